@@ -0,0 +1,824 @@
+// Audio quality of the firmware processing paths, against golden values
+//
+// Test signals go through the processing code of both firmwares built for
+// the host, block by block as the boards run it, and what comes out is
+// measured:
+//   sine -1 dBFS        SNR and THD+N (harmonics to the 9th, below Nyquist)
+//   sine -60 dBFS       THD+N near the bottom, where rounding and dither show
+//   multitone           frequency response at up to a dozen tones, and ripple
+//   log sweep           latency, from the peak of the cross-correlation
+//   silence             noise floor
+//   DC + sine           DC left after 1, 10 and 60 s; for the paths that
+//                       remove DC, how long until it's within 10 LSB and
+//                       what it ends up at
+//   full-scale square   peak and samples at the rails
+//   mains hum           for the paths that cancel it: hum as mic pickup
+//                       has it (a 50 Hz fundamental, strong odd harmonics,
+//                       the grid's frequency wandering) over noise, or
+//                       under tones between the harmonics: how much is
+//                       left once locked, while the frequency drifts and
+//                       steps, how long it takes to lock, and what it does
+//                       to the tones
+// Every output sample also goes into a hash, so a change can be told apart
+// as bit-exact or only within tolerance. After the paths, the speaker's
+// dithered kernels have to give exact zeros when muted and, where the output
+// holds every input bit, the input itself at 0 dB. A full run takes a few
+// seconds.
+//
+//   audio_quality                          compare with audio_golden.txt
+//   audio_quality --exact                  ... and fail if any output changed
+//   audio_quality --update                 write the values as the golden ones
+//   audio_quality --path mic_dc_block -v   one path, every metric
+#include <cerrno>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "hum_notch.h"
+#include "mic_frame.h"
+
+#include "beamformer.h"
+#include "format.h"
+
+namespace {
+
+// ====================== Paths ======================
+
+uint64_t fnv1a(uint64_t h, const void *data, size_t len) {
+  const uint8_t *p = (const uint8_t *)data;
+  for (size_t i = 0; i < len; i++) {
+    h = (h ^ p[i]) * 0x100000001B3ULL;
+  }
+  return h;
+}
+
+// One firmware processing path. Mono PCM16 goes in (both channels of a
+// stereo input get the same samples) and comes out as fractions of full
+// scale; the raw output goes into `hash`.
+class Path {
+public:
+  virtual ~Path() {}
+  virtual const char *name() const = 0;
+  virtual int rate() const = 0;
+  virtual int bits() const { return 16; }
+  virtual bool removes_dc() const { return false; }
+  virtual bool removes_hum() const { return false; }
+  // Frames per block; each call to process() starts a new one
+  virtual size_t block() const = 0;
+  virtual void reset() = 0;
+  virtual void process(const int16_t *in, double *out, size_t n, uint64_t &hash) = 0;
+};
+
+// serial-mic: i2s_reader_task's DC blocker on SAMPLE_BUFFER_SIZE blocks
+class DcBlockPath : public Path {
+public:
+  const char *name() const override { return "mic_dc_block"; }
+  int rate() const override { return 16000; }
+  bool removes_dc() const override { return true; }
+  size_t block() const override { return BLOCK; }
+  void reset() override { dc_est_ = 0; }
+  void process(const int16_t *in, double *out, size_t n, uint64_t &hash) override {
+    for (size_t done = 0; done < n; done += BLOCK) {
+      const int len = (int)(n - done < BLOCK ? n - done : BLOCK);
+      memcpy(buf_, in + done, len * sizeof(int16_t));
+      dc_block_and_copy(&dc_est_, buf_, len);
+      hash = fnv1a(hash, buf_, len * sizeof(int16_t));
+      for (int i = 0; i < len; i++) {
+        out[done + i] = buf_[i] / 32768.0;
+      }
+    }
+  }
+
+private:
+  static constexpr size_t BLOCK = 1024;
+  int32_t dc_est_ = 0;
+  int16_t buf_[BLOCK];
+};
+
+// serial-mic: the DC blocker then the hum canceller, as main.cpp has them
+// with HUM_MAINS_HZ 50
+class MicHumPath : public Path {
+public:
+  const char *name() const override { return "mic_dc_hum"; }
+  int rate() const override { return 16000; }
+  bool removes_dc() const override { return true; }
+  bool removes_hum() const override { return true; }
+  size_t block() const override { return BLOCK; }
+  void reset() override {
+    dc_est_ = 0;
+    hum_init(&hum_, rate(), 50, 8);
+  }
+  void process(const int16_t *in, double *out, size_t n, uint64_t &hash) override {
+    for (size_t done = 0; done < n; done += BLOCK) {
+      const int len = (int)(n - done < BLOCK ? n - done : BLOCK);
+      memcpy(buf_, in + done, len * sizeof(int16_t));
+      dc_block_and_copy(&dc_est_, buf_, len);
+      hum_cancel(&hum_, buf_, len, 1);
+      hash = fnv1a(hash, buf_, len * sizeof(int16_t));
+      for (int i = 0; i < len; i++) {
+        out[done + i] = buf_[i] / 32768.0;
+      }
+    }
+  }
+
+private:
+  static constexpr size_t BLOCK = 1024;
+  int32_t dc_est_ = 0;
+  mic_hum hum_;
+  int16_t buf_[BLOCK];
+};
+
+// usb-audio: the speaker gain for a host volume setting, on 10 ms stereo
+// blocks, to 16 or 24 bit and optionally dithered
+class SpeakerPath : public Path {
+public:
+  SpeakerPath(const char *name, int volume_db, int out_bits, int dither)
+      : name_(name), gain_(format_volume_gain_q16(volume_db)), bits_(out_bits), dither_(dither) {}
+
+  const char *name() const override { return name_; }
+  int rate() const override { return 48000; }
+  int bits() const override { return bits_; }
+  size_t block() const override { return FRAMES; }
+  void reset() override { format_dither_init(&dither_state_, 1, dither_ > 1); }
+  void process(const int16_t *in, double *out, size_t n, uint64_t &hash) override {
+    for (size_t done = 0; done < n; done += FRAMES) {
+      const size_t len = n - done < FRAMES ? n - done : FRAMES;
+      for (size_t i = 0; i < len; i++) {
+        stereo_[2 * i] = stereo_[2 * i + 1] = in[done + i];
+      }
+      if (bits_ == 24) {
+        format_gain_s16_s24(stereo_, out32_, 2 * len, gain_);
+        hash = fnv1a(hash, out32_, 2 * len * sizeof(int32_t));
+        for (size_t i = 0; i < len; i++) {
+          out[done + i] = out32_[2 * i] / 2147483648.0;
+        }
+        continue;
+      }
+      if (dither_) {
+        format_gain_dither_s16_s16(stereo_, out16_, len, 2, gain_, &dither_state_);
+      } else {
+        format_gain_s16_s16(stereo_, out16_, 2 * len, gain_);
+      }
+      hash = fnv1a(hash, out16_, 2 * len * sizeof(int16_t));
+      for (size_t i = 0; i < len; i++) {
+        out[done + i] = out16_[2 * i] / 32768.0;
+      }
+    }
+  }
+
+private:
+  static constexpr size_t FRAMES = 480;
+  const char *name_;
+  uint32_t gain_;
+  int bits_;
+  int dither_; // 0 off, 1 TPDF, 2 TPDF + shaping
+  format_dither_t dither_state_;
+  int16_t stereo_[2 * FRAMES];
+  int16_t out16_[2 * FRAMES];
+  int32_t out32_[2 * FRAMES];
+};
+
+// usb-audio: the mic beamformer looking straight ahead, both mics hearing
+// the same thing, on 10 ms blocks
+class BeamPath : public Path {
+public:
+  BeamPath(const char *name, beam_mode_t mode) : name_(name), mode_(mode) {}
+
+  const char *name() const override { return name_; }
+  int rate() const override { return 48000; }
+  size_t block() const override { return FRAMES; }
+  void reset() override { beamformer_init(&bf_, mode_, rate(), 20, 0); }
+  void process(const int16_t *in, double *out, size_t n, uint64_t &hash) override {
+    for (size_t done = 0; done < n; done += FRAMES) {
+      const size_t len = n - done < FRAMES ? n - done : FRAMES;
+      for (size_t i = 0; i < len; i++) {
+        stereo_[2 * i] = stereo_[2 * i + 1] = in[done + i];
+      }
+      beamformer_process(&bf_, stereo_, mono_, len);
+      hash = fnv1a(hash, mono_, len * sizeof(int16_t));
+      for (size_t i = 0; i < len; i++) {
+        out[done + i] = mono_[i] / 32768.0;
+      }
+    }
+  }
+
+private:
+  static constexpr size_t FRAMES = 480;
+  const char *name_;
+  beam_mode_t mode_;
+  beamformer_t bf_;
+  int16_t stereo_[2 * FRAMES];
+  int16_t mono_[FRAMES];
+};
+
+// usb-audio: the hum canceller on the mic stream (CONFIG_APP_MIC_HUM_CANCEL),
+// one channel of a stereo block so the stride is exercised, on 10 ms blocks
+class UsbHumPath : public Path {
+public:
+  const char *name() const override { return "mic_hum_48k"; }
+  int rate() const override { return 48000; }
+  bool removes_hum() const override { return true; }
+  size_t block() const override { return FRAMES; }
+  void reset() override {
+    for (mic_hum &h : hum_) {
+      hum_init(&h, rate(), 50, 8);
+    }
+  }
+  void process(const int16_t *in, double *out, size_t n, uint64_t &hash) override {
+    for (size_t done = 0; done < n; done += FRAMES) {
+      const size_t len = n - done < FRAMES ? n - done : FRAMES;
+      for (size_t i = 0; i < len; i++) {
+        stereo_[2 * i] = stereo_[2 * i + 1] = in[done + i];
+      }
+      for (int c = 0; c < 2; c++) {
+        hum_cancel(&hum_[c], stereo_ + c, (int)len, 2);
+      }
+      hash = fnv1a(hash, stereo_, 2 * len * sizeof(int16_t));
+      for (size_t i = 0; i < len; i++) {
+        out[done + i] = stereo_[2 * i + 1] / 32768.0;
+      }
+    }
+  }
+
+private:
+  static constexpr size_t FRAMES = 480;
+  mic_hum hum_[2];
+  int16_t stereo_[2 * FRAMES];
+};
+
+// ====================== Signals and measurements ======================
+
+// Analysis length: sines and tones sit exactly on bins of an N point DFT so
+// there is no leakage to window away
+const size_t N = 32768;
+
+std::vector<double> cos_table;
+
+double to_db(double power_ratio) { return 10 * std::log10(power_ratio > 1e-20 ? power_ratio : 1e-20); }
+
+int16_t to_s16(double v) {
+  const double s = std::round(v * 32768);
+  return (int16_t)(s > 32767 ? 32767 : s < -32768 ? -32768 : s);
+}
+
+// Power of bin k over N samples of x
+double bin_power(const double *x, size_t k) {
+  double re = 0, im = 0;
+  size_t phase = 0;
+  for (size_t i = 0; i < N; i++) {
+    re += x[i] * cos_table[phase];
+    im += x[i] * cos_table[(phase + 3 * N / 4) % N]; // sin
+    phase = (phase + k) % N;
+  }
+  re *= 2.0 / N;
+  im *= 2.0 / N;
+  return (re * re + im * im) / 2;
+}
+
+struct Run {
+  Path &path;
+  uint64_t hash = 0xCBF29CE484222325ULL;
+  std::map<std::string, double> metrics;
+
+  explicit Run(Path &p) : path(p) {}
+
+  std::vector<double> through(const std::vector<int16_t> &in) {
+    std::vector<double> out(in.size());
+    path.reset();
+    path.process(in.data(), out.data(), in.size(), hash);
+    return out;
+  }
+};
+
+size_t bin_for(double hz, int rate) { return (size_t)std::lround(hz * N / rate); }
+
+void measure_sine(Run &run, const char *prefix, double level_db, bool snr) {
+  const int rate = run.path.rate();
+  const size_t settle = (size_t)rate / 4;
+  const size_t k = bin_for(997, rate);
+  const double amp = std::pow(10, level_db / 20);
+  std::vector<int16_t> in(settle + N);
+  for (size_t i = 0; i < in.size(); i++) {
+    in[i] = to_s16(amp * cos_table[(k * i + 3 * N / 4) % N]);
+  }
+  const std::vector<double> out = run.through(in);
+  const double *y = out.data() + settle;
+  double mean = 0, total = 0;
+  for (size_t i = 0; i < N; i++) {
+    mean += y[i];
+  }
+  mean /= N;
+  for (size_t i = 0; i < N; i++) {
+    total += (y[i] - mean) * (y[i] - mean);
+  }
+  total /= N;
+  const double signal = bin_power(y, k);
+  double harmonics = 0;
+  for (size_t h = 2; h <= 9 && h * k < N / 2; h++) {
+    harmonics += bin_power(y, h * k);
+  }
+  run.metrics[std::string(prefix) + "_thdn_db"] = to_db((total - signal) / signal);
+  if (snr) {
+    run.metrics[std::string(prefix) + "_snr_db"] = to_db(signal / (total - signal - harmonics));
+  }
+}
+
+void measure_multitone(Run &run) {
+  static const double tones[] = {31.25, 62.5, 125, 250, 500, 1000, 2000, 4000, 6000, 8000, 12000, 16000, 20000};
+  const int rate = run.path.rate();
+  const size_t settle = (size_t)rate / 4;
+  std::vector<size_t> bins;
+  for (double hz : tones) {
+    if (hz < 0.45 * rate) {
+      bins.push_back(bin_for(hz, rate));
+    }
+  }
+  // -26 dBFS each, phases spread so the peaks don't line up
+  std::vector<double> x(settle + N, 0.0);
+  for (size_t t = 0; t < bins.size(); t++) {
+    const size_t offset = (size_t)(N * ((t * t) % bins.size()) / bins.size());
+    for (size_t i = 0; i < x.size(); i++) {
+      x[i] += 0.05 * cos_table[(bins[t] * i + offset) % N];
+    }
+  }
+  std::vector<int16_t> in(x.size());
+  std::vector<double> xq(N);
+  for (size_t i = 0; i < x.size(); i++) {
+    in[i] = to_s16(x[i]);
+    if (i >= settle) {
+      xq[i - settle] = in[i] / 32768.0;
+    }
+  }
+  const std::vector<double> out = run.through(in);
+  double lo = 1e9, hi = -1e9;
+  for (size_t t = 0; t < bins.size(); t++) {
+    const double db = to_db(bin_power(out.data() + settle, bins[t]) / bin_power(xq.data(), bins[t]));
+    char name[48];
+    snprintf(name, sizeof(name), "response_%.0fhz_db", (double)bins[t] * rate / N);
+    run.metrics[name] = db;
+    lo = db < lo ? db : lo;
+    hi = db > hi ? db : hi;
+  }
+  run.metrics["response_ripple_db"] = hi - lo;
+}
+
+void measure_latency(Run &run) {
+  const int rate = run.path.rate();
+  const size_t lead = (size_t)rate / 20, len = (size_t)rate / 2, tail = (size_t)rate / 5;
+  const double f0 = 50, f1 = 0.45 * rate;
+  const double k = std::log(f1 / f0);
+  std::vector<int16_t> in(lead + len + tail, 0);
+  for (size_t i = 0; i < len; i++) {
+    const double t = (double)i / rate, T = (double)len / rate;
+    in[lead + i] = to_s16(0.5 * std::sin(2 * M_PI * f0 * T / k * (std::exp(t / T * k) - 1)));
+  }
+  const std::vector<double> out = run.through(in);
+  const size_t max_lag = 1024;
+  double best = -1;
+  size_t lag = 0;
+  for (size_t l = 0; l <= max_lag; l++) {
+    double c = 0;
+    for (size_t i = lead; i < lead + len && i + l < out.size(); i++) {
+      c += out[i + l] * in[i];
+    }
+    if (std::fabs(c) > best) {
+      best = std::fabs(c);
+      lag = l;
+    }
+  }
+  run.metrics["latency_samples"] = (double)lag;
+}
+
+void measure_silence(Run &run) {
+  const std::vector<int16_t> in((size_t)run.path.rate(), 0);
+  const std::vector<double> out = run.through(in);
+  double power = 0;
+  for (double v : out) {
+    power += v * v;
+  }
+  run.metrics["silence_dbfs"] = to_db(power / out.size());
+}
+
+// 2000 LSB of DC plus a 200 Hz sine at -20 dBFS, streamed in 0.1 s chunks
+// (each a whole number of the sine's periods, so a chunk's mean is its DC).
+// The serial-mic blocker moves 1/2^LERP_SHIFT of the way per 64 ms block,
+// so it takes minutes: it gets 20 minutes of audio, and what's left over
+// the last one is its floor.
+void measure_dc(Run &run) {
+  const int rate = run.path.rate();
+  const size_t chunk = (size_t)rate / 10;
+  const size_t chunks = run.path.removes_dc() ? 12000 : 110;
+  // fed in whole blocks, however they line up with the chunks
+  size_t piece = chunk;
+  while (piece % run.path.block()) {
+    piece += chunk;
+  }
+  std::vector<int16_t> in(piece);
+  for (size_t i = 0; i < piece; i++) {
+    in[i] = to_s16(2000.0 / 32768 + 0.1 * std::sin(2 * M_PI * 200 * (double)i / rate));
+  }
+  std::vector<double> out(piece);
+  run.path.reset();
+  double last_over = 0, floor = 0;
+  for (size_t c = 0; c < chunks; c++) {
+    if (c % (piece / chunk) == 0) {
+      run.path.process(in.data(), out.data(), piece, run.hash);
+    }
+    double mean = 0;
+    for (size_t i = 0; i < chunk; i++) {
+      mean += out[c % (piece / chunk) * chunk + i];
+    }
+    const double lsb = mean / chunk * 32768;
+    if (c == 10 || c == 100 || (c == 600 && run.path.removes_dc())) {
+      char name[32];
+      snprintf(name, sizeof(name), "dc_%zus_lsb", c / 10);
+      run.metrics[name] = lsb;
+    }
+    if (std::fabs(lsb) >= 10) {
+      last_over = (double)(c + 1) / 10;
+    }
+    if (c >= chunks - 600) {
+      floor += lsb / 600;
+    }
+  }
+  if (run.path.removes_dc()) {
+    // under 0.5% of the step for good, or -1 if it never got there
+    run.metrics["dc_settle_s"] = last_over >= chunks / 10.0 ? -1 : last_over;
+    run.metrics["dc_floor_lsb"] = floor;
+  }
+}
+
+void measure_square(Run &run) {
+  const int rate = run.path.rate();
+  const size_t period = (size_t)rate / 100;
+  std::vector<int16_t> in((size_t)rate);
+  for (size_t i = 0; i < in.size(); i++) {
+    in[i] = i % period < period / 2 ? 32767 : -32768;
+  }
+  const std::vector<double> out = run.through(in);
+  const double rail = 1.0 - 1.0 / (double)(1u << (run.path.bits() - 1)) - 1e-12;
+  double peak = 0;
+  size_t clipped = 0;
+  for (size_t i = in.size() / 2; i < in.size(); i++) {
+    const double a = std::fabs(out[i]);
+    peak = a > peak ? a : peak;
+    clipped += a >= rail;
+  }
+  run.metrics["square_peak"] = peak;
+  run.metrics["square_railed"] = (double)clipped;
+}
+
+// Mains hum as a mic picks it up: a fundamental near 50 Hz, odd harmonics
+// strongest as a rectifier's load draws them, in LSB
+const double HUM_LSB[8] = {400, 60, 250, 30, 120, 15, 60, 10};
+
+// Hum at a frequency that moves as `hz(t)`, with white noise (20 LSB rms)
+// and `program` under it. `hum` and `rest` get what went in, apart.
+template <typename F>
+std::vector<int16_t> hum_signal(int rate, double seconds, F hz, const std::vector<double> &program,
+                                std::vector<double> &hum, std::vector<double> &rest) {
+  const size_t n = (size_t)(seconds * rate);
+  std::vector<int16_t> in(n);
+  hum.assign(n, 0);
+  rest.assign(n, 0);
+  uint32_t seed = 12345;
+  double phase = 0;
+  for (size_t i = 0; i < n; i++) {
+    for (int h = 0; h < 8; h++) {
+      hum[i] += HUM_LSB[h] * std::sin((h + 1) * phase + h);
+    }
+    phase += 2 * M_PI * hz((double)i / rate) / rate;
+    phase = std::fmod(phase, 2 * M_PI);
+    // two uniforms make a triangle: 20 LSB rms
+    seed = seed * 1664525 + 1013904223;
+    double noise = (seed >> 8) / 16777216.0;
+    seed = seed * 1664525 + 1013904223;
+    noise += (seed >> 8) / 16777216.0 - 1;
+    noise *= 20 * std::sqrt(6.0);
+    const double x = hum[i] + noise + (i < program.size() ? program[i] : 0);
+    in[i] = to_s16(x / 32768);
+    rest[i] = in[i] - hum[i];
+  }
+  return in;
+}
+
+// Power of what came out less `rest`, over [from, to) seconds, against the hum
+double hum_left_db(const std::vector<double> &out, const std::vector<double> &hum, const std::vector<double> &rest,
+                   int rate, double from, double to) {
+  double left = 0, power = 0;
+  for (size_t i = (size_t)(from * rate); i < (size_t)(to * rate) && i < out.size(); i++) {
+    const double e = out[i] * 32768 - rest[i];
+    left += e * e;
+    power += hum[i] * hum[i];
+  }
+  return to_db(left / power);
+}
+
+// When what's left of the hum is under -30 dB for good after `from`, in
+// 0.1 s windows, seconds after it; -1 if never
+double hum_lock_s(const std::vector<double> &out, const std::vector<double> &hum, const std::vector<double> &rest,
+                  int rate, double from, double to) {
+  double last_over = from;
+  for (double t = from; t + 0.1 <= to + 1e-9; t += 0.1) {
+    if (hum_left_db(out, hum, rest, rate, t, t + 0.1) >= -30) {
+      last_over = t + 0.1;
+    }
+  }
+  return last_over >= to - 1e-9 ? -1 : last_over - from;
+}
+
+// Steady hum at 50.2 Hz; hum wandering +-0.05 Hz over 30 s (0.01 Hz/s at
+// most, a grid on a bad day), then stepping 0.3 Hz (more than a grid does,
+// so it shows how it comes back); steady hum
+// under four -26 dBFS tones between the harmonics, where what is left of the
+// hum and whatever the tones lost count against the tones.
+void measure_hum(Run &run) {
+  const int rate = run.path.rate();
+  std::vector<double> hum, rest;
+
+  std::vector<int16_t> in = hum_signal(rate, 20, [](double) { return 50.2; }, {}, hum, rest);
+  std::vector<double> out = run.through(in);
+  run.metrics["hum_lock_s"] = hum_lock_s(out, hum, rest, rate, 0, 20);
+  run.metrics["hum_steady_db"] = hum_left_db(out, hum, rest, rate, 15, 20);
+
+  in = hum_signal(rate, 50,
+                  [](double t) { return t < 40 ? 50 + 0.05 * std::sin(2 * M_PI * t / 30) : 50.3; }, {}, hum, rest);
+  out = run.through(in);
+  run.metrics["hum_drift_db"] = hum_left_db(out, hum, rest, rate, 10, 40);
+  run.metrics["hum_relock_s"] = hum_lock_s(out, hum, rest, rate, 40, 50);
+
+  static const double tones[] = {75, 175, 1000, 2470};
+  std::vector<double> program((size_t)(20 * rate), 0.0);
+  for (size_t t = 0; t < 4; t++) {
+    for (size_t i = 0; i < program.size(); i++) {
+      program[i] += 0.05 * 32768 * std::sin(2 * M_PI * tones[t] * i / rate + t);
+    }
+  }
+  in = hum_signal(rate, 20, [](double) { return 50.2; }, program, hum, rest);
+  out = run.through(in);
+  double error = 0, power = 0;
+  for (size_t i = 15 * (size_t)rate; i < out.size(); i++) {
+    const double e = out[i] * 32768 - rest[i];
+    error += e * e;
+    power += program[i] * program[i];
+  }
+  run.metrics["hum_program_error_db"] = to_db(error / power);
+}
+
+void measure(Run &run) {
+  measure_sine(run, "sine", -1, true);
+  measure_sine(run, "sine_low", -60, false);
+  measure_multitone(run);
+  measure_latency(run);
+  measure_silence(run);
+  measure_dc(run);
+  measure_square(run);
+  if (run.path.removes_hum()) {
+    measure_hum(run);
+  }
+}
+
+// How far a metric may move before it's a regression
+double default_tolerance(const std::string &metric) {
+  if (metric.compare(0, 9, "response_") == 0) {
+    return 0.05;
+  }
+  if (metric == "latency_samples" || metric == "square_railed") {
+    return 0;
+  }
+  if (metric.compare(0, 3, "dc_") == 0) {
+    return metric == "dc_settle_s" ? 1 : metric == "dc_floor_lsb" ? 0.25 : 0.5;
+  }
+  if (metric == "hum_lock_s" || metric == "hum_relock_s") {
+    return 0.5;
+  }
+  if (metric == "square_peak") {
+    return 0.001;
+  }
+  return 0.5; // SNR, THD+N and noise in dB
+}
+
+// ====================== Golden values ======================
+
+struct Golden {
+  double value;
+  double tolerance;
+};
+
+struct GoldenFile {
+  std::map<std::string, std::string> hash;             // path -> hex
+  std::map<std::string, std::map<std::string, Golden>> values; // path -> metric
+};
+
+bool read_golden(const char *path, GoldenFile &g) {
+  FILE *f = fopen(path, "r");
+  if (!f) {
+    fprintf(stderr, "can't open %s: %s\n", path, strerror(errno));
+    return false;
+  }
+  char line[256];
+  while (fgets(line, sizeof(line), f)) {
+    char p[64], metric[64], value[64];
+    double tolerance = 0;
+    if (line[0] == '#' || sscanf(line, "%63s %63s %63s %lf", p, metric, value, &tolerance) < 3) {
+      continue;
+    }
+    if (!strcmp(metric, "hash")) {
+      g.hash[p] = value;
+    } else {
+      g.values[p][metric] = {atof(value), tolerance};
+    }
+  }
+  fclose(f);
+  return true;
+}
+
+bool write_golden(const char *path, const std::vector<Run> &runs, const GoldenFile &old) {
+  FILE *f = fopen(path, "w");
+  if (!f) {
+    fprintf(stderr, "can't write %s: %s\n", path, strerror(errno));
+    return false;
+  }
+  fprintf(f, "# Golden values for bench/audio_quality. `audio_quality --update` rewrites\n"
+             "# the values and keeps the tolerances, which can be edited by hand.\n"
+             "# path               metric                    value   tolerance\n");
+  for (const Run &run : runs) {
+    fprintf(f, "%-20s %-22s %016llx\n", run.path.name(), "hash", (unsigned long long)run.hash);
+    for (const auto &m : run.metrics) {
+      double tolerance = default_tolerance(m.first);
+      auto p = old.values.find(run.path.name());
+      if (p != old.values.end() && p->second.count(m.first)) {
+        tolerance = p->second.at(m.first).tolerance;
+      }
+      fprintf(f, "%-20s %-22s %10.4f  %g\n", run.path.name(), m.first.c_str(), m.second, tolerance);
+    }
+  }
+  fclose(f);
+  return true;
+}
+
+// ====================== Dither bypass ======================
+// The speaker's dithered kernels at a gain of 0 (mute) and unity, where
+// nothing is requantised: mute has to be exact zeros and 0 dB the input
+// itself, however far the dither's noise shaping had got. Exact, so no
+// golden values.
+template <class In, class Out, class Kernel>
+int check_bypass(const char *name, Kernel kernel, int shift, bool unity) {
+  const size_t frames = 2400;
+  std::vector<In> in(2 * frames);
+  uint32_t rng = 12345;
+  for (auto &v : in) {
+    rng = rng * 1664525u + 1013904223u;
+    v = (In)((int32_t)rng >> (32 - 8 * (int)sizeof(In)));
+  }
+  std::vector<Out> out(in.size());
+  format_dither_t dither;
+  format_dither_init(&dither, 1, true);
+  // a block at -6 dB first, so there's shaped error to carry over
+  kernel(in.data(), out.data(), frames, 2, format_volume_gain_q16(-6), &dither);
+  int wrong = 0;
+  kernel(in.data(), out.data(), frames, 2, 0, &dither);
+  for (size_t i = 0; i < out.size(); i++) {
+    wrong += out[i] != 0;
+  }
+  printf("%-22s mute %d of %zu samples nonzero", name, wrong, out.size());
+  int bad = wrong;
+  if (unity) {
+    wrong = 0;
+    kernel(in.data(), out.data(), frames, 2, FORMAT_GAIN_UNITY, &dither);
+    for (size_t i = 0; i < out.size(); i++) {
+      wrong += (int64_t)out[i] != (int64_t)in[i] * ((int64_t)1 << shift);
+    }
+    printf(", 0 dB %d changed", wrong);
+    bad += wrong;
+  }
+  printf("%s\n", bad ? "  FAILED" : "");
+  return bad ? 1 : 0;
+}
+
+int check_dither_bypass() {
+  int failed = 0;
+  failed += check_bypass<int16_t, int16_t>("dither_s16_s16", format_gain_dither_s16_s16, 0, true);
+  failed += check_bypass<int16_t, int32_t>("dither_s16_s24", format_gain_dither_s16_s24, 16, true);
+  failed += check_bypass<int32_t, int16_t>("dither_s32_s16", format_gain_dither_s32_s16, 0, false);
+  failed += check_bypass<int32_t, int32_t>("dither_s32_s24", format_gain_dither_s32_s24, 0, false);
+  failed += check_bypass<int32_t, int32_t>("dither_s32_s32", format_gain_dither_s32_s32, 0, true);
+  return failed;
+}
+
+void usage() {
+  fprintf(stderr, "usage: audio_quality [--golden FILE] [--update] [--exact] [--path NAME] [-v]\n");
+  exit(1);
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  const char *golden_path = GOLDEN_FILE;
+  bool update = false, exact = false, verbose = false;
+  const char *only = nullptr;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--golden") && i + 1 < argc) {
+      golden_path = argv[++i];
+    } else if (!strcmp(argv[i], "--path") && i + 1 < argc) {
+      only = argv[++i];
+    } else if (!strcmp(argv[i], "--update")) {
+      update = true;
+    } else if (!strcmp(argv[i], "--exact")) {
+      exact = true;
+    } else if (!strcmp(argv[i], "-v")) {
+      verbose = true;
+    } else {
+      usage();
+    }
+  }
+
+  cos_table.resize(N);
+  for (size_t i = 0; i < N; i++) {
+    cos_table[i] = std::cos(2 * M_PI * (double)i / N);
+  }
+
+  std::vector<std::unique_ptr<Path>> paths;
+  paths.emplace_back(new DcBlockPath);
+  paths.emplace_back(new SpeakerPath("speaker_0db", 0, 16, 0));
+  paths.emplace_back(new SpeakerPath("speaker_-6db", -6, 16, 0));
+  paths.emplace_back(new SpeakerPath("speaker_-6db_s24", -6, 24, 0));
+  paths.emplace_back(new SpeakerPath("speaker_-6db_dither", -6, 16, 1));
+  paths.emplace_back(new SpeakerPath("speaker_-6db_shaped", -6, 16, 2));
+  paths.emplace_back(new BeamPath("mic_beam_das", BEAM_DELAY_SUM));
+  paths.emplace_back(new BeamPath("mic_beam_mvdr", BEAM_MVDR));
+  paths.emplace_back(new MicHumPath);
+  paths.emplace_back(new UsbHumPath);
+
+  std::vector<Run> runs;
+  for (auto &p : paths) {
+    if (!only || !strcmp(only, p->name())) {
+      runs.emplace_back(*p);
+      measure(runs.back());
+    }
+  }
+  if (runs.empty()) {
+    fprintf(stderr, "no path called %s\n", only);
+    return 1;
+  }
+
+  GoldenFile golden;
+  const bool have_golden = read_golden(golden_path, golden);
+  if (update) {
+    if (only) {
+      fprintf(stderr, "--update rewrites every path, leave out --path\n");
+      return 1;
+    }
+    if (!write_golden(golden_path, runs, golden)) {
+      return 1;
+    }
+    printf("wrote %s\n", golden_path);
+    return 0;
+  }
+  if (!have_golden) {
+    return 1;
+  }
+
+  int failed = 0, changed = 0;
+  for (const Run &run : runs) {
+    const char *name = run.path.name();
+    char hex[20];
+    snprintf(hex, sizeof(hex), "%016llx", (unsigned long long)run.hash);
+    const bool same = golden.hash.count(name) && golden.hash[name] == hex;
+    int bad = 0;
+    if (verbose) {
+      printf("%s\n", name);
+    }
+    for (const auto &m : run.metrics) {
+      auto p = golden.values.find(name);
+      if (p == golden.values.end() || !p->second.count(m.first)) {
+        printf("  %-22s %10.4f  (no golden value)\n", m.first.c_str(), m.second);
+        bad++;
+        continue;
+      }
+      const Golden &g = p->second.at(m.first);
+      const bool ok = std::fabs(m.second - g.value) <= g.tolerance + 1e-9;
+      if (!ok || verbose) {
+        printf("  %-22s %10.4f  golden %10.4f +-%g%s\n", m.first.c_str(), m.second, g.value, g.tolerance,
+               ok ? "" : "  FAIL");
+      }
+      bad += !ok;
+    }
+    printf("%-22s %s\n", name,
+           bad ? "FAILED" : same ? "bit-exact" : exact ? "FAILED: output changed" : "output changed, within tolerance");
+    failed += bad || (exact && !same);
+    changed += !same;
+  }
+  printf("\n");
+  const int bypass_failed = only ? 0 : check_dither_bypass();
+  printf("\n%zu paths: %d bit-exact, %d changed, %d failed%s\n", runs.size(), (int)runs.size() - changed, changed,
+         failed, bypass_failed ? "; dither bypass FAILED" : "");
+  failed += bypass_failed;
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,129 @@
+#!/usr/bin/env python3
+"""Compare kernel_bench results with the committed baseline.
+
+Times are CPU time divided by BM_Calibrate's from the same run: what's
+compared is how long a kernel takes against a fixed loop of integer
+arithmetic, not the raw nanoseconds. That takes out the clock speed but not
+the memory system or the vector units, so the memory bound and vectorised
+kernels only compare on the machine class the baseline came from (its
+"host" block, which is checked against the results). With
+--benchmark_repetitions the fastest repetition is used: on a shared machine
+other work only ever makes a run slower.
+
+    kernel_bench --benchmark_repetitions=5 --benchmark_out=results.json
+    check_baseline.py results.json                    # exits 1 on a regression
+    check_baseline.py results.json --update           # rewrite the baseline
+    check_baseline.py run1.json run2.json --update    # the fastest of several runs
+    check_baseline.py results.json --report-only      # print the comparison, never fail
+
+A kernel more than --threshold slower than its baseline is a regression;
+one more than --threshold faster is reported so the baseline can be moved
+up to it. Benchmarks only in one of the two are listed but don't fail.
+"""
+import argparse
+import json
+import os
+import sys
+
+CALIBRATION = "BM_Calibrate"
+UNITS = {"ns": 1.0, "us": 1e3, "ms": 1e6, "s": 1e9}
+
+
+def load_results(paths):
+    """Benchmark name -> CPU ns, the fastest of all the repetitions."""
+    times, context = {}, {}
+    for path in paths:
+        with open(path) as f:
+            data = json.load(f)
+        context = data.get("context", context)
+        add_times(times, data)
+    return times, context
+
+
+def add_times(times, data):
+    for b in data.get("benchmarks", []):
+        if b.get("error_occurred") or b.get("run_type") == "aggregate":
+            continue
+        ns = b["cpu_time"] * UNITS[b.get("time_unit", "ns")]
+        name = b.get("run_name", b["name"])
+        times[name] = min(ns, times.get(name, ns))
+
+
+def describe(host):
+    return ", ".join(f"{k} {v}" for k, v in host.items())
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("results", nargs="+", help="kernel_bench --benchmark_out JSON")
+    parser.add_argument("--baseline", default=os.path.join(os.path.dirname(os.path.abspath(__file__)), "baseline.json"))
+    parser.add_argument("--threshold", type=float, default=0.25, help="allowed slowdown, 0.25 = 25%%")
+    parser.add_argument("--update", action="store_true", help="write the results as the new baseline")
+    parser.add_argument("--report-only", action="store_true", help="exit 0 whatever the comparison shows")
+    args = parser.parse_args()
+
+    times, context = load_results(args.results)
+    if CALIBRATION not in times:
+        sys.exit(f"no {CALIBRATION} in the results, can't scale the times")
+    calibration = times[CALIBRATION]
+    relative = {name: ns / calibration for name, ns in times.items() if name != CALIBRATION}
+
+    if args.update:
+        baseline = {
+            "calibration_ns": round(calibration, 1),
+            "host": {k: context.get(k) for k in ("host_name", "num_cpus", "mhz_per_cpu", "library_build_type")},
+            "benchmarks": {name: {"cpu_ns": round(times[name], 2), "relative": round(r, 7)}
+                           for name, r in sorted(relative.items())},
+        }
+        with open(args.baseline, "w") as f:
+            json.dump(baseline, f, indent=1)
+            f.write("\n")
+        print(f"wrote {args.baseline}: {len(relative)} benchmarks, calibration {calibration:.0f} ns")
+        return 0
+
+    with open(args.baseline) as f:
+        recorded = json.load(f)
+    baseline = recorded["benchmarks"]
+
+    slower, faster = [], []
+    print(f"calibration {calibration:.0f} ns, threshold {args.threshold:.0%}")
+    host = {k: context.get(k) for k in recorded.get("host", {})}
+    if host != recorded.get("host", host):
+        print(f"baseline host {describe(recorded['host'])}")
+        print(f"this host     {describe(host)} - expect the memory bound kernels to differ")
+    if context.get("library_build_type") == "debug":
+        print("libbenchmark is a debug build, its timing loop adds to the smallest kernels")
+    print()
+    print(f"{'benchmark':<44} {'cpu ns':>12} {'baseline':>8}")
+    for name in sorted(set(baseline) & set(relative)):
+        change = relative[name] / baseline[name]["relative"] - 1
+        mark = ""
+        if change > args.threshold:
+            slower.append(name)
+            mark = "  SLOWER"
+        elif change < -args.threshold:
+            faster.append(name)
+            mark = "  faster"
+        print(f"{name:<44} {times[name]:>12.1f} {change:>+8.1%}{mark}")
+
+    for name in sorted(set(baseline) - set(relative)):
+        print(f"{name:<44} {'':>12} {'missing':>8}")
+    for name in sorted(set(relative) - set(baseline)):
+        print(f"{name:<44} {times[name]:>12.1f} {'new':>8}")
+
+    if faster:
+        print(f"\n{len(faster)} faster than the baseline - run with --update to keep the gain")
+    if slower:
+        print(f"\n{len(slower)} slower than the baseline by more than {args.threshold:.0%}:")
+        for name in slower:
+            print(f"  {name}")
+        if args.report_only:
+            print("report only, not failing")
+            return 0
+        return 1
+    print("\nno regressions")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,434 @@
+// Microbenchmarks of the audio hot paths of both firmwares, built for the host
+//
+// Each kernel is timed over a sweep of block sizes, and of sample rates
+// where its cost depends on the rate:
+//   serial-mic  CRC-16 (the firmware's bit loop and the host's table), the
+//               DC blocker, the hum canceller (also on the usb-audio mic),
+//               framing a buffer into a packet, and the host parser taking
+//               a stream of them apart
+//   usb-audio   speaker gain and format conversion (plain and dithered),
+//               the DSP chain, both beamformers, sidetone and concealment
+// plus a fixed reference loop (BM_Calibrate) that check_baseline.py divides
+// everything by, so a baseline from one machine means something on another.
+//
+// Besides the time, every benchmark reports samples (or bytes) per second
+// and "realtime": seconds of audio processed per second, for the rate
+// swept or the firmware's own.
+//
+//   kernel_bench --benchmark_filter=Dc --benchmark_out=results.json
+#include <benchmark/benchmark.h>
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "hum_notch.h"
+#include "mic_frame.h"
+#include "mic_slm.h"
+#include "packet.h"
+
+#include "beamformer.h"
+#include "dsp_chain.h"
+#include "format.h"
+#include "plc.h"
+#include "sidetone.h"
+
+namespace {
+
+uint32_t rng = 12345;
+uint32_t rand32() {
+  rng = rng * 1664525u + 1013904223u;
+  return rng;
+}
+
+// A tone, some noise and a DC offset, like a PDM mic
+std::vector<int16_t> make_audio(size_t n, int rate, int channels = 1) {
+  std::vector<int16_t> pcm(n * channels);
+  for (size_t i = 0; i < n; i++) {
+    const double s = 8000 * std::sin(2 * M_PI * 440 * i / rate);
+    for (int c = 0; c < channels; c++) {
+      pcm[i * channels + c] = (int16_t)(s + (int)(rand32() % 1024) - 512 + 200 * c + 300);
+    }
+  }
+  return pcm;
+}
+
+// items are samples; realtime is seconds of audio per second of CPU
+void report(benchmark::State &state, size_t samples, int rate) {
+  state.SetItemsProcessed((int64_t)state.iterations() * (int64_t)samples);
+  state.counters["realtime"] =
+      benchmark::Counter((double)samples / rate, benchmark::Counter::kIsIterationInvariantRate);
+}
+
+const int SERIAL_MIC_RATE = 16000;
+const int SPEAKER_RATE = 48000;
+
+// ====================== Reference ======================
+
+// A dependent chain of integer multiplies and adds: scales with the core's
+// clock and little else
+void BM_Calibrate(benchmark::State &state) {
+  for (auto _ : state) {
+    uint32_t x = 1;
+    for (int i = 0; i < 100000; i++) {
+      x = x * 1664525u + 1013904223u;
+    }
+    benchmark::DoNotOptimize(x);
+  }
+}
+BENCHMARK(BM_Calibrate);
+
+// ====================== serial-mic ======================
+
+// Block sizes in samples around SAMPLE_BUFFER_SIZE
+#define SERIAL_MIC_SWEEP RangeMultiplier(4)->Range(64, 4096)
+
+// Random bytes, 256K of them. The CRC benchmarks walk through it a packet at
+// a time: over the same few bytes again and again the host's branch
+// predictor learns the bit loop's branches and it looks several times
+// faster than it is.
+const std::vector<uint8_t> &random_bytes() {
+  static std::vector<uint8_t> bytes;
+  if (bytes.empty()) {
+    bytes.resize(256 * 1024);
+    for (auto &b : bytes) {
+      b = (uint8_t)(rand32() >> 24);
+    }
+  }
+  return bytes;
+}
+
+template <uint16_t (*crc)(const uint8_t *, size_t)>
+void bench_crc(benchmark::State &state) {
+  const size_t len = MIC_PKT_HEADER_LEN + (size_t)state.range(0) * 2;
+  const std::vector<uint8_t> &bytes = random_bytes();
+  size_t off = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(crc(bytes.data() + off, len));
+    off = off + 2 * len <= bytes.size() ? off + len : 0;
+  }
+  state.SetBytesProcessed((int64_t)state.iterations() * (int64_t)len);
+}
+
+uint16_t crc_table(const uint8_t *data, size_t len) { return serialmic::crc16_ccitt(data, len); }
+
+void BM_Crc16Bitwise(benchmark::State &state) { bench_crc<::crc16_ccitt>(state); }
+BENCHMARK(BM_Crc16Bitwise)->SERIAL_MIC_SWEEP;
+
+void BM_Crc16Table(benchmark::State &state) { bench_crc<crc_table>(state); }
+BENCHMARK(BM_Crc16Table)->SERIAL_MIC_SWEEP;
+
+void BM_DcBlock(benchmark::State &state) {
+  const int n = (int)state.range(0);
+  const std::vector<int16_t> audio = make_audio((size_t)n, SERIAL_MIC_RATE);
+  std::vector<int16_t> buf(audio);
+  int32_t dc_est = 0;
+  for (auto _ : state) {
+    // the blocker works in place; the copy is a fraction of its cost
+    memcpy(buf.data(), audio.data(), n * sizeof(int16_t));
+    dc_block_and_copy(&dc_est, buf.data(), n);
+    benchmark::ClobberMemory();
+  }
+  report(state, (size_t)n, SERIAL_MIC_RATE);
+}
+BENCHMARK(BM_DcBlock)->SERIAL_MIC_SWEEP;
+
+// 1024 sample blocks of hum at 50.2 Hz under the usual audio, against the
+// number of harmonics cancelled; its cost is per sample, so the rate only
+// changes how many harmonics fit and the realtime figure
+void BM_HumCancel(benchmark::State &state) {
+  const int harmonics = (int)state.range(0);
+  const int rate = (int)state.range(1);
+  const int n = 1024;
+  std::vector<int16_t> audio = make_audio((size_t)n * 64, rate);
+  for (size_t i = 0; i < audio.size(); i++) {
+    audio[i] += (int16_t)(300 * std::sin(2 * M_PI * 50.2 * i / rate) + 150 * std::sin(2 * M_PI * 150.6 * i / rate));
+  }
+  static mic_hum hum;
+  hum_init(&hum, rate, 50, harmonics);
+  std::vector<int16_t> buf((size_t)n);
+  size_t off = 0;
+  for (auto _ : state) {
+    memcpy(buf.data(), audio.data() + off, n * sizeof(int16_t));
+    hum_cancel(&hum, buf.data(), n, 1);
+    benchmark::ClobberMemory();
+    off = off + 2 * n <= audio.size() ? off + n : 0;
+  }
+  report(state, (size_t)n, rate);
+}
+BENCHMARK(BM_HumCancel)->ArgsProduct({{1, 4, 8, 16}, {16000, 48000}})->ArgNames({"harmonics", "rate"});
+
+// The serial-mic's sound level meter on blocks as the I2S reads hand them
+// over: 25 1/3 octave bands (most on decimated audio), A and C weighting, and
+// a band level packet every second of audio
+void BM_SoundLevelMeter(benchmark::State &state) {
+  const int n = (int)state.range(0);
+  const int rate = (int)state.range(1);
+  const std::vector<int16_t> audio = make_audio((size_t)n * 64, rate);
+  static mic_slm slm;
+  slm_init(&slm, rate, (uint32_t)rate);
+  uint8_t pkt[MIC_LEVELS_MAX_LEN];
+  size_t off = 0;
+  for (auto _ : state) {
+    for (int done = 0; done < n;) {
+      done += slm_process(&slm, audio.data() + off + done, n - done);
+      if (slm_ready(&slm)) {
+        benchmark::DoNotOptimize(slm_frame_levels(pkt, &slm, 0, 0, 1));
+      }
+    }
+    off = off + 2 * n <= audio.size() ? off + n : 0;
+  }
+  report(state, (size_t)n, rate);
+}
+BENCHMARK(BM_SoundLevelMeter)->ArgsProduct({{256, 1024}, {16000, 48000}})->ArgNames({"samples", "rate"});
+
+void BM_FramePacket(benchmark::State &state) {
+  const int n = (int)state.range(0);
+  const bool crc = state.range(1) != 0;
+  const std::vector<int16_t> audio = make_audio((size_t)n, SERIAL_MIC_RATE);
+  std::vector<uint8_t> out(MIC_PKT_HEADER_LEN + n * 2 + MIC_PKT_TRAILER_LEN);
+  uint32_t seq = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(frame_packet(out.data(), seq, seq * 64000u, audio.data(), n, crc));
+    seq++;
+  }
+  report(state, (size_t)n, SERIAL_MIC_RATE);
+}
+BENCHMARK(BM_FramePacket)->ArgsProduct({{64, 256, 1024, 4096}, {0, 1}})->ArgNames({"samples", "crc"});
+
+// A stream of 64 packets of `samples` each, parsed in 16K reads
+void BM_ParsePackets(benchmark::State &state) {
+  const size_t n = (size_t)state.range(0);
+  const bool verify = state.range(1) != 0;
+  const std::vector<int16_t> audio = make_audio(n, SERIAL_MIC_RATE);
+  std::vector<uint8_t> stream;
+  std::vector<uint8_t> pkt(serialmic::PKT_OVERHEAD + n * 2);
+  for (uint32_t i = 0; i < 64; i++) {
+    const size_t len = serialmic::encode_packet(pkt.data(), i, i * 64000u, audio.data(), n);
+    stream.insert(stream.end(), pkt.begin(), pkt.begin() + len);
+  }
+  struct Count {
+    uint64_t packets = 0;
+    void on_packet(const serialmic::Packet &) { packets++; }
+    void on_crc_error(uint64_t) {}
+  };
+  serialmic::PacketParser parser(verify);
+  Count count;
+  for (auto _ : state) {
+    for (size_t off = 0; off < stream.size(); off += 16384) {
+      const size_t len = stream.size() - off < 16384 ? stream.size() - off : 16384;
+      parser.feed(stream.data() + off, len, count);
+    }
+  }
+  if (count.packets != 64 * (uint64_t)state.iterations()) {
+    state.SkipWithError("packets went missing");
+  }
+  report(state, 64 * n, SERIAL_MIC_RATE);
+}
+BENCHMARK(BM_ParsePackets)->ArgsProduct({{64, 256, 1024, 4096}, {0, 1}})->ArgNames({"samples", "crc"});
+
+// ====================== usb-audio ======================
+
+// Frames per block: a 1 ms UAC interval at 48 kHz up to a 1024 frame DMA
+// buffer, at both the rates the project builds for
+#define USB_AUDIO_SWEEP ArgsProduct({{48, 256, 1024}, {16000, 48000}})->ArgNames({"frames", "rate"})
+
+// The speaker gain for the host's volume at -6 dB
+uint32_t speaker_gain_q16() { return format_volume_gain_q16(-6); }
+
+void BM_GainS16(benchmark::State &state) {
+  const size_t frames = (size_t)state.range(0);
+  const std::vector<int16_t> in = make_audio(frames, SPEAKER_RATE, 2);
+  std::vector<int16_t> out(in.size());
+  const uint32_t gain = speaker_gain_q16();
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(format_gain_s16_s16(in.data(), out.data(), in.size(), gain));
+    benchmark::ClobberMemory();
+  }
+  report(state, in.size(), SPEAKER_RATE * 2);
+}
+BENCHMARK(BM_GainS16)->Arg(48)->Arg(256)->Arg(1024)->ArgName("frames");
+
+void BM_GainS16ToS32(benchmark::State &state) {
+  const size_t frames = (size_t)state.range(0);
+  const std::vector<int16_t> in = make_audio(frames, SPEAKER_RATE, 2);
+  std::vector<int32_t> out(in.size());
+  const uint32_t gain = speaker_gain_q16();
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(format_gain_s16_s32(in.data(), out.data(), in.size(), gain));
+    benchmark::ClobberMemory();
+  }
+  report(state, in.size(), SPEAKER_RATE * 2);
+}
+BENCHMARK(BM_GainS16ToS32)->Arg(48)->Arg(256)->Arg(1024)->ArgName("frames");
+
+void BM_GainS32ToS16(benchmark::State &state) {
+  const size_t frames = (size_t)state.range(0);
+  const std::vector<int16_t> audio = make_audio(frames, SPEAKER_RATE, 2);
+  std::vector<int32_t> in(audio.size());
+  for (size_t i = 0; i < in.size(); i++) {
+    in[i] = (int32_t)audio[i] << 16 | (int32_t)(rand32() & 0xFFFF);
+  }
+  std::vector<int16_t> out(in.size());
+  const uint32_t gain = speaker_gain_q16();
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(format_gain_s32_s16(in.data(), out.data(), in.size(), gain));
+    benchmark::ClobberMemory();
+  }
+  report(state, in.size(), SPEAKER_RATE * 2);
+}
+BENCHMARK(BM_GainS32ToS16)->Arg(48)->Arg(256)->Arg(1024)->ArgName("frames");
+
+void BM_GainDitherS16(benchmark::State &state) {
+  const size_t frames = (size_t)state.range(0);
+  const bool shape = state.range(1) != 0;
+  const std::vector<int16_t> in = make_audio(frames, SPEAKER_RATE, 2);
+  std::vector<int16_t> out(in.size());
+  const uint32_t gain = speaker_gain_q16();
+  format_dither_t dither;
+  format_dither_init(&dither, 1, shape);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(format_gain_dither_s16_s16(in.data(), out.data(), frames, 2, gain, &dither));
+    benchmark::ClobberMemory();
+  }
+  report(state, in.size(), SPEAKER_RATE * 2);
+}
+BENCHMARK(BM_GainDitherS16)->ArgsProduct({{48, 256, 1024}, {0, 1}})->ArgNames({"frames", "shape"});
+
+// ---- DSP chain ----
+
+struct Descriptor {
+  std::vector<uint8_t> data;
+
+  void put8(uint8_t v) { data.push_back(v); }
+  void put16(uint16_t v) {
+    put8(v & 0xFF);
+    put8(v >> 8);
+  }
+  void put_f32(float f) {
+    uint32_t bits;
+    memcpy(&bits, &f, 4);
+    put16(bits & 0xFFFF);
+    put16(bits >> 16);
+  }
+  void stage(uint8_t type, std::initializer_list<float> params, int shape = -1) {
+    put8(type);
+    put8(0); // every channel
+    put16((uint16_t)(params.size() * 4 + (shape >= 0)));
+    if (shape >= 0) {
+      put8((uint8_t)shape);
+    }
+    for (float p : params) {
+      put_f32(p);
+    }
+  }
+};
+
+// A typical speaker tune: high pass, two EQ bands, a gain trim and a limiter
+std::vector<uint8_t> speaker_chain() {
+  Descriptor d;
+  d.data.assign({'D', 'S', 'P', 'C', DSP_CHAIN_VERSION, 5, 0, 0});
+  d.stage(DSP_STAGE_EQ, {80, 0.707f, 0}, DSP_EQ_HIGH_PASS);
+  d.stage(DSP_STAGE_EQ, {250, 1.0f, -3}, DSP_EQ_PEAK);
+  d.stage(DSP_STAGE_EQ, {6000, 0.707f, 4}, DSP_EQ_HIGH_SHELF);
+  d.stage(DSP_STAGE_GAIN, {-2});
+  d.stage(DSP_STAGE_LIMITER, {-1, 1, 50});
+  const size_t len = d.data.size() + 2;
+  d.data[6] = len & 0xFF;
+  d.data[7] = (uint8_t)(len >> 8);
+  d.put16(dsp_chain_crc16(d.data.data(), d.data.size()));
+  return d.data;
+}
+
+void BM_DspChain(benchmark::State &state) {
+  const size_t frames = (size_t)state.range(0);
+  const int rate = (int)state.range(1);
+  const std::vector<uint8_t> desc = speaker_chain();
+  static uint8_t arena[64 * 1024] __attribute__((aligned(8)));
+  dsp_chain_t chain;
+  size_t offset = 0;
+  const dsp_chain_err_t err =
+      dsp_chain_build(&chain, desc.data(), desc.size(), 2, rate, frames, arena, sizeof(arena), &offset);
+  if (err != DSP_CHAIN_OK) {
+    state.SkipWithError(dsp_chain_err_str(err));
+    return;
+  }
+  const std::vector<int16_t> audio = make_audio(frames, rate, 2);
+  std::vector<int16_t> buf(audio);
+  for (auto _ : state) {
+    memcpy(buf.data(), audio.data(), audio.size() * sizeof(int16_t));
+    dsp_chain_process_s16(&chain, buf.data(), frames);
+    benchmark::ClobberMemory();
+  }
+  report(state, audio.size(), rate * 2);
+}
+BENCHMARK(BM_DspChain)->USB_AUDIO_SWEEP;
+
+// ---- Mic path ----
+
+void bench_beamformer(benchmark::State &state, beam_mode_t mode) {
+  const size_t frames = (size_t)state.range(0);
+  const int rate = (int)state.range(1);
+  static beamformer_t bf;
+  if (!beamformer_init(&bf, mode, rate, 40, 20)) {
+    state.SkipWithError("beamformer_init failed");
+    return;
+  }
+  const std::vector<int16_t> in = make_audio(frames, rate, 2);
+  std::vector<int16_t> out(frames);
+  for (auto _ : state) {
+    beamformer_process(&bf, in.data(), out.data(), frames);
+    benchmark::ClobberMemory();
+  }
+  report(state, frames, rate);
+}
+
+void BM_BeamDelaySum(benchmark::State &state) { bench_beamformer(state, BEAM_DELAY_SUM); }
+BENCHMARK(BM_BeamDelaySum)->USB_AUDIO_SWEEP;
+
+void BM_BeamMvdr(benchmark::State &state) { bench_beamformer(state, BEAM_MVDR); }
+BENCHMARK(BM_BeamMvdr)->USB_AUDIO_SWEEP;
+
+void BM_Sidetone(benchmark::State &state) {
+  const size_t frames = (size_t)state.range(0);
+  const std::vector<int16_t> mic = make_audio(frames, SPEAKER_RATE);
+  const std::vector<int16_t> speaker = make_audio(frames, SPEAKER_RATE, 2);
+  std::vector<int16_t> out(speaker);
+  const int16_t gain_q15 = (int16_t)(32768 * powf(10.0f, -20.0f / 20.0f));
+  for (auto _ : state) {
+    sidetone_mix2_s16(out.data(), mic.data(), frames, gain_q15);
+    benchmark::ClobberMemory();
+  }
+  report(state, out.size(), SPEAKER_RATE * 2);
+}
+BENCHMARK(BM_Sidetone)->Arg(48)->Arg(256)->Arg(1024)->ArgName("frames");
+
+// ---- Speaker concealment ----
+
+// One lost block after each good one, so every iteration pays for a pitch
+// search, the concealment and the cross-fade back
+void BM_PlcConceal(benchmark::State &state) {
+  const size_t frames = (size_t)state.range(0);
+  const int rate = (int)state.range(1);
+  static plc_t plc;
+  plc_init(&plc, rate);
+  const std::vector<int16_t> audio = make_audio(frames, rate);
+  std::vector<int16_t> good(audio), lost(frames);
+  for (int i = 0; i < 8; i++) {
+    plc_good_frame(&plc, good.data(), frames);
+    good = audio;
+  }
+  for (auto _ : state) {
+    plc_conceal(&plc, lost.data(), frames);
+    memcpy(good.data(), audio.data(), frames * sizeof(int16_t));
+    plc_good_frame(&plc, good.data(), frames);
+    benchmark::ClobberMemory();
+  }
+  report(state, 2 * frames, rate);
+}
+BENCHMARK(BM_PlcConceal)->USB_AUDIO_SWEEP;
+
+} // namespace
+
+BENCHMARK_MAIN();
@@ -0,0 +1,29 @@
+// serialmic.wasm against the page's JavaScript under Node, no browser:
+//   npm run build:wasm && npm run bench:wasm [-- serialmic.wasm [packets]]
+// src/wasm-bench.ts is bundled with esbuild (vite's) and run from memory.
+import { readFile } from 'node:fs/promises';
+import { fileURLToPath } from 'node:url';
+import { build } from 'esbuild';
+
+const wasmPath = process.argv[2] ?? fileURLToPath(new URL('../public/serialmic.wasm', import.meta.url));
+const packets = Number(process.argv[3]) || 2000;
+
+const out = await build({
+  entryPoints: [fileURLToPath(new URL('../src/wasm-bench.ts', import.meta.url))],
+  bundle: true,
+  format: 'esm',
+  platform: 'neutral',
+  target: 'node18',
+  write: false,
+});
+const bench = await import('data:text/javascript;base64,' + Buffer.from(out.outputFiles[0].text).toString('base64'));
+
+let bytes;
+try {
+  bytes = await readFile(wasmPath);
+} catch {
+  console.error(`${wasmPath}: not found (npm run build:wasm)`);
+  process.exit(1);
+}
+console.log(`${wasmPath}, Node ${process.versions.node}`);
+await bench.runKernelBench(bytes, packets, (line) => console.log(line));
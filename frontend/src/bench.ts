@@ -0,0 +1,153 @@
+import { PacketParser } from './parser';
+import { resizeCanvasToDpr, drawScope, drawScopeMinMax, drawSpectrogram, drawSpectrogramColumn } from './visuals';
+import { BarSpectrum } from './spectrum';
+import { detectPitchAutocorrPCM16, drawTunerGauge, pitchResult } from './pitch';
+import { connectBridge, dequantizeDb, BridgeFrame } from './bridge';
+import { RollingStats } from './perf';
+import { makePackets, runKernelBench } from './wasm-bench';
+
+// Main thread cost per packet of the Web Serial path (parse, FFTs, pitch,
+// draw: what onPcm in main.ts does) against the bridge path (decode a
+// frame, draw), and the bridge's read-to-drawn latency. Also serialmic.wasm's
+// kernels against the JavaScript ones, as npm run bench:wasm does in Node.
+
+const packetsEl = document.getElementById('packets') as HTMLInputElement;
+const bridgeUrlEl = document.getElementById('bridgeUrl') as HTMLInputElement;
+const serialBtn = document.getElementById('serialBtn') as HTMLButtonElement;
+const bridgeBtn = document.getElementById('bridgeBtn') as HTMLButtonElement;
+const wasmBtn = document.getElementById('wasmBtn') as HTMLButtonElement;
+const resultsEl = document.getElementById('results') as HTMLPreElement;
+const scopeCanvas = document.getElementById('scope') as HTMLCanvasElement;
+const specCanvas = document.getElementById('spec') as HTMLCanvasElement;
+const barsCanvas = document.getElementById('bars') as HTMLCanvasElement;
+const tunerCanvas = document.getElementById('tuner') as HTMLCanvasElement;
+const scopeCtx = scopeCanvas.getContext('2d')!;
+const specCtx = specCanvas.getContext('2d')!;
+const barsCtx = barsCanvas.getContext('2d')!;
+const tunerCtx = tunerCanvas.getContext('2d')!;
+for (const [c, ctx] of [[scopeCanvas, scopeCtx], [specCanvas, specCtx], [barsCanvas, barsCtx], [tunerCanvas, tunerCtx]] as const) {
+  resizeCanvasToDpr(c, ctx);
+}
+
+const SAMPLE_RATE = 16000;
+const SAMPLES = 1024;
+const barSpec = new BarSpectrum(barsCanvas, { bands: 31, fftSize: 1024, minDb: -80, maxDb: 0, peakHoldDecayDbPerSec: 12, levelDecayDbPerSec: 50, segments: 28, segmentGapPx: 2, glow: true });
+
+function report(line: string) {
+  resultsEl.textContent += line + '\n';
+}
+
+function summary(name: string, s: RollingStats, unit = 'ms/pkt') {
+  return `${name.padEnd(22)} mean ${s.mean().toFixed(3)}  p50 ${s.percentile(0.5).toFixed(3)}  p99 ${s.percentile(0.99).toFixed(3)} ${unit}`;
+}
+
+// Same work as onPcm in main.ts
+function serialPacket(pcm: Int16Array) {
+  drawScope(scopeCtx, scopeCanvas, pcm, 1);
+  drawSpectrogram(specCtx, specCanvas, pcm, SAMPLE_RATE, 'turbo');
+  barSpec.update(pcm, SAMPLE_RATE, 16 / 1000);
+  barSpec.draw();
+  const pitch = detectPitchAutocorrPCM16(pcm, SAMPLE_RATE);
+  drawTunerGauge(tunerCtx, tunerCanvas, pitch.cents, pitch.confidence, pitch.note, pitch.freqHz);
+  let sumSq = 0;
+  for (let i = 0; i < pcm.length; i++) { const v = pcm[i] / 32768; sumSq += v * v; }
+  return sumSq;
+}
+
+async function runSerial() {
+  const count = Math.max(16, Number(packetsEl.value) || 500);
+  const bytes = makePackets(count);
+  const perPacket = new RollingStats(count);
+  const parseOnly = new RollingStats(count);
+  // packets arrive from Web Serial in chunks of a few KB
+  const CHUNK = 4096;
+  let last = 0;
+  let parsed = 0;
+  const countOnly = new PacketParser(() => true, () => { parsed++; });
+  for (let o = 0; o < bytes.length; o += CHUNK) {
+    const t0 = performance.now();
+    countOnly.append(bytes.subarray(o, Math.min(bytes.length, o + CHUNK)));
+    parseOnly.add(performance.now() - t0);
+  }
+  const parser = new PacketParser(() => true, (pcm) => {
+    serialPacket(pcm);
+    const now = performance.now();
+    perPacket.add(now - last);
+    last = now;
+  });
+  for (let o = 0; o < bytes.length; o += CHUNK) {
+    last = performance.now();
+    parser.append(bytes.subarray(o, Math.min(bytes.length, o + CHUNK)));
+    // let the browser paint as it would between reads
+    if ((o / CHUNK) % 8 === 7) await new Promise(r => requestAnimationFrame(r));
+  }
+  const ms = perPacket.mean();
+  report(`Web Serial path, ${parsed} packets`);
+  report(summary('parse (per 4KB read)', parseOnly, 'ms'));
+  report(summary('parse + analyze + draw', perPacket));
+  report(`  ${(ms * SAMPLE_RATE / SAMPLES / 10).toFixed(1)}% of the main thread at ${(SAMPLE_RATE / SAMPLES).toFixed(1)} packets/s, at most ${(1000 / ms).toFixed(0)} packets/s`);
+  report('');
+}
+
+function bridgePacket(frame: BridgeFrame, specDb: Float32Array, bandDb: Float32Array, minDb: number, maxDb: number) {
+  drawScopeMinMax(scopeCtx, scopeCanvas, frame.scope, 1);
+  drawSpectrogramColumn(specCtx, specCanvas, dequantizeDb(frame.spectrum, minDb, maxDb, specDb), frame.sampleRate, 'turbo');
+  barSpec.updateBandsDb(dequantizeDb(frame.bands, minDb, maxDb, bandDb), 16 / 1000);
+  barSpec.draw();
+  const pitch = pitchResult(frame.pitchHz, frame.pitchConfidence);
+  drawTunerGauge(tunerCtx, tunerCanvas, pitch.cents, pitch.confidence, pitch.note, pitch.freqHz);
+}
+
+async function runBridge() {
+  const count = Math.max(16, Number(packetsEl.value) || 500);
+  const perPacket = new RollingStats(count);
+  const latency = new RollingStats(count);
+  let minDb = -100, maxDb = 0, frames = 0, lost = 0, firstLost = -1;
+  const specDb = new Float32Array(512), bandDb = new Float32Array(31);
+  report(`Bridge path, ${count} frames from ${bridgeUrlEl.value} (at the device's pace)`);
+  await new Promise<void>((resolve) => {
+    let conn: { close: () => void } | null = null;
+    connectBridge(bridgeUrlEl.value, {
+      onHello: (h) => { minDb = h.min_db; maxDb = h.max_db; },
+      onFrame: (frame) => {
+        const t0 = performance.now();
+        bridgePacket(frame, specDb, bandDb, minDb, maxDb);
+        perPacket.add(performance.now() - t0);
+        latency.add(Date.now() - frame.readMs);
+        if (firstLost < 0) firstLost = frame.lost;
+        lost = frame.lost - firstLost;
+        if (++frames >= count) { conn?.close(); resolve(); }
+      },
+      onClose: () => resolve(),
+    }).then(c => { conn = c; }).catch((e) => { report('  ' + (e instanceof Error ? e.message : String(e))); resolve(); });
+  });
+  if (frames) {
+    const ms = perPacket.mean();
+    report(summary('decode + draw', perPacket));
+    report(summary('read on host to drawn', latency, 'ms'));
+    report(`  ${(ms * SAMPLE_RATE / SAMPLES / 10).toFixed(1)}% of the main thread at ${(SAMPLE_RATE / SAMPLES).toFixed(1)} packets/s, at most ${(1000 / ms).toFixed(0)} packets/s; ${lost} lost`);
+  }
+  report('');
+}
+
+serialBtn.addEventListener('click', async () => {
+  serialBtn.disabled = true;
+  try { await runSerial(); } finally { serialBtn.disabled = false; }
+});
+bridgeBtn.addEventListener('click', async () => {
+  bridgeBtn.disabled = true;
+  try { await runBridge(); } finally { bridgeBtn.disabled = false; }
+});
+wasmBtn.addEventListener('click', async () => {
+  wasmBtn.disabled = true;
+  try {
+    const resp = await fetch('./serialmic.wasm');
+    if (!resp.ok) throw new Error('no serialmic.wasm (npm run build:wasm)');
+    await runKernelBench(await resp.arrayBuffer(), Math.max(16, Number(packetsEl.value) || 500), report);
+  } catch (e) {
+    report(e instanceof Error ? e.message : String(e));
+  } finally {
+    report('');
+    wasmBtn.disabled = false;
+  }
+});
@@ -0,0 +1,127 @@
+// Client for serialmic_bridge: it owns the serial port and does the
+// decoding, FFT, pitch and metering natively; each packet arrives as one
+// binary WebSocket message (layout in serial-mic/host/live_analysis.h)
+
+export const BRIDGE_FRAME = 1;
+export const BRIDGE_VERSION = 1;
+export const BRIDGE_HEADER_LEN = 72;
+export const BRIDGE_FLAG_PCM = 1;
+export const BRIDGE_FLAG_GAP = 2;
+export const BRIDGE_FLAG_RESTART = 4;
+
+export type BridgeHello = {
+  type: 'hello';
+  version: number;
+  source: string;
+  sample_rate: number;
+  fft_size: number;
+  bands: number;
+  scope_cols: number;
+  min_db: number;
+  max_db: number;
+};
+
+export type BridgeFrame = {
+  flags: number;
+  seq: number;
+  usec: number;
+  sampleRate: number;
+  readMs: number;   // wall clock when the bridge read the packet
+  sentMs: number;   // wall clock when it sent this frame
+  packets: number;
+  lost: number;
+  crcErrors: number;
+  bytesPerSec: number;
+  rmsDb: number;
+  peakDb: number;
+  pitchHz: number;  // 0 when no pitch was found
+  pitchConfidence: number;
+  scope: Int16Array;     // min, max per column
+  pcm: Int16Array|null;  // only after setPcm(true)
+  spectrum: Uint8Array;  // quantized dB per FFT bin
+  bands: Uint8Array;     // quantized dB per bar
+};
+
+// Views into `buf`, no copies. Null if it isn't a frame this understands.
+export function decodeBridgeFrame(buf: ArrayBuffer): BridgeFrame|null {
+  if (buf.byteLength < BRIDGE_HEADER_LEN) return null;
+  const dv = new DataView(buf);
+  if (dv.getUint8(0) !== BRIDGE_FRAME || dv.getUint8(1) !== BRIDGE_VERSION) return null;
+  const scopeCols = dv.getUint16(64, true);
+  const spectrumBins = dv.getUint16(66, true);
+  const bands = dv.getUint16(68, true);
+  const pcmSamples = dv.getUint16(70, true);
+  const total = BRIDGE_HEADER_LEN + 2 * (2 * scopeCols + pcmSamples) + spectrumBins + bands;
+  if (buf.byteLength < total) return null;
+  // Int16Array views need an even offset, which the 72 byte header keeps
+  let o = BRIDGE_HEADER_LEN;
+  const scope = new Int16Array(buf, o, 2 * scopeCols); o += 4 * scopeCols;
+  const pcm = pcmSamples ? new Int16Array(buf, o, pcmSamples) : null; o += 2 * pcmSamples;
+  const spectrum = new Uint8Array(buf, o, spectrumBins); o += spectrumBins;
+  return {
+    flags: dv.getUint16(2, true),
+    seq: dv.getUint32(4, true),
+    usec: dv.getUint32(8, true),
+    sampleRate: dv.getUint32(12, true),
+    readMs: dv.getFloat64(16, true),
+    sentMs: dv.getFloat64(24, true),
+    packets: dv.getUint32(32, true),
+    lost: dv.getUint32(36, true),
+    crcErrors: dv.getUint32(40, true),
+    bytesPerSec: dv.getUint32(44, true),
+    rmsDb: dv.getFloat32(48, true),
+    peakDb: dv.getFloat32(52, true),
+    pitchHz: dv.getFloat32(56, true),
+    pitchConfidence: dv.getFloat32(60, true),
+    scope,
+    pcm,
+    spectrum,
+    bands: new Uint8Array(buf, o, bands),
+  };
+}
+
+// Quantized dB back to dB; `out` is reused when it's the right size
+export function dequantizeDb(q: Uint8Array, minDb: number, maxDb: number, out?: Float32Array): Float32Array {
+  const db = out && out.length === q.length ? out : new Float32Array(q.length);
+  const step = (maxDb - minDb) / 255;
+  for (let i = 0; i < q.length; i++) db[i] = minDb + q[i] * step;
+  return db;
+}
+
+export type BridgeHandlers = {
+  onHello?: (hello: BridgeHello) => void;
+  onFrame: (frame: BridgeFrame) => void;
+  onClose?: (reason: string) => void;
+};
+
+export type BridgeConnection = {
+  close: () => void;
+  // Ask for each packet's samples as well, e.g. to record
+  setPcm: (on: boolean) => void;
+};
+
+export function connectBridge(url: string, handlers: BridgeHandlers): Promise<BridgeConnection> {
+  return new Promise((resolve, reject) => {
+    const ws = new WebSocket(url);
+    ws.binaryType = 'arraybuffer';
+    let opened = false;
+    const conn: BridgeConnection = {
+      close: () => { try { ws.close(); } catch {} },
+      setPcm: (on: boolean) => { if (ws.readyState === WebSocket.OPEN) ws.send(on ? 'pcm on' : 'pcm off'); },
+    };
+    ws.onopen = () => { opened = true; resolve(conn); };
+    ws.onerror = () => { if (!opened) reject(new Error(`cannot connect to ${url}`)); };
+    ws.onclose = (e) => { if (opened) handlers.onClose?.(e.reason || `closed (${e.code})`); };
+    ws.onmessage = (e) => {
+      if (typeof e.data === 'string') {
+        try {
+          const msg = JSON.parse(e.data) as BridgeHello;
+          if (msg.type === 'hello') handlers.onHello?.(msg);
+        } catch {}
+        return;
+      }
+      const frame = decodeBridgeFrame(e.data as ArrayBuffer);
+      if (frame) handlers.onFrame(frame);
+    };
+  });
+}
@@ -1,16 +1,21 @@
 import { PacketParser } from './parser';
-import { resizeCanvasToDpr, drawScope, drawSpectrogram } from './visuals';
+import { resizeCanvasToDpr, drawScope, drawScopeMinMax, drawSpectrogram, drawSpectrogramColumn } from './visuals';
 import { int16ToWavBlob } from './wav';
 import { requestAndOpen, closeCurrentPort } from './serial';
 import { createMicReader } from './mic';
 import { BarSpectrum } from './spectrum';
-import { detectPitchAutocorrPCM16, drawTunerGauge } from './pitch';
+import { detectPitchAutocorrPCM16, drawTunerGauge, pitchResult, PitchResult } from './pitch';
+import { connectBridge, dequantizeDb, BridgeConnection, BridgeFrame, BRIDGE_FLAG_GAP } from './bridge';
+import { RollingStats } from './perf';
+import { WasmDsp, WASM_FLAG_GAP } from './wasm';
 
 const connectBtn = document.getElementById('connectBtn') as HTMLButtonElement;
 const disconnectBtn = document.getElementById('disconnectBtn') as HTMLButtonElement;
 const sourceSelect = document.getElementById('sourceSelect') as HTMLSelectElement | null;
 const micPickerWrap = document.getElementById('micPickerWrap') as HTMLLabelElement | null;
 const micSelect = document.getElementById('micSelect') as HTMLSelectElement | null;
+const bridgeUrlWrap = document.getElementById('bridgeUrlWrap') as HTMLLabelElement | null;
+const bridgeUrlEl = document.getElementById('bridgeUrl') as HTMLInputElement | null;
 const scopeCanvas = document.getElementById('scope') as HTMLCanvasElement;
 const specCanvas = document.getElementById('spec') as HTMLCanvasElement;
 const barsCanvas = document.getElementById('bars') as HTMLCanvasElement;
@@ -54,7 +59,14 @@ window.addEventListener('resize', resizeAll);
 
 let reader: ReadableStreamDefaultReader<Uint8Array> | null = null;
 const mic = createMicReader();
-let sourceMode: 'serial' | 'mic' = 'mic';
+type SourceMode = 'serial' | 'mic' | 'bridge';
+let sourceMode: SourceMode = 'mic';
+let bridge: BridgeConnection | null = null;
+let bridgeRate = 16000;
+let bridgeMinDb = -100, bridgeMaxDb = 0;
+let bridgeSpecDb = new Float32Array(512);
+let bridgeBandDb = new Float32Array(31);
+let bridgeLastUsec: number | null = null;
 let selectedMicId: string | undefined;
 let bytesWindow = 0;
 let lastBpsTs = performance.now();
@@ -65,51 +77,139 @@ let recordingChunks: Int16Array[] = [];
 const barSpec = new BarSpectrum(barsCanvas, { bands: 31, fftSize: 1024, minDb: -80, maxDb: 0, peakHoldDecayDbPerSec: 12, levelDecayDbPerSec: 50, segments: 28, segmentGapPx: 2, glow: true });
 
 const parser = new PacketParser(() => crcCheckEl.checked, onPcm, (m)=>log(m));
+// The host tools' decoder and kernels, if serialmic.wasm was built (npm run
+// build:wasm); otherwise parser and the JavaScript analysis above
+let wasm: WasmDsp | null = null;
+WasmDsp.load('./serialmic.wasm').then((w) => { wasm = w; log('Using serialmic.wasm for decoding and analysis'); }).catch(() => {});
+crcCheckEl.addEventListener('change', () => wasm?.setVerifyCrc(crcCheckEl.checked));
 
 let pktCount = 0;
-const crcErrors = 0;
+let crcErrors = 0;
 let bps = 0;
+// Main thread time spent on each packet, and for the bridge how long after
+// the read on the host it was drawn
+const procStats = new RollingStats(256);
+const latencyStats = new RollingStats(256);
 // VU meter state (true-RMS with ~50 ms time constant)
 let vuRms2 = 0; // running mean-square in 0..1
 const VU_TAU_SEC = 0.05;
 const VU_MIN_DB = -80; // floor
 
-function onPcm(pcm: Int16Array) {
-  pktCount++;
-  if ((pktCount & 0x3F) === 0) debugStats.textContent = `packets: ${pktCount}`;
-  const gain = scopeGainEl ? Number(scopeGainEl.value) : 1;
-  if (scopeGainVal) scopeGainVal.textContent = `${gain.toFixed(2)}×`;
-  drawScope(scopeCtx, scopeCanvas, pcm, gain);
-  const sr = sourceMode === 'mic' ? (mic.getSampleRate() || Number(samplerateEl.value) || 48000) : (Number(samplerateEl.value) || 48000);
-  const palette: 'turbo'|'viridis'|'inferno'|'greys' = (colormapEl?.value as 'turbo'|'viridis'|'inferno'|'greys') ?? 'turbo';
-  drawSpectrogram(specCtx, specCanvas, pcm, sr, palette);
-  // update classic spectrum
-  const dt = 16 / 1000; // approx frame delta; fine for smoothing
-  barSpec.update(pcm, sr, dt);
-  barSpec.draw();
-  // Pitch detection and tuner draw
-  const pitch = detectPitchAutocorrPCM16(pcm, sr);
+function showDebugStats() {
+  let text = `packets: ${pktCount} · main thread ${procStats.mean().toFixed(2)} ms/pkt (p99 ${procStats.percentile(0.99).toFixed(2)})`;
+  if (sourceMode === 'bridge') text += ` · latency ${latencyStats.mean().toFixed(1)} ms (p99 ${latencyStats.percentile(0.99).toFixed(1)})`;
+  debugStats.textContent = text;
+}
+
+function showPitch(pitch: PitchResult) {
   noteEl.textContent = pitch.note ?? '—';
   pitchHzEl.textContent = pitch.freqHz ? pitch.freqHz.toFixed(1) + '' : '— Hz';
   pitchConfEl.textContent = pitch.confidence.toFixed(2);
   const tctx = tunerCanvas.getContext('2d'); if (tctx) drawTunerGauge(tctx, tunerCanvas, pitch.cents, pitch.confidence, pitch.note, pitch.freqHz);
-  // --- VU update ---
-  let sumSq = 0;
-  for (let i = 0; i < pcm.length; i++) { const v = pcm[i] / 32768; sumSq += v * v; }
-  const meanSq = sumSq / Math.max(1, pcm.length);
-  const chunkDt = pcm.length / Math.max(1, sr);
+}
+
+function updateVu(meanSq: number, chunkDt: number) {
   const alpha = Math.exp(-chunkDt / VU_TAU_SEC);
   vuRms2 = alpha * vuRms2 + (1 - alpha) * meanSq;
   const rms = Math.sqrt(vuRms2 + 1e-12);
   const db = 20 * Math.log10(rms + 1e-12);
   const vuNorm = Math.min(1, Math.max(0, (db - VU_MIN_DB) / (0 - VU_MIN_DB)));
   vuFill.style.width = (vuNorm * 100).toFixed(0) + '%';
-  if (recordingActive) recordingChunks.push(pcm);
+}
+
+function onPcm(pcm: Int16Array) {
+  const t0 = performance.now();
+  pktCount++;
+  if ((pktCount & 0x3F) === 0) showDebugStats();
+  const gain = scopeGainEl ? Number(scopeGainEl.value) : 1;
+  if (scopeGainVal) scopeGainVal.textContent = `${gain.toFixed(2)}×`;
+  drawScope(scopeCtx, scopeCanvas, pcm, gain);
+  const sr = sourceMode === 'mic' ? (mic.getSampleRate() || Number(samplerateEl.value) || 48000) : (Number(samplerateEl.value) || 48000);
+  const palette: 'turbo'|'viridis'|'inferno'|'greys' = (colormapEl?.value as 'turbo'|'viridis'|'inferno'|'greys') ?? 'turbo';
+  const dt = 16 / 1000; // approx frame delta; fine for smoothing
+  const chunkDt = pcm.length / Math.max(1, sr);
+  if (wasm) {
+    const magDb = wasm.spectrumDb(pcm);
+    drawSpectrogramColumn(specCtx, specCanvas, magDb, sr, palette);
+    barSpec.updateSpectrumDb(magDb, sr, dt);
+    barSpec.draw();
+    // a longer frame for low notes at mic rates
+    const p = wasm.pitch(pcm, sr, 50, 1200, pcm.length >= 2048 ? 2048 : 1024);
+    showPitch(pitchResult(p.freqHz, p.confidence));
+    updateVu(Math.pow(10, wasm.levels(pcm).rmsDb / 10), chunkDt);
+    // packets from wasm.push() are views into its ring
+    if (recordingActive) recordingChunks.push(pcm.slice());
+  } else {
+    drawSpectrogram(specCtx, specCanvas, pcm, sr, palette);
+    // update classic spectrum
+    barSpec.update(pcm, sr, dt);
+    barSpec.draw();
+    // Pitch detection and tuner draw
+    showPitch(detectPitchAutocorrPCM16(pcm, sr));
+    // --- VU update ---
+    let sumSq = 0;
+    for (let i = 0; i < pcm.length; i++) { const v = pcm[i] / 32768; sumSq += v * v; }
+    updateVu(sumSq / Math.max(1, pcm.length), chunkDt);
+    if (recordingActive) recordingChunks.push(pcm);
+  }
+  procStats.add(performance.now() - t0);
+}
+
+// The bridge did the analysis: only draw
+function onBridgeFrame(frame: BridgeFrame) {
+  const t0 = performance.now();
+  pktCount = frame.packets; crcErrors = frame.crcErrors;
+  if ((pktCount & 0x3F) === 0) showDebugStats();
+  if (frame.flags & BRIDGE_FLAG_GAP) log(`Bridge: ${frame.lost} packets lost so far`);
+  const gain = scopeGainEl ? Number(scopeGainEl.value) : 1;
+  if (scopeGainVal) scopeGainVal.textContent = `${gain.toFixed(2)}×`;
+  drawScopeMinMax(scopeCtx, scopeCanvas, frame.scope, gain);
+  const palette: 'turbo'|'viridis'|'inferno'|'greys' = (colormapEl?.value as 'turbo'|'viridis'|'inferno'|'greys') ?? 'turbo';
+  bridgeSpecDb = dequantizeDb(frame.spectrum, bridgeMinDb, bridgeMaxDb, bridgeSpecDb);
+  drawSpectrogramColumn(specCtx, specCanvas, bridgeSpecDb, frame.sampleRate, palette);
+  bridgeBandDb = dequantizeDb(frame.bands, bridgeMinDb, bridgeMaxDb, bridgeBandDb);
+  barSpec.updateBandsDb(bridgeBandDb, 16 / 1000);
+  barSpec.draw();
+  showPitch(pitchResult(frame.pitchHz, frame.pitchConfidence));
+  // the packet's length from the device timestamps, as frames without PCM don't carry it
+  const usecDelta = bridgeLastUsec === null ? 0 : (frame.usec - bridgeLastUsec) >>> 0;
+  bridgeLastUsec = frame.usec;
+  const chunkDt = usecDelta > 0 && usecDelta < 1e6 ? usecDelta / 1e6 : 1024 / Math.max(1, frame.sampleRate);
+  updateVu(Math.pow(10, frame.rmsDb / 10), chunkDt);
+  if (recordingActive && frame.pcm) recordingChunks.push(frame.pcm.slice());
+  const kb = (frame.bytesPerSec / 1024).toFixed(1) + ' kB/s';
+  scopeStatus.textContent = kb; bpsChip.textContent = kb;
+  procStats.add(performance.now() - t0);
+  latencyStats.add(Date.now() - frame.readMs);
 }
 
 connectBtn.addEventListener('click', async () => {
-  sourceMode = (sourceSelect?.value as 'serial'|'mic') || 'serial';
-  if (sourceMode === 'serial') {
+  sourceMode = (sourceSelect?.value as SourceMode) || 'serial';
+  procStats.reset(); latencyStats.reset();
+  if (sourceMode === 'bridge') {
+    const url = bridgeUrlEl?.value || 'ws://127.0.0.1:8765';
+    try {
+      bridgeLastUsec = null;
+      bridge = await connectBridge(url, {
+        onHello: (hello) => {
+          bridgeRate = hello.sample_rate; bridgeMinDb = hello.min_db; bridgeMaxDb = hello.max_db;
+          samplerateEl.value = String(hello.sample_rate);
+          wsSupport.textContent = `Bridge: ${hello.source}`; wsSupport.className = 'chip ok';
+          log(`Bridge serving ${hello.source} at ${hello.sample_rate} Hz`);
+        },
+        onFrame: onBridgeFrame,
+        onClose: (reason) => { if (!bridge) return; log('Bridge ' + reason); bridge = null; setDisconnected(); },
+      });
+      connectBtn.disabled = true; disconnectBtn.disabled = false; startRecBtn.disabled = false;
+      connState.textContent = 'Bridge connected';
+      connState.className = 'chip ok';
+      // the bridge checks CRCs and knows the rate
+      crcCheckEl.disabled = true; samplerateEl.disabled = true;
+      log('Connected to ' + url);
+    } catch (e) {
+      log('Bridge error: ' + (e instanceof Error ? e.message : String(e)));
+    }
+  } else if (sourceMode === 'serial') {
     reader = await requestAndOpen(115200);
     if (!reader) return;
     log('Serial port opened at 115200 baud');
@@ -117,6 +217,7 @@ connectBtn.addEventListener('click', async () => {
     connState.textContent = 'Connected';
     connState.className = 'chip ok';
     samplerateEl.disabled = false; crcCheckEl.disabled = false;
+    wasm?.reset(crcCheckEl.checked);
     readLoop();
   } else {
     try {
@@ -137,7 +238,11 @@ connectBtn.addEventListener('click', async () => {
 });
 
 disconnectBtn.addEventListener('click', async () => {
-  if (sourceMode === 'serial') {
+  if (sourceMode === 'bridge') {
+    const b = bridge; bridge = null;
+    b?.close();
+    log('Bridge closed');
+  } else if (sourceMode === 'serial') {
     try { await reader?.cancel(); reader?.releaseLock(); } catch {}
     try { await closeCurrentPort(); } catch {}
     log('Serial port closed');
@@ -146,25 +251,32 @@ disconnectBtn.addEventListener('click', async () => {
     try { await mic.stop(); } catch {}
     log('Microphone stopped');
   }
+  setDisconnected();
+});
+
+function setDisconnected() {
+  crcCheckEl.disabled = false; samplerateEl.disabled = false;
   connectBtn.disabled = false; disconnectBtn.disabled = true; startRecBtn.disabled = true; stopRecBtn.disabled = true; downloadBtn.disabled = true;
   connState.textContent = 'Disconnected';
   connState.className = 'chip bad';
   wsSupport.textContent = ('serial' in navigator) ? 'WebSerial: available' : 'WebSerial: not supported';
   wsSupport.className = ('serial' in navigator) ? 'chip ok' : 'chip bad';
-});
+}
 
 startRecBtn.addEventListener('click', () => {
   recordingActive = true; recordingChunks = [];
+  bridge?.setPcm(true);
   startRecBtn.disabled = true; stopRecBtn.disabled = false; downloadBtn.disabled = true;
 });
 
 stopRecBtn.addEventListener('click', () => {
   recordingActive = false;
+  bridge?.setPcm(false);
   startRecBtn.disabled = false; stopRecBtn.disabled = true;
   const totalLen = recordingChunks.reduce((a, b) => a + b.length, 0);
   const merged = new Int16Array(totalLen);
   let o = 0; for (const c of recordingChunks) { merged.set(c, o); o += c.length; }
-  const useSr = sourceMode === 'mic' ? (mic.getSampleRate() || Number(samplerateEl.value)) : Number(samplerateEl.value);
+  const useSr = sourceMode === 'mic' ? (mic.getSampleRate() || Number(samplerateEl.value)) : sourceMode === 'bridge' ? bridgeRate : Number(samplerateEl.value);
   const blob = int16ToWavBlob(merged, useSr);
   const url = URL.createObjectURL(blob);
   downloadBtn.disabled = false;
@@ -185,7 +297,15 @@ async function readLoop(){
         const kb = (bps/1024).toFixed(1) + ' kB/s';
         scopeStatus.textContent = kb; bpsChip.textContent = kb;
       }
-      parser.append(value);
+      if (wasm) {
+        wasm.push(value, (p) => {
+          if (p.flags & WASM_FLAG_GAP) log(`${wasm?.lost ?? 0} packets lost so far`);
+          onPcm(p.pcm);
+        });
+        crcErrors = wasm.crcErrors;
+      } else {
+        parser.append(value);
+      }
     } catch (e) {
       const msg = e instanceof Error ? e.message : String(e);
       log('Read error: ' + msg);
@@ -249,8 +369,9 @@ async function refreshMicList() {
 }
 
 sourceSelect?.addEventListener('change', async () => {
-  const val = sourceSelect.value as 'serial'|'mic';
+  const val = sourceSelect.value as SourceMode;
   if (micPickerWrap) micPickerWrap.style.display = val === 'mic' ? '' : 'none';
+  if (bridgeUrlWrap) bridgeUrlWrap.style.display = val === 'bridge' ? '' : 'none';
   if (val === 'mic') {
     try {
       // Request mic permission to reveal labels
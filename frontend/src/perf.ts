@@ -0,0 +1,33 @@
+// Mean and percentiles over the last `size` values, for per-packet timings
+export class RollingStats {
+  private values: Float64Array;
+  private count = 0;
+  private next = 0;
+
+  constructor(size = 256) {
+    this.values = new Float64Array(size);
+  }
+
+  add(v: number): void {
+    this.values[this.next] = v;
+    this.next = (this.next + 1) % this.values.length;
+    if (this.count < this.values.length) this.count++;
+  }
+
+  reset(): void { this.count = 0; this.next = 0; }
+
+  get size(): number { return this.count; }
+
+  mean(): number {
+    let sum = 0;
+    for (let i = 0; i < this.count; i++) sum += this.values[i];
+    return this.count ? sum / this.count : 0;
+  }
+
+  // q in [0, 1]
+  percentile(q: number): number {
+    if (!this.count) return 0;
+    const sorted = this.values.slice(0, this.count).sort();
+    return sorted[Math.min(this.count - 1, Math.floor(q * (this.count - 1)))];
+  }
+}
@@ -42,12 +42,18 @@ export function detectPitchAutocorrPCM16(pcm: Int16Array, sampleRate: number, fM
   let energy = 0; for (let i = 0; i < N; i++) energy += buf[i]*buf[i];
   const conf = Math.max(0, Math.min(1, bestVal / (energy + 1e-9)));
 
-  const midi = 69 + 12 * Math.log2(freq / 440);
+  return pitchResult(freq, conf);
+}
+
+// Nearest note and how far off it is; a frequency of 0 or less is no pitch
+export function pitchResult(freqHz: number, confidence: number): PitchResult {
+  if (!(freqHz > 0)) return { freqHz: null, confidence: 0, cents: null, note: null };
+  const midi = 69 + 12 * Math.log2(freqHz / 440);
   const noteIdx = Math.round(midi);
   const cents = (midi - noteIdx) * 100;
   const octave = Math.floor(noteIdx / 12) - 1;
   const name = NOTE_NAMES[((noteIdx % 12) + 12) % 12] + octave;
-  return { freqHz: freq, confidence: conf, cents, note: name };
+  return { freqHz, confidence, cents, note: name };
 }
 
 export function drawTunerGauge(ctx: CanvasRenderingContext2D, canvas: HTMLCanvasElement, cents: number|null, conf: number, note: string|null, freqHz: number|null) {
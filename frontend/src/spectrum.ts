@@ -63,19 +63,23 @@ export class BarSpectrum {
     this.im.fill(0);
     fftRadix2(this.re, this.im);
 
-    // Magnitudes for first half
+    // Magnitudes for first half, in dBFS: normalize by FFT size and Hann
+    // coherent gain, one-sided amplitude
     const bins = N >> 1;
-    const mag = new Float32Array(bins);
-    for (let k = 0; k < bins; k++) mag[k] = Math.hypot(this.re[k], this.im[k]);
-
-    // Convert to dBFS: normalize by FFT size and Hann coherent gain, one-sided amplitude
     let sumWin = 0; for (let i = 0; i < N; i++) sumWin += this.win[i];
     const coherentGain = sumWin / N; // ~0.5 for Hann
     const scale = 2 / (N * coherentGain + 1e-12);
+    const magDb = new Float32Array(bins);
+    for (let k = 0; k < bins; k++) magDb[k] = 20 * Math.log10(Math.hypot(this.re[k], this.im[k]) * scale + 1e-12);
+    this.updateSpectrumDb(magDb, sampleRate, dtSec);
+  }
 
+  // A dBFS spectrum (0..Nyquist) worked out elsewhere (serialmic.wasm)
+  updateSpectrumDb(magDb: Float32Array, sampleRate: number, dtSec: number): void {
+    const bins = magDb.length;
     // Map to log-spaced bands
     const sr2 = sampleRate / 2;
-    const bandLevels = new Float32Array(this.bands);
+    const bandDb = new Float32Array(this.bands);
     for (let b = 0; b < this.bands; b++) {
       const t0 = b / this.bands; const t1 = (b + 1) / this.bands;
       // Quadratic mapping for pseudo-log scale
@@ -83,17 +87,20 @@ export class BarSpectrum {
       const f1 = Math.pow(t1, 2.0) * sr2 * 0.98 + 20;
       const k0 = Math.max(1, Math.floor((f0 / sr2) * bins));
       const k1 = Math.min(bins - 1, Math.ceil((f1 / sr2) * bins));
-      let peak = 0;
-      for (let k = k0; k <= k1; k++) { const a = mag[k] * scale; if (a > peak) peak = a; }
-      const db = 20 * Math.log10(peak + 1e-12); // 0 dBFS for full-scale tone
-      bandLevels[b] = this.dbToNorm(db);
+      let peak = -240;
+      for (let k = k0; k <= k1; k++) { if (magDb[k] > peak) peak = magDb[k]; }
+      bandDb[b] = peak; // 0 dBFS for full-scale tone
     }
+    this.updateBandsDb(bandDb, dtSec);
+  }
 
+  // The loudest dBFS in each band, worked out elsewhere (serialmic_bridge)
+  updateBandsDb(bandDb: ArrayLike<number>, dtSec: number): void {
     // Smooth and peak hold with decay
     const levelFall = (this.levelDecay * dtSec) / (this.maxDb - this.minDb); // normalized per second
     const peakFall = (this.peakHoldDecay * dtSec) / (this.maxDb - this.minDb);
     for (let b = 0; b < this.bands; b++) {
-      const target = bandLevels[b];
+      const target = this.dbToNorm(bandDb[b] ?? this.minDb);
       if (target >= this.levels[b]) {
         // rise fast
         this.levels[b] = this.levels[b] * 0.6 + target * 0.4;
@@ -28,6 +28,24 @@ export function drawScope(ctx: CanvasRenderingContext2D, canvas: HTMLCanvasEleme
   ctx.stroke();
 }
 
+// Bridge frames carry the min and max of each column instead of samples
+export function drawScopeMinMax(ctx: CanvasRenderingContext2D, canvas: HTMLCanvasElement, minMax: Int16Array, gain = 1): void {
+  const rect = canvas.getBoundingClientRect();
+  const wCss = Math.max(1, Math.floor(rect.width));
+  const hCss = Math.max(1, Math.floor(rect.height));
+  ctx.clearRect(0, 0, wCss, hCss);
+  ctx.fillStyle = '#5df';
+  const mid = hCss / 2;
+  const cols = minMax.length >> 1;
+  const colW = wCss / Math.max(1, cols);
+  const k = (hCss * 0.48 * gain) / 32768;
+  for (let c = 0; c < cols; c++) {
+    const yTop = Math.max(0, mid - minMax[2 * c + 1] * k);
+    const yBottom = Math.min(hCss, mid - minMax[2 * c] * k);
+    ctx.fillRect(c * colW, yTop - 1, Math.max(1, colW), Math.max(2, yBottom - yTop + 2));
+  }
+}
+
 // Turbo colormap (approximation). t in [0,1]
 function turboColorRGB(t: number): [number, number, number] {
   t = Math.max(0, Math.min(1, t));
@@ -89,7 +107,18 @@ export function drawSpectrogram(
   const bins = nfft >> 1;
   const magDb = new Float32Array(bins);
   for (let k = 0; k < bins; k++) magDb[k] = 20 * Math.log10(Math.hypot(re[k], im[k]) * scale + 1e-12);
+  drawSpectrogramColumn(ctx, canvas, magDb, sampleRate, palette);
+}
 
+// Scrolls the spectrogram and draws one column of dBFS bins (0..Nyquist)
+export function drawSpectrogramColumn(
+  ctx: CanvasRenderingContext2D,
+  canvas: HTMLCanvasElement,
+  magDb: Float32Array,
+  sampleRate: number,
+  palette: 'turbo'|'viridis'|'inferno'|'greys' = 'turbo'
+): void {
+  const bins = magDb.length;
   const MIN_DB = -100, MAX_DB = 0;
   // Use device-pixel dimensions to avoid DPR transform mismatch
   const wDev = canvas.width;
@@ -0,0 +1,121 @@
+import { HEADER_LEN, TRAILER_LEN, SYNC } from './constants';
+import { crc16ccitt } from './crc';
+import { PacketParser } from './parser';
+import { hann, fftRadix2 } from './fft';
+import { detectPitchAutocorrPCM16 } from './pitch';
+import { WasmDsp } from './wasm';
+
+// serialmic.wasm against the page's JavaScript, kernel by kernel: decoding
+// reads from the port, the spectrogram's spectrum, pitch and the VU meter's
+// rms. Nothing here touches the DOM, so it runs under Node (npm run
+// bench:wasm) as well as on bench.html.
+
+const SAMPLE_RATE = 16000;
+const SAMPLES = 1024;
+// packets arrive from Web Serial in chunks of a few KB
+const CHUNK = 4096;
+
+// What serialmic sends: a 220 Hz tone with harmonics over a little noise
+export function makePackets(count: number): Uint8Array {
+  const payload = SAMPLES * 2;
+  const len = HEADER_LEN + payload + TRAILER_LEN;
+  const out = new Uint8Array(count * len);
+  const dv = new DataView(out.buffer);
+  let rng = 12345;
+  for (let p = 0; p < count; p++) {
+    const o = p * len;
+    out[o] = SYNC;
+    dv.setUint16(o + 1, payload, true);
+    dv.setUint32(o + 3, p, true);
+    dv.setUint32(o + 7, Math.round(p * SAMPLES * 1e6 / SAMPLE_RATE) >>> 0, true);
+    for (let i = 0; i < SAMPLES; i++) {
+      const t = (p * SAMPLES + i) / SAMPLE_RATE;
+      let v = 0;
+      for (let h = 1; h <= 4; h++) v += 0.15 / h * Math.sin(2 * Math.PI * 220 * h * t);
+      rng = (Math.imul(rng, 1664525) + 1013904223) >>> 0;
+      v += ((rng >>> 16) / 32768 - 1) * 0.02;
+      dv.setInt16(o + HEADER_LEN + 2 * i, Math.round(v * 32767), true);
+    }
+    dv.setUint16(o + HEADER_LEN + payload, crc16ccitt(out, o, HEADER_LEN + payload), true);
+  }
+  return out;
+}
+
+// The analysis half of drawSpectrogram in visuals.ts
+function jsSpectrumDb(pcm: Int16Array): Float32Array {
+  const nfft = 1024;
+  const step = Math.max(1, Math.floor(pcm.length / nfft));
+  const re = new Float32Array(nfft);
+  const im = new Float32Array(nfft);
+  const win = hann(nfft);
+  for (let i = 0; i < nfft; i++) re[i] = ((pcm[Math.min(pcm.length - 1, i * step)] ?? 0) / 32768) * win[i];
+  fftRadix2(re, im);
+  let sumWin = 0; for (let i = 0; i < nfft; i++) sumWin += win[i];
+  const scale = 2 / (sumWin + 1e-12);
+  const bins = nfft >> 1;
+  const magDb = new Float32Array(bins);
+  for (let k = 0; k < bins; k++) magDb[k] = 20 * Math.log10(Math.hypot(re[k], im[k]) * scale + 1e-12);
+  return magDb;
+}
+
+// The VU meter's loop in main.ts
+function jsMeanSq(pcm: Int16Array): number {
+  let sumSq = 0;
+  for (let i = 0; i < pcm.length; i++) { const v = pcm[i] / 32768; sumSq += v * v; }
+  return sumSq / Math.max(1, pcm.length);
+}
+
+// µs per call of `fn` over every packet, best of three passes
+function time(packets: Int16Array[], fn: (pcm: Int16Array) => void): number {
+  let best = Infinity;
+  for (let pass = 0; pass < 3; pass++) {
+    const t0 = performance.now();
+    for (const pcm of packets) fn(pcm);
+    best = Math.min(best, (performance.now() - t0) * 1000 / packets.length);
+  }
+  return best;
+}
+
+function row(name: string, jsUs: number, wasmUs: number): string {
+  return `${name.padEnd(10)} ${jsUs.toFixed(1).padStart(9)} ${wasmUs.toFixed(1).padStart(9)} ${(jsUs / wasmUs).toFixed(1).padStart(7)}x`;
+}
+
+export async function runKernelBench(wasmBytes: BufferSource, count: number, report: (line: string) => void): Promise<void> {
+  const dsp = await WasmDsp.load(wasmBytes);
+  const bytes = makePackets(count);
+
+  // Decoding, which the others then work on
+  const packets: Int16Array[] = [];
+  let jsSum = 0, wasmSum = 0, wasmPackets = 0;
+  const parser = new PacketParser(() => true, (pcm) => { packets.push(pcm); });
+  let t0 = performance.now();
+  for (let o = 0; o < bytes.length; o += CHUNK) parser.append(bytes.subarray(o, Math.min(bytes.length, o + CHUNK)));
+  const jsDecode = (performance.now() - t0) * 1000 / Math.max(1, packets.length);
+  dsp.reset(true);
+  t0 = performance.now();
+  for (let o = 0; o < bytes.length; o += CHUNK) {
+    dsp.push(bytes.subarray(o, Math.min(bytes.length, o + CHUNK)), (p) => { wasmPackets++; wasmSum += p.pcm[0] + p.pcm[p.pcm.length - 1]; });
+  }
+  const wasmDecode = (performance.now() - t0) * 1000 / Math.max(1, wasmPackets);
+  for (const pcm of packets) jsSum += pcm[0] + pcm[pcm.length - 1];
+
+  report(`${count} packets of ${SAMPLES} samples at ${SAMPLE_RATE} Hz, µs per packet`);
+  report(`${'kernel'.padEnd(10)} ${'js'.padStart(9)} ${'wasm'.padStart(9)} ${'speedup'.padStart(8)}`);
+  report(row('decode', jsDecode, wasmDecode));
+  report(row('spectrum', time(packets, jsSpectrumDb), time(packets, (pcm) => dsp.spectrumDb(pcm))));
+  report(row('pitch', time(packets, (pcm) => detectPitchAutocorrPCM16(pcm, SAMPLE_RATE)), time(packets, (pcm) => dsp.pitch(pcm, SAMPLE_RATE))));
+  report(row('levels', time(packets, jsMeanSq), time(packets, (pcm) => dsp.levels(pcm))));
+
+  // Same answers?
+  report('');
+  report(`decode: js ${packets.length} packets, wasm ${wasmPackets}, samples ${jsSum === wasmSum ? 'match' : 'differ'}, ${dsp.crcErrors} CRC errors`);
+  const pcm = packets[packets.length >> 1];
+  const a = jsSpectrumDb(pcm), b = dsp.spectrumDb(pcm);
+  let worst = 0;
+  for (let k = 0; k < a.length; k++) if (a[k] > -100) worst = Math.max(worst, Math.abs(a[k] - b[k]));
+  report(`spectrum: largest difference ${worst.toFixed(3)} dB over bins above -100 dBFS`);
+  const jsPitch = detectPitchAutocorrPCM16(pcm, SAMPLE_RATE), wasmPitch = dsp.pitch(pcm, SAMPLE_RATE);
+  report(`pitch of the 220 Hz tone: js ${jsPitch.freqHz?.toFixed(2) ?? '-'} Hz, wasm ${wasmPitch.freqHz.toFixed(2)} Hz (confidence ${wasmPitch.confidence.toFixed(2)})`);
+  const jsRms = 10 * Math.log10(jsMeanSq(pcm) + 1e-24);
+  report(`rms: js ${jsRms.toFixed(3)} dBFS, wasm ${dsp.levels(pcm).rmsDb.toFixed(3)} dBFS`);
+}
@@ -0,0 +1,178 @@
+// serialmic.wasm: the host tools' packet decoder and DSP kernels
+// (serial-mic/host/wasm_api.cpp, dsp_kernels.cpp) built for the page with
+// SIMD128. `npm run build:wasm` puts it in public/; without it the page
+// keeps to the JavaScript in parser.ts, fft.ts and pitch.ts.
+
+type Exports = {
+  memory: WebAssembly.Memory;
+  _initialize?: () => void;
+  sm_rx_buffer(): number;
+  sm_rx_capacity(): number;
+  sm_rx_push(n: number): number;
+  sm_reset(verifyCrc: number): void;
+  sm_set_verify_crc(on: number): void;
+  sm_slot_count(): number;
+  sm_slot_samples(): number;
+  sm_pcm_slots(): number;
+  sm_packet_info(): number;
+  sm_packets_written(): number;
+  sm_packets_lost(): number;
+  sm_crc_errors(): number;
+  sm_scratch_pcm(): number;
+  sm_scratch_samples(): number;
+  sm_spectrum_init(n: number): number;
+  sm_spectrum_out(): number;
+  sm_spectrum_db(pcm: number, count: number): void;
+  sm_yin_init(frame: number, rate: number, minHz: number, maxHz: number, threshold: number): number;
+  sm_yin(pcm: number, count: number): number;
+  sm_yin_confidence(): number;
+  sm_levels(pcm: number, count: number): void;
+  sm_levels_out(): number;
+};
+
+export const WASM_FLAG_GAP = 1;
+export const WASM_FLAG_RESTART = 2;
+
+export type WasmPacket = {
+  seq: number;
+  usec: number;
+  flags: number;
+  // A view into the module's ring: good until sm_slot_count() more
+  // packets have come in. slice() it to keep it.
+  pcm: Int16Array;
+};
+
+export class WasmDsp {
+  private buf: ArrayBuffer | null = null;
+  private rx!: Uint8Array;
+  private slots!: Int16Array;
+  private info!: Uint32Array;
+  private scratch!: Int16Array;
+  private read = 0;
+  private slotCount: number;
+  private slotSamples: number;
+  private spectrumBins = 0;
+  private yinKey = '';
+  overruns = 0; // packets overwritten before push() got to them
+
+  private constructor(private x: Exports) {
+    x._initialize?.();
+    this.slotCount = x.sm_slot_count();
+    this.slotSamples = x.sm_slot_samples();
+    this.views();
+  }
+
+  // `source` a URL or the module's bytes
+  static async load(source: string | BufferSource): Promise<WasmDsp> {
+    let bytes: BufferSource;
+    if (typeof source === 'string') {
+      const resp = await fetch(source);
+      if (!resp.ok) throw new Error(`${source}: ${resp.status}`);
+      bytes = await resp.arrayBuffer();
+    } else {
+      bytes = source;
+    }
+    const mod = await WebAssembly.compile(bytes);
+    // A standalone build may import a few WASI calls on paths that end the
+    // program; none are made in normal use
+    const imports: Record<string, Record<string, () => void>> = {};
+    for (const imp of WebAssembly.Module.imports(mod)) {
+      if (imp.kind !== 'function') continue;
+      const m = imports[imp.module] ?? (imports[imp.module] = {});
+      m[imp.name] = imp.name === 'emscripten_notify_memory_growth'
+        ? () => {}
+        : () => { throw new Error(`serialmic.wasm called ${imp.module}.${imp.name}`); };
+    }
+    const instance = await WebAssembly.instantiate(mod, imports);
+    return new WasmDsp(instance.exports as unknown as Exports);
+  }
+
+  // Typed arrays over linear memory, made again if it has grown
+  private views(): void {
+    const b = this.x.memory.buffer;
+    if (b === this.buf) return;
+    this.buf = b;
+    this.rx = new Uint8Array(b, this.x.sm_rx_buffer(), this.x.sm_rx_capacity());
+    this.slots = new Int16Array(b, this.x.sm_pcm_slots(), this.slotCount * this.slotSamples);
+    this.info = new Uint32Array(b, this.x.sm_packet_info(), this.slotCount * 4);
+    this.scratch = new Int16Array(b, this.x.sm_scratch_pcm(), this.x.sm_scratch_samples());
+  }
+
+  reset(verifyCrc: boolean): void {
+    this.x.sm_reset(verifyCrc ? 1 : 0);
+    this.read = 0;
+    this.overruns = 0;
+  }
+
+  setVerifyCrc(on: boolean): void { this.x.sm_set_verify_crc(on ? 1 : 0); }
+
+  get crcErrors(): number { return this.x.sm_crc_errors(); }
+  get lost(): number { return this.x.sm_packets_lost(); }
+
+  // A read from the port: each packet in it, in order, to `onPacket`
+  push(chunk: Uint8Array, onPacket: (p: WasmPacket) => void): void {
+    this.views();
+    for (let o = 0; o < chunk.length; o += this.rx.length) {
+      const part = chunk.subarray(o, Math.min(chunk.length, o + this.rx.length));
+      this.rx.set(part);
+      const written = this.x.sm_rx_push(part.length);
+      if (written - this.read > this.slotCount) {
+        this.overruns += written - this.read - this.slotCount;
+        this.read = written - this.slotCount;
+      }
+      for (; this.read < written; this.read++) {
+        const slot = this.read % this.slotCount;
+        const i = slot * 4;
+        const start = slot * this.slotSamples;
+        onPacket({
+          seq: this.info[i],
+          usec: this.info[i + 1],
+          flags: this.info[i + 3],
+          pcm: this.slots.subarray(start, start + this.info[i + 2]),
+        });
+      }
+    }
+  }
+
+  // Where `pcm` is in linear memory: where it already is if it's a view
+  // into it (a packet from push()), otherwise copied to the scratch area
+  private place(pcm: Int16Array): [number, number] {
+    this.views();
+    if (pcm.buffer === this.buf) return [pcm.byteOffset, pcm.length];
+    const n = Math.min(pcm.length, this.scratch.length);
+    this.scratch.set(pcm.subarray(pcm.length - n));
+    return [this.scratch.byteOffset, n];
+  }
+
+  // dBFS of the last `n` samples' Hann spectrum, n / 2 bins. A view that
+  // the next call overwrites.
+  spectrumDb(pcm: Int16Array, n = 1024): Float32Array {
+    if (n !== this.spectrumBins * 2) {
+      if (!this.x.sm_spectrum_init(n)) throw new Error(`no ${n} point spectrum`);
+      this.spectrumBins = n / 2;
+    }
+    const [ptr, count] = this.place(pcm);
+    this.x.sm_spectrum_db(ptr, count);
+    this.views();
+    return new Float32Array(this.x.memory.buffer, this.x.sm_spectrum_out(), this.spectrumBins);
+  }
+
+  // YIN over the last `frame` samples: Hz (0 for none) and confidence
+  pitch(pcm: Int16Array, sampleRate: number, fMin = 50, fMax = 1200, frame = 1024): { freqHz: number; confidence: number } {
+    const key = `${frame}/${sampleRate}/${fMin}/${fMax}`;
+    if (key !== this.yinKey) {
+      if (!this.x.sm_yin_init(frame, sampleRate, fMin, fMax, 0.15)) throw new Error(`no YIN for ${key}`);
+      this.yinKey = key;
+    }
+    const [ptr, count] = this.place(pcm);
+    const freqHz = this.x.sm_yin(ptr, count);
+    return { freqHz, confidence: this.x.sm_yin_confidence() };
+  }
+
+  levels(pcm: Int16Array): { rmsDb: number; peakDb: number } {
+    const [ptr, count] = this.place(pcm);
+    this.x.sm_levels(ptr, count);
+    const out = new Float32Array(this.x.memory.buffer, this.x.sm_levels_out(), 2);
+    return { rmsDb: out[0], peakDb: out[1] };
+  }
+}
@@ -14,7 +14,8 @@ export default defineConfig({
     rollupOptions: {
       input: {
         main: resolve(__dirname, 'index.html'),
-        test: resolve(__dirname, 'test.html')
+        test: resolve(__dirname, 'test.html'),
+        bench: resolve(__dirname, 'bench.html')
       }
     }
   }
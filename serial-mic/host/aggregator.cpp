@@ -0,0 +1,310 @@
+#include "aggregator.h"
+
+#include <cmath>
+#include <cstring>
+#include <ctime>
+#include <poll.h>
+#include <unistd.h>
+
+#include "serial_port.h"
+
+namespace serialmic {
+
+double monotonic_us() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec * 1e-3;
+}
+
+bool push_packet(FrameRing &ring, const Packet &pkt, double arrival_us) {
+  if (pkt.samples() > Frame::MAX_SAMPLES) {
+    return false;
+  }
+  Frame *frame = ring.write_slot();
+  if (!frame) {
+    return false;
+  }
+  frame->seq = pkt.seq;
+  frame->usec = pkt.usec;
+  frame->arrival_us = arrival_us;
+  frame->samples = (uint16_t)pkt.samples();
+  pkt.read_pcm(frame->pcm);
+  ring.publish();
+  return true;
+}
+
+// ====================== DeviceReader ======================
+DeviceReader::DeviceReader(const std::string &path, FrameRing &ring, bool verify_crc)
+    : path_(path), ring_(ring), parser_(verify_crc) {}
+
+void DeviceReader::start() { thread_ = std::thread(&DeviceReader::run, this); }
+
+void DeviceReader::stop() {
+  quit_ = true;
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+}
+
+void DeviceReader::on_packet(const Packet &pkt) {
+  if (!push_packet(ring_, pkt, arrival_us_)) {
+    overflows_++;
+  }
+}
+
+void DeviceReader::run() {
+  static constexpr size_t READ_SIZE = 16 * 1024;
+  uint8_t buf[READ_SIZE];
+  int fd = -1;
+  while (!quit_) {
+    if (fd < 0) {
+      fd = open_stream(path_.c_str());
+      if (fd < 0) {
+        usleep(1000 * 1000);
+        continue;
+      }
+      parser_.reset();
+    }
+    struct pollfd pfd = {fd, POLLIN, 0};
+    if (poll(&pfd, 1, 200) <= 0) {
+      continue;
+    }
+    ssize_t n = read(fd, buf, sizeof(buf));
+    if (n <= 0) {
+      close(fd);
+      fd = -1;
+      continue;
+    }
+    arrival_us_ = monotonic_us();
+    parser_.feed(buf, (size_t)n, *this);
+  }
+  if (fd >= 0) {
+    close(fd);
+  }
+}
+
+// ====================== Resampling ======================
+// Windowed sinc interpolation, TAPS samples around the read position. The
+// table has the taps for PHASES fractional positions; between them it
+// interpolates linearly.
+#define TAPS 16
+#define PHASES 64
+
+namespace {
+struct SincTable {
+  float taps[PHASES + 1][TAPS];
+  SincTable() {
+    for (int p = 0; p <= PHASES; p++) {
+      const double frac = (double)p / PHASES;
+      double sum = 0;
+      for (int k = 0; k < TAPS; k++) {
+        // distance from the read position to sample i - TAPS/2 + 1 + k
+        const double t = k - (TAPS / 2 - 1) - frac;
+        const double x = M_PI * t * 0.95; // cutoff a little below Nyquist
+        const double sinc = t == 0 ? 1.0 : sin(x) / x;
+        const double w = 0.42 + 0.5 * cos(M_PI * t / (TAPS / 2)) + 0.08 * cos(2 * M_PI * t / (TAPS / 2));
+        taps[p][k] = (float)(sinc * w);
+        sum += taps[p][k];
+      }
+      for (int k = 0; k < TAPS; k++) {
+        taps[p][k] = (float)(taps[p][k] / sum); // unity gain at DC
+      }
+    }
+  }
+};
+const SincTable sinc_table;
+} // namespace
+
+// ====================== Aggregator ======================
+// A late packet this far back still fills its gap, further back the device
+// has restarted
+#define LATE_WINDOW 64
+// Further than this from where the fit says it should be, the resampler
+// jumps instead of steering (after a restart or a long gap)
+#define MAX_SLIP_SAMPLES 800.0
+// Steering never moves the rate more than this from 1:1
+#define MAX_RATE_ERROR 0.02
+
+struct Aggregator::Channel {
+  explicit Channel(int sample_rate) : clock(sample_rate) {}
+
+  FrameRing ring;
+  DeviceClock clock;
+  ChannelStats stats;
+
+  bool started = false;
+  uint32_t expected_seq = 0;
+  uint64_t next_index = 0; // packets since the start, unwrapped
+  uint32_t last_usec = 0;
+  double usec = 0;         // unwrapped
+  size_t packet_samples = 0;
+
+  int16_t history[HISTORY];
+  uint64_t history_start = 0; // first sample index still held
+  uint64_t history_end = 0;   // one past the newest
+
+  bool steering = false;
+  double position = 0; // device sample index for the next output frame
+  double rate = 1;     // device samples per output frame
+};
+
+Aggregator::Aggregator(int devices, int sample_rate, double latency_ms)
+    : sample_rate_(sample_rate), latency_us_(latency_ms * 1000) {
+  for (int i = 0; i < devices; i++) {
+    channels_.emplace_back(new Channel(sample_rate));
+  }
+}
+
+Aggregator::~Aggregator() = default;
+
+FrameRing &Aggregator::ring(int dev) { return channels_[dev]->ring; }
+const DeviceClock &Aggregator::clock(int dev) const { return channels_[dev]->clock; }
+const ChannelStats &Aggregator::stats(int dev) const { return channels_[dev]->stats; }
+double Aggregator::position(int dev) const { return channels_[dev]->position; }
+double Aggregator::time_us() const { return start_us_ + frames_out_ * 1e6 / sample_rate_; }
+
+void Aggregator::ingest(Channel &ch, const Frame &frame) {
+  ch.stats.packets++;
+  int64_t index;
+  if (!ch.started) {
+    ch.started = true;
+    ch.usec = frame.usec;
+    ch.packet_samples = frame.samples;
+    index = 0;
+  } else {
+    const int32_t gap = seq_gap(ch.expected_seq, frame.seq);
+    if (gap < -LATE_WINDOW || frame.samples != ch.packet_samples) {
+      // the device started again - so does everything about it
+      ch.stats.restarts++;
+      ch.clock.reset();
+      ch.steering = false;
+      ch.usec = frame.usec;
+      ch.packet_samples = frame.samples;
+      ch.next_index = 0;
+      ch.history_start = ch.history_end = 0;
+      index = 0;
+    } else {
+      index = (int64_t)ch.next_index + gap;
+      if (gap < 0) {
+        ch.stats.late_packets++;
+      } else {
+        ch.stats.lost_packets += gap;
+        ch.usec += (int32_t)(frame.usec - ch.last_usec);
+      }
+    }
+  }
+  if (index < 0) {
+    return;
+  }
+
+  const uint64_t first = (uint64_t)index * ch.packet_samples;
+  const uint64_t end = first + frame.samples;
+  if (end > ch.history_end) {
+    // a new packet: silence over any gap, then note the timing
+    if (ch.history_end == 0 && ch.history_start == 0) {
+      ch.history_start = first;
+    } else {
+      uint64_t from = ch.history_end;
+      if (end > HISTORY && from < end - HISTORY) {
+        from = end - HISTORY;
+      }
+      for (uint64_t s = from; s < first; s++) {
+        ch.history[s & (HISTORY - 1)] = 0;
+      }
+    }
+    ch.history_end = end;
+    if (ch.history_end - ch.history_start > HISTORY) {
+      ch.history_start = ch.history_end - HISTORY;
+    }
+    ch.expected_seq = frame.seq + 1;
+    ch.next_index = (uint64_t)index + 1;
+    ch.last_usec = frame.usec;
+    ch.clock.add(end, ch.usec, frame.arrival_us);
+  }
+  // late ones fill their gap if it is still held
+  for (uint16_t i = 0; i < frame.samples; i++) {
+    if (first + i >= ch.history_start) {
+      ch.history[(first + i) & (HISTORY - 1)] = frame.pcm[i];
+    }
+  }
+}
+
+void Aggregator::render_block(Channel &ch, double t_start, double t_end, int16_t *out, int stride) {
+  if (!ch.clock.ready()) {
+    for (int j = 0; j < BLOCK; j++) {
+      out[j * stride] = 0;
+    }
+    return;
+  }
+  // where the fit says the device is at each end of the block; steer towards
+  // the end rather than jump, so the read position moves smoothly
+  const double target_start = ch.clock.position(t_start);
+  if (!ch.steering || fabs(target_start - ch.position) > MAX_SLIP_SAMPLES) {
+    ch.stats.resyncs += ch.steering;
+    ch.steering = true;
+    ch.position = target_start;
+  }
+  double rate = (ch.clock.position(t_end) - ch.position) / BLOCK;
+  if (rate < 1 - MAX_RATE_ERROR) {
+    rate = 1 - MAX_RATE_ERROR;
+  } else if (rate > 1 + MAX_RATE_ERROR) {
+    rate = 1 + MAX_RATE_ERROR;
+  }
+  ch.rate = rate;
+
+  double pos = ch.position;
+  for (int j = 0; j < BLOCK; j++, pos += rate) {
+    const double whole = floor(pos);
+    const int64_t first = (int64_t)whole - (TAPS / 2 - 1);
+    if (first < (int64_t)ch.history_start || first + TAPS > (int64_t)ch.history_end) {
+      // before the device started, too old, or not here yet
+      ch.stats.starved += first + TAPS > (int64_t)ch.history_end;
+      out[j * stride] = 0;
+      continue;
+    }
+    const float phase = (float)(pos - whole) * PHASES;
+    const int p = (int)phase;
+    const float mix = phase - p;
+    const float *a = sinc_table.taps[p];
+    const float *b = sinc_table.taps[p + 1];
+    float acc = 0;
+    for (int k = 0; k < TAPS; k++) {
+      const float tap = a[k] + (b[k] - a[k]) * mix;
+      acc += tap * ch.history[(uint64_t)(first + k) & (HISTORY - 1)];
+    }
+    const long v = lrintf(acc);
+    out[j * stride] = (int16_t)(v > 32767 ? 32767 : v < -32768 ? -32768 : v);
+  }
+  ch.position = pos;
+}
+
+size_t Aggregator::render(double host_us, int16_t *out, size_t max_frames) {
+  for (auto &ch : channels_) {
+    while (Frame *frame = ch->ring.read_slot()) {
+      ingest(*ch, *frame);
+      ch->ring.release();
+    }
+  }
+  const double until = host_us - latency_us_;
+  if (!started_) {
+    started_ = true;
+    start_us_ = until;
+  }
+  const int n = devices();
+  size_t done = 0;
+  while (done + BLOCK <= max_frames) {
+    const double t_start = time_us();
+    const double t_end = start_us_ + (frames_out_ + BLOCK) * 1e6 / sample_rate_;
+    if (t_end > until) {
+      break;
+    }
+    for (int c = 0; c < n; c++) {
+      render_block(*channels_[c], t_start, t_end, out + done * n + c, n);
+    }
+    frames_out_ += BLOCK;
+    done += BLOCK;
+  }
+  return done;
+}
+
+} // namespace serialmic
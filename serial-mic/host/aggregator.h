@@ -0,0 +1,120 @@
+// Several serial-mics on one timeline
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "clock_fit.h"
+#include "packet.h"
+#include "spsc_ring.h"
+
+namespace serialmic {
+
+// One packet's audio on its way from a reader thread to the aggregator
+struct Frame {
+  static constexpr size_t MAX_SAMPLES = 2 * SAMPLES_PER_PACKET;
+  uint32_t seq;
+  uint32_t usec;
+  double arrival_us; // host monotonic clock when it was read
+  uint16_t samples;
+  int16_t pcm[MAX_SAMPLES];
+};
+// 64 packets is 4s of audio
+using FrameRing = SpscRing<Frame, 64>;
+
+// Host monotonic clock, microseconds
+double monotonic_us();
+
+// Copies a packet into the ring. Returns false if the ring is full (or the
+// packet is too big for a frame).
+bool push_packet(FrameRing &ring, const Packet &pkt, double arrival_us);
+
+// Reads one port on its own thread, parses it and hands the packets over,
+// stamped with the time they were read. Reopens the port if it goes away.
+class DeviceReader {
+public:
+  DeviceReader(const std::string &path, FrameRing &ring, bool verify_crc = true);
+  ~DeviceReader() { stop(); }
+
+  void start();
+  void stop();
+
+  const std::string &path() const { return path_; }
+  uint64_t overflows() const { return overflows_; } // ring was full
+  uint64_t crc_errors() const { return crc_errors_; }
+
+  // PacketParser handler
+  void on_packet(const Packet &pkt);
+  void on_crc_error(uint64_t) { crc_errors_++; }
+
+private:
+  void run();
+
+  std::string path_;
+  FrameRing &ring_;
+  PacketParser parser_;
+  double arrival_us_ = 0;
+  std::atomic<bool> quit_{false};
+  std::atomic<uint64_t> overflows_{0};
+  std::atomic<uint64_t> crc_errors_{0};
+  std::thread thread_;
+};
+
+struct ChannelStats {
+  uint64_t packets = 0;
+  uint64_t lost_packets = 0;
+  uint64_t late_packets = 0; // arrived after newer ones (still used if in time)
+  uint64_t restarts = 0;     // device reset, everything starts again
+  uint64_t starved = 0;      // output samples with no audio in time for them
+  uint64_t resyncs = 0;      // resampler jumped instead of steering
+};
+
+// Puts N streams on the host's clock and interleaves them.
+//
+// Each device's clock is fitted to the host's from its usec stamps, sequence
+// numbers and arrival times (DeviceClock). Output sample k belongs to host
+// time start + k / sample_rate; for each device the resampler steers its
+// read position to where the fit says that device was at that time, with a
+// 16 tap windowed sinc between samples. The output runs `latency_ms` behind
+// the host clock to give packets time to arrive. A device that is late or
+// missing reads as silence.
+class Aggregator {
+public:
+  static constexpr int BLOCK = 160;           // output frames per step
+  static constexpr size_t HISTORY = 1 << 16;  // samples kept per device, 4s
+
+  Aggregator(int devices, int sample_rate = SAMPLE_RATE, double latency_ms = 300);
+  ~Aggregator();
+
+  int devices() const { return (int)channels_.size(); }
+  FrameRing &ring(int dev);
+
+  // Writes interleaved frames for up to `host_us` - latency (in whole
+  // blocks, at most `max_frames`) and returns how many
+  size_t render(double host_us, int16_t *out, size_t max_frames);
+
+  const DeviceClock &clock(int dev) const;
+  const ChannelStats &stats(int dev) const;
+  // Device sample index the next output frame will read
+  double position(int dev) const;
+  // Host time of the next output frame
+  double time_us() const;
+
+private:
+  struct Channel;
+  void ingest(Channel &ch, const Frame &frame);
+  void render_block(Channel &ch, double t_start, double t_end, int16_t *out, int stride);
+
+  int sample_rate_;
+  double latency_us_;
+  bool started_ = false;
+  double start_us_ = 0;
+  uint64_t frames_out_ = 0;
+  std::vector<std::unique_ptr<Channel>> channels_;
+};
+
+} // namespace serialmic
@@ -0,0 +1,184 @@
+#include "audio_source.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "capture_file.h"
+#include "packet.h"
+
+namespace serialmic {
+
+namespace {
+
+uint64_t le_read64(const uint8_t *p) { return le_read32(p) | ((uint64_t)le_read32(p + 4) << 32); }
+
+class WavSource : public AudioSource {
+public:
+  ~WavSource() override {
+    if (map_) {
+      munmap((void *)map_, size_);
+    }
+  }
+
+  bool open(const char *path, int channel);
+  int sample_rate() const override { return rate_; }
+  uint64_t samples() const override { return frames_; }
+  size_t read(uint64_t first, int16_t *out, size_t count) const override {
+    size_t have = first < frames_ ? (size_t)(frames_ - first < count ? frames_ - first : count) : 0;
+    const uint8_t *p = data_ + (first * channels_ + channel_) * 2;
+    if (channels_ == 1) {
+      memcpy(out, p, have * 2);
+    } else {
+      for (size_t i = 0; i < have; i++) {
+        out[i] = (int16_t)le_read16(p + i * channels_ * 2);
+      }
+    }
+    memset(out + have, 0, (count - have) * 2);
+    return have;
+  }
+
+private:
+  const uint8_t *map_ = nullptr;
+  size_t size_ = 0;
+  const uint8_t *data_ = nullptr;
+  uint64_t frames_ = 0;
+  int rate_ = 0;
+  int channels_ = 0;
+  int channel_ = 0;
+};
+
+bool WavSource::open(const char *path, int channel) {
+  int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    fprintf(stderr, "can't open %s: %s\n", path, strerror(errno));
+    return false;
+  }
+  struct stat st;
+  fstat(fd, &st);
+  size_ = (size_t)st.st_size;
+  void *p = size_ >= 12 ? mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+  ::close(fd);
+  if (p == MAP_FAILED) {
+    fprintf(stderr, "can't map %s\n", path);
+    size_ = 0;
+    return false;
+  }
+  map_ = (const uint8_t *)p;
+  madvise(p, size_, MADV_SEQUENTIAL);
+  const bool rf64 = !memcmp(map_, "RF64", 4);
+  uint64_t data_size = 0, ds64_data = 0;
+  int bits = 0;
+  // walk the chunks for ds64, fmt and data
+  size_t pos = 12;
+  while (pos + 8 <= size_) {
+    const uint8_t *c = map_ + pos;
+    uint64_t len = le_read32(c + 4);
+    if (!memcmp(c, "ds64", 4) && len >= 16) {
+      ds64_data = le_read64(c + 16);
+    } else if (!memcmp(c, "fmt ", 4) && len >= 16) {
+      const uint16_t format = le_read16(c + 8);
+      channels_ = le_read16(c + 10);
+      rate_ = (int)le_read32(c + 12);
+      bits = le_read16(c + 22);
+      if (format != 1 && format != 0xFFFE) {
+        bits = 0;
+      }
+    } else if (!memcmp(c, "data", 4)) {
+      data_ = c + 8;
+      data_size = rf64 && len == 0xFFFFFFFF ? ds64_data : len;
+      // a recorder that was killed leaves the size short; take what's there
+      if (data_size > size_ - (pos + 8) || data_size == 0) {
+        data_size = size_ - (pos + 8);
+      }
+      break;
+    }
+    pos += 8 + len + (len & 1);
+  }
+  if (memcmp(map_ + 8, "WAVE", 4) || !data_ || bits != 16 || channels_ < 1 || rate_ <= 0) {
+    fprintf(stderr, "%s: not a 16 bit PCM WAV\n", path);
+    return false;
+  }
+  if (channel < 0 || channel >= channels_) {
+    fprintf(stderr, "%s has %d channels\n", path, channels_);
+    return false;
+  }
+  channel_ = channel;
+  frames_ = data_size / (2 * channels_);
+  return true;
+}
+
+class CaptureSource : public AudioSource {
+public:
+  bool open(const char *path) {
+    if (!reader_.open(path)) {
+      return false;
+    }
+    ps_ = reader_.header().packet_samples;
+    CapPacket p;
+    const int64_t first = reader_.stored_from(0);
+    if (first >= 0 && reader_.packet((uint64_t)first, p)) {
+      start_ = p.host_us - (int64_t)(first * ps_ * 1e6 / sample_rate());
+    }
+    return true;
+  }
+  int sample_rate() const override { return (int)reader_.header().sample_rate; }
+  uint64_t samples() const override { return reader_.end() * ps_; }
+  size_t read(uint64_t first, int16_t *out, size_t count) const override {
+    size_t done = 0, have = 0;
+    uint64_t n = first / ps_;
+    size_t skip = (size_t)(first % ps_);
+    while (done < count) {
+      size_t take = ps_ - skip;
+      if (take > count - done) {
+        take = count - done;
+      }
+      CapPacket p;
+      if (reader_.packet(n, p) && skip + take <= p.record->payload_len / 2u) {
+        memcpy(out + done, p.pcm + skip, take * 2);
+        have += take;
+      } else {
+        memset(out + done, 0, take * 2);
+      }
+      done += take;
+      skip = 0;
+      n++;
+    }
+    return have;
+  }
+  int64_t start_host_us() const override { return start_; }
+
+private:
+  CaptureReader reader_;
+  size_t ps_ = SAMPLES_PER_PACKET;
+  int64_t start_ = 0;
+};
+
+} // namespace
+
+std::unique_ptr<AudioSource> open_audio(const char *path, int channel) {
+  char magic[8] = {0};
+  FILE *f = fopen(path, "rb");
+  if (!f) {
+    fprintf(stderr, "can't open %s: %s\n", path, strerror(errno));
+    return nullptr;
+  }
+  size_t got = fread(magic, 1, sizeof(magic), f);
+  fclose(f);
+  if (got == sizeof(magic) && !memcmp(magic, CAP_MAGIC, sizeof(magic))) {
+    std::unique_ptr<CaptureSource> cap(new CaptureSource);
+    if (channel != 0) {
+      fprintf(stderr, "%s is a capture, it has one channel\n", path);
+      return nullptr;
+    }
+    return cap->open(path) ? std::move(cap) : nullptr;
+  }
+  std::unique_ptr<WavSource> wav(new WavSource);
+  return wav->open(path, channel) ? std::move(wav) : nullptr;
+}
+
+} // namespace serialmic
@@ -0,0 +1,30 @@
+// Recorded audio for the batch tools: WAV/RF64 files or captures
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace serialmic {
+
+// One channel of a recording, read by sample position. read() may be called
+// from several threads at once.
+class AudioSource {
+public:
+  virtual ~AudioSource() = default;
+  virtual int sample_rate() const = 0;
+  virtual uint64_t samples() const = 0;
+  // Samples [first, first + count) into `out`, silence past the end or
+  // where the recording has a hole. Returns how many were in the recording.
+  virtual size_t read(uint64_t first, int16_t *out, size_t count) const = 0;
+  // Host wall clock of sample 0 in us, 0 if the file doesn't say
+  virtual int64_t start_host_us() const { return 0; }
+};
+
+// A 16 bit PCM WAV (RIFF or RF64, as serialmic_record and
+// serialmic_aggregate write them; `channel` picks one of several) or a
+// capture from serialmic_capture, told apart by their first bytes. The file
+// is mapped, not read. nullptr with a message on stderr if it can't be used.
+std::unique_ptr<AudioSource> open_audio(const char *path, int channel = 0);
+
+} // namespace serialmic
@@ -0,0 +1,281 @@
+// Aggregator benchmark
+//
+// Alignment: simulated serial-mics with their own crystals (up to +-50ppm),
+// power-on times and usec counters (which wrap), all hearing the same sound.
+// Each packet is stamped late by the device's scheduling and read late by
+// the host after a random USB delay with the odd long stall, and some are
+// lost. Once the clock fits have settled it reports
+//   - the drift estimate against the true crystal error
+//   - how far each device's read position is from where it should be
+//     (everyone's error, and each device against the others)
+//   - how closely the output channels match each other, which is what the
+//     alignment is for
+// Throughput: a reader thread per simulated device pushing packets through
+// the parser as fast as it can, and one thread rendering the output.
+//
+//   bench_aggregate [--devices 8] [--seconds 180]
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "aggregator.h"
+
+using namespace serialmic;
+
+#define TONES 8
+#define USB_BASE_US 1000.0 // shortest trip from device to host
+#define SETTLE_SEC 60      // left out of the alignment figures
+
+static double now_sec(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// The sound everyone hears, at any time
+struct Scene {
+  double freq[TONES], amp[TONES], phase[TONES];
+  explicit Scene(std::mt19937 &rng) {
+    std::uniform_real_distribution<double> u(0, 1);
+    for (int i = 0; i < TONES; i++) {
+      freq[i] = 100 * pow(60, u(rng)); // 100Hz to 6kHz
+      amp[i] = 2500;
+      phase[i] = 2 * M_PI * u(rng);
+    }
+  }
+  double at(double t) const {
+    double v = 0;
+    for (int i = 0; i < TONES; i++) {
+      v += amp[i] * sin(2 * M_PI * freq[i] * t + phase[i]);
+    }
+    return v;
+  }
+};
+
+struct SimDevice {
+  double ppm;      // crystal error
+  double start;    // true time of sample 0, seconds
+  uint32_t usec0;  // usec counter at sample 0
+  double rate() const { return SAMPLE_RATE * (1 + ppm * 1e-6); }
+  uint32_t next_seq = 0;
+  double last_arrival = 0;
+  // the next packet, ready to go when the host time reaches `arrival`
+  bool ready = false;
+  Packet pkt;
+  double arrival;
+  uint8_t bytes[MAX_PKT_BYTES];
+};
+
+// Captures, stamps and sends the next packet
+static void make_packet(SimDevice &d, const Scene &scene, std::mt19937 &rng) {
+  std::uniform_real_distribution<double> u(0, 1);
+  std::exponential_distribution<double> usb(1.0 / 1000); // mean 1ms
+  for (;;) {
+    const uint32_t seq = d.next_seq++;
+    int16_t pcm[SAMPLES_PER_PACKET];
+    const double first = seq * (double)SAMPLES_PER_PACKET;
+    for (size_t i = 0; i < SAMPLES_PER_PACKET; i++) {
+      pcm[i] = (int16_t)lrint(scene.at(d.start + (first + i) / d.rate()));
+    }
+    const double done = d.start + (first + SAMPLES_PER_PACKET) / d.rate();
+    // stamped after i2s_read returns, by the device's own clock
+    const double sched_us = u(rng) < 0.01 ? 3000 : 300 * u(rng);
+    const uint32_t usec = d.usec0 + (uint32_t)llrint(((done - d.start) * 1e6 + sched_us) * (1 + d.ppm * 1e-6));
+    double arrival = done * 1e6 + sched_us + USB_BASE_US + usb(rng);
+    if (u(rng) < 0.02) {
+      arrival += 5000 + 25000 * u(rng); // the host was busy
+    }
+    arrival = std::max(arrival, d.last_arrival); // it's a FIFO
+    d.last_arrival = arrival;
+    if (u(rng) < 0.005) {
+      continue; // lost
+    }
+    encode_packet(d.bytes, seq, usec, pcm, SAMPLES_PER_PACKET);
+    d.pkt.seq = seq;
+    d.pkt.usec = usec;
+    d.pkt.payload = d.bytes + PKT_HEADER_LEN;
+    d.pkt.payload_len = SAMPLES_PER_PACKET * 2;
+    d.pkt.offset = 0;
+    d.arrival = arrival;
+    d.ready = true;
+    return;
+  }
+}
+
+static void bench_alignment(int devices, double seconds) {
+  std::mt19937 rng(1234);
+  std::uniform_real_distribution<double> u(0, 1);
+  Scene scene(rng);
+  std::vector<SimDevice> sim(devices);
+  for (auto &d : sim) {
+    d.ppm = 100 * u(rng) - 50;
+    d.start = 2 * u(rng);
+    d.usec0 = (uint32_t)(u(rng) * 4294967295.0);
+    make_packet(d, scene, rng);
+  }
+
+  Aggregator agg(devices, SAMPLE_RATE, 300);
+  std::vector<int16_t> out(Aggregator::BLOCK * devices * 16);
+  double sum_abs = 0, max_abs = 0, sum_rel = 0, max_rel = 0;
+  long count = 0;
+  double signal = 0, residual = 0;
+  for (double t = 0; t < seconds * 1e6; t += 10000) {
+    for (auto &d : sim) {
+      while (d.arrival <= t) {
+        push_packet(agg.ring(&d - &sim[0]), d.pkt, d.arrival);
+        make_packet(d, scene, rng);
+      }
+    }
+    size_t done = 0;
+    for (;;) {
+      // time and positions of the block about to be rendered
+      const double t_block = agg.time_us() / 1e6;
+      std::vector<double> pos(devices);
+      for (int i = 0; i < devices; i++) {
+        pos[i] = agg.position(i);
+      }
+      size_t n = agg.render(t, &out[0], Aggregator::BLOCK);
+      if (n == 0) {
+        break;
+      }
+      done += n;
+      if (t_block < SETTLE_SEC) {
+        continue;
+      }
+      // errors in microseconds: against the truth less the shortest trip,
+      // and against the mean of the devices
+      std::vector<double> err(devices);
+      double mean = 0;
+      for (int i = 0; i < devices; i++) {
+        const double truth = (t_block - USB_BASE_US * 1e-6 - sim[i].start) * sim[i].rate();
+        err[i] = (pos[i] - truth) / sim[i].rate() * 1e6;
+        mean += err[i] / devices;
+      }
+      for (int i = 0; i < devices; i++) {
+        sum_abs += err[i] * err[i];
+        max_abs = std::max(max_abs, fabs(err[i]));
+        sum_rel += (err[i] - mean) * (err[i] - mean);
+        max_rel = std::max(max_rel, fabs(err[i] - mean));
+        count++;
+      }
+      for (size_t j = 0; j < n; j++) {
+        for (int i = 1; i < devices; i++) {
+          const double a = out[j * devices];
+          const double b = out[j * devices + i];
+          signal += a * a;
+          residual += (a - b) * (a - b);
+        }
+      }
+    }
+  }
+
+  printf("%d devices, %.0f s (first %d s left out)\n", devices, seconds, SETTLE_SEC);
+  printf("  dev    true ppm  estimated  rate (own clock)  lost  late  starved  resyncs\n");
+  for (int i = 0; i < devices; i++) {
+    const ChannelStats &s = agg.stats(i);
+    printf("  %3d  %+9.2f  %+9.2f  %12.3f Hz  %4llu  %4llu  %7llu  %7llu\n", i, sim[i].ppm,
+           agg.clock(i).drift_ppm(), agg.clock(i).device_rate(), (unsigned long long)s.lost_packets,
+           (unsigned long long)s.late_packets, (unsigned long long)s.starved,
+           (unsigned long long)s.resyncs);
+  }
+  double worst_ppm = 0;
+  for (auto &d : sim) {
+    worst_ppm = std::max(worst_ppm, fabs(d.ppm));
+  }
+  printf("  alignment to true time:      rms %6.1f us  max %6.1f us\n", sqrt(sum_abs / count), max_abs);
+  printf("  alignment between devices:   rms %6.1f us  max %6.1f us\n", sqrt(sum_rel / count), max_rel);
+  printf("  channel match (vs channel 0): %.1f dB\n", 10 * log10(signal / residual));
+  printf("  (by start time alone the worst device would be %.1f ms out after %.0f s)\n\n",
+         worst_ppm * 1e-6 * seconds * 1e3, seconds);
+}
+
+// ====================== Throughput ======================
+static void bench_throughput(int devices, int packets) {
+  Aggregator agg(devices, SAMPLE_RATE, 300);
+  std::vector<std::atomic<int64_t>> sent(devices);
+  for (auto &s : sent) {
+    s = 0;
+  }
+  std::vector<std::thread> readers;
+  const double t0 = now_sec();
+  for (int d = 0; d < devices; d++) {
+    readers.emplace_back([&, d] {
+      struct Pusher {
+        FrameRing &ring;
+        double arrival;
+        void on_packet(const Packet &pkt) {
+          while (!push_packet(ring, pkt, arrival)) {
+            std::this_thread::yield();
+          }
+        }
+        void on_crc_error(uint64_t) {}
+      } pusher{agg.ring(d), 0};
+      PacketParser parser;
+      int16_t pcm[SAMPLES_PER_PACKET];
+      for (size_t i = 0; i < SAMPLES_PER_PACKET; i++) {
+        pcm[i] = (int16_t)(i * 37 + d);
+      }
+      uint8_t bytes[MAX_PKT_BYTES];
+      for (int k = 0; k < packets; k++) {
+        const uint32_t usec = (uint32_t)(k + 1) * 64000;
+        const size_t len = encode_packet(bytes, k, usec, pcm, SAMPLES_PER_PACKET);
+        pusher.arrival = usec + 1000;
+        parser.feed(bytes, len, pusher);
+        sent[d].store(usec + 1000, std::memory_order_release);
+      }
+    });
+  }
+
+  std::vector<int16_t> out(Aggregator::BLOCK * devices * 64);
+  size_t frames = 0;
+  double busy = 0;
+  const int64_t last = (int64_t)packets * 64000 + 1000;
+  for (;;) {
+    int64_t now = INT64_MAX;
+    for (auto &s : sent) {
+      now = std::min(now, s.load(std::memory_order_acquire));
+    }
+    const double r0 = now_sec();
+    const size_t n = agg.render((double)now + 300e3, &out[0], out.size() / devices);
+    busy += now_sec() - r0;
+    frames += n;
+    if (n == 0) {
+      if (now == last) {
+        break;
+      }
+      std::this_thread::yield();
+    }
+  }
+  const double wall = now_sec() - t0;
+  for (auto &r : readers) {
+    r.join();
+  }
+  const double audio = (double)frames / SAMPLE_RATE;
+  printf("%4d devices: %6.0fx real time, %5.0f device-streams in all; render %4.1f us per device per 10ms\n",
+         devices, audio / wall, audio * devices / wall,
+         busy / (frames / (double)Aggregator::BLOCK) / devices * 1e6);
+}
+
+int main(int argc, char **argv) {
+  int devices = 8;
+  double seconds = 180;
+  for (int i = 1; i + 1 < argc; i += 2) {
+    if (!strcmp(argv[i], "--devices")) {
+      devices = atoi(argv[i + 1]);
+    } else if (!strcmp(argv[i], "--seconds")) {
+      seconds = atof(argv[i + 1]);
+    }
+  }
+  bench_alignment(devices, seconds);
+  for (int n : {1, 4, 16, 64}) {
+    bench_throughput(n, 2000);
+  }
+  return 0;
+}
@@ -0,0 +1,350 @@
+// WebSocket bridge benchmark
+//
+// What serialmic_bridge costs and how long a packet takes to reach a page:
+//   - the analysis of one packet (scope, spectrum, bands, pitch, level) and
+//     encoding its frame, us per packet, and the frame's size against the
+//     packet's
+//   - end to end through the real serialmic_bridge: packets written into a
+//     pipe it reads, frames read back by 1, 4 and 16 WebSocket clients in
+//     this process. Latency from the write to the frame arriving, at the
+//     device's rate and at 60x it, with the bridge's CPU per packet (from
+//     /proc) and any frames dropped
+//
+// The browser's side of the comparison - decoding and drawing frames
+// against the Web Serial path's parsing and analysis - is measured by the
+// frontend's bench.html.
+//
+//   bench_bridge [--seconds 5] [--bridge PATH]
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
+#include <string>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "live_analysis.h"
+#include "packet.h"
+
+using namespace serialmic;
+
+static double now_sec(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint32_t rng = 12345;
+static uint32_t rand32(void) {
+  rng = rng * 1664525u + 1013904223u;
+  return rng;
+}
+
+// A voice-ish test signal: a 220Hz tone with harmonics over some noise
+static void make_packet_pcm(int16_t *pcm, size_t n, uint64_t first) {
+  for (size_t i = 0; i < n; i++) {
+    const double t = (double)(first + i) / SAMPLE_RATE;
+    double v = 0;
+    for (int h = 1; h <= 4; h++) {
+      v += 0.15 / h * sin(2 * M_PI * 220 * h * t);
+    }
+    v += ((int32_t)(rand32() >> 16) - 32768) / 32768.0 * 0.02;
+    pcm[i] = (int16_t)(v * 32767);
+  }
+}
+
+static void bench_analysis(void) {
+  LiveConfig config;
+  LiveAnalyzer analyzer(config);
+  const size_t n = SAMPLES_PER_PACKET;
+  const int packets = 2000;
+  std::vector<int16_t> pcm(n * 16);
+  for (int i = 0; i < 16; i++) {
+    make_packet_pcm(pcm.data() + i * n, n, (uint64_t)i * n);
+  }
+  LiveFrame frame;
+  std::vector<uint8_t> msg;
+  double t0 = now_sec();
+  for (int i = 0; i < packets; i++) {
+    analyzer.analyze(pcm.data() + (i % 16) * n, n, &frame);
+  }
+  const double analyze_us = (now_sec() - t0) / packets * 1e6;
+  t0 = now_sec();
+  for (int i = 0; i < packets; i++) {
+    encode_live_frame(frame, config.rate, nullptr, 0, 0, &msg);
+  }
+  const double encode_us = (now_sec() - t0) / packets * 1e6;
+  const size_t frame_bytes = msg.size();
+  encode_live_frame(frame, config.rate, pcm.data(), n, 0, &msg);
+  printf("analysis:   %.1f us per packet (%.2f%% of a core at %d packets/s)\n", analyze_us,
+         analyze_us * SAMPLE_RATE / n / 1e4, (int)(SAMPLE_RATE / n));
+  printf("encoding:   %.2f us per frame\n", encode_us);
+  printf("frame size: %zu bytes (packet %zu bytes), %zu with PCM\n", frame_bytes, PKT_OVERHEAD + 2 * n,
+         msg.size());
+  printf("pitch of the 220Hz test signal: %.1f Hz, confidence %.2f\n\n", frame.pitch_hz, frame.pitch_confidence);
+}
+
+// ====================== WebSocket client ======================
+
+struct Client {
+  int fd = -1;
+  std::string in;
+  bool open = false;
+  uint64_t frames = 0;
+};
+
+static bool ws_connect(Client *c, int port) {
+  c->fd = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons((uint16_t)port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  for (int attempt = 0; attempt < 50; attempt++) {
+    if (connect(c->fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+      const int one = 1;
+      setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+      const char *req = "GET / HTTP/1.1\r\nHost: 127.0.0.1\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+                        "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nSec-WebSocket-Version: 13\r\n\r\n";
+      return write(c->fd, req, strlen(req)) == (ssize_t)strlen(req);
+    }
+    usleep(20 * 1000); // the bridge may still be starting
+  }
+  perror("connect");
+  return false;
+}
+
+// Whole messages out of c->in; binary ones give their seq to `on_frame`
+template <class F> static bool ws_parse(Client *c, F on_frame) {
+  if (!c->open) {
+    const size_t end = c->in.find("\r\n\r\n");
+    if (end == std::string::npos) {
+      return true;
+    }
+    // the key is RFC 6455's example, so the answer is known
+    if (c->in.compare(0, 12, "HTTP/1.1 101") || c->in.find("s3pPLMBiTxaQ9kYGzzhZRbK+xOo=") == std::string::npos) {
+      fprintf(stderr, "bad handshake: %s\n", c->in.c_str());
+      return false;
+    }
+    c->in.erase(0, end + 4);
+    c->open = true;
+  }
+  size_t pos = 0;
+  for (;;) {
+    const uint8_t *p = (const uint8_t *)c->in.data() + pos;
+    const size_t avail = c->in.size() - pos;
+    if (avail < 2) {
+      break;
+    }
+    uint64_t len = p[1] & 0x7F;
+    size_t head = 2;
+    if (len == 126) {
+      if (avail < 4) {
+        break;
+      }
+      len = (uint64_t)p[2] << 8 | p[3];
+      head = 4;
+    } else if (len == 127) {
+      if (avail < 10) {
+        break;
+      }
+      len = 0;
+      for (int i = 0; i < 8; i++) {
+        len = len << 8 | p[2 + i];
+      }
+      head = 10;
+    }
+    if (avail < head + len) {
+      break;
+    }
+    if ((p[0] & 0x0F) == 2 && len >= LIVE_HEADER_LEN) {
+      on_frame(le_read32(p + head + 4));
+      c->frames++;
+    }
+    pos += head + (size_t)len;
+  }
+  c->in.erase(0, pos);
+  return true;
+}
+
+static double process_cpu_sec(pid_t pid) {
+  char path[64];
+  snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+  FILE *f = fopen(path, "r");
+  if (!f) {
+    return 0;
+  }
+  char buf[1024];
+  const size_t n = fread(buf, 1, sizeof(buf) - 1, f);
+  fclose(f);
+  buf[n] = 0;
+  // fields after the ")" of the command name: state is 3, utime 14, stime 15
+  const char *p = strrchr(buf, ')');
+  unsigned long utime = 0, stime = 0;
+  if (!p || sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) != 2) {
+    return 0;
+  }
+  return (double)(utime + stime) / sysconf(_SC_CLK_TCK);
+}
+
+static void run_end_to_end(const char *bridge_path, int clients, double speed, double seconds) {
+  static int next_port = 0;
+  if (!next_port) {
+    next_port = 20000 + getpid() % 20000;
+  }
+  const int port = next_port++;
+  int pipe_fds[2];
+  if (pipe(pipe_fds) != 0) {
+    perror("pipe");
+    return;
+  }
+  char port_str[16];
+  snprintf(port_str, sizeof(port_str), "%d", port);
+  const pid_t pid = fork();
+  if (pid == 0) {
+    dup2(pipe_fds[0], 0);
+    close(pipe_fds[0]);
+    close(pipe_fds[1]);
+    execl(bridge_path, bridge_path, "-", "--port", port_str, "--quiet", (char *)nullptr);
+    perror(bridge_path);
+    _exit(1);
+  }
+  close(pipe_fds[0]);
+  const int out = pipe_fds[1];
+
+  std::vector<Client> cs(clients);
+  for (Client &c : cs) {
+    if (!ws_connect(&c, port)) {
+      kill(pid, SIGTERM);
+      waitpid(pid, nullptr, 0);
+      close(out);
+      return;
+    }
+  }
+
+  const size_t n = SAMPLES_PER_PACKET;
+  const double interval = (double)n / SAMPLE_RATE / speed;
+  const uint32_t total = (uint32_t)(seconds / interval);
+  std::vector<double> sent_at(total, 0);
+  std::vector<double> latencies;
+  latencies.reserve((size_t)total * clients);
+  std::atomic<uint32_t> written{0};
+
+  // the writer paces packets out like a device; this thread reads
+  std::thread writer([&]() {
+    std::vector<int16_t> pcm(n);
+    std::vector<uint8_t> pkt(PKT_OVERHEAD + 2 * n);
+    const double start = now_sec() + 0.2; // let the handshakes finish
+    for (uint32_t seq = 0; seq < total; seq++) {
+      make_packet_pcm(pcm.data(), n, (uint64_t)seq * n);
+      const size_t len = encode_packet(pkt.data(), seq, (uint32_t)(seq * n * 1e6 / SAMPLE_RATE), pcm.data(), n);
+      const double due = start + seq * interval;
+      double now;
+      while ((now = now_sec()) < due) {
+        const double wait = due - now;
+        if (wait > 0.0005) {
+          usleep((useconds_t)((wait - 0.0003) * 1e6));
+        }
+      }
+      sent_at[seq] = now_sec();
+      written.store(seq + 1, std::memory_order_release);
+      if (write(out, pkt.data(), len) != (ssize_t)len) {
+        break;
+      }
+    }
+  });
+
+  const double cpu_start = process_cpu_sec(pid);
+  std::vector<struct pollfd> fds(clients);
+  const double deadline = now_sec() + seconds + 3;
+  char buf[64 * 1024];
+  uint64_t received = 0;
+  while (now_sec() < deadline && received < (uint64_t)total * clients) {
+    for (int i = 0; i < clients; i++) {
+      fds[i] = {cs[i].fd, POLLIN, 0};
+    }
+    if (poll(fds.data(), fds.size(), 100) <= 0) {
+      continue;
+    }
+    const double now = now_sec();
+    for (int i = 0; i < clients; i++) {
+      if (!(fds[i].revents & POLLIN)) {
+        continue;
+      }
+      const ssize_t got = read(cs[i].fd, buf, sizeof(buf));
+      if (got <= 0) {
+        continue;
+      }
+      cs[i].in.append(buf, (size_t)got);
+      ws_parse(&cs[i], [&](uint32_t seq) {
+        received++;
+        if (seq < written.load(std::memory_order_acquire)) {
+          latencies.push_back(now - sent_at[seq]);
+        }
+      });
+    }
+  }
+  writer.join();
+  const double cpu = process_cpu_sec(pid) - cpu_start;
+  close(out);
+  kill(pid, SIGTERM);
+  waitpid(pid, nullptr, 0);
+  for (Client &c : cs) {
+    close(c.fd);
+  }
+
+  std::sort(latencies.begin(), latencies.end());
+  auto pct = [&](double q) { return latencies.empty() ? NAN : latencies[(size_t)(q * (latencies.size() - 1))] * 1e3; };
+  const uint64_t expected = (uint64_t)total * clients;
+  printf("%7d %6.0fx %8u %9.2f %9.2f %9.2f %10.1f %8llu\n", clients, speed, total, pct(0.5), pct(0.99),
+         latencies.empty() ? NAN : latencies.back() * 1e3, cpu / total * 1e6,
+         (unsigned long long)(expected - std::min(expected, received)));
+}
+
+int main(int argc, char **argv) {
+  double seconds = 5;
+  std::string bridge;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--seconds") && i + 1 < argc) {
+      seconds = atof(argv[++i]);
+    } else if (!strcmp(argv[i], "--bridge") && i + 1 < argc) {
+      bridge = argv[++i];
+    } else {
+      fprintf(stderr, "usage: bench_bridge [--seconds 5] [--bridge PATH]\n");
+      return 1;
+    }
+  }
+  if (bridge.empty()) {
+    // serialmic_bridge is built next to this
+    char self[PATH_MAX];
+    const ssize_t len = readlink("/proc/self/exe", self, sizeof(self) - 1);
+    self[len > 0 ? len : 0] = 0;
+    bridge = self;
+    bridge = bridge.substr(0, bridge.rfind('/') + 1) + "serialmic_bridge";
+  }
+  signal(SIGPIPE, SIG_IGN);
+
+  bench_analysis();
+  printf("end to end through %s, %.0fs each\n", bridge.c_str(), seconds);
+  printf("%7s %7s %8s %9s %9s %9s %10s %8s\n", "clients", "speed", "packets", "p50 ms", "p99 ms", "max ms",
+         "cpu us/pkt", "missing");
+  for (double speed : {1.0, 60.0}) {
+    for (int clients : {1, 4, 16}) {
+      run_end_to_end(bridge.c_str(), clients, speed, seconds);
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,282 @@
+// Capture file benchmark
+//
+// How an indexed capture holds up once it's big. It writes a synthetic
+// recording of several GB - a day or two of one device, with packets lost
+// singly and in bursts, CRC failures, and the device unplugged for a couple
+// of hours and restarting - then measures:
+//   - writing: MB/s of packets, and bytes written per byte of packet stream
+//     (write amplification: records are padded, and checkpoints rewrite
+//     headers)
+//   - opening the file (there is no index to load)
+//   - random lookups by seq, by device clock and by time of day, each
+//     reading the packet it finds, with the file in the page cache and
+//     after it has been dropped (from disk). Every lookup is checked.
+//   - for scale: finding a time of day by reading every chunk header
+//
+//   bench_capture [--dir /tmp] [--gb 4] [--lookups 200000] [--keep]
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include "capture_file.h"
+
+using namespace serialmic;
+
+static double now_sec(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint32_t rng = 12345;
+static uint32_t rand32(void) {
+  rng = rng * 1664525u + 1013904223u;
+  return rng;
+}
+static uint64_t rand64(void) { return ((uint64_t)rand32() << 32) | rand32(); }
+
+// Packet number n's payload starts with n, so a lookup can be checked
+static void write_capture(const char *path, uint64_t stream_bytes, double *mb_per_sec, double *amplification,
+                          uint64_t *packets_out) {
+  CaptureWriter writer;
+  if (!writer.open(path)) {
+    exit(1);
+  }
+  uint8_t pkt_buf[PKT_OVERHEAD + SAMPLES_PER_PACKET * 2];
+  for (size_t i = 0; i < sizeof(pkt_buf); i++) {
+    pkt_buf[i] = (uint8_t)rand32();
+  }
+  Packet pkt;
+  pkt.payload = pkt_buf + PKT_HEADER_LEN;
+  pkt.payload_len = SAMPLES_PER_PACKET * 2;
+  pkt.offset = 0;
+
+  const uint64_t total = stream_bytes / (PKT_OVERHEAD + SAMPLES_PER_PACKET * 2);
+  uint32_t seq = 1000;
+  double usec = 123456789.0; // device clock, 20 ppm fast
+  int64_t host_us = realtime_us() - (int64_t)(total * 64000 + 2 * 3600e6);
+  uint64_t written = 0;
+  const double start = now_sec();
+  for (uint64_t i = 0; i < total; i++) {
+    if (i == total / 2) {
+      // unplugged for two hours, back with a fresh seq and clock
+      host_us += (int64_t)(2 * 3600e6);
+      seq = 0;
+      usec = 2.5e6;
+    }
+    uint32_t r = rand32();
+    if (r % 500 == 0) {
+      seq++; // one lost
+      usec += 64000 * 1.00002;
+      host_us += 64000;
+    } else if (r % 20000 == 1) {
+      seq += 40; // a burst
+      usec += 40 * 64000 * 1.00002;
+      host_us += 40 * 64000;
+    }
+    if (r % 3000 == 2) {
+      writer.add_crc_error();
+    }
+    pkt.seq = seq++;
+    pkt.usec = (uint32_t)(uint64_t)usec;
+    memcpy(pkt_buf + PKT_HEADER_LEN, &i, sizeof(i));
+    // arrival jitters by a few ms
+    writer.add(pkt, host_us + (int64_t)(r % 4000));
+    usec += 64000 * 1.00002;
+    host_us += 64000;
+    written += PKT_OVERHEAD + pkt.payload_len;
+  }
+  writer.close();
+  const double elapsed = now_sec() - start;
+  *mb_per_sec = written / elapsed / 1e6;
+  *amplification = (double)writer.bytes_written() / written;
+  *packets_out = writer.header().packets;
+}
+
+// Forget the file's pages, so the next lookups come from disk
+static bool drop_cache(const char *path) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  fdatasync(fd);
+  bool ok = posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) == 0;
+  close(fd);
+  return ok;
+}
+
+struct Target {
+  uint64_t packet;
+  uint32_t seq;
+  uint64_t usec;
+  int64_t host_us;
+};
+
+enum { BY_SEQ, BY_USEC, BY_TIME };
+
+// Lookups by one key, each reading the packet found. Returns latencies in us.
+static std::vector<double> lookups(const CaptureReader &reader, const std::vector<Target> &targets, int by,
+                                   uint64_t *wrong) {
+  std::vector<double> lat;
+  lat.reserve(targets.size());
+  volatile int64_t sink = 0;
+  for (const Target &t : targets) {
+    const double t0 = now_sec();
+    int64_t n = by == BY_SEQ ? reader.find_seq(t.seq)
+                : by == BY_USEC ? reader.find_usec(t.usec)
+                                : reader.find_host_time(t.host_us);
+    CapPacket p;
+    int64_t sum = 0;
+    if (n >= 0 && reader.packet((uint64_t)n, p)) {
+      for (size_t i = 0; i < p.record->payload_len / 2; i += 64) {
+        sum += p.pcm[i];
+      }
+    }
+    lat.push_back((now_sec() - t0) * 1e6);
+    sink += sum;
+    uint64_t marker = 0;
+    if (n >= 0 && reader.packet((uint64_t)n, p)) {
+      memcpy(&marker, p.pcm, sizeof(marker));
+    }
+    // the host times of neighbours can tie, any packet with the time is right
+    if (n < 0 || (by == BY_TIME ? p.host_us != t.host_us : marker != t.packet)) {
+      (*wrong)++;
+    }
+  }
+  (void)sink;
+  return lat;
+}
+
+static void print_lookups(const char *what, std::vector<double> lat, uint64_t wrong) {
+  std::sort(lat.begin(), lat.end());
+  double sum = 0;
+  for (double v : lat) {
+    sum += v;
+  }
+  const size_t n = lat.size();
+  printf("  %-22s %8zu %9.2f %9.2f %9.2f %9.2f %7llu\n", what, n, sum / n, lat[n / 2], lat[n * 99 / 100],
+         lat[n - 1], (unsigned long long)wrong);
+}
+
+int main(int argc, char **argv) {
+  std::string dir = "/tmp";
+  double gb = 4;
+  size_t count = 200000;
+  bool keep = false;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--dir") && i + 1 < argc) {
+      dir = argv[++i];
+    } else if (!strcmp(argv[i], "--gb") && i + 1 < argc) {
+      gb = atof(argv[++i]);
+    } else if (!strcmp(argv[i], "--lookups") && i + 1 < argc) {
+      count = (size_t)atol(argv[++i]);
+    } else if (!strcmp(argv[i], "--keep")) {
+      keep = true;
+    } else {
+      fprintf(stderr, "usage: bench_capture [--dir /tmp] [--gb 4] [--lookups 200000] [--keep]\n");
+      return 1;
+    }
+  }
+  const std::string path = dir + "/bench_capture.smc";
+
+  printf("writing %.1f GB of packet stream (%.1f hours of one device)\n", gb,
+         gb * 1e9 / DEVICE_BYTES_PER_SEC / 3600);
+  double mb_per_sec, amplification;
+  uint64_t packets;
+  write_capture(path.c_str(), (uint64_t)(gb * 1e9), &mb_per_sec, &amplification, &packets);
+  struct stat st;
+  stat(path.c_str(), &st);
+  printf("  %.0f MB/s (%.0f devices), %.3f bytes written per byte of stream\n", mb_per_sec,
+         mb_per_sec * 1e6 / DEVICE_BYTES_PER_SEC, amplification);
+  printf("  file %.2f GB, %.2f GB on disk\n", st.st_size / 1e9, st.st_blocks * 512 / 1e9);
+
+  CaptureReader reader;
+  double t0 = now_sec();
+  if (!reader.open(path.c_str())) {
+    return 1;
+  }
+  printf("open: %.1f us, %llu chunks, %llu packets\n", (now_sec() - t0) * 1e6,
+         (unsigned long long)reader.chunks(), (unsigned long long)packets);
+
+  // targets: random stored packets, with their keys as the reader sees them
+  std::vector<Target> targets;
+  while (targets.size() < count) {
+    int64_t n = reader.stored_from(rand64() % reader.end());
+    CapPacket p;
+    if (n < 0 || !reader.packet((uint64_t)n, p)) {
+      continue;
+    }
+    uint64_t marker;
+    memcpy(&marker, p.pcm, sizeof(marker));
+    targets.push_back({marker, p.record->seq, p.usec, p.host_us});
+  }
+  printf("\nlookup + read                 count   mean us    p50 us    p99 us    max us   wrong\n");
+  for (int cold = 0; cold < 2; cold++) {
+    if (cold) {
+      reader.close();
+      if (!drop_cache(path.c_str())) {
+        printf("  (can't drop the page cache here, skipping cold lookups)\n");
+        break;
+      }
+      reader.open(path.c_str());
+    }
+    const char *names[] = {"seq", "device clock", "time of day"};
+    for (int by = BY_SEQ; by <= BY_TIME; by++) {
+      std::vector<Target> some = targets;
+      if (cold) {
+        some.resize(std::min<size_t>(targets.size(), 2000));
+        reader.close();
+        drop_cache(path.c_str());
+        reader.open(path.c_str());
+      }
+      uint64_t wrong = 0;
+      if (by == BY_SEQ) {
+        // seqs start again from 0 after the reconnect and find_seq gives the
+        // first packet with a seq, so only look up the ones that are unique:
+        // before the reconnect, or below where the first run started
+        std::vector<Target> unique;
+        for (const Target &t : some) {
+          if (t.packet < packets / 2 || t.seq < 1000) {
+            unique.push_back(t);
+          }
+        }
+        some.swap(unique);
+      }
+      std::string what = std::string(cold ? "disk, " : "cached, ") + names[by];
+      std::vector<double> lat = lookups(reader, some, by, &wrong);
+      print_lookups(what.c_str(), lat, wrong);
+    }
+  }
+
+  // for scale, what an index-less search costs: every chunk header
+  reader.close();
+  reader.open(path.c_str());
+  t0 = now_sec();
+  int found = 0;
+  const int scans = 20;
+  for (int i = 0; i < scans; i++) {
+    const int64_t when = targets[i].host_us;
+    for (uint64_t k = 0; k < reader.chunks(); k++) {
+      const CapChunkHeader *h = reader.chunk(k);
+      if (h && h->first_host_us <= when && when <= h->last_host_us) {
+        found++;
+        break;
+      }
+    }
+  }
+  printf("\nscan of chunk headers (cached): %.1f us per lookup (%d/%d found)\n",
+         (now_sec() - t0) / scans * 1e6, found, scans);
+
+  reader.close();
+  if (!keep) {
+    unlink(path.c_str());
+  }
+  return 0;
+}
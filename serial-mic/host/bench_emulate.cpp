@@ -0,0 +1,238 @@
+// Emulator benchmark
+//
+// How many serial-mics one machine can pretend to be, and how much a host
+// can take in from them through pseudo-terminals:
+//   - making packets: framing (with and without the firmware's DC blocker)
+//     and fault injection, in packets per second and real-time devices per
+//     core
+//   - the whole trip: N ptys written as fast as they'll go by one thread and
+//     read back by another, which polls them all and parses every stream,
+//     checking each packet arrives once, in order and intact
+//
+//   bench_emulate [--seconds 2] [--devices 1,16,64,256]
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <memory>
+#include <poll.h>
+#include <string>
+#include <termios.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "emulator.h"
+
+using namespace serialmic;
+
+static double now_sec(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint32_t rng = 12345;
+static uint32_t rand32(void) {
+  rng = rng * 1664525u + 1013904223u;
+  return rng;
+}
+
+// Ten seconds of a chirp over noise, in memory
+class MemorySource : public AudioSource {
+public:
+  MemorySource() : pcm_(10 * SAMPLE_RATE) {
+    for (size_t i = 0; i < pcm_.size(); i++) {
+      const double t = (double)i / SAMPLE_RATE;
+      pcm_[i] = (int16_t)(6000 * std::sin(2 * M_PI * (200 + 300 * t) * t) + (int)(rand32() % 512) - 256 + 300);
+    }
+  }
+  int sample_rate() const override { return SAMPLE_RATE; }
+  uint64_t samples() const override { return pcm_.size(); }
+  size_t read(uint64_t first, int16_t *out, size_t count) const override {
+    size_t have = first < pcm_.size() ? std::min<size_t>(count, pcm_.size() - first) : 0;
+    memcpy(out, pcm_.data() + first, have * 2);
+    memset(out + have, 0, (count - have) * 2);
+    return have;
+  }
+
+private:
+  std::vector<int16_t> pcm_;
+};
+
+static void bench_making(const AudioSource &audio, const char *what, const DeviceConfig &dc,
+                         const FaultConfig &fc, double seconds) {
+  FramedSource source(audio, dc, 1);
+  FaultInjector faults(source, fc, 1);
+  std::unique_ptr<WirePacket> pkt(new WirePacket);
+  uint64_t packets = 0;
+  volatile uint8_t sink = 0;
+  const double t0 = now_sec();
+  double elapsed = 0;
+  while (elapsed < seconds) {
+    for (int i = 0; i < 256; i++) {
+      faults.next(*pkt);
+      sink ^= pkt->bytes[pkt->len - 1];
+    }
+    packets += 256;
+    elapsed = now_sec() - t0;
+  }
+  (void)sink;
+  const double rate = packets / elapsed;
+  printf("  %-26s %10.0f %9.2f %11.0f\n", what, rate, 1e6 / rate, rate / (SAMPLE_RATE / (double)SAMPLES_PER_PACKET));
+}
+
+struct Pty {
+  int master = -1, slave = -1;
+  std::vector<uint8_t> stream; // packets to send, round and round
+  size_t pos = 0;
+  PacketParser parser;
+  bool started = false;
+  uint32_t expected = 0;
+  uint64_t packets = 0, bad = 0;
+
+  void on_packet(const Packet &p) {
+    // the stream goes round after seq 255
+    if (started && p.seq != expected % 256) {
+      bad++;
+    }
+    started = true;
+    expected = p.seq + 1;
+    packets++;
+  }
+  void on_crc_error(uint64_t) { bad++; }
+};
+
+static bool open_pty(Pty &p) {
+  p.master = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+  if (p.master < 0 || grantpt(p.master) != 0 || unlockpt(p.master) != 0) {
+    return false;
+  }
+  p.slave = open(ptsname(p.master), O_RDWR | O_NOCTTY | O_NONBLOCK);
+  if (p.slave < 0) {
+    return false;
+  }
+  struct termios t;
+  tcgetattr(p.slave, &t);
+  cfmakeraw(&t);
+  tcsetattr(p.slave, TCSANOW, &t);
+  return true;
+}
+
+static void bench_ptys(const AudioSource &audio, int count, double seconds) {
+  std::vector<std::unique_ptr<Pty>> ptys;
+  for (int i = 0; i < count; i++) {
+    std::unique_ptr<Pty> p(new Pty);
+    if (!open_pty(*p)) {
+      printf("  %5d devices: can't make that many ptys here\n", count);
+      return;
+    }
+    // 256 packets, wrapping seq included
+    DeviceConfig dc;
+    FramedSource source(audio, dc, (uint32_t)i);
+    std::unique_ptr<WirePacket> pkt(new WirePacket);
+    for (int k = 0; k < 256; k++) {
+      source.next(*pkt);
+      p->stream.insert(p->stream.end(), pkt->bytes, pkt->bytes + pkt->len);
+    }
+    ptys.push_back(std::move(p));
+  }
+  volatile bool done = false;
+  uint64_t written = 0;
+  std::thread writer([&] {
+    std::vector<struct pollfd> pfds(ptys.size());
+    while (!done) {
+      bool wrote = false;
+      for (auto &p : ptys) {
+        const ssize_t n = write(p->master, p->stream.data() + p->pos, p->stream.size() - p->pos);
+        if (n > 0) {
+          p->pos = (p->pos + (size_t)n) % p->stream.size();
+          written += (uint64_t)n;
+          wrote = true;
+        }
+      }
+      if (!wrote) {
+        for (size_t i = 0; i < ptys.size(); i++) {
+          pfds[i] = {ptys[i]->master, POLLOUT, 0};
+        }
+        poll(pfds.data(), pfds.size(), 10);
+      }
+    }
+  });
+  std::vector<struct pollfd> pfds(ptys.size());
+  for (size_t i = 0; i < ptys.size(); i++) {
+    pfds[i] = {ptys[i]->slave, POLLIN, 0};
+  }
+  static uint8_t buf[64 * 1024];
+  uint64_t bytes = 0;
+  const double t0 = now_sec();
+  double elapsed = 0;
+  while (elapsed < seconds) {
+    if (poll(pfds.data(), pfds.size(), 10) > 0) {
+      for (size_t i = 0; i < ptys.size(); i++) {
+        if (pfds[i].revents & POLLIN) {
+          const ssize_t n = read(ptys[i]->slave, buf, sizeof(buf));
+          if (n > 0) {
+            ptys[i]->parser.feed(buf, (size_t)n, *ptys[i]);
+            bytes += (uint64_t)n;
+          }
+        }
+      }
+    }
+    elapsed = now_sec() - t0;
+  }
+  done = true;
+  writer.join();
+  uint64_t packets = 0, bad = 0;
+  for (auto &p : ptys) {
+    packets += p->packets;
+    bad += p->bad;
+    close(p->slave);
+    close(p->master);
+  }
+  printf("  %5d devices %10.1f %10.0f %11.0f %8llu\n", count, bytes / elapsed / 1e6, packets / elapsed,
+         bytes / elapsed / DEVICE_BYTES_PER_SEC, (unsigned long long)bad);
+}
+
+int main(int argc, char **argv) {
+  double seconds = 2;
+  std::vector<int> counts = {1, 16, 64, 256};
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--seconds") && i + 1 < argc) {
+      seconds = atof(argv[++i]);
+    } else if (!strcmp(argv[i], "--devices") && i + 1 < argc) {
+      counts.clear();
+      for (const char *p = argv[++i]; *p;) {
+        counts.push_back(atoi(p));
+        p = strchr(p, ',') ? strchr(p, ',') + 1 : p + strlen(p);
+      }
+    } else {
+      fprintf(stderr, "usage: bench_emulate [--seconds 2] [--devices 1,16,64,256]\n");
+      return 1;
+    }
+  }
+  MemorySource audio;
+
+  printf("making packets              packets/s  us/packet  devices/core\n");
+  DeviceConfig dc;
+  FaultConfig none;
+  bench_making(audio, "framing + CRC", dc, none, seconds);
+  dc.dc_block = true;
+  bench_making(audio, "+ DC blocker", dc, none, seconds);
+  FaultConfig faults;
+  faults.bit_error_rate = 1e-6;
+  faults.drop = 0.001;
+  faults.reorder = 0.001;
+  faults.jitter_ms = 5;
+  bench_making(audio, "+ every fault", dc, faults, seconds);
+
+  printf("\nthrough ptys, one writer and one reader thread\n");
+  printf("                          MB/s  packets/s  real-time x  errors\n");
+  for (int n : counts) {
+    bench_ptys(audio, n, seconds);
+  }
+  return 0;
+}
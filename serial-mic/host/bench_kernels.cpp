@@ -0,0 +1,376 @@
+// Decoder and DSP kernel benchmark
+//
+// The calls the frontend makes into serialmic.wasm (wasm_api.cpp), built
+// natively, against ports of the frontend's JavaScript for the same jobs:
+//   - decoding: 4KB reads through sm_rx_push() into the slot ring, with
+//     some packets corrupted, against PacketParser.append(), which copies
+//     everything it holds on each read. Every good packet must come out.
+//   - the 1024 point dBFS spectrum against drawSpectrogram's (Hann,
+//     fftRadix2 with twiddles worked out as it goes)
+//   - YIN against detectPitchAutocorrPCM16, in time per packet and in
+//     accuracy on harmonic tones over noise
+//   - rms and peak levels
+// The same source built for WebAssembly is timed by the frontend's
+// npm run bench:wasm.
+//
+//   bench_kernels
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <vector>
+
+#include "packet.h"
+
+extern "C" {
+uint8_t *sm_rx_buffer(void);
+uint32_t sm_rx_capacity(void);
+uint32_t sm_rx_push(uint32_t n);
+void sm_reset(int verify_crc);
+uint32_t sm_slot_count(void);
+uint32_t sm_slot_samples(void);
+int16_t *sm_pcm_slots(void);
+uint32_t *sm_packet_info(void);
+uint32_t sm_crc_errors(void);
+int sm_spectrum_init(uint32_t n);
+float *sm_spectrum_out(void);
+void sm_spectrum_db(const int16_t *pcm, uint32_t count);
+int sm_yin_init(uint32_t frame, float rate, float min_hz, float max_hz, float threshold);
+float sm_yin(const int16_t *pcm, uint32_t count);
+float sm_yin_confidence(void);
+void sm_levels(const int16_t *pcm, uint32_t count);
+float *sm_levels_out(void);
+}
+
+using namespace serialmic;
+
+static double now_sec(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint32_t rng = 12345;
+static uint32_t rand32(void) {
+  rng = rng * 1664525u + 1013904223u;
+  return rng;
+}
+
+// A tone with three harmonics over white noise `noise` below it
+static void harmonic_tone(int16_t *pcm, size_t n, double hz, double noise_db, uint64_t first) {
+  const double noise = pow(10, noise_db / 20);
+  for (size_t i = 0; i < n; i++) {
+    const double t = (double)(first + i) / SAMPLE_RATE;
+    double v = 0;
+    for (int h = 1; h <= 4; h++) {
+      v += 0.3 / h * sin(2 * M_PI * hz * h * t + h);
+    }
+    v += ((int32_t)(rand32() >> 16) - 32768) / 32768.0 * noise * 0.3;
+    pcm[i] = (int16_t)std::max(-32768.0, std::min(32767.0, v * 32767));
+  }
+}
+
+// ====================== The frontend's code ======================
+// PacketParser.append: a new buffer holding the old and the read on each
+// append, and a slice of what's left after parsing
+struct FrontendParser {
+  std::vector<uint8_t> rx;
+  uint64_t packets = 0;
+
+  void append(const uint8_t *chunk, size_t len) {
+    std::vector<uint8_t> a(rx.size() + len);
+    std::copy(rx.begin(), rx.end(), a.begin());
+    std::copy(chunk, chunk + len, a.begin() + rx.size());
+    rx.swap(a);
+    size_t i = 0;
+    while (i + PKT_OVERHEAD <= rx.size()) {
+      if (rx[i] != PKT_SYNC) {
+        i++;
+        continue;
+      }
+      const size_t len16 = le_read16(&rx[i + 1]), total = PKT_OVERHEAD + len16;
+      if (i + total > rx.size()) {
+        break;
+      }
+      if (crc16_ccitt(&rx[i], PKT_HEADER_LEN + len16) != le_read16(&rx[i + PKT_HEADER_LEN + len16])) {
+        i++;
+        continue;
+      }
+      // new Int16Array(pcm): a copy per packet
+      std::vector<int16_t> pcm(len16 / 2);
+      memcpy(pcm.data(), &rx[i + PKT_HEADER_LEN], len16);
+      packets += pcm[0] != 12345;
+      i += total;
+    }
+    rx.erase(rx.begin(), rx.begin() + i);
+  }
+};
+
+static void frontend_fft(float *re, float *im, size_t n) {
+  size_t j = 0;
+  for (size_t i = 0; i < n; i++) {
+    if (i < j) {
+      std::swap(re[i], re[j]);
+      std::swap(im[i], im[j]);
+    }
+    size_t m = n >> 1;
+    while (m >= 1 && j >= m) {
+      j -= m;
+      m >>= 1;
+    }
+    j += m;
+  }
+  for (size_t step = 1; step < n; step <<= 1) {
+    const size_t jump = step << 1;
+    const double delta = M_PI / step;
+    for (size_t group = 0; group < step; group++) {
+      const float wr = (float)cos(delta * group), wi = (float)-sin(delta * group);
+      for (size_t pair = group; pair < n; pair += jump) {
+        const size_t match = pair + step;
+        const float tr = wr * re[match] - wi * im[match];
+        const float ti = wr * im[match] + wi * re[match];
+        re[match] = re[pair] - tr;
+        im[match] = im[pair] - ti;
+        re[pair] += tr;
+        im[pair] += ti;
+      }
+    }
+  }
+}
+
+// drawSpectrogram's analysis, window made per call as it does
+static void frontend_spectrum(const int16_t *pcm, size_t n, float *db) {
+  std::vector<float> re(n), im(n, 0.0f), win(n);
+  double sum = 0;
+  for (size_t i = 0; i < n; i++) {
+    win[i] = (float)(0.5 * (1 - cos(2 * M_PI * i / (n - 1))));
+    re[i] = pcm[i] / 32768.0f * win[i];
+    sum += win[i];
+  }
+  frontend_fft(re.data(), im.data(), n);
+  const float scale = (float)(2 / sum);
+  for (size_t k = 0; k < n / 2; k++) {
+    db[k] = 20 * log10f(hypotf(re[k], im[k]) * scale + 1e-12f);
+  }
+}
+
+// detectPitchAutocorrPCM16: the highest autocorrelation peak, 50-1200Hz
+static float frontend_pitch(const int16_t *pcm, size_t n, double rate) {
+  std::vector<float> buf(n);
+  double mean = 0;
+  for (size_t i = 0; i < n; i++) {
+    buf[i] = pcm[i] / 32768.0f;
+    mean += buf[i];
+  }
+  mean /= n;
+  for (size_t i = 0; i < n; i++) {
+    buf[i] -= (float)mean;
+  }
+  const int max_lag = (int)floor(rate / 50), min_lag = std::max(1, (int)floor(rate / 1200));
+  std::vector<float> ac(max_lag + 1, 0.0f);
+  for (int lag = min_lag; lag <= max_lag; lag++) {
+    float s = 0;
+    for (size_t i = 0; i + lag < n; i++) {
+      s += buf[i] * buf[i + lag];
+    }
+    ac[lag] = s;
+  }
+  int best = -1;
+  float best_v = 0;
+  for (int lag = min_lag + 1; lag < max_lag - 1; lag++) {
+    if (ac[lag] > ac[lag - 1] && ac[lag] >= ac[lag + 1] && ac[lag] > best_v) {
+      best_v = ac[lag];
+      best = lag;
+    }
+  }
+  if (best < 0) {
+    return 0;
+  }
+  const float y1 = ac[best - 1], y2 = ac[best], y3 = ac[best + 1];
+  float den = y1 - 2 * y2 + y3;
+  if (den == 0) {
+    den = 1e-12f;
+  }
+  return (float)(rate / (best + 0.5f * (y1 - y3) / den));
+}
+
+// ====================== Benchmarks ======================
+static void bench_decode(void) {
+  const size_t packets = 4000, n = SAMPLES_PER_PACKET;
+  std::vector<uint8_t> stream;
+  std::vector<int16_t> pcm(n);
+  std::vector<uint8_t> pkt(MAX_PKT_BYTES);
+  std::vector<bool> good(packets, true);
+  for (size_t p = 0; p < packets; p++) {
+    harmonic_tone(pcm.data(), n, 220, -40, p * n);
+    pcm[0] = (int16_t)p; // to check each comes out whole
+    const size_t len = encode_packet(pkt.data(), (uint32_t)p, (uint32_t)(p * 64000), pcm.data(), n);
+    if (rand32() % 200 == 0) {
+      pkt[PKT_HEADER_LEN + 100] ^= 0x55;
+      good[p] = false;
+    }
+    stream.insert(stream.end(), pkt.begin(), pkt.begin() + len);
+  }
+  size_t expected = 0;
+  for (bool g : good) {
+    expected += g;
+  }
+
+  const size_t chunk = 4096;
+  const int reps = 5;
+  sm_reset(1);
+  uint32_t read = 0;
+  size_t received = 0, wrong = 0;
+  const uint32_t slots = sm_slot_count(), slot_samples = sm_slot_samples();
+  double t0 = now_sec();
+  for (int r = 0; r < reps; r++) {
+    for (size_t o = 0; o < stream.size(); o += chunk) {
+      const size_t len = std::min(chunk, stream.size() - o);
+      memcpy(sm_rx_buffer(), stream.data() + o, len);
+      const uint32_t written = sm_rx_push((uint32_t)len);
+      for (; read < written; read++) {
+        const uint32_t slot = read % slots;
+        const uint32_t *info = sm_packet_info() + 4 * slot;
+        const int16_t *samples = sm_pcm_slots() + (size_t)slot * slot_samples;
+        if (r == 0) {
+          received++;
+          wrong += info[2] != n || samples[0] != (int16_t)info[0] || !good[info[0]];
+        }
+      }
+    }
+  }
+  const double ours = (now_sec() - t0) / reps;
+  FrontendParser fp;
+  t0 = now_sec();
+  for (int r = 0; r < reps; r++) {
+    for (size_t o = 0; o < stream.size(); o += chunk) {
+      fp.append(stream.data() + o, std::min(chunk, stream.size() - o));
+    }
+  }
+  const double theirs = (now_sec() - t0) / reps;
+  printf("decode, %zu packets in %zuB reads, %zu corrupted:\n", packets, chunk, packets - expected);
+  printf("  sm_rx_push      %6.2f us/packet %7.0f MB/s   %zu of %zu good packets out, %zu wrong, %u CRC errors\n",
+         ours / packets * 1e6, stream.size() / ours / 1e6, received, expected, wrong, sm_crc_errors() / reps);
+  printf("  frontend        %6.2f us/packet %7.0f MB/s   (%.1fx)\n\n", theirs / packets * 1e6,
+         stream.size() / theirs / 1e6, theirs / ours);
+}
+
+static void bench_spectrum(void) {
+  const size_t n = 1024, reps = 4000;
+  std::vector<int16_t> pcm(n);
+  harmonic_tone(pcm.data(), n, 1000, -60, 0);
+  sm_spectrum_init(n);
+  std::vector<float> theirs_db(n / 2);
+  double t0 = now_sec();
+  for (size_t r = 0; r < reps; r++) {
+    sm_spectrum_db(pcm.data(), (uint32_t)n);
+  }
+  const double ours = (now_sec() - t0) / reps;
+  t0 = now_sec();
+  for (size_t r = 0; r < reps; r++) {
+    frontend_spectrum(pcm.data(), n, theirs_db.data());
+  }
+  const double theirs = (now_sec() - t0) / reps;
+  const float *db = sm_spectrum_out();
+  const size_t bin = 1000 * n / SAMPLE_RATE;
+  printf("spectrum, %zu points:\n", n);
+  printf("  sm_spectrum_db  %6.2f us   1kHz bin %.2f dBFS\n", ours * 1e6, db[bin]);
+  printf("  frontend        %6.2f us   1kHz bin %.2f dBFS   (%.1fx)\n\n", theirs * 1e6, theirs_db[bin],
+         theirs / ours);
+}
+
+static void bench_pitch(void) {
+  const size_t n = SAMPLES_PER_PACKET;
+  sm_yin_init((uint32_t)n, SAMPLE_RATE, 50, 1200, 0.15f);
+  std::vector<int16_t> pcm(n);
+  harmonic_tone(pcm.data(), n, 220, -30, 0);
+  const int reps = 2000;
+  float sink = 0;
+  double t0 = now_sec();
+  for (int r = 0; r < reps; r++) {
+    sink += sm_yin(pcm.data(), (uint32_t)n);
+  }
+  const double ours = (now_sec() - t0) / reps;
+  t0 = now_sec();
+  for (int r = 0; r < reps / 10; r++) {
+    sink += frontend_pitch(pcm.data(), n, SAMPLE_RATE);
+  }
+  const double theirs = (now_sec() - t0) / (reps / 10);
+  printf("pitch, %zu samples, 50-1200Hz:\n", n);
+  printf("  sm_yin          %6.2f us\n", ours * 1e6);
+  printf("  frontend        %6.2f us   (%.1fx)%s\n\n", theirs * 1e6, theirs / ours, sink == 1.5f ? " " : "");
+
+  // accuracy over 60-1000Hz, 200 packets each
+  printf("  %-16s %7s %12s %12s %10s\n", "noise", "method", "p50 cents", "p99 cents", "wrong");
+  for (double noise_db : {-60.0, -20.0, -10.0}) {
+    std::vector<double> errs[2];
+    int wrong[2] = {0, 0};
+    uint64_t at = 0;
+    for (int i = 0; i < 200; i++) {
+      const double hz = 60 * pow(1000.0 / 60, i / 199.0);
+      harmonic_tone(pcm.data(), n, hz, noise_db, at);
+      at += n;
+      const float got[2] = {sm_yin(pcm.data(), (uint32_t)n), frontend_pitch(pcm.data(), n, SAMPLE_RATE)};
+      for (int m = 0; m < 2; m++) {
+        const double cents = got[m] > 0 ? fabs(1200 * log2(got[m] / hz)) : 1e9;
+        if (cents > 50) {
+          wrong[m]++; // none, or an octave or other harmonic out
+        } else {
+          errs[m].push_back(cents);
+        }
+      }
+    }
+    for (int m = 0; m < 2; m++) {
+      std::sort(errs[m].begin(), errs[m].end());
+      auto pct = [&](double q) { return errs[m].empty() ? NAN : errs[m][(size_t)(q * (errs[m].size() - 1))]; };
+      char label[32];
+      snprintf(label, sizeof(label), "%.0f dB", noise_db);
+      printf("  %-16s %7s %12.2f %12.2f %7d/200\n", m ? "" : label, m ? "autocorr" : "yin", pct(0.5), pct(0.99),
+             wrong[m]);
+    }
+  }
+  printf("\n");
+}
+
+static void bench_levels(void) {
+  const size_t n = SAMPLES_PER_PACKET;
+  std::vector<int16_t> pcm(n);
+  harmonic_tone(pcm.data(), n, 440, -40, 0);
+  pcm[333] = -32768;
+  const int reps = 50000;
+  double t0 = now_sec();
+  for (int r = 0; r < reps; r++) {
+    sm_levels(pcm.data(), (uint32_t)n);
+  }
+  const double ours = (now_sec() - t0) / reps;
+  // main.ts's VU loop
+  double sink = 0;
+  t0 = now_sec();
+  for (int r = 0; r < reps; r++) {
+    double sum_sq = 0;
+    for (size_t i = 0; i < n; i++) {
+      const double v = pcm[i] / 32768.0;
+      sum_sq += v * v;
+    }
+    sink += sum_sq;
+  }
+  const double theirs = (now_sec() - t0) / reps;
+  printf("levels, %zu samples:\n", n);
+  printf("  sm_levels       %6.0f ns   rms %.2f dBFS, peak %.2f dBFS\n", ours * 1e9, sm_levels_out()[0],
+         sm_levels_out()[1]);
+  printf("  frontend (rms)  %6.0f ns   (%.1fx)%s\n", theirs * 1e9, theirs / ours, sink == 1.5 ? " " : "");
+}
+
+int main(int argc, char **) {
+  if (argc > 1) {
+    fprintf(stderr, "usage: bench_kernels\n");
+    return 1;
+  }
+  bench_decode();
+  bench_spectrum();
+  bench_pitch();
+  bench_levels();
+  return 0;
+}
@@ -0,0 +1,157 @@
+// Link statistics benchmark
+//
+// What the analyzer costs next to the parsing it rides on:
+//   - the analyzer alone, per packet, with arrival times, loss,
+//     CRC failures and a restart in the stream
+//   - parsing a stream with and without it
+//   - both as a share of one core for a device at 1000x real time
+// and that its answers come out right: the loss counted, the sample rate
+// and drift put into the stream found again.
+//
+//   bench_link [--packets 2000000]
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <vector>
+
+#include "link_stats.h"
+
+using namespace serialmic;
+
+static double now_sec(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint32_t rng = 12345;
+static uint32_t rand32(void) {
+  rng = rng * 1664525u + 1013904223u;
+  return rng;
+}
+
+// Packets from a device whose I2S runs 25 ppm fast by its own clock, which
+// runs 40 ppm slow against the host's, delivered up to 4 ms late
+struct Event {
+  uint32_t seq;
+  uint32_t usec;
+  double arrival_us;
+  bool crc_error;
+};
+
+static std::vector<Event> make_events(size_t count, uint64_t *lost) {
+  std::vector<Event> events;
+  events.reserve(count);
+  const double period = SAMPLES_PER_PACKET * 1e6 / SAMPLE_RATE / (1 + 25e-6);
+  uint32_t seq = 0;
+  double usec = 2e6;
+  double device = 0; // time on the device clock, across the restart
+  *lost = 0;
+  for (size_t i = 0; i < count; i++) {
+    const uint32_t r = rand32();
+    if (i == count / 2) {
+      seq = 0; // restart
+      usec = 1.5e6;
+    } else if (r % 200 == 0) {
+      const uint32_t n = 1 + r % 7;
+      seq += n;
+      usec += n * period;
+      device += n * period;
+      *lost += n;
+    }
+    if (r % 1000 == 1) {
+      events.push_back({0, 0, 0, true});
+    }
+    const double host = 5e6 + device / (1 - 40e-6);
+    events.push_back({seq++, (uint32_t)(uint64_t)(usec + (r >> 24) % 50), host + (r >> 8) % 4000, false});
+    usec += period;
+    device += period;
+  }
+  return events;
+}
+
+int main(int argc, char **argv) {
+  size_t count = 2000000;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--packets") && i + 1 < argc) {
+      count = (size_t)atol(argv[++i]);
+    } else {
+      fprintf(stderr, "usage: bench_link [--packets 2000000]\n");
+      return 1;
+    }
+  }
+  uint64_t lost = 0;
+  std::vector<Event> events = make_events(count, &lost);
+  static uint8_t payload[SAMPLES_PER_PACKET * 2];
+
+  LinkAnalyzer link;
+  double t0 = now_sec();
+  for (const Event &e : events) {
+    if (e.crc_error) {
+      link.add_crc_error(e.arrival_us);
+      continue;
+    }
+    Packet pkt;
+    pkt.seq = e.seq;
+    pkt.usec = e.usec;
+    pkt.payload = payload;
+    pkt.payload_len = sizeof(payload);
+    pkt.offset = 0;
+    link.add_packet(pkt, e.arrival_us);
+  }
+  const double analyze_ns = (now_sec() - t0) / count * 1e9;
+
+  printf("analyzer, %zu packets\n", count);
+  printf("  %.0f ns per packet\n", analyze_ns);
+  printf("  lost %llu (put in %llu), device rate %.3f Hz (put in %.3f), drift %+.1f ppm (put in %+.1f)\n",
+         (unsigned long long)link.lost(), (unsigned long long)lost, link.device_rate(), SAMPLE_RATE * (1 + 25e-6),
+         link.drift_ppm(), -40.0);
+
+  // a byte stream of 4096 packets, parsed over and over
+  std::vector<uint8_t> stream;
+  {
+    int16_t pcm[SAMPLES_PER_PACKET];
+    uint8_t pkt[PKT_OVERHEAD + sizeof(pcm)];
+    for (uint32_t i = 0; i < 4096; i++) {
+      for (size_t k = 0; k < SAMPLES_PER_PACKET; k++) {
+        pcm[k] = (int16_t)rand32();
+      }
+      const size_t n = encode_packet(pkt, i, i * 64000, pcm, SAMPLES_PER_PACKET);
+      stream.insert(stream.end(), pkt, pkt + n);
+    }
+  }
+  struct Count {
+    uint64_t packets = 0;
+    void on_packet(const Packet &) { packets++; }
+    void on_crc_error(uint64_t) {}
+  };
+  const int rounds = (int)(count / 4096 / 4) + 1;
+  double parse_ns[2];
+  for (int with = 0; with < 2; with++) {
+    PacketParser parser;
+    Count counter;
+    LinkAnalyzer analyzer;
+    t0 = now_sec();
+    for (int r = 0; r < rounds; r++) {
+      for (size_t off = 0; off < stream.size(); off += 16384) {
+        const size_t n = stream.size() - off < 16384 ? stream.size() - off : 16384;
+        if (with) {
+          analyzer.set_arrival((now_sec() - t0) * 1e6);
+          parser.feed(stream.data() + off, n, analyzer);
+        } else {
+          parser.feed(stream.data() + off, n, counter);
+        }
+      }
+    }
+    parse_ns[with] = (now_sec() - t0) / ((double)rounds * 4096) * 1e9;
+  }
+  // one device at 1000x real time is a packet every 64us
+  const double budget_ns = SAMPLES_PER_PACKET * 1e9 / SAMPLE_RATE / 1000;
+  printf("\nper packet                  ns   of a core at 1000x real time\n");
+  printf("  parse                %7.0f   %5.2f%%\n", parse_ns[0], 100 * parse_ns[0] / budget_ns);
+  printf("  parse + analyze      %7.0f   %5.2f%%\n", parse_ns[1], 100 * parse_ns[1] / budget_ns);
+  printf("  analyze alone        %7.0f   %5.2f%%\n", analyze_ns, 100 * analyze_ns / budget_ns);
+  return 0;
+}
@@ -0,0 +1,294 @@
+// Sound source localization benchmark
+//
+// The Localizer against a simulated room and for speed:
+//   - accuracy: a room 8 x 6 x 3m with mics round the walls at mixed
+//     heights, noise bursts from random places in it, each mic hearing the
+//     source delayed (fractionally, through a windowed sinc) and 1/r
+//     quieter, plus first order wall reflections and sensor noise where the
+//     scenario has them. Position error percentiles over every window
+//     located inside a burst, the rms delay error of the pairs used, and
+//     how many windows between bursts were taken for events
+//   - throughput: independent noise on 16, 32 and 64 channels with every
+//     window located (the worst case), with 1, 2, 4 ... threads up to the
+//     core count (or --threads), in ms per window and times real time
+//
+//   bench_locate [--seconds 20] [--threads N]
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <thread>
+#include <vector>
+
+#include "localizer.h"
+
+using namespace serialmic;
+
+static double now_sec(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint32_t rng = 12345;
+static uint32_t rand32(void) {
+  rng = rng * 1664525u + 1013904223u;
+  return rng;
+}
+
+static double uniform(void) { return (rand32() >> 8) * (1.0 / 16777216); }
+
+static double gaussian(void) {
+  const double u = std::max(1e-12, uniform()), v = uniform();
+  return sqrt(-2 * log(u)) * cos(2 * M_PI * v);
+}
+
+static const double ROOM[3] = {8, 6, 3};
+static const double SOUND_SPEED = 343;
+static const int SINC_TAPS = 24;
+
+struct Scenario {
+  const char *name;
+  int mics;
+  bool planar;       // mics and sources all at 1.2m
+  double reflection; // wall reflection coefficient, 0 for none
+  double noise_dbfs; // sensor noise
+};
+
+static std::vector<MicPosition> room_mics(int count, bool planar) {
+  std::vector<MicPosition> mics;
+  for (int i = 0; i < count; i++) {
+    // round the walls, 0.2m in, spread evenly with a little jitter
+    const double perimeter = 2 * (ROOM[0] + ROOM[1] - 0.8);
+    double d = (i + 0.3 * uniform()) * perimeter / count;
+    MicPosition m;
+    const double w = ROOM[0] - 0.4, h = ROOM[1] - 0.4;
+    if (d < w) {
+      m.x = 0.2 + d, m.y = 0.2;
+    } else if ((d -= w) < h) {
+      m.x = ROOM[0] - 0.2, m.y = 0.2 + d;
+    } else if ((d -= h) < w) {
+      m.x = ROOM[0] - 0.2 - d, m.y = ROOM[1] - 0.2;
+    } else {
+      d -= w;
+      m.x = 0.2, m.y = ROOM[1] - 0.2 - d;
+    }
+    m.z = planar ? 1.2 : 0.4 + 2.2 * uniform();
+    mics.push_back(m);
+  }
+  return mics;
+}
+
+// Adds `gain` * src delayed by `delay` samples into out
+static void add_delayed(const std::vector<float> &src, double delay, double gain, float *out, size_t out_len) {
+  const long whole = (long)floor(delay);
+  const double frac = delay - whole;
+  float taps[SINC_TAPS];
+  for (int k = 0; k < SINC_TAPS; k++) {
+    const double t = k - SINC_TAPS / 2 + 1 - frac;
+    const double sinc = fabs(t) < 1e-9 ? 1 : sin(M_PI * t) / (M_PI * t);
+    const double win = 0.42 + 0.5 * cos(M_PI * t / (SINC_TAPS / 2)) + 0.08 * cos(2 * M_PI * t / (SINC_TAPS / 2));
+    taps[k] = (float)(gain * sinc * win);
+  }
+  for (size_t i = 0; i < src.size(); i++) {
+    const long base = (long)i + whole - SINC_TAPS / 2 + 1;
+    for (int k = 0; k < SINC_TAPS; k++) {
+      const long o = base + k;
+      if (o >= 0 && o < (long)out_len) {
+        out[o] += src[i] * taps[k];
+      }
+    }
+  }
+}
+
+struct Burst {
+  double start, end; // seconds
+  MicPosition source;
+};
+
+static void run_accuracy(const Scenario &sc, double seconds, int threads) {
+  const int rate = SAMPLE_RATE;
+  const std::vector<MicPosition> mics = room_mics(sc.mics, sc.planar);
+  const size_t total = (size_t)(seconds * rate);
+  std::vector<float> planar((size_t)sc.mics * total, 0);
+
+  // a 0.4s burst a second, from somewhere new each time
+  std::vector<Burst> bursts;
+  for (double t = 0.5; t + 0.5 < seconds; t += 1.0) {
+    Burst b;
+    b.start = t;
+    b.end = t + 0.4;
+    b.source.x = 1 + (ROOM[0] - 2) * uniform();
+    b.source.y = 1 + (ROOM[1] - 2) * uniform();
+    b.source.z = sc.planar ? 1.2 : 0.5 + 2 * uniform();
+    bursts.push_back(b);
+
+    std::vector<float> src((size_t)(0.4 * rate));
+    const size_t fade = rate / 50;
+    for (size_t i = 0; i < src.size(); i++) {
+      const double env = std::min(1.0, std::min((double)i, (double)(src.size() - 1 - i)) / fade);
+      src[i] = (float)(0.1 * gaussian() * env); // about -20dBFS at 1m
+    }
+    // the source and its six first order images
+    std::vector<MicPosition> images(1, b.source);
+    if (sc.reflection > 0) {
+      for (int axis = 0; axis < 3; axis++) {
+        for (int wall = 0; wall < 2; wall++) {
+          MicPosition im = b.source;
+          double *c = axis == 0 ? &im.x : axis == 1 ? &im.y : &im.z;
+          *c = wall ? 2 * ROOM[axis] - *c : -*c;
+          images.push_back(im);
+        }
+      }
+    }
+    const size_t at = (size_t)(b.start * rate);
+    for (int m = 0; m < sc.mics; m++) {
+      for (size_t k = 0; k < images.size(); k++) {
+        const MicPosition &p = images[k];
+        const double d = sqrt((p.x - mics[m].x) * (p.x - mics[m].x) + (p.y - mics[m].y) * (p.y - mics[m].y) +
+                              (p.z - mics[m].z) * (p.z - mics[m].z));
+        const double gain = (k ? sc.reflection : 1.0) / std::max(0.1, d);
+        add_delayed(src, d / SOUND_SPEED * rate, gain, planar.data() + (size_t)m * total + at, total - at);
+      }
+    }
+  }
+
+  const double noise = pow(10, sc.noise_dbfs / 20);
+  std::vector<int16_t> stream((size_t)sc.mics * total);
+  for (size_t i = 0; i < total; i++) {
+    for (int m = 0; m < sc.mics; m++) {
+      const double v = (planar[(size_t)m * total + i] + noise * gaussian()) * 32768;
+      stream[i * sc.mics + m] = (int16_t)std::max(-32768.0, std::min(32767.0, round(v)));
+    }
+  }
+
+  LocalizerConfig config;
+  config.threads = threads;
+  Localizer loc(mics, config);
+  const size_t hop = config.hop;
+  std::vector<double> errors;
+  double tdoa_sq = 0;
+  uint64_t tdoa_count = 0, quiet_windows = 0, quiet_events = 0, burst_windows = 0, unsolved = 0;
+  std::vector<Location> out;
+  for (size_t at = 0; at < total; at += hop) {
+    out.clear();
+    loc.push(stream.data() + at * sc.mics, std::min(hop, total - at), &out);
+    for (const Location &l : out) {
+      const double from = l.time - config.fft_size / 2.0 / rate, to = l.time + config.fft_size / 2.0 / rate;
+      const Burst *inside = nullptr;
+      bool touches = false;
+      for (const Burst &b : bursts) {
+        if (from >= b.start && to <= b.end + 0.05) {
+          inside = &b;
+        }
+        if (to > b.start && from < b.end + 0.1) {
+          touches = true;
+        }
+      }
+      if (!touches) {
+        quiet_windows++;
+        quiet_events += l.event;
+      }
+      if (!inside) {
+        continue;
+      }
+      burst_windows++;
+      if (!l.solved) {
+        unsolved++;
+        continue;
+      }
+      const MicPosition &s = inside->source;
+      errors.push_back(sqrt((l.x - s.x) * (l.x - s.x) + (l.y - s.y) * (l.y - s.y) + (l.z - s.z) * (l.z - s.z)));
+      for (const PairDelay &p : loc.last_pairs()) {
+        if (!p.used) {
+          continue;
+        }
+        const MicPosition &a = mics[p.a], &b = mics[p.b];
+        const double da = sqrt((s.x - a.x) * (s.x - a.x) + (s.y - a.y) * (s.y - a.y) + (s.z - a.z) * (s.z - a.z));
+        const double db = sqrt((s.x - b.x) * (s.x - b.x) + (s.y - b.y) * (s.y - b.y) + (s.z - b.z) * (s.z - b.z));
+        const double e = p.tdoa - (da - db) / SOUND_SPEED;
+        tdoa_sq += e * e;
+        tdoa_count++;
+      }
+    }
+  }
+  std::sort(errors.begin(), errors.end());
+  auto pct = [&](double q) { return errors.empty() ? NAN : errors[(size_t)(q * (errors.size() - 1))]; };
+  const double within = errors.empty() ? 0 : (double)(std::lower_bound(errors.begin(), errors.end(), 0.1) -
+                                                      errors.begin()) / errors.size();
+  printf("%-28s %4d %2dD %6llu %5llu %7.1f %7.1f %7.1f %7.1f %6.0f%% %7.1f %6llu/%llu\n", sc.name, sc.mics,
+         loc.dims(), (unsigned long long)burst_windows, (unsigned long long)unsolved, pct(0.5) * 100,
+         pct(0.9) * 100, pct(0.99) * 100, errors.empty() ? NAN : errors.back() * 100, within * 100,
+         tdoa_count ? sqrt(tdoa_sq / tdoa_count) * 1e6 : NAN, (unsigned long long)quiet_events,
+         (unsigned long long)quiet_windows);
+}
+
+static void run_throughput(int devices, int threads, double seconds) {
+  const int rate = SAMPLE_RATE;
+  const std::vector<MicPosition> mics = room_mics(devices, false);
+  // a second of noise, pushed round and round
+  const size_t block = rate;
+  std::vector<int16_t> stream((size_t)devices * block);
+  for (int16_t &s : stream) {
+    s = (int16_t)(3000 * gaussian());
+  }
+  LocalizerConfig config;
+  config.threads = threads;
+  config.event_db = 0;
+  config.min_peak = 0; // noise has no clear peaks: solve with them all anyway
+  Localizer loc(mics, config);
+  std::vector<Location> out;
+  out.reserve(64);
+  const size_t total = (size_t)(seconds * rate);
+  const double start = now_sec();
+  uint64_t windows = 0;
+  for (size_t done = 0; done < total; done += block) {
+    out.clear();
+    loc.push(stream.data(), block, &out);
+    windows += out.size();
+  }
+  const double elapsed = now_sec() - start;
+  printf("%7d %7d %7d %10.2f %10.1f\n", devices, loc.threads(), loc.pairs(), elapsed / windows * 1e3,
+         total / (double)rate / elapsed);
+}
+
+int main(int argc, char **argv) {
+  double seconds = 20;
+  int max_threads = (int)std::max(1u, std::thread::hardware_concurrency());
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--seconds") && i + 1 < argc) {
+      seconds = atof(argv[++i]);
+    } else if (!strcmp(argv[i], "--threads") && i + 1 < argc) {
+      max_threads = atoi(argv[++i]);
+    } else {
+      fprintf(stderr, "usage: bench_locate [--seconds 20] [--threads N]\n");
+      return 1;
+    }
+  }
+
+  printf("accuracy: 2048 point GCC-PHAT every 1024 samples, %.0fs of bursts a second apart\n", seconds);
+  printf("%-28s %4s %3s %6s %5s %7s %7s %7s %7s %7s %7s %s\n", "scenario", "mics", "", "windows", "fail",
+         "p50 cm", "p90 cm", "p99 cm", "max cm", "<10cm", "tdoa us", "false/quiet");
+  const Scenario scenarios[] = {
+      {"anechoic", 16, false, 0, -70},
+      {"anechoic, noisy (-40dBFS)", 16, false, 0, -40},
+      {"reflections 0.5", 16, false, 0.5, -70},
+      {"reflections 0.8", 16, false, 0.8, -70},
+      {"planar, reflections 0.5", 16, true, 0.5, -70},
+      {"8 mics, reflections 0.5", 8, false, 0.5, -70},
+  };
+  for (const Scenario &sc : scenarios) {
+    run_accuracy(sc, seconds, max_threads);
+  }
+
+  printf("\nthroughput: every window located\n");
+  printf("%7s %7s %7s %10s %10s\n", "devices", "threads", "pairs", "ms/window", "x realtime");
+  for (int devices : {16, 32, 64}) {
+    for (int threads = 1; threads <= max_threads; threads *= 2) {
+      run_throughput(devices, threads, seconds);
+    }
+  }
+  return 0;
+}
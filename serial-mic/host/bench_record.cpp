@@ -0,0 +1,205 @@
+// Recorder benchmark
+//
+// How much faster than one serial-mic the host side can go:
+//   - CRC-16/CCITT, the firmware's bit loop against the table the host uses
+//   - the packet parser on a clean stream, and on one with corrupt packets
+//     and noise between them
+//   - the whole recorder, parser through to WAV files on disk, with the peak
+//     memory of the process to show it doesn't grow with the recording
+// Rates are in MB/s of packet stream and in devices (one device sends about
+// 32 kB/s).
+//
+//   bench_record [--dir /tmp] [--mb 2048]
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <sys/resource.h>
+#include <unistd.h>
+#include <vector>
+
+#include "packet.h"
+#include "recorder.h"
+
+using namespace serialmic;
+
+#define STREAM_PACKETS 16384 // about 33MB of stream, reused with new seqs
+
+static double now_sec(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint16_t crc16_bitwise(const uint8_t *data, size_t len) {
+  uint16_t crc = 0xFFFF;
+  for (size_t i = 0; i < len; ++i) {
+    crc ^= (uint16_t)data[i] << 8;
+    for (int b = 0; b < 8; ++b) {
+      crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+    }
+  }
+  return crc;
+}
+
+struct Stream {
+  std::vector<uint8_t> bytes;
+  std::vector<size_t> packets; // offsets
+};
+
+// `corrupt`: one packet in this many gets a flipped bit, and a few bytes of
+// noise (with sync bytes in it) go between packets now and then
+static Stream make_stream(int corrupt) {
+  Stream s;
+  s.bytes.resize(STREAM_PACKETS * (PKT_OVERHEAD + SAMPLES_PER_PACKET * 2 + 8));
+  int16_t pcm[SAMPLES_PER_PACKET];
+  uint32_t rng = 12345;
+  size_t pos = 0;
+  for (int p = 0; p < STREAM_PACKETS; p++) {
+    for (size_t i = 0; i < SAMPLES_PER_PACKET; i++) {
+      rng = rng * 1664525 + 1013904223;
+      pcm[i] = (int16_t)((int32_t)(rng >> 16) - 32768) / 8;
+    }
+    s.packets.push_back(pos);
+    pos += encode_packet(&s.bytes[pos], p, (uint32_t)(p * 64000ull), pcm, SAMPLES_PER_PACKET);
+    if (corrupt && p % corrupt == corrupt / 2) {
+      for (int i = 0; i < 8; i++) {
+        s.bytes[pos++] = (i & 1) ? PKT_SYNC : (uint8_t)rng;
+      }
+    }
+  }
+  s.bytes.resize(pos);
+  return s;
+}
+
+// New seqs and usecs for the next pass (and new CRCs, corrupting some again)
+static void restamp(Stream &s, uint32_t first_seq, int corrupt) {
+  for (size_t p = 0; p < s.packets.size(); p++) {
+    uint8_t *pkt = &s.bytes[s.packets[p]];
+    const size_t len = PKT_HEADER_LEN + le_read16(pkt + 1);
+    le_write32(pkt + 3, first_seq + (uint32_t)p);
+    le_write32(pkt + 7, (first_seq + (uint32_t)p) * 64000u);
+    le_write16(pkt + len, crc16_ccitt(pkt, len));
+    if (corrupt && p % corrupt == 0) {
+      pkt[PKT_HEADER_LEN + 100] ^= 0x10;
+    }
+  }
+}
+
+struct Counter {
+  uint64_t packets = 0, crc = 0;
+  void on_packet(const Packet &) { packets++; }
+  void on_crc_error(uint64_t) { crc++; }
+};
+
+static void report(const char *name, double bytes, double secs) {
+  const double rate = bytes / secs;
+  printf("%-28s %9.1f MB/s  %9.0f devices\n", name, rate / 1e6, rate / DEVICE_BYTES_PER_SEC);
+}
+
+static void bench_crc(void) {
+  std::vector<uint8_t> data(1 << 20);
+  for (size_t i = 0; i < data.size(); i++) {
+    data[i] = (uint8_t)(i * 31 + 7);
+  }
+  if (crc16_bitwise(data.data(), data.size()) != crc16_ccitt(data.data(), data.size())) {
+    printf("CRC MISMATCH\n");
+    exit(1);
+  }
+  volatile uint16_t sink = 0;
+  double t0 = now_sec();
+  for (int i = 0; i < 16; i++) {
+    sink = sink + crc16_bitwise(data.data(), data.size());
+  }
+  report("crc16 bit loop (firmware)", 16.0 * data.size(), now_sec() - t0);
+  t0 = now_sec();
+  for (int i = 0; i < 128; i++) {
+    sink = sink + crc16_ccitt(data.data(), data.size());
+  }
+  report("crc16 table", 128.0 * data.size(), now_sec() - t0);
+}
+
+static void bench_parser(const char *name, int corrupt) {
+  Stream s = make_stream(corrupt);
+  PacketParser parser;
+  Counter counter;
+  double busy = 0;
+  const int passes = 16;
+  for (int pass = 0; pass < passes; pass++) {
+    restamp(s, pass * STREAM_PACKETS, corrupt);
+    const double t0 = now_sec();
+    // in reads the size a tty hands over
+    for (size_t pos = 0; pos < s.bytes.size(); pos += 16384) {
+      const size_t n = s.bytes.size() - pos < 16384 ? s.bytes.size() - pos : 16384;
+      parser.feed(&s.bytes[pos], n, counter);
+    }
+    busy += now_sec() - t0;
+  }
+  report(name, (double)s.bytes.size() * passes, busy);
+  printf("%28s %llu packets, %llu CRC errors, %llu bytes skipped\n", "",
+         (unsigned long long)counter.packets, (unsigned long long)counter.crc,
+         (unsigned long long)parser.stats().skipped_bytes);
+}
+
+static void bench_recorder(const std::string &dir, double megabytes) {
+  const int corrupt = 1000;
+  Stream s = make_stream(corrupt);
+  RecorderConfig config;
+  config.prefix = dir + "/bench_record";
+  config.roll_bytes = 1ull << 30;
+  Recorder rec(config);
+  if (!rec.start()) {
+    exit(1);
+  }
+  const int passes = (int)(megabytes * 1e6 / s.bytes.size()) + 1;
+  double busy = 0;
+  for (int pass = 0; pass < passes; pass++) {
+    restamp(s, pass * STREAM_PACKETS, corrupt);
+    const double t0 = now_sec();
+    for (size_t pos = 0; pos < s.bytes.size(); pos += 16384) {
+      const size_t n = s.bytes.size() - pos < 16384 ? s.bytes.size() - pos : 16384;
+      rec.feed(&s.bytes[pos], n);
+    }
+    busy += now_sec() - t0;
+  }
+  const double t0 = now_sec();
+  rec.finish();
+  busy += now_sec() - t0;
+
+  const RecorderStats &st = rec.stats();
+  report("recorder to disk", (double)s.bytes.size() * passes, busy);
+  printf("%28s %d files, %.1f hours of audio, %llu CRC errors, %llu lost, %llu writer stalls\n", "",
+         st.files, st.samples / (double)SAMPLE_RATE / 3600, (unsigned long long)st.crc_errors,
+         (unsigned long long)st.lost_packets, (unsigned long long)rec.writer().stalls());
+  struct rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+  printf("%28s writer blocks %zu kB, peak RSS %ld MB (the test stream is %zu MB)\n", "",
+         rec.writer().memory() / 1024, ru.ru_maxrss / 1024, s.bytes.size() >> 20);
+
+  char path[1024];
+  for (int i = 1; i <= st.files; i++) {
+    snprintf(path, sizeof(path), "%s-%04d.wav", config.prefix.c_str(), i);
+    unlink(path);
+    snprintf(path, sizeof(path), "%s-%04d.gaps.csv", config.prefix.c_str(), i);
+    unlink(path);
+  }
+}
+
+int main(int argc, char **argv) {
+  std::string dir = "/tmp";
+  double megabytes = 2048;
+  for (int i = 1; i + 1 < argc; i += 2) {
+    if (!strcmp(argv[i], "--dir")) {
+      dir = argv[i + 1];
+    } else if (!strcmp(argv[i], "--mb")) {
+      megabytes = atof(argv[i + 1]);
+    }
+  }
+  printf("one device: %.1f kB/s\n\n", DEVICE_BYTES_PER_SEC / 1e3);
+  bench_crc();
+  bench_parser("parser, clean", 0);
+  bench_parser("parser, 0.1% corrupt", 1000);
+  bench_recorder(dir, megabytes);
+  return 0;
+}
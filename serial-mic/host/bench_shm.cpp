@@ -0,0 +1,201 @@
+// Shared memory fan-out benchmark
+//
+// A writer publishes frames into the ring while 1 to 64 reader processes
+// follow it, as serialmic_shm and its clients would. For each number of
+// readers it reports
+//   - what a publish costs the writer, which shouldn't depend on the readers
+//   - the time from publish to a reader having the frame (a futex wake and a
+//     context switch or two), across all readers
+//   - overruns: frames readers missed because they fell a ring behind
+// One extra reader in the last run is deliberately too slow, to show it gets
+// overruns while the writer and the other readers don't notice.
+//
+// Frames go out every millisecond, 64x the rate a device sends them.
+//
+//   bench_shm [--frames 2000]
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <poll.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+#include "shm_ring.h"
+
+using namespace serialmic;
+
+#define SLOTS 256
+#define INTERVAL_NS 1000000ull
+#define END_SEQ 0xFFFFFFFFu
+
+struct ReaderResult {
+  uint64_t frames;
+  uint64_t overruns;
+  uint64_t skipped;
+  double p50_us, p99_us, max_us;
+};
+
+static void sleep_until(uint64_t ns) {
+  struct timespec ts = {(time_t)(ns / 1000000000ull), (long)(ns % 1000000000ull)};
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) != 0) {
+  }
+}
+
+static void run_reader(const char *name, int ready_fd, int result_fd, int frames, bool slow) {
+  ShmReader reader;
+  if (!reader.open(name)) {
+    _exit(1);
+  }
+  char c = 1;
+  if (write(ready_fd, &c, 1) != 1) {
+    _exit(1);
+  }
+  std::vector<float> latency;
+  latency.reserve(frames);
+  FrameView view;
+  for (;;) {
+    if (!reader.next(view, 5000)) {
+      break;
+    }
+    const uint64_t now = monotonic_ns();
+    const uint32_t seq = view.frame->seq;
+    const uint64_t sent = view.frame->publish_ns;
+    if (!reader.done(view)) {
+      continue;
+    }
+    if (seq == END_SEQ) {
+      break;
+    }
+    latency.push_back((float)((now - sent) * 1e-3));
+    if (slow) {
+      usleep(2000);
+    }
+  }
+  ReaderResult r = {};
+  r.frames = latency.size();
+  r.overruns = reader.overruns();
+  r.skipped = reader.skipped();
+  if (!latency.empty()) {
+    std::sort(latency.begin(), latency.end());
+    r.p50_us = latency[latency.size() / 2];
+    r.p99_us = latency[latency.size() * 99 / 100];
+    r.max_us = latency.back();
+  }
+  if (write(result_fd, &r, sizeof(r)) != sizeof(r)) {
+    _exit(1);
+  }
+  _exit(0);
+}
+
+static void run(int readers, int frames, bool with_slow) {
+  char name[64];
+  snprintf(name, sizeof(name), "/serialmic_bench_%d", (int)getpid());
+  ShmWriter shm;
+  if (!shm.create(name, SLOTS, SAMPLE_RATE)) {
+    exit(1);
+  }
+  int ready[2], results[2];
+  if (pipe(ready) || pipe(results)) {
+    exit(1);
+  }
+  const int total = readers + (with_slow ? 1 : 0);
+  std::vector<pid_t> pids;
+  for (int i = 0; i < total; i++) {
+    pid_t pid = fork();
+    if (pid == 0) {
+      run_reader(name, ready[1], results[1], frames, i == readers);
+    }
+    pids.push_back(pid);
+  }
+  for (int i = 0; i < total; i++) {
+    char c;
+    if (read(ready[0], &c, 1) != 1) {
+      exit(1);
+    }
+  }
+
+  int16_t pcm[SAMPLES_PER_PACKET];
+  for (size_t i = 0; i < SAMPLES_PER_PACKET; i++) {
+    pcm[i] = (int16_t)(i * 13);
+  }
+  double publish_sum = 0, publish_max = 0;
+  uint64_t next = monotonic_ns() + INTERVAL_NS;
+  for (int k = 0; k < frames; k++) {
+    sleep_until(next);
+    next += INTERVAL_NS;
+    const uint64_t t0 = monotonic_ns();
+    shm.publish((uint32_t)k, (uint32_t)k * 64000, pcm, SAMPLES_PER_PACKET, 0, 0);
+    const double ns = (double)(monotonic_ns() - t0);
+    publish_sum += ns;
+    publish_max = std::max(publish_max, ns);
+  }
+  // end markers at the same pace until every reader has seen one
+  std::vector<ReaderResult> res(total);
+  for (int got = 0; got < total;) {
+    sleep_until(next);
+    next += INTERVAL_NS;
+    shm.publish(END_SEQ, 0, pcm, 1, 0, 0);
+    struct pollfd pfd = {results[0], POLLIN, 0};
+    while (got < total && poll(&pfd, 1, 0) > 0) {
+      if (read(results[0], &res[got++], sizeof(ReaderResult)) != sizeof(ReaderResult)) {
+        exit(1);
+      }
+    }
+  }
+  for (pid_t pid : pids) {
+    waitpid(pid, nullptr, 0);
+  }
+  shm.close();
+  close(ready[0]);
+  close(ready[1]);
+  close(results[0]);
+  close(results[1]);
+
+  // the slow reader, if any, is reported on its own line
+  double p50 = 0, p99 = 0, worst = 0;
+  uint64_t overruns = 0, received = 0;
+  ReaderResult slow = {};
+  for (int i = 0; i < total; i++) {
+    if (with_slow && i == readers) {
+      slow = res[i];
+      continue;
+    }
+    p50 = std::max(p50, res[i].p50_us);
+    p99 = std::max(p99, res[i].p99_us);
+    worst = std::max(worst, res[i].max_us);
+    overruns += res[i].overruns;
+    received += res[i].frames;
+  }
+  if (readers == 0) {
+    printf("%7d  %6.0f  %8.0f\n", readers, publish_sum / frames, publish_max);
+    return;
+  }
+  printf("%7d  %6.0f  %8.0f  %6.1f  %6.1f  %7.1f  %8llu  %7.1f%%\n", readers, publish_sum / frames,
+         publish_max, p50, p99, worst, (unsigned long long)overruns,
+         100.0 * received / ((double)frames * readers));
+  if (with_slow) {
+    printf("%7s  slow reader: %llu overruns, %llu frames missed, %llu received\n", "",
+           (unsigned long long)slow.overruns, (unsigned long long)slow.skipped,
+           (unsigned long long)slow.frames);
+  }
+}
+
+int main(int argc, char **argv) {
+  int frames = 2000;
+  for (int i = 1; i + 1 < argc; i += 2) {
+    if (!strcmp(argv[i], "--frames")) {
+      frames = atoi(argv[i + 1]);
+    }
+  }
+  printf("%d frames of %zu samples, one every %.1f ms, %d slot ring\n\n", frames, SAMPLES_PER_PACKET,
+         INTERVAL_NS / 1e6, SLOTS);
+  printf("         publish (ns)        latency to readers (us)\n");
+  printf("readers  mean    worst      p50     p99     max    overruns  received\n");
+  for (int readers : {0, 1, 4, 16, 64}) {
+    run(readers, frames, readers == 64);
+  }
+  return 0;
+}
@@ -0,0 +1,308 @@
+// Sound level meter benchmark
+//
+// The firmware's meter (mic_slm.h) against the standards' class 1 limits,
+// from sines through the whole bank as the board runs it (decimators and
+// all, so anything folded back by one shows):
+//   - every 1/3 octave band's relative attenuation, on a sweep 1/24 of an
+//     octave apart and at each breakpoint of the IEC 61260 class 1 mask
+//   - A and C weighting at each band's centre against IEC 61672-1's
+//     formulas, within its class 1 tolerances
+//   - level linearity of the 1 kHz band and LAeq from 0 to -80 dBFS
+// then what it costs: each band's filters at the rate it runs at, the
+// decimators and the weighting, in microseconds per second of audio, and
+// the whole meter on 1024 sample blocks as the firmware calls it. Exits 1
+// if anything is outside its limits.
+//
+//   bench_slm [-v]
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <vector>
+
+#include "mic_slm.h"
+#include "slm.h"
+
+using namespace serialmic;
+
+static const int RATE = 16000;
+
+static volatile float sink;
+static void benchmark_sink(float v) { sink = sink + v; }
+
+static double now_sec(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// A sine through a fresh meter: settles, then is measured over a second
+static void measure_sine(mic_slm &slm, double hz, double dbfs) {
+  slm_init(&slm, RATE, UINT32_MAX);
+  const double amp = 32767 * pow(10, dbfs / 20);
+  std::vector<int16_t> pcm(RATE);
+  double phase = 0;
+  for (int pass = 0; pass < 3; pass++) {
+    // two seconds to settle: the 25 Hz band rings for a good part of one
+    if (pass == 2) {
+      slm_restart(&slm);
+    }
+    for (int16_t &s : pcm) {
+      s = (int16_t)lrint(amp * sin(phase));
+      phase = fmod(phase + 2 * M_PI * hz / RATE, 2 * M_PI);
+    }
+    slm_process(&slm, pcm.data(), (int)pcm.size());
+  }
+}
+
+// ====================== Filter bank ======================
+// IEC 61260:1995 class 1, octave bands: attenuation limits at Omega =
+// f / fm, above the centre (below it mirrors). Between breakpoints the
+// inner one's lower limit and the outer one's upper limit hold.
+struct Breakpoint {
+  double octave_exp; // Omega = G^octave_exp for an octave band
+  double min_db, max_db;
+};
+static const Breakpoint MASK[] = {
+    {0, -0.3, 0.3},    {0.125, -0.3, 0.4}, {0.25, -0.3, 0.6}, {0.375, -0.3, 1.3}, {0.5, 2.0, 5.0},
+    {1, 17.5, INFINITY}, {2, 42, INFINITY}, {3, 61, INFINITY}, {4, 70, INFINITY},
+};
+static const int MASK_POINTS = sizeof(MASK) / sizeof(MASK[0]);
+
+// The standard's move of an octave band's Omega to a 1/3 octave band's
+static double third_omega(double octave_exp) {
+  const double G = pow(10, 0.3);
+  return 1 + (pow(G, 1.0 / 6) - 1) / (pow(G, 0.5) - 1) * (pow(G, octave_exp) - 1);
+}
+
+// Limits at Omega >= 1 (a 1/3 octave band's)
+static void mask_at(double omega, double *min_db, double *max_db) {
+  int i = 0;
+  while (i + 1 < MASK_POINTS && third_omega(MASK[i + 1].octave_exp) <= omega * (1 + 1e-9)) {
+    i++;
+  }
+  const bool on = fabs(third_omega(MASK[i].octave_exp) / omega - 1) < 1e-9;
+  *min_db = MASK[i].min_db;
+  *max_db = on || i + 1 == MASK_POINTS ? MASK[i].max_db : MASK[i + 1].max_db;
+}
+
+struct BandResult {
+  double at_centre_db = 0;
+  double worst_margin_db = INFINITY; // least room to a limit, negative if out
+  double worst_hz = 0;
+  double edge_db[2] = {0, 0}; // attenuation at the edges
+};
+
+static bool check_bands(bool verbose) {
+  mic_slm slm;
+  slm_init(&slm, RATE, UINT32_MAX);
+  const int bands = slm.bands;
+  std::vector<double> freqs;
+  for (double hz = 10; hz < 0.49 * RATE; hz *= pow(2, 1.0 / 24)) {
+    freqs.push_back(hz);
+  }
+  // each band's centre and breakpoints, both sides
+  for (int b = 0; b < bands; b++) {
+    const double fm = slm_band_hz(SLM_FIRST_BAND + b);
+    for (const Breakpoint &bp : MASK) {
+      const double omega = third_omega(bp.octave_exp);
+      if (fm * omega < 0.49 * RATE) {
+        freqs.push_back(fm * omega);
+      }
+      if (bp.octave_exp > 0 && fm / omega > 5) {
+        freqs.push_back(fm / omega);
+      }
+    }
+  }
+  std::sort(freqs.begin(), freqs.end());
+
+  // level in every band for every tone
+  std::vector<std::vector<double>> level(freqs.size(), std::vector<double>(bands));
+  for (size_t f = 0; f < freqs.size(); f++) {
+    measure_sine(slm, freqs[f], -20);
+    for (int b = 0; b < bands; b++) {
+      level[f][b] = slm_band_db(&slm, b);
+    }
+  }
+
+  bool ok = true;
+  printf("1/3 octave bands against IEC 61260 class 1 (%zu tones)\n", freqs.size());
+  printf("  %8s %10s %10s %10s %12s %10s\n", "band Hz", "centre dB", "lower edge", "upper edge", "least room", "at Hz");
+  for (int b = 0; b < bands; b++) {
+    const double fm = slm_band_hz(SLM_FIRST_BAND + b);
+    BandResult r;
+    // the tone at fm is the reference
+    size_t centre = 0;
+    for (size_t f = 0; f < freqs.size(); f++) {
+      if (fabs(freqs[f] - fm) < fabs(freqs[centre] - fm)) {
+        centre = f;
+      }
+    }
+    const double ref = level[centre][b];
+    r.at_centre_db = ref - (-20);
+    for (size_t f = 0; f < freqs.size(); f++) {
+      const double omega = freqs[f] > fm ? freqs[f] / fm : fm / freqs[f];
+      double lo, hi;
+      mask_at(omega, &lo, &hi);
+      const double att = ref - level[f][b];
+      const double margin = std::min(att - lo, hi - att);
+      if (margin < r.worst_margin_db) {
+        r.worst_margin_db = margin;
+        r.worst_hz = freqs[f];
+      }
+      if (fabs(omega - third_omega(0.5)) < 1e-9 * omega) {
+        r.edge_db[freqs[f] > fm] = att;
+      }
+      if (verbose && margin < 0) {
+        printf("    %.1f Hz: %.2f dB down, limits %.1f to %.1f\n", freqs[f], att, lo, hi);
+      }
+    }
+    const bool pass = r.worst_margin_db >= 0 && fabs(r.at_centre_db) <= 0.3;
+    ok = ok && pass;
+    printf("  %8.1f %+10.3f %10.2f %10.2f %12.2f %10.1f%s\n", fm, r.at_centre_db, r.edge_db[0], r.edge_db[1],
+           r.worst_margin_db, r.worst_hz, pass ? "" : "  FAIL");
+  }
+  return ok;
+}
+
+// ====================== Weighting ======================
+// IEC 61672-1 class 1 tolerance limits at the 1/3 octave centres
+struct Tolerance {
+  double hz, plus, minus;
+};
+static const Tolerance WEIGHT_TOL[] = {
+    {25, 2.0, 2.0},   {31.5, 1.5, 1.5}, {40, 1.0, 1.0},   {50, 1.0, 1.0},   {63, 1.0, 1.0},   {80, 1.0, 1.0},
+    {100, 1.0, 1.0},  {125, 1.0, 1.0},  {160, 1.0, 1.0},  {200, 1.0, 1.0},  {250, 1.0, 1.0},  {315, 1.0, 1.0},
+    {400, 1.0, 1.0},  {500, 1.0, 1.0},  {630, 1.0, 1.0},  {800, 1.0, 1.0},  {1000, 0.7, 0.7}, {1250, 1.0, 1.0},
+    {1600, 1.0, 1.0}, {2000, 1.0, 1.0}, {2500, 1.0, 1.0}, {3150, 1.0, 1.0}, {4000, 1.0, 1.0}, {5000, 1.5, 1.5},
+    {6300, 1.5, 2.0},
+};
+
+static bool check_weighting(void) {
+  mic_slm slm;
+  bool ok = true;
+  printf("\nA and C weighting against IEC 61672-1 (class 1 limits)\n");
+  printf("  %8s %9s %9s %9s %9s %9s\n", "Hz", "A", "A error", "C", "C error", "limits");
+  double worst_a = 0, worst_c = 0;
+  for (const Tolerance &t : WEIGHT_TOL) {
+    // exact centre, not the nominal one
+    const double hz = slm_band_hz((int)lrint(10 * log10(t.hz / 1000)));
+    measure_sine(slm, hz, -20);
+    const double a = slm_level_db(slm.a_energy, slm.samples) - slm_level_db(slm.z_energy, slm.samples);
+    const double c = slm_level_db(slm.c_energy, slm.samples) - slm_level_db(slm.z_energy, slm.samples);
+    const double ea = a - a_weighting_db(hz), ec = c - c_weighting_db(hz);
+    const bool pass = ea <= t.plus && ea >= -t.minus && ec <= t.plus && ec >= -t.minus;
+    ok = ok && pass;
+    worst_a = fabs(ea) > fabs(worst_a) ? ea : worst_a;
+    worst_c = fabs(ec) > fabs(worst_c) ? ec : worst_c;
+    printf("  %8.1f %+9.2f %+9.3f %+9.2f %+9.3f   +%.1f/-%.1f%s\n", t.hz, a, ea, c, ec, t.plus, t.minus,
+           pass ? "" : "  FAIL");
+  }
+  printf("  worst error: A %+.3f dB, C %+.3f dB\n", worst_a, worst_c);
+  return ok;
+}
+
+// ====================== Linearity ======================
+static bool check_linearity(void) {
+  mic_slm slm;
+  bool ok = true;
+  printf("\nLevel linearity, 1 kHz (IEC 61672-1 class 1: 0.8 dB)\n");
+  printf("  %8s %10s %10s\n", "dBFS", "band err", "LAeq err");
+  const int band_1k = -SLM_FIRST_BAND;
+  for (double dbfs = 0; dbfs >= -80; dbfs -= 10) {
+    measure_sine(slm, 1000, dbfs);
+    // what a sine of that peak should read, after rounding to 16 bits
+    const double in = 20 * log10(lrint(32767 * pow(10, dbfs / 20)) / 32768.0);
+    const double eb = slm_band_db(&slm, band_1k) - in;
+    const double ea = slm_level_db(slm.a_energy, slm.samples) - in;
+    const bool pass = fabs(eb) <= 0.8 && fabs(ea) <= 0.8;
+    ok = ok && pass;
+    printf("  %8.0f %+10.3f %+10.3f%s\n", dbfs, eb, ea, pass ? "" : "  FAIL");
+  }
+  return ok;
+}
+
+// ====================== Cost ======================
+// Microseconds of CPU per second of audio: the best of many one second runs,
+// each short enough to miss the scheduler
+template <class F> static double time_per_second(F run) {
+  double best = INFINITY;
+  for (int rep = 0; rep < 50; rep++) {
+    const double t0 = now_sec();
+    run();
+    best = std::min(best, now_sec() - t0);
+  }
+  return best * 1e6;
+}
+
+static void bench_cost(void) {
+  static mic_slm slm;
+  slm_init(&slm, RATE, RATE);
+  // the filters' inputs come from a buffer that stays in cache, so this
+  // measures the arithmetic rather than the host's memory
+  std::vector<float> noise((size_t)SLM_BLOCK * 8);
+  uint32_t rng = 12345;
+  for (float &v : noise) {
+    rng = rng * 1664525u + 1013904223u;
+    v = (float)((int)(rng >> 16) - 32768) / 4;
+  }
+  std::vector<float> x(SLM_BLOCK);
+  // a band's sections on blocks at its own rate
+  auto band_cost = [&](slm_biquad *q, int sections, int rate) {
+    return time_per_second([&] {
+      for (int done = 0; done < rate; done += SLM_BLOCK) {
+        const int n = std::min(SLM_BLOCK, rate - done);
+        memcpy(x.data(), noise.data() + done % noise.size(), n * sizeof(float));
+        for (int k = 0; k < sections; k++) {
+          slm_biquad_run(&q[k], x.data(), n);
+        }
+        benchmark_sink(slm_energy(x.data(), n));
+      }
+    });
+  };
+
+  printf("\nCost on this host, us per second of audio at %d Hz\n", RATE);
+  printf("  %8s %8s %8s\n", "band Hz", "rate", "us/s");
+  double total = 0;
+  for (int b = 0; b < slm.bands; b++) {
+    const int rate = RATE >> slm.band_stage[b];
+    const double us = band_cost(slm.band[b], slm.band_sections[b], rate);
+    total += us;
+    printf("  %8.1f %8d %8.1f\n", slm_band_hz(SLM_FIRST_BAND + b), rate, us);
+  }
+  double decimate = 0;
+  for (int k = 0; k + 1 < slm.stages; k++) {
+    decimate += band_cost(slm.decimate[k], 3, RATE >> k);
+  }
+  const double a = band_cost(slm.a.q, slm.a.sections, RATE), c = band_cost(slm.c.q, slm.c.sections, RATE);
+  printf("  decimators (%d) %.1f, A weighting %.1f, C weighting %.1f\n", slm.stages - 1, decimate, a, c);
+  total += decimate + a + c;
+
+  std::vector<int16_t> pcm((size_t)RATE);
+  for (int i = 0; i < RATE; i++) {
+    pcm[i] = (int16_t)noise[i % noise.size()];
+  }
+  uint8_t pkt[MIC_LEVELS_MAX_LEN];
+  const double whole = time_per_second([&] {
+    for (int done = 0; done < RATE;) {
+      done += slm_process(&slm, pcm.data() + done, std::min(1024, RATE - done));
+      if (slm_ready(&slm)) {
+        benchmark_sink((float)slm_frame_levels(pkt, &slm, 0, 0, 1));
+      }
+    }
+  });
+  printf("  parts %.1f us/s, whole meter on 1024 sample blocks %.1f us/s (%.0fx real time)\n", total, whole,
+         1e6 / whole);
+  printf("  band level packets: %d bytes each\n", (int)slm_frame_levels(pkt, &slm, 0, 0, 1));
+}
+
+int main(int argc, char **argv) {
+  const bool verbose = argc > 1 && !strcmp(argv[1], "-v");
+  bool ok = check_bands(verbose);
+  ok = check_weighting() && ok;
+  ok = check_linearity() && ok;
+  bench_cost();
+  printf("\n%s\n", ok ? "all within class 1 limits" : "OUT OF LIMITS");
+  return ok ? 0 : 1;
+}
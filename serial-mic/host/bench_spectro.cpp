@@ -0,0 +1,222 @@
+// Spectrogram batch benchmark
+//
+// How fast long recordings go through serialmic_spectro's processing:
+//   - the real FFT on its own, against the frontend's fftRadix2 (complex,
+//     twiddles worked out as it goes), ns per transform
+//   - the whole batch (STFT, tiles, log-mel features, levels) on a
+//     synthetic recording with 1, 2, 4 ... threads up to the core count (or
+//     --threads), in hours of audio per second of wall time, with the
+//     speedup over one thread
+//   - features only, without the tile pyramid
+//   - random reads from the mapped feature file
+//
+//   bench_spectro [--dir /tmp] [--hours 2] [--threads N]
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "audio_source.h"
+#include "block_writer.h"
+#include "feature_file.h"
+#include "fft.h"
+#include "packet.h"
+#include "spectro.h"
+#include "wav_writer.h"
+
+using namespace serialmic;
+
+static double now_sec(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint32_t rng = 12345;
+static uint32_t rand32(void) {
+  rng = rng * 1664525u + 1013904223u;
+  return rng;
+}
+
+// The frontend's fftRadix2 as it is, for comparison
+static void frontend_fft(float *re, float *im, size_t n) {
+  size_t j = 0;
+  for (size_t i = 0; i < n; i++) {
+    if (i < j) {
+      std::swap(re[i], re[j]);
+      std::swap(im[i], im[j]);
+    }
+    size_t m = n >> 1;
+    while (m >= 1 && j >= m) {
+      j -= m;
+      m >>= 1;
+    }
+    j += m;
+  }
+  for (size_t step = 1; step < n; step <<= 1) {
+    const size_t jump = step << 1;
+    const double delta = M_PI / step;
+    for (size_t group = 0; group < step; group++) {
+      const float wr = (float)cos(delta * group);
+      const float wi = (float)-sin(delta * group);
+      for (size_t pair = group; pair < n; pair += jump) {
+        const size_t match = pair + step;
+        const float tr = wr * re[match] - wi * im[match];
+        const float ti = wr * im[match] + wi * re[match];
+        re[match] = re[pair] - tr;
+        im[match] = im[pair] - ti;
+        re[pair] += tr;
+        im[pair] += ti;
+      }
+    }
+  }
+}
+
+static void bench_fft(size_t n) {
+  RealFft fft(n);
+  std::vector<float> x(n), re(n / 2 + 1), im(n / 2 + 1);
+  for (float &v : x) {
+    v = (float)(rand32() % 2001) / 1000 - 1;
+  }
+  const int reps = 200000;
+  double t0 = now_sec();
+  float sink = 0;
+  for (int r = 0; r < reps; r++) {
+    fft.transform(x.data(), re.data(), im.data());
+    sink += re[1];
+  }
+  const double real_ns = (now_sec() - t0) / reps * 1e9;
+  std::vector<float> fr(n), fi(n);
+  t0 = now_sec();
+  for (int r = 0; r < reps / 4; r++) {
+    memcpy(fr.data(), x.data(), n * sizeof(float));
+    memset(fi.data(), 0, n * sizeof(float));
+    frontend_fft(fr.data(), fi.data(), n);
+    sink += fr[1];
+  }
+  const double frontend_ns = (now_sec() - t0) / (reps / 4) * 1e9;
+  printf("  %5zu points: real %7.0f ns   frontend %7.0f ns   (%.1fx)%s\n", n, real_ns, frontend_ns,
+         frontend_ns / real_ns, sink == 12345.f ? " " : "");
+}
+
+// Birdsong-ish chirps and a hum over noise, so tiles and features have
+// something in them. 15s of it, repeated.
+static bool make_recording(const std::string &path, double hours) {
+  BlockWriter out;
+  WavWriter wav(out);
+  if (!wav.open(path.c_str(), SAMPLE_RATE, 1, 16)) {
+    return false;
+  }
+  std::vector<int16_t> pattern(15 * SAMPLE_RATE);
+  double phase = 0;
+  for (size_t i = 0; i < pattern.size(); i++) {
+    const double t = (double)i / SAMPLE_RATE;
+    phase += 2 * M_PI * (2000 + 1500 * sin(2 * M_PI * fmod(t, 3.0))) / SAMPLE_RATE;
+    const double chirp = fmod(t, 5.0) < 1.5 ? 6000 * sin(phase) : 0;
+    const double noise = ((int)(rand32() % 2001) - 1000) * 0.5;
+    pattern[i] = (int16_t)(chirp + 3000 * sin(2 * M_PI * 50 * t) + noise);
+  }
+  const uint64_t total = (uint64_t)(hours * 3600 * SAMPLE_RATE);
+  for (uint64_t at = 0; at < total; at += pattern.size()) {
+    wav.write(pattern.data(), std::min<uint64_t>(pattern.size(), total - at) * 2);
+  }
+  wav.close();
+  out.flush();
+  return !out.failed();
+}
+
+int main(int argc, char **argv) {
+  std::string dir = "/tmp";
+  double hours = 2;
+  int max_threads = (int)std::max(1u, std::thread::hardware_concurrency());
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--dir") && i + 1 < argc) {
+      dir = argv[++i];
+    } else if (!strcmp(argv[i], "--hours") && i + 1 < argc) {
+      hours = atof(argv[++i]);
+    } else if (!strcmp(argv[i], "--threads") && i + 1 < argc) {
+      max_threads = atoi(argv[++i]);
+    } else {
+      fprintf(stderr, "usage: bench_spectro [--dir /tmp] [--hours 2] [--threads N]\n");
+      return 1;
+    }
+  }
+
+  printf("FFT\n");
+  for (size_t n : {256, 512, 1024, 2048}) {
+    bench_fft(n);
+  }
+
+  const std::string wav_path = dir + "/bench_spectro.wav";
+  const std::string out_dir = dir + "/bench_spectro.out";
+  printf("\nmaking %.1f hours of audio\n", hours);
+  if (!make_recording(wav_path, hours)) {
+    return 1;
+  }
+  std::unique_ptr<AudioSource> src = open_audio(wav_path.c_str());
+  if (!src) {
+    return 1;
+  }
+  // once through to have the recording in the page cache
+  std::vector<int16_t> tmp(1 << 20);
+  for (uint64_t at = 0; at < src->samples(); at += tmp.size()) {
+    src->read(at, tmp.data(), tmp.size());
+  }
+
+  printf("\nbatch, %d cores\n", (int)std::thread::hardware_concurrency());
+  printf("  what              threads  segments   tiles   seconds  hours/s   speedup\n");
+  double one = 0;
+  for (int t = 1; t <= max_threads; t = t * 2 > max_threads && t < max_threads ? max_threads : t * 2) {
+    SpectroConfig config;
+    config.out_dir = out_dir;
+    config.threads = t;
+    SpectroStats stats;
+    const double t0 = now_sec();
+    if (!run_spectro(*src, config, &stats)) {
+      return 1;
+    }
+    const double elapsed = now_sec() - t0;
+    if (t == 1) {
+      one = elapsed;
+    }
+    printf("  tiles + features  %7d %9llu %7llu %9.2f %8.1f %8.2fx\n", t, (unsigned long long)stats.segments,
+           (unsigned long long)stats.tiles, elapsed, stats.audio_seconds / 3600 / elapsed, one / elapsed);
+  }
+  {
+    SpectroConfig config;
+    config.out_dir = out_dir;
+    config.threads = max_threads;
+    config.tiles = false;
+    SpectroStats stats;
+    const double t0 = now_sec();
+    if (!run_spectro(*src, config, &stats)) {
+      return 1;
+    }
+    const double elapsed = now_sec() - t0;
+    printf("  features only     %7d %9llu %7s %9.2f %8.1f\n", max_threads, (unsigned long long)stats.segments, "-",
+           elapsed, stats.audio_seconds / 3600 / elapsed);
+  }
+
+  FeatureReader reader;
+  if (!reader.open((out_dir + "/features.smf").c_str())) {
+    return 1;
+  }
+  const int reads = 1000000;
+  double t0 = now_sec();
+  float sink = 0;
+  for (int i = 0; i < reads; i++) {
+    const float *row = reader.row(reader.frame_at((rand32() % (uint32_t)(hours * 3600 * 1000)) / 1000.0));
+    sink += row[0];
+  }
+  printf("\nfeature file: %llu frames x %u columns, random row by time %.0f ns%s\n",
+         (unsigned long long)reader.frames(), reader.columns(), (now_sec() - t0) / reads * 1e9,
+         sink == 12345.f ? " " : "");
+  reader.close();
+  unlink(wav_path.c_str());
+  return system(("rm -rf '" + out_dir + "'").c_str()) == 0 ? 0 : 1;
+}
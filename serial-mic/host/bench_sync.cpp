@@ -0,0 +1,346 @@
+// Clock sync benchmark
+//
+// A simulated board and link: the board's clock runs off by tens of ppm and
+// wanders with temperature, its usec counter wraps, and every trip either
+// way is late by a random amount with the odd long stall. Requests go
+// through the firmware's own request scanner and reply framing
+// (mic_frame.h), replies and packets through PacketParser, into ClockSync
+// and SampleClock as serialmic_sync uses them. Once settled it reports, for
+// the last sample of every packet, how far the host time worked out for it
+// is from when it was really captured, against
+//   - the time the host read the packet: what a tool without sync has
+//   - the latest exchange's offset on its own
+//   - the mean offset of the last 128 exchanges, without the delay filter
+// and the skew estimate against the truth, for a few kinds of link. Then
+// what an exchange costs.
+//
+//   bench_sync [--minutes 10] [--interval-ms 250]
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <random>
+#include <vector>
+
+#include "clock_sync.h"
+#include "mic_frame.h"
+
+using namespace serialmic;
+
+#define SETTLE_SEC 60 // left out of the figures
+#define HOST_T0 3.6e9 // host clock when the run starts, us
+
+static double now_sec(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+struct Link {
+  const char *name;
+  double out_base_us, in_base_us; // shortest trip each way
+  double spread_us;               // mean extra, each way
+  double stall;                   // chance the host is busy for 0.2-15ms at either end
+  double busy;                    // chance a reply waits behind packet bytes, up to 4ms
+  double restart_sec;             // the board resets then (0 never)
+};
+
+// The board's clock against the host's: 37ppm fast, wandering 1.5ppm over
+// ten minutes, reading near the top of its 32 bits so it wraps in the
+// first minute. Restarts from 1.2s of uptime.
+struct Board {
+  double skew = 37e-6;
+  double wander = 1.5e-6, period_us = 600e6;
+  double zero = 4294967296.0 - 40e6; // device clock at HOST_T0
+  double restart_host = INFINITY;    // host time it restarts
+  double i2s = 20e-6;                // its sample rate against its own clock
+
+  // Device clock at host time t (us), and its rate
+  double at(double t) const {
+    if (t >= restart_host) {
+      return 1.2e6 + (t - restart_host) * (1 + skew);
+    }
+    const double x = t - HOST_T0;
+    return zero + x * (1 + skew) + wander * period_us / (2 * M_PI) * (1 - cos(2 * M_PI * x / period_us));
+  }
+  double rate(double t) const {
+    return t >= restart_host ? 1 + skew : 1 + skew + wander * sin(2 * M_PI * (t - HOST_T0) / period_us);
+  }
+  // Host time the device clock reads `d`, on the side of the restart `t` is on
+  double host(double d, double t) const {
+    double h = t;
+    for (int i = 0; i < 4; i++) {
+      h -= (at(h) - d) / rate(h);
+    }
+    return h;
+  }
+};
+
+enum EventType { REQUEST, REPLY, PACKET };
+
+struct Event {
+  double host_us; // when it happens on the host
+  EventType type;
+  size_t index; // into the exchanges or packets
+};
+
+// One exchange as the link treats it
+struct Trip {
+  double sent, arrive, depart, received; // host clock
+  bool lost;                             // the board was restarting
+};
+
+struct SimPacket {
+  uint32_t seq;
+  uint32_t usec;
+  double truth_us; // host time its last sample was captured
+};
+
+struct Stats {
+  std::vector<double> err[4]; // sync, arrival, latest exchange, mean
+  double skew_err_ppm = 0;
+  size_t exchanges = 0, lost = 0;
+};
+
+static double percentile(std::vector<double> v, double p) {
+  if (v.empty()) {
+    return 0;
+  }
+  std::sort(v.begin(), v.end());
+  return v[std::min(v.size() - 1, (size_t)(p * (v.size() - 1) + 0.5))];
+}
+
+// What the parser hands on, into the estimators, as serialmic_sync does
+struct Host {
+  ClockSync sync;
+  SampleClock samples{SAMPLE_RATE};
+  double now = 0;
+  bool have_seq = false;
+  uint32_t last_seq = 0;
+  uint64_t sample_end = 0;
+  bool got_packet = false;
+  std::vector<double> sent; // by request id
+  // for the other methods: offsets of the last 128 exchanges
+  std::vector<double> recent;
+  size_t replies = 0;
+
+  void on_packet(const Packet &pkt) {
+    if (have_seq && seq_gap(last_seq + 1, pkt.seq) < 0) {
+      // the board restarted: so did its clock
+      sync.restart();
+      samples.reset();
+      recent.clear();
+      sample_end = 0;
+    }
+    have_seq = true;
+    last_seq = pkt.seq;
+    sample_end += pkt.samples();
+    samples.add(sample_end, sync.unwrap(pkt.usec));
+    got_packet = true;
+  }
+  void on_sync_reply(const Packet &pkt) {
+    const SyncReply r = read_sync_reply(pkt);
+    if (!sync.reply(r, now)) {
+      return;
+    }
+    replies++;
+    SyncExchange x;
+    x.sent_us = sent[r.id];
+    x.received_us = now;
+    x.arrived_us = sync.unwrap(r.arrived_usec);
+    x.replied_us = sync.unwrap(r.sent_usec);
+    recent.push_back(x.offset());
+    if (recent.size() > 128) {
+      recent.erase(recent.begin());
+    }
+  }
+  void on_crc_error(uint64_t) {}
+};
+
+static void run(const Link &link, double minutes, double interval_ms, uint32_t seed, Stats &st) {
+  std::mt19937 rng(seed);
+  std::uniform_real_distribution<double> u(0, 1);
+  std::exponential_distribution<double> spread(1.0 / link.spread_us);
+  std::exponential_distribution<double> stamp(1.0 / 40); // scheduling before a packet's stamp
+  std::exponential_distribution<double> usb(1.0 / 3000); // a packet's trip past the shortest
+  auto stall = [&]() { return u(rng) < link.stall ? 200 + u(rng) * 14800 : 0.0; };
+
+  Board board;
+  const double end = HOST_T0 + minutes * 60e6;
+  if (link.restart_sec > 0) {
+    board.restart_host = HOST_T0 + link.restart_sec * 1e6;
+  }
+  const double boot_us = 1.5e6; // the board is away this long when it restarts
+  auto up = [&](double t) { return t < board.restart_host || t >= board.restart_host + boot_us; };
+
+  std::vector<Event> events;
+  // Exchanges: the host stamps and writes; the board stamps when its RX
+  // event runs, puts the reply at the front of the queue and stamps it when
+  // the loop task gets to it, which may be behind a packet still going out
+  std::vector<Trip> trips;
+  for (double t = HOST_T0 + 1000; t < end; t += interval_ms * 1000 * (0.9 + 0.2 * u(rng))) {
+    Trip trip;
+    trip.sent = t;
+    trip.arrive = t + stall() + link.out_base_us + spread(rng);
+    trip.depart = trip.arrive + 20 + u(rng) * 80;
+    const double wait = u(rng) < link.busy ? u(rng) * 4000 : 0;
+    trip.received = trip.depart + wait + link.in_base_us + spread(rng) + stall();
+    trip.lost = !up(trip.arrive) || !up(trip.depart);
+    events.push_back({trip.sent, REQUEST, trips.size()});
+    if (!trip.lost) {
+      events.push_back({trip.received, REPLY, trips.size()});
+    }
+    st.lost += trip.lost;
+    trips.push_back(trip);
+  }
+
+  // Packets: 1024 samples at the board's I2S rate, stamped once the buffer
+  // is in, read by the host a few ms later with the odd long wait
+  std::vector<SimPacket> packets;
+  const double period = 1e6 / (SAMPLE_RATE * (1 + board.i2s)); // device us per sample
+  for (int pass = 0; pass < 2; pass++) {
+    const double from = pass ? board.restart_host + boot_us : HOST_T0 + 500e3;
+    const double to = pass ? end : std::min(end, board.restart_host);
+    if (from >= end) {
+      break;
+    }
+    const double d0 = board.at(from);
+    uint32_t seq = 0;
+    for (uint64_t n = SAMPLES_PER_PACKET;; n += SAMPLES_PER_PACKET, seq++) {
+      const double captured = d0 + n * period; // device clock, the buffer's last sample done
+      const double truth = board.host(captured, from);
+      if (truth >= to) {
+        break;
+      }
+      const double stamped = captured + stamp(rng);
+      double arrival = board.host(stamped, from) + 300 + usb(rng);
+      if (u(rng) < 0.05) {
+        arrival += 10e3 + u(rng) * 30e3;
+      }
+      events.push_back({arrival, PACKET, packets.size()});
+      packets.push_back({seq, (uint32_t)(int64_t)stamped, truth});
+    }
+  }
+  std::stable_sort(events.begin(), events.end(), [](const Event &a, const Event &b) { return a.host_us < b.host_us; });
+
+  Host host;
+  PacketParser parser(true);
+  mic_sync_rx rx = {};
+  std::vector<std::vector<uint8_t>> replies(trips.size());
+  static int16_t pcm[SAMPLES_PER_PACKET];
+  static uint8_t wire[MAX_PKT_BYTES];
+  for (const Event &e : events) {
+    host.now = e.host_us;
+    if (e.type == REQUEST) {
+      // the request through the firmware's scanner, the reply framed as the
+      // firmware frames it
+      const Trip &trip = trips[e.index];
+      const uint32_t id = host.sync.request(trip.sent);
+      host.sent.resize(std::max(host.sent.size(), (size_t)id + 1));
+      host.sent[id] = trip.sent;
+      uint8_t req[MIC_SYNC_REQ_LEN];
+      frame_sync_request(req, id);
+      uint32_t got = 0;
+      for (uint8_t b : req) {
+        sync_rx_byte(&rx, b, &got);
+      }
+      replies[e.index].resize(MIC_SYNC_REPLY_LEN);
+      frame_sync_reply(replies[e.index].data(), got, (uint32_t)(int64_t)board.at(trip.arrive),
+                       (uint32_t)(int64_t)board.at(trip.depart));
+      continue;
+    }
+    if (e.type == REPLY) {
+      parser.feed(replies[e.index].data(), replies[e.index].size(), host);
+      continue;
+    }
+    const SimPacket &p = packets[e.index];
+    host.got_packet = false;
+    parser.feed(wire, encode_packet(wire, p.seq, p.usec, pcm, SAMPLES_PER_PACKET), host);
+    const bool settling = e.host_us < HOST_T0 + SETTLE_SEC * 1e6 ||
+                          (e.host_us > board.restart_host && e.host_us < board.restart_host + SETTLE_SEC * 1e6);
+    if (!host.got_packet || settling || !host.sync.ready() || !host.samples.ready() || host.recent.empty()) {
+      continue;
+    }
+    const double last = (double)host.sample_end - 1;
+    const double device = host.samples.device_us(last);
+    double mean = 0;
+    for (double o : host.recent) {
+      mean += o;
+    }
+    mean /= host.recent.size();
+    st.err[0].push_back(host.samples.host_us(last, host.sync) - p.truth_us);
+    st.err[1].push_back(e.host_us - p.truth_us);
+    st.err[2].push_back(device - host.recent.back() - p.truth_us);
+    st.err[3].push_back(device - mean - p.truth_us);
+  }
+  st.exchanges = host.replies;
+  st.skew_err_ppm = host.sync.skew_ppm() - (board.rate(end) - 1) * 1e6;
+}
+
+int main(int argc, char **argv) {
+  double minutes = 10;
+  double interval_ms = 250;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--minutes") && i + 1 < argc) {
+      minutes = atof(argv[++i]);
+    } else if (!strcmp(argv[i], "--interval-ms") && i + 1 < argc) {
+      interval_ms = atof(argv[++i]);
+    } else {
+      fprintf(stderr, "usage: bench_sync [--minutes 10] [--interval-ms 250]\n");
+      return 1;
+    }
+  }
+
+  const Link links[] = {
+      {"quiet", 150, 200, 60, 0, 0.1, 0},
+      {"loaded host", 150, 200, 150, 0.1, 0.1, 0},
+      {"busy link", 150, 200, 60, 0.02, 0.6, 0},
+      {"board restarts", 150, 200, 60, 0.02, 0.3, 240},
+  };
+  printf("%.0f minutes a link, an exchange every %.0fms; error in the host time of each packet's last sample\n",
+         minutes, interval_ms);
+  printf("after the first %ds, microseconds\n\n", SETTLE_SEC);
+  printf("%-16s %-22s %9s %9s %9s %9s\n", "link", "method", "p50", "p99", "max", ">1ms");
+  const char *methods[4] = {"ClockSync", "host read time", "latest exchange", "mean of 128"};
+  for (const Link &link : links) {
+    Stats st;
+    run(link, minutes, interval_ms, 12345, st);
+    for (int m = 0; m < 4; m++) {
+      std::vector<double> a;
+      size_t over = 0;
+      for (double e : st.err[m]) {
+        a.push_back(fabs(e));
+        over += fabs(e) > 1000;
+      }
+      printf("%-16s %-22s %9.1f %9.1f %9.1f %8.2f%%\n", m == 0 ? link.name : "", methods[m], percentile(a, 0.5),
+             percentile(a, 0.99), a.empty() ? 0 : *std::max_element(a.begin(), a.end()),
+             a.empty() ? 0 : 100.0 * over / a.size());
+    }
+    printf("%-16s skew error %.2fppm, %zu exchanges used, %zu lost, %zu packets scored\n\n", "", st.skew_err_ppm,
+           st.exchanges, st.lost, st.err[0].size());
+  }
+
+  // What an exchange costs: the fit runs on every one
+  ClockSync sync;
+  std::mt19937 rng(1);
+  std::exponential_distribution<double> spread(1.0 / 100);
+  const int n = 200000;
+  std::vector<SyncExchange> xs(n);
+  for (int i = 0; i < n; i++) {
+    const double t = HOST_T0 + i * 250e3;
+    xs[i].sent_us = t;
+    xs[i].arrived_us = t * (1 + 37e-6) + 5e6 + 150 + spread(rng);
+    xs[i].replied_us = xs[i].arrived_us + 50;
+    xs[i].received_us = t + 400 + 2 * spread(rng);
+  }
+  const double t0 = now_sec();
+  for (const SyncExchange &x : xs) {
+    sync.add(x);
+  }
+  const double sec = now_sec() - t0;
+  printf("ClockSync::add with a 128 exchange window: %.2fus an exchange (%.4f%% of a core at 4 a second)\n",
+         sec / n * 1e6, sec / n * 4 * 100);
+  return 0;
+}
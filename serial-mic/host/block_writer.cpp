@@ -0,0 +1,175 @@
+#include "block_writer.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace serialmic {
+
+BlockWriter::BlockWriter(size_t block_bytes, int blocks) : block_bytes_(block_bytes) {
+  // page aligned, the kernel copies whole pages fastest
+  block_bytes_ = (block_bytes_ + 4095) & ~(size_t)4095;
+  for (int i = 0; i < blocks; i++) {
+    void *p = nullptr;
+    if (posix_memalign(&p, 4096, block_bytes_) != 0) {
+      abort();
+    }
+    pool_.emplace_back((uint8_t *)p, free);
+    free_.push_back(i);
+  }
+  thread_ = std::thread(&BlockWriter::run, this);
+}
+
+BlockWriter::~BlockWriter() {
+  close();
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    quit_ = true;
+  }
+  cond_.notify_all();
+  thread_.join();
+}
+
+bool BlockWriter::open(const char *path) {
+  close();
+  fd_ = ::open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd_ < 0) {
+    fprintf(stderr, "can't create %s: %s\n", path, strerror(errno));
+    return false;
+  }
+  size_ = 0;
+  failed_ = false;
+  return true;
+}
+
+int BlockWriter::take_block() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (free_.empty()) {
+    stalls_++;
+    cond_.wait(lock, [this] { return !free_.empty(); });
+  }
+  int block = free_.back();
+  free_.pop_back();
+  return block;
+}
+
+void BlockWriter::submit(int block, size_t len, int64_t offset, bool close_fd) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    jobs_.push_back(Job{fd_, block, len, offset, close_fd});
+  }
+  cond_.notify_all();
+}
+
+void BlockWriter::append(const void *data, size_t len) {
+  if (fd_ < 0) {
+    return;
+  }
+  const uint8_t *p = (const uint8_t *)data;
+  size_ += len;
+  while (len > 0) {
+    if (current_ < 0) {
+      current_ = take_block();
+      fill_ = 0;
+    }
+    size_t n = block_bytes_ - fill_;
+    if (n > len) {
+      n = len;
+    }
+    if (p) {
+      memcpy(pool_[current_].get() + fill_, p, n);
+      p += n;
+    } else {
+      memset(pool_[current_].get() + fill_, 0, n);
+    }
+    fill_ += n;
+    len -= n;
+    if (fill_ == block_bytes_) {
+      submit(current_, fill_, -1, false);
+      current_ = -1;
+    }
+  }
+}
+
+void BlockWriter::append_zeros(size_t len) { append(nullptr, len); }
+
+void BlockWriter::patch(uint64_t offset, const void *data, size_t len) {
+  if (fd_ < 0 || len > block_bytes_) {
+    return;
+  }
+  // the partial block goes first, or its write would land on top of the patch
+  if (current_ >= 0) {
+    submit(current_, fill_, -1, false);
+    current_ = -1;
+  }
+  int block = take_block();
+  memcpy(pool_[block].get(), data, len);
+  submit(block, len, (int64_t)offset, false);
+}
+
+void BlockWriter::close() {
+  if (fd_ < 0) {
+    return;
+  }
+  if (current_ < 0) {
+    current_ = take_block();
+    fill_ = 0;
+  }
+  // the last partial block goes with the close
+  submit(current_, fill_, -1, true);
+  current_ = -1;
+  fd_ = -1;
+}
+
+void BlockWriter::flush() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  cond_.wait(lock, [this] { return jobs_.empty() && !busy_; });
+}
+
+void BlockWriter::run() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  for (;;) {
+    cond_.wait(lock, [this] { return quit_ || !jobs_.empty(); });
+    if (jobs_.empty()) {
+      return;
+    }
+    Job job = jobs_.front();
+    jobs_.pop_front();
+    busy_ = true;
+    lock.unlock();
+
+    bool ok = true;
+    const uint8_t *p = pool_[job.block].get();
+    size_t done = 0;
+    while (done < job.len) {
+      ssize_t n = job.offset < 0 ? ::write(job.fd, p + done, job.len - done)
+                                 : ::pwrite(job.fd, p + done, job.len - done, job.offset + done);
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      if (n <= 0) {
+        fprintf(stderr, "write failed: %s\n", strerror(errno));
+        ok = false;
+        break;
+      }
+      done += n;
+    }
+    if (job.close_fd) {
+      ::close(job.fd);
+    }
+
+    lock.lock();
+    busy_ = false;
+    written_ += done;
+    if (!ok) {
+      failed_ = true;
+    }
+    free_.push_back(job.block);
+    cond_.notify_all();
+  }
+}
+
+} // namespace serialmic
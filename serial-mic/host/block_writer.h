@@ -0,0 +1,81 @@
+// Large block file writer with a fixed amount of memory
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace serialmic {
+
+// Appends go into one of a fixed pool of big blocks; full blocks are written
+// out by a background thread, so a slow disk holds up the caller only once
+// every block is waiting to be written. Memory is block_bytes * blocks,
+// however long the recording.
+//
+// Several files can be on the go: jobs carry their fd and are done in order,
+// so closing one file and opening the next never waits for the disk.
+class BlockWriter {
+public:
+  BlockWriter(size_t block_bytes = 1 << 20, int blocks = 4);
+  ~BlockWriter();
+
+  // Creates (or truncates) `path` and makes it the file appends go to.
+  // Returns false if it can't be opened.
+  bool open(const char *path);
+  void append(const void *data, size_t len);
+  // Appends `len` zero bytes
+  void append_zeros(size_t len);
+  // Overwrites `len` (at most one block) bytes at `offset` once everything
+  // appended so far is written - for patching headers. Sends the block being
+  // filled early, so keep it to the occasional checkpoint.
+  void patch(uint64_t offset, const void *data, size_t len);
+  // Queues the rest of the file and the close; doesn't wait for them
+  void close();
+  // Waits until everything queued is on disk (in the page cache)
+  void flush();
+
+  uint64_t size() const { return size_; }     // of the open file
+  uint64_t written() const { return written_; } // bytes written, all files
+  uint64_t stalls() const { return stalls_; }   // appends that waited for a block
+  bool failed() const { return failed_; }       // a write failed since open()
+  size_t memory() const { return block_bytes_ * pool_.size(); }
+
+private:
+  struct Job {
+    int fd;
+    int block;
+    size_t len;
+    int64_t offset; // -1 appends
+    bool close_fd;
+  };
+
+  int take_block();
+  void submit(int block, size_t len, int64_t offset, bool close_fd);
+  void run();
+
+  size_t block_bytes_;
+  std::vector<std::unique_ptr<uint8_t, void (*)(void *)>> pool_;
+  int fd_ = -1;
+  int current_ = -1; // block being filled
+  size_t fill_ = 0;
+  uint64_t size_ = 0;
+  uint64_t stalls_ = 0;
+
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  std::vector<int> free_;
+  std::deque<Job> jobs_;
+  bool busy_ = false;
+  bool quit_ = false;
+  std::atomic<bool> failed_{false};
+  std::atomic<uint64_t> written_{0};
+  std::thread thread_;
+};
+
+} // namespace serialmic
@@ -0,0 +1,585 @@
+#include "capture_file.h"
+
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "capture files are written as they are laid out in memory, which needs a little-endian host"
+#endif
+
+namespace serialmic {
+
+// A seq this far behind the one expected is a late packet, further back the
+// device has restarted (as in the recorder)
+#define LATE_WINDOW 64
+
+int64_t realtime_us() {
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// ====================== Writer ======================
+bool CaptureWriter::open(const char *path, int sample_rate, size_t packet_samples) {
+  close();
+  fd_ = ::open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd_ < 0) {
+    fprintf(stderr, "can't create %s: %s\n", path, strerror(errno));
+    return false;
+  }
+  memset(&file_, 0, sizeof(file_));
+  memcpy(file_.magic, CAP_MAGIC, sizeof(file_.magic));
+  file_.version = CAP_VERSION;
+  file_.sample_rate = (uint32_t)sample_rate;
+  file_.packet_samples = (uint32_t)packet_samples;
+  file_.record_bytes = (uint32_t)((sizeof(CapRecord) + packet_samples * 2 + 15) & ~(size_t)15);
+  file_.chunk_bytes = (CAP_PAGE + (uint64_t)CAP_CHUNK_PACKETS * file_.record_bytes + CAP_PAGE - 1) & ~(uint64_t)(CAP_PAGE - 1);
+  file_.data_offset = CAP_PAGE;
+  file_.created_host_us = realtime_us();
+
+  void *p = nullptr;
+  if (posix_memalign(&p, CAP_PAGE, file_.chunk_bytes) != 0) {
+    abort();
+  }
+  chunk_buf_ = (uint8_t *)p;
+  chunk_ = (CapChunkHeader *)chunk_buf_;
+  chunk_open_ = false;
+  started_ = false;
+  pending_crc_ = 0;
+  since_checkpoint_ = 0;
+  bytes_written_ = 0;
+  oversize_ = 0;
+  failed_ = false;
+  write_at(0, &file_, sizeof(file_));
+  return !failed_;
+}
+
+void CaptureWriter::write_at(uint64_t offset, const void *data, size_t len) {
+  const uint8_t *p = (const uint8_t *)data;
+  while (len > 0 && !failed_) {
+    ssize_t n = pwrite(fd_, p, len, (off_t)offset);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      perror("capture write");
+      failed_ = true;
+      return;
+    }
+    p += n;
+    len -= (size_t)n;
+    offset += (uint64_t)n;
+    bytes_written_ += (uint64_t)n;
+  }
+}
+
+void CaptureWriter::add_event(uint8_t type, uint32_t slot, uint32_t count) {
+  if (chunk_->events < CAP_MAX_EVENTS) {
+    CapEvent &e = chunk_->event[chunk_->events++];
+    e.type = type;
+    e.slot = (uint16_t)slot;
+    e.count = count;
+  } else {
+    chunk_->dropped_events++;
+  }
+}
+
+void CaptureWriter::start_chunk(uint64_t chunk) {
+  memset(chunk_buf_, 0, file_.chunk_bytes);
+  memcpy(chunk_->magic, CAP_CHUNK_MAGIC, sizeof(chunk_->magic));
+  chunk_->chunk = chunk;
+  chunk_open_ = true;
+  dirty_lo_ = CAP_CHUNK_PACKETS;
+  dirty_hi_ = 0;
+  if (chunk + 1 > file_.chunks) {
+    file_.chunks = chunk + 1;
+  }
+}
+
+// The records not written yet, then the header, which is what makes them
+// visible to a reader
+void CaptureWriter::write_chunk() {
+  const uint64_t base = chunk_offset(chunk_->chunk);
+  const uint32_t rb = file_.record_bytes;
+  if (dirty_lo_ == 0) {
+    // the chunk so far in one write, header included
+    write_at(base, chunk_buf_, CAP_PAGE + (size_t)dirty_hi_ * rb);
+  } else {
+    if (dirty_lo_ < dirty_hi_) {
+      write_at(base + CAP_PAGE + (uint64_t)dirty_lo_ * rb, chunk_buf_ + CAP_PAGE + (size_t)dirty_lo_ * rb,
+               (size_t)(dirty_hi_ - dirty_lo_) * rb);
+    }
+    write_at(base, chunk_buf_, CAP_PAGE);
+  }
+  dirty_lo_ = CAP_CHUNK_PACKETS;
+  dirty_hi_ = 0;
+}
+
+void CaptureWriter::store(uint64_t n, const Packet &pkt, uint64_t usec, int64_t host_us) {
+  const uint64_t k = n / CAP_CHUNK_PACKETS;
+  const uint32_t slot = (uint32_t)(n % CAP_CHUNK_PACKETS);
+  if (!chunk_open_ || chunk_->chunk != k) {
+    if (chunk_open_) {
+      write_chunk();
+      write_at(0, &file_, sizeof(file_));
+    }
+    start_chunk(k);
+  }
+  uint8_t *r = chunk_buf_ + CAP_PAGE + (size_t)slot * file_.record_bytes;
+  CapRecord *rec = (CapRecord *)r;
+  rec->seq = pkt.seq;
+  rec->usec = pkt.usec;
+  rec->payload_len = pkt.payload_len;
+  rec->crc = le_read16(pkt.payload + pkt.payload_len);
+  memcpy(r + sizeof(CapRecord), pkt.payload, pkt.payload_len);
+
+  CapChunkHeader *h = chunk_;
+  h->present[slot / 8] |= (uint8_t)(1 << (slot % 8));
+  if (h->packets == 0 || slot < h->first_slot) {
+    h->first_slot = (uint16_t)slot;
+    h->first_usec = usec;
+    h->first_host_us = host_us;
+  }
+  if (h->packets == 0 || slot > h->last_slot) {
+    h->last_slot = (uint16_t)slot;
+    h->last_usec = usec;
+    h->last_host_us = host_us;
+  }
+  h->packets++;
+  file_.packets++;
+  if (slot < dirty_lo_) {
+    dirty_lo_ = slot;
+  }
+  if (slot + 1 > dirty_hi_) {
+    dirty_hi_ = slot + 1;
+  }
+}
+
+void CaptureWriter::add(const Packet &pkt, int64_t host_us) {
+  if (fd_ < 0) {
+    return;
+  }
+  if (sizeof(CapRecord) + pkt.payload_len > file_.record_bytes) {
+    oversize_++;
+    return;
+  }
+  const double packet_us = file_.packet_samples * 1e6 / file_.sample_rate;
+  uint64_t n;
+  if (!started_) {
+    started_ = true;
+    n = 0;
+    usec_ = pkt.usec;
+    file_.segment[0].first_packet = 0;
+    file_.segment[0].first_seq = pkt.seq;
+    file_.segments = 1;
+    store(n, pkt, usec_, host_us);
+  } else {
+    const int32_t gap = seq_gap(expected_seq_, pkt.seq);
+    if (gap < 0 && gap >= -LATE_WINDOW) {
+      // fills a hole if it's still in the chunk being written
+      const int64_t late = (int64_t)last_packet_ + 1 + gap;
+      const uint32_t slot = (uint32_t)(late % CAP_CHUNK_PACKETS);
+      if (late >= 0 && (uint64_t)late / CAP_CHUNK_PACKETS == chunk_->chunk &&
+          !((chunk_->present[slot / 8] >> (slot % 8)) & 1)) {
+        store((uint64_t)late, pkt, usec_ - (uint32_t)(last_usec_ - pkt.usec), host_us);
+        add_event(CAP_EVENT_LATE, slot, 1);
+        if (chunk_->lost > 0) {
+          chunk_->lost--;
+          file_.lost--;
+        }
+      } else {
+        file_.late_dropped++;
+      }
+      return;
+    }
+    if (gap < 0) {
+      // a restart starts a chunk, so each chunk has one run of seqs and
+      // one device clock. The unwrapped clock carries on at the nominal rate.
+      n = (last_packet_ / CAP_CHUNK_PACKETS + 1) * CAP_CHUNK_PACKETS;
+      usec_ += (uint64_t)((n - last_packet_) * packet_us);
+      if (file_.segments < CAP_MAX_SEGMENTS) {
+        file_.segment[file_.segments].first_packet = n;
+        file_.segment[file_.segments].first_seq = pkt.seq;
+        file_.segments++;
+      }
+    } else {
+      n = last_packet_ + 1 + (uint32_t)gap;
+      usec_ += (uint32_t)(pkt.usec - last_usec_);
+    }
+    store(n, pkt, usec_, host_us);
+    if (gap < 0) {
+      add_event(CAP_EVENT_RESTART, 0, 0);
+    } else if (gap > 0) {
+      add_event(CAP_EVENT_GAP, (uint32_t)(n % CAP_CHUNK_PACKETS), (uint32_t)gap);
+      chunk_->lost += (uint32_t)gap;
+      file_.lost += (uint32_t)gap;
+    }
+  }
+  if (pending_crc_ > 0) {
+    add_event(CAP_EVENT_CRC, (uint32_t)(n % CAP_CHUNK_PACKETS), pending_crc_);
+    chunk_->crc_errors += pending_crc_;
+    file_.crc_errors += pending_crc_;
+    pending_crc_ = 0;
+  }
+  last_packet_ = n;
+  expected_seq_ = pkt.seq + 1;
+  last_usec_ = pkt.usec;
+  if (++since_checkpoint_ >= checkpoint_packets_) {
+    checkpoint();
+  }
+}
+
+void CaptureWriter::checkpoint() {
+  if (fd_ < 0) {
+    return;
+  }
+  if (chunk_open_ && dirty_lo_ < dirty_hi_) {
+    write_chunk();
+  }
+  write_at(0, &file_, sizeof(file_));
+  since_checkpoint_ = 0;
+}
+
+void CaptureWriter::close() {
+  if (fd_ < 0) {
+    return;
+  }
+  if (chunk_open_) {
+    write_chunk();
+  }
+  write_at(0, &file_, sizeof(file_));
+  ::close(fd_);
+  fd_ = -1;
+  free(chunk_buf_);
+  chunk_buf_ = nullptr;
+  chunk_ = nullptr;
+  chunk_open_ = false;
+}
+
+// ====================== Reader ======================
+bool CaptureReader::open(const char *path) {
+  close();
+  int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    fprintf(stderr, "can't open %s: %s\n", path, strerror(errno));
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size < (off_t)CAP_PAGE) {
+    fprintf(stderr, "%s: not a capture file\n", path);
+    ::close(fd);
+    return false;
+  }
+  void *p = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (p == MAP_FAILED) {
+    fprintf(stderr, "can't map %s: %s\n", path, strerror(errno));
+    return false;
+  }
+  map_ = (const uint8_t *)p;
+  size_ = (size_t)st.st_size;
+  file_ = (const CapFileHeader *)map_;
+  if (memcmp(file_->magic, CAP_MAGIC, sizeof(CAP_MAGIC)) != 0 || file_->version != CAP_VERSION ||
+      file_->sample_rate == 0 || file_->chunk_bytes < CAP_PAGE || file_->data_offset < CAP_PAGE) {
+    fprintf(stderr, "%s: not a capture file (or a newer version)\n", path);
+    close();
+    return false;
+  }
+  // lookups touch a page or two each, read-ahead would only get in the way
+  madvise(p, size_, MADV_RANDOM);
+  packet_us_ = file_->packet_samples * 1e6 / file_->sample_rate;
+  // the header is only as new as the last checkpoint, the file may have
+  // more chunks after it
+  chunks_ = file_->chunks;
+  if (size_ > file_->data_offset) {
+    const uint64_t by_size = (size_ - file_->data_offset + file_->chunk_bytes - 1) / file_->chunk_bytes;
+    if (by_size > chunks_) {
+      chunks_ = by_size;
+    }
+  }
+  end_ = 0;
+  for (int64_t k = (int64_t)chunks_ - 1; k >= 0; k--) {
+    if (const CapChunkHeader *h = chunk((uint64_t)k)) {
+      end_ = (uint64_t)k * CAP_CHUNK_PACKETS + h->last_slot + 1;
+      break;
+    }
+  }
+  return true;
+}
+
+void CaptureReader::close() {
+  if (map_) {
+    munmap((void *)map_, size_);
+    map_ = nullptr;
+  }
+  file_ = nullptr;
+  size_ = 0;
+  chunks_ = 0;
+  end_ = 0;
+}
+
+const CapChunkHeader *CaptureReader::chunk(uint64_t k) const {
+  if (k >= chunks_) {
+    return nullptr;
+  }
+  const uint64_t off = file_->data_offset + k * file_->chunk_bytes;
+  if (off + CAP_PAGE > size_) {
+    return nullptr;
+  }
+  const CapChunkHeader *h = (const CapChunkHeader *)(map_ + off);
+  if (memcmp(h->magic, CAP_CHUNK_MAGIC, sizeof(CAP_CHUNK_MAGIC)) != 0 || h->chunk != k || h->packets == 0) {
+    return nullptr; // a hole, or not written yet
+  }
+  return h;
+}
+
+const CapRecord *CaptureReader::record(uint64_t n) const {
+  const uint64_t off = file_->data_offset + n / CAP_CHUNK_PACKETS * file_->chunk_bytes + CAP_PAGE +
+                       n % CAP_CHUNK_PACKETS * file_->record_bytes;
+  if (off + file_->record_bytes > size_) {
+    return nullptr;
+  }
+  return (const CapRecord *)(map_ + off);
+}
+
+bool CaptureReader::packet(uint64_t n, CapPacket &out) const {
+  const CapChunkHeader *h = chunk(n / CAP_CHUNK_PACKETS);
+  const uint32_t slot = (uint32_t)(n % CAP_CHUNK_PACKETS);
+  if (!h || !present(h, slot)) {
+    return false;
+  }
+  const CapRecord *rec = record(n);
+  const CapRecord *first = record(n - slot + h->first_slot);
+  if (!rec || !first || sizeof(CapRecord) + rec->payload_len > file_->record_bytes) {
+    return false;
+  }
+  out.number = n;
+  out.record = rec;
+  out.pcm = (const int16_t *)(rec + 1);
+  // one run of seqs per chunk, so the device clock doesn't wrap inside one
+  out.usec = h->first_usec + (uint32_t)(rec->usec - first->usec);
+  out.host_us = h->first_host_us;
+  if (h->last_slot > h->first_slot) {
+    out.host_us += (h->last_host_us - h->first_host_us) * (int64_t)(slot - h->first_slot) /
+                   (h->last_slot - h->first_slot);
+  }
+  return true;
+}
+
+size_t CaptureReader::rebuild(const CapPacket &pkt, uint8_t *out) const {
+  const CapRecord *rec = pkt.record;
+  out[0] = PKT_SYNC;
+  le_write16(out + 1, rec->payload_len);
+  le_write32(out + 3, rec->seq);
+  le_write32(out + 7, rec->usec);
+  memcpy(out + PKT_HEADER_LEN, rec + 1, rec->payload_len);
+  le_write16(out + PKT_HEADER_LEN + rec->payload_len, rec->crc);
+  return PKT_OVERHEAD + rec->payload_len;
+}
+
+int64_t CaptureReader::next_chunk(int64_t k) const {
+  for (; k < (int64_t)chunks_; k++) {
+    if (chunk((uint64_t)k)) {
+      return k;
+    }
+  }
+  return -1;
+}
+
+int64_t CaptureReader::stored_from(uint64_t n) const {
+  while (n < end_) {
+    const int64_t k = next_chunk((int64_t)(n / CAP_CHUNK_PACKETS));
+    if (k < 0) {
+      return -1;
+    }
+    if ((uint64_t)k > n / CAP_CHUNK_PACKETS) {
+      n = (uint64_t)k * CAP_CHUNK_PACKETS;
+    }
+    const CapChunkHeader *h = chunk((uint64_t)k);
+    for (uint32_t slot = (uint32_t)(n % CAP_CHUNK_PACKETS); slot <= h->last_slot; slot++) {
+      if (present(h, slot)) {
+        return (int64_t)((uint64_t)k * CAP_CHUNK_PACKETS + slot);
+      }
+    }
+    n = (uint64_t)(k + 1) * CAP_CHUNK_PACKETS;
+  }
+  return -1;
+}
+
+int64_t CaptureReader::find_seq(uint32_t seq) const {
+  for (uint32_t s = 0; s < file_->segments && s < CAP_MAX_SEGMENTS; s++) {
+    const CapSegment &seg = file_->segment[s];
+    const uint64_t n = seg.first_packet + (uint32_t)(seq - seg.first_seq);
+    const uint64_t seg_end = s + 1 < file_->segments ? file_->segment[s + 1].first_packet : end_;
+    if (n < seg_end) {
+      return stored_from(n);
+    }
+  }
+  return -1;
+}
+
+// The last stored chunk whose first key is at or before the target, -1 if
+// the target is before them all.
+//
+// `guess` comes from the nominal packet rate and is right unless there has
+// been a restart or a long gap, so this is a couple of header reads. It
+// gallops out from the guess until it brackets the answer, then bisects,
+// so a bad guess costs a few more.
+template <class Key> int64_t CaptureReader::last_chunk_at(Key key, int64_t target, int64_t guess) const {
+  const int64_t n = (int64_t)chunks_;
+  if (n == 0) {
+    return -1;
+  }
+  // true once the first stored chunk from k on starts after the target
+  auto after = [&](int64_t k) {
+    const int64_t c = next_chunk(k);
+    return c < 0 || key(chunk((uint64_t)c)) > target;
+  };
+  if (guess < 0) {
+    guess = 0;
+  }
+  if (guess >= n) {
+    guess = n - 1;
+  }
+  int64_t lo, hi; // !after(lo) (or lo == -1), after(hi) (or hi == n)
+  if (after(guess)) {
+    hi = guess;
+    for (int64_t step = 1;; step *= 2) {
+      lo = hi - step;
+      if (lo < 0) {
+        lo = -1;
+        break;
+      }
+      if (!after(lo)) {
+        break;
+      }
+      hi = lo;
+    }
+  } else {
+    lo = guess;
+    for (int64_t step = 1;; step *= 2) {
+      hi = lo + step;
+      if (hi >= n) {
+        hi = n;
+        break;
+      }
+      if (after(hi)) {
+        break;
+      }
+      lo = hi;
+    }
+  }
+  while (hi - lo > 1) {
+    const int64_t mid = lo + (hi - lo) / 2;
+    if (after(mid)) {
+      hi = mid;
+    } else {
+      lo = mid;
+    }
+  }
+  for (int64_t k = hi - 1; k >= 0 && k >= lo; k--) {
+    if (chunk((uint64_t)k)) {
+      return k;
+    }
+  }
+  return -1;
+}
+
+// First stored packet in chunk c whose key reaches the target, starting the
+// search from an estimated slot. The caller has checked the chunk's last
+// packet does.
+template <class Key> int64_t CaptureReader::find_in(int64_t c, Key key, int64_t target, uint32_t slot) const {
+  const CapChunkHeader *h = chunk((uint64_t)c);
+  const uint64_t base = (uint64_t)c * CAP_CHUNK_PACKETS;
+  if (slot < h->first_slot) {
+    slot = h->first_slot;
+  }
+  if (slot > h->last_slot) {
+    slot = h->last_slot;
+  }
+  // back to a packet before the target, then forward to the first at it
+  while (slot > h->first_slot && !(present(h, slot) && key(base + slot) < target)) {
+    slot--;
+  }
+  while (slot < h->last_slot && !(present(h, slot) && key(base + slot) >= target)) {
+    slot++;
+  }
+  return (int64_t)(base + slot);
+}
+
+int64_t CaptureReader::find_usec(uint64_t usec) const {
+  const CapChunkHeader *h0 = chunk(0);
+  if (!h0) {
+    return stored_from(0);
+  }
+  const int64_t t = (int64_t)usec;
+  const double chunk_us = packet_us_ * CAP_CHUNK_PACKETS;
+  const int64_t c = last_chunk_at([](const CapChunkHeader *h) { return (int64_t)h->first_usec; }, t,
+                                  (int64_t)((t - (int64_t)h0->first_usec) / chunk_us));
+  if (c < 0) {
+    return stored_from(0);
+  }
+  const CapChunkHeader *h = chunk((uint64_t)c);
+  if (t > (int64_t)h->last_usec) {
+    return stored_from((uint64_t)(c + 1) * CAP_CHUNK_PACKETS);
+  }
+  auto key = [this](uint64_t n) {
+    CapPacket p;
+    return packet(n, p) ? (int64_t)p.usec : INT64_MIN;
+  };
+  return find_in(c, key, t, h->first_slot + (uint32_t)((t - (int64_t)h->first_usec) / packet_us_));
+}
+
+int64_t CaptureReader::find_host_time(int64_t host_us) const {
+  const CapChunkHeader *h0 = chunk(0);
+  if (!h0) {
+    return stored_from(0);
+  }
+  const double chunk_us = packet_us_ * CAP_CHUNK_PACKETS;
+  const int64_t c = last_chunk_at([](const CapChunkHeader *h) { return h->first_host_us; }, host_us,
+                                  (int64_t)((host_us - h0->first_host_us) / chunk_us));
+  if (c < 0) {
+    return stored_from(0);
+  }
+  const CapChunkHeader *h = chunk((uint64_t)c);
+  if (host_us > h->last_host_us) {
+    return stored_from((uint64_t)(c + 1) * CAP_CHUNK_PACKETS);
+  }
+  auto key = [this](uint64_t n) {
+    CapPacket p;
+    return packet(n, p) ? p.host_us : INT64_MIN;
+  };
+  return find_in(c, key, host_us, h->first_slot + (uint32_t)((host_us - h->first_host_us) / packet_us_));
+}
+
+size_t CaptureReader::read_pcm(uint64_t first_packet, int16_t *out, size_t count) const {
+  size_t done = 0;
+  for (uint64_t n = first_packet; done < count && n < end_; n++) {
+    CapPacket p;
+    size_t samples = file_->packet_samples;
+    const bool have = packet(n, p);
+    if (have) {
+      samples = p.record->payload_len / 2;
+    }
+    if (samples > count - done) {
+      samples = count - done;
+    }
+    if (have) {
+      memcpy(out + done, p.pcm, samples * 2);
+    } else {
+      memset(out + done, 0, samples * 2);
+    }
+    done += samples;
+  }
+  return done;
+}
+
+} // namespace serialmic
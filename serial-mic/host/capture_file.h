@@ -0,0 +1,226 @@
+// Indexed serial-mic capture files (.smc)
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "packet.h"
+
+namespace serialmic {
+
+// A capture keeps every packet as it arrived, so it can be played back,
+// re-exported byte for byte or turned into audio later, and finds any
+// packet or moment in it without reading the rest.
+//
+// Packets are numbered from the start of the recording (the seq, unwrapped,
+// carrying on across device restarts). Packet n always lives at the same
+// place:
+//   chunk  n / CAP_CHUNK_PACKETS, at data_offset + chunk * chunk_bytes
+//   record n % CAP_CHUNK_PACKETS, after the chunk header
+// so finding packet n is arithmetic, and finding a seq or a time is an
+// estimate from the nominal packet rate corrected by looking at a chunk
+// header or two. Missing packets leave their record empty; a gap of whole
+// chunks leaves a hole in the file (sparse, so it costs no disk).
+//
+// Each chunk header has the chunk's time range on the device and host
+// clocks, a bitmap of the records present, and markers for gaps, CRC
+// failures and restarts. A chunk is written in one go once it is full (about
+// 16s of audio); in between, checkpoints write the new records and the
+// header every few seconds, so a crash loses no more than that. Nothing is
+// ever written twice except the two headers, which keeps write
+// amplification to a couple of percent.
+//
+// Little-endian hosts only: the structures are the file layout.
+constexpr char CAP_MAGIC[8] = {'S', 'M', 'I', 'C', 'A', 'P', '0', '1'};
+constexpr char CAP_CHUNK_MAGIC[8] = {'S', 'M', 'C', 'H', 'U', 'N', 'K', 0};
+constexpr uint32_t CAP_VERSION = 1;
+constexpr size_t CAP_PAGE = 4096;
+constexpr uint32_t CAP_CHUNK_PACKETS = 256;
+constexpr int CAP_MAX_EVENTS = 128;
+constexpr int CAP_MAX_SEGMENTS = 120;
+
+// One packet: its header fields, the original CRC so the exact bytes can be
+// rebuilt, then the payload
+struct CapRecord {
+  uint32_t seq;
+  uint32_t usec;
+  uint16_t payload_len;
+  uint16_t flags; // unused, 0
+  uint16_t crc;
+  uint16_t reserved;
+  // uint8_t payload[payload_len], record padded to record_bytes
+};
+static_assert(sizeof(CapRecord) == 16, "record header is 16 bytes");
+
+enum : uint8_t {
+  CAP_EVENT_GAP = 1,     // `count` packets lost before `slot`
+  CAP_EVENT_CRC = 2,     // `count` CRC failures before `slot`
+  CAP_EVENT_RESTART = 3, // the device restarted, `slot` is its first packet
+  CAP_EVENT_LATE = 4,    // a packet for `slot` arrived after newer ones
+};
+
+struct CapEvent {
+  uint8_t type;
+  uint8_t reserved;
+  uint16_t slot;
+  uint32_t count;
+};
+
+struct CapChunkHeader {
+  char magic[8];
+  uint64_t chunk;
+  uint32_t packets;     // records present
+  uint32_t events;      // in the table (more are counted in dropped_events)
+  uint32_t lost;        // packets lost in this chunk
+  uint32_t crc_errors;
+  uint32_t dropped_events;
+  uint16_t first_slot, last_slot; // present records span
+  uint64_t first_usec, last_usec; // device clock, unwrapped, of those two
+  int64_t first_host_us, last_host_us; // host realtime when they arrived
+  uint8_t present[CAP_CHUNK_PACKETS / 8];
+  CapEvent event[CAP_MAX_EVENTS];
+};
+static_assert(sizeof(CapChunkHeader) <= CAP_PAGE, "chunk header fits a page");
+
+struct CapSegment {
+  uint64_t first_packet; // packet number where this run of seqs starts
+  uint32_t first_seq;
+  uint32_t reserved;
+};
+
+struct CapFileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t sample_rate;
+  uint32_t packet_samples; // samples per packet the records are sized for
+  uint32_t record_bytes;
+  uint64_t chunk_bytes;
+  uint64_t data_offset;
+  int64_t created_host_us;
+  // brought up to date at every checkpoint
+  uint64_t chunks;  // chunks started (the last may be partial)
+  uint64_t packets; // stored
+  uint64_t lost;
+  uint64_t crc_errors;
+  uint64_t late_dropped; // too late to store
+  uint32_t segments;     // device restarts + 1
+  uint32_t reserved;
+  CapSegment segment[CAP_MAX_SEGMENTS];
+};
+static_assert(sizeof(CapFileHeader) <= CAP_PAGE, "file header fits a page");
+
+// Host realtime clock (wall time), microseconds
+int64_t realtime_us();
+
+class CaptureWriter {
+public:
+  CaptureWriter() = default;
+  ~CaptureWriter() { close(); }
+
+  bool open(const char *path, int sample_rate = SAMPLE_RATE, size_t packet_samples = SAMPLES_PER_PACKET);
+  // `host_us` is when it arrived (realtime_us()). The CRC is kept from the
+  // two bytes after the payload, where the parser left them.
+  void add(const Packet &pkt, int64_t host_us);
+  void add_crc_error() { pending_crc_++; }
+  // Writes what's new since the last one. add() calls it every
+  // `checkpoint_packets`.
+  void checkpoint();
+  void close();
+
+  void set_checkpoint_packets(uint32_t n) { checkpoint_packets_ = n; }
+  const CapFileHeader &header() const { return file_; }
+  uint64_t bytes_written() const { return bytes_written_; } // every write, headers included
+  uint64_t oversize() const { return oversize_; }           // packets too big for a record
+  bool failed() const { return failed_; }
+
+private:
+  void store(uint64_t n, const Packet &pkt, uint64_t usec, int64_t host_us);
+  void start_chunk(uint64_t chunk);
+  void write_chunk();
+  void add_event(uint8_t type, uint32_t slot, uint32_t count);
+  void write_at(uint64_t offset, const void *data, size_t len);
+  uint64_t chunk_offset(uint64_t chunk) const { return file_.data_offset + chunk * file_.chunk_bytes; }
+
+  int fd_ = -1;
+  CapFileHeader file_;
+  uint8_t *chunk_buf_ = nullptr; // chunk_bytes, header page first
+  CapChunkHeader *chunk_ = nullptr;
+  bool chunk_open_ = false;
+  uint32_t dirty_lo_ = 0, dirty_hi_ = 0; // records not yet written
+  bool started_ = false;
+  uint64_t last_packet_ = 0;
+  uint32_t expected_seq_ = 0;
+  uint32_t last_usec_ = 0;
+  uint64_t usec_ = 0; // unwrapped
+  uint32_t pending_crc_ = 0;
+  uint32_t checkpoint_packets_ = 160; // about 10s
+  uint32_t since_checkpoint_ = 0;
+  uint64_t bytes_written_ = 0;
+  uint64_t oversize_ = 0;
+  bool failed_ = false;
+};
+
+// A packet found in a capture: points into the mapped file
+struct CapPacket {
+  uint64_t number;
+  const CapRecord *record;
+  const int16_t *pcm; // record->payload_len / 2 samples
+  uint64_t usec;      // unwrapped device clock
+  int64_t host_us;    // estimated from the chunk's arrival times
+};
+
+class CaptureReader {
+public:
+  CaptureReader() = default;
+  ~CaptureReader() { close(); }
+
+  // Maps the file. Works on a capture still being written (up to its last
+  // checkpoint).
+  bool open(const char *path);
+  void close();
+
+  const CapFileHeader &header() const { return *file_; }
+  uint64_t chunks() const { return chunks_; }
+  // One past the last packet number stored
+  uint64_t end() const { return end_; }
+  // nullptr for a chunk that's a hole
+  const CapChunkHeader *chunk(uint64_t k) const;
+
+  // Packet n, if it was stored
+  bool packet(uint64_t n, CapPacket &out) const;
+  // First packet number with this seq (or the nearest stored after it), -1
+  // if there is none
+  int64_t find_seq(uint32_t seq) const;
+  // First stored packet at or after this time on the device clock
+  // (unwrapped, as in CapPacket::usec), or -1
+  int64_t find_usec(uint64_t usec) const;
+  // ... on the host's wall clock
+  int64_t find_host_time(int64_t host_us) const;
+  // Samples from packet number `first_packet` on, silence where packets are
+  // missing. Returns `count` unless the capture ends first.
+  size_t read_pcm(uint64_t first_packet, int16_t *out, size_t count) const;
+
+  // The packet as the device sent it, PKT_OVERHEAD + payload_len bytes
+  size_t rebuild(const CapPacket &pkt, uint8_t *out) const;
+  // First stored packet numbered n or later, -1 if none
+  int64_t stored_from(uint64_t n) const;
+
+private:
+  bool present(const CapChunkHeader *h, uint32_t slot) const {
+    return (h->present[slot / 8] >> (slot % 8)) & 1;
+  }
+  const CapRecord *record(uint64_t n) const;
+  int64_t next_chunk(int64_t k) const;
+  template <class Key> int64_t last_chunk_at(Key key, int64_t target, int64_t guess) const;
+  template <class Key> int64_t find_in(int64_t chunk, Key key, int64_t target, uint32_t slot) const;
+
+  const uint8_t *map_ = nullptr;
+  size_t size_ = 0;
+  const CapFileHeader *file_ = nullptr;
+  uint64_t chunks_ = 0;
+  uint64_t end_ = 0;
+  double packet_us_ = 0; // nominal
+};
+
+} // namespace serialmic
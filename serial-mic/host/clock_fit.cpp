@@ -0,0 +1,67 @@
+#include "clock_fit.h"
+
+namespace serialmic {
+
+LineFit::LineFit(double nominal_slope, double max_error, int window, double forget, int min_points)
+    : nominal_(nominal_slope), max_error_(max_error), window_(window), forget_(forget), min_points_(min_points) {}
+
+void LineFit::reset() {
+  in_window_ = 0;
+  points_ = 0;
+  w_ = mx_ = my_ = cxx_ = cxy_ = 0;
+}
+
+double LineFit::slope() const {
+  if (points_ < min_points_ || cxx_ <= 0) {
+    return nominal_;
+  }
+  const double slope = cxy_ / cxx_;
+  const double lo = nominal_ * (1 - max_error_), hi = nominal_ * (1 + max_error_);
+  return slope < lo ? lo : slope > hi ? hi : slope;
+}
+
+void LineFit::add(double x, double y) {
+  // how late this point is against the line so far
+  const double r = points_ ? y - at(x) : y - nominal_ * x;
+  if (in_window_ == 0 || r < best_r_) {
+    best_x_ = x;
+    best_y_ = y;
+    best_r_ = r;
+  }
+  if (++in_window_ < window_) {
+    return;
+  }
+  in_window_ = 0;
+
+  // weighted running means and co-moments (West's algorithm), which keep
+  // their precision with x in the 1e12 range
+  points_++;
+  w_ = w_ * forget_ + 1.0;
+  const double dx = best_x_ - mx_;
+  mx_ += dx / w_;
+  my_ += (best_y_ - my_) / w_;
+  cxx_ = cxx_ * forget_ + dx * (best_x_ - mx_);
+  cxy_ = cxy_ * forget_ + dx * (best_y_ - my_);
+}
+
+// ====================== DeviceClock ======================
+// The device stamps each packet after i2s_read returns, a little late by
+// however long the task took to run: a short window is enough. The trip to
+// the host is late by up to tens of milliseconds, so the window there is
+// four seconds of packets, and the fit remembers about four minutes.
+// Crystals are good to tens of ppm, but the I2S clock dividers can leave the
+// sample rate a fraction of a percent out.
+DeviceClock::DeviceClock(int sample_rate)
+    : device_(1e6 / sample_rate, 0.01, 4, 1.0 - 1.0 / 256), host_(1.0, 500e-6, 64, 1.0 - 1.0 / 64) {}
+
+void DeviceClock::reset() {
+  device_.reset();
+  host_.reset();
+}
+
+void DeviceClock::add(uint64_t sample_end, double usec, double arrival_us) {
+  device_.add((double)sample_end, usec);
+  host_.add(usec, arrival_us);
+}
+
+} // namespace serialmic
@@ -0,0 +1,73 @@
+// Device clock estimation from packet timestamps
+#pragma once
+
+#include <cstdint>
+
+namespace serialmic {
+
+// Straight line y = a + b x through points that are late by a random,
+// never negative amount - packets held up by scheduling or USB. Each window
+// of points gives only its least late one to an exponentially weighted least
+// squares fit, so the line follows the lower edge of the points.
+class LineFit {
+public:
+  // `nominal_slope` is used until there are `min_points` window minima, and
+  // the fitted slope is never more than `max_error` (relative) from it
+  LineFit(double nominal_slope, double max_error, int window, double forget, int min_points = 4);
+
+  void add(double x, double y);
+  void reset();
+
+  bool started() const { return points_ > 0; }
+  double at(double x) const { return my_ + slope() * (x - mx_); }
+  double inverse(double y) const { return mx_ + (y - my_) / slope(); }
+  double slope() const;
+
+private:
+  double nominal_;
+  double max_error_;
+  int window_;
+  double forget_;
+  int min_points_;
+
+  int in_window_ = 0;
+  double best_x_ = 0, best_y_ = 0, best_r_ = 0;
+
+  int points_ = 0;
+  double w_ = 0, mx_ = 0, my_ = 0, cxx_ = 0, cxy_ = 0;
+};
+
+// Where a serial-mic is in its stream at a given host time.
+//
+// Two fits: the device's usec stamps against its sample count (its own
+// clock's view of its sample rate, free of the trip to the host), then host
+// arrival times against usec (the device clock's offset and drift from the
+// host's). Times are in microseconds.
+class DeviceClock {
+public:
+  explicit DeviceClock(int sample_rate);
+
+  // A packet whose last sample is `sample_end - 1`, stamped `usec` by the
+  // device (unwrapped) and read by the host at `arrival_us`
+  void add(uint64_t sample_end, double usec, double arrival_us);
+  void reset();
+
+  bool ready() const { return device_.started() && host_.started(); }
+  // Device sample index being captured at host time `host_us`, less the
+  // shortest trip to the host
+  double position(double host_us) const { return device_.inverse(host_.inverse(host_us)); }
+  // The device's sample rate by its own clock
+  double device_rate() const { return 1e6 / device_.slope(); }
+  // ... and by the host's
+  double host_rate() const { return 1e6 / (device_.slope() * host_.slope()); }
+  // How fast the device clock runs against the host's, parts per million
+  double drift_ppm() const { return (1.0 / host_.slope() - 1.0) * 1e6; }
+  // Host time when the device clock read zero
+  double offset_us() const { return host_.at(0); }
+
+private:
+  LineFit device_; // usec against sample index
+  LineFit host_;   // arrival against usec
+};
+
+} // namespace serialmic
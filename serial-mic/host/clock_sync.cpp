@@ -0,0 +1,176 @@
+#include "clock_sync.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "mic_frame.h"
+
+namespace serialmic {
+
+// ====================== Wire format ======================
+size_t encode_sync_request(uint8_t *out, uint32_t id) { return frame_sync_request(out, id); }
+
+size_t encode_sync_reply(uint8_t *out, uint32_t id, uint32_t arrived_usec, uint32_t sent_usec) {
+  return frame_sync_reply(out, id, arrived_usec, sent_usec);
+}
+
+static_assert(SYNC_REQUEST_BYTES == MIC_SYNC_REQ_LEN, "request length");
+static_assert(PKT_SYNC_REPLY == MIC_SYNC_BYTE && SYNC_REPLY_PAYLOAD_BYTES == MIC_SYNC_REPLY_PAYLOAD_LEN,
+              "reply framing");
+
+// ====================== ClockSync ======================
+ClockSync::ClockSync(const SyncConfig &config) : config_(config) {
+  window_.reserve(config_.window);
+  order_.reserve(config_.window);
+}
+
+void ClockSync::restart() {
+  window_.clear();
+  next_ = 0;
+  used_ = 0;
+  mid_ = offset_ = slope_ = residual_ = 0;
+  have_device_ = false;
+  for (Pending &p : pending_) {
+    p.out = false;
+  }
+}
+
+uint32_t ClockSync::request(double host_us) {
+  const uint32_t id = next_id_++;
+  pending_[id % PENDING] = {id, host_us, true};
+  return id;
+}
+
+double ClockSync::unwrap(uint32_t usec) {
+  if (!have_device_) {
+    have_device_ = true;
+    device_ref_ = usec;
+    return device_ref_;
+  }
+  // the nearest time to the last one that reads `usec`
+  const int32_t d = (int32_t)(usec - (uint32_t)(int64_t)device_ref_);
+  const double t = device_ref_ + d;
+  device_ref_ = std::max(device_ref_, t);
+  return t;
+}
+
+bool ClockSync::reply(const SyncReply &r, double host_us) {
+  Pending &p = pending_[r.id % PENDING];
+  if (!p.out || p.id != r.id) {
+    return false;
+  }
+  p.out = false;
+  SyncExchange e;
+  e.sent_us = p.sent_us;
+  e.received_us = host_us;
+  e.arrived_us = unwrap(r.arrived_usec);
+  e.replied_us = unwrap(r.sent_usec);
+  add(e);
+  return true;
+}
+
+void ClockSync::add(const SyncExchange &e) {
+  if (e.delay() < 0 || e.replied_us < e.arrived_us) {
+    return; // stamps that can't be
+  }
+  if (used_ && fabs(e.offset() - (device_us(e.host_mid()) - e.host_mid())) > e.delay() / 2 + config_.restart_us) {
+    // its trip can't explain where it is: the device's clock started again
+    const uint32_t arrived = (uint32_t)(int64_t)e.arrived_us, replied = (uint32_t)(int64_t)e.replied_us;
+    restart();
+    SyncExchange fresh = e;
+    fresh.arrived_us = unwrap(arrived);
+    fresh.replied_us = unwrap(replied);
+    add(fresh);
+    return;
+  }
+  exchanges_++;
+  if (window_.size() < (size_t)config_.window) {
+    window_.push_back(e);
+  } else {
+    window_[next_] = e;
+    next_ = (next_ + 1) % window_.size();
+  }
+  last_host_ = e.received_us;
+  fit();
+}
+
+double ClockSync::min_delay_us() const {
+  double best = INFINITY;
+  for (const SyncExchange &e : window_) {
+    best = std::min(best, e.delay());
+  }
+  return best;
+}
+
+void ClockSync::fit() {
+  const size_t n = window_.size();
+  order_.resize(n);
+  for (size_t i = 0; i < n; i++) {
+    order_[i] = i;
+  }
+  size_t take = std::max((size_t)config_.min_points, (size_t)ceil(n * config_.keep));
+  take = std::min(take, n);
+  std::partial_sort(order_.begin(), order_.begin() + take, order_.end(),
+                    [&](size_t a, size_t b) { return window_[a].delay() < window_[b].delay(); });
+  order_.resize(take);
+
+  const double max_slope = config_.max_ppm * 1e-6;
+  for (int pass = 0; pass < 2; pass++) {
+    double mx = 0, my = 0;
+    for (size_t i : order_) {
+      mx += window_[i].host_mid();
+      my += window_[i].offset();
+    }
+    mx /= order_.size();
+    my /= order_.size();
+    double sxx = 0, sxy = 0;
+    for (size_t i : order_) {
+      const double dx = window_[i].host_mid() - mx;
+      sxx += dx * dx;
+      sxy += dx * (window_[i].offset() - my);
+    }
+    // too few or too close together for a slope: the offset alone
+    double slope = order_.size() >= (size_t)config_.min_points && sxx > 0 ? sxy / sxx : 0;
+    slope = std::max(-max_slope, std::min(max_slope, slope));
+    double ss = 0;
+    for (size_t i : order_) {
+      const double r = window_[i].offset() - (my + slope * (window_[i].host_mid() - mx));
+      ss += r * r;
+    }
+    mid_ = mx;
+    offset_ = my;
+    slope_ = slope;
+    residual_ = sqrt(ss / order_.size());
+    used_ = order_.size();
+    if (pass == 1 || order_.size() <= (size_t)config_.min_points) {
+      break;
+    }
+    // once more without any far off the line: a trip slow both ways by
+    // about the same passes the delay test
+    const double limit = std::max(3 * residual_, 5.0);
+    size_t kept = 0;
+    for (size_t i : order_) {
+      const double r = window_[i].offset() - (my + slope * (window_[i].host_mid() - mx));
+      if (fabs(r) <= limit) {
+        order_[kept++] = i;
+      }
+    }
+    if (kept == order_.size() || kept < (size_t)config_.min_points) {
+      break;
+    }
+    order_.resize(kept);
+  }
+}
+
+double ClockSync::device_us(double host_us) const { return host_us + offset_ + slope_ * (host_us - mid_); }
+
+double ClockSync::host_us(double device_us) const {
+  // device = host (1 + slope) + offset - slope mid
+  return (device_us - offset_ + slope_ * mid_) / (1 + slope_);
+}
+
+// ====================== SampleClock ======================
+// As DeviceClock's device side: stamps late by task scheduling only
+SampleClock::SampleClock(int sample_rate) : fit_(1e6 / sample_rate, 0.01, 4, 1.0 - 1.0 / 256) {}
+
+} // namespace serialmic
@@ -0,0 +1,145 @@
+// Host and device clocks lined up by NTP style exchanges over the CDC link
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "clock_fit.h"
+#include "packet.h"
+
+namespace serialmic {
+
+// ====================== Wire format ======================
+// The firmware's side is in ../include/mic_frame.h: the host sends a
+// request with an id, the board replies with the id and its clock when the
+// request came in and when the reply went out.
+constexpr size_t SYNC_REQUEST_BYTES = 1 + 4 + 2; // sync + id + crc16
+
+size_t encode_sync_request(uint8_t *out, uint32_t id);
+// The board's reply (for simulations): PKT_OVERHEAD + SYNC_REPLY_PAYLOAD_BYTES
+size_t encode_sync_reply(uint8_t *out, uint32_t id, uint32_t arrived_usec, uint32_t sent_usec);
+
+struct SyncReply {
+  uint32_t id;
+  uint32_t arrived_usec; // device clock, request in
+  uint32_t sent_usec;    // device clock, reply out
+};
+
+// From what PacketParser hands on_sync_reply
+inline SyncReply read_sync_reply(const Packet &pkt) { return {pkt.seq, le_read32(pkt.payload), pkt.usec}; }
+
+// ====================== Estimation ======================
+// One exchange. Host times on its own clock, device times unwrapped, all in
+// microseconds.
+struct SyncExchange {
+  double sent_us;     // host wrote the request
+  double arrived_us;  // device stamped it in
+  double replied_us;  // device stamped the reply out
+  double received_us; // host read the reply
+
+  // Time on the wire both ways
+  double delay() const { return (received_us - sent_us) - (replied_us - arrived_us); }
+  // Device clock less host clock, if both trips took as long
+  double offset() const { return ((arrived_us - sent_us) + (replied_us - received_us)) / 2; }
+  // Host time that offset is for
+  double host_mid() const { return (sent_us + received_us) / 2; }
+};
+
+struct SyncConfig {
+  int window = 128;       // latest exchanges kept
+  double keep = 0.25;     // least delayed share of them the fit uses
+  int min_points = 4;     // before this, the least delayed one alone
+  double max_ppm = 500;   // a steeper skew is a bad fit, not a crystal
+  double restart_us = 100e3; // an offset further off than its trip allows, and this, is a new clock
+};
+
+// Device clock against host clock: offset and skew.
+//
+// An exchange's offset is wrong by half the difference between its two
+// trips, which can only be as large as its delay over the fastest one.
+// So the fit is over the least delayed quarter of the last 128 exchanges,
+// whose trips were nearly the shortest both ways, with any that still sit
+// far from the line dropped once; what is left is the difference between
+// the shortest trips in and out, which no exchange can see.
+class ClockSync {
+public:
+  explicit ClockSync(const SyncConfig &config = SyncConfig());
+
+  // Id for a request written at `host_us`
+  uint32_t request(double host_us);
+  // Its reply, read at `host_us`. False for one that matches no request
+  // still out (a stale or repeated id).
+  bool reply(const SyncReply &r, double host_us);
+  // An exchange already matched and unwrapped
+  void add(const SyncExchange &e);
+
+  // Unwraps a 32 bit device stamp (a reply's, or a packet's usec) to the
+  // nearest of the device times seen so far, and moves that on
+  double unwrap(uint32_t usec);
+  // A new device clock: the board restarted. Everything starts again.
+  void restart();
+
+  bool ready() const { return used_ >= 1; }
+  double device_us(double host_us) const;
+  double host_us(double device_us) const;
+  // Device clock rate against the host's, parts per million
+  double skew_ppm() const { return slope_ * 1e6; }
+  // Device less host clock at the last exchange
+  double offset_us() const { return device_us(last_host_) - last_host_; }
+
+  size_t exchanges() const { return exchanges_; }
+  double min_delay_us() const; // over the window
+  // How far the exchanges the fit used sit from it, rms
+  double residual_us() const { return residual_; }
+
+private:
+  void fit();
+
+  SyncConfig config_;
+  std::vector<SyncExchange> window_; // ring
+  size_t next_ = 0;
+  size_t exchanges_ = 0;
+
+  struct Pending {
+    uint32_t id;
+    double sent_us;
+    bool out;
+  };
+  static constexpr size_t PENDING = 16;
+  Pending pending_[PENDING] = {};
+  uint32_t next_id_ = 1;
+
+  bool have_device_ = false;
+  double device_ref_ = 0; // latest device time, unwrapped
+
+  // device = host + offset_ + slope_ (host - mid_)
+  size_t used_ = 0;
+  double mid_ = 0, offset_ = 0, slope_ = 0, residual_ = 0;
+  double last_host_ = 0;
+  std::vector<size_t> order_; // scratch for fit()
+};
+
+// Where each sample of a stream was on the device clock: the packets' usec
+// stamps, late by however long the task took to be scheduled, against the
+// sample count, as DeviceClock has them. With ClockSync, the host time of any
+// sample.
+class SampleClock {
+public:
+  explicit SampleClock(int sample_rate);
+
+  // A packet whose last sample is `sample_end - 1`, stamped at `device_us`
+  // (ClockSync::unwrap of its usec)
+  void add(uint64_t sample_end, double device_us) { fit_.add((double)sample_end, device_us); }
+  void reset() { fit_.reset(); }
+
+  bool ready() const { return fit_.started(); }
+  // When sample `sample` (fractional) was stamped, on the device clock
+  double device_us(double sample) const { return fit_.at(sample + 1); }
+  double host_us(double sample, const ClockSync &sync) const { return sync.host_us(device_us(sample)); }
+
+private:
+  LineFit fit_;
+};
+
+} // namespace serialmic
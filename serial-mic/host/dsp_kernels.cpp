@@ -0,0 +1,218 @@
+#include "dsp_kernels.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace serialmic {
+
+// ====================== Vectors ======================
+// GCC and Clang vector extensions: SSE or NEON on the host, SIMD128 when
+// the WebAssembly build passes -msimd128
+namespace {
+typedef float f32x4 __attribute__((vector_size(16)));
+typedef int16_t i16x8 __attribute__((vector_size(16)));
+typedef int16_t i16x4 __attribute__((vector_size(8)));
+typedef int32_t i32x4 __attribute__((vector_size(16)));
+
+// unaligned loads and stores
+template <class V, class T> inline V load(const T *p) {
+  V v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+template <class V, class T> inline void store(T *p, V v) { memcpy(p, &v, sizeof(v)); }
+
+template <class V, class T> inline V splat(T x) {
+  V v;
+  for (size_t i = 0; i < sizeof(V) / sizeof(T); i++) {
+    v[i] = x;
+  }
+  return v;
+}
+
+// through i32x4: straight from i16x4, GCC does each lane on its own
+inline f32x4 to_float(const int16_t *p) {
+  return __builtin_convertvector(__builtin_convertvector(load<i16x4>(p), i32x4), f32x4);
+}
+
+inline float sum(f32x4 v) { return (v[0] + v[1]) + (v[2] + v[3]); }
+} // namespace
+
+// ====================== Levels ======================
+Levels measure_levels(const int16_t *pcm, size_t n) {
+  Levels out;
+  if (n == 0) {
+    return out;
+  }
+  f32x4 acc0 = splat<f32x4>(0.0f), acc1 = acc0;
+  i16x8 lo = splat<i16x8>((int16_t)32767), hi = splat<i16x8>((int16_t)-32768);
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    const i16x8 v = load<i16x8>(pcm + i);
+    const i16x8 below = v < lo, above = v > hi;
+    lo = (v & below) | (lo & ~below);
+    hi = (v & above) | (hi & ~above);
+    const f32x4 a = to_float(pcm + i), b = to_float(pcm + i + 4);
+    acc0 += a * a;
+    acc1 += b * b;
+  }
+  double sum_sq = sum(acc0) + sum(acc1);
+  int min_v = 32767, max_v = -32768;
+  for (int k = 0; k < 8 && n >= 8; k++) {
+    min_v = std::min(min_v, (int)lo[k]);
+    max_v = std::max(max_v, (int)hi[k]);
+  }
+  for (; i < n; i++) {
+    sum_sq += (double)pcm[i] * pcm[i];
+    min_v = std::min(min_v, (int)pcm[i]);
+    max_v = std::max(max_v, (int)pcm[i]);
+  }
+  const int peak = std::max(-min_v, max_v);
+  out.rms_db = (float)(10 * log10(sum_sq / n / (32768.0 * 32768.0) + 1e-24));
+  out.peak_db = (float)(20 * log10(peak / 32768.0 + 1e-12));
+  return out;
+}
+
+// Last `n` of `count` samples as floats in [-1, 1), times `window` if given,
+// with zeros before them if there are fewer
+static void take_last(const int16_t *pcm, size_t count, size_t n, const float *window, float *out) {
+  const size_t take = std::min(count, n), pad = n - take;
+  std::fill(out, out + pad, 0.0f);
+  const int16_t *src = pcm + count - take;
+  float *dst = out + pad;
+  const f32x4 k = splat<f32x4>(1.0f / 32768);
+  size_t i = 0;
+  if (window) {
+    const float *w = window + pad;
+    for (; i + 4 <= take; i += 4) {
+      store(dst + i, to_float(src + i) * k * load<f32x4>(w + i));
+    }
+    for (; i < take; i++) {
+      dst[i] = src[i] * (1.0f / 32768) * w[i];
+    }
+  } else {
+    for (; i + 4 <= take; i += 4) {
+      store(dst + i, to_float(src + i) * k);
+    }
+    for (; i < take; i++) {
+      dst[i] = src[i] * (1.0f / 32768);
+    }
+  }
+}
+
+// ====================== Spectrum ======================
+SpectrumDb::SpectrumDb(size_t n)
+    : fft_(n), window_(hann_window(n)), buf_(n), re_(n / 2 + 1), im_(n / 2 + 1) {
+  double sum = 0;
+  for (float w : window_) {
+    sum += w;
+  }
+  // one sided amplitude over the window's coherent gain
+  scale_ = (float)(2 / sum);
+}
+
+void SpectrumDb::compute(const int16_t *pcm, size_t count, float *db) {
+  const size_t n = fft_.size(), bins = n / 2;
+  take_last(pcm, count, n, window_.data(), buf_.data());
+  fft_.transform(buf_.data(), re_.data(), im_.data());
+  const f32x4 s2 = splat<f32x4>(scale_ * scale_);
+  size_t k = 0;
+  for (; k + 4 <= bins; k += 4) {
+    const f32x4 r = load<f32x4>(re_.data() + k), m = load<f32x4>(im_.data() + k);
+    store(db + k, (r * r + m * m) * s2);
+  }
+  for (; k < bins; k++) {
+    db[k] = (re_[k] * re_[k] + im_[k] * im_[k]) * scale_ * scale_;
+  }
+  for (k = 0; k < bins; k++) {
+    db[k] = 10 * log10f(db[k] + 1e-24f);
+  }
+}
+
+// ====================== YIN ======================
+Yin::Yin(size_t frame, double rate, double min_hz, double max_hz, float threshold)
+    : fft_(frame), rate_(rate), threshold_(threshold), x_(frame), a_(frame, 0.0f), ar_(frame / 2 + 1),
+      ai_(frame / 2 + 1), br_(frame / 2 + 1), bi_(frame / 2 + 1), sr_(frame / 2 + 1), si_(frame / 2 + 1),
+      corr_(frame), d_(frame / 2 + 1), energy_(frame + 1) {
+  // the difference at lag t sums over the first half of the frame against
+  // the samples t on, and the parabola needs the lag after the last
+  min_lag_ = std::max<size_t>(2, (size_t)floor(rate / max_hz));
+  max_lag_ = std::min<size_t>(frame / 2 - 1, (size_t)ceil(rate / min_hz));
+}
+
+PitchEstimate Yin::detect(const int16_t *pcm, size_t count) {
+  PitchEstimate out;
+  const size_t n = fft_.size(), w = n / 2, bins = n / 2 + 1;
+  if (count < n || min_lag_ >= max_lag_) {
+    return out;
+  }
+  take_last(pcm, count, n, nullptr, x_.data());
+  energy_[0] = 0;
+  for (size_t i = 0; i < n; i++) {
+    energy_[i + 1] = energy_[i] + (double)x_[i] * x_[i];
+  }
+  const double e0 = energy_[w];
+  if (e0 <= 0) {
+    return out;
+  }
+
+  // r(t) = sum over j < w of x[j] x[j + t]: the correlation of the first
+  // half, zero padded, with the whole frame. No lag wraps round, as
+  // w + max_lag < n.
+  std::copy(x_.begin(), x_.begin() + w, a_.begin());
+  fft_.transform(a_.data(), ar_.data(), ai_.data());
+  fft_.transform(x_.data(), br_.data(), bi_.data());
+  size_t k = 0;
+  for (; k + 4 <= bins; k += 4) {
+    const f32x4 ar = load<f32x4>(ar_.data() + k), ai = load<f32x4>(ai_.data() + k);
+    const f32x4 br = load<f32x4>(br_.data() + k), bi = load<f32x4>(bi_.data() + k);
+    // conj(A) B
+    store(sr_.data() + k, ar * br + ai * bi);
+    store(si_.data() + k, ar * bi - ai * br);
+  }
+  for (; k < bins; k++) {
+    sr_[k] = ar_[k] * br_[k] + ai_[k] * bi_[k];
+    si_[k] = ar_[k] * bi_[k] - ai_[k] * br_[k];
+  }
+  fft_.inverse(sr_.data(), si_.data(), corr_.data(), ar_.data(), ai_.data());
+
+  // d(t) = sum (x[j] - x[j + t])^2 = e(0..w) + e(t..t+w) - 2 r(t), then
+  // normalized by its running mean
+  d_[0] = 1;
+  double running = 0;
+  const size_t last = max_lag_ + 1;
+  for (size_t t = 1; t <= last; t++) {
+    const double d = std::max(0.0, e0 + (energy_[t + w] - energy_[t]) - 2.0 * corr_[t]);
+    running += d;
+    d_[t] = running > 0 ? (float)(d * t / running) : 1.0f;
+  }
+
+  size_t best = 0;
+  for (size_t t = min_lag_; t <= max_lag_; t++) {
+    if (d_[t] < threshold_) {
+      while (t + 1 <= max_lag_ && d_[t + 1] < d_[t]) {
+        t++;
+      }
+      best = t;
+      break;
+    }
+  }
+  if (!best) {
+    // unvoiced: how close the best dip came
+    float lowest = 1;
+    for (size_t t = min_lag_; t <= max_lag_; t++) {
+      lowest = std::min(lowest, d_[t]);
+    }
+    out.confidence = std::max(0.0f, 1 - lowest);
+    return out;
+  }
+  const float y1 = d_[best - 1], y2 = d_[best], y3 = d_[best + 1];
+  const float den = y1 - 2 * y2 + y3;
+  const float shift = den > 0 ? std::max(-0.5f, std::min(0.5f, 0.5f * (y1 - y3) / den)) : 0.0f;
+  out.hz = (float)(rate_ / (best + shift));
+  out.confidence = std::max(0.0f, std::min(1.0f, 1 - y2));
+  return out;
+}
+
+} // namespace serialmic
@@ -0,0 +1,68 @@
+// Per-packet DSP kernels shared by the host tools and the frontend's
+// WebAssembly module (wasm_api.cpp)
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "fft.h"
+
+namespace serialmic {
+
+struct Levels {
+  float rms_db = -240;  // dBFS
+  float peak_db = -240; // dBFS of the largest sample
+};
+
+// rms and peak of `n` samples
+Levels measure_levels(const int16_t *pcm, size_t n);
+
+// Hann windowed spectrum in dBFS, scaled so a full scale sine reads 0dB in
+// its bin, as the frontend's spectrogram and bar spectrum have it
+class SpectrumDb {
+public:
+  // `n` a power of two, 4 or more
+  explicit SpectrumDb(size_t n);
+
+  size_t size() const { return fft_.size(); }
+  size_t bins() const { return fft_.size() / 2; }
+  // The last size() of `count` samples (zeros before them if there are
+  // fewer) into `db`, bins() values from DC up to just under Nyquist
+  void compute(const int16_t *pcm, size_t count, float *db);
+
+private:
+  RealFft fft_;
+  std::vector<float> window_, buf_, re_, im_;
+  float scale_;
+};
+
+struct PitchEstimate {
+  float hz = 0; // 0: none found
+  float confidence = 0;
+};
+
+// YIN (de Cheveigne and Kawahara 2002): the cumulative mean normalized
+// difference function, the first dip under `threshold` and a parabola
+// through it. The difference function's cross term is taken with real
+// FFTs, so a frame costs three transforms of its length rather than a sum
+// per lag. Periods up to half the frame can be found.
+class Yin {
+public:
+  // `frame` a power of two, 64 or more
+  Yin(size_t frame, double rate, double min_hz, double max_hz, float threshold = 0.15f);
+
+  size_t frame() const { return fft_.size(); }
+  // The last frame() of `count` samples; fewer than that finds nothing
+  PitchEstimate detect(const int16_t *pcm, size_t count);
+
+private:
+  RealFft fft_;
+  double rate_;
+  float threshold_;
+  size_t min_lag_, max_lag_;
+  std::vector<float> x_, a_, ar_, ai_, br_, bi_, sr_, si_, corr_, d_;
+  std::vector<double> energy_; // running sums of x^2
+};
+
+} // namespace serialmic
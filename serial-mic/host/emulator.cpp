@@ -0,0 +1,231 @@
+#include "emulator.h"
+
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+
+#include "mic_frame.h"
+
+namespace serialmic {
+
+namespace {
+
+// xorshift64*, plenty for noise and faults
+inline uint64_t next_random(uint64_t &s) {
+  s ^= s >> 12;
+  s ^= s << 25;
+  s ^= s >> 27;
+  return s * 0x2545F4914F6CDD1DULL;
+}
+
+inline double to_uniform(uint64_t r) { return (double)(r >> 11) * (1.0 / 9007199254740992.0); }
+
+inline uint64_t seed64(uint32_t seed) {
+  uint64_t s = 0x9E3779B97F4A7C15ULL * (seed + 1);
+  return s ? s : 1;
+}
+
+} // namespace
+
+// ====================== FramedSource ======================
+
+FramedSource::FramedSource(const AudioSource &audio, const DeviceConfig &config, uint32_t seed)
+    : audio_(audio), config_(config), rng_(seed * 2654435761u + 1) {
+  if (config_.packet_samples == 0 || config_.packet_samples > MAX_PAYLOAD_BYTES / 2) {
+    config_.packet_samples = SAMPLES_PER_PACKET;
+  }
+  period_us_ = config_.packet_samples * 1e6 / audio.sample_rate() / (1 + config_.rate_ppm * 1e-6);
+  position_ = (uint64_t)(config_.start_seconds * audio.sample_rate());
+  if (audio.samples() > 0) {
+    position_ %= audio.samples();
+  }
+  // the first buffer finishes one period after the board starts reading
+  device_us_ = config_.boot_us - period_us_;
+}
+
+double FramedSource::host_seconds(double device_us) const {
+  // the board's clock runs clock_ppm fast against the host's
+  return boot_host_ + (device_us - (config_.boot_us - period_us_)) * 1e-6 / (1 + config_.clock_ppm * 1e-6);
+}
+
+bool FramedSource::read_block() {
+  const size_t n = config_.packet_samples;
+  const uint64_t total = audio_.samples();
+  if (total == 0 || (!config_.loop && position_ >= total)) {
+    return false;
+  }
+  size_t done = 0;
+  while (done < n) {
+    if (position_ >= total) {
+      if (!config_.loop) {
+        memset(pcm_ + done, 0, (n - done) * 2);
+        break;
+      }
+      position_ = 0;
+    }
+    const size_t want = (size_t)(total - position_ < n - done ? total - position_ : n - done);
+    audio_.read(position_, pcm_ + done, want);
+    position_ += want;
+    done += want;
+  }
+  return true;
+}
+
+bool FramedSource::next(WirePacket &out) {
+  device_us_ += period_us_;
+  if (config_.restart_seconds > 0 && host_seconds(device_us_) - boot_host_ >= config_.restart_seconds) {
+    // reset: esp_timer and seq start again, and the audio goes on without
+    // us while it boots
+    boot_host_ = host_seconds(device_us_) + config_.boot_us * 1e-6;
+    position_ += (uint64_t)(config_.boot_us * 1e-6 * audio_.sample_rate());
+    if (audio_.samples() > 0 && config_.loop) {
+      position_ %= audio_.samples();
+    }
+    device_us_ = config_.boot_us;
+    seq_ = 0;
+    dc_est_ = 0;
+  }
+  if (!read_block()) {
+    return false;
+  }
+  const int n = (int)config_.packet_samples;
+  if (config_.dc_block) {
+    dc_block_and_copy(&dc_est_, pcm_, n);
+  }
+  // the stamp is taken once the task gets to run after i2s_read returns
+  rng_ = rng_ * 1664525u + 1013904223u;
+  const double late = -config_.stamp_jitter_us * std::log(1.0 - (rng_ >> 8) * (1.0 / 16777216.0));
+  const uint32_t usec = (uint32_t)(uint64_t)(device_us_ + late);
+  out.seq = seq_;
+  out.len = encode_packet(out.bytes, seq_++, usec, pcm_, (size_t)n, config_.crc);
+  out.due = host_seconds(device_us_ + late);
+  return true;
+}
+
+// ====================== RecordedSource ======================
+
+RecordedSource::RecordedSource(const CaptureReader &capture, bool loop) : capture_(capture), loop_(loop) {}
+
+bool RecordedSource::advance(CapPacket &out) {
+  for (int pass = 0; pass < 2; pass++) {
+    const int64_t n = capture_.stored_from((uint64_t)next_);
+    if (n >= 0 && capture_.packet((uint64_t)n, out)) {
+      next_ = n + 1;
+      return true;
+    }
+    if (!loop_) {
+      return false;
+    }
+    // round again, a moment after the last packet
+    next_ = 0;
+    base_ = last_ + 0.064;
+    have_last_ = false;
+  }
+  return false;
+}
+
+bool RecordedSource::next(WirePacket &out) {
+  CapPacket p;
+  if (!advance(p)) {
+    return false;
+  }
+  double due;
+  if (!have_last_) {
+    due = base_;
+  } else if (p.usec >= last_usec_ && p.usec - last_usec_ < 10000000) {
+    due = last_ + (p.usec - last_usec_) * 1e-6;
+  } else {
+    // a restart or a long gap: don't sit out hours of unplugged board
+    due = last_ + 1.0;
+  }
+  have_last_ = true;
+  last_ = due;
+  last_usec_ = p.usec;
+  out.due = due;
+  out.seq = p.record->seq;
+  out.len = capture_.rebuild(p, out.bytes);
+  return true;
+}
+
+// ====================== FaultInjector ======================
+
+FaultInjector::FaultInjector(PacketSource &source, const FaultConfig &config, uint32_t seed)
+    : source_(source), config_(config), rng_(seed64(seed)), held_(new WirePacket) {
+  bits_to_error_ = config_.bit_error_rate > 0 ? -std::log(1.0 - uniform()) / config_.bit_error_rate : 0;
+}
+
+double FaultInjector::uniform() { return to_uniform(next_random(rng_)); }
+
+bool FaultInjector::pull(WirePacket &out) {
+  for (;;) {
+    if (!source_.next(out)) {
+      return false;
+    }
+    if (config_.drop > 0 && uniform() < config_.drop) {
+      stats_.dropped++;
+      continue;
+    }
+    return true;
+  }
+}
+
+bool FaultInjector::next(WirePacket &out) {
+  if (have_held_ && release_) {
+    // the one held back goes straight after the packet that overtook it
+    memcpy(&out, held_.get(), offsetof(WirePacket, bytes) + held_->len);
+    have_held_ = false;
+    release_ = false;
+    out.due = last_due_;
+  } else {
+    if (!pull(out)) {
+      if (!have_held_) {
+        return false;
+      }
+      release_ = true;
+      return next(out);
+    }
+    if (!have_held_ && config_.reorder > 0 && uniform() < config_.reorder) {
+      memcpy(held_.get(), &out, offsetof(WirePacket, bytes) + out.len);
+      have_held_ = true;
+      stats_.reordered++;
+      if (!pull(out)) {
+        release_ = true;
+        return next(out);
+      }
+    }
+    release_ = have_held_;
+    // USB holds bytes up but never swaps them
+    double due = out.due;
+    if (config_.jitter_ms > 0) {
+      due += uniform() * config_.jitter_ms * 1e-3;
+    }
+    out.due = due > last_due_ ? due : last_due_;
+  }
+  last_due_ = out.due;
+  corrupt(out);
+  stats_.packets++;
+  return true;
+}
+
+void FaultInjector::corrupt(WirePacket &pkt) {
+  if (config_.bit_error_rate <= 0) {
+    return;
+  }
+  const double bits = pkt.len * 8.0;
+  double at = bits_to_error_;
+  bool hit = false;
+  while (at < bits) {
+    const size_t bit = (size_t)at;
+    pkt.bytes[bit / 8] ^= (uint8_t)(1u << (bit % 8));
+    stats_.bit_errors++;
+    hit = true;
+    // errors arrive independently, so the distance to the next is geometric
+    at += 1 + std::floor(-std::log(1.0 - uniform()) / config_.bit_error_rate);
+  }
+  bits_to_error_ = at - bits;
+  if (hit) {
+    stats_.corrupted++;
+  }
+}
+
+} // namespace serialmic
@@ -0,0 +1,133 @@
+// Emulated serial-mics: recordings turned back into packet streams
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include "audio_source.h"
+#include "capture_file.h"
+#include "packet.h"
+
+namespace serialmic {
+
+// One packet on its way to the wire, and when it's due there: seconds after
+// the device started, on the host's clock
+struct WirePacket {
+  double due;
+  uint32_t seq;
+  size_t len;
+  uint8_t bytes[MAX_PKT_BYTES];
+};
+
+// Something that makes a device's packets in order
+class PacketSource {
+public:
+  virtual ~PacketSource() = default;
+  // The next packet, false once there are no more
+  virtual bool next(WirePacket &out) = 0;
+};
+
+struct DeviceConfig {
+  size_t packet_samples = SAMPLES_PER_PACKET;
+  bool crc = true;       // false is firmware built with USE_CRC 0
+  bool dc_block = false; // run the firmware's DC blocker over the audio
+  bool loop = true;      // start the recording again at its end
+  double start_seconds = 0; // where in the recording to start
+  double clock_ppm = 0;  // the board's crystal against the host's clock
+  double rate_ppm = 0;   // its I2S sample rate against its own timer
+  double boot_us = 1.5e6; // esp_timer when the first packet is stamped
+  double stamp_jitter_us = 40; // task scheduling between i2s_read and the stamp
+  double restart_seconds = 0;  // the board resets this often (0 never)
+};
+
+// Audio framed the way i2s_reader_task does it: seq from 0, usec from
+// esp_timer once each buffer is read (so one packet period on, give or take
+// the task being scheduled), the firmware's DC blocker bit for bit, CRC or 0.
+// Packets are due one period apart on the board's clock, which runs at its
+// own rate against the host's.
+class FramedSource : public PacketSource {
+public:
+  FramedSource(const AudioSource &audio, const DeviceConfig &config, uint32_t seed);
+
+  bool next(WirePacket &out) override;
+
+private:
+  bool read_block();
+  double host_seconds(double device_us) const;
+
+  const AudioSource &audio_;
+  DeviceConfig config_;
+  uint32_t rng_;
+  uint64_t position_ = 0; // next sample in the recording
+  uint32_t seq_ = 0;
+  double boot_host_ = 0;   // host seconds when this run of the board began
+  double device_us_ = 0;   // esp_timer at the last buffer read
+  double period_us_;       // one buffer by the board's timer
+  int32_t dc_est_ = 0;
+  int16_t pcm_[MAX_PAYLOAD_BYTES / 2];
+};
+
+// A capture played back as it was recorded: every stored packet byte for
+// byte, seq, usec and CRC as they came, due when they were stamped on the
+// device's clock (restarts and gaps in the recording are kept). Packets
+// that were lost stay lost.
+class RecordedSource : public PacketSource {
+public:
+  RecordedSource(const CaptureReader &capture, bool loop);
+
+  bool next(WirePacket &out) override;
+
+private:
+  bool advance(CapPacket &out);
+
+  const CaptureReader &capture_;
+  bool loop_;
+  int64_t next_ = 0;      // packet number
+  double base_ = 0;       // seconds added to this pass's times
+  double last_ = 0;       // due time of the last packet
+  bool have_last_ = false;
+  uint64_t last_usec_ = 0;
+};
+
+// What goes wrong between the board and the host
+struct FaultConfig {
+  double bit_error_rate = 0; // per bit on the wire
+  double drop = 0;           // chance a packet never arrives
+  double reorder = 0;        // chance a packet is held back behind the next
+  double jitter_ms = 0;      // extra delay, up to this, bytes stay in order
+};
+
+struct FaultStats {
+  uint64_t packets = 0;  // handed on
+  uint64_t dropped = 0;
+  uint64_t reordered = 0;
+  uint64_t bit_errors = 0;
+  uint64_t corrupted = 0; // packets with at least one
+};
+
+// Applies faults to a device's packets, deterministically from the seed
+class FaultInjector {
+public:
+  FaultInjector(PacketSource &source, const FaultConfig &config, uint32_t seed);
+
+  bool next(WirePacket &out);
+  const FaultStats &stats() const { return stats_; }
+
+private:
+  bool pull(WirePacket &out);
+  void corrupt(WirePacket &pkt);
+  double uniform();
+
+  PacketSource &source_;
+  FaultConfig config_;
+  uint64_t rng_;
+  double bits_to_error_; // bits until the next flipped one
+  std::unique_ptr<WirePacket> held_; // the packet being reordered
+  bool have_held_ = false;
+  bool release_ = false; // the held packet goes next
+  double last_due_ = 0;
+  FaultStats stats_;
+};
+
+} // namespace serialmic
@@ -0,0 +1,117 @@
+#include "feature_file.h"
+
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace serialmic {
+
+static double hz_to_mel(double hz) { return 2595 * log10(1 + hz / 700); }
+static double mel_to_hz(double mel) { return 700 * (pow(10, mel / 2595) - 1); }
+
+double mel_band_centre(int b, int bands, double low_hz, double high_hz) {
+  const double lo = hz_to_mel(low_hz), hi = hz_to_mel(high_hz);
+  return mel_to_hz(lo + (hi - lo) * (b + 1) / (bands + 1));
+}
+
+// ====================== Writer ======================
+bool FeatureWriter::create(const char *path, const FeatureHeader &header) {
+  close();
+  fd_ = ::open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd_ < 0) {
+    fprintf(stderr, "can't create %s: %s\n", path, strerror(errno));
+    return false;
+  }
+  header_ = header;
+  uint8_t page[FEAT_HEADER_BYTES] = {0};
+  memcpy(page, &header_, sizeof(header_));
+  const off_t size = (off_t)(header_.data_offset + header_.frames * header_.columns * sizeof(float));
+  if (pwrite(fd_, page, sizeof(page), 0) != (ssize_t)sizeof(page) || ftruncate(fd_, size) != 0) {
+    fprintf(stderr, "can't write %s: %s\n", path, strerror(errno));
+    close();
+    return false;
+  }
+  return true;
+}
+
+bool FeatureWriter::write_rows(uint64_t first_frame, const float *rows, size_t frames) {
+  const uint8_t *p = (const uint8_t *)rows;
+  size_t len = frames * header_.columns * sizeof(float);
+  off_t at = (off_t)(header_.data_offset + first_frame * header_.columns * sizeof(float));
+  while (len > 0) {
+    ssize_t n = pwrite(fd_, p, len, at);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      perror("feature write");
+      return false;
+    }
+    p += n;
+    len -= (size_t)n;
+    at += n;
+  }
+  return true;
+}
+
+void FeatureWriter::close() {
+  if (fd_ >= 0) {
+    ::close(fd_);
+    fd_ = -1;
+  }
+}
+
+// ====================== Reader ======================
+bool FeatureReader::open(const char *path) {
+  close();
+  int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    fprintf(stderr, "can't open %s: %s\n", path, strerror(errno));
+    return false;
+  }
+  struct stat st;
+  fstat(fd, &st);
+  void *p = st.st_size >= (off_t)FEAT_HEADER_BYTES
+                ? mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0)
+                : MAP_FAILED;
+  ::close(fd);
+  if (p == MAP_FAILED) {
+    fprintf(stderr, "%s: not a feature file\n", path);
+    return false;
+  }
+  map_ = (const uint8_t *)p;
+  size_ = (size_t)st.st_size;
+  header_ = (const FeatureHeader *)map_;
+  if (memcmp(header_->magic, FEAT_MAGIC, sizeof(FEAT_MAGIC)) || header_->version != FEAT_VERSION ||
+      header_->columns == 0 || header_->sample_rate == 0 || header_->hop == 0 ||
+      header_->data_offset + header_->frames * header_->columns * sizeof(float) > size_) {
+    fprintf(stderr, "%s: not a feature file (or a newer version)\n", path);
+    close();
+    return false;
+  }
+  return true;
+}
+
+void FeatureReader::close() {
+  if (map_) {
+    munmap((void *)map_, size_);
+  }
+  map_ = nullptr;
+  header_ = nullptr;
+  size_ = 0;
+}
+
+uint64_t FeatureReader::frame_at(double seconds) const {
+  if (seconds <= 0) {
+    return 0;
+  }
+  const uint64_t f = (uint64_t)ceil(seconds * header_->sample_rate / header_->hop);
+  return f < header_->frames ? f : header_->frames;
+}
+
+} // namespace serialmic
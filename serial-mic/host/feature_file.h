@@ -0,0 +1,77 @@
+// Feature matrices from serialmic_spectro (.smf)
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace serialmic {
+
+// One row of float32 per STFT frame: the log-mel bands (dB re full scale),
+// then the level of the hop the frame starts with (RMS and peak, dBFS).
+// Rows are in time order after a one page header, so frame f is at
+// data_offset + f * columns * 4 - a reader maps the file and indexes it.
+// Little-endian.
+constexpr char FEAT_MAGIC[8] = {'S', 'M', 'F', 'E', 'A', 'T', '0', '1'};
+constexpr uint32_t FEAT_VERSION = 1;
+constexpr size_t FEAT_HEADER_BYTES = 4096;
+// columns after the bands
+enum { FEAT_RMS = 0, FEAT_PEAK = 1, FEAT_LEVELS = 2 };
+
+struct FeatureHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t sample_rate;
+  uint32_t fft_size;
+  uint32_t hop; // samples between frames
+  uint32_t bands;
+  uint32_t columns; // bands + FEAT_LEVELS
+  uint64_t frames;
+  uint64_t data_offset;
+  float mel_low_hz, mel_high_hz; // the band edges (HTK mel scale)
+  int64_t start_host_us;         // wall clock of the first sample, 0 if unknown
+};
+static_assert(sizeof(FeatureHeader) <= FEAT_HEADER_BYTES, "header fits its page");
+
+// Centre frequency of mel band `b` of `bands` between `low` and `high` Hz
+double mel_band_centre(int b, int bands, double low_hz, double high_hz);
+
+// Creates the file at full size, then rows can go in from any thread
+class FeatureWriter {
+public:
+  FeatureWriter() = default;
+  ~FeatureWriter() { close(); }
+
+  bool create(const char *path, const FeatureHeader &header);
+  bool write_rows(uint64_t first_frame, const float *rows, size_t frames);
+  void close();
+
+private:
+  int fd_ = -1;
+  FeatureHeader header_;
+};
+
+class FeatureReader {
+public:
+  FeatureReader() = default;
+  ~FeatureReader() { close(); }
+
+  bool open(const char *path);
+  void close();
+
+  const FeatureHeader &header() const { return *header_; }
+  uint64_t frames() const { return header_->frames; }
+  uint32_t columns() const { return header_->columns; }
+  const float *row(uint64_t frame) const {
+    return (const float *)(map_ + header_->data_offset) + frame * header_->columns;
+  }
+  // Frame starting nearest after `seconds` into the recording
+  uint64_t frame_at(double seconds) const;
+  double seconds(uint64_t frame) const { return (double)frame * header_->hop / header_->sample_rate; }
+
+private:
+  const uint8_t *map_ = nullptr;
+  size_t size_ = 0;
+  const FeatureHeader *header_ = nullptr;
+};
+
+} // namespace serialmic
@@ -0,0 +1,160 @@
+#include "fft.h"
+
+#include <cmath>
+#include <cstdlib>
+
+namespace serialmic {
+
+RealFft::RealFft(size_t n) : n_(n), half_(n / 2) {
+  if (n < 4 || (n & (n - 1))) {
+    abort();
+  }
+  unsigned bits = 0;
+  while ((1u << bits) < half_) {
+    bits++;
+  }
+  bitrev_.resize(half_);
+  for (unsigned i = 0; i < half_; i++) {
+    unsigned r = 0;
+    for (unsigned b = 0; b < bits; b++) {
+      r |= ((i >> b) & 1) << (bits - 1 - b);
+    }
+    bitrev_[i] = r;
+  }
+  // each stage's twiddles in a row, so the butterflies read them in order:
+  // the stage with half length h starts at h - 4
+  for (size_t h = 4; h < half_; h <<= 1) {
+    for (size_t j = 0; j < h; j++) {
+      const double a = -M_PI * j / h;
+      tw_re_.push_back((float)cos(a));
+      tw_im_.push_back((float)sin(a));
+    }
+  }
+  split_re_.resize(half_);
+  split_im_.resize(half_);
+  for (size_t k = 0; k < half_; k++) {
+    const double a = -2 * M_PI * k / n_;
+    split_re_[k] = (float)cos(a);
+    split_im_[k] = (float)sin(a);
+  }
+}
+
+void RealFft::butterflies(float *re, float *im) const {
+  const size_t m = half_;
+  // the first two stages have trivial twiddles: a radix 4 butterfly
+  for (size_t i = 0; i + 3 < m; i += 4) {
+    const float ar = re[i] + re[i + 1], ai = im[i] + im[i + 1];
+    const float br = re[i] - re[i + 1], bi = im[i] - im[i + 1];
+    const float cr = re[i + 2] + re[i + 3], ci = im[i + 2] + im[i + 3];
+    const float dr = re[i + 2] - re[i + 3], di = im[i + 2] - im[i + 3];
+    re[i] = ar + cr;
+    im[i] = ai + ci;
+    re[i + 2] = ar - cr;
+    im[i + 2] = ai - ci;
+    // d times -i
+    re[i + 1] = br + di;
+    im[i + 1] = bi - dr;
+    re[i + 3] = br - di;
+    im[i + 3] = bi + dr;
+  }
+  if (m == 2) {
+    const float r0 = re[0], i0 = im[0];
+    re[0] = r0 + re[1];
+    im[0] = i0 + im[1];
+    re[1] = r0 - re[1];
+    im[1] = i0 - im[1];
+  }
+  for (size_t h = 4; h < m; h <<= 1) {
+    const float *__restrict twr = tw_re_.data() + h - 4;
+    const float *__restrict twi = tw_im_.data() + h - 4;
+    for (size_t i = 0; i < m; i += 2 * h) {
+      float *__restrict ur = re + i, *__restrict ui = im + i;
+      float *__restrict vr = re + i + h, *__restrict vi = im + i + h;
+      for (size_t j = 0; j < h; j++) {
+        const float wr = twr[j], wi = twi[j];
+        const float tr = vr[j] * wr - vi[j] * wi;
+        const float ti = vr[j] * wi + vi[j] * wr;
+        vr[j] = ur[j] - tr;
+        vi[j] = ui[j] - ti;
+        ur[j] += tr;
+        ui[j] += ti;
+      }
+    }
+  }
+}
+
+void RealFft::transform(const float *in, float *re, float *im) const {
+  const size_t m = half_;
+  // z[k] = x[2k] + i x[2k+1], in bit reversed order
+  for (size_t k = 0; k < m; k++) {
+    const unsigned r = bitrev_[k];
+    re[r] = in[2 * k];
+    im[r] = in[2 * k + 1];
+  }
+  butterflies(re, im);
+  // split: X[k] = (Z[k] + conj Z[m-k]) / 2 - i W^k (Z[k] - conj Z[m-k]) / 2
+  const float z0r = re[0], z0i = im[0];
+  for (size_t k = 1, j = m - 1; k <= j; k++, j--) {
+    const float ar = re[k], ai = im[k], br = re[j], bi = im[j];
+    // even and odd parts of bin k
+    const float er = 0.5f * (ar + br), ei = 0.5f * (ai - bi);
+    const float or_ = 0.5f * (ai + bi), oi = -0.5f * (ar - br);
+    const float wr = split_re_[k], wi = split_im_[k];
+    const float tr = or_ * wr - oi * wi, ti = or_ * wi + oi * wr;
+    // bin m-k uses the conjugate parts and W^(m-k) = -conj W^k
+    const float er2 = er, ei2 = -ei;
+    const float or2 = or_, oi2 = -oi;
+    const float wr2 = -wr, wi2 = wi;
+    const float tr2 = or2 * wr2 - oi2 * wi2, ti2 = or2 * wi2 + oi2 * wr2;
+    re[k] = er + tr;
+    im[k] = ei + ti;
+    re[j] = er2 + tr2;
+    im[j] = ei2 + ti2;
+  }
+  re[0] = z0r + z0i;
+  im[0] = 0;
+  re[m] = z0r - z0i;
+  im[m] = 0;
+}
+
+void RealFft::inverse(const float *re, const float *im, float *out, float *scratch_re,
+                      float *scratch_im) const {
+  const size_t m = half_;
+  // undo the split: Z[k] = E[k] + i O[k], with E and O the spectra of the
+  // even and odd samples, E[k] = (X[k] + conj X[m-k]) / 2 and
+  // O[k] = conj W^k (X[k] - conj X[m-k]) / 2. The inverse of Z is the
+  // forward transform of its conjugate, conjugated, so that goes in.
+  for (size_t k = 0; k < m; k++) {
+    const float ar = re[k], ai = im[k], br = re[m - k], bi = -im[m - k];
+    const float er = 0.5f * (ar + br), ei = 0.5f * (ai + bi);
+    const float dr = 0.5f * (ar - br), di = 0.5f * (ai - bi);
+    const float wr = split_re_[k], wi = -split_im_[k];
+    const float or_ = dr * wr - di * wi, oi = dr * wi + di * wr;
+    const unsigned r = bitrev_[k];
+    scratch_re[r] = er - oi;
+    scratch_im[r] = -(ei + or_);
+  }
+  butterflies(scratch_re, scratch_im);
+  const float scale = 1.0f / m;
+  for (size_t k = 0; k < m; k++) {
+    out[2 * k] = scratch_re[k] * scale;
+    out[2 * k + 1] = -scratch_im[k] * scale;
+  }
+}
+
+void RealFft::power(const float *in, float *re, float *im, float *power) const {
+  transform(in, re, im);
+  for (size_t k = 0; k <= half_; k++) {
+    power[k] = re[k] * re[k] + im[k] * im[k];
+  }
+}
+
+std::vector<float> hann_window(size_t n) {
+  std::vector<float> w(n);
+  for (size_t i = 0; i < n; i++) {
+    w[i] = (float)(0.5 - 0.5 * cos(2 * M_PI * i / n));
+  }
+  return w;
+}
+
+} // namespace serialmic
@@ -0,0 +1,42 @@
+// Real FFT for the host tools
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+namespace serialmic {
+
+// Forward FFT of `n` real samples (n a power of two, 4 or more), giving bins
+// 0..n/2. The real input is packed into an n/2 point complex FFT and split
+// afterwards, which is half the work of a complex FFT of n. Twiddles and the
+// bit reversal are tabled at construction, so transform() doesn't allocate
+// and one RealFft can be shared by threads that each have their own buffers.
+class RealFft {
+public:
+  explicit RealFft(size_t n);
+
+  size_t size() const { return n_; }
+  size_t bins() const { return n_ / 2 + 1; }
+  // `in` n samples; `re` and `im` bins() each. `in` is left alone.
+  void transform(const float *in, float *re, float *im) const;
+  // Back from bins() of `re` and `im` to n samples in `out`, scaled so that
+  // inverse(transform(x)) is x. The imaginary parts of bins 0 and n/2 are
+  // ignored. `scratch_re` and `scratch_im` are n/2 each.
+  void inverse(const float *re, const float *im, float *out, float *scratch_re, float *scratch_im) const;
+  // |X[k]|^2 for each bin, into `power` (bins()); `re` and `im` are scratch
+  void power(const float *in, float *re, float *im, float *power) const;
+
+private:
+  // The complex FFT of n/2 points in place, input in bit reversed order
+  void butterflies(float *re, float *im) const;
+
+  size_t n_, half_;
+  std::vector<unsigned> bitrev_; // half_ entries
+  std::vector<float> tw_re_, tw_im_;       // per stage from the third, e^-pi i j/h
+  std::vector<float> split_re_, split_im_; // half_ entries, e^-2pi i k/n
+};
+
+// Periodic Hann window, `n` samples
+std::vector<float> hann_window(size_t n);
+
+} // namespace serialmic
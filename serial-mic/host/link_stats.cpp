@@ -0,0 +1,406 @@
+#include "link_stats.h"
+
+#include <cmath>
+#include <cstring>
+
+namespace serialmic {
+
+// A seq this far behind the one expected is a late packet, further back the
+// device has restarted (as in the recorder)
+#define LATE_WINDOW 64
+
+// ====================== QuantileSketch ======================
+
+namespace {
+constexpr double GAMMA = 1.01;
+const double LOG_GAMMA = std::log(GAMMA);
+} // namespace
+
+void QuantileSketch::clear() {
+  memset(bucket_, 0, sizeof(bucket_));
+  zeros_ = 0;
+  count_ = 0;
+  sum_ = 0;
+  min_ = HUGE_VAL;
+  max_ = 0;
+}
+
+void QuantileSketch::add(double v, uint64_t count) {
+  if (!(v >= 0)) {
+    v = 0;
+  }
+  count_ += count;
+  sum_ += v * count;
+  if (v < min_) {
+    min_ = v;
+  }
+  if (v > max_) {
+    max_ = v;
+  }
+  if (v < 1) {
+    zeros_ += count;
+    return;
+  }
+  // bucket i holds (GAMMA^(i-1), GAMMA^i]
+  int i = (int)std::ceil(std::log(v) / LOG_GAMMA);
+  if (i >= BUCKETS) {
+    i = BUCKETS - 1;
+  }
+  bucket_[i] += count;
+}
+
+double QuantileSketch::quantile(double q) const {
+  if (count_ == 0) {
+    return 0;
+  }
+  if (q <= 0) {
+    return min_;
+  }
+  if (q >= 1) {
+    return max_;
+  }
+  const uint64_t rank = (uint64_t)(q * (count_ - 1));
+  uint64_t seen = zeros_;
+  double v = 0;
+  if (seen <= rank) {
+    for (int i = 0; i < BUCKETS; i++) {
+      seen += bucket_[i];
+      if (seen > rank) {
+        // the middle of the bucket, to within GAMMA/2 of anything in it
+        v = 2 * std::pow(GAMMA, i) / (GAMMA + 1);
+        break;
+      }
+    }
+  }
+  return v < min_ ? min_ : v > max_ ? max_ : v;
+}
+
+// ====================== PooledFit ======================
+
+void PooledFit::add(double x, double y) {
+  n_++;
+  const double dx = x - mx_;
+  const double dy = y - my_;
+  mx_ += dx / n_;
+  my_ += dy / n_;
+  cxx_ += dx * (x - mx_);
+  cxy_ += dx * (y - my_);
+  cyy_ += dy * (y - my_);
+}
+
+void PooledFit::new_run() {
+  if (n_ == 0) {
+    return;
+  }
+  total_n_ += n_;
+  runs_++;
+  total_cxx_ += cxx_;
+  total_cxy_ += cxy_;
+  total_cyy_ += cyy_;
+  n_ = 0;
+  mx_ = my_ = cxx_ = cxy_ = cyy_ = 0;
+}
+
+double PooledFit::slope() const {
+  const double sxx = total_cxx_ + cxx_;
+  return sxx > 0 ? (total_cxy_ + cxy_) / sxx : 0;
+}
+
+double PooledFit::residual() const {
+  const double sxx = total_cxx_ + cxx_;
+  const double sxy = total_cxy_ + cxy_;
+  const double syy = total_cyy_ + cyy_;
+  // a slope, and an offset for each run
+  const double dof = (double)points() - 1 - (runs_ + (n_ > 0));
+  if (sxx <= 0 || dof < 1) {
+    return 0;
+  }
+  const double sse = syy - sxy * sxy / sxx;
+  return sse > 0 ? std::sqrt(sse / dof) : 0;
+}
+
+// ====================== WindowRate ======================
+
+void WindowRate::advance(double t_sec) {
+  const int64_t s = (int64_t)std::floor(t_sec / step_);
+  if (!started_) {
+    started_ = true;
+    first_ = slot_ = s;
+    return;
+  }
+  // a window's worth of steps one by one; after that the window is empty
+  const int64_t steps = s - slot_;
+  const int64_t one_by_one = steps < SLOTS ? steps : SLOTS;
+  for (int64_t i = 0; i < one_by_one; i++) {
+    if (slot_ - first_ >= SLOTS - 1) {
+      double sum = 0;
+      for (double v : slots_) {
+        sum += v;
+      }
+      rates_.add(sum / window_);
+    }
+    slot_++;
+    slots_[slot_ % SLOTS] = 0;
+  }
+  if (steps > one_by_one) {
+    rates_.add(0, (uint64_t)(steps - one_by_one));
+    slot_ = s;
+  }
+}
+
+void WindowRate::add(double t_sec, double amount) {
+  advance(t_sec);
+  slots_[slot_ % SLOTS] += amount;
+}
+
+// ====================== RunHistogram ======================
+
+void RunHistogram::add(uint64_t length) {
+  if (length == 0) {
+    return;
+  }
+  int i = 0;
+  while (i < BINS - 1 && length > (1ull << i)) {
+    i++;
+  }
+  bin[i]++;
+  runs++;
+  total += length;
+  if (length > longest) {
+    longest = length;
+  }
+}
+
+const char *RunHistogram::label(int i) {
+  static const char *labels[BINS] = {"1", "2", "3-4", "5-8", "9-16", "17-32", "33-64", "65-128", "129+"};
+  return labels[i];
+}
+
+// ====================== LinkAnalyzer ======================
+
+LinkAnalyzer::LinkAnalyzer(int nominal_rate) : nominal_rate_(nominal_rate) {}
+
+double LinkAnalyzer::now_sec(double arrival_us) const {
+  if (arrival_us >= 0) {
+    return arrival_us * 1e-6;
+  }
+  return device_base_sec_ + usec_ * 1e-6;
+}
+
+void LinkAnalyzer::add_packet(const Packet &pkt, double arrival_us) {
+  packets_++;
+  const size_t bytes = PKT_OVERHEAD + pkt.payload_len;
+  bytes_ += bytes;
+  bool consecutive = false;
+  uint32_t step_us = 0;
+  if (have_seq_) {
+    const int32_t gap = seq_gap(expected_seq_, pkt.seq);
+    if (gap < 0 && gap >= -LATE_WINDOW) {
+      // too late to be in order: counted, but no use for timing
+      if (gap == -1) {
+        duplicates_++;
+      } else {
+        late_++;
+        if (lost_ > 0) {
+          lost_--; // it was counted lost when the gap went past
+        }
+      }
+      const double t = arrival_us >= 0 ? arrival_us * 1e-6 : last_sec_;
+      rate_1s_.add(t, (double)bytes);
+      rate_10s_.add(t, (double)bytes);
+      return;
+    }
+    if (gap < 0) {
+      restarts_++;
+      device_fit_.new_run();
+      host_fit_.new_run();
+      device_base_sec_ = last_sec_ + (double)samples_ / nominal_rate_;
+      seq_ = 0;
+      usec_ = 0;
+    } else {
+      step_us = pkt.usec - last_usec_;
+      seq_ += (uint64_t)gap + 1;
+      usec_ += step_us;
+      if (gap > 0) {
+        lost_ += (uint64_t)gap;
+        gaps_.add((uint64_t)gap);
+        good_runs_.add((double)good_run_);
+        good_run_ = 0;
+      } else {
+        consecutive = true;
+      }
+    }
+  }
+  if (crc_run_ > 0) {
+    crc_bursts_.add(crc_run_);
+    crc_run_ = 0;
+  }
+  good_run_++;
+  if (pkt.payload_len > 0) {
+    samples_ = pkt.payload_len / 2;
+  }
+
+  const double t = now_sec(arrival_us);
+  if (first_sec_ < 0) {
+    first_sec_ = t;
+  }
+  last_sec_ = t;
+  device_fit_.add((double)(seq_ * samples_), (double)usec_);
+  if (consecutive) {
+    // stamps are taken tens of us apart from the period, finer than the
+    // sketch could see in the interval itself
+    stamp_error_us_.add(std::fabs(step_us - 1e6 * samples_ / nominal_rate_));
+  }
+  if (arrival_us >= 0) {
+    host_fit_.add((double)usec_, arrival_us);
+    if (last_arrival_ >= 0) {
+      const double interval = arrival_us - last_arrival_;
+      interval_us_.add(interval);
+      if (consecutive) {
+        // RFC 3550: how much longer this one took to get here than the last
+        const double d = std::fabs(interval - step_us);
+        transit_us_.add(d);
+        jitter_us_ += (d - jitter_us_) / 16;
+        if (jitter_us_ > max_jitter_us_) {
+          max_jitter_us_ = jitter_us_;
+        }
+      }
+    }
+    last_arrival_ = arrival_us;
+  }
+  rate_1s_.add(t, (double)bytes);
+  rate_10s_.add(t, (double)bytes);
+
+  have_seq_ = true;
+  expected_seq_ = pkt.seq + 1;
+  last_usec_ = pkt.usec;
+}
+
+void LinkAnalyzer::add_crc_error(double arrival_us) {
+  crc_errors_++;
+  if (crc_run_++ == 0) {
+    const double t = arrival_us >= 0 ? arrival_us * 1e-6 : last_sec_;
+    if (last_burst_sec_ >= 0) {
+      burst_gap_us_.add((t - last_burst_sec_) * 1e6);
+    }
+    last_burst_sec_ = t;
+  }
+}
+
+double LinkAnalyzer::device_rate() const {
+  const double slope = device_fit_.slope(); // us per sample
+  return device_fit_.points() > 2 && slope > 0 ? 1e6 / slope : 0;
+}
+
+double LinkAnalyzer::host_rate() const {
+  const double b = host_fit_.slope(); // host us per device us
+  return host_fit_.points() > 2 && b > 0 ? device_rate() / b : 0;
+}
+
+double LinkAnalyzer::drift_ppm() const {
+  const double b = host_fit_.slope();
+  return host_fit_.points() > 2 && b > 0 ? (1 / b - 1) * 1e6 : 0;
+}
+
+// ====================== Reports ======================
+
+namespace {
+
+void print_quantiles(FILE *out, const char *what, const QuantileSketch &s, double scale, const char *unit) {
+  if (s.count() == 0) {
+    return;
+  }
+  fprintf(out, "  %-22s %9.3g %9.3g %9.3g %9.3g %9.3g %9.3g %9.3g  %s\n", what, s.mean() * scale,
+          s.min() * scale, s.quantile(0.5) * scale, s.quantile(0.9) * scale, s.quantile(0.99) * scale,
+          s.quantile(0.999) * scale, s.max() * scale, unit);
+}
+
+void print_runs(FILE *out, const char *what, const RunHistogram &h) {
+  fprintf(out, "  %-10s", what);
+  for (int i = 0; i < RunHistogram::BINS; i++) {
+    if (h.bin[i]) {
+      fprintf(out, " %s:%llu", RunHistogram::label(i), (unsigned long long)h.bin[i]);
+    }
+  }
+  fprintf(out, "%s  (longest %llu)\n", h.runs ? "" : " none", (unsigned long long)h.longest);
+}
+
+void json_quantiles(FILE *out, const char *name, const QuantileSketch &s, double scale, bool last = false) {
+  fprintf(out,
+          "  \"%s\": {\"count\": %llu, \"mean\": %.6g, \"min\": %.6g, \"p50\": %.6g, \"p90\": %.6g, "
+          "\"p99\": %.6g, \"p999\": %.6g, \"max\": %.6g}%s\n",
+          name, (unsigned long long)s.count(), s.mean() * scale, s.min() * scale, s.quantile(0.5) * scale,
+          s.quantile(0.9) * scale, s.quantile(0.99) * scale, s.quantile(0.999) * scale, s.max() * scale,
+          last ? "" : ",");
+}
+
+void json_runs(FILE *out, const char *name, const RunHistogram &h) {
+  fprintf(out, "  \"%s\": {\"runs\": %llu, \"total\": %llu, \"longest\": %llu, \"histogram\": {", name,
+          (unsigned long long)h.runs, (unsigned long long)h.total, (unsigned long long)h.longest);
+  for (int i = 0; i < RunHistogram::BINS; i++) {
+    fprintf(out, "%s\"%s\": %llu", i ? ", " : "", RunHistogram::label(i), (unsigned long long)h.bin[i]);
+  }
+  fprintf(out, "}},\n");
+}
+
+} // namespace
+
+void LinkAnalyzer::print(FILE *out) const {
+  const double duration = packets_ ? last_sec_ - first_sec_ : 0;
+  const uint64_t expected = packets_ - late_ - duplicates_ + lost_;
+  fprintf(out, "packets    %llu in %.1f s, %.2f MB, %llu lost (%.3f%%), %llu late, %llu duplicated, %llu restarts\n",
+          (unsigned long long)packets_, duration, bytes_ / 1e6, (unsigned long long)lost_,
+          expected ? 100.0 * lost_ / expected : 0, (unsigned long long)late_, (unsigned long long)duplicates_,
+          (unsigned long long)restarts_);
+  fprintf(out, "crc        %llu failures in %llu bursts\n", (unsigned long long)crc_errors_,
+          (unsigned long long)(crc_bursts_.runs + (crc_run_ > 0)));
+  print_runs(out, "gap runs", gaps_);
+  print_runs(out, "crc bursts", crc_bursts_);
+  if (device_rate() > 0) {
+    fprintf(out, "clock      %.3f Hz by the device's clock (%+.1f ppm), fit residual %.1f us", device_rate(),
+            (device_rate() / nominal_rate_ - 1) * 1e6, device_fit_.residual());
+    if (host_rate() > 0) {
+      fprintf(out, "\n           %.3f Hz by the host's, device clock %+.1f ppm against it, residual %.0f us",
+              host_rate(), drift_ppm(), host_fit_.residual());
+    }
+    fprintf(out, "\n");
+  }
+  if (interval_us_.count()) {
+    fprintf(out, "jitter     %.0f us now (RFC 3550), %.0f us at most\n", jitter_us_, max_jitter_us_);
+  }
+  fprintf(out, "                              mean       min       p50       p90       p99     p99.9       max\n");
+  print_quantiles(out, "arrival interval", interval_us_, 1e-3, "ms");
+  print_quantiles(out, "transit change |D|", transit_us_, 1e-3, "ms");
+  print_quantiles(out, "stamp error", stamp_error_us_, 1, "us");
+  print_quantiles(out, "packets between gaps", good_runs_, 1, "packets");
+  print_quantiles(out, "between crc bursts", burst_gap_us_, 1e-6, "s");
+  print_quantiles(out, "throughput, 1s", rate_1s_.rates(), 1e-3, "kB/s");
+  print_quantiles(out, "throughput, 10s", rate_10s_.rates(), 1e-3, "kB/s");
+}
+
+void LinkAnalyzer::print_json(FILE *out) const {
+  fprintf(out, "{\n");
+  fprintf(out, "  \"packets\": %llu,\n  \"bytes\": %llu,\n  \"seconds\": %.6f,\n", (unsigned long long)packets_,
+          (unsigned long long)bytes_, packets_ ? last_sec_ - first_sec_ : 0);
+  fprintf(out, "  \"lost\": %llu,\n  \"late\": %llu,\n  \"duplicates\": %llu,\n  \"restarts\": %llu,\n",
+          (unsigned long long)lost_, (unsigned long long)late_, (unsigned long long)duplicates_,
+          (unsigned long long)restarts_);
+  fprintf(out, "  \"crc_errors\": %llu,\n", (unsigned long long)crc_errors_);
+  json_runs(out, "gap_runs", gaps_);
+  json_runs(out, "crc_bursts", crc_bursts_);
+  fprintf(out, "  \"device_rate_hz\": %.6f,\n  \"host_rate_hz\": %.6f,\n  \"drift_ppm\": %.3f,\n", device_rate(),
+          host_rate(), drift_ppm());
+  fprintf(out, "  \"device_fit_residual_us\": %.3f,\n  \"host_fit_residual_us\": %.3f,\n", device_fit_.residual(),
+          host_fit_.residual());
+  fprintf(out, "  \"jitter_us\": %.3f,\n  \"max_jitter_us\": %.3f,\n", jitter_us_, max_jitter_us_);
+  json_quantiles(out, "arrival_interval_us", interval_us_, 1);
+  json_quantiles(out, "transit_change_us", transit_us_, 1);
+  json_quantiles(out, "stamp_error_us", stamp_error_us_, 1);
+  json_quantiles(out, "packets_between_gaps", good_runs_, 1);
+  json_quantiles(out, "between_crc_bursts_us", burst_gap_us_, 1);
+  json_quantiles(out, "throughput_1s_bytes_per_sec", rate_1s_.rates(), 1);
+  json_quantiles(out, "throughput_10s_bytes_per_sec", rate_10s_.rates(), 1, true);
+  fprintf(out, "}\n");
+}
+
+} // namespace serialmic
@@ -0,0 +1,170 @@
+// Link statistics for a serial-mic stream, in one pass and fixed memory
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+
+#include "packet.h"
+
+namespace serialmic {
+
+// Quantiles of a stream of non-negative values to within 0.5% of the value,
+// in a fixed 22K whatever the count: values are counted in buckets whose
+// edges grow by 1% (a DDSketch with a fixed range). Values below 1 count as
+// 0 and above 1e12 as 1e12, so pick units that put the interesting range in
+// between - microseconds, bytes per second.
+class QuantileSketch {
+public:
+  QuantileSketch() { clear(); }
+
+  void add(double v, uint64_t count = 1);
+  void clear();
+
+  uint64_t count() const { return count_; }
+  double mean() const { return count_ ? sum_ / count_ : 0; }
+  double min() const { return count_ ? min_ : 0; }
+  double max() const { return count_ ? max_ : 0; }
+  // q from 0 to 1
+  double quantile(double q) const;
+
+private:
+  static constexpr int BUCKETS = 2800;
+  uint64_t bucket_[BUCKETS];
+  uint64_t zeros_;
+  uint64_t count_;
+  double sum_, min_, max_;
+};
+
+// Straight line fit by least squares for points that come in runs, each run
+// with its own offset but all on the same slope (a device's clock across
+// restarts). Running co-moments, so it stays accurate however long it runs.
+class PooledFit {
+public:
+  void add(double x, double y);
+  // The next point starts a new run
+  void new_run();
+
+  uint64_t points() const { return total_n_ + n_; }
+  double slope() const;
+  // Root mean square distance of the points from their run's line
+  double residual() const;
+
+private:
+  uint64_t n_ = 0;
+  double mx_ = 0, my_ = 0, cxx_ = 0, cxy_ = 0, cyy_ = 0; // this run
+  uint64_t total_n_ = 0;
+  uint64_t runs_ = 0;
+  double total_cxx_ = 0, total_cxy_ = 0, total_cyy_ = 0; // runs before it
+};
+
+// Throughput over a sliding window: every tenth of the window a sample of
+// the window's total goes into a sketch
+class WindowRate {
+public:
+  explicit WindowRate(double window_sec) : window_(window_sec), step_(window_sec / SLOTS) {}
+
+  void add(double t_sec, double amount);
+  const QuantileSketch &rates() const { return rates_; } // per second
+  double window() const { return window_; }
+
+private:
+  static constexpr int SLOTS = 10;
+  void advance(double t_sec);
+
+  double window_, step_;
+  bool started_ = false;
+  int64_t first_ = 0; // slot numbers, by time
+  int64_t slot_ = 0;  // the one filling
+  double slots_[SLOTS] = {};
+  QuantileSketch rates_;
+};
+
+// Histogram by powers of two: 1, 2, 3-4, 5-8, ... 129+
+struct RunHistogram {
+  static constexpr int BINS = 9;
+  uint64_t bin[BINS] = {};
+  uint64_t runs = 0, total = 0, longest = 0;
+
+  void add(uint64_t length);
+  static const char *label(int i);
+};
+
+// Everything `frontend/src/test.ts` counts and more, for one stream. Give it
+// each packet with the host time it arrived, or a negative time for a
+// recording that doesn't have one (then time follows the device's clock and
+// the arrival figures are left out). Also works as a PacketParser handler:
+// set_arrival() before each feed().
+//
+// Gaps, restarts and late packets are told apart as the recorder does. A
+// CRC burst is failures with no good packet between them.
+class LinkAnalyzer {
+public:
+  explicit LinkAnalyzer(int nominal_rate = SAMPLE_RATE);
+
+  void add_packet(const Packet &pkt, double arrival_us);
+  void add_crc_error(double arrival_us);
+
+  void set_arrival(double arrival_us) { arrival_ = arrival_us; }
+  void on_packet(const Packet &pkt) { add_packet(pkt, arrival_); }
+  void on_crc_error(uint64_t) { add_crc_error(arrival_); }
+
+  // Human readable, or one JSON object
+  void print(FILE *out) const;
+  void print_json(FILE *out) const;
+
+  uint64_t packets() const { return packets_; }
+  uint64_t lost() const { return lost_; }
+  uint64_t crc_errors() const { return crc_errors_; }
+  // Sample rate by the device's clock (its usec stamps against seq) and by
+  // the host's, and the device clock against the host's in ppm. 0 until
+  // there is enough to go on.
+  double device_rate() const;
+  double host_rate() const;
+  double drift_ppm() const;
+
+private:
+  double now_sec(double arrival_us) const;
+
+  int nominal_rate_;
+  double arrival_ = -1;
+
+  uint64_t packets_ = 0;
+  uint64_t bytes_ = 0;
+  uint64_t lost_ = 0;
+  uint64_t late_ = 0;
+  uint64_t duplicates_ = 0;
+  uint64_t restarts_ = 0;
+  uint64_t crc_errors_ = 0;
+  bool have_seq_ = false;
+  uint32_t expected_seq_ = 0;
+  uint64_t seq_ = 0;         // unwrapped, this run
+  uint64_t usec_ = 0;        // unwrapped device clock, this run
+  uint32_t last_usec_ = 0;
+  double last_arrival_ = -1;
+  double first_sec_ = -1, last_sec_ = 0;
+  double device_base_sec_ = 0; // timeline for recordings, carried across restarts
+  uint32_t samples_ = 0;     // per packet, the latest
+
+  RunHistogram gaps_;          // packets lost in a row
+  QuantileSketch good_runs_;   // packets between gaps
+  uint64_t good_run_ = 0;
+  RunHistogram crc_bursts_;
+  uint64_t crc_run_ = 0;
+  double last_burst_sec_ = -1;
+  QuantileSketch burst_gap_us_; // start of one burst to the next
+
+  QuantileSketch interval_us_;  // arrival to arrival
+  QuantileSketch stamp_error_us_; // usec to usec against a packet's worth, consecutive packets
+  QuantileSketch transit_us_;   // |D| from RFC 3550, change in transit time
+  double jitter_us_ = 0;        // RFC 3550 running jitter
+  double max_jitter_us_ = 0;
+
+  PooledFit device_fit_; // usec against samples
+  PooledFit host_fit_;   // arrival against usec
+
+  WindowRate rate_1s_{1};
+  WindowRate rate_10s_{10};
+};
+
+} // namespace serialmic
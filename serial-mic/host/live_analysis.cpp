@@ -0,0 +1,231 @@
+#include "live_analysis.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+
+namespace serialmic {
+
+double wall_ms() {
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec * 1e-6;
+}
+
+LiveAnalyzer::LiveAnalyzer(const LiveConfig &config)
+    : c_(config), fft_(config.fft_size), window_(hann_window(config.fft_size)), history_(config.fft_size, 0),
+      buf_(config.fft_size), re_(config.fft_size / 2 + 1), im_(config.fft_size / 2 + 1) {
+  const size_t n = c_.fft_size;
+  // dBFS for a full scale sine: one sided, over the window's coherent gain
+  double sum = 0;
+  for (float w : window_) {
+    sum += w;
+  }
+  scale_ = (float)(2 / (n * (sum / n)));
+
+  // BarSpectrum's bands: quadratic from 20Hz up to near Nyquist
+  const double nyquist = c_.rate / 2.0;
+  const int bins = (int)(n / 2);
+  for (int b = 0; b < c_.bands; b++) {
+    const double t0 = (double)b / c_.bands, t1 = (double)(b + 1) / c_.bands;
+    const double f0 = t0 * t0 * nyquist * 0.95 + 20;
+    const double f1 = t1 * t1 * nyquist * 0.98 + 20;
+    band_lo_.push_back(std::max(1, (int)floor(f0 / nyquist * bins)));
+    band_hi_.push_back(std::min(bins - 1, (int)ceil(f1 / nyquist * bins)));
+  }
+}
+
+uint8_t LiveAnalyzer::quantize(float db) const {
+  const float t = (db - c_.min_db) / (c_.max_db - c_.min_db);
+  return (uint8_t)lrintf(std::max(0.0f, std::min(1.0f, t)) * 255);
+}
+
+void LiveAnalyzer::analyze(const int16_t *pcm, size_t n, LiveFrame *frame) {
+  const size_t size = c_.fft_size;
+
+  // level and scope
+  const Levels levels = measure_levels(pcm, n);
+  frame->rms_db = levels.rms_db;
+  frame->peak_db = levels.peak_db;
+  const int cols = c_.scope_cols;
+  frame->scope.resize(2 * cols);
+  for (int c = 0; c < cols; c++) {
+    const size_t from = n * c / cols, to = std::max(from + 1, n * (c + 1) / cols);
+    int lo = 32767, hi = -32768;
+    for (size_t i = from; i < to && i < n; i++) {
+      lo = std::min(lo, (int)pcm[i]);
+      hi = std::max(hi, (int)pcm[i]);
+    }
+    if (lo > hi) {
+      lo = hi = 0;
+    }
+    frame->scope[2 * c] = (int16_t)lo;
+    frame->scope[2 * c + 1] = (int16_t)hi;
+  }
+
+  // spectrum over the last fft_size samples
+  if (n >= size) {
+    for (size_t i = 0; i < size; i++) {
+      history_[i] = pcm[n - size + i] * (1.0f / 32768);
+    }
+  } else {
+    memmove(history_.data(), history_.data() + n, (size - n) * sizeof(float));
+    for (size_t i = 0; i < n; i++) {
+      history_[size - n + i] = pcm[i] * (1.0f / 32768);
+    }
+  }
+  for (size_t i = 0; i < size; i++) {
+    buf_[i] = history_[i] * window_[i];
+  }
+  fft_.transform(buf_.data(), re_.data(), im_.data());
+  const size_t bins = size / 2;
+  frame->spectrum.resize(bins);
+  frame->bands.resize(c_.bands);
+  for (size_t k = 0; k < bins; k++) {
+    // amplitude into re_, for the bands below
+    re_[k] = sqrtf(re_[k] * re_[k] + im_[k] * im_[k]) * scale_;
+    frame->spectrum[k] = quantize(20 * log10f(re_[k] + 1e-12f));
+  }
+  for (int b = 0; b < c_.bands; b++) {
+    float loudest = 0;
+    for (int k = band_lo_[b]; k <= band_hi_[b]; k++) {
+      loudest = std::max(loudest, re_[k]);
+    }
+    frame->bands[b] = quantize(20 * log10f(loudest + 1e-12f));
+  }
+
+  pitch(pcm, n, frame);
+}
+
+// detectPitchAutocorrPCM16: the first autocorrelation peak that is the
+// highest between pitch_min_hz and pitch_max_hz, interpolated
+void LiveAnalyzer::pitch(const int16_t *pcm, size_t n, LiveFrame *frame) {
+  frame->pitch_hz = 0;
+  frame->pitch_confidence = 0;
+  if (n < 512) {
+    return;
+  }
+  pitch_buf_.resize(n);
+  double mean = 0;
+  for (size_t i = 0; i < n; i++) {
+    mean += pcm[i];
+  }
+  mean /= n * 32768.0;
+  double energy = 0;
+  for (size_t i = 0; i < n; i++) {
+    pitch_buf_[i] = (float)(pcm[i] / 32768.0 - mean);
+    energy += (double)pitch_buf_[i] * pitch_buf_[i];
+  }
+  const int max_lag = (int)floor(c_.rate / c_.pitch_min_hz);
+  const int min_lag = std::max(1, (int)floor(c_.rate / c_.pitch_max_hz));
+  std::vector<float> &ac = ac_;
+  ac.assign(max_lag + 1, 0.0f);
+  const float *x = pitch_buf_.data();
+  for (int lag = min_lag; lag <= max_lag && (size_t)lag < n; lag++) {
+    float sum = 0;
+    const size_t len = n - lag;
+    for (size_t i = 0; i < len; i++) {
+      sum += x[i] * x[i + lag];
+    }
+    ac[lag] = sum;
+  }
+  int best = -1;
+  float best_v = 0;
+  for (int lag = min_lag + 1; lag < max_lag - 1; lag++) {
+    const float v = ac[lag];
+    if (v > ac[lag - 1] && v >= ac[lag + 1] && v > best_v) {
+      best_v = v;
+      best = lag;
+    }
+  }
+  if (best < 0) {
+    return;
+  }
+  const float y1 = ac[best - 1], y2 = ac[best], y3 = ac[best + 1];
+  float den = y1 - 2 * y2 + y3;
+  if (den == 0) {
+    den = 1e-12f;
+  }
+  frame->pitch_hz = (float)(c_.rate / (best + 0.5f * (y1 - y3) / den));
+  frame->pitch_confidence = (float)std::max(0.0, std::min(1.0, best_v / (energy + 1e-9)));
+}
+
+static void put16(std::vector<uint8_t> *out, uint16_t v) {
+  out->push_back((uint8_t)v);
+  out->push_back((uint8_t)(v >> 8));
+}
+static void put32(std::vector<uint8_t> *out, uint32_t v) {
+  for (int i = 0; i < 4; i++) {
+    out->push_back((uint8_t)(v >> (8 * i)));
+  }
+}
+static void putf32(std::vector<uint8_t> *out, float f) {
+  uint32_t v;
+  memcpy(&v, &f, 4);
+  put32(out, v);
+}
+static void putf64(std::vector<uint8_t> *out, double d) {
+  uint64_t v;
+  memcpy(&v, &d, 8);
+  put32(out, (uint32_t)v);
+  put32(out, (uint32_t)(v >> 32));
+}
+
+void encode_live_frame(const LiveFrame &f, int rate, const int16_t *pcm, size_t pcm_samples, double sent_ms,
+                       std::vector<uint8_t> *out) {
+  if (!pcm) {
+    pcm_samples = 0;
+  }
+  out->clear();
+  out->reserve(LIVE_HEADER_LEN + 2 * (f.scope.size() + pcm_samples) + f.spectrum.size() + f.bands.size());
+  out->push_back(LIVE_FRAME);
+  out->push_back(LIVE_VERSION);
+  put16(out, (uint16_t)(f.flags | (pcm_samples ? LIVE_FLAG_PCM : 0)));
+  put32(out, f.seq);
+  put32(out, f.usec);
+  put32(out, (uint32_t)rate);
+  putf64(out, f.read_ms);
+  putf64(out, sent_ms);
+  put32(out, f.packets);
+  put32(out, f.lost);
+  put32(out, f.crc_errors);
+  put32(out, f.bytes_per_sec);
+  putf32(out, f.rms_db);
+  putf32(out, f.peak_db);
+  putf32(out, f.pitch_hz);
+  putf32(out, f.pitch_confidence);
+  put16(out, (uint16_t)(f.scope.size() / 2));
+  put16(out, (uint16_t)f.spectrum.size());
+  put16(out, (uint16_t)f.bands.size());
+  put16(out, (uint16_t)pcm_samples);
+  for (int16_t v : f.scope) {
+    put16(out, (uint16_t)v);
+  }
+  for (size_t i = 0; i < pcm_samples; i++) {
+    put16(out, (uint16_t)pcm[i]);
+  }
+  out->insert(out->end(), f.spectrum.begin(), f.spectrum.end());
+  out->insert(out->end(), f.bands.begin(), f.bands.end());
+}
+
+std::string live_hello_json(const LiveConfig &c, const char *source) {
+  std::string name;
+  for (const char *p = source; *p; p++) {
+    if (*p == '"' || *p == '\\') {
+      name += '\\';
+    }
+    if ((unsigned char)*p >= 0x20) {
+      name += *p;
+    }
+  }
+  char buf[512];
+  snprintf(buf, sizeof(buf),
+           "{\"type\":\"hello\",\"version\":%d,\"source\":\"%s\",\"sample_rate\":%d,\"fft_size\":%zu,"
+           "\"bands\":%d,\"scope_cols\":%d,\"min_db\":%g,\"max_db\":%g}",
+           LIVE_VERSION, name.c_str(), c.rate, c.fft_size, c.bands, c.scope_cols, c.min_db, c.max_db);
+  return buf;
+}
+
+} // namespace serialmic
@@ -0,0 +1,95 @@
+// The frontend's per-packet analysis, done natively for serialmic_bridge
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "dsp_kernels.h"
+#include "fft.h"
+#include "packet.h"
+
+namespace serialmic {
+
+struct LiveConfig {
+  int rate = SAMPLE_RATE;
+  size_t fft_size = 1024; // as drawSpectrogram and BarSpectrum
+  int bands = 31;
+  int scope_cols = 256;
+  float min_db = -100, max_db = 0; // the range spectrum bytes cover
+  double pitch_min_hz = 50, pitch_max_hz = 1200;
+};
+
+// What the page draws for one packet
+struct LiveFrame {
+  uint16_t flags = 0;
+  uint32_t seq = 0, usec = 0;
+  double read_ms = 0; // wall clock when the packet was read
+  uint32_t packets = 0, lost = 0, crc_errors = 0, bytes_per_sec = 0;
+  float rms_db = 0, peak_db = 0; // of this packet, dBFS
+  float pitch_hz = 0, pitch_confidence = 0; // 0 Hz: none found
+  std::vector<int16_t> scope;    // min, max per column
+  std::vector<uint8_t> spectrum; // fft_size / 2 bins, quantized dB
+  std::vector<uint8_t> bands;    // band peaks, quantized dB
+};
+
+// ====================== Wire format ======================
+// One WebSocket binary message per packet, little endian:
+//    0 u8  type (LIVE_FRAME)        1 u8  version (LIVE_VERSION)
+//    2 u16 flags                    4 u32 seq
+//    8 u32 usec                    12 u32 sample rate
+//   16 f64 read_ms                 24 f64 sent_ms (wall clock, ms since 1970)
+//   32 u32 packets                 36 u32 lost
+//   40 u32 crc_errors              44 u32 bytes_per_sec
+//   48 f32 rms_db                  52 f32 peak_db
+//   56 f32 pitch_hz                60 f32 pitch_confidence
+//   64 u16 scope_cols              66 u16 spectrum_bins
+//   68 u16 bands                   70 u16 pcm_samples
+//   72 i16 scope[2 * scope_cols], i16 pcm[pcm_samples],
+//      u8 spectrum[spectrum_bins], u8 bands[bands]
+// Quantized dB are min_db + v * (max_db - min_db) / 255, with min_db and
+// max_db in the hello text message sent on connecting. The PCM is only
+// there for clients that asked for it (to record).
+constexpr uint8_t LIVE_FRAME = 1;
+constexpr uint8_t LIVE_VERSION = 1;
+constexpr size_t LIVE_HEADER_LEN = 72;
+constexpr uint16_t LIVE_FLAG_PCM = 1;
+constexpr uint16_t LIVE_FLAG_GAP = 2;     // packets were lost before this one
+constexpr uint16_t LIVE_FLAG_RESTART = 4; // the device started again
+
+// Scope, spectrum, band levels, pitch and level of each packet, as the
+// frontend works them out in onPcm: the same 1024 point Hann spectrum and
+// dBFS scaling, BarSpectrum's bands (the loudest bin in each) and the same
+// autocorrelation pitch. The page keeps only what is about drawing - the
+// scrolling, peak hold, meter ballistics. The spectrum covers the last
+// fft_size samples, so packets shorter than that still give a full one.
+class LiveAnalyzer {
+public:
+  explicit LiveAnalyzer(const LiveConfig &config);
+
+  const LiveConfig &config() const { return c_; }
+  // One packet's samples; fills in the analysis fields of `frame`
+  void analyze(const int16_t *pcm, size_t n, LiveFrame *frame);
+
+private:
+  uint8_t quantize(float db) const;
+  void pitch(const int16_t *pcm, size_t n, LiveFrame *frame);
+
+  LiveConfig c_;
+  RealFft fft_;
+  std::vector<float> window_, history_, buf_, re_, im_, pitch_buf_, ac_;
+  float scale_;
+  std::vector<int> band_lo_, band_hi_;
+};
+
+// The frame in the wire format into `out`, with `pcm` when not null
+void encode_live_frame(const LiveFrame &frame, int rate, const int16_t *pcm, size_t pcm_samples, double sent_ms,
+                       std::vector<uint8_t> *out);
+// The text message a client gets first: what the frames hold
+std::string live_hello_json(const LiveConfig &config, const char *source);
+
+// Wall clock in ms, to compare with the browser's Date.now()
+double wall_ms();
+
+} // namespace serialmic
@@ -0,0 +1,559 @@
+#include "localizer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace serialmic {
+
+// How fast the noise floor follows the level up; it follows it down at once
+static const double FLOOR_RISE_DB_PER_S = 1.0;
+
+bool load_mic_positions(const char *path, std::vector<MicPosition> *mics) {
+  FILE *f = fopen(path, "r");
+  if (!f) {
+    fprintf(stderr, "%s: can't open\n", path);
+    return false;
+  }
+  mics->clear();
+  char line[256];
+  int line_no = 0;
+  bool ok = true;
+  while (fgets(line, sizeof(line), f)) {
+    line_no++;
+    char *hash = strchr(line, '#');
+    if (hash) {
+      *hash = 0;
+    }
+    MicPosition m;
+    const int n = sscanf(line, "%lf %lf %lf", &m.x, &m.y, &m.z);
+    if (n <= 0) {
+      continue; // blank
+    }
+    if (n < 2) {
+      fprintf(stderr, "%s:%d: expected x y [z]\n", path, line_no);
+      ok = false;
+      break;
+    }
+    mics->push_back(m);
+  }
+  fclose(f);
+  return ok;
+}
+
+// Solves the n x n system a x = b in place (b becomes x), partial pivoting
+static bool solve_linear(double *a, double *b, int n) {
+  for (int col = 0; col < n; col++) {
+    int pivot = col;
+    for (int r = col + 1; r < n; r++) {
+      if (fabs(a[r * n + col]) > fabs(a[pivot * n + col])) {
+        pivot = r;
+      }
+    }
+    if (fabs(a[pivot * n + col]) < 1e-12) {
+      return false;
+    }
+    if (pivot != col) {
+      for (int k = 0; k < n; k++) {
+        std::swap(a[col * n + k], a[pivot * n + k]);
+      }
+      std::swap(b[col], b[pivot]);
+    }
+    for (int r = col + 1; r < n; r++) {
+      const double f = a[r * n + col] / a[col * n + col];
+      if (f == 0) {
+        continue;
+      }
+      for (int k = col; k < n; k++) {
+        a[r * n + k] -= f * a[col * n + k];
+      }
+      b[r] -= f * b[col];
+    }
+  }
+  for (int r = n - 1; r >= 0; r--) {
+    double s = b[r];
+    for (int k = r + 1; k < n; k++) {
+      s -= a[r * n + k] * b[k];
+    }
+    b[r] = s / a[r * n + r];
+  }
+  return true;
+}
+
+static double distance(const MicPosition &a, const MicPosition &b) {
+  return sqrt((a.x - b.x) * (a.x - b.x) + (a.y - b.y) * (a.y - b.y) + (a.z - b.z) * (a.z - b.z));
+}
+
+Localizer::Localizer(const std::vector<MicPosition> &mics, const LocalizerConfig &config)
+    : c_(config), devices_((int)mics.size()), mics_(mics), fft_(config.fft_size),
+      window_(hann_window(config.fft_size)), bins_(config.fft_size / 2 + 1) {
+  if (c_.hop == 0 || c_.hop > c_.fft_size) {
+    c_.hop = c_.fft_size / 2;
+  }
+  dims_ = c_.dims;
+  if (dims_ != 2 && dims_ != 3) {
+    dims_ = 2;
+    for (const MicPosition &m : mics_) {
+      if (fabs(m.z - mics_[0].z) > 1e-6) {
+        dims_ = 3;
+      }
+    }
+  }
+  if (c_.threads <= 0) {
+    c_.threads = (int)std::max(1u, std::thread::hardware_concurrency());
+  }
+  threads_ = c_.threads;
+
+  double aperture = 0;
+  for (int a = 0; a < devices_; a++) {
+    for (int b = a + 1; b < devices_; b++) {
+      aperture = std::max(aperture, distance(mics_[a], mics_[b]));
+      PairDelay p;
+      p.a = a;
+      p.b = b;
+      pairs_.push_back(p);
+    }
+  }
+  max_lag_ = (int)ceil(aperture / c_.sound_speed * c_.rate) + 1;
+  max_lag_ = std::min(max_lag_, (int)c_.fft_size / 2 - 2);
+
+  const double bin_hz = (double)c_.rate / c_.fft_size;
+  band_lo_ = std::max<size_t>(1, (size_t)ceil(c_.low_hz / bin_hz));
+  band_hi_ = std::min(bins_ - 2, (size_t)floor(c_.high_hz / bin_hz));
+  if (band_hi_ < band_lo_) {
+    band_hi_ = band_lo_;
+  }
+
+  input_.assign((size_t)devices_ * c_.fft_size, 0);
+  spec_re_.assign((size_t)devices_ * bins_, 0);
+  spec_im_.assign((size_t)devices_ * bins_, 0);
+  energy_.assign(devices_, 0);
+  scratch_.resize(threads_);
+  for (Scratch &s : scratch_) {
+    s.buf.assign(c_.fft_size, 0);
+    s.re.assign(bins_, 0);
+    s.im.assign(bins_, 0);
+    s.half_re.assign(c_.fft_size / 2, 0);
+    s.half_im.assign(c_.fft_size / 2, 0);
+    s.corr.assign(c_.fft_size, 0);
+  }
+
+  // a perfect match whitens to 1 in every bin of the band, and its
+  // correlation at lag 0 is what a peak is measured against
+  Scratch &s = scratch_[0];
+  for (size_t k = band_lo_; k <= band_hi_; k++) {
+    s.re[k] = 1;
+  }
+  fft_.inverse(s.re.data(), s.im.data(), s.corr.data(), s.half_re.data(), s.half_im.data());
+  peak_norm_ = s.corr[0];
+  std::fill(s.re.begin(), s.re.end(), 0.0f);
+
+  for (int t = 1; t < threads_; t++) {
+    pool_.emplace_back(&Localizer::worker_loop, this, t);
+  }
+}
+
+Localizer::~Localizer() {
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    quit_ = true;
+  }
+  start_cv_.notify_all();
+  for (std::thread &t : pool_) {
+    t.join();
+  }
+}
+
+void Localizer::push(const int16_t *interleaved, size_t frames, std::vector<Location> *out) {
+  const size_t n = c_.fft_size;
+  while (frames > 0) {
+    const size_t take = std::min(frames, n - fill_);
+    for (int d = 0; d < devices_; d++) {
+      float *dst = input_.data() + (size_t)d * n + fill_;
+      const int16_t *src = interleaved + d;
+      for (size_t i = 0; i < take; i++) {
+        dst[i] = src[i * devices_] * (1.0f / 32768);
+      }
+    }
+    interleaved += take * devices_;
+    frames -= take;
+    fill_ += take;
+    if (fill_ < n) {
+      break;
+    }
+    Location loc;
+    process_window(&loc);
+    out->push_back(loc);
+    // keep the overlap for the next window
+    const size_t keep = n - c_.hop;
+    for (int d = 0; d < devices_; d++) {
+      float *ch = input_.data() + (size_t)d * n;
+      memmove(ch, ch + c_.hop, keep * sizeof(float));
+    }
+    fill_ = keep;
+  }
+}
+
+void Localizer::process_window(Location *loc) {
+  loc->window = windows_;
+  loc->time = ((double)windows_ * c_.hop + c_.fft_size / 2.0) / c_.rate;
+  windows_++;
+
+  run_stage(0, devices_);
+  double energy = 0;
+  for (int d = 0; d < devices_; d++) {
+    energy += energy_[d];
+  }
+  energy /= std::max(1, devices_);
+  loc->level_db = 10 * log10(std::max(energy, 1e-12));
+  // digital silence (nothing arrived yet, or every device starved) says
+  // nothing about the room's noise
+  if (energy <= 1e-12) {
+    return;
+  }
+  if (!have_floor_ || loc->level_db < floor_db_) {
+    floor_db_ = loc->level_db;
+    have_floor_ = true;
+  } else {
+    floor_db_ += FLOOR_RISE_DB_PER_S * c_.hop / c_.rate;
+  }
+  loc->above_floor_db = loc->level_db - floor_db_;
+  loc->event = c_.event_db <= 0 || loc->above_floor_db >= c_.event_db;
+  if (!loc->event || pairs_.empty()) {
+    return;
+  }
+  run_stage(1, (int)pairs_.size());
+  loc->solved = solve(loc);
+}
+
+void Localizer::transform_channel(int dev, int worker) {
+  Scratch &s = scratch_[worker];
+  const size_t n = c_.fft_size;
+  const float *in = input_.data() + (size_t)dev * n;
+  double sum = 0, wsum = 0;
+  for (size_t i = 0; i < n; i++) {
+    s.buf[i] = in[i] * window_[i];
+    sum += (double)s.buf[i] * s.buf[i];
+    wsum += (double)window_[i] * window_[i];
+  }
+  energy_[dev] = sum / wsum;
+  float *re = spec_re_.data() + (size_t)dev * bins_;
+  float *im = spec_im_.data() + (size_t)dev * bins_;
+  fft_.transform(s.buf.data(), re, im);
+  // whiten: the phase is all GCC-PHAT keeps
+  for (size_t k = band_lo_; k <= band_hi_; k++) {
+    const float mag = sqrtf(re[k] * re[k] + im[k] * im[k]);
+    const float g = mag > 1e-20f ? 1 / mag : 0;
+    re[k] *= g;
+    im[k] *= g;
+  }
+}
+
+void Localizer::correlate_pair(int pair, int worker) {
+  Scratch &s = scratch_[worker];
+  PairDelay &p = pairs_[pair];
+  const float *ar = spec_re_.data() + (size_t)p.a * bins_, *ai = spec_im_.data() + (size_t)p.a * bins_;
+  const float *br = spec_re_.data() + (size_t)p.b * bins_, *bi = spec_im_.data() + (size_t)p.b * bins_;
+  // A conj B over the band; the bins outside it stay 0 from construction
+  float *__restrict xr = s.re.data();
+  float *__restrict xi = s.im.data();
+  for (size_t k = band_lo_; k <= band_hi_; k++) {
+    xr[k] = ar[k] * br[k] + ai[k] * bi[k];
+    xi[k] = ai[k] * br[k] - ar[k] * bi[k];
+  }
+  fft_.inverse(xr, xi, s.corr.data(), s.half_re.data(), s.half_im.data());
+
+  // lag l is at l, or n + l when negative
+  const int n = (int)c_.fft_size;
+  const float *corr = s.corr.data();
+  int best = 0;
+  float best_v = corr[0];
+  for (int l = 1; l <= max_lag_; l++) {
+    if (corr[l] > best_v) {
+      best_v = corr[l];
+      best = l;
+    }
+    if (corr[n - l] > best_v) {
+      best_v = corr[n - l];
+      best = -l;
+    }
+  }
+  const float y0 = corr[(best - 1 + n) % n], y2 = corr[(best + 1 + n) % n];
+  const float den = y0 - 2 * best_v + y2;
+  float frac = den < 0 ? 0.5f * (y0 - y2) / den : 0;
+  frac = std::max(-0.5f, std::min(0.5f, frac));
+  p.tdoa = (best + frac) / c_.rate;
+  p.peak = best_v / peak_norm_;
+}
+
+bool Localizer::solve(Location *loc) {
+  const double c = c_.sound_speed;
+  const int dims = dims_;
+  MicPosition centroid;
+  for (const MicPosition &m : mics_) {
+    centroid.x += m.x / devices_;
+    centroid.y += m.y / devices_;
+    centroid.z += m.z / devices_;
+  }
+
+  int used = 0;
+  for (PairDelay &p : pairs_) {
+    p.used = p.peak >= c_.min_peak;
+    used += p.used;
+  }
+  if (used < dims + 1) {
+    return false;
+  }
+
+  // Arrival times: t_a - t_b = tdoa over the pairs, mean of t pinned to 0
+  const int n = devices_;
+  std::vector<double> lap((size_t)n * n, 0), rhs(n, 0), degree(n, 0);
+  for (const PairDelay &p : pairs_) {
+    if (!p.used) {
+      continue;
+    }
+    const double w = (double)p.peak * p.peak;
+    lap[p.a * n + p.a] += w;
+    lap[p.b * n + p.b] += w;
+    lap[p.a * n + p.b] -= w;
+    lap[p.b * n + p.a] -= w;
+    rhs[p.a] += w * p.tdoa;
+    rhs[p.b] -= w * p.tdoa;
+    degree[p.a] += w;
+    degree[p.b] += w;
+  }
+  for (int i = 0; i < n; i++) {
+    for (int j = 0; j < n; j++) {
+      lap[i * n + j] += 1.0 / n;
+    }
+    lap[i * n + i] += 1e-9;
+  }
+  double s[3] = {centroid.x, centroid.y, centroid.z};
+  if (solve_linear(lap.data(), rhs.data(), n)) {
+    // closed form from the best connected mic: with u = s - p_ref and
+    // r_i = c (t_i - t_ref), 2 q_i.u + 2 r_i |u| = |q_i|^2 - r_i^2
+    int ref = (int)(std::max_element(degree.begin(), degree.end()) - degree.begin());
+    const int unknowns = dims + 1;
+    double ata[16] = {0}, atb[4] = {0};
+    int rows = 0;
+    for (int i = 0; i < n; i++) {
+      if (i == ref || degree[i] <= 0) {
+        continue;
+      }
+      const double q[3] = {mics_[i].x - mics_[ref].x, mics_[i].y - mics_[ref].y, mics_[i].z - mics_[ref].z};
+      const double r = c * (rhs[i] - rhs[ref]);
+      double row[4];
+      double qq = 0;
+      for (int k = 0; k < dims; k++) {
+        row[k] = 2 * q[k];
+        qq += q[k] * q[k];
+      }
+      row[dims] = 2 * r;
+      const double b = qq - r * r;
+      for (int j = 0; j < unknowns; j++) {
+        for (int k = 0; k < unknowns; k++) {
+          ata[j * unknowns + k] += row[j] * row[k];
+        }
+        atb[j] += row[j] * b;
+      }
+      rows++;
+    }
+    if (rows >= unknowns && solve_linear(ata, atb, unknowns)) {
+      const double ref_p[3] = {mics_[ref].x, mics_[ref].y, mics_[ref].z};
+      double guess[3] = {s[0], s[1], s[2]};
+      for (int k = 0; k < dims; k++) {
+        guess[k] = ref_p[k] + atb[k];
+      }
+      // a start wildly outside the array (over 100 apertures off) is worse
+      // than the middle
+      const double far = 100 * (1 + max_lag_ * c / c_.rate);
+      double d2 = 0;
+      for (int k = 0; k < dims; k++) {
+        const double mid[3] = {centroid.x, centroid.y, centroid.z};
+        d2 += (guess[k] - mid[k]) * (guess[k] - mid[k]);
+      }
+      if (std::isfinite(d2) && d2 < far * far) {
+        for (int k = 0; k < dims; k++) {
+          s[k] = guess[k];
+        }
+      }
+    }
+  }
+
+  // Gauss-Newton with Levenberg-Marquardt damping on the range differences
+  auto cost = [&](const double *pos, double *jtj, double *jtf) {
+    double sum = 0;
+    if (jtj) {
+      std::fill(jtj, jtj + 9, 0.0);
+      std::fill(jtf, jtf + 3, 0.0);
+    }
+    for (const PairDelay &p : pairs_) {
+      if (!p.used) {
+        continue;
+      }
+      const MicPosition &ma = mics_[p.a], &mb = mics_[p.b];
+      const double va[3] = {pos[0] - ma.x, pos[1] - ma.y, pos[2] - ma.z};
+      const double vb[3] = {pos[0] - mb.x, pos[1] - mb.y, pos[2] - mb.z};
+      const double da = std::max(1e-6, sqrt(va[0] * va[0] + va[1] * va[1] + va[2] * va[2]));
+      const double db = std::max(1e-6, sqrt(vb[0] * vb[0] + vb[1] * vb[1] + vb[2] * vb[2]));
+      const double f = da - db - c * p.tdoa;
+      const double w = (double)p.peak * p.peak;
+      sum += w * f * f;
+      if (jtj) {
+        double j[3];
+        for (int k = 0; k < dims; k++) {
+          j[k] = va[k] / da - vb[k] / db;
+        }
+        for (int r = 0; r < dims; r++) {
+          for (int k = 0; k < dims; k++) {
+            jtj[r * 3 + k] += w * j[r] * j[k];
+          }
+          jtf[r] += w * j[r] * f;
+        }
+      }
+    }
+    return sum;
+  };
+  auto refine = [&]() {
+    double lambda = 1e-3;
+    double jtj[9], jtf[3];
+    double current = cost(s, jtj, jtf);
+    for (int iter = 0; iter < 50; iter++) {
+      double a[9], step[3];
+      for (int r = 0; r < dims; r++) {
+        for (int k = 0; k < dims; k++) {
+          a[r * dims + k] = jtj[r * 3 + k] + (r == k ? lambda * (jtj[r * 3 + r] + 1e-9) : 0);
+        }
+        step[r] = -jtf[r];
+      }
+      if (!solve_linear(a, step, dims)) {
+        break;
+      }
+      double trial[3] = {s[0], s[1], s[2]};
+      double step_len = 0;
+      for (int k = 0; k < dims; k++) {
+        trial[k] += step[k];
+        step_len += step[k] * step[k];
+      }
+      const double next = cost(trial, nullptr, nullptr);
+      if (next < current) {
+        std::copy(trial, trial + 3, s);
+        current = cost(s, jtj, jtf);
+        lambda = std::max(1e-9, lambda / 3);
+        if (step_len < 1e-12) {
+          break;
+        }
+      } else {
+        lambda *= 4;
+        if (lambda > 1e9) {
+          break;
+        }
+      }
+    }
+  };
+  refine();
+
+  // drop the pairs far off the answer and go again, until none are: a
+  // reflection's delay can be well off yet still pull the first answer
+  // towards itself
+  auto residual = [&](const PairDelay &p) {
+    return distance({s[0], s[1], s[2]}, mics_[p.a]) - distance({s[0], s[1], s[2]}, mics_[p.b]) - c * p.tdoa;
+  };
+  std::vector<double> err;
+  for (int round = 0; round < 4; round++) {
+    err.clear();
+    for (const PairDelay &p : pairs_) {
+      if (p.used) {
+        err.push_back(fabs(residual(p)));
+      }
+    }
+    std::nth_element(err.begin(), err.begin() + err.size() / 2, err.end());
+    const double limit = std::max(4 * 1.4826 * err[err.size() / 2], 1.5 * c / c_.rate);
+    int dropped = 0;
+    for (PairDelay &p : pairs_) {
+      if (p.used && fabs(residual(p)) > limit) {
+        p.used = false;
+        dropped++;
+      }
+    }
+    used -= dropped;
+    if (used < dims + 1) {
+      return false;
+    }
+    if (!dropped) {
+      break;
+    }
+    refine();
+  }
+
+  double sum = 0, wsum = 0;
+  for (const PairDelay &p : pairs_) {
+    if (p.used) {
+      const double w = (double)p.peak * p.peak;
+      const double r = residual(p);
+      sum += w * r * r;
+      wsum += w;
+    }
+  }
+  loc->x = s[0];
+  loc->y = s[1];
+  loc->z = s[2];
+  loc->pairs_used = used;
+  loc->residual_m = sqrt(sum / wsum);
+  return std::isfinite(s[0]) && std::isfinite(s[1]) && std::isfinite(s[2]);
+}
+
+// ====================== Thread pool ======================
+
+void Localizer::run_stage(int stage, int count) {
+  if (pool_.empty() || count < 2) {
+    for (int i = 0; i < count; i++) {
+      stage == 0 ? transform_channel(i, 0) : correlate_pair(i, 0);
+    }
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    stage_ = stage;
+    tasks_ = count;
+    busy_ = (int)pool_.size();
+    next_.store(0);
+    generation_++;
+  }
+  start_cv_.notify_all();
+  int i;
+  while ((i = next_.fetch_add(1)) < count) {
+    stage == 0 ? transform_channel(i, 0) : correlate_pair(i, 0);
+  }
+  std::unique_lock<std::mutex> lock(mu_);
+  done_cv_.wait(lock, [&] { return busy_ == 0; });
+}
+
+void Localizer::worker_loop(int worker) {
+  uint64_t seen = 0;
+  for (;;) {
+    int stage, count;
+    {
+      std::unique_lock<std::mutex> lock(mu_);
+      start_cv_.wait(lock, [&] { return quit_ || generation_ != seen; });
+      if (quit_) {
+        return;
+      }
+      seen = generation_;
+      stage = stage_;
+      count = tasks_;
+    }
+    int i;
+    while ((i = next_.fetch_add(1)) < count) {
+      stage == 0 ? transform_channel(i, worker) : correlate_pair(i, worker);
+    }
+    std::lock_guard<std::mutex> lock(mu_);
+    if (--busy_ == 0) {
+      done_cv_.notify_one();
+    }
+  }
+}
+
+} // namespace serialmic
@@ -0,0 +1,147 @@
+// Sound source localization across several serial-mics
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "fft.h"
+#include "packet.h"
+
+namespace serialmic {
+
+// Where a microphone is, in metres, in whatever frame the answers should
+// come back in
+struct MicPosition {
+  double x = 0, y = 0, z = 0;
+};
+
+// Reads "x y z" a line (metres, '#' starts a comment), one line per channel
+// in channel order. Two numbers put the mic at z = 0.
+bool load_mic_positions(const char *path, std::vector<MicPosition> *mics);
+
+struct LocalizerConfig {
+  int rate = SAMPLE_RATE;
+  size_t fft_size = 2048; // 128ms at 16kHz
+  size_t hop = 1024;
+  double sound_speed = 343; // m/s, about 20C
+  // GCC-PHAT whitens every bin to the same weight, so bins with nothing but
+  // noise in them count as much as the rest: only this band is used
+  double low_hz = 150, high_hz = 6000;
+  int threads = 0; // 0: one per core
+  // A pair whose correlation peak is below this (1 for a perfect match) has
+  // no clear delay and is left out of the solve
+  float min_peak = 0.08f;
+  // Windows are only located when the level is this far over the running
+  // noise floor; 0 locates every window
+  double event_db = 6;
+  // 2 solves in the plane of the mics (z fixed at their mean height), 3 in
+  // space. 0 picks 2 when the mics are all at one height.
+  int dims = 0;
+};
+
+// The delay between one pair of channels in the last window
+struct PairDelay {
+  int a = 0, b = 0;
+  float tdoa = 0; // seconds the sound reached a after b (negative: before)
+  float peak = 0; // the normalized GCC-PHAT peak, 0-1
+  bool used = false; // made it into the solve
+};
+
+struct Location {
+  uint64_t window = 0;
+  double time = 0;           // the window's middle, seconds from the first sample
+  double level_db = 0;       // mean over channels, dBFS
+  double above_floor_db = 0; // against the running noise floor
+  bool event = false;        // loud enough to locate
+  bool solved = false;
+  double x = 0, y = 0, z = 0;
+  double residual_m = 0; // rms range difference error over the pairs used
+  int pairs_used = 0;
+};
+
+// Every hop, each channel's window is transformed and whitened (divided by
+// its own magnitude, band limited) once; every pair's cross spectrum is then
+// one complex multiply of the two, and its inverse FFT the GCC-PHAT
+// correlation. The peak within the lags the array can physically give,
+// interpolated between samples, is that pair's delay. Channels and then
+// pairs are shared out to a pool of threads that sleeps between windows.
+//
+// The position is solved from all the pairs' delays at once: delays are
+// first reconciled into one arrival time per mic (least squares over the
+// pairs, so one bad pair is outvoted), which gives a closed form start;
+// Gauss-Newton on the pairs' range differences, weighted by their peaks,
+// then refines it, and pairs left far off the answer are dropped and it's
+// solved again.
+//
+// Channels must already be time aligned - the output of Aggregator, or a
+// file from serialmic_aggregate.
+class Localizer {
+public:
+  Localizer(const std::vector<MicPosition> &mics, const LocalizerConfig &config);
+  ~Localizer();
+  Localizer(const Localizer &) = delete;
+  Localizer &operator=(const Localizer &) = delete;
+
+  int devices() const { return devices_; }
+  int pairs() const { return (int)pairs_.size(); }
+  int threads() const { return threads_; }
+  int dims() const { return dims_; }
+  // The largest delay the array can give, in samples
+  int max_lag() const { return max_lag_; }
+  const LocalizerConfig &config() const { return c_; }
+
+  // `frames` interleaved frames of devices() channels. A Location is
+  // appended to `out` for every window completed, located or not.
+  void push(const int16_t *interleaved, size_t frames, std::vector<Location> *out);
+  // The pairs as of the last located window
+  const std::vector<PairDelay> &last_pairs() const { return pairs_; }
+
+private:
+  void process_window(Location *loc);
+  void transform_channel(int dev, int worker);
+  void correlate_pair(int pair, int worker);
+  bool solve(Location *loc);
+  void run_stage(int stage, int count);
+  void worker_loop(int worker);
+
+  LocalizerConfig c_;
+  int devices_, dims_, threads_;
+  std::vector<MicPosition> mics_;
+  RealFft fft_;
+  std::vector<float> window_;
+  size_t bins_, band_lo_, band_hi_;
+  int max_lag_;
+  float peak_norm_;
+
+  std::vector<float> input_; // devices_ x fft_size, planar
+  size_t fill_ = 0;
+  uint64_t windows_ = 0;
+  double floor_db_ = 0;
+  bool have_floor_ = false;
+
+  std::vector<float> spec_re_, spec_im_; // devices_ x bins_, whitened
+  std::vector<double> energy_;           // per device
+  std::vector<PairDelay> pairs_;
+
+  struct Scratch {
+    std::vector<float> buf, re, im, half_re, half_im, corr;
+  };
+  std::vector<Scratch> scratch_; // per worker
+
+  // the pool: workers wait for generation_ to move, then take tasks of
+  // stage_ from next_ until there are none
+  std::vector<std::thread> pool_;
+  std::mutex mu_;
+  std::condition_variable start_cv_, done_cv_;
+  uint64_t generation_ = 0;
+  int stage_ = 0, tasks_ = 0, busy_ = 0;
+  bool quit_ = false;
+  std::atomic<int> next_{0};
+};
+
+} // namespace serialmic
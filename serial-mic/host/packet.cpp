@@ -0,0 +1,50 @@
+#include "packet.h"
+
+namespace serialmic {
+
+// ====================== CRC-16/CCITT ======================
+// Byte at a time from a table, about 8x the bit loop in the firmware
+namespace {
+struct CrcTable {
+  uint16_t entry[256];
+  CrcTable() {
+    for (int i = 0; i < 256; i++) {
+      uint16_t crc = (uint16_t)(i << 8);
+      for (int b = 0; b < 8; b++) {
+        crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+      }
+      entry[i] = crc;
+    }
+  }
+};
+const CrcTable crc_table;
+} // namespace
+
+uint16_t crc16_ccitt(const uint8_t *data, size_t len, uint16_t crc) {
+  for (size_t i = 0; i < len; i++) {
+    crc = (uint16_t)((crc << 8) ^ crc_table.entry[(crc >> 8) ^ data[i]]);
+  }
+  return crc;
+}
+
+// ====================== Framing ======================
+size_t encode_packet(uint8_t *out, uint32_t seq, uint32_t usec, const int16_t *pcm, size_t samples,
+                     bool crc) {
+  const uint16_t payload_len = (uint16_t)(samples * 2);
+  uint8_t *p = out;
+  *p++ = PKT_SYNC;
+  le_write16(p, payload_len);
+  p += 2;
+  le_write32(p, seq);
+  p += 4;
+  le_write32(p, usec);
+  p += 4;
+  for (size_t i = 0; i < samples; i++) {
+    le_write16(p, (uint16_t)pcm[i]);
+    p += 2;
+  }
+  le_write16(p, crc ? crc16_ccitt(out, PKT_HEADER_LEN + payload_len) : 0);
+  return PKT_OVERHEAD + payload_len;
+}
+
+} // namespace serialmic
@@ -0,0 +1,236 @@
+// serial-mic packet framing for the host tools
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <utility>
+
+// Matches src/main.cpp:
+//   [0xA6][uint16 len][uint32 seq][uint32 usec][payload bytes][uint16 crc]
+// everything little-endian, payload PCM16 mono, CRC-16/CCITT (0x1021, init
+// 0xFFFF, no XORout) over the header and payload.
+namespace serialmic {
+
+constexpr uint8_t PKT_SYNC = 0xA6;
+constexpr size_t PKT_HEADER_LEN = 1 + 2 + 4 + 4; // sync + length + seq + usec
+constexpr size_t PKT_TRAILER_LEN = 2;            // crc16
+constexpr size_t PKT_OVERHEAD = PKT_HEADER_LEN + PKT_TRAILER_LEN;
+// A clock sync reply (clock_sync.h) is framed like a packet with this sync
+// byte and a 4 byte payload
+constexpr uint8_t PKT_SYNC_REPLY = 0xA7;
+constexpr size_t SYNC_REPLY_PAYLOAD_BYTES = 4;
+// So is a sound level meter's band levels (slm.h), with at least this much
+// payload
+constexpr uint8_t PKT_LEVELS = 0xA8;
+constexpr size_t LEVELS_MIN_PAYLOAD_BYTES = 12;
+constexpr int SAMPLE_RATE = 16000;
+constexpr size_t SAMPLES_PER_PACKET = 1024; // SAMPLE_BUFFER_SIZE
+// Longest payload the parser accepts. The firmware sends 2048 bytes; a
+// "length" much bigger than that is noise after a false sync byte, and
+// waiting for 64K of it would stall the stream.
+constexpr size_t MAX_PAYLOAD_BYTES = 8192;
+constexpr size_t MAX_PKT_BYTES = PKT_OVERHEAD + MAX_PAYLOAD_BYTES;
+// Bytes per second one device puts on the wire
+constexpr double DEVICE_BYTES_PER_SEC =
+    (PKT_OVERHEAD + SAMPLES_PER_PACKET * 2) * (double)SAMPLE_RATE / SAMPLES_PER_PACKET;
+
+uint16_t crc16_ccitt(const uint8_t *data, size_t len, uint16_t crc = 0xFFFF);
+
+inline uint16_t le_read16(const uint8_t *p) { return (uint16_t)(p[0] | (p[1] << 8)); }
+inline uint32_t le_read32(const uint8_t *p) {
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+inline void le_write16(uint8_t *p, uint16_t v) {
+  p[0] = (uint8_t)v;
+  p[1] = (uint8_t)(v >> 8);
+}
+inline void le_write32(uint8_t *p, uint32_t v) {
+  p[0] = (uint8_t)v;
+  p[1] = (uint8_t)(v >> 8);
+  p[2] = (uint8_t)(v >> 16);
+  p[3] = (uint8_t)(v >> 24);
+}
+
+// A decoded packet. `payload` points into the parser's buffer and is only
+// valid during the callback.
+struct Packet {
+  uint32_t seq;
+  uint32_t usec;
+  const uint8_t *payload; // PCM16 little-endian
+  uint16_t payload_len;
+  uint64_t offset; // of the sync byte in the stream
+
+  size_t samples() const { return payload_len / 2; }
+  // Copies the samples out (the payload may be unaligned)
+  void read_pcm(int16_t *out) const {
+    for (size_t i = 0; i < samples(); i++) {
+      out[i] = (int16_t)le_read16(payload + 2 * i);
+    }
+  }
+};
+
+// Frames `samples` PCM16 samples the way i2s_reader_task does. `out` needs
+// PKT_OVERHEAD + 2 * samples bytes. Returns the packet length.
+size_t encode_packet(uint8_t *out, uint32_t seq, uint32_t usec, const int16_t *pcm, size_t samples,
+                     bool crc = true);
+
+// Packets lost between the one expected and the one that arrived. Negative
+// means it went backwards: a duplicate, a late packet or the device
+// restarting.
+inline int32_t seq_gap(uint32_t expected, uint32_t seq) { return (int32_t)(seq - expected); }
+
+struct ParserStats {
+  uint64_t bytes = 0;         // fed in
+  uint64_t packets = 0;       // delivered
+  uint64_t crc_errors = 0;    // framed packets whose CRC didn't match
+  uint64_t skipped_bytes = 0; // passed over looking for a sync byte
+  uint64_t sync_replies = 0;  // delivered to on_sync_reply
+  uint64_t band_levels = 0;   // delivered to on_band_levels
+};
+
+// Whether a parser handler takes clock sync replies
+template <class H, class = void> struct WantsSyncReplies : std::false_type {};
+template <class H>
+struct WantsSyncReplies<H, std::void_t<decltype(std::declval<H &>().on_sync_reply(std::declval<const Packet &>()))>>
+    : std::true_type {};
+
+// And band level packets
+template <class H, class = void> struct WantsBandLevels : std::false_type {};
+template <class H>
+struct WantsBandLevels<H, std::void_t<decltype(std::declval<H &>().on_band_levels(std::declval<const Packet &>()))>>
+    : std::true_type {};
+
+// Finds packets in a byte stream, like the frontend's PacketParser but with
+// a fixed buffer: no allocation per packet or per read, and a packet is
+// delivered straight from the buffer without a copy.
+//
+// On a bad CRC it resyncs one byte on, so a corrupt packet costs only
+// itself. The handler is anything with
+//   void on_packet(const Packet &);
+//   void on_crc_error(uint64_t offset); // offset of the sync byte
+// and, if it wants clock sync replies or band levels rather than having
+// them skipped,
+//   void on_sync_reply(const Packet &);  // seq the id, see read_sync_reply
+//   void on_band_levels(const Packet &); // see read_band_levels
+class PacketParser {
+public:
+  explicit PacketParser(bool verify_crc = true) : verify_crc_(verify_crc) {}
+
+  template <class Handler> void feed(const uint8_t *data, size_t len, Handler &handler) {
+    stats_.bytes += len;
+    while (len > 0) {
+      size_t n = sizeof(buf_) - fill_;
+      if (n > len) {
+        n = len;
+      }
+      memcpy(buf_ + fill_, data, n);
+      fill_ += n;
+      data += n;
+      len -= n;
+      parse(handler);
+    }
+  }
+
+  // Forget any partial packet, e.g. after reopening the port
+  void reset() {
+    base_ += fill_;
+    fill_ = 0;
+  }
+
+  void set_verify_crc(bool on) { verify_crc_ = on; }
+
+  const ParserStats &stats() const { return stats_; }
+
+private:
+  template <class Handler> void parse(Handler &handler) {
+    constexpr bool replies = WantsSyncReplies<Handler>::value;
+    constexpr bool levels = WantsBandLevels<Handler>::value;
+    auto wanted = [](uint8_t b) {
+      return b == PKT_SYNC || (replies && b == PKT_SYNC_REPLY) || (levels && b == PKT_LEVELS);
+    };
+    size_t i = 0;
+    while (fill_ - i >= PKT_OVERHEAD) {
+      const uint8_t sync = buf_[i];
+      if (!wanted(sync)) {
+        size_t next;
+        if (replies || levels) {
+          next = i + 1;
+          while (next < fill_ && !wanted(buf_[next])) {
+            next++;
+          }
+        } else {
+          const void *found = memchr(buf_ + i, PKT_SYNC, fill_ - i);
+          next = found ? (size_t)((const uint8_t *)found - buf_) : fill_;
+        }
+        stats_.skipped_bytes += next - i;
+        i = next;
+        continue;
+      }
+      const uint16_t payload_len = le_read16(buf_ + i + 1);
+      if (payload_len > MAX_PAYLOAD_BYTES || (payload_len & 1) ||
+          (sync == PKT_SYNC_REPLY && payload_len != SYNC_REPLY_PAYLOAD_BYTES) ||
+          (sync == PKT_LEVELS && payload_len < LEVELS_MIN_PAYLOAD_BYTES)) {
+        stats_.skipped_bytes++;
+        i++;
+        continue;
+      }
+      const size_t total = PKT_OVERHEAD + payload_len;
+      if (fill_ - i < total) {
+        break;
+      }
+      const uint8_t *p = buf_ + i;
+      if (verify_crc_) {
+        const uint16_t crc = le_read16(p + PKT_HEADER_LEN + payload_len);
+        if (crc16_ccitt(p, PKT_HEADER_LEN + payload_len) != crc) {
+          stats_.crc_errors++;
+          stats_.skipped_bytes++;
+          handler.on_crc_error(base_ + i);
+          i++;
+          continue;
+        }
+      }
+      Packet pkt;
+      pkt.seq = le_read32(p + 3);
+      pkt.usec = le_read32(p + 7);
+      pkt.payload = p + PKT_HEADER_LEN;
+      pkt.payload_len = payload_len;
+      pkt.offset = base_ + i;
+      if constexpr (replies) {
+        if (sync == PKT_SYNC_REPLY) {
+          stats_.sync_replies++;
+          handler.on_sync_reply(pkt);
+          i += total;
+          continue;
+        }
+      }
+      if constexpr (levels) {
+        if (sync == PKT_LEVELS) {
+          stats_.band_levels++;
+          handler.on_band_levels(pkt);
+          i += total;
+          continue;
+        }
+      }
+      stats_.packets++;
+      handler.on_packet(pkt);
+      i += total;
+    }
+    // keep the partial packet at the front
+    if (i > 0) {
+      memmove(buf_, buf_ + i, fill_ - i);
+      fill_ -= i;
+      base_ += i;
+    }
+  }
+
+  bool verify_crc_;
+  // room for a partial packet plus a good sized read
+  uint8_t buf_[MAX_PKT_BYTES + 64 * 1024];
+  size_t fill_ = 0;
+  uint64_t base_ = 0; // stream offset of buf_[0]
+  ParserStats stats_;
+};
+
+} // namespace serialmic
@@ -0,0 +1,132 @@
+#include "png_writer.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+
+namespace serialmic {
+
+namespace {
+
+struct Crc32Table {
+  uint32_t t[256];
+  Crc32Table() {
+    for (uint32_t i = 0; i < 256; i++) {
+      uint32_t c = i;
+      for (int k = 0; k < 8; k++) {
+        c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+      }
+      t[i] = c;
+    }
+  }
+};
+const Crc32Table crc_table;
+
+void be_write32(uint8_t *p, uint32_t v) {
+  p[0] = (uint8_t)(v >> 24);
+  p[1] = (uint8_t)(v >> 16);
+  p[2] = (uint8_t)(v >> 8);
+  p[3] = (uint8_t)v;
+}
+
+// length, type, data, CRC of type and data
+void put_chunk(std::vector<uint8_t> &out, const char *type, const uint8_t *data, size_t len) {
+  const size_t at = out.size();
+  out.resize(at + 12 + len);
+  uint8_t *p = out.data() + at;
+  be_write32(p, (uint32_t)len);
+  memcpy(p + 4, type, 4);
+  if (len > 0) {
+    memcpy(p + 8, data, len);
+  }
+  be_write32(p + 8 + len, crc32(p + 4, 4 + len));
+}
+
+} // namespace
+
+uint32_t crc32(const uint8_t *data, size_t len, uint32_t crc) {
+  crc = ~crc;
+  for (size_t i = 0; i < len; i++) {
+    crc = crc_table.t[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+  }
+  return ~crc;
+}
+
+bool write_png_indexed(const char *path, const uint8_t *pixels, int width, int height, const uint8_t *palette) {
+  std::vector<uint8_t> out;
+  const size_t raw_len = (size_t)(width + 1) * height; // a filter byte per row
+  out.reserve(64 + 768 + raw_len + raw_len / 65535 * 5 + 64);
+  static const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+  out.insert(out.end(), signature, signature + 8);
+
+  uint8_t ihdr[13];
+  be_write32(ihdr, (uint32_t)width);
+  be_write32(ihdr + 4, (uint32_t)height);
+  ihdr[8] = 8;  // bits
+  ihdr[9] = 3;  // palette
+  ihdr[10] = 0; // deflate
+  ihdr[11] = 0; // adaptive filtering (every row "none")
+  ihdr[12] = 0; // not interlaced
+  put_chunk(out, "IHDR", ihdr, sizeof(ihdr));
+  put_chunk(out, "PLTE", palette, 768);
+
+  // the rows, each after a filter byte of 0 (none)
+  std::vector<uint8_t> raw(raw_len);
+  for (int y = 0; y < height; y++) {
+    uint8_t *row = raw.data() + (size_t)y * (width + 1);
+    row[0] = 0;
+    memcpy(row + 1, pixels + (size_t)y * width, (size_t)width);
+  }
+  // zlib stream: header, stored blocks of up to 65535 bytes, Adler-32
+  std::vector<uint8_t> z;
+  z.reserve(2 + raw_len + (raw_len / 65535 + 1) * 5 + 4);
+  z.push_back(0x78);
+  z.push_back(0x01);
+  for (size_t at = 0; at < raw_len || at == 0;) {
+    const size_t n = raw_len - at < 65535 ? raw_len - at : 65535;
+    z.push_back(at + n == raw_len ? 1 : 0); // BFINAL, BTYPE 00
+    z.push_back((uint8_t)n);
+    z.push_back((uint8_t)(n >> 8));
+    z.push_back((uint8_t)~n);
+    z.push_back((uint8_t)(~n >> 8));
+    z.insert(z.end(), raw.begin() + at, raw.begin() + at + n);
+    at += n;
+    if (n == 0) {
+      break;
+    }
+  }
+  uint32_t a = 1, b = 0;
+  for (size_t at = 0; at < raw_len;) {
+    // 5552 bytes is the most that can't overflow before the modulo
+    const size_t end = raw_len - at < 5552 ? raw_len : at + 5552;
+    for (; at < end; at++) {
+      a += raw[at];
+      b += a;
+    }
+    a %= 65521;
+    b %= 65521;
+  }
+  const uint32_t adler = (b << 16) | a;
+  z.push_back((uint8_t)(adler >> 24));
+  z.push_back((uint8_t)(adler >> 16));
+  z.push_back((uint8_t)(adler >> 8));
+  z.push_back((uint8_t)adler);
+  put_chunk(out, "IDAT", z.data(), z.size());
+  put_chunk(out, "IEND", nullptr, 0);
+
+  FILE *f = fopen(path, "wb");
+  if (!f) {
+    fprintf(stderr, "can't create %s: %s\n", path, strerror(errno));
+    return false;
+  }
+  const bool ok = fwrite(out.data(), 1, out.size(), f) == out.size();
+  if (fclose(f) != 0 || !ok) {
+    fprintf(stderr, "can't write %s\n", path);
+    return false;
+  }
+  return true;
+}
+
+} // namespace serialmic
@@ -0,0 +1,17 @@
+// Minimal PNG output for the batch tools
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace serialmic {
+
+// Writes an 8 bit palette image (`palette` is 256 RGB triples, `pixels` one
+// index per pixel, rows top to bottom). The image data goes in stored
+// (uncompressed) deflate blocks: no zlib needed, and writing costs little
+// more than the copy. Returns false with a message on stderr.
+bool write_png_indexed(const char *path, const uint8_t *pixels, int width, int height, const uint8_t *palette);
+
+uint32_t crc32(const uint8_t *data, size_t len, uint32_t crc = 0);
+
+} // namespace serialmic
@@ -0,0 +1,145 @@
+#include "recorder.h"
+
+#include <cinttypes>
+
+#if __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "payloads go into the WAV as they are, which needs a little-endian host"
+#endif
+
+namespace serialmic {
+
+// A seq this far behind the one expected is a late packet, further back the
+// device has restarted
+#define LATE_WINDOW 64
+
+Recorder::Recorder(const RecorderConfig &config)
+    : config_(config), parser_(config.verify_crc), out_(config.block_bytes, config.blocks), wav_(out_) {
+  roll_samples_ = (uint64_t)(config.roll_seconds * config.sample_rate);
+  max_fill_samples_ = (uint64_t)(config.max_fill_seconds * config.sample_rate);
+  checkpoint_samples_ = (uint64_t)(config.checkpoint_seconds * config.sample_rate);
+}
+
+Recorder::~Recorder() { finish(); }
+
+bool Recorder::start() { return open_file(); }
+
+bool Recorder::open_file() {
+  char path[1024];
+  snprintf(path, sizeof(path), "%s-%04d.wav", config_.prefix.c_str(), stats_.files + 1);
+  if (!wav_.open(path, config_.sample_rate, 1, 16)) {
+    failed_ = true;
+    return false;
+  }
+  snprintf(path, sizeof(path), "%s-%04d.gaps.csv", config_.prefix.c_str(), stats_.files + 1);
+  gaps_ = fopen(path, "w");
+  if (!gaps_) {
+    perror(path);
+    wav_.close();
+    failed_ = true;
+    return false;
+  }
+  setvbuf(gaps_, gaps_buf_, _IOFBF, sizeof(gaps_buf_));
+  fprintf(gaps_, "event,sample,seq,usec,count,offset\n");
+  stats_.files++;
+  file_started_ = false;
+  next_checkpoint_ = checkpoint_samples_;
+  return true;
+}
+
+void Recorder::close_file() {
+  if (gaps_) {
+    fclose(gaps_);
+    gaps_ = nullptr;
+  }
+  wav_.close();
+}
+
+bool Recorder::roll() {
+  close_file();
+  return open_file();
+}
+
+void Recorder::finish() {
+  close_file();
+  out_.flush();
+}
+
+void Recorder::log(const char *event, uint32_t seq, uint32_t usec, int64_t count, uint64_t offset) {
+  if (gaps_) {
+    fprintf(gaps_, "%s,%" PRIu64 ",%" PRIu32 ",%" PRIu32 ",%" PRId64 ",%" PRIu64 "\n", event, wav_.frames(),
+            seq, usec, count, offset);
+  }
+}
+
+void Recorder::note(const char *what) {
+  if (gaps_) {
+    fprintf(gaps_, "note,%" PRIu64 ",%" PRIu32 ",%" PRIu32 ",%s,%" PRIu64 "\n", wav_.frames(),
+            expected_seq_ - 1, last_usec_, what, parser_.stats().bytes);
+  }
+}
+
+void Recorder::on_crc_error(uint64_t offset) {
+  stats_.crc_errors++;
+  log("crc", expected_seq_ - 1, last_usec_, 1, offset);
+}
+
+void Recorder::on_packet(const Packet &pkt) {
+  if (!wav_.is_open()) {
+    return;
+  }
+  stats_.packets++;
+  int64_t lost = 0;
+  if (have_seq_) {
+    const int32_t gap = seq_gap(expected_seq_, pkt.seq);
+    if (gap < 0 && gap >= -LATE_WINDOW) {
+      stats_.late_packets++;
+      log("late", pkt.seq, pkt.usec, gap, pkt.offset);
+      return;
+    }
+    if (gap < 0) {
+      stats_.restarts++;
+      log("restart", pkt.seq, pkt.usec, 0, pkt.offset);
+    } else {
+      lost = gap;
+    }
+  }
+  have_seq_ = true;
+  expected_seq_ = pkt.seq + 1;
+  last_usec_ = pkt.usec;
+
+  if (file_started_ && ((roll_samples_ && wav_.frames() >= roll_samples_) ||
+                        (config_.roll_bytes && wav_.data_bytes() >= config_.roll_bytes))) {
+    if (!roll()) {
+      return;
+    }
+  }
+
+  if (lost > 0) {
+    stats_.lost_packets += lost;
+    stats_.gaps++;
+  }
+  if (!file_started_) {
+    // a gap across a roll goes in the new file's start line, not as silence
+    log("start", pkt.seq, pkt.usec, lost, pkt.offset);
+    file_started_ = true;
+  } else if (lost > 0) {
+    log("gap", pkt.seq, pkt.usec, lost, pkt.offset);
+    const uint64_t fill = (uint64_t)lost * pkt.samples();
+    if (config_.fill_gaps && fill <= max_fill_samples_) {
+      wav_.write_silence(fill * 2);
+      stats_.silence_samples += fill;
+      stats_.samples += fill;
+    }
+  }
+
+  wav_.write(pkt.payload, pkt.payload_len);
+  stats_.samples += pkt.samples();
+
+  if (checkpoint_samples_ && wav_.frames() >= next_checkpoint_) {
+    wav_.checkpoint();
+    fflush(gaps_);
+    next_checkpoint_ = wav_.frames() + checkpoint_samples_;
+  }
+}
+
+} // namespace serialmic
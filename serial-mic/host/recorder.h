@@ -0,0 +1,101 @@
+// serial-mic stream to rolling WAV/RF64 files with gap logs
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+#include "block_writer.h"
+#include "packet.h"
+#include "wav_writer.h"
+
+namespace serialmic {
+
+struct RecorderConfig {
+  std::string prefix = "capture"; // files are <prefix>-0001.wav, ...
+  int sample_rate = SAMPLE_RATE;
+  double roll_seconds = 0;  // start a new file after this much audio (0 never)
+  uint64_t roll_bytes = 0;  // ... or this much data (0 never)
+  bool verify_crc = true;   // off for firmware built with USE_CRC 0
+  bool fill_gaps = true;    // write silence for lost packets
+  double max_fill_seconds = 10; // longer gaps are only logged
+  double checkpoint_seconds = 10; // header and gap log brought up to date
+  size_t block_bytes = 1 << 20;
+  int blocks = 4;
+};
+
+struct RecorderStats {
+  uint64_t packets = 0;
+  uint64_t lost_packets = 0;   // from seq gaps
+  uint64_t gaps = 0;
+  uint64_t late_packets = 0;   // seq went back a little - dropped
+  uint64_t restarts = 0;       // seq went back a lot - the device restarted
+  uint64_t crc_errors = 0;
+  uint64_t samples = 0;        // written, silence included
+  uint64_t silence_samples = 0;
+  int files = 0;
+};
+
+// Everything lands in a fixed set of buffers: the parser's, the writer's
+// blocks and stdio's for the gap log, so memory stays the same however long
+// it runs and nothing is allocated per packet.
+//
+// Each WAV has a <prefix>-NNNN.gaps.csv next to it:
+//   event,sample,seq,usec,count,offset
+// with `sample` the position in that WAV and `offset` the byte in the input
+// stream. Events are
+//   start    first packet in the file (count = packets lost before it)
+//   gap      `count` packets missing before this one (filled with silence
+//            unless it was longer than max_fill_seconds)
+//   late     a packet older than the last one, dropped
+//   restart  seq went back to the start, the device was reset
+//   crc      a packet failed its CRC (seq/usec are the last good packet's)
+//   note     something from outside, e.g. the port reopened (in `count`)
+class Recorder {
+public:
+  explicit Recorder(const RecorderConfig &config);
+  ~Recorder();
+
+  // Opens the first file. Returns false if it can't.
+  bool start();
+  // Bytes as they come from the port
+  void feed(const uint8_t *data, size_t len) { parser_.feed(data, len, *this); }
+  // Closes the current file and starts the next
+  bool roll();
+  void note(const char *what);
+  // Closes the files and waits for them to reach the disk
+  void finish();
+
+  const RecorderStats &stats() const { return stats_; }
+  const ParserStats &parser_stats() const { return parser_.stats(); }
+  const BlockWriter &writer() const { return out_; }
+  bool failed() const { return failed_ || out_.failed(); }
+
+  // PacketParser handler
+  void on_packet(const Packet &pkt);
+  void on_crc_error(uint64_t offset);
+
+private:
+  bool open_file();
+  void close_file();
+  void log(const char *event, uint32_t seq, uint32_t usec, int64_t count, uint64_t offset);
+
+  RecorderConfig config_;
+  PacketParser parser_;
+  BlockWriter out_;
+  WavWriter wav_;
+  FILE *gaps_ = nullptr;
+  char gaps_buf_[16 * 1024];
+  RecorderStats stats_;
+  bool failed_ = false;
+  bool have_seq_ = false;
+  bool file_started_ = false; // a packet has gone into the current file
+  uint32_t expected_seq_ = 0;
+  uint32_t last_usec_ = 0;
+  uint64_t roll_samples_ = 0;
+  uint64_t max_fill_samples_ = 0;
+  uint64_t checkpoint_samples_ = 0;
+  uint64_t next_checkpoint_ = 0;
+};
+
+} // namespace serialmic
@@ -0,0 +1,43 @@
+#include "serial_port.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <unistd.h>
+
+namespace serialmic {
+
+int open_stream(const char *path, bool *is_tty, bool read_write) {
+  const int mode = read_write ? O_RDWR : O_RDONLY;
+  int fd = strcmp(path, "-") == 0 ? dup(STDIN_FILENO) : open(path, mode | O_NOCTTY | O_CLOEXEC);
+  if (fd < 0) {
+    fprintf(stderr, "can't open %s: %s\n", path, strerror(errno));
+    return -1;
+  }
+  const bool tty = isatty(fd);
+  if (is_tty) {
+    *is_tty = tty;
+  }
+  if (tty) {
+    // USB CDC ignores the baud rate, but nothing may touch the bytes
+    struct termios t;
+    if (tcgetattr(fd, &t) == 0) {
+      cfmakeraw(&t);
+      cfsetspeed(&t, B115200);
+      t.c_cflag |= CLOCAL | CREAD;
+      t.c_cc[VMIN] = 1;
+      t.c_cc[VTIME] = 0;
+      tcsetattr(fd, TCSANOW, &t);
+    }
+    // some CDC stacks send BREAK when DTR is deasserted
+    int dtr = TIOCM_DTR;
+    ioctl(fd, TIOCMBIS, &dtr);
+    tcflush(fd, TCIFLUSH);
+  }
+  return fd;
+}
+
+} // namespace serialmic
@@ -0,0 +1,12 @@
+// Opening the serial-mic stream: a CDC tty, a capture file or stdin
+#pragma once
+
+namespace serialmic {
+
+// Opens `path` for reading ("-" is stdin). A tty is put in raw mode with DTR
+// asserted, as the frontend does. Returns the fd, or -1 with a message on
+// stderr. `is_tty` says which it was. `read_write` opens it for writing too,
+// for what the host sends the board (clock sync requests).
+int open_stream(const char *path, bool *is_tty = nullptr, bool read_write = false);
+
+} // namespace serialmic
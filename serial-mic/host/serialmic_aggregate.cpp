@@ -0,0 +1,159 @@
+// serial-mic aggregator
+//
+// Records several serial-mics at once as one multichannel stream, channel N
+// from the Nth port, all resampled onto the host's clock so the channels
+// stay lined up however far the boards' crystals drift. See aggregator.h.
+//
+//   serialmic_aggregate /dev/ttyACM0 /dev/ttyACM1 /dev/ttyACM2 --out room.wav
+//   serialmic_aggregate /dev/ttyACM0 /dev/ttyACM1 --out - | sox -t raw -r 16k -e signed -b 16 -c 2 - ...
+//
+// Runs until Ctrl-C (or --seconds).
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <unistd.h>
+#include <vector>
+
+#include "aggregator.h"
+#include "block_writer.h"
+#include "wav_writer.h"
+
+using namespace serialmic;
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void on_signal(int) { stop_requested = 1; }
+
+static void usage(void) {
+  fprintf(stderr, "usage: serialmic_aggregate <tty> <tty> ... --out FILE.wav|- [--latency-ms N]\n"
+                  "                           [--rate HZ] [--seconds N] [--no-crc] [--quiet]\n");
+  exit(1);
+}
+
+static void print_status(const Aggregator &agg, const std::vector<std::unique_ptr<DeviceReader>> &readers,
+                         double seconds) {
+  fprintf(stderr, "%.1f s\n", seconds);
+  for (int i = 0; i < agg.devices(); i++) {
+    const DeviceClock &clock = agg.clock(i);
+    const ChannelStats &s = agg.stats(i);
+    if (!clock.ready()) {
+      fprintf(stderr, "  %d %s: waiting\n", i, readers[i]->path().c_str());
+      continue;
+    }
+    fprintf(stderr,
+            "  %d %s: %+.1f ppm, %.2f Hz, packets %llu lost %llu late %llu crc %llu overflow %llu starved %llu\n",
+            i, readers[i]->path().c_str(), clock.drift_ppm(), clock.device_rate(),
+            (unsigned long long)s.packets, (unsigned long long)s.lost_packets,
+            (unsigned long long)s.late_packets, (unsigned long long)readers[i]->crc_errors(),
+            (unsigned long long)readers[i]->overflows(), (unsigned long long)s.starved);
+  }
+}
+
+int main(int argc, char **argv) {
+  std::vector<const char *> inputs;
+  const char *out_path = nullptr;
+  double latency_ms = 300;
+  double seconds = 0;
+  int rate = SAMPLE_RATE;
+  bool verify_crc = true;
+  bool quiet = false;
+
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    if (arg[0] != '-') {
+      inputs.push_back(arg);
+      continue;
+    }
+    if (!strcmp(arg, "--no-crc")) {
+      verify_crc = false;
+      continue;
+    }
+    if (!strcmp(arg, "--quiet")) {
+      quiet = true;
+      continue;
+    }
+    const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+    if (!value) {
+      usage();
+    }
+    i++;
+    if (!strcmp(arg, "--out")) {
+      out_path = value;
+    } else if (!strcmp(arg, "--latency-ms")) {
+      latency_ms = atof(value);
+    } else if (!strcmp(arg, "--rate")) {
+      rate = atoi(value);
+    } else if (!strcmp(arg, "--seconds")) {
+      seconds = atof(value);
+    } else {
+      usage();
+    }
+  }
+  if (inputs.empty() || !out_path || rate <= 0) {
+    usage();
+  }
+  const int devices = (int)inputs.size();
+
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = on_signal;
+  sigaction(SIGINT, &sa, nullptr);
+  sigaction(SIGTERM, &sa, nullptr);
+
+  BlockWriter out(1 << 20, 4);
+  WavWriter wav(out);
+  const bool to_stdout = !strcmp(out_path, "-");
+  if (!to_stdout && !wav.open(out_path, rate, devices, 16)) {
+    return 1;
+  }
+
+  Aggregator agg(devices, rate, latency_ms);
+  std::vector<std::unique_ptr<DeviceReader>> readers;
+  for (int i = 0; i < devices; i++) {
+    readers.emplace_back(new DeviceReader(inputs[i], agg.ring(i), verify_crc));
+    readers.back()->start();
+  }
+
+  std::vector<int16_t> buf((size_t)Aggregator::BLOCK * 16 * devices);
+  const double start = monotonic_us();
+  double next_status = start + 5e6;
+  double next_checkpoint = start + 10e6;
+  while (!stop_requested) {
+    usleep(10 * 1000);
+    const double now = monotonic_us();
+    size_t n;
+    while ((n = agg.render(now, buf.data(), buf.size() / devices)) > 0) {
+      const size_t bytes = n * devices * sizeof(int16_t);
+      if (to_stdout) {
+        if (fwrite(buf.data(), 1, bytes, stdout) != bytes) {
+          stop_requested = 1;
+          break;
+        }
+      } else {
+        wav.write(buf.data(), bytes);
+      }
+    }
+    if (!to_stdout && now >= next_checkpoint) {
+      wav.checkpoint();
+      next_checkpoint = now + 10e6;
+    }
+    if (!quiet && now >= next_status) {
+      print_status(agg, readers, (now - start) / 1e6);
+      next_status = now + 5e6;
+    }
+    if (seconds > 0 && now - start >= seconds * 1e6) {
+      break;
+    }
+  }
+  for (auto &reader : readers) {
+    reader->stop();
+  }
+  wav.close();
+  out.flush();
+  if (!quiet) {
+    print_status(agg, readers, (monotonic_us() - start) / 1e6);
+  }
+  return out.failed() ? 1 : 0;
+}
@@ -0,0 +1,234 @@
+// serial-mic WebSocket bridge
+//
+// Owns the port, decodes the packets and does the frontend's analysis on
+// them natively (live_analysis.h), then serves a compact frame per packet
+// to pages on this machine over a WebSocket. The page only has to draw
+// them: pick "Bridge" as the source.
+//
+//   serialmic_bridge /dev/ttyACM0                 # ws://127.0.0.1:8765
+//   serialmic_emulate --tone 440 --out - | serialmic_bridge - --port 9000
+//
+// Only localhost pages may connect unless --allow-origin says otherwise.
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <poll.h>
+#include <unistd.h>
+#include <vector>
+
+#include "live_analysis.h"
+#include "serial_port.h"
+#include "shm_ring.h"
+#include "ws_server.h"
+
+using namespace serialmic;
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void on_signal(int) { stop_requested = 1; }
+
+static void usage(void) {
+  fprintf(stderr, "usage: serialmic_bridge <tty|file|-> [--host 127.0.0.1] [--port 8765] [--allow-origin URL]\n"
+                  "                        [--rate HZ] [--scope-cols N] [--max-queue-kb N] [--no-crc] [--quiet]\n");
+  exit(1);
+}
+
+// Analyzes each good packet and sends it to every client
+struct Bridge {
+  LiveAnalyzer &analyzer;
+  WsServer &ws;
+  LiveFrame frame;
+  std::vector<int16_t> pcm;
+  std::vector<uint8_t> msg;
+  bool have_seq = false;
+  uint32_t expected = 0;
+  uint64_t packets = 0, lost = 0, crc_errors = 0;
+  double read_ms = 0;
+  uint32_t bytes_per_sec = 0;
+
+  Bridge(LiveAnalyzer &a, WsServer &w) : analyzer(a), ws(w) {}
+
+  void on_packet(const Packet &pkt) {
+    frame.flags = 0;
+    if (have_seq) {
+      const int32_t d = seq_gap(expected, pkt.seq);
+      if (d > 0) {
+        lost += (uint32_t)d;
+        frame.flags |= LIVE_FLAG_GAP;
+      } else if (d < 0) {
+        frame.flags |= LIVE_FLAG_RESTART;
+      }
+    }
+    have_seq = true;
+    expected = pkt.seq + 1;
+    packets++;
+    if (ws.clients() == 0) {
+      return;
+    }
+    const size_t n = pkt.samples();
+    pcm.resize(n);
+    pkt.read_pcm(pcm.data());
+    frame.seq = pkt.seq;
+    frame.usec = pkt.usec;
+    frame.read_ms = read_ms;
+    frame.packets = (uint32_t)packets;
+    frame.lost = (uint32_t)lost;
+    frame.crc_errors = (uint32_t)crc_errors;
+    frame.bytes_per_sec = bytes_per_sec;
+    analyzer.analyze(pcm.data(), n, &frame);
+    const int rate = analyzer.config().rate;
+    encode_live_frame(frame, rate, nullptr, 0, wall_ms(), &msg);
+    ws.broadcast(msg.data(), msg.size(), false);
+    if (ws.any_wants_pcm()) {
+      encode_live_frame(frame, rate, pcm.data(), n, wall_ms(), &msg);
+      ws.broadcast(msg.data(), msg.size(), true);
+    }
+  }
+  void on_crc_error(uint64_t) { crc_errors++; }
+};
+
+static void print_status(const Bridge &bridge, const WsServer &ws) {
+  fprintf(stderr, "packets %llu  lost %llu  crc %llu  %u B/s  clients %zu\n", (unsigned long long)bridge.packets,
+          (unsigned long long)bridge.lost, (unsigned long long)bridge.crc_errors, bridge.bytes_per_sec,
+          ws.clients());
+  for (const WsClientStats &c : ws.stats()) {
+    fprintf(stderr, "  %s: %s%s, sent %llu dropped %llu queued %zu\n", c.peer.c_str(),
+            c.open ? "open" : "handshake", c.wants_pcm ? " +pcm" : "", (unsigned long long)c.sent,
+            (unsigned long long)c.dropped, c.queued);
+  }
+}
+
+int main(int argc, char **argv) {
+  const char *input = nullptr;
+  const char *host = "127.0.0.1";
+  int port = 8765;
+  std::vector<const char *> origins;
+  LiveConfig config;
+  size_t max_queue_kb = 256;
+  bool verify_crc = true;
+  bool quiet = false;
+
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    if (arg[0] != '-' || !strcmp(arg, "-")) {
+      if (input) {
+        usage();
+      }
+      input = arg;
+      continue;
+    }
+    if (!strcmp(arg, "--no-crc")) {
+      verify_crc = false;
+      continue;
+    }
+    if (!strcmp(arg, "--quiet")) {
+      quiet = true;
+      continue;
+    }
+    const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+    if (!value) {
+      usage();
+    }
+    i++;
+    if (!strcmp(arg, "--host")) {
+      host = value;
+    } else if (!strcmp(arg, "--port")) {
+      port = atoi(value);
+    } else if (!strcmp(arg, "--allow-origin")) {
+      origins.push_back(value);
+    } else if (!strcmp(arg, "--rate")) {
+      config.rate = atoi(value);
+    } else if (!strcmp(arg, "--scope-cols")) {
+      config.scope_cols = atoi(value);
+    } else if (!strcmp(arg, "--max-queue-kb")) {
+      max_queue_kb = (size_t)atoi(value);
+    } else {
+      usage();
+    }
+  }
+  if (!input || config.rate <= 0 || config.scope_cols <= 0 || config.scope_cols > 4096) {
+    usage();
+  }
+
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = on_signal;
+  sigaction(SIGINT, &sa, nullptr);
+  sigaction(SIGTERM, &sa, nullptr);
+
+  WsServer ws;
+  for (const char *o : origins) {
+    ws.allow_origin(o);
+  }
+  ws.set_max_queue(max_queue_kb * 1024);
+  ws.set_hello(live_hello_json(config, input));
+  if (!ws.listen(host, port)) {
+    return 1;
+  }
+  bool is_tty = false;
+  int fd = open_stream(input, &is_tty);
+  if (fd < 0) {
+    return 1;
+  }
+  if (!quiet) {
+    fprintf(stderr, "serving %s on ws://%s:%d\n", input, host, port);
+  }
+  LiveAnalyzer analyzer(config);
+  PacketParser parser(verify_crc);
+  Bridge bridge(analyzer, ws);
+  static uint8_t buf[64 * 1024];
+  std::vector<struct pollfd> fds;
+  double next_status = 0, next_rate = 0;
+  uint64_t rate_bytes = 0;
+  while (!stop_requested) {
+    fds.clear();
+    if (fd >= 0) {
+      fds.push_back({fd, POLLIN, 0});
+    }
+    ws.add_pollfds(&fds);
+    const int ready = poll(fds.data(), fds.size(), fd >= 0 ? 500 : 1000);
+    if (fd >= 0 && ready > 0 && (fds[0].revents & (POLLIN | POLLHUP | POLLERR))) {
+      ssize_t n = read(fd, buf, sizeof(buf));
+      if (n > 0) {
+        // every packet in a read arrived together
+        bridge.read_ms = wall_ms();
+        rate_bytes += (uint64_t)n;
+        parser.feed(buf, (size_t)n, bridge);
+      } else if (!(n < 0 && (errno == EINTR || errno == EAGAIN))) {
+        close(fd);
+        fd = -1;
+        if (!is_tty) {
+          break;
+        }
+      }
+    } else if (fd < 0) {
+      // the board was unplugged: pages stay connected and carry on when it
+      // comes back
+      fd = open_stream(input, &is_tty);
+      parser.reset();
+    }
+    ws.service();
+
+    const double now = monotonic_ns() * 1e-9;
+    if (now >= next_rate) {
+      bridge.bytes_per_sec = (uint32_t)rate_bytes;
+      rate_bytes = 0;
+      next_rate = now + 1;
+    }
+    if (!quiet && now >= next_status) {
+      if (next_status > 0) {
+        print_status(bridge, ws);
+      }
+      next_status = now + 5;
+    }
+  }
+  if (fd >= 0) {
+    close(fd);
+  }
+  if (!quiet) {
+    print_status(bridge, ws);
+  }
+  return 0;
+}
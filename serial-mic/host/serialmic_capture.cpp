@@ -0,0 +1,422 @@
+// serial-mic capture files
+//
+// Records the packet stream as it arrives into an indexed capture (see
+// capture_file.h), and gets things back out of one without reading the rest
+// of it: a summary with every gap, CRC failure and restart, or a stretch of
+// audio (as WAV) or of packets (the original bytes, CRCs and all) from a
+// seq, a point on the device clock or a time of day.
+//
+//   serialmic_capture record /dev/ttyACM0 --out site.smc
+//   serialmic_capture info site.smc --events
+//   serialmic_capture extract site.smc --time 14:32:05 --seconds 30 --wav incident.wav
+//   serialmic_capture extract site.smc --seq 123456 --count 100 --packets - | ...
+//
+// Recording: Ctrl-C (or SIGTERM) closes the file cleanly; if the process dies
+// anyway the file is good up to its last checkpoint.
+#include <cerrno>
+#include <cinttypes>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <poll.h>
+#include <unistd.h>
+#include <vector>
+
+#include "capture_file.h"
+#include "serial_port.h"
+#include "wav_writer.h"
+
+using namespace serialmic;
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void on_signal(int) { stop_requested = 1; }
+
+static double now_sec(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void usage(void) {
+  fprintf(stderr, "usage: serialmic_capture record <tty|file|-> --out FILE.smc [--rate HZ] [--no-crc]\n"
+                  "                         [--checkpoint-seconds N] [--reconnect] [--quiet]\n"
+                  "       serialmic_capture info FILE.smc [--events]\n"
+                  "       serialmic_capture extract FILE.smc (--seq N | --at SECONDS | --time WHEN)\n"
+                  "                         [--seconds N | --count PACKETS] (--wav OUT.wav | --packets OUT|-)\n"
+                  "WHEN is seconds since 1970 or HH:MM[:SS] local time, on the day the capture started\n"
+                  "(or the day after, if that time of day comes before the start)\n");
+  exit(1);
+}
+
+static const char *format_time(int64_t host_us, char *buf, size_t len) {
+  time_t t = (time_t)(host_us / 1000000);
+  struct tm tm;
+  localtime_r(&t, &tm);
+  size_t n = strftime(buf, len, "%Y-%m-%d %H:%M:%S", &tm);
+  snprintf(buf + n, len - n, ".%03d", (int)(host_us / 1000 % 1000));
+  return buf;
+}
+
+// ====================== record ======================
+struct CaptureHandler {
+  CaptureWriter &writer;
+  void on_packet(const Packet &pkt) { writer.add(pkt, realtime_us()); }
+  void on_crc_error(uint64_t) { writer.add_crc_error(); }
+};
+
+static void print_status(const CaptureWriter &w, const ParserStats &p, double elapsed) {
+  const CapFileHeader &h = w.header();
+  fprintf(stderr, "%.1f s  packets %llu  lost %llu  late dropped %llu  restarts %u  crc %llu  %.1f kB/s\n",
+          (double)h.packets * h.packet_samples / h.sample_rate, (unsigned long long)h.packets,
+          (unsigned long long)h.lost, (unsigned long long)h.late_dropped, h.segments ? h.segments - 1 : 0,
+          (unsigned long long)h.crc_errors, elapsed > 0 ? p.bytes / elapsed / 1024 : 0.0);
+}
+
+static int cmd_record(int argc, char **argv) {
+  const char *input = nullptr;
+  const char *out_path = nullptr;
+  int rate = SAMPLE_RATE;
+  bool verify_crc = true;
+  bool reconnect = false;
+  bool quiet = false;
+  double checkpoint_seconds = 10;
+  for (int i = 0; i < argc; i++) {
+    const char *arg = argv[i];
+    if (arg[0] != '-' || !strcmp(arg, "-")) {
+      if (input) {
+        usage();
+      }
+      input = arg;
+      continue;
+    }
+    if (!strcmp(arg, "--no-crc")) {
+      verify_crc = false;
+      continue;
+    }
+    if (!strcmp(arg, "--reconnect")) {
+      reconnect = true;
+      continue;
+    }
+    if (!strcmp(arg, "--quiet")) {
+      quiet = true;
+      continue;
+    }
+    const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+    if (!value) {
+      usage();
+    }
+    i++;
+    if (!strcmp(arg, "--out")) {
+      out_path = value;
+    } else if (!strcmp(arg, "--rate")) {
+      rate = atoi(value);
+    } else if (!strcmp(arg, "--checkpoint-seconds")) {
+      checkpoint_seconds = atof(value);
+    } else {
+      usage();
+    }
+  }
+  if (!input || !out_path || rate <= 0 || checkpoint_seconds <= 0) {
+    usage();
+  }
+
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = on_signal; // no SA_RESTART, so read() and poll() return
+  sigaction(SIGINT, &sa, nullptr);
+  sigaction(SIGTERM, &sa, nullptr);
+
+  bool is_tty = false;
+  int fd = open_stream(input, &is_tty);
+  if (fd < 0) {
+    return 1;
+  }
+  CaptureWriter writer;
+  if (!writer.open(out_path, rate)) {
+    return 1;
+  }
+  writer.set_checkpoint_packets((uint32_t)(checkpoint_seconds * rate / SAMPLES_PER_PACKET) + 1);
+  static PacketParser parser(verify_crc);
+  CaptureHandler handler{writer};
+
+  static uint8_t buf[64 * 1024];
+  const double start = now_sec();
+  double next_status = start + 5;
+  while (!stop_requested) {
+    if (fd < 0) {
+      sleep(1);
+      fd = open_stream(input, &is_tty);
+      parser.reset();
+      continue;
+    }
+    struct pollfd pfd = {fd, POLLIN, 0};
+    int ready = poll(&pfd, 1, 500);
+    if (ready > 0) {
+      ssize_t n = read(fd, buf, sizeof(buf));
+      if (n > 0) {
+        parser.feed(buf, (size_t)n, handler);
+      } else if (n < 0 && errno == EINTR) {
+        continue;
+      } else {
+        if (n < 0) {
+          fprintf(stderr, "%s: %s\n", input, strerror(errno));
+        }
+        close(fd);
+        fd = -1;
+        if (!(reconnect && is_tty)) {
+          break;
+        }
+      }
+    }
+    if (writer.failed()) {
+      fprintf(stderr, "write failed, stopping\n");
+      break;
+    }
+    const double now = now_sec();
+    if (!quiet && now >= next_status) {
+      print_status(writer, parser.stats(), now - start);
+      next_status = now + 5;
+    }
+  }
+  if (fd >= 0) {
+    close(fd);
+  }
+  if (writer.oversize() > 0) {
+    fprintf(stderr, "%llu packets were too big for the capture's records and were dropped\n",
+            (unsigned long long)writer.oversize());
+  }
+  writer.close();
+  if (!quiet) {
+    print_status(writer, parser.stats(), now_sec() - start);
+  }
+  return writer.failed() ? 1 : 0;
+}
+
+// ====================== info ======================
+static int cmd_info(int argc, char **argv) {
+  const char *path = nullptr;
+  bool events = false;
+  for (int i = 0; i < argc; i++) {
+    if (!strcmp(argv[i], "--events")) {
+      events = true;
+    } else if (argv[i][0] != '-' && !path) {
+      path = argv[i];
+    } else {
+      usage();
+    }
+  }
+  if (!path) {
+    usage();
+  }
+  CaptureReader reader;
+  if (!reader.open(path)) {
+    return 1;
+  }
+  const CapFileHeader &h = reader.header();
+  char when[64];
+  printf("%s: %u Hz, %u samples per packet, %llu chunks\n", path, h.sample_rate, h.packet_samples,
+         (unsigned long long)reader.chunks());
+  printf("created   %s\n", format_time(h.created_host_us, when, sizeof(when)));
+  CapPacket first, last;
+  const int64_t f = reader.stored_from(0);
+  if (f >= 0 && reader.packet((uint64_t)f, first) && reader.end() > 0 && reader.packet(reader.end() - 1, last)) {
+    printf("first     %s  seq %" PRIu32 "\n", format_time(first.host_us, when, sizeof(when)), first.record->seq);
+    printf("last      %s  seq %" PRIu32 "\n", format_time(last.host_us, when, sizeof(when)), last.record->seq);
+    printf("duration  %.1f s on the device clock\n", (last.usec - first.usec) / 1e6);
+  }
+  printf("packets   %llu stored, %llu lost, %llu too late, %llu CRC failures, %u restarts\n",
+         (unsigned long long)h.packets, (unsigned long long)h.lost, (unsigned long long)h.late_dropped,
+         (unsigned long long)h.crc_errors, h.segments ? h.segments - 1 : 0);
+  if (!events) {
+    return 0;
+  }
+  static const char *names[] = {"?", "gap", "crc", "restart", "late"};
+  printf("\nevent,packet,seq,time,count\n");
+  for (uint64_t k = 0; k < reader.chunks(); k++) {
+    const CapChunkHeader *c = reader.chunk(k);
+    if (!c) {
+      continue;
+    }
+    for (uint32_t e = 0; e < c->events && e < CAP_MAX_EVENTS; e++) {
+      const CapEvent &ev = c->event[e];
+      const uint64_t n = k * CAP_CHUNK_PACKETS + ev.slot;
+      CapPacket p;
+      if (!reader.packet(n, p)) {
+        continue;
+      }
+      printf("%s,%llu,%" PRIu32 ",%s,%" PRIu32 "\n", names[ev.type <= CAP_EVENT_LATE ? ev.type : 0],
+             (unsigned long long)n, p.record->seq, format_time(p.host_us, when, sizeof(when)), ev.count);
+    }
+    if (c->dropped_events > 0) {
+      printf("# %u more events in chunk %llu\n", c->dropped_events, (unsigned long long)k);
+    }
+  }
+  return 0;
+}
+
+// ====================== extract ======================
+// Seconds since 1970, or a time of day on the day the capture started
+static bool parse_when(const char *s, int64_t created_us, int64_t *out) {
+  int hh = 0, mm = 0;
+  double ss = 0;
+  if (!strchr(s, ':')) {
+    char *end;
+    double t = strtod(s, &end);
+    if (*end) {
+      return false;
+    }
+    *out = (int64_t)(t * 1e6);
+    return true;
+  }
+  if (sscanf(s, "%d:%d:%lf", &hh, &mm, &ss) < 2) {
+    return false;
+  }
+  time_t t = (time_t)(created_us / 1000000);
+  struct tm tm;
+  localtime_r(&t, &tm);
+  tm.tm_hour = hh;
+  tm.tm_min = mm;
+  tm.tm_sec = 0;
+  tm.tm_isdst = -1;
+  int64_t when = (int64_t)mktime(&tm) * 1000000 + (int64_t)(ss * 1e6);
+  if (when < created_us - 1000000) {
+    tm.tm_mday++;
+    tm.tm_isdst = -1;
+    when = (int64_t)mktime(&tm) * 1000000 + (int64_t)(ss * 1e6);
+  }
+  *out = when;
+  return true;
+}
+
+static int cmd_extract(int argc, char **argv) {
+  const char *path = nullptr;
+  const char *seq_arg = nullptr, *at_arg = nullptr, *time_arg = nullptr;
+  const char *wav_path = nullptr, *packets_path = nullptr;
+  double seconds = 10;
+  long long count = -1;
+  for (int i = 0; i < argc; i++) {
+    const char *arg = argv[i];
+    if (arg[0] != '-') {
+      if (path) {
+        usage();
+      }
+      path = arg;
+      continue;
+    }
+    const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+    if (!value) {
+      usage();
+    }
+    i++;
+    if (!strcmp(arg, "--seq")) {
+      seq_arg = value;
+    } else if (!strcmp(arg, "--at")) {
+      at_arg = value;
+    } else if (!strcmp(arg, "--time")) {
+      time_arg = value;
+    } else if (!strcmp(arg, "--seconds")) {
+      seconds = atof(value);
+    } else if (!strcmp(arg, "--count")) {
+      count = atoll(value);
+    } else if (!strcmp(arg, "--wav")) {
+      wav_path = value;
+    } else if (!strcmp(arg, "--packets")) {
+      packets_path = value;
+    } else {
+      usage();
+    }
+  }
+  if (!path || (!seq_arg + !at_arg + !time_arg) != 2 || (!wav_path == !packets_path)) {
+    usage();
+  }
+  CaptureReader reader;
+  if (!reader.open(path)) {
+    return 1;
+  }
+  const CapFileHeader &h = reader.header();
+  int64_t from = -1;
+  if (seq_arg) {
+    from = reader.find_seq((uint32_t)strtoul(seq_arg, nullptr, 0));
+  } else if (at_arg) {
+    CapPacket first;
+    const int64_t f = reader.stored_from(0);
+    if (f >= 0 && reader.packet((uint64_t)f, first)) {
+      from = reader.find_usec(first.usec + (uint64_t)(atof(at_arg) * 1e6));
+    }
+  } else {
+    int64_t when;
+    if (!parse_when(time_arg, h.created_host_us, &when)) {
+      usage();
+    }
+    from = reader.find_host_time(when);
+  }
+  if (from < 0) {
+    fprintf(stderr, "%s: nothing recorded from there on\n", path);
+    return 1;
+  }
+  uint64_t packets = count >= 0 ? (uint64_t)count
+                                : (uint64_t)(seconds * h.sample_rate / h.packet_samples + 0.999);
+  if (packets > reader.end() - (uint64_t)from) {
+    packets = reader.end() - (uint64_t)from;
+  }
+  CapPacket p;
+  char when[64];
+  if (reader.packet((uint64_t)from, p)) {
+    fprintf(stderr, "from packet %lld, seq %" PRIu32 ", %s, %llu packets\n", (long long)from, p.record->seq,
+            format_time(p.host_us, when, sizeof(when)), (unsigned long long)packets);
+  }
+
+  if (packets_path) {
+    FILE *out = strcmp(packets_path, "-") ? fopen(packets_path, "wb") : stdout;
+    if (!out) {
+      perror(packets_path);
+      return 1;
+    }
+    // the packets as they arrived: missing ones stay missing
+    std::vector<uint8_t> buf(PKT_OVERHEAD + h.record_bytes);
+    for (uint64_t n = (uint64_t)from; n < (uint64_t)from + packets; n++) {
+      if (reader.packet(n, p)) {
+        fwrite(buf.data(), 1, reader.rebuild(p, buf.data()), out);
+      }
+    }
+    if (out != stdout) {
+      fclose(out);
+    }
+    return 0;
+  }
+
+  BlockWriter out;
+  WavWriter wav(out);
+  if (!wav.open(wav_path, (int)h.sample_rate, 1, 16)) {
+    return 1;
+  }
+  std::vector<int16_t> pcm(h.packet_samples * 64);
+  for (uint64_t n = (uint64_t)from; n < (uint64_t)from + packets; n += 64) {
+    const uint64_t batch = packets - (n - (uint64_t)from) < 64 ? packets - (n - (uint64_t)from) : 64;
+    const size_t got = reader.read_pcm(n, pcm.data(), batch * h.packet_samples);
+    wav.write(pcm.data(), got * 2);
+  }
+  wav.close();
+  out.flush();
+  return out.failed() ? 1 : 0;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    usage();
+  }
+  if (!strcmp(argv[1], "record")) {
+    return cmd_record(argc - 2, argv + 2);
+  }
+  if (!strcmp(argv[1], "info")) {
+    return cmd_info(argc - 2, argv + 2);
+  }
+  if (!strcmp(argv[1], "extract")) {
+    return cmd_extract(argc - 2, argv + 2);
+  }
+  usage();
+  return 1;
+}
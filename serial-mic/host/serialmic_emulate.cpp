@@ -0,0 +1,516 @@
+// serial-mic emulator
+//
+// Plays a WAV file or a capture as one or many serial-mics, each on its own
+// pseudo-terminal, so the host tools can be run, broken and load tested
+// without a board plugged in. The bytes are what i2s_reader_task would send
+// (see emulator.h), paced in real time, N times faster, or as fast as the
+// readers take them, with bit errors, lost and reordered packets and USB
+// jitter thrown in on request.
+//
+//   serialmic_emulate speech.wav --link /tmp/mic
+//   serialmic_record /tmp/mic0 --prefix test
+//
+//   serialmic_emulate --tone 1000 --devices 300 --ppm 50 --drop 0.001
+//   serialmic_emulate day.smc --replay --speed 10 --out - | serialmic_record -
+//
+// Each port is printed on stdout as it's made. A reader that falls behind
+// loses whole packets once the port's buffer and 64K of backlog are full,
+// and sees them as seq gaps.
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cmath>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <memory>
+#include <poll.h>
+#include <string>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <termios.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "emulator.h"
+
+using namespace serialmic;
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void on_signal(int) { stop_requested = 1; }
+
+static void usage(void) {
+  fprintf(stderr,
+          "usage: serialmic_emulate <audio.wav|capture.smc> | --tone HZ\n"
+          "                         [--devices N] [--link PREFIX] [--out FILE|-]\n"
+          "                         [--speed X | --max] [--seconds S] [--no-loop] [--threads N]\n"
+          "                         [--replay] [--dc-block] [--no-crc] [--channel N] [--stagger S]\n"
+          "                         [--ppm P] [--rate-ppm P] [--restart-every S]\n"
+          "                         [--ber RATE] [--drop P] [--reorder P] [--jitter-ms MS]\n"
+          "                         [--seed N] [--quiet]\n");
+  exit(1);
+}
+
+// A test signal that never ends: a sine at -12 dBFS over a little noise
+class ToneSource : public AudioSource {
+public:
+  explicit ToneSource(double hz) : step_(2 * M_PI * hz / SAMPLE_RATE) {}
+  int sample_rate() const override { return SAMPLE_RATE; }
+  uint64_t samples() const override { return (uint64_t)1 << 40; }
+  size_t read(uint64_t first, int16_t *out, size_t count) const override {
+    for (size_t i = 0; i < count; i++) {
+      const uint64_t n = first + i;
+      uint32_t h = (uint32_t)(n * 2654435761u);
+      h ^= h >> 15;
+      out[i] = (int16_t)(8192 * std::sin(step_ * (double)(n % (1u << 30))) + (int)(h % 64) - 32);
+    }
+    return count;
+  }
+
+private:
+  double step_;
+};
+
+// The firmware's TX queue and CDC buffer between them hold about this much
+constexpr size_t BACKLOG_BYTES = 64 * 1024;
+
+struct Device {
+  int fd = -1;       // pty master, or the output
+  int slave_fd = -1; // held open so the port survives readers coming and going
+  std::string name;
+  std::string link;
+  std::unique_ptr<PacketSource> source;
+  std::unique_ptr<FaultInjector> faults;
+  std::unique_ptr<WirePacket> pkt{new WirePacket};
+  bool have_pkt = false;
+  bool ended = false;
+  double phase = 0; // when it was plugged in, seconds
+  uint8_t backlog[BACKLOG_BYTES];
+  size_t pos = 0, fill = 0;
+};
+
+// Counters the status line reads while the threads run
+struct Totals {
+  std::atomic<uint64_t> packets{0}; // put on the wire
+  std::atomic<uint64_t> bytes{0};   // taken by the readers
+  std::atomic<uint64_t> overflows{0};
+  std::atomic<uint64_t> late{0};     // sent more than 5 ms after they were due
+  std::atomic<uint64_t> max_late_us{0};
+};
+
+static double now_sec(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Makes a pty whose slave end behaves like a CDC port: raw, no echo
+static bool open_pty(Device &dev) {
+  int master = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+  if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0) {
+    fprintf(stderr, "can't make a pty: %s\n", strerror(errno));
+    if (master >= 0) {
+      close(master);
+    }
+    return false;
+  }
+  const char *name = ptsname(master);
+  int slave = name ? open(name, O_RDWR | O_NOCTTY | O_CLOEXEC) : -1;
+  if (slave < 0) {
+    fprintf(stderr, "can't open the pty: %s\n", strerror(errno));
+    close(master);
+    return false;
+  }
+  struct termios t;
+  if (tcgetattr(slave, &t) == 0) {
+    cfmakeraw(&t);
+    tcsetattr(slave, TCSANOW, &t);
+  }
+  dev.fd = master;
+  dev.slave_fd = slave;
+  dev.name = name;
+  return true;
+}
+
+// Takes what's due off the device's source into its backlog, then gives the
+// port as much of the backlog as it will take. Returns the next due time, or
+// a negative number once the device has nothing more to send.
+static double service(Device &dev, double now, double end, bool max_speed, Totals &totals) {
+  while (!dev.ended) {
+    if (!dev.have_pkt) {
+      if (!dev.faults->next(*dev.pkt)) {
+        dev.ended = true;
+        break;
+      }
+      dev.pkt->due += dev.phase;
+      dev.have_pkt = true;
+    }
+    WirePacket &pkt = *dev.pkt;
+    if (end > 0 && pkt.due >= end) {
+      dev.ended = true;
+      break;
+    }
+    if (!max_speed && pkt.due > now) {
+      break;
+    }
+    if (max_speed && dev.fill - dev.pos >= BACKLOG_BYTES / 2) {
+      break;
+    }
+    if (dev.fill + pkt.len > BACKLOG_BYTES && dev.pos > 0) {
+      memmove(dev.backlog, dev.backlog + dev.pos, dev.fill - dev.pos);
+      dev.fill -= dev.pos;
+      dev.pos = 0;
+    }
+    if (dev.fill + pkt.len <= BACKLOG_BYTES) {
+      memcpy(dev.backlog + dev.fill, pkt.bytes, pkt.len);
+      dev.fill += pkt.len;
+      totals.packets.fetch_add(1, std::memory_order_relaxed);
+    } else {
+      totals.overflows.fetch_add(1, std::memory_order_relaxed);
+    }
+    if (!max_speed) {
+      const uint64_t late_us = (uint64_t)((now - pkt.due) * 1e6);
+      if (late_us > 5000) {
+        totals.late.fetch_add(1, std::memory_order_relaxed);
+      }
+      if (late_us > totals.max_late_us.load(std::memory_order_relaxed)) {
+        totals.max_late_us.store(late_us, std::memory_order_relaxed);
+      }
+    }
+    dev.have_pkt = false;
+  }
+  while (dev.pos < dev.fill) {
+    const ssize_t n = write(dev.fd, dev.backlog + dev.pos, dev.fill - dev.pos);
+    if (n <= 0) {
+      break; // full (or a pipe that's gone), try again later
+    }
+    dev.pos += (size_t)n;
+    totals.bytes.fetch_add((uint64_t)n, std::memory_order_relaxed);
+  }
+  if (dev.pos == dev.fill) {
+    dev.pos = dev.fill = 0;
+  }
+  if (dev.ended && dev.fill == 0) {
+    return -1;
+  }
+  return dev.have_pkt ? dev.pkt->due : now;
+}
+
+// One thread's share of the devices. Emulated time is host time since the
+// start times `speed`; with `speed` 0 nothing waits for its due time.
+static void run_devices(std::vector<Device *> devices, double start, double speed, double end, Totals &totals) {
+  const bool max_speed = speed <= 0;
+  std::vector<struct pollfd> pfds(devices.size());
+  while (!stop_requested) {
+    const double now = max_speed ? 0 : (now_sec() - start) * speed;
+    double next = HUGE_VAL;
+    bool busy = false;    // something is still to be sent
+    bool blocked = false; // a port is full
+    for (Device *dev : devices) {
+      const double due = service(*dev, now, end, max_speed, totals);
+      if (due < 0) {
+        continue;
+      }
+      busy = true;
+      blocked |= dev->fill > 0;
+      next = std::min(next, due);
+    }
+    if (!busy) {
+      break;
+    }
+    if (max_speed && !blocked) {
+      continue;
+    }
+    if (blocked) {
+      // wait for a reader to make room, but not past the next due packet
+      size_t n = 0;
+      for (Device *dev : devices) {
+        if (dev->fill > 0) {
+          pfds[n++] = {dev->fd, POLLOUT, 0};
+        }
+      }
+      int wait_ms = max_speed ? 100 : (int)std::ceil(std::max(0.0, (next - now) / speed) * 1e3);
+      poll(pfds.data(), n, std::min(wait_ms, 100));
+      continue;
+    }
+    const double wait = (next - now) / speed;
+    if (wait > 0) {
+      const double until = start + next / speed;
+      struct timespec ts;
+      ts.tv_sec = (time_t)until;
+      ts.tv_nsec = (long)((until - ts.tv_sec) * 1e9);
+      clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr);
+    }
+  }
+}
+
+static void print_status(const Totals &totals, const std::vector<std::unique_ptr<Device>> &devices,
+                         double elapsed, double emulated) {
+  FaultStats f;
+  for (const auto &dev : devices) {
+    const FaultStats &s = dev->faults->stats();
+    f.dropped += s.dropped;
+    f.reordered += s.reordered;
+    f.bit_errors += s.bit_errors;
+  }
+  fprintf(stderr,
+          "%.0fs (%.0fs emulated)  packets %llu  %.2f MB/s  overflows %llu  late %llu (max %.1f ms)"
+          "  dropped %llu  reordered %llu  bit errors %llu\n",
+          elapsed, emulated, (unsigned long long)totals.packets.load(), totals.bytes.load() / elapsed / 1e6,
+          (unsigned long long)totals.overflows.load(), (unsigned long long)totals.late.load(),
+          totals.max_late_us.load() / 1e3, (unsigned long long)f.dropped, (unsigned long long)f.reordered,
+          (unsigned long long)f.bit_errors);
+}
+
+int main(int argc, char **argv) {
+  const char *input = nullptr;
+  double tone = 0;
+  int count = 1;
+  const char *link = nullptr;
+  const char *out = nullptr;
+  double speed = 1;
+  double seconds = 0;
+  int threads = 0;
+  bool replay = false;
+  int channel = 0;
+  double stagger = 0;
+  double ppm = 0;
+  uint32_t seed = 1;
+  bool quiet = false;
+  DeviceConfig dc;
+  FaultConfig fc;
+
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    if (arg[0] != '-') {
+      if (input) {
+        usage();
+      }
+      input = arg;
+      continue;
+    }
+    if (!strcmp(arg, "--max")) {
+      speed = 0;
+      continue;
+    }
+    if (!strcmp(arg, "--no-loop")) {
+      dc.loop = false;
+      continue;
+    }
+    if (!strcmp(arg, "--replay")) {
+      replay = true;
+      continue;
+    }
+    if (!strcmp(arg, "--dc-block")) {
+      dc.dc_block = true;
+      continue;
+    }
+    if (!strcmp(arg, "--no-crc")) {
+      dc.crc = false;
+      continue;
+    }
+    if (!strcmp(arg, "--quiet")) {
+      quiet = true;
+      continue;
+    }
+    const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+    if (!value) {
+      usage();
+    }
+    i++;
+    if (!strcmp(arg, "--tone")) {
+      tone = atof(value);
+    } else if (!strcmp(arg, "--devices")) {
+      count = atoi(value);
+    } else if (!strcmp(arg, "--link")) {
+      link = value;
+    } else if (!strcmp(arg, "--out")) {
+      out = value;
+    } else if (!strcmp(arg, "--speed")) {
+      speed = atof(value);
+    } else if (!strcmp(arg, "--seconds")) {
+      seconds = atof(value);
+    } else if (!strcmp(arg, "--threads")) {
+      threads = atoi(value);
+    } else if (!strcmp(arg, "--channel")) {
+      channel = atoi(value);
+    } else if (!strcmp(arg, "--stagger")) {
+      stagger = atof(value);
+    } else if (!strcmp(arg, "--ppm")) {
+      ppm = atof(value);
+    } else if (!strcmp(arg, "--rate-ppm")) {
+      dc.rate_ppm = atof(value);
+    } else if (!strcmp(arg, "--restart-every")) {
+      dc.restart_seconds = atof(value);
+    } else if (!strcmp(arg, "--ber")) {
+      fc.bit_error_rate = atof(value);
+    } else if (!strcmp(arg, "--drop")) {
+      fc.drop = atof(value);
+    } else if (!strcmp(arg, "--reorder")) {
+      fc.reorder = atof(value);
+    } else if (!strcmp(arg, "--jitter-ms")) {
+      fc.jitter_ms = atof(value);
+    } else if (!strcmp(arg, "--seed")) {
+      seed = (uint32_t)atol(value);
+    } else {
+      usage();
+    }
+  }
+  if ((input != nullptr) == (tone > 0) || count < 1 || (out && count != 1) || speed < 0) {
+    usage();
+  }
+
+  // the recording, shared by every device
+  std::unique_ptr<AudioSource> audio;
+  CaptureReader capture;
+  if (replay) {
+    if (!input || !capture.open(input)) {
+      fprintf(stderr, "--replay needs a capture\n");
+      return 1;
+    }
+  } else if (tone > 0) {
+    audio.reset(new ToneSource(tone));
+  } else {
+    audio = open_audio(input, channel);
+    if (!audio) {
+      return 1;
+    }
+    if (audio->sample_rate() != SAMPLE_RATE) {
+      fprintf(stderr, "note: %s is %d Hz, the board sends %d\n", input, audio->sample_rate(), SAMPLE_RATE);
+    }
+  }
+
+  // two fds a device
+  struct rlimit rl;
+  if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+    rl.rlim_cur = rl.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &rl);
+  }
+
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = on_signal;
+  sigaction(SIGINT, &sa, nullptr);
+  sigaction(SIGTERM, &sa, nullptr);
+  signal(SIGPIPE, SIG_IGN);
+
+  std::vector<std::unique_ptr<Device>> devices;
+  uint32_t rng = seed * 2654435761u + 12345;
+  auto uniform = [&rng]() {
+    rng = rng * 1664525u + 1013904223u;
+    return (rng >> 8) * (1.0 / 16777216.0);
+  };
+  int status = 0;
+  for (int i = 0; i < count && !status; i++) {
+    std::unique_ptr<Device> dev(new Device);
+    if (out) {
+      dev->fd = strcmp(out, "-") == 0 ? dup(STDOUT_FILENO) : open(out, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+      dev->name = out;
+      if (dev->fd < 0) {
+        fprintf(stderr, "can't open %s: %s\n", out, strerror(errno));
+        status = 1;
+        break;
+      }
+    } else if (!open_pty(*dev)) {
+      status = 1;
+      break;
+    }
+    if (replay) {
+      dev->source.reset(new RecordedSource(capture, dc.loop));
+    } else {
+      DeviceConfig c = dc;
+      c.clock_ppm = ppm * (2 * uniform() - 1);
+      c.start_seconds = stagger * i;
+      c.boot_us = 1.2e6 + 0.6e6 * uniform();
+      dev->source.reset(new FramedSource(*audio, c, seed * 7919 + i));
+    }
+    dev->faults.reset(new FaultInjector(*dev->source, fc, seed * 104729 + i));
+    // boards plugged in at different moments rather than all in step
+    dev->phase = count > 1 ? uniform() * 0.064 : 0;
+    if (link) {
+      dev->link = std::string(link) + std::to_string(i);
+      unlink(dev->link.c_str());
+      if (symlink(dev->name.c_str(), dev->link.c_str()) != 0) {
+        fprintf(stderr, "can't link %s: %s\n", dev->link.c_str(), strerror(errno));
+        dev->link.clear();
+      }
+    }
+    if (!out) {
+      printf("%s\n", dev->link.empty() ? dev->name.c_str() : dev->link.c_str());
+    }
+    devices.push_back(std::move(dev));
+  }
+  fflush(stdout);
+
+  if (!status) {
+    if (threads <= 0) {
+      // a thread keeps up with a couple of hundred devices in real time
+      threads = std::min<int>((count + 199) / 200, std::max(1u, std::thread::hardware_concurrency()));
+      if (speed != 1) {
+        threads = std::min<int>(count, std::max(1u, std::thread::hardware_concurrency()));
+      }
+    }
+    threads = std::max(1, std::min(threads, count));
+    Totals totals;
+    const double start = now_sec();
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; t++) {
+      std::vector<Device *> mine;
+      for (size_t i = (size_t)t; i < devices.size(); i += (size_t)threads) {
+        mine.push_back(devices[i].get());
+      }
+      workers.emplace_back(run_devices, mine, start, speed, seconds, std::ref(totals));
+    }
+    // the workers end on their own when the recordings do
+    std::atomic<int> running{threads};
+    std::thread waiter([&] {
+      for (auto &w : workers) {
+        w.join();
+      }
+      running = 0;
+    });
+    double next_status = start + 5;
+    while (running && !stop_requested) {
+      usleep(100000);
+      const double now = now_sec();
+      if (!quiet && now >= next_status) {
+        print_status(totals, devices, now - start, speed > 0 ? (now - start) * speed : 0);
+        next_status = now + 5;
+      }
+    }
+    stop_requested = 1;
+    waiter.join();
+    if (!quiet) {
+      const double now = now_sec();
+      print_status(totals, devices, now - start, speed > 0 ? (now - start) * speed : 0);
+    }
+  }
+
+  // give readers a moment to take what's still in the ports
+  const double give_up = now_sec() + 2;
+  for (auto &dev : devices) {
+    int pending = 0;
+    while (dev->slave_fd >= 0 && ioctl(dev->slave_fd, FIONREAD, &pending) == 0 && pending > 0 &&
+           now_sec() < give_up) {
+      usleep(10000);
+    }
+  }
+  for (auto &dev : devices) {
+    if (!dev->link.empty()) {
+      unlink(dev->link.c_str());
+    }
+    // closing the master is the board being unplugged
+    if (dev->slave_fd >= 0) {
+      close(dev->slave_fd);
+    }
+    if (dev->fd >= 0) {
+      close(dev->fd);
+    }
+  }
+  return status;
+}
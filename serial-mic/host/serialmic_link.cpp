@@ -0,0 +1,199 @@
+// serial-mic link statistics
+//
+// How well a board's stream is getting through: loss and how it comes (gap
+// runs, CRC bursts), arrival jitter, the sample rate the board actually
+// runs at, and throughput over sliding windows. One pass and fixed memory,
+// so it can sit on a live port for days or go through a recording at disk
+// speed. See link_stats.h for what is measured.
+//
+//   serialmic_link /dev/ttyACM0 --every 10
+//   serialmic_link capture.smc --json > link.json
+//   serialmic_emulate --tone 1000 --drop 0.01 --out - | serialmic_link - --seconds 60
+//
+// A tty or a pipe is live and timed as it's read; a stream saved to a file
+// or a capture has no arrival times, so its timing comes from the device's
+// own stamps.
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "capture_file.h"
+#include "link_stats.h"
+#include "serial_port.h"
+#include "shm_ring.h"
+
+using namespace serialmic;
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void on_signal(int) { stop_requested = 1; }
+
+static void usage(void) {
+  fprintf(stderr, "usage: serialmic_link <tty|file|-|capture.smc> [--every S] [--seconds S] [--json]\n"
+                  "                      [--rate HZ] [--no-crc] [--live | --recorded]\n");
+  exit(1);
+}
+
+static bool is_capture(const char *path) {
+  char magic[8] = {0};
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+  const bool yes = read(fd, magic, sizeof(magic)) == (ssize_t)sizeof(magic) && !memcmp(magic, CAP_MAGIC, 8);
+  close(fd);
+  return yes;
+}
+
+// Every stored packet in order, with the CRC failures the chunk headers
+// recorded put back where they happened
+static void analyze_capture(const CaptureReader &cap, LinkAnalyzer &link) {
+  for (uint64_t k = 0; k < cap.chunks() && !stop_requested; k++) {
+    const CapChunkHeader *h = cap.chunk(k);
+    if (!h) {
+      continue;
+    }
+    uint32_t e = 0;
+    for (uint32_t slot = 0; slot < CAP_CHUNK_PACKETS; slot++) {
+      for (; e < h->events && h->event[e].slot <= slot; e++) {
+        if (h->event[e].type == CAP_EVENT_CRC) {
+          for (uint32_t i = 0; i < h->event[e].count; i++) {
+            link.add_crc_error(-1);
+          }
+        }
+      }
+      CapPacket p;
+      if (!cap.packet(k * CAP_CHUNK_PACKETS + slot, p)) {
+        continue;
+      }
+      Packet pkt;
+      pkt.seq = p.record->seq;
+      pkt.usec = p.record->usec;
+      pkt.payload = (const uint8_t *)p.pcm;
+      pkt.payload_len = p.record->payload_len;
+      pkt.offset = 0;
+      link.add_packet(pkt, -1);
+    }
+  }
+}
+
+int main(int argc, char **argv) {
+  const char *input = nullptr;
+  double every = -1;
+  double seconds = 0;
+  bool json = false;
+  int rate = SAMPLE_RATE;
+  bool verify_crc = true;
+  int live = -1; // decide from the input
+
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    if (arg[0] != '-' || !strcmp(arg, "-")) {
+      if (input) {
+        usage();
+      }
+      input = arg;
+      continue;
+    }
+    if (!strcmp(arg, "--json")) {
+      json = true;
+      continue;
+    }
+    if (!strcmp(arg, "--no-crc")) {
+      verify_crc = false;
+      continue;
+    }
+    if (!strcmp(arg, "--live")) {
+      live = 1;
+      continue;
+    }
+    if (!strcmp(arg, "--recorded")) {
+      live = 0;
+      continue;
+    }
+    const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+    if (!value) {
+      usage();
+    }
+    i++;
+    if (!strcmp(arg, "--every")) {
+      every = atof(value);
+    } else if (!strcmp(arg, "--seconds")) {
+      seconds = atof(value);
+    } else if (!strcmp(arg, "--rate")) {
+      rate = atoi(value);
+    } else {
+      usage();
+    }
+  }
+  if (!input) {
+    usage();
+  }
+
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = on_signal;
+  sigaction(SIGINT, &sa, nullptr);
+  sigaction(SIGTERM, &sa, nullptr);
+
+  LinkAnalyzer link(rate);
+  if (strcmp(input, "-") && is_capture(input)) {
+    CaptureReader cap;
+    if (!cap.open(input)) {
+      return 1;
+    }
+    analyze_capture(cap, link);
+  } else {
+    bool is_tty = false;
+    int fd = open_stream(input, &is_tty);
+    if (fd < 0) {
+      return 1;
+    }
+    if (live < 0) {
+      struct stat st;
+      live = is_tty || (fstat(fd, &st) == 0 && !S_ISREG(st.st_mode));
+    }
+    if (every < 0) {
+      every = live ? 10 : 0;
+    }
+    PacketParser parser(verify_crc);
+    static uint8_t buf[64 * 1024];
+    const double start = monotonic_ns() * 1e-9;
+    double next_report = start + every;
+    while (!stop_requested) {
+      struct pollfd pfd = {fd, POLLIN, 0};
+      if (poll(&pfd, 1, 500) > 0) {
+        const ssize_t n = read(fd, buf, sizeof(buf));
+        if (n > 0) {
+          // every packet in a read arrived together
+          link.set_arrival(live ? monotonic_ns() * 1e-3 : -1);
+          parser.feed(buf, (size_t)n, link);
+        } else if (!(n < 0 && errno == EINTR)) {
+          break;
+        }
+      }
+      const double now = monotonic_ns() * 1e-9;
+      if (seconds > 0 && now - start >= seconds) {
+        break;
+      }
+      if (every > 0 && now >= next_report) {
+        link.print(stderr);
+        fprintf(stderr, "\n");
+        next_report = now + every;
+      }
+    }
+    close(fd);
+  }
+  if (json) {
+    link.print_json(stdout);
+  } else {
+    link.print(stdout);
+  }
+  return 0;
+}
@@ -0,0 +1,238 @@
+// serial-mic sound source locator
+//
+// Finds where sounds come from with several serial-mics at known places,
+// from the delays between them (GCC-PHAT, see localizer.h). Live from the
+// ports, aligned as serialmic_aggregate does it, or from a multichannel
+// recording it made:
+//
+//   serialmic_locate /dev/ttyACM0 /dev/ttyACM1 /dev/ttyACM2 /dev/ttyACM3 --mics room.txt
+//   serialmic_locate room.wav --mics room.txt --json > events.jsonl
+//
+// room.txt has "x y z" in metres per line, one line per port or channel in
+// the same order. A line per located window goes to stdout.
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include "aggregator.h"
+#include "audio_source.h"
+#include "localizer.h"
+
+using namespace serialmic;
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void on_signal(int) { stop_requested = 1; }
+
+static void usage(void) {
+  fprintf(stderr, "usage: serialmic_locate <tty> <tty> ... | <file.wav> --mics FILE [--fft N] [--hop N]\n"
+                  "                        [--threads N] [--event-db DB] [--min-peak P] [--dims 2|3]\n"
+                  "                        [--low-hz HZ] [--high-hz HZ] [--sound-speed M/S] [--all] [--json]\n"
+                  "                        [--latency-ms N] [--seconds N] [--no-crc] [--quiet]\n");
+  exit(1);
+}
+
+static void print_location(const Location &l, const Localizer &loc, bool json) {
+  if (json) {
+    printf("{\"time\":%.3f,\"window\":%llu,\"level_db\":%.1f,\"above_floor_db\":%.1f,\"event\":%s,\"solved\":%s",
+           l.time, (unsigned long long)l.window, l.level_db, l.above_floor_db, l.event ? "true" : "false",
+           l.solved ? "true" : "false");
+    if (l.solved) {
+      printf(",\"x\":%.3f,\"y\":%.3f,\"z\":%.3f,\"residual_m\":%.4f,\"pairs\":%d", l.x, l.y, l.z, l.residual_m,
+             l.pairs_used);
+    }
+    printf("}\n");
+  } else if (l.solved) {
+    printf("%9.3f  %7.3f %7.3f %7.3f  residual %.3fm  pairs %d/%d  %+.1fdB\n", l.time, l.x, l.y, l.z,
+           l.residual_m, l.pairs_used, loc.pairs(), l.above_floor_db);
+  } else {
+    printf("%9.3f  %s  %+.1fdB\n", l.time, l.event ? "unsolved" : "quiet", l.above_floor_db);
+  }
+}
+
+int main(int argc, char **argv) {
+  std::vector<const char *> inputs;
+  const char *mics_path = nullptr;
+  LocalizerConfig config;
+  double latency_ms = 300;
+  double seconds = 0;
+  bool verify_crc = true;
+  bool quiet = false;
+  bool json = false;
+  bool all = false;
+
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    if (arg[0] != '-') {
+      inputs.push_back(arg);
+      continue;
+    }
+    if (!strcmp(arg, "--no-crc")) {
+      verify_crc = false;
+      continue;
+    }
+    if (!strcmp(arg, "--quiet")) {
+      quiet = true;
+      continue;
+    }
+    if (!strcmp(arg, "--json")) {
+      json = true;
+      continue;
+    }
+    if (!strcmp(arg, "--all")) {
+      all = true;
+      continue;
+    }
+    const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+    if (!value) {
+      usage();
+    }
+    i++;
+    if (!strcmp(arg, "--mics")) {
+      mics_path = value;
+    } else if (!strcmp(arg, "--fft")) {
+      config.fft_size = (size_t)atoi(value);
+    } else if (!strcmp(arg, "--hop")) {
+      config.hop = (size_t)atoi(value);
+    } else if (!strcmp(arg, "--threads")) {
+      config.threads = atoi(value);
+    } else if (!strcmp(arg, "--event-db")) {
+      config.event_db = atof(value);
+    } else if (!strcmp(arg, "--min-peak")) {
+      config.min_peak = (float)atof(value);
+    } else if (!strcmp(arg, "--dims")) {
+      config.dims = atoi(value);
+    } else if (!strcmp(arg, "--low-hz")) {
+      config.low_hz = atof(value);
+    } else if (!strcmp(arg, "--high-hz")) {
+      config.high_hz = atof(value);
+    } else if (!strcmp(arg, "--sound-speed")) {
+      config.sound_speed = atof(value);
+    } else if (!strcmp(arg, "--latency-ms")) {
+      latency_ms = atof(value);
+    } else if (!strcmp(arg, "--seconds")) {
+      seconds = atof(value);
+    } else {
+      usage();
+    }
+  }
+  if (inputs.empty() || !mics_path || config.fft_size < 64 || (config.fft_size & (config.fft_size - 1))) {
+    usage();
+  }
+  std::vector<MicPosition> mics;
+  if (!load_mic_positions(mics_path, &mics)) {
+    return 1;
+  }
+  if (mics.size() < 3) {
+    fprintf(stderr, "%s: need at least 3 mics, have %zu\n", mics_path, mics.size());
+    return 1;
+  }
+  struct stat st;
+  const bool recording = inputs.size() == 1 && stat(inputs[0], &st) == 0 && S_ISREG(st.st_mode);
+  if (!recording && inputs.size() != mics.size()) {
+    fprintf(stderr, "%zu ports but %zu mics in %s\n", inputs.size(), mics.size(), mics_path);
+    return 1;
+  }
+  const int devices = (int)mics.size();
+
+  // a recording: one source per channel, read a second at a time
+  std::vector<std::unique_ptr<AudioSource>> sources;
+  if (recording) {
+    for (int ch = 0; ch < devices; ch++) {
+      sources.push_back(open_audio(inputs[0], ch));
+      if (!sources.back()) {
+        return 1;
+      }
+    }
+    config.rate = sources[0]->sample_rate();
+  }
+
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = on_signal;
+  sigaction(SIGINT, &sa, nullptr);
+  sigaction(SIGTERM, &sa, nullptr);
+
+  Localizer loc(mics, config);
+  if (!quiet) {
+    fprintf(stderr, "%d mics, %d pairs, %dD, lags up to %d samples, %d threads\n", loc.devices(), loc.pairs(),
+            loc.dims(), loc.max_lag(), loc.threads());
+  }
+  std::vector<Location> out;
+  uint64_t located = 0;
+  auto report = [&]() {
+    for (const Location &l : out) {
+      if (l.solved) {
+        located++;
+      }
+      if (all || l.solved) {
+        print_location(l, loc, json);
+      }
+    }
+    fflush(stdout);
+    out.clear();
+  };
+
+  if (recording) {
+    const size_t block = config.rate;
+    std::vector<int16_t> channel(block), frames(block * devices);
+    uint64_t total = sources[0]->samples();
+    if (seconds > 0) {
+      total = std::min(total, (uint64_t)(seconds * config.rate));
+    }
+    for (uint64_t at = 0; at < total && !stop_requested; at += block) {
+      const size_t n = (size_t)std::min<uint64_t>(block, total - at);
+      for (int ch = 0; ch < devices; ch++) {
+        sources[ch]->read(at, channel.data(), n);
+        for (size_t i = 0; i < n; i++) {
+          frames[i * devices + ch] = channel[i];
+        }
+      }
+      loc.push(frames.data(), n, &out);
+      report();
+    }
+  } else {
+    Aggregator agg(devices, config.rate, latency_ms);
+    std::vector<std::unique_ptr<DeviceReader>> readers;
+    for (int i = 0; i < devices; i++) {
+      readers.emplace_back(new DeviceReader(inputs[i], agg.ring(i), verify_crc));
+      readers.back()->start();
+    }
+    std::vector<int16_t> buf((size_t)Aggregator::BLOCK * 16 * devices);
+    const double start = monotonic_us();
+    double next_status = start + 5e6;
+    while (!stop_requested) {
+      usleep(10 * 1000);
+      const double now = monotonic_us();
+      size_t n;
+      while ((n = agg.render(now, buf.data(), buf.size() / devices)) > 0) {
+        loc.push(buf.data(), n, &out);
+      }
+      report();
+      if (!quiet && now >= next_status) {
+        int waiting = 0;
+        for (int i = 0; i < devices; i++) {
+          waiting += !agg.clock(i).ready();
+        }
+        fprintf(stderr, "%.1f s: %llu located, %d of %d devices waiting\n", (now - start) / 1e6,
+                (unsigned long long)located, waiting, devices);
+        next_status = now + 5e6;
+      }
+      if (seconds > 0 && now - start >= seconds * 1e6) {
+        break;
+      }
+    }
+    for (auto &reader : readers) {
+      reader->stop();
+    }
+  }
+  if (!quiet) {
+    fprintf(stderr, "%llu windows located\n", (unsigned long long)located);
+  }
+  return 0;
+}
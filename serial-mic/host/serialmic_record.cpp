@@ -0,0 +1,197 @@
+// serial-mic recorder
+//
+// Reads the packet stream from the CDC tty (or a capture file, or stdin),
+// checks the CRC and sequence numbers and streams the audio to disk as WAV,
+// switching to RF64 for files past 4 GiB. Memory use is fixed, so it can run
+// for days. See recorder.h for the files it writes.
+//
+//   serialmic_record /dev/ttyACM0 --out /data/mic --roll-seconds 3600
+//
+// Ctrl-C (or SIGTERM) finishes the files cleanly, SIGHUP starts new ones.
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <poll.h>
+#include <unistd.h>
+
+#include "recorder.h"
+#include "serial_port.h"
+
+using namespace serialmic;
+
+static volatile sig_atomic_t stop_requested = 0;
+static volatile sig_atomic_t roll_requested = 0;
+
+static void on_signal(int sig) {
+  if (sig == SIGHUP) {
+    roll_requested = 1;
+  } else {
+    stop_requested = 1;
+  }
+}
+
+static double now_sec(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void usage(void) {
+  fprintf(stderr, "usage: serialmic_record <tty|file|-> [--out PREFIX] [--rate HZ]\n"
+                  "                        [--roll-seconds N] [--roll-mb N] [--no-crc] [--no-fill]\n"
+                  "                        [--max-fill-seconds N] [--block-kb N] [--blocks N]\n"
+                  "                        [--reconnect] [--quiet]\n");
+  exit(1);
+}
+
+static void print_status(const Recorder &rec, double elapsed, int rate) {
+  const RecorderStats &s = rec.stats();
+  const ParserStats &p = rec.parser_stats();
+  fprintf(stderr,
+          "file %d  %.1f s  packets %llu  lost %llu (%llu gaps)  late %llu  restarts %llu  crc %llu  "
+          "skipped %llu B  %.1f kB/s\n",
+          s.files, (double)s.samples / rate, (unsigned long long)s.packets,
+          (unsigned long long)s.lost_packets, (unsigned long long)s.gaps,
+          (unsigned long long)s.late_packets, (unsigned long long)s.restarts,
+          (unsigned long long)s.crc_errors, (unsigned long long)p.skipped_bytes,
+          elapsed > 0 ? p.bytes / elapsed / 1024 : 0.0);
+}
+
+int main(int argc, char **argv) {
+  RecorderConfig config;
+  const char *input = nullptr;
+  bool reconnect = false;
+  bool quiet = false;
+
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    if (arg[0] != '-' || !strcmp(arg, "-")) {
+      if (input) {
+        usage();
+      }
+      input = arg;
+      continue;
+    }
+    if (!strcmp(arg, "--no-crc")) {
+      config.verify_crc = false;
+      continue;
+    }
+    if (!strcmp(arg, "--no-fill")) {
+      config.fill_gaps = false;
+      continue;
+    }
+    if (!strcmp(arg, "--reconnect")) {
+      reconnect = true;
+      continue;
+    }
+    if (!strcmp(arg, "--quiet")) {
+      quiet = true;
+      continue;
+    }
+    const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+    if (!value) {
+      usage();
+    }
+    i++;
+    if (!strcmp(arg, "--out")) {
+      config.prefix = value;
+    } else if (!strcmp(arg, "--rate")) {
+      config.sample_rate = atoi(value);
+    } else if (!strcmp(arg, "--roll-seconds")) {
+      config.roll_seconds = atof(value);
+    } else if (!strcmp(arg, "--roll-mb")) {
+      config.roll_bytes = (uint64_t)(atof(value) * 1024 * 1024);
+    } else if (!strcmp(arg, "--max-fill-seconds")) {
+      config.max_fill_seconds = atof(value);
+    } else if (!strcmp(arg, "--block-kb")) {
+      config.block_bytes = (size_t)atoi(value) * 1024;
+    } else if (!strcmp(arg, "--blocks")) {
+      config.blocks = atoi(value);
+    } else {
+      usage();
+    }
+  }
+  if (!input || config.sample_rate <= 0 || config.block_bytes == 0 || config.blocks < 2) {
+    usage();
+  }
+
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = on_signal; // no SA_RESTART, so read() and poll() return
+  sigaction(SIGINT, &sa, nullptr);
+  sigaction(SIGTERM, &sa, nullptr);
+  sigaction(SIGHUP, &sa, nullptr);
+
+  bool is_tty = false;
+  int fd = open_stream(input, &is_tty);
+  if (fd < 0) {
+    return 1;
+  }
+  Recorder rec(config);
+  if (!rec.start()) {
+    return 1;
+  }
+
+  static uint8_t buf[64 * 1024];
+  const double start = now_sec();
+  double next_status = start + 5;
+  while (!stop_requested) {
+    if (roll_requested) {
+      roll_requested = 0;
+      if (!rec.roll()) {
+        break;
+      }
+    }
+    if (fd < 0) {
+      // waiting for the device to come back
+      sleep(1);
+      fd = open_stream(input, &is_tty);
+      if (fd >= 0) {
+        rec.note("reopened");
+      }
+      continue;
+    }
+    struct pollfd pfd = {fd, POLLIN, 0};
+    int ready = poll(&pfd, 1, 500);
+    ssize_t n = 0;
+    if (ready > 0) {
+      n = read(fd, buf, sizeof(buf));
+      if (n > 0) {
+        rec.feed(buf, (size_t)n);
+      } else if (n < 0 && errno == EINTR) {
+        continue;
+      } else {
+        // end of a file, or the device went away (EIO, or EOF on some ttys)
+        if (n < 0) {
+          fprintf(stderr, "%s: %s\n", input, strerror(errno));
+        }
+        close(fd);
+        fd = -1;
+        if (!(reconnect && is_tty)) {
+          break;
+        }
+        rec.note("closed");
+      }
+    }
+    if (rec.failed()) {
+      fprintf(stderr, "write failed, stopping\n");
+      break;
+    }
+    const double now = now_sec();
+    if (!quiet && now >= next_status) {
+      print_status(rec, now - start, config.sample_rate);
+      next_status = now + 5;
+    }
+  }
+  if (fd >= 0) {
+    close(fd);
+  }
+  rec.finish();
+  if (!quiet) {
+    print_status(rec, now_sec() - start, config.sample_rate);
+  }
+  return rec.failed() ? 1 : 0;
+}
@@ -0,0 +1,180 @@
+// serial-mic shared memory bridge
+//
+// Owns the port, decodes the packets once and publishes the audio to a
+// shared memory ring any number of local processes can read at once - the
+// recorder, an analyzer and a classifier all from one board, with no pipes
+// in between. See shm_ring.h for how the ring works and
+// serialmic_shm_cat.cpp for a reader.
+//
+//   serialmic_shm /dev/ttyACM0 --name /serialmic0
+//   serialmic_shm_cat /serialmic0 > audio.raw
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <poll.h>
+#include <unistd.h>
+
+#include "serial_port.h"
+#include "shm_ring.h"
+
+using namespace serialmic;
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void on_signal(int) { stop_requested = 1; }
+
+static void usage(void) {
+  fprintf(stderr, "usage: serialmic_shm <tty|file|-> [--name /serialmic0] [--slots N] [--rate HZ]\n"
+                  "                     [--no-crc] [--quiet]\n");
+  exit(1);
+}
+
+// Publishes every good packet, with the seq bookkeeping done once here
+// rather than in every reader
+struct Publisher {
+  ShmWriter &shm;
+  bool have_seq = false;
+  uint32_t expected = 0;
+  uint64_t packets = 0, lost = 0, crc_errors = 0;
+
+  void on_packet(const Packet &pkt) {
+    uint32_t gap = 0;
+    uint16_t flags = 0;
+    if (have_seq) {
+      const int32_t d = seq_gap(expected, pkt.seq);
+      if (d > 0) {
+        gap = (uint32_t)d;
+        flags |= SHM_FRAME_GAP;
+        lost += gap;
+      } else if (d < 0) {
+        flags |= SHM_FRAME_RESTART;
+      }
+    }
+    have_seq = true;
+    expected = pkt.seq + 1;
+    packets++;
+    shm.publish(pkt, gap, flags);
+  }
+  void on_crc_error(uint64_t) { crc_errors++; }
+};
+
+static void print_status(const Publisher &pub, ShmWriter &shm) {
+  ShmHeader *h = shm.header();
+  const uint64_t published = h->published.load(std::memory_order_relaxed);
+  fprintf(stderr, "published %llu  lost %llu  crc %llu\n", (unsigned long long)published,
+          (unsigned long long)pub.lost, (unsigned long long)pub.crc_errors);
+  shm.reap_readers();
+  for (auto &r : h->readers) {
+    const int32_t pid = r.pid.load(std::memory_order_relaxed);
+    if (pid) {
+      fprintf(stderr, "  reader %d: %llu behind, %llu overruns\n", pid,
+              (unsigned long long)(published - r.cursor.load(std::memory_order_relaxed)),
+              (unsigned long long)r.overruns.load(std::memory_order_relaxed));
+    }
+  }
+}
+
+int main(int argc, char **argv) {
+  const char *input = nullptr;
+  const char *name = "/serialmic0";
+  uint32_t slots = 256; // 16s of audio
+  int rate = SAMPLE_RATE;
+  bool verify_crc = true;
+  bool quiet = false;
+
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    if (arg[0] != '-' || !strcmp(arg, "-")) {
+      if (input) {
+        usage();
+      }
+      input = arg;
+      continue;
+    }
+    if (!strcmp(arg, "--no-crc")) {
+      verify_crc = false;
+      continue;
+    }
+    if (!strcmp(arg, "--quiet")) {
+      quiet = true;
+      continue;
+    }
+    const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+    if (!value) {
+      usage();
+    }
+    i++;
+    if (!strcmp(arg, "--name")) {
+      name = value;
+    } else if (!strcmp(arg, "--slots")) {
+      slots = (uint32_t)atoi(value);
+    } else if (!strcmp(arg, "--rate")) {
+      rate = atoi(value);
+    } else {
+      usage();
+    }
+  }
+  if (!input) {
+    usage();
+  }
+
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = on_signal;
+  sigaction(SIGINT, &sa, nullptr);
+  sigaction(SIGTERM, &sa, nullptr);
+
+  ShmWriter shm;
+  if (!shm.create(name, slots, rate)) {
+    return 1;
+  }
+  bool is_tty = false;
+  int fd = open_stream(input, &is_tty);
+  if (fd < 0) {
+    return 1;
+  }
+  PacketParser parser(verify_crc);
+  Publisher pub{shm};
+  static uint8_t buf[64 * 1024];
+  double next_status = 0;
+  while (!stop_requested) {
+    if (fd < 0) {
+      // the board was unplugged: readers keep their mapping and carry on
+      // when it comes back
+      sleep(1);
+      fd = open_stream(input, &is_tty);
+      parser.reset();
+      continue;
+    }
+    struct pollfd pfd = {fd, POLLIN, 0};
+    if (poll(&pfd, 1, 500) > 0) {
+      ssize_t n = read(fd, buf, sizeof(buf));
+      if (n > 0) {
+        parser.feed(buf, (size_t)n, pub);
+      } else if (!(n < 0 && errno == EINTR)) {
+        close(fd);
+        fd = -1;
+        if (!is_tty) {
+          break;
+        }
+      }
+    }
+    const double now = monotonic_ns() * 1e-9;
+    if (!quiet && now >= next_status) {
+      if (next_status > 0) {
+        print_status(pub, shm);
+      }
+      next_status = now + 5;
+    }
+  }
+  if (fd >= 0) {
+    close(fd);
+  }
+  if (!quiet) {
+    print_status(pub, shm);
+  }
+  shm.close();
+  return 0;
+}
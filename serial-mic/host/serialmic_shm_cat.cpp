@@ -0,0 +1,94 @@
+// Reads audio from a serialmic_shm ring
+//
+// Writes the samples to stdout as raw PCM16 - a drop-in for a pipe from the
+// port - or with --meter prints the level once a second instead, worked out
+// in place in shared memory without copying the audio.
+//
+//   serialmic_shm_cat /serialmic0 | sox -t raw -r 16k -e signed -b 16 -c 1 - out.flac
+//   serialmic_shm_cat /serialmic0 --meter
+#include <cmath>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "shm_ring.h"
+
+using namespace serialmic;
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void on_signal(int) { stop_requested = 1; }
+
+int main(int argc, char **argv) {
+  const char *name = nullptr;
+  bool meter = false;
+  bool from_oldest = false;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--meter")) {
+      meter = true;
+    } else if (!strcmp(argv[i], "--oldest")) {
+      from_oldest = true;
+    } else if (!name && argv[i][0] != '-') {
+      name = argv[i];
+    } else {
+      fprintf(stderr, "usage: serialmic_shm_cat <name> [--meter] [--oldest]\n");
+      return 1;
+    }
+  }
+  if (!name) {
+    name = "/serialmic0";
+  }
+  signal(SIGINT, on_signal);
+  signal(SIGTERM, on_signal);
+  signal(SIGPIPE, on_signal);
+
+  ShmReader reader;
+  if (!reader.open(name, from_oldest)) {
+    return 1;
+  }
+  const int rate = (int)reader.header()->sample_rate;
+  double sum = 0;
+  int64_t count = 0;
+  int16_t copy[SHM_MAX_SAMPLES];
+  FrameView view;
+  while (!stop_requested && reader.writer_alive()) {
+    if (!reader.next(view, 500)) {
+      continue;
+    }
+    if (view.skipped) {
+      fprintf(stderr, "overrun: %llu frames missed\n", (unsigned long long)view.skipped);
+    }
+    const ShmFrame *f = view.frame;
+    const size_t samples = f->samples;
+    if (meter) {
+      // straight from shared memory; thrown away if the writer lapped us
+      double s = 0;
+      for (size_t i = 0; i < samples; i++) {
+        s += (double)f->pcm[i] * f->pcm[i];
+      }
+      if (!reader.done(view)) {
+        continue;
+      }
+      sum += s;
+      count += samples;
+      if (count >= rate) {
+        printf("%6.1f dBFS  lag %llu  overruns %llu\n", 10 * log10(sum / count / (32768.0 * 32768.0) + 1e-20),
+               (unsigned long long)reader.lag(), (unsigned long long)reader.overruns());
+        fflush(stdout);
+        sum = 0;
+        count = 0;
+      }
+    } else {
+      // copied out and checked before it goes anywhere we can't take it back
+      memcpy(copy, f->pcm, samples * 2);
+      if (!reader.done(view)) {
+        continue;
+      }
+      if (fwrite(copy, 2, samples, stdout) != samples) {
+        break;
+      }
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,247 @@
+// serial-mic sound level meter
+//
+// Reads a board running in sound level meter mode (SLM_MODE in the firmware,
+// see ../include/mic_slm.h): each interval's LAeq, LCeq and LZeq and its
+// 1/3 octave band levels, one line per interval, and the Leq of the whole run
+// at the end. Levels are dB SPL given what a full scale sine is for the mic
+// (--full-scale-db, 120 for the usual -26 dBFS at 94 dB SPL parts), and the
+// bands can be shown A or C weighted.
+//
+//   serialmic_slm /dev/ttyACM0
+//   serialmic_slm /dev/ttyACM0 --weight A --csv levels.csv
+//   serialmic_slm levels.bin --full-scale-db 116.5
+#include <cerrno>
+#include <cmath>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <poll.h>
+#include <unistd.h>
+
+#include "serial_port.h"
+#include "slm.h"
+
+using namespace serialmic;
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void on_signal(int) { stop_requested = 1; }
+
+static void usage(void) {
+  fprintf(stderr, "usage: serialmic_slm <tty|file|-> [--full-scale-db DB] [--weight A|C|Z] [--csv FILE] [--no-crc]\n");
+  exit(1);
+}
+
+struct SlmHandler {
+  double full_scale_db;
+  char weight; // applied to the bands shown
+  FILE *csv;
+
+  BandLevels levels{};
+  bool header_done = false;
+  uint64_t intervals = 0, pcm_packets = 0, bad = 0;
+  // the run so far, as energy times samples
+  double run_samples = 0, run_a = 0, run_c = 0, run_z = 0;
+  std::vector<double> run_bands{};
+
+  double band_weight_db(int x) const {
+    const double hz = band_centre_hz(x);
+    return weight == 'A' ? a_weighting_db(hz) : weight == 'C' ? c_weighting_db(hz) : 0;
+  }
+
+  // the table goes to stdout unless the CSV does
+  bool table(void) const { return csv != stdout; }
+
+  void print_header(void) {
+    header_done = true;
+    if (csv) {
+      fprintf(csv, "seq,usec,samples,laeq,lceq,lzeq");
+      for (size_t i = 0; i < levels.bands.size(); i++) {
+        fprintf(csv, ",%g", band_nominal_hz(levels.band(i)));
+      }
+      fprintf(csv, "\n");
+    }
+    if (!table()) {
+      return;
+    }
+    printf("%8s %6s %6s %6s  ", "seq", "LAeq", "LCeq", "LZeq");
+    for (size_t i = 0; i < levels.bands.size(); i++) {
+      const double hz = band_nominal_hz(levels.band(i));
+      if (hz >= 1000) {
+        printf(" %4.3gk", hz / 1000);
+      } else {
+        printf(" %5.3g", hz);
+      }
+    }
+    printf("  (bands %c weighted, dB SPL)\n", weight);
+  }
+
+  static void accumulate(double &sum, double db, double samples) {
+    if (!std::isnan(db)) {
+      sum += pow(10, db / 10) * samples;
+    }
+  }
+
+  void on_band_levels(const Packet &pkt) {
+    if (!read_band_levels(pkt, levels)) {
+      bad++;
+      return;
+    }
+    if (!header_done || levels.bands.size() != run_bands.size()) {
+      run_bands.assign(levels.bands.size(), 0);
+      print_header();
+    }
+    const double cal = full_scale_db;
+    if (table()) {
+      printf("%8u %6.1f %6.1f %6.1f  ", levels.seq, levels.la + cal, levels.lc + cal, levels.lz + cal);
+      for (size_t i = 0; i < levels.bands.size(); i++) {
+        const double db = levels.bands[i] + cal + band_weight_db(levels.band(i));
+        if (std::isnan(db)) {
+          printf(" %5s", "-");
+        } else {
+          printf(" %5.1f", db);
+        }
+      }
+      printf("\n");
+      fflush(stdout);
+    }
+    if (csv) {
+      fprintf(csv, "%u,%u,%u,%.2f,%.2f,%.2f", levels.seq, levels.usec, levels.samples, levels.la + cal,
+              levels.lc + cal, levels.lz + cal);
+      for (size_t i = 0; i < levels.bands.size(); i++) {
+        fprintf(csv, ",%.2f", levels.bands[i] + cal + band_weight_db(levels.band(i)));
+      }
+      fprintf(csv, "\n");
+    }
+
+    const double n = levels.samples;
+    run_samples += n;
+    accumulate(run_a, levels.la, n);
+    accumulate(run_c, levels.lc, n);
+    accumulate(run_z, levels.lz, n);
+    for (size_t i = 0; i < levels.bands.size(); i++) {
+      accumulate(run_bands[i], levels.bands[i], n);
+    }
+    intervals++;
+  }
+  void on_packet(const Packet &) { pcm_packets++; }
+  void on_crc_error(uint64_t) {}
+};
+
+static double run_db(double sum, double samples, double cal) {
+  return sum > 0 ? 10 * log10(sum / samples) + cal : NAN;
+}
+
+static void print_summary(const SlmHandler &h) {
+  if (h.pcm_packets && !h.intervals) {
+    fprintf(stderr, "%llu PCM packets and no levels: the board isn't in sound level meter mode (SLM_MODE)\n",
+            (unsigned long long)h.pcm_packets);
+    return;
+  }
+  if (!h.intervals) {
+    fprintf(stderr, "no band levels\n");
+    return;
+  }
+  const double cal = h.full_scale_db;
+  fprintf(stderr, "%llu intervals: LAeq %.1f  LCeq %.1f  LZeq %.1f dB SPL", (unsigned long long)h.intervals,
+          run_db(h.run_a, h.run_samples, cal), run_db(h.run_c, h.run_samples, cal),
+          run_db(h.run_z, h.run_samples, cal));
+  std::vector<double> bands(h.run_bands.size());
+  for (size_t i = 0; i < bands.size(); i++) {
+    bands[i] = run_db(h.run_bands[i], h.run_samples, cal);
+  }
+  // the bands cover 22 Hz to 7 kHz, so short of LZeq by what's outside them
+  fprintf(stderr, ", bands summed %.1f\n", sum_levels_db(bands.data(), bands.size()));
+  if (h.bad) {
+    fprintf(stderr, "%llu malformed level packets\n", (unsigned long long)h.bad);
+  }
+}
+
+int main(int argc, char **argv) {
+  const char *input = nullptr;
+  const char *csv_path = nullptr;
+  double full_scale_db = 120;
+  char weight = 'Z';
+  bool verify_crc = true;
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    if (arg[0] != '-' || !strcmp(arg, "-")) {
+      if (input) {
+        usage();
+      }
+      input = arg;
+      continue;
+    }
+    if (!strcmp(arg, "--no-crc")) {
+      verify_crc = false;
+      continue;
+    }
+    const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+    if (!value) {
+      usage();
+    }
+    i++;
+    if (!strcmp(arg, "--full-scale-db")) {
+      full_scale_db = atof(value);
+    } else if (!strcmp(arg, "--weight")) {
+      weight = value[0];
+      if (value[1] || !strchr("ACZ", weight)) {
+        usage();
+      }
+    } else if (!strcmp(arg, "--csv")) {
+      csv_path = value;
+    } else {
+      usage();
+    }
+  }
+  if (!input) {
+    usage();
+  }
+
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = on_signal; // no SA_RESTART, so read() and poll() return
+  sigaction(SIGINT, &sa, nullptr);
+  sigaction(SIGTERM, &sa, nullptr);
+
+  const int fd = open_stream(input);
+  if (fd < 0) {
+    return 1;
+  }
+  FILE *csv = nullptr;
+  if (csv_path) {
+    csv = strcmp(csv_path, "-") ? fopen(csv_path, "w") : stdout;
+    if (!csv) {
+      perror(csv_path);
+      return 1;
+    }
+  }
+
+  SlmHandler handler{full_scale_db, weight, csv};
+  PacketParser parser(verify_crc);
+  static uint8_t buf[4096];
+  int status = 0;
+  while (!stop_requested) {
+    struct pollfd pfd = {fd, POLLIN, 0};
+    if (poll(&pfd, 1, 500) <= 0) {
+      continue;
+    }
+    const ssize_t n = read(fd, buf, sizeof(buf));
+    if (n > 0) {
+      parser.feed(buf, (size_t)n, handler);
+    } else if (!(n < 0 && errno == EINTR)) {
+      if (n < 0) {
+        fprintf(stderr, "%s: %s\n", input, strerror(errno));
+        status = 1;
+      }
+      break;
+    }
+  }
+  close(fd);
+  print_summary(handler);
+  if (csv && csv != stdout) {
+    fclose(csv);
+  }
+  return status;
+}
@@ -0,0 +1,144 @@
+// Spectrograms and features for long recordings
+//
+// Works through a WAV (from serialmic_record or serialmic_aggregate) or a
+// capture (serialmic_capture) on every core, writing a zoomable tile
+// pyramid, a feature matrix and per minute levels - see spectro.h.
+//
+//   serialmic_spectro /data/mic-0001.wav --out /data/mic-0001.spectro
+//   serialmic_spectro site.smc --out site.spectro --threads 8 --no-tiles
+//   serialmic_spectro --dump site.spectro/features.smf --from 3600 --seconds 2
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+
+#include "audio_source.h"
+#include "feature_file.h"
+#include "spectro.h"
+
+using namespace serialmic;
+
+static double now_sec(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void usage(void) {
+  fprintf(stderr, "usage: serialmic_spectro <file.wav|file.smc> --out DIR [--channel N] [--threads N]\n"
+                  "                         [--fft N] [--hop N] [--bands N] [--tile-width N]\n"
+                  "                         [--floor-db DB] [--ceil-db DB] [--no-tiles] [--no-features] [--quiet]\n"
+                  "       serialmic_spectro --dump FEATURES.smf [--from SECONDS] [--seconds N]\n");
+  exit(1);
+}
+
+// Rows of a feature file as CSV, found through the mapped file
+static int dump(const char *path, double from, double seconds) {
+  FeatureReader reader;
+  if (!reader.open(path)) {
+    return 1;
+  }
+  const FeatureHeader &h = reader.header();
+  printf("seconds");
+  for (uint32_t b = 0; b < h.bands; b++) {
+    printf(",mel_%.0fhz", mel_band_centre((int)b, (int)h.bands, h.mel_low_hz, h.mel_high_hz));
+  }
+  printf(",rms_db,peak_db\n");
+  const uint64_t end = reader.frame_at(from + seconds);
+  for (uint64_t f = reader.frame_at(from); f < end; f++) {
+    const float *row = reader.row(f);
+    printf("%.3f", reader.seconds(f));
+    for (uint32_t c = 0; c < h.columns; c++) {
+      printf(",%.2f", row[c]);
+    }
+    printf("\n");
+  }
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  SpectroConfig config;
+  const char *input = nullptr;
+  const char *dump_path = nullptr;
+  double from = 0, seconds = 1;
+  int channel = 0;
+  bool quiet = false;
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    if (arg[0] != '-') {
+      if (input) {
+        usage();
+      }
+      input = arg;
+      continue;
+    }
+    if (!strcmp(arg, "--no-tiles")) {
+      config.tiles = false;
+      continue;
+    }
+    if (!strcmp(arg, "--no-features")) {
+      config.features = false;
+      continue;
+    }
+    if (!strcmp(arg, "--quiet")) {
+      quiet = true;
+      continue;
+    }
+    const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+    if (!value) {
+      usage();
+    }
+    i++;
+    if (!strcmp(arg, "--out")) {
+      config.out_dir = value;
+    } else if (!strcmp(arg, "--channel")) {
+      channel = atoi(value);
+    } else if (!strcmp(arg, "--threads")) {
+      config.threads = atoi(value);
+    } else if (!strcmp(arg, "--fft")) {
+      config.fft_size = (size_t)atoi(value);
+    } else if (!strcmp(arg, "--hop")) {
+      config.hop = (size_t)atoi(value);
+    } else if (!strcmp(arg, "--bands")) {
+      config.bands = atoi(value);
+    } else if (!strcmp(arg, "--tile-width")) {
+      config.tile_width = atoi(value);
+    } else if (!strcmp(arg, "--floor-db")) {
+      config.floor_db = (float)atof(value);
+    } else if (!strcmp(arg, "--ceil-db")) {
+      config.ceil_db = (float)atof(value);
+    } else if (!strcmp(arg, "--dump")) {
+      dump_path = value;
+    } else if (!strcmp(arg, "--from")) {
+      from = atof(value);
+    } else if (!strcmp(arg, "--seconds")) {
+      seconds = atof(value);
+    } else {
+      usage();
+    }
+  }
+  if (dump_path) {
+    return input ? (usage(), 1) : dump(dump_path, from, seconds);
+  }
+  if (!input || config.out_dir.empty() || (!config.tiles && !config.features)) {
+    usage();
+  }
+  std::unique_ptr<AudioSource> src = open_audio(input, channel);
+  if (!src) {
+    return 1;
+  }
+  config.progress = !quiet;
+  SpectroStats stats;
+  const double start = now_sec();
+  if (!run_spectro(*src, config, &stats)) {
+    return 1;
+  }
+  const double elapsed = now_sec() - start;
+  if (!quiet) {
+    fprintf(stderr, "%.2f hours, %llu frames, %llu tiles in %d levels on %d threads: %.1f s (%.0fx real time)\n",
+            stats.audio_seconds / 3600, (unsigned long long)stats.frames, (unsigned long long)stats.tiles,
+            stats.levels, stats.threads, elapsed, stats.audio_seconds / elapsed);
+  }
+  return 0;
+}
@@ -0,0 +1,219 @@
+// serial-mic clock sync
+//
+// Keeps the host's clock and a board's lined up while it streams: a sync
+// request down the CDC link every so often, which the board answers with its
+// clock when the request came in and when the reply went out (see
+// clock_sync.h). With the packets' own stamps, that puts a host time on
+// every sample. Prints the offset, skew and how good the estimate is every
+// few seconds, and with --csv the host time of each packet's first sample.
+//
+//   serialmic_sync /dev/ttyACM0
+//   serialmic_sync /dev/ttyACM0 --interval-ms 100 --csv times.csv
+//
+// Needs the port itself: the board only answers what is written to it.
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <poll.h>
+#include <unistd.h>
+
+#include "capture_file.h"
+#include "clock_sync.h"
+#include "serial_port.h"
+#include "shm_ring.h"
+
+using namespace serialmic;
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void on_signal(int) { stop_requested = 1; }
+
+static double host_now_us(void) { return monotonic_ns() / 1e3; }
+
+static void usage(void) {
+  fprintf(stderr, "usage: serialmic_sync <tty> [--interval-ms MS] [--every S] [--csv FILE] [--rate HZ] [--no-crc]\n");
+  exit(1);
+}
+
+struct SyncHandler {
+  ClockSync &sync;
+  SampleClock &samples;
+  FILE *csv;
+  double realtime_offset_us; // CLOCK_REALTIME less CLOCK_MONOTONIC
+  double now_us = 0;         // when the bytes being parsed were read
+
+  bool have_seq = false;
+  uint32_t last_seq = 0;
+  uint64_t sample_end = 0;
+  uint64_t packets = 0, restarts = 0;
+  // how late the packets were read, against the host time of their last sample
+  double late_sum_us = 0, late_max_us = 0;
+  uint64_t late_count = 0;
+
+  void on_packet(const Packet &pkt) {
+    if (have_seq && seq_gap(last_seq + 1, pkt.seq) < 0) {
+      // the board restarted, and its clock with it
+      sync.restart();
+      samples.reset();
+      sample_end = 0;
+      restarts++;
+    } else if (have_seq) {
+      // lost packets still had their samples
+      sample_end += (uint64_t)(seq_gap(last_seq + 1, pkt.seq)) * pkt.samples();
+    }
+    have_seq = true;
+    last_seq = pkt.seq;
+    const uint64_t first = sample_end;
+    sample_end += pkt.samples();
+    samples.add(sample_end, sync.unwrap(pkt.usec));
+    packets++;
+    if (!sync.ready()) {
+      return;
+    }
+    const double late = now_us - samples.host_us((double)sample_end - 1, sync);
+    late_sum_us += late;
+    late_max_us = late > late_max_us ? late : late_max_us;
+    late_count++;
+    if (csv) {
+      fprintf(csv, "%u,%u,%.6f\n", pkt.seq, pkt.usec,
+              (samples.host_us((double)first, sync) + realtime_offset_us) / 1e6);
+    }
+  }
+  void on_sync_reply(const Packet &pkt) { sync.reply(read_sync_reply(pkt), now_us); }
+  void on_crc_error(uint64_t) {}
+};
+
+static void print_status(const SyncHandler &h) {
+  const ClockSync &s = h.sync;
+  if (!s.ready()) {
+    fprintf(stderr, "packets %llu  no replies yet\n", (unsigned long long)h.packets);
+    return;
+  }
+  fprintf(stderr,
+          "offset %.3f s  skew %+.2f ppm  exchanges %llu  min delay %.0f us  residual %.1f us  "
+          "packets %llu read %.2f ms late (max %.2f)  restarts %llu\n",
+          s.offset_us() / 1e6, s.skew_ppm(), (unsigned long long)s.exchanges(), s.min_delay_us(), s.residual_us(),
+          (unsigned long long)h.packets, h.late_count ? h.late_sum_us / h.late_count / 1e3 : 0.0,
+          h.late_max_us / 1e3, (unsigned long long)h.restarts);
+}
+
+int main(int argc, char **argv) {
+  const char *input = nullptr;
+  const char *csv_path = nullptr;
+  double interval_ms = 250;
+  double every = 5;
+  int rate = SAMPLE_RATE;
+  bool verify_crc = true;
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    if (arg[0] != '-') {
+      if (input) {
+        usage();
+      }
+      input = arg;
+      continue;
+    }
+    if (!strcmp(arg, "--no-crc")) {
+      verify_crc = false;
+      continue;
+    }
+    const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+    if (!value) {
+      usage();
+    }
+    i++;
+    if (!strcmp(arg, "--interval-ms")) {
+      interval_ms = atof(value);
+    } else if (!strcmp(arg, "--every")) {
+      every = atof(value);
+    } else if (!strcmp(arg, "--csv")) {
+      csv_path = value;
+    } else if (!strcmp(arg, "--rate")) {
+      rate = atoi(value);
+    } else {
+      usage();
+    }
+  }
+  if (!input || interval_ms <= 0 || every <= 0 || rate <= 0) {
+    usage();
+  }
+
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = on_signal; // no SA_RESTART, so read() and poll() return
+  sigaction(SIGINT, &sa, nullptr);
+  sigaction(SIGTERM, &sa, nullptr);
+  signal(SIGPIPE, SIG_IGN);
+
+  bool is_tty = false;
+  int fd = open_stream(input, &is_tty, true);
+  if (fd < 0) {
+    return 1;
+  }
+  if (!is_tty) {
+    fprintf(stderr, "%s: not a tty; the board has to be there to answer\n", input);
+    return 1;
+  }
+  FILE *csv = nullptr;
+  if (csv_path) {
+    csv = strcmp(csv_path, "-") ? fopen(csv_path, "w") : stdout;
+    if (!csv) {
+      perror(csv_path);
+      return 1;
+    }
+    fprintf(csv, "seq,usec,host_time\n");
+  }
+
+  ClockSync sync;
+  SampleClock samples(rate);
+  SyncHandler handler{sync, samples, csv, (double)realtime_us() - host_now_us()};
+  static PacketParser parser(verify_crc);
+
+  static uint8_t buf[64 * 1024];
+  double next_request = host_now_us();
+  double next_status = next_request + every * 1e6;
+  int status = 0;
+  while (!stop_requested) {
+    double now = host_now_us();
+    if (now >= next_request) {
+      // stamped as close to the write as it can be
+      uint8_t req[SYNC_REQUEST_BYTES];
+      const size_t n = encode_sync_request(req, sync.request(now));
+      if (write(fd, req, n) != (ssize_t)n && errno != EINTR) {
+        fprintf(stderr, "%s: %s\n", input, strerror(errno));
+        status = 1;
+        break;
+      }
+      next_request = now + interval_ms * 1e3;
+    }
+    struct pollfd pfd = {fd, POLLIN, 0};
+    const int timeout_ms = (int)((next_request - now) / 1e3) + 1;
+    if (poll(&pfd, 1, timeout_ms) > 0) {
+      ssize_t n = read(fd, buf, sizeof(buf));
+      handler.now_us = host_now_us();
+      if (n > 0) {
+        parser.feed(buf, (size_t)n, handler);
+      } else if (n < 0 && errno == EINTR) {
+        continue;
+      } else {
+        if (n < 0) {
+          fprintf(stderr, "%s: %s\n", input, strerror(errno));
+          status = 1;
+        }
+        break;
+      }
+    }
+    if (host_now_us() >= next_status) {
+      print_status(handler);
+      next_status += every * 1e6;
+    }
+  }
+  close(fd);
+  print_status(handler);
+  if (csv && csv != stdout) {
+    fclose(csv);
+  }
+  return status;
+}
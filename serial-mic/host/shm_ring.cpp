@@ -0,0 +1,279 @@
+#include "shm_ring.h"
+
+#include <cerrno>
+#include <climits>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+namespace serialmic {
+
+uint64_t monotonic_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// ====================== Waiting ======================
+// Shared (not process private) futexes, so they work across processes.
+// Elsewhere readers poll every millisecond.
+static void wake_all(std::atomic<uint32_t> *word) {
+#ifdef __linux__
+  syscall(SYS_futex, (uint32_t *)word, FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+#else
+  (void)word;
+#endif
+}
+
+static void wait_on(std::atomic<uint32_t> *word, uint32_t seen, int timeout_ms) {
+#ifdef __linux__
+  struct timespec ts = {timeout_ms / 1000, (long)(timeout_ms % 1000) * 1000000};
+  syscall(SYS_futex, (uint32_t *)word, FUTEX_WAIT, seen, timeout_ms < 0 ? nullptr : &ts, nullptr, 0);
+#else
+  (void)word;
+  (void)seen;
+  usleep(timeout_ms >= 0 && timeout_ms < 1 ? timeout_ms * 1000 : 1000);
+#endif
+}
+
+// ====================== Writer ======================
+bool ShmWriter::create(const char *name, uint32_t slots, int sample_rate) {
+  close();
+  if (slots == 0 || (slots & (slots - 1))) {
+    fprintf(stderr, "ring slots must be a power of two\n");
+    return false;
+  }
+  shm_unlink(name); // a ring left by a bridge that died
+  int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0644);
+  if (fd < 0) {
+    fprintf(stderr, "can't create shared memory %s: %s\n", name, strerror(errno));
+    return false;
+  }
+  size_ = shm_size(slots);
+  void *p = MAP_FAILED;
+  if (ftruncate(fd, (off_t)size_) == 0) {
+    p = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+  ::close(fd);
+  if (p == MAP_FAILED) {
+    fprintf(stderr, "can't map shared memory %s: %s\n", name, strerror(errno));
+    shm_unlink(name);
+    return false;
+  }
+  // the memory starts zeroed, which is where all the counters start
+  name_ = name;
+  header_ = (ShmHeader *)p;
+  header_->version = SHM_VERSION;
+  header_->slots = slots;
+  header_->sample_rate = (uint32_t)sample_rate;
+  header_->writer_pid.store(getpid(), std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  header_->magic = SHM_MAGIC; // readers check this last
+  return true;
+}
+
+void ShmWriter::close() {
+  if (!header_) {
+    return;
+  }
+  header_->writer_pid.store(0, std::memory_order_relaxed);
+  // wake anyone waiting so they can see the writer has gone
+  header_->futex.fetch_add(1, std::memory_order_release);
+  wake_all(&header_->futex);
+  munmap(header_, size_);
+  shm_unlink(name_.c_str());
+  header_ = nullptr;
+}
+
+ShmFrame *ShmWriter::begin_frame(uint64_t &n) {
+  n = header_->published.load(std::memory_order_relaxed);
+  ShmFrame *f = &shm_frames(header_)[n & (header_->slots - 1)];
+  f->stamp.store(2 * n + 1, std::memory_order_relaxed);
+  // the odd stamp is seen before any of the new contents
+  std::atomic_thread_fence(std::memory_order_release);
+  return f;
+}
+
+void ShmWriter::end_frame(ShmFrame *f, uint64_t n) {
+  f->stamp.store(2 * n + 2, std::memory_order_release);
+  header_->published.store(n + 1, std::memory_order_release);
+  header_->futex.fetch_add(1, std::memory_order_seq_cst);
+  if (header_->waiters.load(std::memory_order_seq_cst)) {
+    wake_all(&header_->futex);
+  }
+}
+
+void ShmWriter::publish(const Packet &pkt, uint32_t lost, uint16_t flags) {
+  if (!header_) {
+    return;
+  }
+  uint64_t n;
+  ShmFrame *f = begin_frame(n);
+  const size_t samples = pkt.samples() < SHM_MAX_SAMPLES ? pkt.samples() : SHM_MAX_SAMPLES;
+  f->seq = pkt.seq;
+  f->usec = pkt.usec;
+  f->lost = lost;
+  f->flags = flags;
+  f->samples = (uint16_t)samples;
+  memcpy(f->pcm, pkt.payload, samples * 2); // little-endian host
+  f->publish_ns = monotonic_ns();
+  end_frame(f, n);
+}
+
+void ShmWriter::publish(uint32_t seq, uint32_t usec, const int16_t *pcm, size_t samples, uint32_t lost,
+                        uint16_t flags) {
+  if (!header_) {
+    return;
+  }
+  uint64_t n;
+  ShmFrame *f = begin_frame(n);
+  if (samples > SHM_MAX_SAMPLES) {
+    samples = SHM_MAX_SAMPLES;
+  }
+  f->seq = seq;
+  f->usec = usec;
+  f->lost = lost;
+  f->flags = flags;
+  f->samples = (uint16_t)samples;
+  memcpy(f->pcm, pcm, samples * 2);
+  f->publish_ns = monotonic_ns();
+  end_frame(f, n);
+}
+
+void ShmWriter::reap_readers() {
+  for (auto &r : header_->readers) {
+    int32_t pid = r.pid.load(std::memory_order_relaxed);
+    if (pid && kill(pid, 0) < 0 && errno == ESRCH) {
+      r.pid.compare_exchange_strong(pid, 0);
+    }
+  }
+}
+
+// ====================== Reader ======================
+bool ShmReader::open(const char *name, bool from_oldest) {
+  close();
+  int fd = shm_open(name, O_RDWR, 0);
+  if (fd < 0) {
+    fprintf(stderr, "can't open shared memory %s: %s\n", name, strerror(errno));
+    return false;
+  }
+  ShmHeader probe;
+  void *p = MAP_FAILED;
+  if (pread(fd, &probe, offsetof(ShmHeader, published), 0) == (ssize_t)offsetof(ShmHeader, published) &&
+      probe.magic == SHM_MAGIC && probe.version == SHM_VERSION) {
+    size_ = shm_size(probe.slots);
+    p = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+  ::close(fd);
+  if (p == MAP_FAILED) {
+    fprintf(stderr, "%s is not a serial-mic ring (or not ready yet)\n", name);
+    return false;
+  }
+  header_ = (ShmHeader *)p;
+  const uint64_t published = header_->published.load(std::memory_order_acquire);
+  cursor_ = published;
+  if (from_oldest) {
+    cursor_ = published > header_->slots ? published - header_->slots : 0;
+  } else if (published > 0) {
+    cursor_ = published - 1;
+  }
+  // take a slot to show up in the bridge's list, if there is one free
+  const int32_t pid = getpid();
+  for (auto &r : header_->readers) {
+    int32_t free_pid = 0;
+    if (r.pid.compare_exchange_strong(free_pid, pid)) {
+      r.cursor.store(cursor_, std::memory_order_relaxed);
+      r.overruns.store(0, std::memory_order_relaxed);
+      slot_ = &r;
+      break;
+    }
+  }
+  return true;
+}
+
+void ShmReader::close() {
+  if (!header_) {
+    return;
+  }
+  if (slot_) {
+    slot_->pid.store(0, std::memory_order_release);
+    slot_ = nullptr;
+  }
+  munmap(header_, size_);
+  header_ = nullptr;
+}
+
+uint64_t ShmReader::lag() const { return header_->published.load(std::memory_order_acquire) - cursor_; }
+
+bool ShmReader::next(FrameView &view, int timeout_ms) {
+  const uint64_t deadline = timeout_ms > 0 ? monotonic_ns() + (uint64_t)timeout_ms * 1000000 : 0;
+  const uint32_t slots = header_->slots;
+  uint64_t skipped = 0;
+  for (;;) {
+    const uint64_t published = header_->published.load(std::memory_order_acquire);
+    if (cursor_ < published) {
+      if (published - cursor_ > slots) {
+        // lapped: go to the oldest frame still held
+        skipped += published - slots - cursor_;
+        cursor_ = published - slots;
+      }
+      const ShmFrame *f = &shm_frames(header_)[cursor_ & (slots - 1)];
+      if (f->stamp.load(std::memory_order_acquire) != 2 * cursor_ + 2) {
+        // overwritten since `published` was read
+        skipped++;
+        cursor_++;
+        continue;
+      }
+      view.frame = f;
+      view.index = cursor_;
+      view.skipped = skipped;
+      if (skipped) {
+        overruns_++;
+        skipped_ += skipped;
+      }
+      cursor_++;
+      if (slot_) {
+        slot_->cursor.store(cursor_, std::memory_order_relaxed);
+        slot_->overruns.store(overruns_, std::memory_order_relaxed);
+      }
+      return true;
+    }
+    if (timeout_ms == 0 || (deadline && monotonic_ns() >= deadline) || !writer_alive()) {
+      return false;
+    }
+    // sleep until the writer bumps the futex word
+    const uint32_t seen = header_->futex.load(std::memory_order_acquire);
+    header_->waiters.fetch_add(1, std::memory_order_seq_cst);
+    if (header_->published.load(std::memory_order_seq_cst) == published) {
+      int wait_ms = -1;
+      if (deadline) {
+        const uint64_t now = monotonic_ns();
+        wait_ms = now < deadline ? (int)((deadline - now + 999999) / 1000000) : 0;
+      }
+      wait_on(&header_->futex, seen, wait_ms);
+    }
+    header_->waiters.fetch_sub(1, std::memory_order_seq_cst);
+  }
+}
+
+bool ShmReader::done(const FrameView &view) {
+  if (view.valid()) {
+    return true;
+  }
+  overruns_++;
+  skipped_++;
+  if (slot_) {
+    slot_->overruns.store(overruns_, std::memory_order_relaxed);
+  }
+  return false;
+}
+
+} // namespace serialmic
@@ -0,0 +1,153 @@
+// Decoded serial-mic audio in POSIX shared memory, for any number of local
+// readers
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "packet.h"
+
+namespace serialmic {
+
+// One process (the bridge) owns the port, decodes the packets once and
+// publishes the audio into a ring of frames in shared memory; any number of
+// other processes map it and follow along with their own cursor. They only
+// read the frames, but map the whole segment read-write: a reader claims a
+// slot in the header's readers[] to show its cursor and overruns to the
+// bridge, and bumps waiters around its futex sleep so the writer knows to
+// wake it.
+//
+// Publishing never waits for a reader. Each frame has a stamp - odd while the
+// writer is filling it, even once it's published - so a reader checks the
+// stamp before and after looking at a frame in place: if it moved, the
+// writer has lapped the reader, which gets an overrun instead of torn audio.
+// Readers that fall a whole ring behind skip to the oldest frame still held
+// and get an overrun too.
+//
+// Readers sleep on a futex the writer wakes (only when someone is waiting).
+constexpr uint32_t SHM_MAGIC = 0x534D4943; // "SMIC"
+constexpr uint32_t SHM_VERSION = 1;
+constexpr int SHM_MAX_READERS = 64;
+constexpr size_t SHM_MAX_SAMPLES = 2 * SAMPLES_PER_PACKET;
+
+enum : uint16_t {
+  SHM_FRAME_GAP = 1 << 0,     // packets were lost just before this one
+  SHM_FRAME_RESTART = 1 << 1, // the device restarted
+};
+
+struct alignas(64) ShmFrame {
+  std::atomic<uint64_t> stamp; // 2n + 1 while frame n is written, 2n + 2 after
+  uint32_t seq;
+  uint32_t usec;
+  uint64_t publish_ns; // host monotonic clock
+  uint32_t lost;       // packets lost just before this one
+  uint16_t flags;
+  uint16_t samples;
+  int16_t pcm[SHM_MAX_SAMPLES];
+};
+
+// Where each reader is, so the bridge can show who is falling behind. Only
+// for watching: the writer never waits on these.
+struct alignas(64) ShmReaderSlot {
+  std::atomic<int32_t> pid; // 0 free
+  std::atomic<uint64_t> cursor;
+  std::atomic<uint64_t> overruns;
+};
+
+struct alignas(64) ShmHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t slots; // power of two
+  uint32_t sample_rate;
+  std::atomic<int32_t> writer_pid; // 0 once the bridge has gone
+  alignas(64) std::atomic<uint64_t> published; // frames so far
+  std::atomic<uint32_t> futex;   // bumped on every publish
+  std::atomic<uint32_t> waiters; // readers asleep on it
+  ShmReaderSlot readers[SHM_MAX_READERS];
+  // ShmFrame frames[slots] follow
+};
+
+inline size_t shm_size(uint32_t slots) { return sizeof(ShmHeader) + (size_t)slots * sizeof(ShmFrame); }
+inline ShmFrame *shm_frames(ShmHeader *h) { return (ShmFrame *)(h + 1); }
+
+// Monotonic clock in nanoseconds, the one publish_ns uses
+uint64_t monotonic_ns();
+
+class ShmWriter {
+public:
+  ShmWriter() = default;
+  ~ShmWriter() { close(); }
+
+  // Creates the ring `name` ("/serialmic0") with `slots` frames, replacing
+  // any left behind. Returns false with a message on stderr if it can't.
+  bool create(const char *name, uint32_t slots, int sample_rate);
+  void close();
+
+  // Wait-free: never blocks, whoever is reading
+  void publish(const Packet &pkt, uint32_t lost, uint16_t flags);
+  // The same from samples already decoded
+  void publish(uint32_t seq, uint32_t usec, const int16_t *pcm, size_t samples, uint32_t lost, uint16_t flags);
+
+  ShmHeader *header() const { return header_; }
+  // Drops reader slots whose process has gone
+  void reap_readers();
+
+private:
+  ShmFrame *begin_frame(uint64_t &n);
+  void end_frame(ShmFrame *f, uint64_t n);
+
+  std::string name_;
+  ShmHeader *header_ = nullptr;
+  size_t size_ = 0;
+};
+
+// A published frame, looked at where it lies in shared memory. Check
+// valid() once done with it: if the writer came round again meanwhile the
+// contents may be torn and should be thrown away.
+struct FrameView {
+  const ShmFrame *frame = nullptr;
+  uint64_t index = 0;     // frame number since the bridge started
+  uint64_t skipped = 0;   // frames this reader missed just before (overrun)
+
+  bool valid() const {
+    // everything read from the frame is done before the stamp is looked at
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return frame->stamp.load(std::memory_order_relaxed) == 2 * index + 2;
+  }
+};
+
+class ShmReader {
+public:
+  ShmReader() = default;
+  ~ShmReader() { close(); }
+
+  // Maps the ring `name`. Starts at the newest frame, or the oldest still
+  // held with `from_oldest`.
+  bool open(const char *name, bool from_oldest = false);
+  void close();
+
+  // The next frame, waiting up to `timeout_ms` for it (0 doesn't wait, -1
+  // waits for ever). Returns false on timeout.
+  bool next(FrameView &view, int timeout_ms = -1);
+  // Call with a view once it's been used; false (and an overrun) if it was
+  // overwritten meanwhile
+  bool done(const FrameView &view);
+
+  uint64_t overruns() const { return overruns_; } // times the reader was lapped
+  uint64_t skipped() const { return skipped_; }   // frames missed because of it
+  uint64_t lag() const;                           // frames published but not read
+  bool writer_alive() const { return header_->writer_pid.load(std::memory_order_relaxed) != 0; }
+  const ShmHeader *header() const { return header_; }
+
+private:
+  ShmHeader *header_ = nullptr;
+  size_t size_ = 0;
+  ShmReaderSlot *slot_ = nullptr;
+  uint64_t cursor_ = 0;
+  uint64_t overruns_ = 0;
+  uint64_t skipped_ = 0;
+};
+
+} // namespace serialmic
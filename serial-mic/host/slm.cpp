@@ -0,0 +1,80 @@
+#include "slm.h"
+
+#include <cmath>
+
+#include "mic_slm.h"
+
+namespace serialmic {
+
+static_assert(PKT_LEVELS == MIC_LEVELS_BYTE && LEVELS_MIN_PAYLOAD_BYTES == MIC_LEVELS_FIXED_LEN, "levels framing");
+
+static double centi_db(const uint8_t *p) {
+  const int16_t v = (int16_t)le_read16(p);
+  return v == SLM_NO_LEVEL ? NAN : v / 100.0;
+}
+
+bool read_band_levels(const Packet &pkt, BandLevels &out) {
+  if (pkt.payload_len < LEVELS_MIN_PAYLOAD_BYTES) {
+    return false;
+  }
+  const uint8_t *p = pkt.payload;
+  const size_t bands = p[5];
+  if (pkt.payload_len < LEVELS_MIN_PAYLOAD_BYTES + 2 * bands) {
+    return false;
+  }
+  out.seq = pkt.seq;
+  out.usec = pkt.usec;
+  out.samples = le_read32(p);
+  out.first_band = (int8_t)p[4];
+  out.la = centi_db(p + 6);
+  out.lc = centi_db(p + 8);
+  out.lz = centi_db(p + 10);
+  out.bands.resize(bands);
+  for (size_t i = 0; i < bands; i++) {
+    out.bands[i] = centi_db(p + LEVELS_MIN_PAYLOAD_BYTES + 2 * i);
+  }
+  return true;
+}
+
+double band_centre_hz(int x) { return 1000 * pow(10, x / 10.0); }
+
+double band_nominal_hz(int x) {
+  static const double mantissa[10] = {1, 1.25, 1.6, 2, 2.5, 3.15, 4, 5, 6.3, 8};
+  const int decade = (x >= 0 ? x : x - 9) / 10;
+  return 1000 * pow(10, decade) * mantissa[x - 10 * decade];
+}
+
+// Annex E: the poles, and the constants that make 1 kHz 0 dB
+static double weighting_parts(double hz, double *c) {
+  const double f1 = SLM_F1, f2 = SLM_F2, f3 = SLM_F3, f4 = SLM_F4;
+  const double f_2 = hz * hz;
+  *c = 20 * log10(f4 * f4 * f_2 / ((f_2 + f1 * f1) * (f_2 + f4 * f4)));
+  return 20 * log10(f_2 / sqrt((f_2 + f2 * f2) * (f_2 + f3 * f3)));
+}
+
+double a_weighting_db(double hz) {
+  double c, c1k;
+  const double a = weighting_parts(hz, &c), a1k = weighting_parts(1000, &c1k);
+  return c + a - (c1k + a1k);
+}
+
+double c_weighting_db(double hz) {
+  double c, c1k;
+  weighting_parts(hz, &c);
+  weighting_parts(1000, &c1k);
+  return c - c1k;
+}
+
+double sum_levels_db(const double *db, size_t n) {
+  double power = 0;
+  bool any = false;
+  for (size_t i = 0; i < n; i++) {
+    if (!std::isnan(db[i])) {
+      power += pow(10, db[i] / 10);
+      any = true;
+    }
+  }
+  return any ? 10 * log10(power) : NAN;
+}
+
+} // namespace serialmic
@@ -0,0 +1,41 @@
+// Band levels from a serial-mic in sound level meter mode
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "packet.h"
+
+namespace serialmic {
+
+// One interval's levels, as ../include/mic_slm.h frames them: dB against a
+// full scale sine, NAN where there was nothing. Add the mic's calibration
+// (the dB SPL a full scale sine would be) for dB SPL.
+struct BandLevels {
+  uint32_t seq = 0;
+  uint32_t usec = 0;    // device clock at the end of the interval
+  uint32_t samples = 0; // the interval
+  int first_band = 0;   // 1/3 octave bands numbered from 1 kHz (0)
+  double la = 0, lc = 0, lz = 0;
+  std::vector<double> bands; // unweighted
+
+  int band(size_t i) const { return first_band + (int)i; }
+};
+
+// False for a payload too short for the bands it says it has
+bool read_band_levels(const Packet &pkt, BandLevels &out);
+
+// Band x's exact centre (1000 * 10^(x/10)) and the nominal one it's labelled
+// with (31.5, 1250 ...)
+double band_centre_hz(int x);
+double band_nominal_hz(int x);
+
+// IEC 61672-1's A and C weighting, dB (0 at 1 kHz)
+double a_weighting_db(double hz);
+double c_weighting_db(double hz);
+
+// Levels in dB summed as powers, NAN ones left out (NAN if all are)
+double sum_levels_db(const double *db, size_t n);
+
+} // namespace serialmic
@@ -0,0 +1,499 @@
+#include "spectro.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <sys/stat.h>
+#include <thread>
+#include <vector>
+
+#include "feature_file.h"
+#include "fft.h"
+#include "png_writer.h"
+
+namespace serialmic {
+
+namespace {
+
+// log2 to about 0.01, plenty for an 8 bit colour: the exponent from the
+// float's bits and a cubic on the mantissa
+inline float fast_log2(float x) {
+  uint32_t bits;
+  memcpy(&bits, &x, sizeof(bits));
+  const float e = (float)((int)((bits >> 23) & 0xFF) - 127);
+  bits = (bits & 0x007FFFFF) | 0x3F800000;
+  float m;
+  memcpy(&m, &bits, sizeof(m));
+  return e + ((0.15824871f * m - 1.05187502f) * m + 3.04788335f) * m - 2.15404799f;
+}
+
+// Turbo, from its published polynomial fit. The frontend has the same fit
+// with the last two blue terms wrong, which turns the loud end magenta.
+void turbo_palette(uint8_t *rgb) {
+  for (int i = 0; i < 256; i++) {
+    const double t = i / 255.0;
+    const double r = 0.13572138 + t * (4.61539260 + t * (-42.66032258 + t * (132.13108234 + t * (-152.94239396 + t * 59.28637943))));
+    const double g = 0.09140261 + t * (2.19418839 + t * (4.84296658 + t * (-14.18503333 + t * (4.27729857 + t * 2.82956604))));
+    const double b = 0.10667330 + t * (12.64194608 + t * (-60.58204836 + t * (110.36276771 + t * (-89.90310912 + t * 27.34824973))));
+    rgb[3 * i] = (uint8_t)std::max(0.0, std::min(255.0, round(255 * r)));
+    rgb[3 * i + 1] = (uint8_t)std::max(0.0, std::min(255.0, round(255 * g)));
+    rgb[3 * i + 2] = (uint8_t)std::max(0.0, std::min(255.0, round(255 * b)));
+  }
+}
+
+bool make_dir(const std::string &path) {
+  if (mkdir(path.c_str(), 0755) != 0 && errno != EEXIST) {
+    fprintf(stderr, "can't create %s: %s\n", path.c_str(), strerror(errno));
+    return false;
+  }
+  return true;
+}
+
+struct MelBand {
+  size_t first_bin;
+  std::vector<float> weight; // sum to 1, so a band is the mean power under it
+};
+
+class SpectroJob {
+public:
+  SpectroJob(const AudioSource &src, const SpectroConfig &config)
+      : src_(src), c_(config), fft_(config.fft_size), window_(hann_window(config.fft_size)) {}
+
+  bool run(SpectroStats *stats);
+
+private:
+  struct Scratch {
+    std::vector<int16_t> pcm;
+    std::vector<float> frame, re, im, power;
+    std::vector<uint8_t> cols; // column major, height_ bytes each
+    std::vector<float> rows;   // features
+    std::vector<uint8_t> image;
+  };
+
+  void setup();
+  void work();
+  void segment(uint64_t s, Scratch &w);
+  void coarse_tile(uint64_t task, Scratch &w);
+  bool write_tile(int level, uint64_t index, const uint8_t *cols, size_t count, Scratch &w);
+  bool write_index() const;
+  bool write_levels() const;
+  uint64_t columns_at(int level) const { return (frames_ + (1ull << level) - 1) >> level; }
+  uint64_t tiles_at(int level) const { return (columns_at(level) + c_.tile_width - 1) / c_.tile_width; }
+
+  const AudioSource &src_;
+  SpectroConfig c_;
+  RealFft fft_;
+  std::vector<float> window_;
+  float power_scale_ = 1; // to full scale sine = 0dB, as the frontend scales
+  std::vector<MelBand> mel_;
+  uint8_t palette_[768];
+  size_t height_ = 0;
+  uint64_t frames_ = 0;
+  int levels_ = 0; // top level; level levels_ is one tile
+  int seg_level_ = 0;
+  uint64_t seg_frames_ = 0, segments_ = 0;
+  std::vector<uint8_t> top_; // level seg_level_ columns of the whole recording
+  std::vector<std::pair<int, uint64_t>> coarse_; // (level, tile) above the segments
+  FeatureWriter features_;
+
+  std::atomic<uint64_t> next_{0};
+  std::atomic<uint64_t> done_{0};
+  std::atomic<uint64_t> tiles_{0};
+  std::atomic<bool> failed_{false};
+  // segments first, then the coarse tiles once every segment is in top_
+  std::atomic<uint64_t> segments_done_{0};
+};
+
+void SpectroJob::setup() {
+  const size_t n = c_.fft_size;
+  height_ = n / 2;
+  double sum = 0;
+  for (float w : window_) {
+    sum += w;
+  }
+  // amplitude 2|X| / sum(w), the frontend's 2 / (N * coherent gain)
+  power_scale_ = (float)(4 / (sum * sum));
+
+  const double rate = src_.sample_rate();
+  const double high = rate / 2;
+  const double lo_mel = 2595 * log10(1 + c_.mel_low_hz / 700), hi_mel = 2595 * log10(1 + high / 700);
+  auto mel_hz = [&](double i) { return 700 * (pow(10, (lo_mel + (hi_mel - lo_mel) * i / (c_.bands + 1)) / 2595) - 1); };
+  mel_.resize(c_.bands);
+  for (int b = 0; b < c_.bands; b++) {
+    const double f0 = mel_hz(b), f1 = mel_hz(b + 1), f2 = mel_hz(b + 2);
+    MelBand &band = mel_[b];
+    band.first_bin = (size_t)ceil(f0 * n / rate);
+    double total = 0;
+    for (size_t k = band.first_bin; k <= n / 2 && k * rate / n < f2; k++) {
+      const double f = k * rate / n;
+      const double w = f < f1 ? (f - f0) / (f1 - f0) : (f2 - f) / (f2 - f1);
+      band.weight.push_back((float)std::max(0.0, w));
+      total += std::max(0.0, w);
+    }
+    if (total <= 0) {
+      // narrower than a bin: the nearest one
+      band.first_bin = std::min(n / 2, (size_t)lround(f1 * n / rate));
+      band.weight.assign(1, 1.0f);
+      total = 1;
+    }
+    for (float &w : band.weight) {
+      w = (float)(w / total);
+    }
+  }
+  turbo_palette(palette_);
+
+  frames_ = src_.samples() >= n ? (src_.samples() - n) / c_.hop + 1 : 0;
+  levels_ = 0;
+  while (columns_at(levels_) > (uint64_t)c_.tile_width) {
+    levels_++;
+  }
+  const int threads = c_.threads;
+  seg_level_ = c_.segment_level;
+  if (seg_level_ < 0) {
+    seg_level_ = 5;
+    while (seg_level_ > 0 && (frames_ + ((uint64_t)c_.tile_width << seg_level_) - 1) /
+                                     ((uint64_t)c_.tile_width << seg_level_) < 4 * (uint64_t)threads) {
+      seg_level_--;
+    }
+    // the columns kept for the coarse levels stay under 128MB
+    while (c_.tiles && columns_at(seg_level_) * height_ > (128u << 20)) {
+      seg_level_++;
+    }
+  }
+  seg_frames_ = (uint64_t)c_.tile_width << seg_level_;
+  segments_ = (frames_ + seg_frames_ - 1) / seg_frames_;
+  if (c_.tiles) {
+    top_.assign(columns_at(seg_level_) * height_, 0);
+    for (int l = seg_level_ + 1; l <= levels_; l++) {
+      for (uint64_t t = 0; t < tiles_at(l); t++) {
+        coarse_.push_back({l, t});
+      }
+    }
+  }
+}
+
+bool SpectroJob::run(SpectroStats *stats) {
+  if (c_.threads <= 0) {
+    c_.threads = (int)std::max(1u, std::thread::hardware_concurrency());
+  }
+  if (c_.fft_size < 16 || (c_.fft_size & (c_.fft_size - 1)) || c_.hop == 0 || c_.bands < 1 ||
+      c_.tile_width < 1 || !(c_.ceil_db > c_.floor_db)) {
+    fprintf(stderr, "bad spectrogram settings\n");
+    return false;
+  }
+  setup();
+  if (!make_dir(c_.out_dir)) {
+    return false;
+  }
+  if (c_.tiles) {
+    if (!make_dir(c_.out_dir + "/tiles")) {
+      return false;
+    }
+    for (int l = 0; l <= levels_; l++) {
+      if (!make_dir(c_.out_dir + "/tiles/" + std::to_string(l))) {
+        return false;
+      }
+    }
+  }
+  if (c_.features) {
+    FeatureHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, FEAT_MAGIC, sizeof(h.magic));
+    h.version = FEAT_VERSION;
+    h.sample_rate = (uint32_t)src_.sample_rate();
+    h.fft_size = (uint32_t)c_.fft_size;
+    h.hop = (uint32_t)c_.hop;
+    h.bands = (uint32_t)c_.bands;
+    h.columns = (uint32_t)c_.bands + FEAT_LEVELS;
+    h.frames = frames_;
+    h.data_offset = FEAT_HEADER_BYTES;
+    h.mel_low_hz = (float)c_.mel_low_hz;
+    h.mel_high_hz = (float)(src_.sample_rate() / 2.0);
+    h.start_host_us = src_.start_host_us();
+    if (!features_.create((c_.out_dir + "/features.smf").c_str(), h)) {
+      return false;
+    }
+  }
+
+  std::vector<std::thread> pool;
+  for (int t = 0; t < c_.threads; t++) {
+    pool.emplace_back(&SpectroJob::work, this);
+  }
+  const uint64_t total = segments_ + coarse_.size();
+  auto next_status = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+  while (done_.load() < total && !failed_.load()) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    if (c_.progress && std::chrono::steady_clock::now() >= next_status) {
+      fprintf(stderr, "%llu/%llu segments, %llu tiles\n", (unsigned long long)segments_done_.load(),
+              (unsigned long long)segments_, (unsigned long long)tiles_.load());
+      next_status += std::chrono::seconds(5);
+    }
+  }
+  for (std::thread &t : pool) {
+    t.join();
+  }
+  features_.close();
+  if (failed_) {
+    return false;
+  }
+  if ((c_.tiles && !write_index()) || (c_.features && !write_levels())) {
+    return false;
+  }
+  if (stats) {
+    stats->frames = frames_;
+    stats->segments = segments_;
+    stats->tiles = tiles_;
+    stats->levels = levels_ + 1;
+    stats->segment_level = seg_level_;
+    stats->threads = c_.threads;
+    stats->audio_seconds = (double)src_.samples() / src_.sample_rate();
+  }
+  return true;
+}
+
+void SpectroJob::work() {
+  Scratch w;
+  const uint64_t total = segments_ + coarse_.size();
+  for (;;) {
+    const uint64_t task = next_.fetch_add(1);
+    if (task >= total || failed_) {
+      return;
+    }
+    if (task < segments_) {
+      segment(task, w);
+      segments_done_++;
+    } else {
+      // the coarse levels are built from every segment's columns
+      while (segments_done_.load() < segments_ && !failed_) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      }
+      coarse_tile(task - segments_, w);
+    }
+    done_++;
+  }
+}
+
+void SpectroJob::segment(uint64_t s, Scratch &w) {
+  const size_t n = c_.fft_size, hop = c_.hop, bins = n / 2 + 1;
+  const uint64_t f0 = s * seg_frames_;
+  const uint64_t count = std::min(seg_frames_, frames_ - f0);
+  // this segment's frames, reading on into the next one's samples
+  const size_t samples = (size_t)((count - 1) * hop + n);
+  w.pcm.resize(samples);
+  src_.read(f0 * hop, w.pcm.data(), samples);
+  w.frame.resize(n);
+  w.re.resize(bins);
+  w.im.resize(bins);
+  w.power.resize(bins);
+  if (c_.tiles) {
+    w.cols.resize(count * height_);
+  }
+  const size_t columns = (size_t)c_.bands + FEAT_LEVELS;
+  if (c_.features) {
+    w.rows.resize(count * columns);
+  }
+  // power to palette index: 10 log10 p = 3.0103 log2 p
+  const float db_per_log2 = 3.01029996f;
+  const float to_index = 255.0f / (c_.ceil_db - c_.floor_db);
+  const float log2_scale = fast_log2(power_scale_);
+
+  for (uint64_t f = 0; f < count; f++) {
+    const int16_t *x = w.pcm.data() + f * hop;
+    for (size_t i = 0; i < n; i++) {
+      w.frame[i] = x[i] * (window_[i] * (1.0f / 32768));
+    }
+    fft_.power(w.frame.data(), w.re.data(), w.im.data(), w.power.data());
+    if (c_.tiles) {
+      uint8_t *col = w.cols.data() + f * height_;
+      for (size_t y = 0; y < height_; y++) {
+        const float p = w.power[height_ - y] + 1e-20f;
+        const float db = db_per_log2 * (fast_log2(p) + log2_scale);
+        const float v = (db - c_.floor_db) * to_index;
+        col[y] = (uint8_t)(v <= 0 ? 0 : v >= 255 ? 255 : v + 0.5f);
+      }
+    }
+    if (c_.features) {
+      float *row = w.rows.data() + f * columns;
+      for (int b = 0; b < c_.bands; b++) {
+        const MelBand &band = mel_[b];
+        float e = 0;
+        for (size_t k = 0; k < band.weight.size(); k++) {
+          e += band.weight[k] * w.power[band.first_bin + k];
+        }
+        row[b] = 10 * log10f(e * power_scale_ + 1e-12f);
+      }
+      // the level of the hop this frame starts with, so hops tile the
+      // recording and Leq adds up
+      double sq = 0;
+      int peak = 0;
+      for (size_t i = 0; i < hop && i < n; i++) {
+        sq += (double)x[i] * x[i];
+        peak = std::max(peak, std::abs((int)x[i]));
+      }
+      row[c_.bands + FEAT_RMS] = (float)(10 * log10(sq / std::min(hop, n) / (32768.0 * 32768.0) + 1e-12));
+      row[c_.bands + FEAT_PEAK] = (float)(20 * log10(peak / 32768.0 + 1e-6));
+    }
+  }
+  if (c_.features && !features_.write_rows(f0, w.rows.data(), (size_t)count)) {
+    failed_ = true;
+    return;
+  }
+  if (!c_.tiles) {
+    return;
+  }
+  // levels 0 up to the segment's own, halving the columns in place
+  uint64_t have = count;
+  for (int l = 0; l <= seg_level_ && l <= levels_; l++) {
+    if (l > 0) {
+      for (uint64_t i = 0; i < (have + 1) / 2; i++) {
+        uint8_t *dst = w.cols.data() + i * height_;
+        const uint8_t *a = w.cols.data() + 2 * i * height_;
+        if (2 * i + 1 < have) {
+          const uint8_t *b = a + height_;
+          for (size_t y = 0; y < height_; y++) {
+            dst[y] = std::max(a[y], b[y]);
+          }
+        } else {
+          memmove(dst, a, height_);
+        }
+      }
+      have = (have + 1) / 2;
+    }
+    const uint64_t first_tile = (f0 >> l) / c_.tile_width;
+    for (uint64_t t = 0; t * c_.tile_width < have; t++) {
+      const size_t width = (size_t)std::min<uint64_t>(c_.tile_width, have - t * c_.tile_width);
+      if (!write_tile(l, first_tile + t, w.cols.data() + t * c_.tile_width * height_, width, w)) {
+        failed_ = true;
+        return;
+      }
+    }
+  }
+  if (seg_level_ < levels_) {
+    memcpy(top_.data() + (f0 >> seg_level_) * height_, w.cols.data(), have * height_);
+  }
+}
+
+void SpectroJob::coarse_tile(uint64_t task, Scratch &w) {
+  const int l = coarse_[task].first;
+  const uint64_t t = coarse_[task].second;
+  const uint64_t top_cols = columns_at(seg_level_);
+  const uint64_t span = 1ull << (l - seg_level_); // top columns per column
+  const uint64_t first = t * c_.tile_width;
+  const size_t width = (size_t)std::min<uint64_t>(c_.tile_width, columns_at(l) - first);
+  w.cols.resize(width * height_);
+  for (size_t x = 0; x < width; x++) {
+    uint8_t *dst = w.cols.data() + x * height_;
+    const uint64_t from = (first + x) * span;
+    const uint64_t to = std::min(top_cols, from + span);
+    memcpy(dst, top_.data() + from * height_, height_);
+    for (uint64_t c = from + 1; c < to; c++) {
+      const uint8_t *src = top_.data() + c * height_;
+      for (size_t y = 0; y < height_; y++) {
+        dst[y] = std::max(dst[y], src[y]);
+      }
+    }
+  }
+  if (!write_tile(l, t, w.cols.data(), width, w)) {
+    failed_ = true;
+  }
+}
+
+bool SpectroJob::write_tile(int level, uint64_t index, const uint8_t *cols, size_t count, Scratch &w) {
+  // columns to rows
+  w.image.resize(count * height_);
+  for (size_t x = 0; x < count; x++) {
+    const uint8_t *col = cols + x * height_;
+    for (size_t y = 0; y < height_; y++) {
+      w.image[y * count + x] = col[y];
+    }
+  }
+  char path[1024];
+  snprintf(path, sizeof(path), "%s/tiles/%d/%llu.png", c_.out_dir.c_str(), level, (unsigned long long)index);
+  if (!write_png_indexed(path, w.image.data(), (int)count, (int)height_, palette_)) {
+    return false;
+  }
+  tiles_++;
+  return true;
+}
+
+bool SpectroJob::write_index() const {
+  const std::string path = c_.out_dir + "/tiles/index.json";
+  FILE *f = fopen(path.c_str(), "w");
+  if (!f) {
+    fprintf(stderr, "can't create %s: %s\n", path.c_str(), strerror(errno));
+    return false;
+  }
+  fprintf(f,
+          "{\n"
+          "  \"sample_rate\": %d,\n"
+          "  \"fft_size\": %zu,\n"
+          "  \"hop\": %zu,\n"
+          "  \"frames\": %llu,\n"
+          "  \"start_host_us\": %lld,\n"
+          "  \"tile_width\": %d,\n"
+          "  \"tile_height\": %zu,\n"
+          "  \"levels\": %d,\n"
+          "  \"seconds_per_column\": %.9g,\n"
+          "  \"floor_db\": %g,\n"
+          "  \"ceil_db\": %g,\n"
+          "  \"palette\": \"turbo\",\n"
+          "  \"path\": \"{level}/{index}.png\"\n"
+          "}\n",
+          src_.sample_rate(), c_.fft_size, c_.hop, (unsigned long long)frames_, (long long)src_.start_host_us(),
+          c_.tile_width, height_, levels_ + 1, (double)c_.hop / src_.sample_rate(), c_.floor_db, c_.ceil_db);
+  return fclose(f) == 0;
+}
+
+// Per minute level statistics, from the feature file
+bool SpectroJob::write_levels() const {
+  FeatureReader reader;
+  if (!reader.open((c_.out_dir + "/features.smf").c_str())) {
+    return false;
+  }
+  const std::string path = c_.out_dir + "/levels.csv";
+  FILE *f = fopen(path.c_str(), "w");
+  if (!f) {
+    fprintf(stderr, "can't create %s: %s\n", path.c_str(), strerror(errno));
+    return false;
+  }
+  fprintf(f, "start_s,leq_db,peak_db,l10_db,l50_db,l90_db\n");
+  const int bands = c_.bands;
+  std::vector<float> rms;
+  for (double start = 0;; start += 60) {
+    const uint64_t a = reader.frame_at(start), b = reader.frame_at(start + 60);
+    if (a >= b) {
+      break;
+    }
+    rms.clear();
+    double energy = 0;
+    float peak = -200;
+    for (uint64_t i = a; i < b; i++) {
+      const float *row = reader.row(i);
+      rms.push_back(row[bands + FEAT_RMS]);
+      energy += pow(10, row[bands + FEAT_RMS] / 10);
+      peak = std::max(peak, row[bands + FEAT_PEAK]);
+    }
+    // LN: the level exceeded N% of the time
+    auto exceeded = [&](double pct) {
+      const size_t k = std::min(rms.size() - 1, (size_t)((1 - pct / 100) * rms.size()));
+      std::nth_element(rms.begin(), rms.begin() + k, rms.end());
+      return rms[k];
+    };
+    fprintf(f, "%.0f,%.1f,%.1f,%.1f,%.1f,%.1f\n", start, 10 * log10(energy / rms.size()), peak, exceeded(10),
+            exceeded(50), exceeded(90));
+  }
+  return fclose(f) == 0;
+}
+
+} // namespace
+
+bool run_spectro(const AudioSource &src, const SpectroConfig &config, SpectroStats *stats) {
+  SpectroJob job(src, config);
+  return job.run(stats);
+}
+
+} // namespace serialmic
@@ -0,0 +1,57 @@
+// Offline spectrograms and features for long recordings
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "audio_source.h"
+
+namespace serialmic {
+
+// Splits a recording into segments of whole image tiles and works through
+// them on a pool of threads. Frames at a segment's end read on into the
+// next segment's samples (the recording is mapped, so the overlap costs
+// nothing) and every frame is computed once, so the output doesn't depend
+// on the thread count.
+//
+// Into `out_dir`:
+//   tiles/<level>/<n>.png  the spectrogram as a zoom pyramid: level 0 has a
+//                          pixel column per STFT frame, each level up half
+//                          as many (the louder of each pair, so short
+//                          sounds stay visible), tiles tile_width wide and
+//                          fft_size / 2 high (Nyquist at the top), coloured
+//                          with turbo over the frontend's dB range
+//   tiles/index.json       what a viewer needs to lay them out
+//   features.smf           log-mel bands and levels per frame (feature_file.h)
+//   levels.csv             per minute: Leq, peak and L10/L50/L90, dBFS
+struct SpectroConfig {
+  std::string out_dir;
+  size_t fft_size = 512; // 32ms at 16kHz
+  size_t hop = 256;
+  int bands = 64;
+  double mel_low_hz = 50;
+  int threads = 0; // 0: one per core
+  bool tiles = true;
+  bool features = true;
+  int tile_width = 256;
+  float floor_db = -100, ceil_db = 0; // the palette's range, as the frontend's
+  // Segments are tile_width << segment_level frames. -1 picks the largest
+  // (up to 5) that still gives every thread several.
+  int segment_level = -1;
+  bool progress = false; // to stderr every 5s
+};
+
+struct SpectroStats {
+  uint64_t frames = 0;
+  uint64_t segments = 0;
+  uint64_t tiles = 0;
+  int levels = 0;
+  int segment_level = 0;
+  int threads = 0;
+  double audio_seconds = 0;
+};
+
+bool run_spectro(const AudioSource &src, const SpectroConfig &config, SpectroStats *stats = nullptr);
+
+} // namespace serialmic
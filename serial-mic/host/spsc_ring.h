@@ -0,0 +1,53 @@
+// Single producer, single consumer ring for handing work between threads
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+namespace serialmic {
+
+// Slots are filled and read in place, so nothing is copied or allocated to
+// pass one over; the two sides only share the head and tail counters.
+// `N` must be a power of two.
+template <class T, size_t N> class SpscRing {
+  static_assert((N & (N - 1)) == 0, "N must be a power of two");
+
+public:
+  // Producer: the slot to fill next, or nullptr if the ring is full
+  T *write_slot() {
+    const size_t head = head_.load(std::memory_order_relaxed);
+    if (head - tail_cache_ == N) {
+      tail_cache_ = tail_.load(std::memory_order_acquire);
+      if (head - tail_cache_ == N) {
+        return nullptr;
+      }
+    }
+    return &slots_[head & (N - 1)];
+  }
+  // Producer: hands the slot from write_slot() over
+  void publish() { head_.store(head_.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+  // Consumer: the oldest slot, or nullptr if the ring is empty
+  T *read_slot() {
+    const size_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail == head_cache_) {
+      head_cache_ = head_.load(std::memory_order_acquire);
+      if (tail == head_cache_) {
+        return nullptr;
+      }
+    }
+    return &slots_[tail & (N - 1)];
+  }
+  // Consumer: gives the slot from read_slot() back
+  void release() { tail_.store(tail_.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+private:
+  // each side's counter on its own cache line, with its copy of the other's
+  alignas(64) std::atomic<size_t> head_{0};
+  size_t tail_cache_ = 0;
+  alignas(64) std::atomic<size_t> tail_{0};
+  size_t head_cache_ = 0;
+  alignas(64) T slots_[N];
+};
+
+} // namespace serialmic
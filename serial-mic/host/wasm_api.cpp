@@ -0,0 +1,166 @@
+// The C API of serialmic.wasm, the frontend's decoder and DSP kernels
+// (frontend/src/wasm.ts wraps it). Built natively too, for bench_kernels.
+//
+// Everything lives at fixed places in linear memory, so the page makes
+// typed array views once and copies nothing it doesn't have to:
+//   - bytes from the port are written at sm_rx_buffer() (up to
+//     sm_rx_capacity() at a time) and sm_rx_push(n) parses them
+//   - each packet found goes into the next of sm_slot_count() slots, a
+//     ring: its samples at sm_pcm_slots() + slot * sm_slot_samples(), and
+//     its seq, usec, sample count and flags at sm_packet_info() + slot.
+//     sm_packets_written() counts them all, so the page reads from where it
+//     got to up to that, and knows it fell behind if that's more than a
+//     ring's worth
+//   - the kernels take a pointer to samples anywhere in memory: a slot, or
+//     sm_scratch_pcm() for samples from elsewhere (the microphone)
+// One module instance is one decoder. The kernels' set up allocates, which
+// can grow the memory, so the page checks for a new buffer after those.
+#include <cstdint>
+
+#include "dsp_kernels.h"
+#include "packet.h"
+
+#ifdef __EMSCRIPTEN__
+#include <emscripten/emscripten.h>
+#define SM_EXPORT extern "C" EMSCRIPTEN_KEEPALIVE
+#else
+#define SM_EXPORT extern "C"
+#endif
+
+using namespace serialmic;
+
+namespace {
+
+constexpr uint32_t RX_BYTES = 64 * 1024;
+constexpr uint32_t SLOTS = 64;
+constexpr uint32_t SLOT_SAMPLES = MAX_PAYLOAD_BYTES / 2;
+constexpr uint32_t SCRATCH_SAMPLES = 16384;
+constexpr uint32_t FLAG_GAP = 1;     // packets were lost before this one
+constexpr uint32_t FLAG_RESTART = 2; // seq went back: the device restarted
+
+struct SlotInfo {
+  uint32_t seq, usec, samples, flags;
+};
+
+struct Decoder {
+  PacketParser parser{true};
+  bool have_seq = false;
+  uint32_t expected = 0;
+  uint32_t written = 0, lost = 0, crc_errors = 0;
+
+  void on_packet(const Packet &pkt);
+  void on_crc_error(uint64_t) { crc_errors++; }
+};
+
+alignas(16) uint8_t rx[RX_BYTES];
+alignas(16) int16_t pcm_slots[SLOTS][SLOT_SAMPLES];
+SlotInfo slot_info[SLOTS];
+alignas(16) int16_t scratch[SCRATCH_SAMPLES];
+Decoder decoder;
+
+SpectrumDb *spectrum = nullptr;
+float *spectrum_out = nullptr;
+Yin *yin = nullptr;
+PitchEstimate pitch;
+float levels_out[2];
+
+void Decoder::on_packet(const Packet &pkt) {
+  const uint32_t slot = written % SLOTS;
+  SlotInfo &info = slot_info[slot];
+  info.flags = 0;
+  if (have_seq) {
+    const int32_t d = seq_gap(expected, pkt.seq);
+    if (d > 0) {
+      lost += (uint32_t)d;
+      info.flags |= FLAG_GAP;
+    } else if (d < 0) {
+      info.flags |= FLAG_RESTART;
+    }
+  }
+  have_seq = true;
+  expected = pkt.seq + 1;
+  info.seq = pkt.seq;
+  info.usec = pkt.usec;
+  info.samples = (uint32_t)pkt.samples();
+  pkt.read_pcm(pcm_slots[slot]);
+  written++;
+}
+
+} // namespace
+
+// ====================== Decoder ======================
+SM_EXPORT uint8_t *sm_rx_buffer(void) { return rx; }
+SM_EXPORT uint32_t sm_rx_capacity(void) { return RX_BYTES; }
+
+// Parses `n` bytes written at sm_rx_buffer(); returns sm_packets_written()
+SM_EXPORT uint32_t sm_rx_push(uint32_t n) {
+  decoder.parser.feed(rx, n < RX_BYTES ? n : RX_BYTES, decoder);
+  return decoder.written;
+}
+
+// Starts again, e.g. for a new port; `verify_crc` 0 takes packets whatever
+// their CRC
+SM_EXPORT void sm_reset(int verify_crc) {
+  decoder.parser.reset();
+  decoder.parser.set_verify_crc(verify_crc != 0);
+  decoder.have_seq = false;
+  decoder.written = decoder.lost = decoder.crc_errors = 0;
+}
+SM_EXPORT void sm_set_verify_crc(int on) { decoder.parser.set_verify_crc(on != 0); }
+
+SM_EXPORT uint32_t sm_slot_count(void) { return SLOTS; }
+SM_EXPORT uint32_t sm_slot_samples(void) { return SLOT_SAMPLES; }
+SM_EXPORT int16_t *sm_pcm_slots(void) { return &pcm_slots[0][0]; }
+// SLOTS entries of four u32: seq, usec, samples, flags
+SM_EXPORT uint32_t *sm_packet_info(void) { return &slot_info[0].seq; }
+SM_EXPORT uint32_t sm_packets_written(void) { return decoder.written; }
+SM_EXPORT uint32_t sm_packets_lost(void) { return decoder.lost; }
+SM_EXPORT uint32_t sm_crc_errors(void) { return decoder.crc_errors; }
+
+SM_EXPORT int16_t *sm_scratch_pcm(void) { return scratch; }
+SM_EXPORT uint32_t sm_scratch_samples(void) { return SCRATCH_SAMPLES; }
+
+// ====================== Kernels ======================
+// `n` points (a power of two); sm_spectrum_db() then writes n / 2 dBFS
+// values at sm_spectrum_out(). 0 if `n` won't do.
+SM_EXPORT int sm_spectrum_init(uint32_t n) {
+  if (n < 4 || (n & (n - 1)) || n > 65536) {
+    return 0;
+  }
+  delete spectrum;
+  delete[] spectrum_out;
+  spectrum = new SpectrumDb(n);
+  spectrum_out = new float[n / 2];
+  return 1;
+}
+SM_EXPORT float *sm_spectrum_out(void) { return spectrum_out; }
+SM_EXPORT void sm_spectrum_db(const int16_t *pcm, uint32_t count) {
+  if (spectrum) {
+    spectrum->compute(pcm, count, spectrum_out);
+  }
+}
+
+// A `frame` point YIN (a power of two, 64 or more); 0 if that won't do
+SM_EXPORT int sm_yin_init(uint32_t frame, float rate, float min_hz, float max_hz, float threshold) {
+  if (frame < 64 || (frame & (frame - 1)) || frame > 65536 || rate <= 0 || min_hz <= 0 || max_hz <= min_hz) {
+    return 0;
+  }
+  delete yin;
+  yin = new Yin(frame, rate, min_hz, max_hz, threshold);
+  return 1;
+}
+// Pitch in Hz of the last frame of `count` samples, 0 for none; its
+// confidence is then sm_yin_confidence()
+SM_EXPORT float sm_yin(const int16_t *pcm, uint32_t count) {
+  pitch = yin ? yin->detect(pcm, count) : PitchEstimate();
+  return pitch.hz;
+}
+SM_EXPORT float sm_yin_confidence(void) { return pitch.confidence; }
+
+// rms and peak dBFS into two floats at sm_levels_out()
+SM_EXPORT void sm_levels(const int16_t *pcm, uint32_t count) {
+  const Levels l = measure_levels(pcm, count);
+  levels_out[0] = l.rms_db;
+  levels_out[1] = l.peak_db;
+}
+SM_EXPORT float *sm_levels_out(void) { return levels_out; }
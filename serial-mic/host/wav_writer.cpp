@@ -0,0 +1,83 @@
+#include "wav_writer.h"
+
+#include <cstring>
+
+#include "packet.h"
+
+namespace serialmic {
+
+namespace {
+void le_write64(uint8_t *p, uint64_t v) {
+  le_write32(p, (uint32_t)v);
+  le_write32(p + 4, (uint32_t)(v >> 32));
+}
+} // namespace
+
+bool WavWriter::open(const char *path, int sample_rate, int channels, int bits) {
+  close();
+  if (!out_.open(path)) {
+    return false;
+  }
+  open_ = true;
+  sample_rate_ = sample_rate;
+  channels_ = channels;
+  bits_ = bits;
+  block_align_ = channels * bits / 8;
+  data_bytes_ = 0;
+  uint8_t h[HEADER_LEN];
+  header(h);
+  out_.append(h, sizeof(h));
+  return true;
+}
+
+// RIFF/RF64 header, JUNK/ds64 chunk, fmt chunk, data chunk header
+void WavWriter::header(uint8_t *h) const {
+  const uint64_t riff_size = HEADER_LEN - 8 + data_bytes_;
+  const bool rf64 = riff_size > 0xFFFFFFFFull;
+  memset(h, 0, HEADER_LEN);
+  memcpy(h, rf64 ? "RF64" : "RIFF", 4);
+  le_write32(h + 4, rf64 ? 0xFFFFFFFF : (uint32_t)riff_size);
+  memcpy(h + 8, "WAVE", 4);
+
+  // 28 bytes: RIFF size, data size and sample count as 64 bits and an
+  // empty table of other chunk sizes
+  memcpy(h + 12, rf64 ? "ds64" : "JUNK", 4);
+  le_write32(h + 16, 28);
+  if (rf64) {
+    le_write64(h + 20, riff_size);
+    le_write64(h + 28, data_bytes_);
+    le_write64(h + 36, frames());
+  }
+
+  memcpy(h + 48, "fmt ", 4);
+  le_write32(h + 52, 16);
+  le_write16(h + 56, 1); // PCM
+  le_write16(h + 58, (uint16_t)channels_);
+  le_write32(h + 60, (uint32_t)sample_rate_);
+  le_write32(h + 64, (uint32_t)(sample_rate_ * block_align_));
+  le_write16(h + 68, (uint16_t)block_align_);
+  le_write16(h + 70, (uint16_t)bits_);
+
+  memcpy(h + 72, "data", 4);
+  le_write32(h + 76, rf64 ? 0xFFFFFFFF : (uint32_t)data_bytes_);
+}
+
+void WavWriter::checkpoint() {
+  if (!open_) {
+    return;
+  }
+  uint8_t h[HEADER_LEN];
+  header(h);
+  out_.patch(0, h, sizeof(h));
+}
+
+void WavWriter::close() {
+  if (!open_) {
+    return;
+  }
+  checkpoint();
+  out_.close();
+  open_ = false;
+}
+
+} // namespace serialmic
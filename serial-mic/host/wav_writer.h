@@ -0,0 +1,52 @@
+// Streaming WAV writer that becomes RF64 past 4 GiB
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "block_writer.h"
+
+namespace serialmic {
+
+// PCM WAV through a BlockWriter. The header has a JUNK chunk where a ds64
+// chunk will fit (EBU Tech 3306), so a file that grows past what 32-bit
+// RIFF sizes can hold is turned into RF64 in place when it is closed -
+// nothing is rewritten but the header.
+class WavWriter {
+public:
+  static constexpr size_t HEADER_LEN = 80;
+
+  explicit WavWriter(BlockWriter &out) : out_(out) {}
+
+  bool open(const char *path, int sample_rate, int channels, int bits);
+  // Interleaved little-endian samples, as they go in the file
+  void write(const void *data, size_t bytes) {
+    out_.append(data, bytes);
+    data_bytes_ += bytes;
+  }
+  void write_silence(size_t bytes) {
+    out_.append_zeros(bytes);
+    data_bytes_ += bytes;
+  }
+  // Brings the header up to date with what has been written, so if the
+  // process dies the file is good up to here
+  void checkpoint();
+  void close();
+
+  bool is_open() const { return open_; }
+  uint64_t data_bytes() const { return data_bytes_; }
+  uint64_t frames() const { return data_bytes_ / block_align_; }
+
+private:
+  void header(uint8_t *h) const;
+
+  BlockWriter &out_;
+  bool open_ = false;
+  int sample_rate_ = 0;
+  int channels_ = 0;
+  int bits_ = 0;
+  int block_align_ = 1;
+  uint64_t data_bytes_ = 0;
+};
+
+} // namespace serialmic
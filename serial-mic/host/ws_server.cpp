@@ -0,0 +1,438 @@
+#include "ws_server.h"
+
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace serialmic {
+
+static const size_t MAX_REQUEST = 8192;
+static const size_t MAX_MESSAGE = 64 * 1024;
+
+// ====================== Handshake ======================
+
+static uint32_t rol(uint32_t v, int n) { return (v << n) | (v >> (32 - n)); }
+
+static void sha1(const uint8_t *data, size_t len, uint8_t out[20]) {
+  uint32_t h[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+  std::vector<uint8_t> msg(data, data + len);
+  msg.push_back(0x80);
+  while (msg.size() % 64 != 56) {
+    msg.push_back(0);
+  }
+  const uint64_t bits = (uint64_t)len * 8;
+  for (int i = 7; i >= 0; i--) {
+    msg.push_back((uint8_t)(bits >> (8 * i)));
+  }
+  for (size_t block = 0; block < msg.size(); block += 64) {
+    uint32_t w[80];
+    for (int i = 0; i < 16; i++) {
+      const uint8_t *p = &msg[block + 4 * i];
+      w[i] = (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+    }
+    for (int i = 16; i < 80; i++) {
+      w[i] = rol(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+    }
+    uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+    for (int i = 0; i < 80; i++) {
+      uint32_t f, k;
+      if (i < 20) {
+        f = (b & c) | (~b & d), k = 0x5A827999;
+      } else if (i < 40) {
+        f = b ^ c ^ d, k = 0x6ED9EBA1;
+      } else if (i < 60) {
+        f = (b & c) | (b & d) | (c & d), k = 0x8F1BBCDC;
+      } else {
+        f = b ^ c ^ d, k = 0xCA62C1D6;
+      }
+      const uint32_t t = rol(a, 5) + f + e + k + w[i];
+      e = d;
+      d = c;
+      c = rol(b, 30);
+      b = a;
+      a = t;
+    }
+    h[0] += a, h[1] += b, h[2] += c, h[3] += d, h[4] += e;
+  }
+  for (int i = 0; i < 5; i++) {
+    for (int j = 0; j < 4; j++) {
+      out[4 * i + j] = (uint8_t)(h[i] >> (24 - 8 * j));
+    }
+  }
+}
+
+static std::string base64(const uint8_t *data, size_t len) {
+  static const char table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  std::string out;
+  for (size_t i = 0; i < len; i += 3) {
+    const uint32_t v = (uint32_t)data[i] << 16 | (i + 1 < len ? data[i + 1] << 8 : 0) | (i + 2 < len ? data[i + 2] : 0);
+    out += table[(v >> 18) & 63];
+    out += table[(v >> 12) & 63];
+    out += i + 1 < len ? table[(v >> 6) & 63] : '=';
+    out += i + 2 < len ? table[v & 63] : '=';
+  }
+  return out;
+}
+
+// The value of header `name` in `request`, or "" if it isn't there
+static std::string header(const std::string &request, const char *name) {
+  const size_t name_len = strlen(name);
+  size_t pos = request.find("\r\n");
+  while (pos != std::string::npos && pos + 2 < request.size()) {
+    const size_t start = pos + 2;
+    const size_t end = request.find("\r\n", start);
+    if (end == std::string::npos || end == start) {
+      break;
+    }
+    if (end - start > name_len && request[start + name_len] == ':' &&
+        !strncasecmp(request.c_str() + start, name, name_len)) {
+      size_t v = start + name_len + 1;
+      size_t e = end;
+      while (v < e && (request[v] == ' ' || request[v] == '\t')) {
+        v++;
+      }
+      while (e > v && (request[e - 1] == ' ' || request[e - 1] == '\t')) {
+        e--;
+      }
+      return request.substr(v, e - v);
+    }
+    pos = end;
+  }
+  return "";
+}
+
+// ====================== Server ======================
+
+WsServer::~WsServer() {
+  for (Client &c : clients_) {
+    close(c.fd);
+  }
+  if (listen_fd_ >= 0) {
+    close(listen_fd_);
+  }
+}
+
+bool WsServer::listen(const char *host, int port) {
+  struct addrinfo hints, *res = nullptr;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_PASSIVE;
+  char port_str[16];
+  snprintf(port_str, sizeof(port_str), "%d", port);
+  const int err = getaddrinfo(host, port_str, &hints, &res);
+  if (err) {
+    fprintf(stderr, "%s: %s\n", host, gai_strerror(err));
+    return false;
+  }
+  listen_fd_ = socket(res->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  const int one = 1;
+  if (listen_fd_ >= 0) {
+    setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  }
+  if (listen_fd_ < 0 || bind(listen_fd_, res->ai_addr, res->ai_addrlen) < 0 || ::listen(listen_fd_, 16) < 0) {
+    fprintf(stderr, "%s:%d: %s\n", host, port, strerror(errno));
+    freeaddrinfo(res);
+    if (listen_fd_ >= 0) {
+      close(listen_fd_);
+      listen_fd_ = -1;
+    }
+    return false;
+  }
+  freeaddrinfo(res);
+  return true;
+}
+
+void WsServer::add_pollfds(std::vector<struct pollfd> *fds) const {
+  if (listen_fd_ >= 0) {
+    fds->push_back({listen_fd_, POLLIN, 0});
+  }
+  for (const Client &c : clients_) {
+    fds->push_back({c.fd, (short)(POLLIN | (c.out_pos < c.out.size() ? POLLOUT : 0)), 0});
+  }
+}
+
+void WsServer::service() {
+  accept_clients();
+  for (size_t i = 0; i < clients_.size();) {
+    Client &c = clients_[i];
+    const bool ok = read_client(c) && flush(c) && !(c.closing && c.out_pos == c.out.size());
+    if (!ok) {
+      close(c.fd);
+      clients_.erase(clients_.begin() + i);
+    } else {
+      i++;
+    }
+  }
+}
+
+void WsServer::accept_clients() {
+  if (listen_fd_ < 0) {
+    return;
+  }
+  for (;;) {
+    struct sockaddr_storage addr;
+    socklen_t addr_len = sizeof(addr);
+    const int fd = accept4(listen_fd_, (struct sockaddr *)&addr, &addr_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) {
+      return;
+    }
+    const int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    char host[NI_MAXHOST] = "?", serv[NI_MAXSERV] = "?";
+    getnameinfo((struct sockaddr *)&addr, addr_len, host, sizeof(host), serv, sizeof(serv),
+                NI_NUMERICHOST | NI_NUMERICSERV);
+    Client c;
+    c.fd = fd;
+    c.id = next_id_++;
+    c.stats.peer = std::string(host) + ":" + serv;
+    clients_.push_back(std::move(c));
+  }
+}
+
+bool WsServer::read_client(Client &c) {
+  char buf[16 * 1024];
+  for (;;) {
+    const ssize_t n = recv(c.fd, buf, sizeof(buf), 0);
+    if (n > 0) {
+      c.in.append(buf, (size_t)n);
+      if (c.in.size() > MAX_MESSAGE + MAX_REQUEST) {
+        return false;
+      }
+      continue;
+    }
+    if (n == 0) {
+      return false;
+    }
+    if (errno == EINTR) {
+      continue;
+    }
+    if (errno != EAGAIN && errno != EWOULDBLOCK) {
+      return false;
+    }
+    break;
+  }
+  if (!c.stats.open) {
+    return handshake(c);
+  }
+  return parse_messages(c);
+}
+
+bool WsServer::origin_allowed(const std::string &origin) const {
+  if (origin.empty()) {
+    return true;
+  }
+  for (const std::string &o : origins_) {
+    if (o == "*" || o == origin) {
+      return true;
+    }
+  }
+  // scheme://host[:port], host on this machine
+  const size_t scheme = origin.find("://");
+  if (scheme == std::string::npos) {
+    return false;
+  }
+  std::string host = origin.substr(scheme + 3);
+  if (!host.empty() && host[0] == '[') {
+    host = host.substr(0, host.find(']') + 1);
+  } else {
+    host = host.substr(0, host.find(':'));
+  }
+  return host == "localhost" || host == "127.0.0.1" || host == "[::1]";
+}
+
+bool WsServer::handshake(Client &c) {
+  const size_t end = c.in.find("\r\n\r\n");
+  if (end == std::string::npos) {
+    return c.in.size() < MAX_REQUEST;
+  }
+  const std::string request = c.in.substr(0, end + 2);
+  c.in.erase(0, end + 4);
+  const std::string key = header(request, "Sec-WebSocket-Key");
+  const std::string upgrade = header(request, "Upgrade");
+  const char *refusal = nullptr;
+  if (request.compare(0, 4, "GET ") || strcasecmp(upgrade.c_str(), "websocket") || key.empty()) {
+    refusal = "400 Bad Request";
+  } else if (!origin_allowed(header(request, "Origin"))) {
+    refusal = "403 Forbidden";
+    fprintf(stderr, "%s: refused, origin %s\n", c.stats.peer.c_str(), header(request, "Origin").c_str());
+  }
+  if (refusal) {
+    c.out = std::string("HTTP/1.1 ") + refusal + "\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+    c.closing = true;
+    return true;
+  }
+  const std::string accept_src = key + "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+  uint8_t digest[20];
+  sha1((const uint8_t *)accept_src.data(), accept_src.size(), digest);
+  c.out = "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+          "Sec-WebSocket-Accept: " +
+          base64(digest, 20) + "\r\n\r\n";
+  c.stats.open = true;
+  if (!hello_.empty()) {
+    queue(c, 1, (const uint8_t *)hello_.data(), hello_.size(), false);
+  }
+  return parse_messages(c);
+}
+
+bool WsServer::parse_messages(Client &c) {
+  size_t pos = 0;
+  for (;;) {
+    const uint8_t *p = (const uint8_t *)c.in.data() + pos;
+    const size_t avail = c.in.size() - pos;
+    if (avail < 2) {
+      break;
+    }
+    const int opcode = p[0] & 0x0F;
+    const bool masked = p[1] & 0x80;
+    uint64_t len = p[1] & 0x7F;
+    size_t head = 2;
+    if (len == 126) {
+      if (avail < 4) {
+        break;
+      }
+      len = (uint64_t)p[2] << 8 | p[3];
+      head = 4;
+    } else if (len == 127) {
+      if (avail < 10) {
+        break;
+      }
+      len = 0;
+      for (int i = 0; i < 8; i++) {
+        len = len << 8 | p[2 + i];
+      }
+      head = 10;
+    }
+    // clients must mask, and nothing they send here is big
+    if (!masked || len > MAX_MESSAGE) {
+      return false;
+    }
+    if (avail < head + 4 + len) {
+      break;
+    }
+    const uint8_t *mask = p + head;
+    std::string payload((const char *)p + head + 4, (size_t)len);
+    for (size_t i = 0; i < len; i++) {
+      payload[i] ^= mask[i & 3];
+    }
+    pos += head + 4 + (size_t)len;
+
+    if (opcode == 8) { // close: answer it and hang up once it's sent
+      queue(c, 8, (const uint8_t *)payload.data(), std::min<size_t>(payload.size(), 2), false);
+      c.closing = true;
+      break;
+    } else if (opcode == 9) { // ping
+      queue(c, 10, (const uint8_t *)payload.data(), payload.size(), false);
+    } else if (opcode == 1) {
+      if (payload == "pcm on") {
+        c.stats.wants_pcm = true;
+      } else if (payload == "pcm off") {
+        c.stats.wants_pcm = false;
+      } else if (on_text_) {
+        on_text_(c.id, payload);
+      }
+    }
+  }
+  c.in.erase(0, pos);
+  return true;
+}
+
+void WsServer::queue(Client &c, int opcode, const uint8_t *data, size_t len, bool droppable) {
+  if (c.closing) {
+    return;
+  }
+  if (droppable && c.out.size() - c.out_pos + len > max_queue_) {
+    c.stats.dropped++;
+    return;
+  }
+  // what's been sent is only trimmed here, so sends don't shuffle the queue
+  if (c.out_pos > 0 && c.out_pos * 2 >= c.out.size()) {
+    c.out.erase(0, c.out_pos);
+    c.out_pos = 0;
+  }
+  uint8_t head[10];
+  size_t head_len = 2;
+  head[0] = (uint8_t)(0x80 | opcode);
+  if (len < 126) {
+    head[1] = (uint8_t)len;
+  } else if (len < 65536) {
+    head[1] = 126;
+    head[2] = (uint8_t)(len >> 8);
+    head[3] = (uint8_t)len;
+    head_len = 4;
+  } else {
+    head[1] = 127;
+    for (int i = 0; i < 8; i++) {
+      head[2 + i] = (uint8_t)((uint64_t)len >> (56 - 8 * i));
+    }
+    head_len = 10;
+  }
+  c.out.append((const char *)head, head_len);
+  c.out.append((const char *)data, len);
+  if (opcode == 2) {
+    c.stats.sent++;
+  }
+}
+
+bool WsServer::flush(Client &c) {
+  while (c.out_pos < c.out.size()) {
+    const ssize_t n = send(c.fd, c.out.data() + c.out_pos, c.out.size() - c.out_pos, MSG_NOSIGNAL);
+    if (n > 0) {
+      c.out_pos += (size_t)n;
+    } else if (n < 0 && errno == EINTR) {
+      continue;
+    } else {
+      return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+    }
+  }
+  c.out.clear();
+  c.out_pos = 0;
+  return true;
+}
+
+void WsServer::broadcast(const uint8_t *data, size_t len, bool pcm) {
+  for (Client &c : clients_) {
+    if (c.stats.open && c.stats.wants_pcm == pcm) {
+      queue(c, 2, data, len, true);
+      flush(c);
+    }
+  }
+}
+
+void WsServer::send_text(int id, const std::string &text) {
+  for (Client &c : clients_) {
+    if (c.id == id && c.stats.open) {
+      queue(c, 1, (const uint8_t *)text.data(), text.size(), false);
+      flush(c);
+    }
+  }
+}
+
+bool WsServer::any_wants_pcm() const {
+  for (const Client &c : clients_) {
+    if (c.stats.open && c.stats.wants_pcm) {
+      return true;
+    }
+  }
+  return false;
+}
+
+std::vector<WsClientStats> WsServer::stats() const {
+  std::vector<WsClientStats> out;
+  for (const Client &c : clients_) {
+    out.push_back(c.stats);
+    out.back().queued = c.out.size() - c.out_pos;
+  }
+  return out;
+}
+
+} // namespace serialmic
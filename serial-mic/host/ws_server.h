@@ -0,0 +1,93 @@
+// A small WebSocket server for serving local pages
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+struct pollfd;
+
+namespace serialmic {
+
+struct WsClientStats {
+  std::string peer;
+  bool open = false; // handshake done
+  bool wants_pcm = false;
+  uint64_t sent = 0, dropped = 0;
+  size_t queued = 0; // bytes waiting to go
+};
+
+// Just what a bridge to a browser on the same machine needs (RFC 6455):
+// the upgrade handshake, unfragmented text and binary messages, ping and
+// close. Everything is non-blocking and runs on the caller's thread: put
+// add_pollfds() into the poll() that waits on the port and call service()
+// after it.
+//
+// Sending never waits for a client. Each has a queue of at most
+// max_queue bytes; a message that doesn't fit is dropped for that client
+// and counted, so a stalled tab only loses its own frames.
+//
+// A page from any site can open a WebSocket to localhost, so a handshake
+// with an Origin header is refused unless the origin is on localhost
+// (any port) or was allowed with allow_origin(). Tools that send no Origin
+// are let in.
+class WsServer {
+public:
+  // A text message from client `id`. "pcm on" and "pcm off" are handled
+  // before this is called.
+  using TextHandler = std::function<void(int id, const std::string &text)>;
+
+  WsServer() = default;
+  ~WsServer();
+  WsServer(const WsServer &) = delete;
+  WsServer &operator=(const WsServer &) = delete;
+
+  // false with a message on stderr if the port can't be had
+  bool listen(const char *host, int port);
+  void allow_origin(const std::string &origin) { origins_.push_back(origin); }
+  void set_max_queue(size_t bytes) { max_queue_ = bytes; }
+  // Sent as a text message to every client when its handshake completes
+  void set_hello(const std::string &text) { hello_ = text; }
+  void on_text(TextHandler handler) { on_text_ = std::move(handler); }
+
+  void add_pollfds(std::vector<struct pollfd> *fds) const;
+  // Accepts, reads and writes whatever is ready without blocking
+  void service();
+
+  // A binary message to every open client whose wants_pcm is `pcm`
+  void broadcast(const uint8_t *data, size_t len, bool pcm);
+  void send_text(int id, const std::string &text);
+  bool any_wants_pcm() const;
+  size_t clients() const { return clients_.size(); }
+  std::vector<WsClientStats> stats() const;
+
+private:
+  struct Client {
+    int fd = -1;
+    int id = 0;
+    WsClientStats stats;
+    std::string in, out;
+    size_t out_pos = 0;
+    bool closing = false;
+  };
+
+  void accept_clients();
+  bool read_client(Client &c);
+  bool handshake(Client &c);
+  bool parse_messages(Client &c);
+  bool flush(Client &c);
+  void queue(Client &c, int opcode, const uint8_t *data, size_t len, bool droppable);
+  bool origin_allowed(const std::string &origin) const;
+
+  int listen_fd_ = -1;
+  int next_id_ = 1;
+  size_t max_queue_ = 256 * 1024;
+  std::string hello_;
+  std::vector<std::string> origins_;
+  std::vector<Client> clients_;
+  TextHandler on_text_;
+};
+
+} // namespace serialmic
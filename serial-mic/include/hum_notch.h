@@ -0,0 +1,173 @@
+// Mains hum canceller for the microphone paths of both firmwares.
+// Header only and plain C, like mic_frame.h, so the host benchmarks build the
+// exact code the boards run; no floating point once it's set up.
+//
+// Hum from a nearby supply is the mains frequency and its harmonics, which
+// drift together as the grid's frequency does. A fixed notch would have to
+// be wide to allow for that; this one follows it:
+//   - an oscillator (a 32 bit phase) runs at the mains frequency, and gives
+//     a cosine and sine at each harmonic from a table
+//   - for each harmonic two LMS weights fit the hum as a cosine and a sine
+//     at that phase; what is left after taking the fit away is the output,
+//     and what it leaves drives the fit (an adaptive line canceller, which
+//     is a notch about HUM_BANDWIDTH_HZ wide at every harmonic)
+//   - if the oscillator is off frequency the weights turn at the difference
+//     (k times it at harmonic k). Every HUM_FLL_MS that turn, weighted by
+//     each harmonic's strength, nudges the oscillator's rate, so the notches
+//     stay on the hum instead of having to chase it. The turn is between the
+//     weights' averages over one block and the next: program near a harmonic
+//     shows in the weights too, turning at its distance from it, and
+//     averaging over a few mains cycles keeps that from pulling the rate
+// Without hum the weights stay near zero and the oscillator holds where it
+// was. A tone sitting on a harmonic is taken for hum.
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define HUM_MAX_HARMONICS 16
+#define HUM_FLL_MS 40       // between oscillator updates
+#ifndef HUM_BANDWIDTH_HZ
+#define HUM_BANDWIDTH_HZ 1  // each notch, roughly; wider locks faster and takes more with it
+#endif
+#define HUM_RANGE_PCT 4     // how far from nominal it will follow the mains
+
+// sin over a cycle of 256 steps, Q15, with the first repeated at the end
+static const int16_t hum_sin_table[257] = {
+  0, 804, 1608, 2410, 3212, 4011, 4808, 5602, 6393, 7179, 7962, 8739,
+  9512, 10278, 11039, 11793, 12539, 13279, 14010, 14732, 15446, 16151, 16846, 17530,
+  18204, 18868, 19519, 20159, 20787, 21403, 22005, 22594, 23170, 23731, 24279, 24811,
+  25329, 25832, 26319, 26790, 27245, 27683, 28105, 28510, 28898, 29268, 29621, 29956,
+  30273, 30571, 30852, 31113, 31356, 31580, 31785, 31971, 32137, 32285, 32412, 32521,
+  32609, 32678, 32728, 32757, 32767, 32757, 32728, 32678, 32609, 32521, 32412, 32285,
+  32137, 31971, 31785, 31580, 31356, 31113, 30852, 30571, 30273, 29956, 29621, 29268,
+  28898, 28510, 28105, 27683, 27245, 26790, 26319, 25832, 25329, 24811, 24279, 23731,
+  23170, 22594, 22005, 21403, 20787, 20159, 19519, 18868, 18204, 17530, 16846, 16151,
+  15446, 14732, 14010, 13279, 12539, 11793, 11039, 10278, 9512, 8739, 7962, 7179,
+  6393, 5602, 4808, 4011, 3212, 2410, 1608, 804, 0, -804, -1608, -2410,
+  -3212, -4011, -4808, -5602, -6393, -7179, -7962, -8739, -9512, -10278, -11039, -11793,
+  -12539, -13279, -14010, -14732, -15446, -16151, -16846, -17530, -18204, -18868, -19519, -20159,
+  -20787, -21403, -22005, -22594, -23170, -23731, -24279, -24811, -25329, -25832, -26319, -26790,
+  -27245, -27683, -28105, -28510, -28898, -29268, -29621, -29956, -30273, -30571, -30852, -31113,
+  -31356, -31580, -31785, -31971, -32137, -32285, -32412, -32521, -32609, -32678, -32728, -32757,
+  -32767, -32757, -32728, -32678, -32609, -32521, -32412, -32285, -32137, -31971, -31785, -31580,
+  -31356, -31113, -30852, -30571, -30273, -29956, -29621, -29268, -28898, -28510, -28105, -27683,
+  -27245, -26790, -26319, -25832, -25329, -24811, -24279, -23731, -23170, -22594, -22005, -21403,
+  -20787, -20159, -19519, -18868, -18204, -17530, -16846, -16151, -15446, -14732, -14010, -13279,
+  -12539, -11793, -11039, -10278, -9512, -8739, -7962, -7179, -6393, -5602, -4808, -4011,
+  -3212, -2410, -1608, -804, 0,
+};
+
+// sin of a 32 bit phase (2^32 a cycle), Q15, interpolated
+static inline int32_t hum_sin(uint32_t phase) {
+  const uint32_t i = phase >> 24;
+  const int32_t frac = (int32_t)((phase >> 9) & 0x7FFF);
+  const int32_t a = hum_sin_table[i], b = hum_sin_table[i + 1];
+  return a + (((b - a) * frac) >> 15);
+}
+
+struct mic_hum {
+  uint32_t phase; // fundamental
+  uint32_t step;  // phase per sample
+  uint32_t step_min, step_max;
+  int harmonics;
+  int mu_shift;     // LMS step 2^-mu_shift
+  int32_t fll_gain; // oscillator step per unit of weight turn (below)
+  int block;        // samples in an FLL block
+  int fill;         // samples into it
+  int32_t w[HUM_MAX_HARMONICS][2];    // cos and sin weights, LSB Q14 (room for a full scale square)
+  int64_t sum[HUM_MAX_HARMONICS][2];  // of the weights over this block
+  int64_t last[HUM_MAX_HARMONICS][2]; // and over the one before
+  int rate;
+};
+
+// `mains_hz` 50 or 60, and as many of its harmonics as fit below 0.45 of
+// the sample rate, up to `harmonics`
+static inline void hum_init(struct mic_hum *h, int rate, int mains_hz, int harmonics) {
+  memset(h, 0, sizeof(*h));
+  h->rate = rate;
+  const double cycles = 4294967296.0 / rate; // phase per Hz
+  h->step = (uint32_t)(mains_hz * cycles + 0.5);
+  h->step_min = (uint32_t)(mains_hz * (100 - HUM_RANGE_PCT) / 100.0 * cycles);
+  h->step_max = (uint32_t)(mains_hz * (100 + HUM_RANGE_PCT) / 100.0 * cycles);
+  if (harmonics > HUM_MAX_HARMONICS) harmonics = HUM_MAX_HARMONICS;
+  while (harmonics > 0 && harmonics * mains_hz * (100 + HUM_RANGE_PCT) > 45 * rate) harmonics--;
+  h->harmonics = harmonics;
+  h->block = rate * HUM_FLL_MS / 1000;
+  // An LMS step of mu with a unit reference puts the notch's poles 1 - mu/2
+  // from the origin, so it's mu rad/sample wide: mu = 2 pi bw / rate, to
+  // the nearest power of two
+  const double mu = 2 * 3.14159265358979 * HUM_BANDWIDTH_HZ / rate;
+  h->mu_shift = 1;
+  while (1.0 / (1 << (h->mu_shift + 1)) > mu * 0.7071) h->mu_shift++;
+  // The weights take 2/mu samples to follow a change, and the turn they
+  // show lags by that much; with that in it the oscillator's loop is
+  // critically damped when a turn of x rad over a block of B samples, x / B
+  // rad/sample off, moves the rate mu B / 8 of the way there.
+  // It settles in a few seconds and follows the grid's drift closely.
+  h->fll_gain = (int32_t)(4294967296.0 / (1 << h->mu_shift) / (16 * 3.14159265358979));
+}
+
+// Takes the hum out of n samples in place, `stride` apart (the channel
+// count, for one channel of an interleaved block)
+static inline void hum_cancel(struct mic_hum *h, int16_t *a, int n, int stride) {
+  const int nh = h->harmonics;
+  const int shift = 17 + h->mu_shift; // e Q16 times Q15 to Q14, times mu
+  const int64_t round = (int64_t)1 << (shift - 1);
+  for (int i = 0; i < n; i++) {
+    int32_t c[HUM_MAX_HARMONICS], s[HUM_MAX_HARMONICS];
+    int64_t fit = 0; // LSB Q29
+    uint32_t ph = h->phase;
+    for (int k = 0; k < nh; k++) {
+      c[k] = hum_sin(ph + 0x40000000u);
+      s[k] = hum_sin(ph);
+      fit += (int64_t)h->w[k][0] * c[k] + (int64_t)h->w[k][1] * s[k];
+      ph += h->phase;
+    }
+    const int16_t x = a[i * stride];
+    const int64_t e = ((int64_t)x << 16) - (fit >> 13); // LSB Q16
+    const int64_t y = (e + (1 << 15)) >> 16;
+    a[i * stride] = (int16_t)(y > 32767 ? 32767 : y < -32768 ? -32768 : y);
+    for (int k = 0; k < nh; k++) {
+      h->w[k][0] += (int32_t)((e * c[k] + round) >> shift);
+      h->w[k][1] += (int32_t)((e * s[k] + round) >> shift);
+      h->sum[k][0] += h->w[k][0];
+      h->sum[k][1] += h->w[k][1];
+    }
+    h->phase += h->step;
+
+    if (++h->fill < h->block) continue;
+    h->fill = 0;
+    // How far the weights turned over the block: each harmonic's cross
+    // product with where it was, sin(angle) |w|^2, and harmonic k turns k
+    // times as far as the fundamental. Over sum(k |w_k|^2) that is the
+    // fundamental's turn in rad. Q8 keeps the squares in 64 bits.
+    int64_t turn = 0, power = 0;
+    for (int k = 0; k < nh; k++) {
+      const int64_t ca = h->sum[k][0] / h->block >> 6, sa = h->sum[k][1] / h->block >> 6;
+      const int64_t cb = h->last[k][0] / h->block >> 6, sb = h->last[k][1] / h->block >> 6;
+      turn += cb * sa - sb * ca;
+      power += (k + 1) * (ca * ca + sa * sa);
+      h->last[k][0] = h->sum[k][0];
+      h->last[k][1] = h->sum[k][1];
+      h->sum[k][0] = h->sum[k][1] = 0;
+    }
+    // under about 2 LSB of hum the turn is mostly noise: hold
+    if (power < ((int64_t)4 << 16)) continue;
+    int bits = 0;
+    for (int64_t p = power; p >>= 1;) bits++;
+    if (bits > 40) {
+      turn >>= bits - 40;
+      power >>= bits - 40;
+    }
+    // the hum's cos/sin weights turn backwards as it runs ahead
+    const int64_t step = (int64_t)h->step - turn * h->fll_gain / power;
+    h->step = (uint32_t)(step < h->step_min ? h->step_min : step > h->step_max ? h->step_max : step);
+  }
+}
+
+// The mains frequency it is following, mHz
+static inline uint32_t hum_freq_mhz(const struct mic_hum *h) {
+  return (uint32_t)(((uint64_t)h->step * (uint64_t)h->rate * 1000 + (1ull << 31)) >> 32);
+}
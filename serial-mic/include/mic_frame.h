@@ -0,0 +1,154 @@
+// Per-buffer processing and packet framing for the serial-mic firmware.
+// Header only and plain C so the host tools and benchmarks can build the
+// exact code the board runs.
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// ====================== Packet format ======================
+// [0xA6][uint16 len][uint32 seq][uint32 usec][payload bytes][uint16 crc]
+#define MIC_PKT_SYNC 0xA6
+#define MIC_PKT_HEADER_LEN (1 + 2 + 4 + 4) // type + length + seq + usec
+#define MIC_PKT_TRAILER_LEN 2              // crc16
+
+// Smooth block-mean DC remover
+// Use per block of N (e.g., your codec frame size). Pick LERP_SHIFT to slew the
+// DC estimate smoothly between old and new means; S=8..11 are gentle.
+#ifndef LERP_SHIFT
+#define LERP_SHIFT 10  // larger => slower update
+#endif
+
+static inline int16_t sat16(int32_t v){
+  if (v >  32767) return  32767;
+  if (v < -32768) return -32768;
+  return (int16_t)v;
+}
+
+// dc_est is the Q15 running DC estimate, 0 to start
+static inline void dc_block_and_copy(int32_t *dc_est, int16_t * __restrict a, int n){
+  // compute block mean in int32 to avoid overflow
+  int64_t sum = 0;
+  for(int i=0;i<n;i++) sum += a[i];
+  int32_t mean_q15 = (int32_t)((sum / n) << 15); // int16 mean -> Q15
+
+  // slew dc_est towards block mean to avoid zipper noise
+  // dc_est += (mean_q15 - dc_est) * (1/2^LERP_SHIFT)
+  *dc_est += ( (mean_q15 - *dc_est) >> LERP_SHIFT );
+
+  // subtract DC estimate
+  for(int i=0;i<n;i++){
+    int32_t y = ((int32_t)a[i] << 15) - *dc_est; // Q15
+    a[i] = sat16( (y + (1<<14)) >> 15 );         // back to int16
+  }
+}
+
+// ====================== CRC-16/CCITT (0x1021, init 0xFFFF, no XORout)
+// ======================
+static inline uint16_t crc16_ccitt(const uint8_t *data, size_t len) {
+  uint16_t crc = 0xFFFF;
+  for (size_t i = 0; i < len; ++i) {
+    crc ^= (uint16_t)data[i] << 8;
+    for (int b = 0; b < 8; ++b) {
+      if (crc & 0x8000)
+        crc = (crc << 1) ^ 0x1021;
+      else
+        crc <<= 1;
+    }
+  }
+  return crc;
+}
+
+// ====================== Helpers ======================
+static inline void le_write16(uint8_t *p, uint16_t v) {
+  p[0] = (uint8_t)(v & 0xFF);
+  p[1] = (uint8_t)((v >> 8) & 0xFF);
+}
+static inline void le_write32(uint8_t *p, uint32_t v) {
+  p[0] = (uint8_t)(v & 0xFF);
+  p[1] = (uint8_t)((v >> 8) & 0xFF);
+  p[2] = (uint8_t)((v >> 16) & 0xFF);
+  p[3] = (uint8_t)((v >> 24) & 0xFF);
+}
+
+// Frame n samples into out (MIC_PKT_HEADER_LEN + 2n + MIC_PKT_TRAILER_LEN
+// bytes), CRC over header + payload or 0. Returns the packet length.
+static inline size_t frame_packet(uint8_t *out, uint32_t seq, uint32_t usec,
+                                  const int16_t *samples, int n, int use_crc) {
+  const uint16_t payload_len = (uint16_t)(n * 2);
+  uint8_t *p = out;
+  *p++ = MIC_PKT_SYNC; // sync
+  le_write16(p, payload_len); p += 2; // length
+  le_write32(p, seq);          p += 4; // seq
+  le_write32(p, usec);         p += 4; // timestamp
+
+  // payload (PCM16 little-endian)
+  for (int i = 0; i < n; ++i) {
+    const int16_t s = samples[i];
+    *p++ = (uint8_t)(s & 0xFF);
+    *p++ = (uint8_t)((s >> 8) & 0xFF);
+  }
+
+  // CRC over header + payload
+  const uint16_t crc = use_crc ? crc16_ccitt(out, MIC_PKT_HEADER_LEN + payload_len) : 0;
+  le_write16(p, crc); p += 2;
+  return (size_t)(p - out);
+}
+
+// ====================== Clock sync ======================
+// NTP style exchanges on the CDC link's otherwise unused host to board side.
+// The board stamps a request as it comes in and its reply just before it is
+// written, with the esp_timer that stamps the packets:
+//   host -> board  [0xA7][uint32 id][uint16 crc]
+//   board -> host  [0xA7][uint16 len = 4][uint32 id][uint32 sent usec]
+//                  [uint32 arrived usec][uint16 crc]
+// A reply is framed like a packet with another sync byte, so a parser that
+// doesn't know it passes over it. CRCs as for packets.
+#define MIC_SYNC_BYTE 0xA7
+#define MIC_SYNC_REQ_LEN (1 + 4 + 2) // sync + id + crc16
+#define MIC_SYNC_REPLY_PAYLOAD_LEN 4 // arrived usec
+#define MIC_SYNC_REPLY_LEN (MIC_PKT_HEADER_LEN + MIC_SYNC_REPLY_PAYLOAD_LEN + MIC_PKT_TRAILER_LEN)
+
+static inline uint32_t le_read32(const uint8_t *p) {
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// MIC_SYNC_REQ_LEN bytes into out
+static inline size_t frame_sync_request(uint8_t *out, uint32_t id) {
+  out[0] = MIC_SYNC_BYTE;
+  le_write32(out + 1, id);
+  le_write16(out + 5, crc16_ccitt(out, 5));
+  return MIC_SYNC_REQ_LEN;
+}
+
+// MIC_SYNC_REPLY_LEN bytes into out
+static inline size_t frame_sync_reply(uint8_t *out, uint32_t id, uint32_t arrived_usec, uint32_t sent_usec) {
+  out[0] = MIC_SYNC_BYTE;
+  le_write16(out + 1, MIC_SYNC_REPLY_PAYLOAD_LEN);
+  le_write32(out + 3, id);
+  le_write32(out + 7, sent_usec);
+  le_write32(out + MIC_PKT_HEADER_LEN, arrived_usec);
+  le_write16(out + MIC_PKT_HEADER_LEN + MIC_SYNC_REPLY_PAYLOAD_LEN,
+             crc16_ccitt(out, MIC_PKT_HEADER_LEN + MIC_SYNC_REPLY_PAYLOAD_LEN));
+  return MIC_SYNC_REPLY_LEN;
+}
+
+// Finds requests in what the board receives, a byte at a time. Zero it to
+// start.
+struct mic_sync_rx {
+  uint8_t buf[MIC_SYNC_REQ_LEN];
+  int fill;
+};
+
+// 1, with *id set, when b completes a request. A bad one is dropped whole:
+// the host asks again.
+static inline int sync_rx_byte(struct mic_sync_rx *rx, uint8_t b, uint32_t *id) {
+  if (rx->fill == 0 && b != MIC_SYNC_BYTE) return 0;
+  rx->buf[rx->fill++] = b;
+  if (rx->fill < MIC_SYNC_REQ_LEN) return 0;
+  rx->fill = 0;
+  const uint16_t crc = (uint16_t)(rx->buf[5] | (rx->buf[6] << 8));
+  if (crc16_ccitt(rx->buf, 5) != crc) return 0;
+  *id = le_read32(rx->buf + 1);
+  return 1;
+}
@@ -0,0 +1,411 @@
+// Sound level meter for the serial-mic firmware: 1/3 octave band levels and
+// A and C weighted levels, integrated over an interval (Leq), instead of the
+// samples. Header only and plain C, like mic_frame.h, so the host benchmarks
+// build the exact code the board runs.
+//
+//   - bands are base 10 thirds of an octave, numbered from 1 kHz (0) as
+//     IEC 61260-1 has them: band x is centred on 1000 * 10^(x/10) Hz. Each is
+//     a 6th order Butterworth bandpass (3 biquads), which meets the class 1
+//     masks with some room. Above a fifth of the sample rate the bilinear
+//     transform stretches a band's skirts, so the top three get 8th order
+//   - a band costs the same per sample at any rate, so the low ones run on
+//     decimated audio: every octave down, a 6th order Butterworth low pass
+//     and every other sample. Each band runs at the lowest rate that leaves
+//     it below a fifth of that rate (bar the top three, which no rate does),
+//     clear of where the bilinear transform squeezes the response, and the 25 bands and their
+//     decimators cost about what ten bands would at the full rate
+//   - A and C weighting are IEC 61672-1's analog filters through the bilinear
+//     transform, with their 12.2 kHz poles (above Nyquist at 16 kHz) as a
+//     3 tap FIR that matches them across the band
+//   - levels are dB against a full scale sine: a calibration (the mic's
+//     sensitivity) turns them into dB SPL
+// Floats: the ESP32-S3 has a single precision FPU, and 1/3 octave poles at
+// 16 kHz are too close to the unit circle for 16 bit coefficients. The
+// designs are worked out in double once, at init.
+#pragma once
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "mic_frame.h"
+
+#ifndef SLM_FIRST_BAND
+#define SLM_FIRST_BAND -16 // 25 Hz
+#endif
+#ifndef SLM_LAST_BAND
+#define SLM_LAST_BAND 8    // 6.3 kHz, the last whose top edge is under 8 kHz
+#endif
+#define SLM_MAX_BANDS 32
+#define SLM_MAX_STAGES 10
+#define SLM_MAX_SECTIONS 4 // per band
+#define SLM_BLOCK 256      // samples per pass through the bank
+#define SLM_NO_LEVEL -32768 // a band with nothing in it, in the packet
+
+// ====================== Filters ======================
+// Transposed direct form II
+struct slm_biquad {
+  float b0, b1, b2, a1, a2;
+  float z1, z2;
+};
+
+static inline void slm_biquad_run(struct slm_biquad *q, float *x, int n) {
+  const float b0 = q->b0, b1 = q->b1, b2 = q->b2, a1 = q->a1, a2 = q->a2;
+  float z1 = q->z1, z2 = q->z2;
+  for (int i = 0; i < n; i++) {
+    const float in = x[i];
+    const float y = b0 * in + z1;
+    z1 = b1 * in - a1 * y + z2;
+    z2 = b2 * in - a2 * y;
+    x[i] = y;
+  }
+  q->z1 = z1;
+  q->z2 = z2;
+}
+
+// Complex arithmetic for the designs
+struct slm_cx {
+  double re, im;
+};
+
+static inline struct slm_cx slm_cx_mul(struct slm_cx a, struct slm_cx b) {
+  struct slm_cx r = {a.re * b.re - a.im * b.im, a.re * b.im + a.im * b.re};
+  return r;
+}
+
+static inline struct slm_cx slm_cx_div(struct slm_cx a, struct slm_cx b) {
+  const double d = b.re * b.re + b.im * b.im;
+  struct slm_cx r = {(a.re * b.re + a.im * b.im) / d, (a.im * b.re - a.re * b.im) / d};
+  return r;
+}
+
+static inline struct slm_cx slm_cx_sqrt(struct slm_cx a) {
+  const double m = sqrt(a.re * a.re + a.im * a.im);
+  struct slm_cx r = {sqrt((m + a.re) / 2), sqrt((m - a.re) / 2)};
+  if (a.im < 0) r.im = -r.im;
+  return r;
+}
+
+// s plane to z plane
+static inline struct slm_cx slm_bilinear(struct slm_cx s, double rate) {
+  struct slm_cx num = {2 * rate + s.re, s.im}, den = {2 * rate - s.re, -s.im};
+  return slm_cx_div(num, den);
+}
+
+// An analog frequency, rad/s, that lands on `hz` after the bilinear transform
+static inline double slm_prewarp(double hz, double rate) { return 2 * rate * tan(M_PI * hz / rate); }
+
+// A biquad with a pole at z and its conjugate, and the numerator given
+static inline void slm_biquad_set(struct slm_biquad *q, struct slm_cx z, double b0, double b1, double b2) {
+  q->b0 = (float)b0;
+  q->b1 = (float)b1;
+  q->b2 = (float)b2;
+  q->a1 = (float)(-2 * z.re);
+  q->a2 = (float)(z.re * z.re + z.im * z.im);
+  q->z1 = q->z2 = 0;
+}
+
+// |H| of a biquad at `hz`
+static inline double slm_biquad_gain(const struct slm_biquad *q, double hz, double rate) {
+  const double w = 2 * M_PI * hz / rate;
+  const struct slm_cx z1 = {cos(w), -sin(w)}, z2 = {cos(2 * w), -sin(2 * w)};
+  const struct slm_cx num = {q->b0 + q->b1 * z1.re + q->b2 * z2.re, q->b1 * z1.im + q->b2 * z2.im};
+  const struct slm_cx den = {1 + q->a1 * z1.re + q->a2 * z2.re, q->a1 * z1.im + q->a2 * z2.im};
+  return sqrt((num.re * num.re + num.im * num.im) / (den.re * den.re + den.im * den.im));
+}
+
+static inline void slm_biquad_scale(struct slm_biquad *q, double g) {
+  q->b0 = (float)(q->b0 * g);
+  q->b1 = (float)(q->b1 * g);
+  q->b2 = (float)(q->b2 * g);
+}
+
+// Band x's centre, and its edges a sixth of an octave (base 10) either side
+static inline double slm_band_hz(int x) { return 1000 * pow(10, x / 10.0); }
+
+// Butterworth bandpass of order 2 * `order` (3 or 4) over band x: the low
+// pass prototype's poles, each moved to the pair s^2 - p bw s + w0^2 has,
+// with zeros at DC and Nyquist. Each section is 0 dB at the centre. Returns
+// the number of sections.
+static inline int slm_design_band(struct slm_biquad *q, int x, int order, double rate) {
+  const double fm = slm_band_hz(x), half = pow(10, 0.3 / 6);
+  const double w1 = slm_prewarp(fm / half, rate), w2 = slm_prewarp(fm * half, rate);
+  const double bw = w2 - w1, w0sq = w1 * w2;
+  int k = 0;
+  for (int p = 0; p < (order + 1) / 2; p++) {
+    // the prototype's poles in the upper half plane, and a real one for odd orders
+    const double theta = (2 * p + 1) * M_PI / (2 * order);
+    const struct slm_cx pb = {-sin(theta) * bw, fabs(cos(theta)) < 1e-12 ? 0 : cos(theta) * bw};
+    struct slm_cx d = slm_cx_mul(pb, pb);
+    d.re -= 4 * w0sq;
+    const struct slm_cx r = slm_cx_sqrt(d);
+    const struct slm_cx roots[2] = {{(pb.re + r.re) / 2, (pb.im + r.im) / 2}, {(pb.re - r.re) / 2, (pb.im - r.im) / 2}};
+    // a real prototype pole gives a conjugate pair: one section
+    const int real = pb.im == 0;
+    for (int j = 0; j < (real ? 1 : 2); j++) {
+      const struct slm_cx s = !real || roots[j].im >= 0 ? roots[j] : roots[1 - j];
+      slm_biquad_set(&q[k], slm_bilinear(s, rate), 1, 0, -1);
+      slm_biquad_scale(&q[k], 1 / slm_biquad_gain(&q[k], fm, rate));
+      k++;
+    }
+  }
+  return k;
+}
+
+// 6th order Butterworth low pass at fc, unity at DC
+static inline void slm_design_lowpass(struct slm_biquad q[3], double fc, double rate) {
+  const double wc = slm_prewarp(fc, rate);
+  for (int k = 0; k < 3; k++) {
+    const double theta = (2 * k + 1) * M_PI / 12;
+    const struct slm_cx s = {-wc * sin(theta), wc * cos(theta)};
+    const struct slm_cx z = slm_bilinear(s, rate);
+    const double g = (1 - 2 * z.re + z.re * z.re + z.im * z.im) / 4;
+    slm_biquad_set(&q[k], z, g, 2 * g, g);
+  }
+}
+
+// ====================== Frequency weighting ======================
+// IEC 61672-1 Annex E: A is s^4 / ((s + w1)^2 (s + w2) (s + w3) (s + w4)^2),
+// C is s^2 / ((s + w1)^2 (s + w4)^2), both 0 dB at 1 kHz
+#define SLM_F1 20.598997
+#define SLM_F2 107.65265
+#define SLM_F3 737.86223
+#define SLM_F4 12194.217
+
+enum { SLM_WEIGHT_A, SLM_WEIGHT_C };
+
+struct slm_weight {
+  struct slm_biquad q[3];
+  int sections;
+  float fir; // w4's poles as [c, 1 - 2c, c], when they are above Nyquist
+  float x1, x2;
+};
+
+// Two real poles at w_a and w_b (Hz, prewarped) and two zeros at DC
+static inline void slm_highpass2(struct slm_biquad *q, double fa, double fb, double rate) {
+  const double wa = slm_prewarp(fa, rate), wb = slm_prewarp(fb, rate);
+  const double za = (2 * rate - wa) / (2 * rate + wa), zb = (2 * rate - wb) / (2 * rate + wb);
+  q->b0 = 1;
+  q->b1 = -2;
+  q->b2 = 1;
+  q->a1 = (float)-(za + zb);
+  q->a2 = (float)(za * zb);
+  q->z1 = q->z2 = 0;
+}
+
+// [c, 1 - 2c, c] is 1 - 4c sin^2(pi f / rate): matched to 1 / (1 + (f/f4)^2)
+// at a quarter of the rate, it's within 0.7 dB of it up to 7 kHz at 16 kHz
+static inline double slm_fir_gain(double c, double hz, double rate) {
+  const double s = sin(M_PI * hz / rate);
+  return 1 - 4 * c * s * s;
+}
+
+static inline void slm_design_weight(struct slm_weight *w, int which, double rate) {
+  memset(w, 0, sizeof(*w));
+  slm_highpass2(&w->q[w->sections++], SLM_F1, SLM_F1, rate);
+  if (which == SLM_WEIGHT_A) {
+    slm_highpass2(&w->q[w->sections++], SLM_F2, SLM_F3, rate);
+  }
+  if (SLM_F4 < 0.4 * rate) {
+    struct slm_biquad *q = &w->q[w->sections++];
+    const double w4 = slm_prewarp(SLM_F4, rate);
+    const double z4 = (2 * rate - w4) / (2 * rate + w4);
+    const double g = (1 - z4) * (1 - z4) / 4;
+    q->b0 = (float)g;
+    q->b1 = (float)(2 * g);
+    q->b2 = (float)g;
+    q->a1 = (float)(-2 * z4);
+    q->a2 = (float)(z4 * z4);
+  } else {
+    const double f = rate / 4;
+    w->fir = (float)((1 - 1 / (1 + (f / SLM_F4) * (f / SLM_F4))) / 2);
+  }
+  double g = 1;
+  for (int k = 0; k < w->sections; k++) {
+    g *= slm_biquad_gain(&w->q[k], 1000, rate);
+  }
+  if (w->fir != 0) g *= slm_fir_gain(w->fir, 1000, rate);
+  slm_biquad_scale(&w->q[0], 1 / g);
+}
+
+static inline void slm_weight_run(struct slm_weight *w, float *x, int n) {
+  for (int k = 0; k < w->sections; k++) {
+    slm_biquad_run(&w->q[k], x, n);
+  }
+  if (w->fir == 0) return;
+  const float c = w->fir, mid = 1 - 2 * w->fir;
+  float x1 = w->x1, x2 = w->x2;
+  for (int i = 0; i < n; i++) {
+    const float in = x[i];
+    x[i] = c * (in + x2) + mid * x1; // a sample late
+    x2 = x1;
+    x1 = in;
+  }
+  w->x1 = x1;
+  w->x2 = x2;
+}
+
+// ====================== Meter ======================
+struct mic_slm {
+  int rate;
+  int bands;                             // SLM_FIRST_BAND up
+  int stages;                            // rates, each half the one before
+  int band_stage[SLM_MAX_BANDS];
+  int band_sections[SLM_MAX_BANDS];
+  struct slm_biquad band[SLM_MAX_BANDS][SLM_MAX_SECTIONS];
+  struct slm_biquad decimate[SLM_MAX_STAGES][3]; // stage k to k + 1
+  int odd[SLM_MAX_STAGES];               // stage k + 1 takes stage k's next sample if 0
+  struct slm_weight a, c;
+
+  // The interval so far
+  uint32_t interval; // samples in one
+  uint32_t samples;  // in this one
+  uint32_t stage_samples[SLM_MAX_STAGES];
+  double band_energy[SLM_MAX_BANDS]; // sum of squares, LSB^2
+  double z_energy, a_energy, c_energy;
+
+  float buf[2][SLM_BLOCK];
+  float work[SLM_BLOCK];
+};
+
+// `interval` samples per Leq, e.g. a second's worth
+static inline void slm_init(struct mic_slm *s, int rate, uint32_t interval) {
+  memset(s, 0, sizeof(*s));
+  s->rate = rate;
+  s->interval = interval;
+  s->bands = SLM_LAST_BAND - SLM_FIRST_BAND + 1;
+  for (int b = 0; b < s->bands; b++) {
+    const double fm = slm_band_hz(SLM_FIRST_BAND + b);
+    int stage = 0;
+    while (stage + 1 < SLM_MAX_STAGES && fm <= rate / (double)(1 << (stage + 1)) / 5) stage++;
+    s->band_stage[b] = stage;
+    const double stage_rate = (double)rate / (1 << stage);
+    s->band_sections[b] = slm_design_band(s->band[b], SLM_FIRST_BAND + b, fm > stage_rate / 5 ? 4 : 3, stage_rate);
+    if (stage + 1 > s->stages) s->stages = stage + 1;
+  }
+  // passes everything the next stage's bands reach (a fifth of its rate and
+  // a sixth of an octave) flat, and what would fold onto them is 70 dB down
+  for (int k = 0; k + 1 < s->stages; k++) {
+    slm_design_lowpass(s->decimate[k], 0.2 * rate / (1 << k), (double)rate / (1 << k));
+  }
+  slm_design_weight(&s->a, SLM_WEIGHT_A, rate);
+  slm_design_weight(&s->c, SLM_WEIGHT_C, rate);
+}
+
+static inline float slm_energy(const float *x, int n) {
+  float e = 0;
+  for (int i = 0; i < n; i++) e += x[i] * x[i];
+  return e;
+}
+
+// Up to SLM_BLOCK samples through the bank
+static inline void slm_block(struct mic_slm *s, const int16_t *pcm, int n) {
+  float *in = s->buf[0], *next = s->buf[1], *work = s->work;
+  for (int i = 0; i < n; i++) in[i] = pcm[i];
+  s->z_energy += slm_energy(in, n);
+  memcpy(work, in, n * sizeof(float));
+  slm_weight_run(&s->a, work, n);
+  s->a_energy += slm_energy(work, n);
+  memcpy(work, in, n * sizeof(float));
+  slm_weight_run(&s->c, work, n);
+  s->c_energy += slm_energy(work, n);
+
+  for (int k = 0; k < s->stages && n > 0; k++) {
+    s->stage_samples[k] += n;
+    for (int b = 0; b < s->bands; b++) {
+      if (s->band_stage[b] != k) continue;
+      memcpy(work, in, n * sizeof(float));
+      for (int q = 0; q < s->band_sections[b]; q++) {
+        slm_biquad_run(&s->band[b][q], work, n);
+      }
+      s->band_energy[b] += slm_energy(work, n);
+    }
+    if (k + 1 == s->stages) break;
+    memcpy(work, in, n * sizeof(float));
+    slm_biquad_run(&s->decimate[k][0], work, n);
+    slm_biquad_run(&s->decimate[k][1], work, n);
+    slm_biquad_run(&s->decimate[k][2], work, n);
+    int m = 0;
+    for (int i = s->odd[k]; i < n; i += 2) next[m++] = work[i];
+    s->odd[k] = (s->odd[k] + n) & 1;
+    float *t = in;
+    in = next;
+    next = t;
+    n = m;
+  }
+}
+
+// Takes samples up to the end of the interval and returns how many; when
+// slm_ready(), the levels are in and slm_frame_levels() sends them on
+static inline int slm_process(struct mic_slm *s, const int16_t *pcm, int n) {
+  const uint32_t left = s->interval - s->samples;
+  if ((uint32_t)n > left) n = (int)left;
+  for (int done = 0; done < n; done += SLM_BLOCK) {
+    slm_block(s, pcm + done, n - done < SLM_BLOCK ? n - done : SLM_BLOCK);
+  }
+  s->samples += n;
+  return n;
+}
+
+static inline int slm_ready(const struct mic_slm *s) { return s->samples >= s->interval; }
+
+// dB against a full scale sine (32767 peak), SLM_NO_LEVEL / 100 for nothing
+static inline double slm_level_db(double energy, uint32_t samples) {
+  if (samples == 0 || energy <= 0) return SLM_NO_LEVEL / 100.0;
+  const double db = 10 * log10(energy / samples / (32768.0 * 32768.0 / 2));
+  return db < SLM_NO_LEVEL / 100.0 ? SLM_NO_LEVEL / 100.0 : db;
+}
+
+static inline double slm_band_db(const struct mic_slm *s, int b) {
+  return slm_level_db(s->band_energy[b], s->stage_samples[s->band_stage[b]]);
+}
+
+// Next interval
+static inline void slm_restart(struct mic_slm *s) {
+  s->samples = 0;
+  memset(s->stage_samples, 0, sizeof(s->stage_samples));
+  memset(s->band_energy, 0, sizeof(s->band_energy));
+  s->z_energy = s->a_energy = s->c_energy = 0;
+}
+
+// ====================== Band level packet ======================
+// The interval's levels, framed like a packet with another sync byte so a
+// parser that doesn't know it passes over it:
+//   [0xA8][uint16 len][uint32 seq][uint32 usec]
+//   [uint32 samples][int8 first band][uint8 bands]
+//   [int16 LAeq][int16 LCeq][int16 LZeq][int16 band Leq x bands][uint16 crc]
+// usec is the end of the interval, levels are centi-dB against a full scale
+// sine (the bands unweighted), SLM_NO_LEVEL for none.
+#define MIC_LEVELS_BYTE 0xA8
+#define MIC_LEVELS_FIXED_LEN (4 + 1 + 1 + 3 * 2)
+#define MIC_LEVELS_MAX_LEN (MIC_PKT_HEADER_LEN + MIC_LEVELS_FIXED_LEN + 2 * SLM_MAX_BANDS + MIC_PKT_TRAILER_LEN)
+
+static inline int16_t slm_centi_db(double db) {
+  const double c = floor(db * 100 + 0.5);
+  return (int16_t)(c > 32767 ? 32767 : c < SLM_NO_LEVEL ? SLM_NO_LEVEL : c);
+}
+
+// The levels into out (MIC_LEVELS_MAX_LEN bytes will do) and the meter on
+// to the next interval. Returns the packet length.
+static inline size_t slm_frame_levels(uint8_t *out, struct mic_slm *s, uint32_t seq, uint32_t usec, int use_crc) {
+  const uint16_t payload_len = (uint16_t)(MIC_LEVELS_FIXED_LEN + 2 * s->bands);
+  uint8_t *p = out;
+  *p++ = MIC_LEVELS_BYTE;
+  le_write16(p, payload_len); p += 2;
+  le_write32(p, seq);         p += 4;
+  le_write32(p, usec);        p += 4;
+  le_write32(p, s->samples);  p += 4;
+  *p++ = (uint8_t)(int8_t)SLM_FIRST_BAND;
+  *p++ = (uint8_t)s->bands;
+  le_write16(p, (uint16_t)slm_centi_db(slm_level_db(s->a_energy, s->samples))); p += 2;
+  le_write16(p, (uint16_t)slm_centi_db(slm_level_db(s->c_energy, s->samples))); p += 2;
+  le_write16(p, (uint16_t)slm_centi_db(slm_level_db(s->z_energy, s->samples))); p += 2;
+  for (int b = 0; b < s->bands; b++) {
+    le_write16(p, (uint16_t)slm_centi_db(slm_band_db(s, b))); p += 2;
+  }
+  const uint16_t crc = use_crc ? crc16_ccitt(out, MIC_PKT_HEADER_LEN + payload_len) : 0;
+  le_write16(p, crc); p += 2;
+  slm_restart(s);
+  return (size_t)(p - out);
+}
@@ -5,12 +5,21 @@
 #include <driver/i2s.h>
 #include <math.h>
 
+#include "hum_notch.h"
+#include "mic_frame.h"
+#include "mic_slm.h"
+
 // ====================== User-tweakables ======================
 #define SAMPLE_RATE 16000     // Hz (frontend defaults to 16 kHz)
 #define I2C_SAMPLE_RATE 16000 // Hz (frontend defaults to 16 kHz)
 #define SAMPLE_BUFFER_SIZE 1024 // I2S read chunk in samples (PCM16 payload = 2048 bytes)
 #define SERIAL_BAUD 115200 // USB-CDC ignores baud, but keep for compatibility
 #define USE_CRC 1          // 1 = append CRC-16/CCITT
+#define HUM_MAINS_HZ 0     // local mains (50 or 60) to cancel hum at, 0 = off. It only tracks
+                           // 4% either side, so a 60 Hz grid needs 60, not 50
+#define HUM_HARMONICS 8    // how many of its harmonics, fundamental included
+#define SLM_MODE 0         // 1 = send 1/3 octave and A/C levels (mic_slm.h) instead of PCM
+#define SLM_INTERVAL_MS 1000 // how often, and how long each level's Leq is over
 
 // Test signals removed; always use microphone input
 
@@ -48,10 +57,9 @@ static i2s_pin_config_t i2s_mic_pins = {.bck_io_num = I2S_MIC_SERIAL_CLOCK,
 // ====================== Packet format ======================
 // [0xA6][uint16 len][uint32 seq][uint32 usec][payload bytes][uint16 crc]
 // Note: The first byte is a sync marker (0xA6). Payload is PCM16 little-endian.
-static const uint8_t PKT_SYNC = 0xA6;
-static const size_t PKT_HEADER_LEN =
-    1 + 2 + 4 + 4;                       // type + length + seq + usec
-static const size_t PKT_TRAILER_LEN = 2; // crc16
+// With SLM_MODE the board sends band level packets (0xA8, mic_slm.h) instead.
+static const size_t PKT_HEADER_LEN = MIC_PKT_HEADER_LEN;
+static const size_t PKT_TRAILER_LEN = MIC_PKT_TRAILER_LEN;
 // PCM16 payload is 2 bytes per sample
 static const size_t MAX_PAYLOAD_BYTES = SAMPLE_BUFFER_SIZE * 2;
 static const size_t MAX_PKT_BYTES =
@@ -61,71 +69,66 @@ static const size_t MAX_PKT_BYTES =
 static int16_t sample_buf[SAMPLE_BUFFER_SIZE]; // raw from I2S
 static uint8_t tx_buf[MAX_PKT_BYTES];
 
-// Smooth block-mean DC remover
-// Use per block of N (e.g., your codec frame size). Pick LERP_SHIFT to slew the
-// DC estimate smoothly between old and new means; S=8..11 are gentle.
-#define LERP_SHIFT 10  // larger => slower update
-
 static int32_t dc_est = 0; // Q15 running DC estimate
-
-static inline int16_t sat16(int32_t v){
-  if (v >  32767) return  32767;
-  if (v < -32768) return -32768;
-  return (int16_t)v;
-}
-
-static void dc_block_and_copy(int16_t * __restrict a, int n){
-  // compute block mean in int32 to avoid overflow
-  int64_t sum = 0;
-  for(int i=0;i<n;i++) sum += a[i];
-  int32_t mean_q15 = (int32_t)((sum / n) << 15); // int16 mean -> Q15
-
-  // slew dc_est towards block mean to avoid zipper noise
-  // dc_est += (mean_q15 - dc_est) * (1/2^LERP_SHIFT)
-  dc_est += ( (mean_q15 - dc_est) >> LERP_SHIFT );
-
-  // subtract DC estimate
-  for(int i=0;i<n;i++){
-    int32_t y = ((int32_t)a[i] << 15) - dc_est; // Q15
-    a[i] = sat16( (y + (1<<14)) >> 15 );        // back to int16
-  }
-}
-
-// ====================== CRC-16/CCITT (0x1021, init 0xFFFF, no XORout)
-// ======================
-static uint16_t crc16_ccitt(const uint8_t *data, size_t len) {
-  uint16_t crc = 0xFFFF;
-  for (size_t i = 0; i < len; ++i) {
-    crc ^= (uint16_t)data[i] << 8;
-    for (int b = 0; b < 8; ++b) {
-      if (crc & 0x8000)
-        crc = (crc << 1) ^ 0x1021;
-      else
-        crc <<= 1;
-    }
-  }
-  return crc;
-}
-
-// ====================== Helpers ======================
-static inline void le_write16(uint8_t *p, uint16_t v) {
-  p[0] = (uint8_t)(v & 0xFF);
-  p[1] = (uint8_t)((v >> 8) & 0xFF);
-}
-static inline void le_write32(uint8_t *p, uint32_t v) {
-  p[0] = (uint8_t)(v & 0xFF);
-  p[1] = (uint8_t)((v >> 8) & 0xFF);
-  p[2] = (uint8_t)((v >> 16) & 0xFF);
-  p[3] = (uint8_t)((v >> 24) & 0xFF);
-}
+// a sound level meter measures the hum like any other sound
+#define HUM_CANCEL (HUM_MAINS_HZ && !SLM_MODE)
+#if HUM_CANCEL
+static mic_hum hum;
+#endif
+#if SLM_MODE
+static mic_slm slm;
+static_assert(MIC_LEVELS_MAX_LEN <= MAX_PKT_BYTES, "band levels don't fit tx_buf");
+#endif
 
 // ====================== Queue definitions ======================
+// A packet, or with data NULL a clock sync reply still to be framed
 struct tx_packet_t {
   uint8_t *data;
   size_t length;
+  uint32_t sync_id;
+  uint32_t sync_arrived; // esp_timer when the request came in
 };
 static QueueHandle_t tx_queue;
 
+// ====================== Clock sync ======================
+// Requests from the host (mic_frame.h) are stamped as the USB stack hands
+// them over; the reply goes to the front of the TX queue and is stamped again
+// just before it's written, so the host sees how long the board held it.
+#if ARDUINO_USB_MODE
+#define SERIAL_RX_EVENT ARDUINO_HW_CDC_RX_EVENT
+#else
+#define SERIAL_RX_EVENT ARDUINO_USB_CDC_RX_EVENT
+#endif
+
+static mic_sync_rx sync_rx;
+
+static void on_serial_rx(void *arg, esp_event_base_t base, int32_t event_id, void *event_data) {
+  const uint32_t arrived = (uint32_t)esp_timer_get_time();
+  uint8_t rx_buf[64];
+  size_t n;
+  while ((n = Serial.read(rx_buf, sizeof(rx_buf))) > 0) {
+    for (size_t i = 0; i < n; ++i) {
+      uint32_t id;
+      if (sync_rx_byte(&sync_rx, rx_buf[i], &id)) {
+        tx_packet_t reply = {NULL, 0, id, arrived};
+        xQueueSendToFront(tx_queue, &reply, 0);
+      }
+    }
+  }
+}
+
+// A copy of the packet in tx_buf onto the TX queue; dropped if there's no memory
+static void send_packet(size_t total_len) {
+  tx_packet_t pkt = {};
+  pkt.data = (uint8_t *)malloc(total_len);
+  if (!pkt.data) {
+    return;
+  }
+  memcpy(pkt.data, tx_buf, total_len);
+  pkt.length = total_len;
+  xQueueSend(tx_queue, &pkt, portMAX_DELAY);
+}
+
 static void i2s_reader_task(void *arg) {
   // I2S driver (always on to maintain timing cadence even in test modes)
   i2s_driver_install(I2S_NUM_0, &i2s_config, 0, NULL);
@@ -136,6 +139,13 @@ static void i2s_reader_task(void *arg) {
   i2s_set_clk(I2S_NUM_0, I2C_SAMPLE_RATE, I2S_BITS_PER_SAMPLE_16BIT,
               I2S_CHANNEL_MONO);
 
+#if HUM_CANCEL
+  hum_init(&hum, I2C_SAMPLE_RATE, HUM_MAINS_HZ, HUM_HARMONICS);
+#endif
+#if SLM_MODE
+  slm_init(&slm, I2C_SAMPLE_RATE, (uint32_t)I2C_SAMPLE_RATE * SLM_INTERVAL_MS / 1000);
+#endif
+
   static uint32_t seq = 0;
   int32_t running_average_volume = 0;
   while (true) {
@@ -151,12 +161,15 @@ static void i2s_reader_task(void *arg) {
     int samples_read = (int)(bytes_read / sizeof(int16_t));
 
     // DC block in place
-    dc_block_and_copy(sample_buf, samples_read);
+    dc_block_and_copy(&dc_est, sample_buf, samples_read);
+#if HUM_CANCEL
+    // mains hum and its harmonics, following the grid's frequency
+    hum_cancel(&hum, sample_buf, samples_read, 1);
+#endif
 
     // Frame into a single packet and enqueue for TX
     const uint32_t now_usecs = (uint32_t)esp_timer_get_time();
     const int this_samples = samples_read;
-    const uint16_t payload_len = (uint16_t)(this_samples * 2);
 
 
     // get the average volume of the audio
@@ -171,37 +184,19 @@ static void i2s_reader_task(void *arg) {
     // set the RED LED to the average volume
     ledcWrite(0, 255 - min(255, 1 * average_volume/running_average_volume));
 
-    uint8_t *p = tx_buf;
-    *p++ = PKT_SYNC; // sync
-    le_write16(p, payload_len); p += 2; // length
-    le_write32(p, seq++);        p += 4; // seq
-    le_write32(p, now_usecs);    p += 4; // timestamp
-
-    // payload (PCM16 little-endian)
-    for (int i = 0; i < this_samples; ++i) {
-      const int16_t s = sample_buf[i];
-      *p++ = (uint8_t)(s & 0xFF);
-      *p++ = (uint8_t)((s >> 8) & 0xFF);
-    }
-
-    // CRC over header + payload
-    #if USE_CRC
-    const uint16_t crc = crc16_ccitt(tx_buf, PKT_HEADER_LEN + payload_len);
-    #else
-    const uint16_t crc = 0;
-    #endif
-    le_write16(p, crc); p += 2;
-
-    const size_t total_len = (size_t)(PKT_HEADER_LEN + payload_len + PKT_TRAILER_LEN);
-    tx_packet_t pkt;
-    pkt.data = (uint8_t *)malloc(total_len);
-    if (!pkt.data) {
-      // allocation failed, drop this packet
-      continue;
+#if SLM_MODE
+    // a packet of levels each time an interval fills, stamped with its end
+    for (int done = 0; done < this_samples;) {
+      done += slm_process(&slm, sample_buf + done, this_samples - done);
+      if (slm_ready(&slm)) {
+        const uint32_t end_usecs =
+            now_usecs - (uint32_t)((int64_t)(this_samples - done) * 1000000 / I2C_SAMPLE_RATE);
+        send_packet(slm_frame_levels(tx_buf, &slm, seq++, end_usecs, USE_CRC));
+      }
     }
-    memcpy(pkt.data, tx_buf, total_len);
-    pkt.length = total_len;
-    xQueueSend(tx_queue, &pkt, portMAX_DELAY);
+#else
+    send_packet(frame_packet(tx_buf, seq++, now_usecs, sample_buf, this_samples, USE_CRC));
+#endif
   }
 }
 
@@ -229,6 +224,9 @@ void setup() {
   // create TX queue
   tx_queue = xQueueCreate(16, sizeof(tx_packet_t));
 
+  // clock sync requests from the host
+  Serial.onEvent(SERIAL_RX_EVENT, on_serial_rx);
+
   // kick off a task pinned to core 0 for the i2s reader
   xTaskCreatePinnedToCore(i2s_reader_task, "i2s_reader", 8192, NULL, 1, NULL,
                           0);
@@ -239,6 +237,12 @@ void loop() {
   // Drain TX queue and write to Serial
   tx_packet_t pkt;
   if (xQueueReceive(tx_queue, &pkt, portMAX_DELAY) == pdPASS) {
+    if (!pkt.data) {
+      uint8_t reply[MIC_SYNC_REPLY_LEN];
+      const uint32_t sent = (uint32_t)esp_timer_get_time();
+      Serial.write(reply, frame_sync_reply(reply, pkt.sync_id, pkt.sync_arrived, sent));
+      return;
+    }
     Serial.write(pkt.data, pkt.length);
     free(pkt.data);
   }
@@ -0,0 +1,381 @@
+// Two mic beamformer simulation
+//
+// Renders sound fields at the two mics with exact fractional delays (built in
+// the frequency domain) and runs them through beamformer_process() in 10ms
+// blocks, like the mic callback:
+//
+//   - the beam pattern: octave band noise from each direction against the
+//     same noise from the look direction, for delay and sum and for MVDR
+//     after it has adapted to an interferer
+//   - the directivity gain per octave: how much the beam improves the ratio
+//     of a source in the look direction to diffuse (all round) noise over
+//     one mic
+//   - a target with an interferer and mic self-noise: SIR gain, the target's
+//     level change and the self-noise gain
+// then times both modes per 10ms interval.
+//
+// MVDR adapts to what it hears, so its numbers come from a copy that has
+// adapted to the mixture and is then frozen and fed each part on its own.
+//
+//   beam_sim [--spacing-mm N] [--steer DEG] [--interferer DEG]
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "beamformer.h"
+
+#define SAMPLE_RATE 48000
+#define BLOCK 480            // 10ms UAC interval
+#define N (1 << 17)          // 2.7s of audio, a power of two for the FFT
+#define SKIP (SAMPLE_RATE)   // left out of the measurements while MVDR settles
+#define DIFFUSE_SOURCES 128
+#define LEVEL 0.05           // rms of each rendered field at mic 0, about -26dBFS
+#define SELF_NOISE_DB -70.0  // mic self-noise, dBFS rms
+#define ITERATIONS 2000
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+static const double bands[] = {250, 500, 1000, 2000, 4000, 8000};
+#define BAND_COUNT (int)(sizeof(bands) / sizeof(bands[0]))
+static const char *mode_names[] = {"delay+sum", "mvdr"};
+
+static double spacing_m = 0.02;
+static double steer_deg = 0;
+static double interferer_deg = 60;
+
+static double re[N], im[N];
+static double field[2][N];
+static int16_t mix[N * 2], part[N * 2], out[N];
+static beamformer_t bf, frozen;
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// In place radix 2 FFT
+static void fft(double *x_re, double *x_im, int n, bool inverse)
+{
+    for (int i = 1, j = 0; i < n; i++) {
+        int bit = n >> 1;
+        for (; j & bit; bit >>= 1) {
+            j ^= bit;
+        }
+        j |= bit;
+        if (i < j) {
+            double t = x_re[i];
+            x_re[i] = x_re[j];
+            x_re[j] = t;
+            t = x_im[i];
+            x_im[i] = x_im[j];
+            x_im[j] = t;
+        }
+    }
+    for (int len = 2; len <= n; len <<= 1) {
+        double a = (inverse ? 2 : -2) * M_PI / len;
+        double step_re = cos(a), step_im = sin(a);
+        for (int i = 0; i < n; i += len) {
+            double wr = 1, wi = 0;
+            for (int k = 0; k < len / 2; k++) {
+                double xr = x_re[i + k + len / 2] * wr - x_im[i + k + len / 2] * wi;
+                double xi = x_re[i + k + len / 2] * wi + x_im[i + k + len / 2] * wr;
+                x_re[i + k + len / 2] = x_re[i + k] - xr;
+                x_im[i + k + len / 2] = x_im[i + k] - xi;
+                x_re[i + k] += xr;
+                x_im[i + k] += xi;
+                double t = wr * step_re - wi * step_im;
+                wi = wr * step_im + wi * step_re;
+                wr = t;
+            }
+        }
+    }
+}
+
+static uint32_t rng = 1;
+
+static double gaussian(void)
+{
+    rng = rng * 1664525 + 1013904223;
+    double u1 = (rng >> 8) * (1.0 / 16777216.0) + 1e-12;
+    rng = rng * 1664525 + 1013904223;
+    double u2 = (rng >> 8) * (1.0 / 16777216.0);
+    return sqrt(-2 * log(u1)) * cos(2 * M_PI * u2);
+}
+
+// Uncorrelated noise sources between lo and hi Hz, each with its direction
+// given as the cosine of its angle to the array axis (sin of the angle from
+// broadside). Replaces `field` with what the two mics hear, scaled to LEVEL
+// rms at mic 0.
+static void render(const double *axis_cos, int count, double lo, double hi)
+{
+    static double spec[2][N / 2 + 1][2];
+    memset(spec, 0, sizeof(spec));
+    int k_lo = (int)ceil(lo * N / SAMPLE_RATE), k_hi = (int)floor(hi * N / SAMPLE_RATE);
+    if (k_hi > N / 2 - 1) {
+        k_hi = N / 2 - 1;
+    }
+    for (int s = 0; s < count; s++) {
+        // arrival at each mic relative to the middle, as in beamformer.c
+        double half = 0.5 * spacing_m * axis_cos[s] / BEAM_SPEED_OF_SOUND * SAMPLE_RATE;
+        double arrival[2] = {half, -half};
+        for (int k = k_lo; k <= k_hi; k++) {
+            double g_re = gaussian(), g_im = gaussian();
+            double w = 2 * M_PI * k / N;
+            for (int m = 0; m < 2; m++) {
+                double c = cos(w * arrival[m]), sn = -sin(w * arrival[m]);
+                spec[m][k][0] += g_re * c - g_im * sn;
+                spec[m][k][1] += g_re * sn + g_im * c;
+            }
+        }
+    }
+    double scale = 0;
+    for (int m = 0; m < 2; m++) {
+        memset(re, 0, sizeof(re));
+        memset(im, 0, sizeof(im));
+        for (int k = k_lo; k <= k_hi; k++) {
+            re[k] = spec[m][k][0];
+            im[k] = spec[m][k][1];
+            re[N - k] = spec[m][k][0];
+            im[N - k] = -spec[m][k][1];
+        }
+        fft(re, im, N, true);
+        if (m == 0) {
+            double power = 0;
+            for (int i = 0; i < N; i++) {
+                power += re[i] * re[i];
+            }
+            scale = LEVEL / sqrt(power / N + 1e-30);
+        }
+        for (int i = 0; i < N; i++) {
+            field[m][i] = re[i] * scale;
+        }
+    }
+}
+
+static void point_source(double deg, double lo, double hi)
+{
+    double axis_cos = sin(deg * M_PI / 180);
+    render(&axis_cos, 1, lo, hi);
+}
+
+// All round noise: directions spread evenly over a sphere, which makes the
+// cosine to the axis uniform between -1 and 1
+static void diffuse(double lo, double hi)
+{
+    double axis_cos[DIFFUSE_SOURCES];
+    for (int s = 0; s < DIFFUSE_SOURCES; s++) {
+        axis_cos[s] = -1 + (2.0 * s + 1) / DIFFUSE_SOURCES;
+    }
+    render(axis_cos, DIFFUSE_SOURCES, lo, hi);
+}
+
+// Adds `gain` times the rendered field into an interleaved int16 block
+static void add_field(int16_t *dst, double gain)
+{
+    for (int i = 0; i < N; i++) {
+        for (int m = 0; m < 2; m++) {
+            double v = dst[i * 2 + m] + field[m][i] * gain * 32768.0;
+            dst[i * 2 + m] = (int16_t)lrint(v > 32767 ? 32767 : v < -32768 ? -32768 : v);
+        }
+    }
+}
+
+static void self_noise(int16_t *dst)
+{
+    double rms = pow(10, SELF_NOISE_DB / 20) * 32768.0;
+    for (int i = 0; i < N * 2; i++) {
+        double v = dst[i] + gaussian() * rms;
+        dst[i] = (int16_t)lrint(v > 32767 ? 32767 : v < -32768 ? -32768 : v);
+    }
+}
+
+static void run(beamformer_t *b, const int16_t *in)
+{
+    for (int i = 0; i < N; i += BLOCK) {
+        int n = i + BLOCK <= N ? BLOCK : N - i;
+        beamformer_process(b, in + i * 2, out + i, n);
+    }
+}
+
+static double out_power(void)
+{
+    double power = 0;
+    for (int i = SKIP; i < N; i++) {
+        power += (double)out[i] * out[i];
+    }
+    return power / (N - SKIP);
+}
+
+static double mic_power(const int16_t *in)
+{
+    double power = 0;
+    for (int i = SKIP; i < N; i++) {
+        power += (double)in[i * 2] * in[i * 2];
+    }
+    return power / (N - SKIP);
+}
+
+// The adapted beamformer, frozen, on one part of the sound field
+static double frozen_power(const int16_t *in)
+{
+    frozen = bf;
+    frozen.adapt = false;
+    run(&frozen, in);
+    return out_power();
+}
+
+static double db(double ratio)
+{
+    return 10 * log10(ratio + 1e-30);
+}
+
+static void beam_pattern(beam_mode_t mode)
+{
+    static const double angles[] = {-90, -60, -45, -30, -15, 0, 15, 30, 45, 60, 90};
+    const int count = sizeof(angles) / sizeof(angles[0]);
+    if (mode == BEAM_MVDR) {
+        printf("%s, adapted to a source at %+.0f deg and one at %+.0f deg (dB vs the look direction):\n",
+               mode_names[mode], steer_deg, interferer_deg);
+    } else {
+        printf("%s (dB vs the look direction):\n", mode_names[mode]);
+    }
+    printf("  %6s", "Hz");
+    for (int a = 0; a < count; a++) {
+        printf(" %6.0f", angles[a]);
+    }
+    printf("\n");
+    for (int b = 0; b < BAND_COUNT; b++) {
+        double lo = bands[b] / M_SQRT2, hi = bands[b] * M_SQRT2;
+        beamformer_init(&bf, mode, SAMPLE_RATE, spacing_m * 1000, steer_deg);
+        if (mode == BEAM_MVDR) {
+            memset(mix, 0, sizeof(mix));
+            point_source(steer_deg, lo, hi);
+            add_field(mix, 1);
+            point_source(interferer_deg, lo, hi);
+            add_field(mix, 1);
+            self_noise(mix);
+            run(&bf, mix);
+        }
+        memset(part, 0, sizeof(part));
+        point_source(steer_deg, lo, hi);
+        add_field(part, 1);
+        double look = frozen_power(part);
+        printf("  %6.0f", bands[b]);
+        for (int a = 0; a < count; a++) {
+            memset(part, 0, sizeof(part));
+            point_source(angles[a], lo, hi);
+            add_field(part, 1);
+            printf(" %6.1f", db(frozen_power(part) / look));
+        }
+        printf("\n");
+    }
+}
+
+static void directivity(void)
+{
+    printf("directivity gain against diffuse noise, dB (look direction vs all round, beam vs mic 0):\n");
+    printf("  %6s %10s %10s\n", "Hz", mode_names[0], mode_names[1]);
+    for (int b = 0; b < BAND_COUNT; b++) {
+        double lo = bands[b] / M_SQRT2, hi = bands[b] * M_SQRT2;
+        static int16_t target[N * 2], noise[N * 2];
+        memset(target, 0, sizeof(target));
+        memset(noise, 0, sizeof(noise));
+        point_source(steer_deg, lo, hi);
+        add_field(target, 1);
+        diffuse(lo, hi);
+        add_field(noise, 1);
+        for (int i = 0; i < N * 2; i++) {
+            int v = target[i] + noise[i];
+            mix[i] = (int16_t)(v > 32767 ? 32767 : v < -32768 ? -32768 : v);
+        }
+        printf("  %6.0f", bands[b]);
+        for (int mode = 0; mode < 2; mode++) {
+            beamformer_init(&bf, (beam_mode_t)mode, SAMPLE_RATE, spacing_m * 1000, steer_deg);
+            run(&bf, mix);
+            double t = frozen_power(target) / mic_power(target);
+            double n = frozen_power(noise) / mic_power(noise);
+            printf(" %10.2f", db(t / n));
+        }
+        printf("\n");
+    }
+}
+
+static void interference(void)
+{
+    // speech band target and interferer at the same level, plus self-noise
+    static int16_t target[N * 2], interferer[N * 2], hiss[N * 2];
+    memset(target, 0, sizeof(target));
+    memset(interferer, 0, sizeof(interferer));
+    memset(hiss, 0, sizeof(hiss));
+    point_source(steer_deg, 200, 6000);
+    add_field(target, 1);
+    point_source(interferer_deg, 200, 6000);
+    add_field(interferer, 1);
+    self_noise(hiss);
+    for (int i = 0; i < N * 2; i++) {
+        int v = target[i] + interferer[i] + hiss[i];
+        mix[i] = (int16_t)(v > 32767 ? 32767 : v < -32768 ? -32768 : v);
+    }
+    printf("target at %+.0f deg, interferer at %+.0f deg, 200-6000Hz, %.0fdBFS self-noise:\n", steer_deg,
+           interferer_deg, SELF_NOISE_DB);
+    printf("  %-10s %8s %8s %10s\n", "", "SIR gain", "target", "self-noise");
+    for (int mode = 0; mode < 2; mode++) {
+        beamformer_init(&bf, (beam_mode_t)mode, SAMPLE_RATE, spacing_m * 1000, steer_deg);
+        run(&bf, mix);
+        double t = frozen_power(target) / mic_power(target);
+        double i = frozen_power(interferer) / mic_power(interferer);
+        double h = frozen_power(hiss) / mic_power(hiss);
+        printf("  %-10s %8.1f %8.1f %10.1f\n", mode_names[mode], db(t / i), db(t), db(h));
+    }
+}
+
+static void cost(void)
+{
+    printf("cost per %d frame (10ms) interval:\n", BLOCK);
+    for (int mode = 0; mode < 2; mode++) {
+        beamformer_init(&bf, (beam_mode_t)mode, SAMPLE_RATE, spacing_m * 1000, steer_deg);
+        run(&bf, mix);
+        double start = now_sec();
+        for (int it = 0; it < ITERATIONS; it++) {
+            beamformer_process(&bf, mix + (it % (N / BLOCK)) * BLOCK * 2, out, BLOCK);
+            __asm__ volatile("" ::: "memory");
+        }
+        double us = (now_sec() - start) / ITERATIONS * 1e6;
+        printf("  %-10s %8.2f us  %5.2f%% of the interval, %zu bytes of state, %s latency\n", mode_names[mode], us,
+               us / 100, sizeof(beamformer_t), mode == BEAM_MVDR ? "5.3ms" : "0.2ms");
+    }
+}
+
+int main(int argc, char **argv)
+{
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (!strcmp(argv[i], "--spacing-mm")) {
+            spacing_m = atof(argv[i + 1]) / 1000;
+        } else if (!strcmp(argv[i], "--steer")) {
+            steer_deg = atof(argv[i + 1]);
+        } else if (!strcmp(argv[i], "--interferer")) {
+            interferer_deg = atof(argv[i + 1]);
+        } else {
+            fprintf(stderr, "usage: beam_sim [--spacing-mm N] [--steer DEG] [--interferer DEG]\n");
+            return 1;
+        }
+    }
+    if (!beamformer_init(&bf, BEAM_DELAY_SUM, SAMPLE_RATE, spacing_m * 1000, steer_deg)) {
+        fprintf(stderr, "%.0fmm is too far apart for %d samples of delay\n", spacing_m * 1000, BEAM_MAX_DELAY);
+        return 1;
+    }
+    printf("two mics %.0fmm apart at %d Hz, looking %+.0f deg from broadside\n", spacing_m * 1000, SAMPLE_RATE,
+           steer_deg);
+    beam_pattern(BEAM_DELAY_SUM);
+    beam_pattern(BEAM_MVDR);
+    directivity();
+    interference();
+    cost();
+    return 0;
+}
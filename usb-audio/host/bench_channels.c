@@ -0,0 +1,172 @@
+// Channel kernel benchmark
+//
+// Times the stereo deinterleave, interleave and downmix kernels against the
+// obvious scalar loops (and the generic N channel versions) and checks they
+// all agree.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "channels.h"
+
+#define FRAMES 480 // one 10ms UAC interval at 48kHz
+#define ITERATIONS 200000
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void fill_random(int16_t *buf, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        buf[i] = (int16_t)(rand() & 0xFFFF);
+    }
+}
+
+// references - written the obvious way and kept scalar
+
+static void __attribute__((noinline, optimize("no-tree-vectorize")))
+deinterleave_reference(const int16_t *in, int16_t *left, int16_t *right, size_t frames)
+{
+    for (size_t i = 0; i < frames; i++) {
+        left[i] = in[2 * i];
+        right[i] = in[2 * i + 1];
+    }
+}
+
+static void __attribute__((noinline, optimize("no-tree-vectorize")))
+interleave_reference(const int16_t *left, const int16_t *right, int16_t *out, size_t frames)
+{
+    for (size_t i = 0; i < frames; i++) {
+        out[2 * i] = left[i];
+        out[2 * i + 1] = right[i];
+    }
+}
+
+static void __attribute__((noinline, optimize("no-tree-vectorize")))
+downmix_reference(const int16_t *in, int16_t *out, size_t frames)
+{
+    for (size_t i = 0; i < frames; i++) {
+        out[i] = (int16_t)(((int32_t)in[2 * i] + in[2 * i + 1]) >> 1);
+    }
+}
+
+static int16_t stereo[2 * FRAMES];
+static int16_t left[FRAMES], right[FRAMES];
+static int16_t out_a[2 * FRAMES], out_b[2 * FRAMES];
+
+// Each case runs one kernel over a block; `which` picks the implementation
+typedef void (*case_fn)(int which);
+
+static void run_deinterleave(int which)
+{
+    int16_t *planes[2] = {left, right};
+    if (which == 0) {
+        deinterleave2_s16(stereo, left, right, FRAMES);
+    } else if (which == 1) {
+        deinterleave_n_s16(stereo, planes, FRAMES, 2);
+    } else {
+        deinterleave_reference(stereo, left, right, FRAMES);
+    }
+}
+
+static void run_interleave(int which)
+{
+    const int16_t *planes[2] = {left, right};
+    if (which == 0) {
+        interleave2_s16(left, right, out_a, FRAMES);
+    } else if (which == 1) {
+        interleave_n_s16(planes, out_a, FRAMES, 2);
+    } else {
+        interleave_reference(left, right, out_a, FRAMES);
+    }
+}
+
+static void run_downmix(int which)
+{
+    if (which == 0) {
+        downmix2_s16(stereo, out_a, FRAMES);
+    } else if (which == 1) {
+        downmix_n_s16(stereo, out_a, FRAMES, 2);
+    } else {
+        downmix_reference(stereo, out_a, FRAMES);
+    }
+}
+
+static void run_downmix_in_place(int which)
+{
+    // what the speaker task does - the block is folded down where it is
+    memcpy(out_b, stereo, sizeof(stereo));
+    if (which == 0) {
+        downmix2_s16(out_b, out_b, FRAMES);
+    } else if (which == 1) {
+        downmix_n_s16(out_b, out_b, FRAMES, 2);
+    } else {
+        downmix_reference(out_b, out_b, FRAMES);
+    }
+}
+
+static double time_case(case_fn fn, int which)
+{
+    double start = now_sec();
+    for (int i = 0; i < ITERATIONS; i++) {
+        fn(which);
+        __asm__ volatile("" ::: "memory");
+    }
+    return (now_sec() - start) / ((double)ITERATIONS * FRAMES) * 1e9;
+}
+
+static void bench(const char *name, case_fn fn)
+{
+    // warm up before timing anything
+    time_case(fn, 2);
+    double kernel = time_case(fn, 0);
+    double generic = time_case(fn, 1);
+    double scalar = time_case(fn, 2);
+    printf("  %-20s %6.3f ns/frame  generic %6.3f  scalar %6.3f  (%.2fx)\n", name, kernel, generic, scalar,
+           scalar / kernel);
+}
+
+static int check(void)
+{
+    int mismatches = 0;
+    int16_t ref_l[FRAMES], ref_r[FRAMES], ref[2 * FRAMES];
+
+    deinterleave_reference(stereo, ref_l, ref_r, FRAMES);
+    for (int which = 0; which < 2; which++) {
+        memset(left, 0, sizeof(left));
+        memset(right, 0, sizeof(right));
+        run_deinterleave(which);
+        mismatches += memcmp(left, ref_l, sizeof(left)) != 0;
+        mismatches += memcmp(right, ref_r, sizeof(right)) != 0;
+        memset(out_a, 0, sizeof(out_a));
+        run_interleave(which);
+        mismatches += memcmp(out_a, stereo, sizeof(stereo)) != 0;
+    }
+
+    downmix_reference(stereo, ref, FRAMES);
+    for (int which = 0; which < 2; which++) {
+        run_downmix(which);
+        mismatches += memcmp(out_a, ref, FRAMES * sizeof(int16_t)) != 0;
+        run_downmix_in_place(which);
+        mismatches += memcmp(out_b, ref, FRAMES * sizeof(int16_t)) != 0;
+    }
+    return mismatches;
+}
+
+int main(void)
+{
+    fill_random(stereo, 2 * FRAMES);
+    int mismatches = check();
+    printf("stereo kernels, %d frame blocks:\n", FRAMES);
+    bench("deinterleave", run_deinterleave);
+    bench("interleave", run_interleave);
+    bench("downmix", run_downmix);
+    bench("downmix in place", run_downmix_in_place);
+    printf("bit exact: %s\n", mismatches ? "NO" : "yes");
+    return mismatches ? 1 : 0;
+}
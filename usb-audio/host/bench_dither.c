@@ -0,0 +1,216 @@
+// Dither benchmark
+//
+// Attenuates a 1kHz tone by 60dB through the speaker volume stage and looks
+// at what the requantisation did to it, for plain rounding, TPDF dither and
+// dither with noise shaping:
+//   - the 2nd to 10th harmonics relative to the tone, next to the average
+//     bin of everything else - rounding error that follows the signal stands
+//     out above the floor, dithered error sits on it
+//   - the total error floor and the error below 4kHz, where the ear is most
+//     sensitive, both relative to full scale
+// then times the kernels per sample.
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "format.h"
+
+#define SAMPLE_RATE 48000
+#define N 65536          // analysis length, a power of two for the FFT
+#define TONE_BIN 1365    // 999.8Hz, on a bin so no window is needed
+#define INPUT_DBFS -6.0
+#define GAIN_DB -60.0
+#define FRAMES 480       // one 10ms UAC interval, for the timing
+#define ITERATIONS 20000
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// In place radix 2 FFT
+static void fft(double *re, double *im, int n)
+{
+    for (int i = 1, j = 0; i < n; i++) {
+        int bit = n >> 1;
+        for (; j & bit; bit >>= 1) {
+            j ^= bit;
+        }
+        j |= bit;
+        if (i < j) {
+            double t = re[i];
+            re[i] = re[j];
+            re[j] = t;
+            t = im[i];
+            im[i] = im[j];
+            im[j] = t;
+        }
+    }
+    for (int len = 2; len <= n; len <<= 1) {
+        double a = -2 * M_PI / len;
+        for (int i = 0; i < n; i += len) {
+            for (int k = 0; k < len / 2; k++) {
+                double wr = cos(a * k), wi = sin(a * k);
+                double xr = re[i + k + len / 2] * wr - im[i + k + len / 2] * wi;
+                double xi = re[i + k + len / 2] * wi + im[i + k + len / 2] * wr;
+                re[i + k + len / 2] = re[i + k] - xr;
+                im[i + k + len / 2] = im[i + k] - xi;
+                re[i + k] += xr;
+                im[i + k] += xi;
+            }
+        }
+    }
+}
+
+typedef enum { MODE_ROUND, MODE_TPDF, MODE_SHAPED, MODE_COUNT } mode_t_;
+static const char *mode_names[MODE_COUNT] = {"round", "tpdf", "tpdf+shaped"};
+
+typedef struct {
+    const char *name;
+    int in_bits;
+    int out_bits;
+} pairing_t;
+
+static const pairing_t pairings[] = {
+    {"s16 -> s16", 16, 16},
+    {"s32 -> s16", 32, 16},
+    {"s16 -> s24", 16, 24},
+    {"s32 -> s24", 32, 24},
+};
+
+static int16_t in16[N], out16[N];
+static int32_t in32[N], out32[N];
+static double re[N], im[N], ideal[N];
+
+// Runs `frames` mono frames of the pairing through the selected kernel
+static void convert(const pairing_t *p, mode_t_ mode, format_dither_t *d, size_t offset, size_t frames,
+                    uint32_t gain)
+{
+    const int16_t *i16 = in16 + offset;
+    const int32_t *i32 = in32 + offset;
+    int16_t *o16 = out16 + offset;
+    int32_t *o32 = out32 + offset;
+    if (mode == MODE_ROUND) {
+        if (p->in_bits == 16) {
+            p->out_bits == 16 ? format_gain_s16_s16(i16, o16, frames, gain) : format_gain_s16_s24(i16, o32, frames, gain);
+        } else {
+            p->out_bits == 16 ? format_gain_s32_s16(i32, o16, frames, gain) : format_gain_s32_s24(i32, o32, frames, gain);
+        }
+        return;
+    }
+    if (p->in_bits == 16) {
+        p->out_bits == 16 ? format_gain_dither_s16_s16(i16, o16, frames, 1, gain, d)
+                          : format_gain_dither_s16_s24(i16, o32, frames, 1, gain, d);
+    } else {
+        p->out_bits == 16 ? format_gain_dither_s32_s16(i32, o16, frames, 1, gain, d)
+                          : format_gain_dither_s32_s24(i32, o32, frames, 1, gain, d);
+    }
+}
+
+static double db(double power)
+{
+    return 10 * log10(power + 1e-30);
+}
+
+static void measure(const pairing_t *p, mode_t_ mode, uint32_t gain)
+{
+    format_dither_t d;
+    format_dither_init(&d, 1, mode == MODE_SHAPED);
+    // a block at a time, like the speaker task, so the state carries over
+    for (size_t i = 0; i < N; i += FRAMES) {
+        convert(p, mode, &d, i, i + FRAMES <= N ? FRAMES : N - i, gain);
+    }
+    // everything relative to output full scale
+    for (int i = 0; i < N; i++) {
+        double out = p->out_bits == 16 ? out16[i] / 32768.0 : out32[i] / 2147483648.0;
+        re[i] = out;
+        im[i] = 0;
+    }
+    fft(re, im, N);
+    double tone = 0, harmonics = 0, floor = 0;
+    // |X|^2 of a full scale sine is (N/2)^2, so this scales bins to dBFS
+    const double scale = 1.0 / ((double)N * N / 4);
+    for (int k = 1; k < N / 2; k++) {
+        double power = (re[k] * re[k] + im[k] * im[k]) * scale;
+        if (k == TONE_BIN) {
+            tone = power;
+        } else if (k % TONE_BIN == 0 && k <= 10 * TONE_BIN) {
+            harmonics += power / 9;
+        } else {
+            floor += power / (N / 2 - 11);
+        }
+    }
+
+    // the error against the exact attenuated tone, total and below 4kHz
+    for (int i = 0; i < N; i++) {
+        double out = p->out_bits == 16 ? out16[i] / 32768.0 : out32[i] / 2147483648.0;
+        re[i] = out - ideal[i];
+        im[i] = 0;
+    }
+    fft(re, im, N);
+    double total = 0, audible = 0;
+    for (int k = 1; k < N / 2; k++) {
+        double power = (re[k] * re[k] + im[k] * im[k]) * scale;
+        total += power;
+        if (k < 4000L * N / SAMPLE_RATE) {
+            audible += power;
+        }
+    }
+    printf("  %-12s %-12s %7.1f %9.1f %9.1f %9.1f %9.1f\n", p->name, mode_names[mode], db(tone), db(harmonics) - db(tone),
+           db(floor) - db(tone), db(total), db(audible));
+}
+
+static double time_mode(const pairing_t *p, mode_t_ mode, uint32_t gain)
+{
+    format_dither_t d;
+    format_dither_init(&d, 1, mode == MODE_SHAPED);
+    double start = now_sec();
+    for (int i = 0; i < ITERATIONS; i++) {
+        convert(p, mode, &d, 0, FRAMES, gain);
+        __asm__ volatile("" ::: "memory");
+    }
+    return (now_sec() - start) / ((double)ITERATIONS * FRAMES) * 1e9;
+}
+
+int main(void)
+{
+    const double amplitude = pow(10, INPUT_DBFS / 20);
+    const double gain = pow(10, GAIN_DB / 20);
+    const uint32_t gain_q16 = (uint32_t)lrint(gain * FORMAT_GAIN_UNITY);
+    for (int i = 0; i < N; i++) {
+        double x = amplitude * sin(2 * M_PI * TONE_BIN * i / N);
+        in16[i] = (int16_t)lrint(x * 32767);
+        in32[i] = (int32_t)lrint(x * 2147483647.0);
+    }
+    printf("%.0fdBFS %.0fHz tone through %.0fdB of volume:\n", INPUT_DBFS, (double)TONE_BIN * SAMPLE_RATE / N, GAIN_DB);
+    printf("  %-12s %-12s %7s %9s %9s %9s %9s\n", "usb -> i2s", "requantise", "tone", "harmonic", "bin", "error",
+           "<4kHz");
+    printf("  %-12s %-12s %7s %9s %9s %9s %9s\n", "", "", "dBFS", "dBc", "dBc", "dBFS", "dBFS");
+    for (size_t p = 0; p < sizeof(pairings) / sizeof(pairings[0]); p++) {
+        // the 16 bit input is itself quantised - measure from what it holds
+        // and the output is compared with what the kernels would produce at
+        // infinite resolution, using the Q16 gain they actually apply
+        for (int i = 0; i < N; i++) {
+            double x = pairings[p].in_bits == 16 ? in16[i] / 32768.0 : in32[i] / 2147483648.0;
+            ideal[i] = x * gain_q16 / FORMAT_GAIN_UNITY;
+        }
+        for (int m = 0; m < MODE_COUNT; m++) {
+            measure(&pairings[p], (mode_t_)m, gain_q16);
+        }
+    }
+
+    printf("cost, ns/sample:\n");
+    printf("  %-12s %8s %8s %12s\n", "usb -> i2s", "round", "tpdf", "tpdf+shaped");
+    for (size_t p = 0; p < sizeof(pairings) / sizeof(pairings[0]); p++) {
+        time_mode(&pairings[p], MODE_ROUND, gain_q16);
+        double cost[MODE_COUNT];
+        for (int m = 0; m < MODE_COUNT; m++) {
+            cost[m] = time_mode(&pairings[p], (mode_t_)m, gain_q16);
+        }
+        printf("  %-12s %8.3f %8.3f %12.3f\n", pairings[p].name, cost[0], cost[1], cost[2]);
+    }
+    return 0;
+}
@@ -0,0 +1,165 @@
+// Sample format benchmark
+//
+// Times the speaker path's per-block work - volume/format conversion, stereo
+// downmix, the PLC history update and the sidetone mix - for each pairing of
+// USB and I2S formats, so the cost of going to 24 or 32 bit can be compared
+// with plain 16 bit. Also checks the conversion kernels round trip at unity
+// gain and clip where they should.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "channels.h"
+#include "format.h"
+#include "plc.h"
+#include "sidetone.h"
+
+#define SAMPLE_RATE 48000
+#define FRAMES 480 // one 10ms UAC interval
+#define CHANNELS 2
+#define SAMPLES (FRAMES * CHANNELS)
+#define ITERATIONS 50000
+// -3dB, so the conversion takes the below unity path
+#define GAIN_Q16 46396
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int16_t usb16[SAMPLES];
+static int32_t usb32[SAMPLES];
+static int16_t spk16[SAMPLES];
+static int32_t spk32[SAMPLES];
+static int16_t mic[FRAMES];
+static plc_t plc[2];
+
+typedef struct {
+    const char *name;
+    int usb_bits;
+    int i2s_bits;
+} pairing_t;
+
+static const pairing_t pairings[] = {
+    {"s16 -> s16", 16, 16},
+    {"s16 -> s24", 16, 24},
+    {"s16 -> s32", 16, 32},
+    {"s24 -> s24", 24, 24},
+    {"s32 -> s32", 32, 32},
+    {"s32 -> s16", 32, 16},
+};
+
+static uint32_t convert(const pairing_t *p)
+{
+    if (p->usb_bits == 16) {
+        switch (p->i2s_bits) {
+        case 16: return format_gain_s16_s16(usb16, spk16, SAMPLES, GAIN_Q16);
+        case 24: return format_gain_s16_s24(usb16, spk32, SAMPLES, GAIN_Q16);
+        default: return format_gain_s16_s32(usb16, spk32, SAMPLES, GAIN_Q16);
+        }
+    }
+    switch (p->i2s_bits) {
+    case 16: return format_gain_s32_s16(usb32, spk16, SAMPLES, GAIN_Q16);
+    case 24: return format_gain_s32_s24(usb32, spk32, SAMPLES, GAIN_Q16);
+    default: return format_gain_s32_s32(usb32, spk32, SAMPLES, GAIN_Q16);
+    }
+}
+
+// Stage costs for one block, in microseconds
+typedef struct {
+    double convert, downmix, plc, sidetone;
+} costs_t;
+
+#define TIME_STAGE(field, stmt)                                 \
+    do {                                                        \
+        double start = now_sec();                               \
+        for (int i = 0; i < ITERATIONS; i++) {                  \
+            stmt;                                               \
+            __asm__ volatile("" ::: "memory");                  \
+        }                                                       \
+        c.field = (now_sec() - start) / ITERATIONS * 1e6;       \
+    } while (0)
+
+static costs_t bench(const pairing_t *p)
+{
+    costs_t c;
+    int16_t *planes16[2] = {spk16, spk16 + FRAMES};
+    int32_t *planes32[2] = {spk32, spk32 + FRAMES};
+    TIME_STAGE(convert, convert(p));
+    if (p->i2s_bits == 16) {
+        TIME_STAGE(downmix, downmix2_s16(spk16, spk16, FRAMES));
+        TIME_STAGE(plc, plc_good_frame(&plc[0], planes16[0], FRAMES); plc_good_frame(&plc[1], planes16[1], FRAMES));
+        TIME_STAGE(sidetone, sidetone_mix2_s16(spk16, mic, FRAMES, 3277));
+    } else {
+        TIME_STAGE(downmix, downmix2_s32(spk32, spk32, FRAMES));
+        TIME_STAGE(plc, plc_good_frame_s32(&plc[0], planes32[0], FRAMES);
+                   plc_good_frame_s32(&plc[1], planes32[1], FRAMES));
+        TIME_STAGE(sidetone, sidetone_mix2_s32(spk32, mic, FRAMES, 3277));
+    }
+    return c;
+}
+
+// Unity gain has to be lossless whenever the output is at least as wide as
+// the input, and a +12dB gain has to saturate rather than wrap
+static int check(void)
+{
+    int failures = 0;
+    static int16_t a16[SAMPLES];
+    static int32_t a32[SAMPLES];
+
+    format_gain_s16_s16(usb16, a16, SAMPLES, FORMAT_GAIN_UNITY);
+    failures += memcmp(a16, usb16, sizeof(a16)) != 0;
+    format_gain_s16_s32(usb16, a32, SAMPLES, FORMAT_GAIN_UNITY);
+    for (int i = 0; i < SAMPLES; i++) {
+        failures += a32[i] != (int32_t)usb16[i] * 65536;
+    }
+    format_gain_s16_s24(usb16, a32, SAMPLES, FORMAT_GAIN_UNITY);
+    for (int i = 0; i < SAMPLES; i++) {
+        failures += a32[i] != (int32_t)usb16[i] * 65536;
+    }
+    format_gain_s32_s32(usb32, a32, SAMPLES, FORMAT_GAIN_UNITY);
+    failures += memcmp(a32, usb32, sizeof(a32)) != 0;
+    format_gain_s32_s24(usb32, a32, SAMPLES, FORMAT_GAIN_UNITY);
+    for (int i = 0; i < SAMPLES; i++) {
+        failures += (a32[i] & 0xFF) != 0;
+    }
+
+    const int16_t loud16[2] = {32767, -32768};
+    const int32_t loud32[2] = {INT32_MAX, INT32_MIN};
+    int16_t o16[2];
+    int32_t o32[2];
+    failures += format_gain_s16_s16(loud16, o16, 2, 4 * FORMAT_GAIN_UNITY) != 2;
+    failures += o16[0] != 32767 || o16[1] != -32768;
+    failures += format_gain_s32_s32(loud32, o32, 2, 4 * FORMAT_GAIN_UNITY) != 2;
+    failures += o32[0] != INT32_MAX || o32[1] != INT32_MIN;
+    failures += format_gain_s32_s24(loud32, o32, 2, 4 * FORMAT_GAIN_UNITY) != 2;
+    failures += o32[0] != 0x7FFFFF00 || o32[1] != INT32_MIN;
+    return failures;
+}
+
+int main(void)
+{
+    for (int i = 0; i < SAMPLES; i++) {
+        usb16[i] = (int16_t)(rand() & 0xFFFF);
+        usb32[i] = (int32_t)((uint32_t)rand() << 16 ^ (uint32_t)rand()) & ~0xFF;
+    }
+    for (int i = 0; i < FRAMES; i++) {
+        mic[i] = (int16_t)(rand() & 0xFFFF);
+    }
+    plc_init(&plc[0], SAMPLE_RATE);
+    plc_init(&plc[1], SAMPLE_RATE);
+
+    int failures = check();
+    printf("speaker path per 10ms stereo block (%d frames), us:\n", FRAMES);
+    printf("  %-12s %8s %8s %8s %8s %8s\n", "usb -> i2s", "convert", "downmix", "plc", "sidetone", "total");
+    for (size_t i = 0; i < sizeof(pairings) / sizeof(pairings[0]); i++) {
+        costs_t c = bench(&pairings[i]);
+        printf("  %-12s %8.3f %8.3f %8.3f %8.3f %8.3f\n", pairings[i].name, c.convert, c.downmix, c.plc, c.sidetone,
+               c.convert + c.downmix + c.plc + c.sidetone);
+    }
+    printf("conversions exact and saturating: %s\n", failures ? "NO" : "yes");
+    return failures ? 1 : 0;
+}
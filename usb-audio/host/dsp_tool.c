@@ -0,0 +1,460 @@
+// Builds, checks and benchmarks speaker DSP chain descriptors (main/dsp_chain.h)
+// before they go anywhere near a device.
+//
+//   dsp_tool build OUT.bin STAGE...
+//   dsp_tool validate IN.bin [--channels N] [--rate HZ] [--arena BYTES]
+//   dsp_tool bench IN.bin [--channels N] [--rate HZ]
+//
+// Stages are written type:param:param... with an optional @MASK of channels
+// (bit 0 left, bit 1 right, leave it off for all of them):
+//
+//   gain:DB                      gain:-6
+//   eq:SHAPE:HZ:Q:DB             eq:peak:1000:1.4:-4  eq:highpass:80:0.7:0@1
+//                                (peak lowshelf highshelf lowpass highpass)
+//   limiter:THRESHOLD_DB:ATTACK_MS:RELEASE_MS   limiter:-1:0.5:80
+//   crossover:HZ                 crossover:2200
+//   delay:SAMPLES                delay:48@2
+//
+// validate builds the chain the way the firmware would (stereo, 48kHz and the
+// default CONFIG_APP_DSP_ARENA_BYTES unless told otherwise), lists the stages
+// and what state they take, and measures the frequency response. bench times
+// the chain on 10ms blocks.
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "dsp_chain.h"
+
+#define DEFAULT_CHANNELS 2
+#define DEFAULT_RATE 48000
+#define DEFAULT_ARENA 16384
+#define MAX_ARENA (1 << 20)
+// frequency response from an impulse this long, in blocks of BLOCK_MS
+#define RESPONSE_FRAMES 65536
+#define BLOCK_MS 10
+#define ITERATIONS 2000
+
+static uint8_t arena[MAX_ARENA] __attribute__((aligned(8)));
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: dsp_tool build OUT.bin STAGE...\n"
+                    "       dsp_tool validate IN.bin [--channels N] [--rate HZ] [--arena BYTES]\n"
+                    "       dsp_tool bench IN.bin [--channels N] [--rate HZ]\n"
+                    "stages: gain:DB  eq:SHAPE:HZ:Q:DB  limiter:DB:ATTACK_MS:RELEASE_MS  crossover:HZ  delay:SAMPLES\n"
+                    "        each with an optional @MASK of channels (1 left, 2 right)\n");
+    exit(1);
+}
+
+// ====================== Writing descriptors ======================
+typedef struct {
+    uint8_t data[DSP_CHAIN_MAX_DESCRIPTOR];
+    size_t len;
+    int stages;
+} writer_t;
+
+static void put8(writer_t *w, uint8_t v)
+{
+    if (w->len >= sizeof(w->data)) {
+        fprintf(stderr, "descriptor is over %d bytes\n", DSP_CHAIN_MAX_DESCRIPTOR);
+        exit(1);
+    }
+    w->data[w->len++] = v;
+}
+
+static void put16(writer_t *w, uint16_t v)
+{
+    put8(w, v & 0xFF);
+    put8(w, v >> 8);
+}
+
+static void put32(writer_t *w, uint32_t v)
+{
+    put16(w, v & 0xFFFF);
+    put16(w, v >> 16);
+}
+
+static void put_f32(writer_t *w, float f)
+{
+    uint32_t bits;
+    memcpy(&bits, &f, sizeof(bits));
+    put32(w, bits);
+}
+
+static int shape_from_name(const char *name)
+{
+    for (int shape = DSP_EQ_PEAK; shape <= DSP_EQ_HIGH_PASS; shape++) {
+        if (!strcmp(name, dsp_eq_shape_name(shape))) {
+            return shape;
+        }
+    }
+    return -1;
+}
+
+// Parses one stage argument and appends it. Range checks are left to the
+// chain builder so there is only one set of rules.
+static bool add_stage(writer_t *w, const char *spec)
+{
+    char buf[128];
+    snprintf(buf, sizeof(buf), "%s", spec);
+    uint8_t mask = 0;
+    char *at = strchr(buf, '@');
+    if (at) {
+        *at = 0;
+        mask = (uint8_t)strtoul(at + 1, NULL, 0);
+    }
+    char *fields[6];
+    int n = 0;
+    for (char *tok = strtok(buf, ":"); tok && n < 6; tok = strtok(NULL, ":")) {
+        fields[n++] = tok;
+    }
+    if (n == 0) {
+        return false;
+    }
+
+    uint8_t type;
+    if (!strcmp(fields[0], "gain") && n == 2) {
+        type = DSP_STAGE_GAIN;
+    } else if (!strcmp(fields[0], "eq") && n == 5 && shape_from_name(fields[1]) >= 0) {
+        type = DSP_STAGE_EQ;
+    } else if (!strcmp(fields[0], "limiter") && n == 4) {
+        type = DSP_STAGE_LIMITER;
+    } else if (!strcmp(fields[0], "crossover") && n == 2) {
+        type = DSP_STAGE_CROSSOVER;
+    } else if (!strcmp(fields[0], "delay") && n == 2) {
+        type = DSP_STAGE_DELAY;
+    } else {
+        return false;
+    }
+
+    put8(w, type);
+    put8(w, mask);
+    size_t len_at = w->len;
+    put16(w, 0);
+    switch (type) {
+    case DSP_STAGE_EQ:
+        put8(w, (uint8_t)shape_from_name(fields[1]));
+        for (int i = 2; i < 5; i++) {
+            put_f32(w, strtof(fields[i], NULL));
+        }
+        break;
+    case DSP_STAGE_DELAY:
+        put32(w, (uint32_t)strtoul(fields[1], NULL, 0));
+        break;
+    default:
+        for (int i = 1; i < n; i++) {
+            put_f32(w, strtof(fields[i], NULL));
+        }
+        break;
+    }
+    uint16_t param_len = (uint16_t)(w->len - len_at - 2);
+    w->data[len_at] = param_len & 0xFF;
+    w->data[len_at + 1] = param_len >> 8;
+    w->stages++;
+    return true;
+}
+
+static int cmd_build(int argc, char **argv)
+{
+    if (argc < 1) {
+        usage();
+    }
+    static writer_t w;
+    memcpy(w.data, DSP_CHAIN_MAGIC, 4);
+    w.len = DSP_CHAIN_HEADER_LEN;
+    for (int i = 1; i < argc; i++) {
+        if (!add_stage(&w, argv[i])) {
+            fprintf(stderr, "can't parse stage \"%s\"\n", argv[i]);
+            return 1;
+        }
+    }
+    if (w.stages > DSP_CHAIN_MAX_STAGES) {
+        fprintf(stderr, "%d stages, the most is %d\n", w.stages, DSP_CHAIN_MAX_STAGES);
+        return 1;
+    }
+    w.data[4] = DSP_CHAIN_VERSION;
+    w.data[5] = (uint8_t)w.stages;
+    w.len += 2;
+    w.data[6] = w.len & 0xFF;
+    w.data[7] = w.len >> 8;
+    uint16_t crc = dsp_chain_crc16(w.data, w.len - 2);
+    w.data[w.len - 2] = crc & 0xFF;
+    w.data[w.len - 1] = crc >> 8;
+
+    FILE *f = fopen(argv[0], "wb");
+    if (!f || fwrite(w.data, 1, w.len, f) != w.len) {
+        fprintf(stderr, "can't write %s\n", argv[0]);
+        return 1;
+    }
+    fclose(f);
+    printf("wrote %s: %d stages, %zu bytes\n", argv[0], w.stages, w.len);
+    return 0;
+}
+
+// ====================== Reading descriptors ======================
+typedef struct {
+    uint8_t data[DSP_CHAIN_MAX_DESCRIPTOR];
+    size_t len;
+    int channels;
+    int rate;
+    size_t arena_len;
+} input_t;
+
+static void read_input(input_t *in, int argc, char **argv)
+{
+    if (argc < 1) {
+        usage();
+    }
+    in->channels = DEFAULT_CHANNELS;
+    in->rate = DEFAULT_RATE;
+    in->arena_len = DEFAULT_ARENA;
+    for (int i = 1; i < argc; i++) {
+        if (i + 1 >= argc) {
+            usage();
+        }
+        if (!strcmp(argv[i], "--channels")) {
+            in->channels = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--rate")) {
+            in->rate = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--arena")) {
+            in->arena_len = strtoul(argv[++i], NULL, 0);
+        } else {
+            usage();
+        }
+    }
+    if (in->arena_len > MAX_ARENA) {
+        in->arena_len = MAX_ARENA;
+    }
+    FILE *f = fopen(argv[0], "rb");
+    if (!f) {
+        fprintf(stderr, "can't open %s\n", argv[0]);
+        exit(1);
+    }
+    in->len = fread(in->data, 1, sizeof(in->data), f);
+    if (fgetc(f) != EOF) {
+        fprintf(stderr, "%s is over %d bytes\n", argv[0], DSP_CHAIN_MAX_DESCRIPTOR);
+        exit(1);
+    }
+    fclose(f);
+}
+
+static size_t block_frames(const input_t *in)
+{
+    return (size_t)in->rate * BLOCK_MS / 1000;
+}
+
+static bool build(dsp_chain_t *chain, const input_t *in)
+{
+    size_t offset;
+    dsp_chain_err_t err = dsp_chain_build(chain, in->data, in->len, in->channels, in->rate, block_frames(in), arena,
+                                          in->arena_len, &offset);
+    if (err != DSP_CHAIN_OK) {
+        printf("invalid: %s at byte %zu (%d channels, %d Hz, %zu byte arena)\n", dsp_chain_err_str(err), offset,
+               in->channels, in->rate, in->arena_len);
+        return false;
+    }
+    return true;
+}
+
+static float param_f32(const uint8_t *p)
+{
+    float f;
+    memcpy(&f, p, sizeof(f));
+    return f;
+}
+
+// Prints a built chain's stages with their parameters
+static void list_stages(const dsp_chain_t *chain, const input_t *in)
+{
+    size_t offset = DSP_CHAIN_HEADER_LEN;
+    for (size_t i = 0; i < chain->stage_count; i++) {
+        const uint8_t *s = in->data + offset;
+        const uint8_t *p = s + DSP_CHAIN_STAGE_HEADER_LEN;
+        char params[96];
+        switch (s[0]) {
+        case DSP_STAGE_GAIN:
+            snprintf(params, sizeof(params), "%+.1f dB", param_f32(p));
+            break;
+        case DSP_STAGE_EQ:
+            snprintf(params, sizeof(params), "%s %.0f Hz Q %.2f %+.1f dB", dsp_eq_shape_name(p[0]), param_f32(p + 1),
+                     param_f32(p + 5), param_f32(p + 9));
+            break;
+        case DSP_STAGE_LIMITER:
+            snprintf(params, sizeof(params), "threshold %.1f dB, attack %.2f ms, release %.0f ms", param_f32(p),
+                     param_f32(p + 4), param_f32(p + 8));
+            break;
+        case DSP_STAGE_CROSSOVER:
+            snprintf(params, sizeof(params), "LR4 at %.0f Hz, lows left, highs right", param_f32(p));
+            break;
+        case DSP_STAGE_DELAY: {
+            uint32_t samples = (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+            snprintf(params, sizeof(params), "%u samples (%.2f ms)", samples, samples * 1000.0 / in->rate);
+            break;
+        }
+        default:
+            params[0] = 0;
+            break;
+        }
+        char channels[8] = "all";
+        if (s[1]) {
+            snprintf(channels, sizeof(channels), "0x%x", s[1]);
+        }
+        printf("  %2zu %-10s %-4s %6zu B  %s\n", i, dsp_stage_name(s[0]), channels, chain->stages[i].state_bytes,
+               params);
+        offset += DSP_CHAIN_STAGE_HEADER_LEN + (s[2] | s[3] << 8);
+    }
+}
+
+static int cmd_validate(int argc, char **argv)
+{
+    static input_t in;
+    static dsp_chain_t chain;
+    read_input(&in, argc, argv);
+    if (!build(&chain, &in)) {
+        return 1;
+    }
+    printf("%s: %zu bytes, %zu stages, %d channels at %d Hz\n", argv[0], in.len, chain.stage_count, in.channels,
+           in.rate);
+    printf("  #  stage      mask   state  parameters\n");
+    list_stages(&chain, &in);
+    printf("  arena %zu of %zu bytes (planes %zu)\n", chain.arena_used, in.arena_len,
+           in.channels * block_frames(&in) * sizeof(float));
+
+    // impulse response, then a DFT at each frequency. Small enough to stay
+    // under any limiter threshold, big enough for the 32 bit path to carry
+    // it without noticeable rounding.
+    static float response[DSP_CHAIN_MAX_CHANNELS][RESPONSE_FRAMES];
+    const size_t frames = block_frames(&in);
+    int32_t *block = calloc(frames * in.channels, sizeof(int32_t));
+    const int32_t impulse = 1 << 19;
+    for (size_t start = 0; start < RESPONSE_FRAMES; start += frames) {
+        size_t n = start + frames <= RESPONSE_FRAMES ? frames : RESPONSE_FRAMES - start;
+        memset(block, 0, frames * in.channels * sizeof(int32_t));
+        if (start == 0) {
+            for (int c = 0; c < in.channels; c++) {
+                block[c] = impulse;
+            }
+        }
+        dsp_chain_process_s32(&chain, block, n);
+        for (size_t i = 0; i < n; i++) {
+            for (int c = 0; c < in.channels; c++) {
+                response[c][start + i] = (float)block[i * in.channels + c] / impulse;
+            }
+        }
+    }
+    printf("  response, dB:\n       Hz");
+    for (int c = 0; c < in.channels; c++) {
+        printf("   ch%d", c);
+    }
+    printf("\n");
+    for (double hz = 31.25; hz < in.rate / 2; hz *= 2) {
+        printf("  %7.0f", hz);
+        for (int c = 0; c < in.channels; c++) {
+            double re = 0, im = 0, w = 2 * M_PI * hz / in.rate;
+            for (int i = 0; i < RESPONSE_FRAMES; i++) {
+                re += response[c][i] * cos(w * i);
+                im -= response[c][i] * sin(w * i);
+            }
+            printf(" %5.1f", 10 * log10(re * re + im * im + 1e-20));
+        }
+        printf("\n");
+    }
+    free(block);
+    return 0;
+}
+
+// ====================== Benchmark ======================
+static int cmd_bench(int argc, char **argv)
+{
+    static input_t in;
+    static dsp_chain_t chain;
+    read_input(&in, argc, argv);
+    in.arena_len = MAX_ARENA;
+    if (!build(&chain, &in)) {
+        return 1;
+    }
+    const size_t frames = block_frames(&in);
+    const double interval_us = BLOCK_MS * 1000.0;
+    const size_t samples = frames * in.channels;
+    int16_t *noise16 = calloc(samples, sizeof(int16_t)), *s16 = calloc(samples, sizeof(int16_t));
+    int32_t *noise32 = calloc(samples, sizeof(int32_t)), *s32 = calloc(samples, sizeof(int32_t));
+    float *noise = calloc(frames, sizeof(float));
+    uint32_t rng = 1;
+    for (size_t i = 0; i < samples; i++) {
+        rng = rng * 1664525 + 1013904223;
+        // noise at about -12dBFS so the limiter has something to do
+        noise16[i] = (int16_t)((int32_t)rng >> 18);
+        noise32[i] = (int32_t)rng >> 2;
+        if (i < frames) {
+            noise[i] = noise16[i] / 32768.0f;
+        }
+    }
+    // every pass starts from the same noise - running the chain over its own
+    // output would fade it away and time something else
+
+    printf("%s: %zu stages, %d channels, %zu frame blocks (%d ms)\n", argv[0], chain.stage_count, in.channels, frames,
+           BLOCK_MS);
+    // each stage on its own, straight on the float planes
+    for (size_t i = 0; i < chain.stage_count; i++) {
+        double start = now_sec();
+        for (int it = 0; it < ITERATIONS; it++) {
+            for (int c = 0; c < in.channels; c++) {
+                memcpy(chain.planes[c], noise, frames * sizeof(float));
+            }
+            chain.stages[i].process(chain.stages[i].state, chain.planes, frames);
+            __asm__ volatile("" ::: "memory");
+        }
+        double us = (now_sec() - start) / ITERATIONS * 1e6;
+        printf("  %2zu %-10s %8.2f us/block\n", i, dsp_stage_name(chain.stages[i].type), us);
+    }
+    // the whole chain with the conversions, as the speaker task runs it
+    double start = now_sec();
+    for (int it = 0; it < ITERATIONS; it++) {
+        memcpy(s16, noise16, samples * sizeof(int16_t));
+        dsp_chain_process_s16(&chain, s16, frames);
+        __asm__ volatile("" ::: "memory");
+    }
+    double us16 = (now_sec() - start) / ITERATIONS * 1e6;
+    start = now_sec();
+    for (int it = 0; it < ITERATIONS; it++) {
+        memcpy(s32, noise32, samples * sizeof(int32_t));
+        dsp_chain_process_s32(&chain, s32, frames);
+        __asm__ volatile("" ::: "memory");
+    }
+    double us32 = (now_sec() - start) / ITERATIONS * 1e6;
+    printf("  chain s16  %8.2f us/block  %5.2f%% of the interval\n", us16, us16 * 100 / interval_us);
+    printf("  chain s32  %8.2f us/block  %5.2f%% of the interval\n", us32, us32 * 100 / interval_us);
+    free(noise16);
+    free(s16);
+    free(noise32);
+    free(s32);
+    free(noise);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 3) {
+        usage();
+    }
+    if (!strcmp(argv[1], "build")) {
+        return cmd_build(argc - 2, argv + 2);
+    }
+    if (!strcmp(argv[1], "validate")) {
+        return cmd_validate(argc - 2, argv + 2);
+    }
+    if (!strcmp(argv[1], "bench")) {
+        return cmd_bench(argc - 2, argv + 2);
+    }
+    usage();
+    return 1;
+}
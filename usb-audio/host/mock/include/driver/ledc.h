@@ -0,0 +1,2 @@
+// Host simulation stand-in for the ESP-IDF header of the same name
+#pragma once
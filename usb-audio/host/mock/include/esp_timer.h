@@ -0,0 +1,15 @@
+// Host simulation stand-in for the ESP-IDF header of the same name
+#pragma once
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// virtual time since the simulation started
+int64_t esp_timer_get_time(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,21 @@
+// Host simulation stand-in for the FreeRTOS header of the same name
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct sim_stream_buffer *StreamBufferHandle_t;
+
+StreamBufferHandle_t xStreamBufferCreate(size_t size, size_t trigger_level);
+size_t xStreamBufferSend(StreamBufferHandle_t sb, const void *data, size_t len, TickType_t ticks_to_wait);
+size_t xStreamBufferReceive(StreamBufferHandle_t sb, void *data, size_t len, TickType_t ticks_to_wait);
+size_t xStreamBufferBytesAvailable(StreamBufferHandle_t sb);
+size_t xStreamBufferSpacesAvailable(StreamBufferHandle_t sb);
+BaseType_t xStreamBufferReset(StreamBufferHandle_t sb);
+
+#ifdef __cplusplus
+}
+#endif
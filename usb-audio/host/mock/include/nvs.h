@@ -0,0 +1,17 @@
+// Host simulation stand-in for the ESP-IDF header of the same name. There is
+// one in-memory blob store, which the harness can fill with sim_nvs_set().
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "nvs_flash.h"
+
+typedef uint32_t nvs_handle_t;
+typedef enum { NVS_READONLY, NVS_READWRITE } nvs_open_mode_t;
+
+esp_err_t nvs_open(const char *name, nvs_open_mode_t open_mode, nvs_handle_t *out_handle);
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *out_value, size_t *length);
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char *key, const void *value, size_t length);
+esp_err_t nvs_commit(nvs_handle_t handle);
+void nvs_close(nvs_handle_t handle);
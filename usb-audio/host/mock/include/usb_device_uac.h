@@ -0,0 +1,30 @@
+// Host simulation stand-in for the espressif/usb_device_uac component header
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef esp_err_t (*uac_output_cb_t)(uint8_t *buf, size_t len, void *cb_ctx);
+typedef esp_err_t (*uac_input_cb_t)(uint8_t *buf, size_t len, size_t *bytes_read, void *cb_ctx);
+typedef void (*uac_set_mute_cb_t)(uint32_t mute, void *cb_ctx);
+typedef void (*uac_set_volume_cb_t)(uint32_t volume, void *cb_ctx);
+
+typedef struct {
+    uac_output_cb_t output_cb;
+    uac_input_cb_t input_cb;
+    uac_set_mute_cb_t set_mute_cb;
+    uac_set_volume_cb_t set_volume_cb;
+    void *cb_ctx;
+} uac_device_config_t;
+
+esp_err_t uac_device_init(uac_device_config_t *config);
+
+#ifdef __cplusplus
+}
+#endif
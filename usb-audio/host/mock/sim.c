@@ -0,0 +1,536 @@
+// Virtual time scheduler plus the FreeRTOS, esp_timer and GPIO calls the
+// firmware makes. See sim.h for how it fits together.
+#include "sim.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "driver/gpio.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/stream_buffer.h"
+#include "freertos/task.h"
+#include "nvs.h"
+
+struct sim_task {
+    pthread_t thread;
+    pthread_cond_t cond;
+    const char *name;
+    UBaseType_t priority;
+    TaskFunction_t fn;
+    void *arg;
+    bool runnable;
+    const void *waiting_on;
+    int64_t wake_at;
+    struct sim_task *next;
+};
+
+// Whoever is running - a task or the scheduler - holds this lock, so the
+// firmware code never runs concurrently with anything else
+static pthread_mutex_t big_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t scheduler_cond = PTHREAD_COND_INITIALIZER;
+static struct sim_task *tasks;
+static struct sim_task *current;
+static struct sim_task *last_run;
+static sim_device_t *devices;
+static int64_t now_us;
+
+// ====================== Scheduler ======================
+int64_t sim_now_us(void)
+{
+    return now_us;
+}
+
+int64_t sim_ticks_to_deadline(uint32_t ticks)
+{
+    if (ticks == portMAX_DELAY) {
+        return SIM_NEVER;
+    }
+    return now_us + (int64_t)ticks * 1000000 / configTICK_RATE_HZ;
+}
+
+void sim_wait(const void *object, int64_t timeout_at)
+{
+    struct sim_task *self = current;
+    if (!self) {
+        fprintf(stderr, "sim: blocking call made outside a task\n");
+        abort();
+    }
+    self->runnable = false;
+    self->waiting_on = object;
+    self->wake_at = timeout_at;
+    current = NULL;
+    pthread_cond_signal(&scheduler_cond);
+    while (current != self) {
+        pthread_cond_wait(&self->cond, &big_lock);
+    }
+    self->waiting_on = NULL;
+    self->wake_at = SIM_NEVER;
+}
+
+void sim_sleep_until(int64_t t_us)
+{
+    while (now_us < t_us) {
+        sim_wait(NULL, t_us);
+    }
+}
+
+void sim_notify(const void *object)
+{
+    for (struct sim_task *t = tasks; t; t = t->next) {
+        if (!t->runnable && object && t->waiting_on == object) {
+            t->runnable = true;
+        }
+    }
+}
+
+void sim_add_device(sim_device_t *dev)
+{
+    dev->next = devices;
+    devices = dev;
+}
+
+static void *task_thread(void *arg)
+{
+    struct sim_task *self = arg;
+    pthread_mutex_lock(&big_lock);
+    while (current != self) {
+        pthread_cond_wait(&self->cond, &big_lock);
+    }
+    self->fn(self->arg);
+    // FreeRTOS tasks must never return - treat it like vTaskDelete(NULL)
+    self->runnable = false;
+    self->wake_at = SIM_NEVER;
+    current = NULL;
+    pthread_cond_signal(&scheduler_cond);
+    pthread_mutex_unlock(&big_lock);
+    return NULL;
+}
+
+// Highest priority runnable task, round robin between equal priorities
+static struct sim_task *pick_task(void)
+{
+    struct sim_task *best = NULL;
+    struct sim_task *start = last_run && last_run->next ? last_run->next : tasks;
+    struct sim_task *t = start;
+    if (!t) {
+        return NULL;
+    }
+    do {
+        if (t->runnable && (!best || t->priority > best->priority)) {
+            best = t;
+        }
+        t = t->next ? t->next : tasks;
+    } while (t != start);
+    return best;
+}
+
+static void (*main_entry)(void);
+
+static void main_task(void *arg)
+{
+    (void)arg;
+    main_entry();
+}
+
+void sim_run(void (*entry)(void), int64_t duration_us)
+{
+    pthread_mutex_lock(&big_lock);
+    main_entry = entry;
+    xTaskCreate(main_task, "main", 4096, NULL, 1, NULL);
+    while (now_us < duration_us) {
+        struct sim_task *t = pick_task();
+        if (t) {
+            last_run = t;
+            current = t;
+            pthread_cond_signal(&t->cond);
+            while (current != NULL) {
+                pthread_cond_wait(&scheduler_cond, &big_lock);
+            }
+            continue;
+        }
+        // everyone is blocked - jump to the next event
+        int64_t next = SIM_NEVER;
+        for (struct sim_task *k = tasks; k; k = k->next) {
+            if (k->wake_at < next) {
+                next = k->wake_at;
+            }
+        }
+        for (sim_device_t *d = devices; d; d = d->next) {
+            if (d->next_at < next) {
+                next = d->next_at;
+            }
+        }
+        if (next == SIM_NEVER) {
+            fprintf(stderr, "sim: deadlock - every task is blocked forever\n");
+            break;
+        }
+        now_us = next;
+        for (sim_device_t *d = devices; d; d = d->next) {
+            while (d->next_at <= now_us) {
+                d->fire(d);
+            }
+        }
+        for (struct sim_task *k = tasks; k; k = k->next) {
+            if (!k->runnable && k->wake_at <= now_us) {
+                k->runnable = true;
+            }
+        }
+    }
+    // leave the task threads parked - the process is about to exit
+    pthread_mutex_unlock(&big_lock);
+}
+
+double sim_thread_cpu_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec * 1e-3;
+}
+
+// ====================== Statistics ======================
+void sim_level_add(sim_level_t *level, double value)
+{
+    if (level->count == 0 || value < level->min) {
+        level->min = value;
+    }
+    if (level->count == 0 || value > level->max) {
+        level->max = value;
+    }
+    level->sum += value;
+    level->count++;
+}
+
+double sim_level_mean(const sim_level_t *level)
+{
+    return level->count ? level->sum / level->count : 0;
+}
+
+void sim_samples_add(sim_samples_t *samples, double value)
+{
+    if (samples->count == samples->cap) {
+        samples->cap = samples->cap ? samples->cap * 2 : 1024;
+        samples->values = realloc(samples->values, samples->cap * sizeof(double));
+    }
+    samples->values[samples->count++] = value;
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+double sim_samples_percentile(sim_samples_t *samples, double percentile)
+{
+    if (samples->count == 0) {
+        return 0;
+    }
+    qsort(samples->values, samples->count, sizeof(double), compare_doubles);
+    size_t index = (size_t)(percentile / 100.0 * (samples->count - 1) + 0.5);
+    return samples->values[index];
+}
+
+double sim_samples_mean(const sim_samples_t *samples)
+{
+    double sum = 0;
+    for (size_t i = 0; i < samples->count; i++) {
+        sum += samples->values[i];
+    }
+    return samples->count ? sum / samples->count : 0;
+}
+
+// ====================== FreeRTOS tasks ======================
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name, uint32_t stack_depth, void *arg,
+                                   UBaseType_t priority, TaskHandle_t *handle, BaseType_t core)
+{
+    (void)stack_depth;
+    (void)core;
+    struct sim_task *t = calloc(1, sizeof(*t));
+    t->name = name;
+    t->priority = priority;
+    t->fn = fn;
+    t->arg = arg;
+    t->runnable = true;
+    t->wake_at = SIM_NEVER;
+    pthread_cond_init(&t->cond, NULL);
+    // append so round robin follows creation order
+    struct sim_task **tail = &tasks;
+    while (*tail) {
+        tail = &(*tail)->next;
+    }
+    *tail = t;
+    pthread_create(&t->thread, NULL, task_thread, t);
+    if (handle) {
+        *handle = t;
+    }
+    return pdPASS;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stack_depth, void *arg,
+                       UBaseType_t priority, TaskHandle_t *handle)
+{
+    return xTaskCreatePinnedToCore(fn, name, stack_depth, arg, priority, handle, tskNO_AFFINITY);
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    sim_sleep_until(sim_ticks_to_deadline(ticks));
+}
+
+void vTaskDelayUntil(TickType_t *previous_wake, TickType_t ticks)
+{
+    *previous_wake += ticks;
+    sim_sleep_until((int64_t)*previous_wake * 1000000 / configTICK_RATE_HZ);
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    return (TickType_t)(now_us * configTICK_RATE_HZ / 1000000);
+}
+
+// ====================== FreeRTOS stream buffers ======================
+#define SIM_MAX_STREAM_BUFFERS 8
+
+struct sim_stream_buffer {
+    uint8_t *data;
+    size_t size;
+    size_t trigger_level;
+    size_t head; // bytes ever written
+    size_t tail; // bytes ever read
+    sim_stream_buffer_stats_t stats;
+};
+
+static struct sim_stream_buffer *stream_buffers[SIM_MAX_STREAM_BUFFERS];
+static size_t stream_buffer_count;
+
+StreamBufferHandle_t xStreamBufferCreate(size_t size, size_t trigger_level)
+{
+    struct sim_stream_buffer *sb = calloc(1, sizeof(*sb));
+    sb->data = calloc(1, size);
+    sb->size = size;
+    sb->trigger_level = trigger_level ? trigger_level : 1;
+    sb->stats.size = size;
+    if (stream_buffer_count < SIM_MAX_STREAM_BUFFERS) {
+        stream_buffers[stream_buffer_count++] = sb;
+    }
+    return sb;
+}
+
+size_t xStreamBufferBytesAvailable(StreamBufferHandle_t sb)
+{
+    return sb->head - sb->tail;
+}
+
+size_t xStreamBufferSpacesAvailable(StreamBufferHandle_t sb)
+{
+    return sb->size - (sb->head - sb->tail);
+}
+
+BaseType_t xStreamBufferReset(StreamBufferHandle_t sb)
+{
+    sb->tail = sb->head;
+    sim_notify(sb);
+    return pdPASS;
+}
+
+size_t xStreamBufferSend(StreamBufferHandle_t sb, const void *data, size_t len, TickType_t ticks_to_wait)
+{
+    const uint8_t *src = data;
+    int64_t deadline = sim_ticks_to_deadline(ticks_to_wait);
+    size_t sent = 0;
+    while (1) {
+        size_t space = xStreamBufferSpacesAvailable(sb);
+        size_t n = len - sent < space ? len - sent : space;
+        for (size_t i = 0; i < n; i++) {
+            sb->data[(sb->head + i) % sb->size] = src[sent + i];
+        }
+        sb->head += n;
+        sent += n;
+        if (n) {
+            sim_notify(sb);
+        }
+        if (sent == len || sim_now_us() >= deadline) {
+            break;
+        }
+        sim_wait(sb, deadline);
+    }
+    if (sent < len) {
+        sb->stats.short_sends++;
+    }
+    sim_level_add(&sb->stats.fill, (double)xStreamBufferBytesAvailable(sb));
+    return sent;
+}
+
+size_t xStreamBufferReceive(StreamBufferHandle_t sb, void *data, size_t len, TickType_t ticks_to_wait)
+{
+    // like FreeRTOS: only block if the buffer is empty, and then until the
+    // trigger level is reached
+    int64_t deadline = sim_ticks_to_deadline(ticks_to_wait);
+    if (xStreamBufferBytesAvailable(sb) == 0) {
+        while (xStreamBufferBytesAvailable(sb) < sb->trigger_level && sim_now_us() < deadline) {
+            sim_wait(sb, deadline);
+        }
+    }
+    size_t available = xStreamBufferBytesAvailable(sb);
+    size_t n = len < available ? len : available;
+    uint8_t *dst = data;
+    for (size_t i = 0; i < n; i++) {
+        dst[i] = sb->data[(sb->tail + i) % sb->size];
+    }
+    sb->tail += n;
+    if (n) {
+        sim_notify(sb);
+    }
+    return n;
+}
+
+size_t sim_stream_buffer_stats(sim_stream_buffer_stats_t *out, size_t max)
+{
+    size_t n = stream_buffer_count < max ? stream_buffer_count : max;
+    for (size_t i = 0; i < n; i++) {
+        out[i] = stream_buffers[i]->stats;
+    }
+    return n;
+}
+
+// ====================== esp_timer / GPIO ======================
+int64_t esp_timer_get_time(void)
+{
+    return now_us;
+}
+
+esp_err_t gpio_reset_pin(gpio_num_t gpio_num)
+{
+    (void)gpio_num;
+    return ESP_OK;
+}
+
+esp_err_t gpio_set_direction(gpio_num_t gpio_num, gpio_mode_t mode)
+{
+    (void)gpio_num;
+    (void)mode;
+    return ESP_OK;
+}
+
+esp_err_t gpio_set_level(gpio_num_t gpio_num, uint32_t level)
+{
+    (void)gpio_num;
+    (void)level;
+    return ESP_OK;
+}
+
+// ====================== NVS ======================
+#define SIM_NVS_ENTRIES 8
+#define SIM_NVS_MAX_BLOB 4000 // what NVS allows in one page
+
+typedef struct {
+    char name[16];
+    char key[16];
+    uint8_t data[SIM_NVS_MAX_BLOB];
+    size_t len;
+} sim_nvs_entry_t;
+
+static sim_nvs_entry_t nvs_entries[SIM_NVS_ENTRIES];
+static size_t nvs_entry_count;
+// handles are 1 + an index into nvs_names
+static char nvs_names[SIM_NVS_ENTRIES][16];
+static size_t nvs_name_count;
+
+static sim_nvs_entry_t *nvs_find(const char *name, const char *key, bool create)
+{
+    for (size_t i = 0; i < nvs_entry_count; i++) {
+        if (!strcmp(nvs_entries[i].name, name) && !strcmp(nvs_entries[i].key, key)) {
+            return &nvs_entries[i];
+        }
+    }
+    if (!create || nvs_entry_count == SIM_NVS_ENTRIES) {
+        return NULL;
+    }
+    sim_nvs_entry_t *e = &nvs_entries[nvs_entry_count++];
+    snprintf(e->name, sizeof(e->name), "%s", name);
+    snprintf(e->key, sizeof(e->key), "%s", key);
+    e->len = 0;
+    return e;
+}
+
+bool sim_nvs_set(const char *name, const char *key, const void *data, size_t len)
+{
+    sim_nvs_entry_t *e = len <= SIM_NVS_MAX_BLOB ? nvs_find(name, key, true) : NULL;
+    if (!e) {
+        return false;
+    }
+    memcpy(e->data, data, len);
+    e->len = len;
+    return true;
+}
+
+esp_err_t nvs_flash_init(void)
+{
+    return ESP_OK;
+}
+
+esp_err_t nvs_flash_erase(void)
+{
+    nvs_entry_count = 0;
+    return ESP_OK;
+}
+
+esp_err_t nvs_open(const char *name, nvs_open_mode_t open_mode, nvs_handle_t *out_handle)
+{
+    (void)open_mode;
+    for (size_t i = 0; i < nvs_name_count; i++) {
+        if (!strcmp(nvs_names[i], name)) {
+            *out_handle = (nvs_handle_t)(i + 1);
+            return ESP_OK;
+        }
+    }
+    if (nvs_name_count == SIM_NVS_ENTRIES) {
+        return ESP_ERR_NO_MEM;
+    }
+    snprintf(nvs_names[nvs_name_count], sizeof(nvs_names[0]), "%s", name);
+    *out_handle = (nvs_handle_t)++nvs_name_count;
+    return ESP_OK;
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *out_value, size_t *length)
+{
+    if (handle == 0 || handle > nvs_name_count) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    sim_nvs_entry_t *e = nvs_find(nvs_names[handle - 1], key, false);
+    if (!e) {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    if (out_value) {
+        if (*length < e->len) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        memcpy(out_value, e->data, e->len);
+    }
+    *length = e->len;
+    return ESP_OK;
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char *key, const void *value, size_t length)
+{
+    if (handle == 0 || handle > nvs_name_count) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return sim_nvs_set(nvs_names[handle - 1], key, value, length) ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle)
+{
+    (void)handle;
+    return ESP_OK;
+}
+
+void nvs_close(nvs_handle_t handle)
+{
+    (void)handle;
+}
@@ -0,0 +1,134 @@
+// Host simulation of the bits of ESP-IDF, FreeRTOS and the UAC component that
+// the usb-audio firmware uses.
+//
+// Every FreeRTOS task is a pthread, but only one of them runs at a time (as if
+// on one core) and time is virtual: when every task is blocked the scheduler
+// jumps straight to the next thing that happens - a task timeout, an I2S DMA
+// frame or a USB interval. That makes a run deterministic and lets a minute of
+// audio go through in well under a second, while the CPU time each callback
+// takes is still measured for real.
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SIM_NEVER INT64_MAX
+
+// ====================== Scheduler ======================
+int64_t sim_now_us(void);
+// Block the running task until the given virtual time
+void sim_sleep_until(int64_t t_us);
+// Block the running task until sim_notify(object) or the timeout, whichever
+// comes first. Callers re-check their condition afterwards.
+void sim_wait(const void *object, int64_t timeout_at);
+void sim_notify(const void *object);
+// Virtual time of a FreeRTOS tick count from now (portMAX_DELAY = never)
+int64_t sim_ticks_to_deadline(uint32_t ticks);
+
+// Something outside the CPU with its own clock (an I2S DMA engine, ...)
+typedef struct sim_device {
+    int64_t next_at;                      // virtual time of the next event
+    void (*fire)(struct sim_device *dev); // handles the event and moves next_at on
+    struct sim_device *next;
+} sim_device_t;
+void sim_add_device(sim_device_t *dev);
+
+// Run `entry` as the first task (like app_main) for `duration_us` of virtual time
+void sim_run(void (*entry)(void), int64_t duration_us);
+
+// CPU time used by the calling thread
+double sim_thread_cpu_us(void);
+
+// ====================== Statistics ======================
+typedef struct {
+    double min;
+    double max;
+    double sum;
+    uint64_t count;
+} sim_level_t;
+
+void sim_level_add(sim_level_t *level, double value);
+double sim_level_mean(const sim_level_t *level);
+
+// Keeps every value so we can report percentiles
+typedef struct {
+    double *values;
+    size_t count;
+    size_t cap;
+} sim_samples_t;
+
+void sim_samples_add(sim_samples_t *samples, double value);
+double sim_samples_percentile(sim_samples_t *samples, double percentile);
+double sim_samples_mean(const sim_samples_t *samples);
+
+// ====================== Stream buffers ======================
+typedef struct {
+    size_t size;
+    sim_level_t fill;     // bytes queued after every send
+    uint32_t short_sends; // sends that didn't fit
+} sim_stream_buffer_stats_t;
+
+size_t sim_stream_buffer_stats(sim_stream_buffer_stats_t *out, size_t max);
+
+// ====================== I2S ======================
+// Audio moves as `frames` frames of `channels` interleaved samples, left
+// justified in int32 (a 16 bit sample is shifted up 16) whatever the format
+typedef struct {
+    void (*tx_sink)(const int32_t *samples, size_t frames, int channels, void *ctx); // what the amp plays
+    void (*rx_source)(int32_t *samples, size_t frames, int channels, void *ctx);     // what the mic hears
+    void *ctx;
+} sim_i2s_io_t;
+
+typedef struct {
+    int port;
+    bool is_tx;
+    int slots;          // channels per frame
+    int bits;           // data width
+    size_t dma_samples; // total DMA buffer size
+    sim_level_t fill;   // samples in the DMA buffer at each frame
+    uint64_t frames;
+    uint32_t underruns; // tx: DMA ran dry while audio was playing
+    uint32_t overruns;  // rx: nobody read the DMA in time
+} sim_i2s_stats_t;
+
+void sim_i2s_set_io(const sim_i2s_io_t *io);
+size_t sim_i2s_stats(sim_i2s_stats_t *out, size_t max);
+
+// ====================== UAC host ======================
+typedef struct {
+    double ppm;      // USB clock error against the I2S clock
+    int jitter_us;   // each interval is delivered up to this much early/late
+    double loss;     // probability the host misses a speaker interval
+    int volume_db;   // host volume, -50..+50
+    bool mute;
+    void (*spk_source)(int32_t *samples, size_t frames, int channels, void *ctx);    // what the host plays
+    void (*mic_sink)(const int32_t *samples, size_t frames, int channels, void *ctx); // what the host records
+    void *ctx;
+} sim_uac_host_t;
+
+typedef struct {
+    sim_samples_t output_cb_us; // CPU time of each output callback
+    sim_samples_t input_cb_us;  // CPU time of each input callback
+    uint32_t spk_intervals;
+    uint32_t spk_dropped; // intervals the host missed on purpose
+    uint32_t mic_intervals;
+    uint32_t short_reads; // input callback returned less than asked for
+    uint32_t errors;      // callbacks that didn't return ESP_OK
+} sim_uac_stats_t;
+
+void sim_uac_set_host(const sim_uac_host_t *host);
+sim_uac_stats_t *sim_uac_stats(void);
+
+// ====================== NVS ======================
+// Puts a blob in the simulated NVS before the firmware starts (the data is
+// copied). Returns false if the store is full or the blob too big.
+bool sim_nvs_set(const char *name, const char *key, const void *data, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
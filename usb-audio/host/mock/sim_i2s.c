@@ -0,0 +1,277 @@
+// I2S channels for the host simulation. Each enabled channel is a device with
+// its own sample clock that moves one DMA frame (dma_frame_num samples) in or
+// out of the DMA buffer per tick, just like the descriptors on the ESP32.
+// Samples are kept as left justified int32 whatever the data width, and
+// converted at i2s_channel_read/write.
+#include <stdlib.h>
+#include <string.h>
+
+#include "driver/i2s_pdm.h"
+#include "driver/i2s_std.h"
+#include "sim.h"
+
+#define SIM_MAX_I2S_CHANNELS 4
+
+struct sim_i2s_channel {
+    sim_device_t dev; // must be first
+    bool is_tx;
+    bool enabled;
+    bool auto_clear;
+    uint32_t sample_rate;
+    int slots;       // 1 for mono, 2 for stereo (interleaved)
+    size_t bytes;    // per sample in the application's buffers (2 or 4)
+    size_t dma_frames; // audio frames per DMA frame (dma_frame_num)
+    size_t dma_descs;
+    size_t frame;    // samples per DMA frame (dma_frames * slots)
+    size_t capacity; // samples in the whole DMA buffer
+    int32_t *ring;
+    uint64_t head; // samples ever written into the DMA buffer
+    uint64_t tail; // samples ever taken out of the DMA buffer
+    int32_t *frame_buf;
+    uint64_t frames_done;
+    int64_t start_us;
+    sim_i2s_stats_t stats;
+};
+
+static sim_i2s_io_t io;
+static struct sim_i2s_channel *channels[SIM_MAX_I2S_CHANNELS];
+static size_t channel_count;
+
+void sim_i2s_set_io(const sim_i2s_io_t *new_io)
+{
+    io = *new_io;
+}
+
+size_t sim_i2s_stats(sim_i2s_stats_t *out, size_t max)
+{
+    size_t n = channel_count < max ? channel_count : max;
+    for (size_t i = 0; i < n; i++) {
+        out[i] = channels[i]->stats;
+    }
+    return n;
+}
+
+static int64_t frame_time(const struct sim_i2s_channel *ch, uint64_t frame_index)
+{
+    return ch->start_us + (int64_t)(frame_index * ch->dma_frames * 1000000 / ch->sample_rate);
+}
+
+static void tx_frame(struct sim_i2s_channel *ch)
+{
+    size_t available = (size_t)(ch->head - ch->tail);
+    size_t n = available < ch->frame ? available : ch->frame;
+    for (size_t i = 0; i < n; i++) {
+        ch->frame_buf[i] = ch->ring[(ch->tail + i) % ch->capacity];
+    }
+    ch->tail += n;
+    if (n < ch->frame) {
+        // the DMA ran dry - that's only a glitch if it cut off actual audio
+        int32_t last = n ? ch->frame_buf[n - 1] : ch->frame_buf[ch->frame - 1];
+        if (last != 0) {
+            ch->stats.underruns++;
+        }
+        if (ch->auto_clear) {
+            memset(ch->frame_buf + n, 0, (ch->frame - n) * sizeof(int32_t));
+        }
+        // otherwise the rest of the descriptor still holds whatever it had
+    }
+    if (io.tx_sink) {
+        io.tx_sink(ch->frame_buf, ch->dma_frames, ch->slots, io.ctx);
+    }
+}
+
+static void rx_frame(struct sim_i2s_channel *ch)
+{
+    if (io.rx_source) {
+        io.rx_source(ch->frame_buf, ch->dma_frames, ch->slots, io.ctx);
+    } else {
+        memset(ch->frame_buf, 0, ch->frame * sizeof(int32_t));
+    }
+    if (ch->capacity - (size_t)(ch->head - ch->tail) < ch->frame) {
+        // nobody read in time, the DMA overwrites the oldest frame
+        ch->tail += ch->frame;
+        ch->stats.overruns++;
+    }
+    for (size_t i = 0; i < ch->frame; i++) {
+        ch->ring[(ch->head + i) % ch->capacity] = ch->frame_buf[i];
+    }
+    ch->head += ch->frame;
+}
+
+static void channel_fire(sim_device_t *dev)
+{
+    struct sim_i2s_channel *ch = (struct sim_i2s_channel *)dev;
+    if (ch->is_tx) {
+        tx_frame(ch);
+    } else {
+        rx_frame(ch);
+    }
+    ch->stats.frames++;
+    sim_level_add(&ch->stats.fill, (double)(ch->head - ch->tail));
+    ch->frames_done++;
+    ch->dev.next_at = ch->enabled ? frame_time(ch, ch->frames_done + 1) : SIM_NEVER;
+    sim_notify(ch);
+}
+
+static struct sim_i2s_channel *new_channel(const i2s_chan_config_t *cfg, bool is_tx)
+{
+    struct sim_i2s_channel *ch = calloc(1, sizeof(*ch));
+    ch->is_tx = is_tx;
+    ch->auto_clear = cfg->auto_clear;
+    ch->dma_frames = cfg->dma_frame_num;
+    ch->dma_descs = cfg->dma_desc_num;
+    ch->dev.next_at = SIM_NEVER;
+    ch->dev.fire = channel_fire;
+    ch->stats.port = cfg->id;
+    ch->stats.is_tx = is_tx;
+    if (channel_count < SIM_MAX_I2S_CHANNELS) {
+        channels[channel_count++] = ch;
+    }
+    sim_add_device(&ch->dev);
+    return ch;
+}
+
+esp_err_t i2s_new_channel(const i2s_chan_config_t *chan_cfg, i2s_chan_handle_t *ret_tx_handle,
+                          i2s_chan_handle_t *ret_rx_handle)
+{
+    if (!chan_cfg || (!ret_tx_handle && !ret_rx_handle)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (ret_tx_handle) {
+        *ret_tx_handle = new_channel(chan_cfg, true);
+    }
+    if (ret_rx_handle) {
+        *ret_rx_handle = new_channel(chan_cfg, false);
+    }
+    return ESP_OK;
+}
+
+// The DMA buffers are sized once we know how many slots each frame has
+static esp_err_t init_mode(struct sim_i2s_channel *ch, uint32_t sample_rate, i2s_data_bit_width_t bits,
+                           i2s_slot_mode_t slot_mode)
+{
+    if ((bits != I2S_DATA_BIT_WIDTH_16BIT && bits != I2S_DATA_BIT_WIDTH_32BIT) || ch->ring) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    ch->bytes = bits == I2S_DATA_BIT_WIDTH_16BIT ? 2 : 4;
+    ch->sample_rate = sample_rate;
+    ch->slots = slot_mode == I2S_SLOT_MODE_STEREO ? 2 : 1;
+    ch->frame = ch->dma_frames * ch->slots;
+    ch->capacity = ch->dma_descs * ch->frame;
+    ch->ring = calloc(ch->capacity, sizeof(int32_t));
+    ch->frame_buf = calloc(ch->frame, sizeof(int32_t));
+    ch->stats.dma_samples = ch->capacity;
+    ch->stats.slots = ch->slots;
+    ch->stats.bits = (int)ch->bytes * 8;
+    return ESP_OK;
+}
+
+esp_err_t i2s_channel_init_pdm_rx_mode(i2s_chan_handle_t handle, const i2s_pdm_rx_config_t *pdm_rx_cfg)
+{
+    // like the S3, PDM RX only does 16 bit
+    if (!handle || handle->is_tx || pdm_rx_cfg->slot_cfg.data_bit_width != I2S_DATA_BIT_WIDTH_16BIT) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return init_mode(handle, pdm_rx_cfg->clk_cfg.sample_rate_hz, pdm_rx_cfg->slot_cfg.data_bit_width,
+                     pdm_rx_cfg->slot_cfg.slot_mode);
+}
+
+esp_err_t i2s_channel_init_std_mode(i2s_chan_handle_t handle, const i2s_std_config_t *std_cfg)
+{
+    if (!handle) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return init_mode(handle, std_cfg->clk_cfg.sample_rate_hz, std_cfg->slot_cfg.data_bit_width,
+                     std_cfg->slot_cfg.slot_mode);
+}
+
+esp_err_t i2s_channel_enable(i2s_chan_handle_t handle)
+{
+    if (!handle || handle->enabled || handle->sample_rate == 0) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    handle->enabled = true;
+    handle->start_us = sim_now_us();
+    handle->frames_done = 0;
+    handle->dev.next_at = frame_time(handle, 1);
+    return ESP_OK;
+}
+
+esp_err_t i2s_channel_disable(i2s_chan_handle_t handle)
+{
+    if (!handle || !handle->enabled) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    handle->enabled = false;
+    handle->dev.next_at = SIM_NEVER;
+    return ESP_OK;
+}
+
+static int64_t timeout_deadline(uint32_t timeout_ms)
+{
+    // the IDF takes the timeout in ms but portMAX_DELAY still means forever
+    return timeout_ms == 0xffffffffUL ? SIM_NEVER : sim_now_us() + (int64_t)timeout_ms * 1000;
+}
+
+esp_err_t i2s_channel_write(i2s_chan_handle_t handle, const void *src, size_t size, size_t *bytes_written,
+                            uint32_t timeout_ms)
+{
+    if (!handle || !handle->is_tx || !handle->enabled) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    size_t count = size / handle->bytes;
+    size_t done = 0;
+    int64_t deadline = timeout_deadline(timeout_ms);
+    while (1) {
+        size_t space = handle->capacity - (size_t)(handle->head - handle->tail);
+        size_t n = count - done < space ? count - done : space;
+        for (size_t i = 0; i < n; i++) {
+            int32_t sample = handle->bytes == 2 ? (int32_t)((const int16_t *)src)[done + i] * 65536
+                                                : ((const int32_t *)src)[done + i];
+            handle->ring[(handle->head + i) % handle->capacity] = sample;
+        }
+        handle->head += n;
+        done += n;
+        if (done == count || sim_now_us() >= deadline) {
+            break;
+        }
+        sim_wait(handle, deadline);
+    }
+    if (bytes_written) {
+        *bytes_written = done * handle->bytes;
+    }
+    return done == count ? ESP_OK : ESP_ERR_TIMEOUT;
+}
+
+esp_err_t i2s_channel_read(i2s_chan_handle_t handle, void *dest, size_t size, size_t *bytes_read,
+                           uint32_t timeout_ms)
+{
+    if (!handle || handle->is_tx || !handle->enabled) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    size_t count = size / handle->bytes;
+    size_t done = 0;
+    int64_t deadline = timeout_deadline(timeout_ms);
+    while (1) {
+        size_t available = (size_t)(handle->head - handle->tail);
+        size_t n = count - done < available ? count - done : available;
+        for (size_t i = 0; i < n; i++) {
+            int32_t sample = handle->ring[(handle->tail + i) % handle->capacity];
+            if (handle->bytes == 2) {
+                ((int16_t *)dest)[done + i] = (int16_t)(sample >> 16);
+            } else {
+                ((int32_t *)dest)[done + i] = sample;
+            }
+        }
+        handle->tail += n;
+        done += n;
+        if (done == count || sim_now_us() >= deadline) {
+            break;
+        }
+        sim_wait(handle, deadline);
+    }
+    if (bytes_read) {
+        *bytes_read = done * handle->bytes;
+    }
+    return done == count ? ESP_OK : ESP_ERR_TIMEOUT;
+}
@@ -0,0 +1,145 @@
+// The espressif/usb_device_uac component as seen from the firmware, driven
+// by a virtual USB host. The speaker task hands the output callback one
+// interval of audio per (possibly drifting, jittery or missed) USB interval
+// and the mic task asks the input callback for one interval at a time.
+#include <stdlib.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "sim.h"
+#include "usb_device_uac.h"
+
+#define SPK_BLOCK_FRAMES (CONFIG_UAC_SAMPLE_RATE * CONFIG_UAC_SPK_INTERVAL_MS / 1000)
+#define MIC_BLOCK_FRAMES (CONFIG_UAC_SAMPLE_RATE * CONFIG_UAC_MIC_INTERVAL_MS / 1000)
+#define SPK_BLOCK_SAMPLES (SPK_BLOCK_FRAMES * CONFIG_UAC_SPEAKER_CHANNEL_NUM)
+#define MIC_BLOCK_SAMPLES (MIC_BLOCK_FRAMES * CONFIG_UAC_MIC_CHANNEL_NUM)
+// what the descriptors would advertise
+#define USB_SAMPLE_BITS CONFIG_APP_USB_SAMPLE_BITS
+#define USB_SAMPLE_BYTES (USB_SAMPLE_BITS == 16 ? 2 : 4)
+
+static uac_device_config_t uac_config;
+static sim_uac_host_t host;
+static sim_uac_stats_t stats;
+
+void sim_uac_set_host(const sim_uac_host_t *new_host)
+{
+    host = *new_host;
+}
+
+sim_uac_stats_t *sim_uac_stats(void)
+{
+    return &stats;
+}
+
+// Start of USB interval `k` on the host's clock
+static int64_t interval_time(int64_t start, uint64_t k, int interval_ms)
+{
+    double period_us = interval_ms * 1000.0 / (1.0 + host.ppm * 1e-6);
+    int64_t t = start + (int64_t)(k * period_us);
+    if (host.jitter_us > 0) {
+        t += (rand() % (2 * host.jitter_us + 1)) - host.jitter_us;
+    }
+    return t;
+}
+
+// The host's side of the format: it works in left justified int32 and puts
+// samples on the bus at USB_SAMPLE_BITS
+static void to_usb(const int32_t *in, uint8_t *out, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        if (USB_SAMPLE_BITS == 16) {
+            ((int16_t *)out)[i] = (int16_t)(in[i] >> 16);
+        } else if (USB_SAMPLE_BITS == 24) {
+            ((int32_t *)out)[i] = (int32_t)((uint32_t)in[i] & 0xFFFFFF00u);
+        } else {
+            ((int32_t *)out)[i] = in[i];
+        }
+    }
+}
+
+static void from_usb(const uint8_t *in, int32_t *out, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        out[i] = USB_SAMPLE_BITS == 16 ? (int32_t)((const int16_t *)in)[i] * 65536 : ((const int32_t *)in)[i];
+    }
+}
+
+static void uac_spk_task(void *arg)
+{
+    (void)arg;
+    static int32_t samples[SPK_BLOCK_SAMPLES];
+    static uint8_t block[SPK_BLOCK_SAMPLES * USB_SAMPLE_BYTES];
+    const int64_t start = sim_now_us();
+    for (uint64_t k = 1;; k++) {
+        sim_sleep_until(interval_time(start, k, CONFIG_UAC_SPK_INTERVAL_MS));
+        stats.spk_intervals++;
+        if (host.loss > 0 && rand() < host.loss * RAND_MAX) {
+            stats.spk_dropped++;
+            // the host's audio for this interval is lost, not delayed
+            if (host.spk_source) {
+                host.spk_source(samples, SPK_BLOCK_FRAMES, CONFIG_UAC_SPEAKER_CHANNEL_NUM, host.ctx);
+            }
+            continue;
+        }
+        if (host.spk_source) {
+            host.spk_source(samples, SPK_BLOCK_FRAMES, CONFIG_UAC_SPEAKER_CHANNEL_NUM, host.ctx);
+        } else {
+            memset(samples, 0, sizeof(samples));
+        }
+        to_usb(samples, block, SPK_BLOCK_SAMPLES);
+        double t0 = sim_thread_cpu_us();
+        esp_err_t ret = uac_config.output_cb((uint8_t *)block, sizeof(block), uac_config.cb_ctx);
+        sim_samples_add(&stats.output_cb_us, sim_thread_cpu_us() - t0);
+        if (ret != ESP_OK) {
+            stats.errors++;
+        }
+    }
+}
+
+static void uac_mic_task(void *arg)
+{
+    (void)arg;
+    static uint8_t block[MIC_BLOCK_SAMPLES * USB_SAMPLE_BYTES];
+    static int32_t samples[MIC_BLOCK_SAMPLES];
+    const int64_t start = sim_now_us();
+    for (uint64_t k = 1;; k++) {
+        sim_sleep_until(interval_time(start, k, CONFIG_UAC_MIC_INTERVAL_MS));
+        stats.mic_intervals++;
+        size_t bytes_read = 0;
+        double t0 = sim_thread_cpu_us();
+        esp_err_t ret = uac_config.input_cb((uint8_t *)block, sizeof(block), &bytes_read, uac_config.cb_ctx);
+        sim_samples_add(&stats.input_cb_us, sim_thread_cpu_us() - t0);
+        if (ret != ESP_OK) {
+            stats.errors++;
+        }
+        if (bytes_read < sizeof(block)) {
+            stats.short_reads++;
+        }
+        if (host.mic_sink) {
+            size_t n = bytes_read / USB_SAMPLE_BYTES;
+            from_usb(block, samples, n);
+            host.mic_sink(samples, n / CONFIG_UAC_MIC_CHANNEL_NUM, CONFIG_UAC_MIC_CHANNEL_NUM, host.ctx);
+        }
+    }
+}
+
+esp_err_t uac_device_init(uac_device_config_t *config)
+{
+    if (!config || !config->output_cb || !config->input_cb) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    uac_config = *config;
+    // the host sets volume and mute when it opens the device
+    if (uac_config.set_volume_cb) {
+        uac_config.set_volume_cb((uint32_t)((host.volume_db + 50) * 2), uac_config.cb_ctx);
+    }
+    if (uac_config.set_mute_cb) {
+        uac_config.set_mute_cb(host.mute, uac_config.cb_ctx);
+    }
+    xTaskCreatePinnedToCore(uac_spk_task, "uac_spk", 4096, NULL, CONFIG_UAC_SPK_TASK_PRIORITY, NULL,
+                            CONFIG_UAC_SPK_TASK_CORE);
+    xTaskCreatePinnedToCore(uac_mic_task, "uac_mic", 4096, NULL, CONFIG_UAC_MIC_TASK_PRIORITY, NULL,
+                            CONFIG_UAC_MIC_TASK_CORE);
+    return ESP_OK;
+}
@@ -0,0 +1,237 @@
+// Speaker packet loss concealment simulation
+//
+// Plays test signals through the speaker path one UAC interval at a time,
+// drops intervals according to a loss pattern and compares what comes out
+// with the original. Three strategies are compared:
+//
+//   silence - write nothing, the DMA auto clear plays zeros
+//   repeat  - replay the last interval (what the DMA did before auto clear)
+//   plc     - plc_conceal() / plc_good_frame()
+//
+// For each we report the SNR over the damaged intervals (the lost ones and
+// the one after), the number of clicks at interval boundaries and the time
+// spent in the PLC code.
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "plc.h"
+
+#define SAMPLE_RATE 48000
+#define BLOCK 480 // 10ms UAC interval
+#define SECONDS 20
+#define TOTAL_BLOCKS (SECONDS * SAMPLE_RATE / BLOCK)
+#define TOTAL_SAMPLES (TOTAL_BLOCKS * BLOCK)
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+typedef enum { STRATEGY_SILENCE, STRATEGY_REPEAT, STRATEGY_PLC, STRATEGY_COUNT } strategy_t;
+
+static int16_t original[TOTAL_SAMPLES];
+static int16_t output[TOTAL_SAMPLES];
+static uint8_t lost[TOTAL_BLOCKS];
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// ====================== Test signals ======================
+static void make_tone(void)
+{
+    for (int i = 0; i < TOTAL_SAMPLES; i++) {
+        original[i] = (int16_t)(16000 * sin(2 * M_PI * 440 * i / SAMPLE_RATE));
+    }
+}
+
+// harmonic rich "vowel" with a slowly wandering pitch
+static void make_voice(void)
+{
+    double phase = 0;
+    for (int i = 0; i < TOTAL_SAMPLES; i++) {
+        double f0 = 140 * (1 + 0.03 * sin(2 * M_PI * 0.7 * i / SAMPLE_RATE));
+        phase += 2 * M_PI * f0 / SAMPLE_RATE;
+        double s = 0;
+        for (int h = 1; h <= 12; h++) {
+            s += sin(h * phase) / h;
+        }
+        original[i] = (int16_t)(7000 * s);
+    }
+}
+
+static void make_chord(void)
+{
+    const double notes[] = {261.63, 329.63, 392.0};
+    for (int i = 0; i < TOTAL_SAMPLES; i++) {
+        double s = 0;
+        for (int n = 0; n < 3; n++) {
+            s += sin(2 * M_PI * notes[n] * i / SAMPLE_RATE);
+        }
+        original[i] = (int16_t)(8000 * s);
+    }
+}
+
+static void make_noise(void)
+{
+    for (int i = 0; i < TOTAL_SAMPLES; i++) {
+        original[i] = (int16_t)((rand() % 16001) - 8000);
+    }
+}
+
+typedef struct {
+    const char *name;
+    void (*make)(void);
+} signal_t;
+
+static const signal_t signals[] = {
+    {"tone", make_tone},
+    {"voice", make_voice},
+    {"chord", make_chord},
+    {"noise", make_noise},
+};
+
+// ====================== Loss patterns ======================
+typedef struct {
+    const char *name;
+    double start_prob; // probability a loss starts on any interval
+    int burst;         // intervals lost in a row
+    int every;         // if set, lose one interval every `every`
+} pattern_t;
+
+static const pattern_t patterns[] = {
+    {"random 2%", 0.02, 1, 0},
+    {"random 10%", 0.10, 1, 0},
+    {"bursts 3x10ms", 0.01, 3, 0},
+    {"bursts 10x10ms", 0.003, 10, 0},
+    {"every 50th", 0, 1, 50},
+};
+
+static int make_losses(const pattern_t *p)
+{
+    int count = 0;
+    memset(lost, 0, sizeof(lost));
+    // leave the first second alone so everything has history
+    for (int b = 100; b < TOTAL_BLOCKS - 1; b++) {
+        bool start = p->every ? (b % p->every) == 0 : (rand() / (double)RAND_MAX) < p->start_prob;
+        if (!start) {
+            continue;
+        }
+        for (int k = 0; k < p->burst && b + k < TOTAL_BLOCKS - 1; k++) {
+            lost[b + k] = 1;
+            count++;
+        }
+        b += p->burst;
+    }
+    return count;
+}
+
+// ====================== Simulation ======================
+typedef struct {
+    double snr_db;
+    int clicks;
+    double conceal_us; // per lost interval
+    double good_us;    // per received interval
+} result_t;
+
+static plc_t plc;
+
+static result_t run(strategy_t strategy)
+{
+    result_t r = {0};
+    int16_t block[BLOCK];
+    int16_t last_good[BLOCK] = {0};
+    double conceal_time = 0, good_time = 0;
+    int conceal_calls = 0, good_calls = 0;
+    plc_init(&plc, SAMPLE_RATE);
+
+    for (int b = 0; b < TOTAL_BLOCKS; b++) {
+        int16_t *out = &output[b * BLOCK];
+        if (!lost[b]) {
+            memcpy(block, &original[b * BLOCK], sizeof(block));
+            if (strategy == STRATEGY_PLC) {
+                double t = now_sec();
+                plc_good_frame(&plc, block, BLOCK);
+                good_time += now_sec() - t;
+                good_calls++;
+            }
+            memcpy(last_good, block, sizeof(block));
+            memcpy(out, block, sizeof(block));
+            continue;
+        }
+        switch (strategy) {
+        case STRATEGY_SILENCE:
+            memset(out, 0, sizeof(block));
+            break;
+        case STRATEGY_REPEAT:
+            memcpy(out, last_good, sizeof(block));
+            break;
+        default: {
+            double t = now_sec();
+            plc_conceal(&plc, out, BLOCK);
+            conceal_time += now_sec() - t;
+            conceal_calls++;
+            break;
+        }
+        }
+    }
+
+    // the largest step the real signal ever takes, anything well beyond that
+    // at a block boundary is a click
+    int max_step = 0;
+    for (int i = 1; i < TOTAL_SAMPLES; i++) {
+        int step = abs(original[i] - original[i - 1]);
+        if (step > max_step) {
+            max_step = step;
+        }
+    }
+    double signal = 0, noise = 0;
+    for (int b = 1; b < TOTAL_BLOCKS; b++) {
+        bool damaged = lost[b] || lost[b - 1];
+        if (!damaged) {
+            continue;
+        }
+        for (int i = b * BLOCK; i < (b + 1) * BLOCK; i++) {
+            double d = (double)output[i] - original[i];
+            signal += (double)original[i] * original[i];
+            noise += d * d;
+        }
+        int boundary = b * BLOCK;
+        if (abs(output[boundary] - output[boundary - 1]) > max_step * 3 / 2 + 64) {
+            r.clicks++;
+        }
+    }
+    r.snr_db = noise > 0 ? 10 * log10(signal / noise) : 99;
+    r.conceal_us = conceal_calls ? conceal_time / conceal_calls * 1e6 : 0;
+    r.good_us = good_calls ? good_time / good_calls * 1e6 : 0;
+    return r;
+}
+
+int main(void)
+{
+    srand(1234);
+    printf("%-7s %-15s %6s | %-16s | %-16s | %-16s | %s\n", "signal", "loss", "lost",
+           "silence SNR/clk", "repeat SNR/clk", "plc SNR/clk", "plc us/conceal, us/good");
+    for (size_t s = 0; s < sizeof(signals) / sizeof(signals[0]); s++) {
+        signals[s].make();
+        for (size_t p = 0; p < sizeof(patterns) / sizeof(patterns[0]); p++) {
+            int count = make_losses(&patterns[p]);
+            printf("%-7s %-15s %6d |", signals[s].name, patterns[p].name, count);
+            result_t plc_result = {0};
+            for (int k = 0; k < STRATEGY_COUNT; k++) {
+                result_t r = run((strategy_t)k);
+                printf(" %7.1fdB %5d  |", r.snr_db, r.clicks);
+                if (k == STRATEGY_PLC) {
+                    plc_result = r;
+                }
+            }
+            printf(" %.2f, %.2f\n", plc_result.conceal_us, plc_result.good_us);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,305 @@
+// Runs the usb-audio firmware (main/main.c, unchanged) as a Linux process.
+//
+// A virtual USB host plays a WAV file (or a tone) into the speaker callback
+// and records whatever the mic callback returns, while virtual I2S clocks
+// play the speaker DMA out to a WAV file and feed the mic DMA from another.
+// At the end we report how long each callback took, how full the buffers
+// ran and how many glitches there were.
+//
+//   uac_sim [--spk in.wav] [--mic in.wav] [--seconds N] [--out DIR]
+//           [--ppm X] [--jitter-us N] [--loss P] [--volume-db N] [--mute]
+//           [--dsp chain.bin]
+//
+// --dsp puts a DSP chain descriptor (host/dsp_tool) in the simulated NVS,
+// where a CONFIG_APP_DSP_CHAIN build picks it up at boot.
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sdkconfig.h"
+#include "sim.h"
+#include "telemetry.h"
+#include "wav.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+void app_main(void);
+
+// what the PDM data line carries - two mics for the beamformer
+#if CONFIG_APP_MIC_BEAMFORMER
+#define MIC_PDM_CHANNELS 2
+#else
+#define MIC_PDM_CHANNELS CONFIG_UAC_MIC_CHANNEL_NUM
+#endif
+
+// A WAV file played on a loop, or a tone if there isn't one. The tone is a
+// fifth higher on each extra channel so they can be told apart.
+typedef struct {
+    wav_t wav;
+    size_t pos;
+    double freq;
+    double amplitude;
+    double phase;
+} source_t;
+
+// Samples are left justified int32, so the tone keeps its full resolution
+// in the wider formats
+static void source_read(source_t *src, int32_t *samples, size_t frames, int channels)
+{
+    for (size_t i = 0; i < frames; i++) {
+        for (int c = 0; c < channels; c++) {
+            if (src->wav.count) {
+                samples[i * channels + c] = (int32_t)src->wav.samples[src->pos * src->wav.channels + c] * 65536;
+            } else {
+                samples[i * channels + c] = (int32_t)lrint(65536.0 * src->amplitude * sin(src->phase * (1 + 0.5 * c)));
+            }
+        }
+        if (src->wav.count) {
+            src->pos = (src->pos + 1) % src->wav.count;
+        } else {
+            src->phase += 2 * M_PI * src->freq / CONFIG_UAC_SAMPLE_RATE;
+        }
+    }
+}
+
+typedef struct {
+    source_t spk_in;  // what the host plays
+    source_t mic_in;  // what the mic hears
+    const char *out_dir;
+    wav_writer_t spk_out; // what the amp gets
+    wav_writer_t mic_out; // what the host records
+} harness_t;
+
+static harness_t harness;
+
+static void host_spk_source(int32_t *samples, size_t frames, int channels, void *ctx)
+{
+    source_read(&((harness_t *)ctx)->spk_in, samples, frames, channels);
+}
+
+static void host_mic_sink(const int32_t *samples, size_t frames, int channels, void *ctx)
+{
+    wav_writer_write_s32(&((harness_t *)ctx)->mic_out, samples, frames * channels);
+}
+
+static void i2s_tx_sink(const int32_t *samples, size_t frames, int channels, void *ctx)
+{
+    harness_t *h = ctx;
+    // the amp may have fewer channels than the host sends (downmix), so
+    // open the output once we know
+    if (h->out_dir && !h->spk_out.file) {
+        char path[1024];
+        snprintf(path, sizeof(path), "%s/speaker_out.wav", h->out_dir);
+        wav_writer_open(&h->spk_out, path, CONFIG_UAC_SAMPLE_RATE, channels, CONFIG_APP_SPEAKER_SAMPLE_BITS == 16 ? 16 : 32);
+    }
+    wav_writer_write_s32(&h->spk_out, samples, frames * channels);
+}
+
+static void i2s_rx_source(int32_t *samples, size_t frames, int channels, void *ctx)
+{
+    source_read(&((harness_t *)ctx)->mic_in, samples, frames, channels);
+}
+
+static bool load_source(source_t *src, const char *path, int channels)
+{
+    if (!wav_read_channels(path, &src->wav, channels)) {
+        fprintf(stderr, "can't read %s (16-bit PCM WAV only)\n", path);
+        return false;
+    }
+    if (src->wav.sample_rate != CONFIG_UAC_SAMPLE_RATE) {
+        fprintf(stderr, "%s is %d Hz but the firmware runs at %d Hz\n", path, src->wav.sample_rate,
+                CONFIG_UAC_SAMPLE_RATE);
+        return false;
+    }
+    return true;
+}
+
+static void print_callback(const char *name, sim_samples_t *us, int interval_ms)
+{
+    if (us->count == 0) {
+        printf("  %-12s never called\n", name);
+        return;
+    }
+    double max = sim_samples_percentile(us, 100);
+    printf("  %-12s %7zu calls  mean %7.2f us  p50 %7.2f  p99 %7.2f  max %7.2f  (%.2f%% of %d ms)\n", name,
+           us->count, sim_samples_mean(us), sim_samples_percentile(us, 50), sim_samples_percentile(us, 99), max,
+           max / (interval_ms * 10.0), interval_ms);
+}
+
+static void print_report(void)
+{
+    sim_uac_stats_t *uac = sim_uac_stats();
+    printf("callback CPU time (host):\n");
+    print_callback("output_cb", &uac->output_cb_us, CONFIG_UAC_SPK_INTERVAL_MS);
+    print_callback("input_cb", &uac->input_cb_us, CONFIG_UAC_MIC_INTERVAL_MS);
+
+    printf("buffer fill (min / mean / max):\n");
+    sim_i2s_stats_t i2s[4];
+    size_t n = sim_i2s_stats(i2s, 4);
+    for (size_t i = 0; i < n; i++) {
+        printf("  i2s%d %s DMA  %6.0f / %8.1f / %6.0f of %zu samples (%s, %d bit)\n", i2s[i].port,
+               i2s[i].is_tx ? "tx" : "rx", i2s[i].fill.min, sim_level_mean(&i2s[i].fill), i2s[i].fill.max,
+               i2s[i].dma_samples, i2s[i].slots == 2 ? "stereo" : "mono", i2s[i].bits);
+    }
+    sim_stream_buffer_stats_t sb[8];
+    n = sim_stream_buffer_stats(sb, 8);
+    for (size_t i = 0; i < n; i++) {
+        printf("  stream buffer %zu %6.0f / %8.1f / %6.0f of %zu bytes\n", i, sb[i].fill.min,
+               sim_level_mean(&sb[i].fill), sb[i].fill.max, sb[i].size);
+    }
+
+    printf("glitches:\n");
+    printf("  host missed speaker intervals  %u of %u\n", uac->spk_dropped, uac->spk_intervals);
+    n = sim_i2s_stats(i2s, 4);
+    for (size_t i = 0; i < n; i++) {
+        if (i2s[i].is_tx) {
+            printf("  i2s%d tx underruns (audible)    %u\n", i2s[i].port, i2s[i].underruns);
+        } else {
+            printf("  i2s%d rx overruns               %u\n", i2s[i].port, i2s[i].overruns);
+        }
+    }
+    n = sim_stream_buffer_stats(sb, 8);
+    for (size_t i = 0; i < n; i++) {
+        printf("  stream buffer %zu short sends    %u\n", i, sb[i].short_sends);
+    }
+    printf("  mic short reads                %u\n", uac->short_reads);
+    printf("  callback errors                %u\n", uac->errors);
+
+    // what the firmware would report over the telemetry port, sent through
+    // the packet encoder and back. Callback times are in virtual time, so
+    // they only show waits - the host CPU times are above.
+    uint8_t packet[TELEMETRY_MAX_PACKET_LEN];
+    size_t len = telemetry_encode(&telemetry, 0, 0, packet);
+    telemetry_t t;
+    uint16_t crc = packet[len - 2] | (packet[len - 1] << 8);
+    if (crc != telemetry_crc16(packet, len - TELEMETRY_TRAILER_LEN) ||
+        !telemetry_decode_payload(packet + TELEMETRY_HEADER_LEN, TELEMETRY_PAYLOAD_LEN, &t)) {
+        printf("telemetry: packet failed to decode\n");
+        return;
+    }
+    printf("firmware telemetry (%zu byte packet):\n", len);
+    printf("  speaker  %u callbacks, %u overruns, %u clipped, %u losses, %u samples concealed\n", t.spk_cb.calls,
+           t.spk_overruns, t.spk_clipped, t.spk_loss_events, t.spk_concealed);
+    printf("  mic      %u callbacks, %u errors, %u clipped\n", t.mic_cb.calls, t.mic_errors, t.mic_clipped);
+    printf("  volume   %d dB (x%u%%)%s\n", (int)t.volume_db, t.volume_factor, t.muted ? " muted" : "");
+
+    // the deadline monitors the same way. Like the callback times, the slack
+    // is in virtual time, so it shows late starts and waits, not CPU time.
+    printf("deadlines (slack in us, %zu byte packets):\n", (size_t)TELEMETRY_MAX_PACKET_LEN);
+    for (uint8_t id = 0; id < TELEMETRY_DEADLINE_COUNT; id++) {
+        deadline_monitor_t m;
+        uint8_t decoded_id;
+        len = telemetry_encode_deadline(&telemetry_deadlines[id], id, 0, 0, packet);
+        crc = packet[len - 2] | (packet[len - 1] << 8);
+        if (crc != telemetry_crc16(packet, len - TELEMETRY_TRAILER_LEN) ||
+            !telemetry_decode_deadline(packet + TELEMETRY_HEADER_LEN, TELEMETRY_DEADLINE_PAYLOAD_LEN, &decoded_id, &m) ||
+            decoded_id != id) {
+            printf("deadline telemetry: packet failed to decode\n");
+            return;
+        }
+        deadline_print(telemetry_deadline_name(id), &m);
+    }
+}
+
+static bool load_nvs_blob(const char *name, const char *key, const char *path)
+{
+    uint8_t data[4096];
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        fprintf(stderr, "can't open %s\n", path);
+        return false;
+    }
+    size_t len = fread(data, 1, sizeof(data), f);
+    fclose(f);
+    if (!sim_nvs_set(name, key, data, len)) {
+        fprintf(stderr, "%s is too big for NVS\n", path);
+        return false;
+    }
+    return true;
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: uac_sim [--spk in.wav] [--mic in.wav] [--seconds N] [--out DIR]\n"
+                    "               [--ppm X] [--jitter-us N] [--loss P] [--volume-db N] [--mute]\n"
+                    "               [--dsp chain.bin]\n");
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    double seconds = 10;
+    const char *out_dir = NULL;
+    sim_uac_host_t host = {0};
+    harness.spk_in.freq = 1000;
+    harness.spk_in.amplitude = 8000;
+    harness.mic_in.freq = 440;
+    harness.mic_in.amplitude = 3000;
+
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+        if (!strcmp(arg, "--mute")) {
+            host.mute = true;
+            continue;
+        }
+        if (!value) {
+            usage();
+        }
+        i++;
+        if (!strcmp(arg, "--spk")) {
+            if (!load_source(&harness.spk_in, value, CONFIG_UAC_SPEAKER_CHANNEL_NUM)) {
+                return 1;
+            }
+        } else if (!strcmp(arg, "--mic")) {
+            if (!load_source(&harness.mic_in, value, MIC_PDM_CHANNELS)) {
+                return 1;
+            }
+        } else if (!strcmp(arg, "--seconds")) {
+            seconds = atof(value);
+        } else if (!strcmp(arg, "--out")) {
+            out_dir = value;
+        } else if (!strcmp(arg, "--ppm")) {
+            host.ppm = atof(value);
+        } else if (!strcmp(arg, "--jitter-us")) {
+            host.jitter_us = atoi(value);
+        } else if (!strcmp(arg, "--loss")) {
+            host.loss = atof(value);
+        } else if (!strcmp(arg, "--volume-db")) {
+            host.volume_db = atoi(value);
+        } else if (!strcmp(arg, "--dsp")) {
+            if (!load_nvs_blob("dsp", "chain", value)) {
+                return 1;
+            }
+        } else {
+            usage();
+        }
+    }
+
+    if (out_dir) {
+        char path[1024];
+        harness.out_dir = out_dir;
+        snprintf(path, sizeof(path), "%s/mic_out.wav", out_dir);
+        wav_writer_open(&harness.mic_out, path, CONFIG_UAC_SAMPLE_RATE, CONFIG_UAC_MIC_CHANNEL_NUM,
+                        CONFIG_APP_USB_SAMPLE_BITS == 16 ? 16 : 32);
+    }
+
+    host.spk_source = host_spk_source;
+    host.mic_sink = host_mic_sink;
+    host.ctx = &harness;
+    sim_uac_set_host(&host);
+    sim_i2s_io_t io = {.tx_sink = i2s_tx_sink, .rx_source = i2s_rx_source, .ctx = &harness};
+    sim_i2s_set_io(&io);
+
+    printf("simulating %.1f s at %d Hz (usb %+.0f ppm, +-%d us jitter, %.1f%% loss)\n", seconds,
+           CONFIG_UAC_SAMPLE_RATE, host.ppm, host.jitter_us, host.loss * 100);
+    sim_run(app_main, (int64_t)(seconds * 1e6));
+    print_report();
+
+    wav_writer_close(&harness.spk_out);
+    wav_writer_close(&harness.mic_out);
+    return 0;
+}
@@ -0,0 +1,171 @@
+#include "wav.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static uint32_t read_le32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint16_t read_le16(const uint8_t *p)
+{
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static void write_le32(uint8_t *p, uint32_t v)
+{
+    p[0] = (uint8_t)(v & 0xFF);
+    p[1] = (uint8_t)((v >> 8) & 0xFF);
+    p[2] = (uint8_t)((v >> 16) & 0xFF);
+    p[3] = (uint8_t)((v >> 24) & 0xFF);
+}
+
+static void write_le16(uint8_t *p, uint16_t v)
+{
+    p[0] = (uint8_t)(v & 0xFF);
+    p[1] = (uint8_t)((v >> 8) & 0xFF);
+}
+
+bool wav_read(const char *path, wav_t *wav)
+{
+    return wav_read_channels(path, wav, 1);
+}
+
+bool wav_read_channels(const char *path, wav_t *wav, int want)
+{
+    memset(wav, 0, sizeof(*wav));
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        return false;
+    }
+    uint8_t riff[12];
+    if (fread(riff, 1, 12, f) != 12 || memcmp(riff, "RIFF", 4) || memcmp(riff + 8, "WAVE", 4)) {
+        fclose(f);
+        return false;
+    }
+    int channels = 0;
+    int bits = 0;
+    uint8_t chunk[8];
+    while (fread(chunk, 1, 8, f) == 8) {
+        uint32_t size = read_le32(chunk + 4);
+        if (!memcmp(chunk, "fmt ", 4)) {
+            uint8_t fmt[16];
+            if (size < 16 || fread(fmt, 1, 16, f) != 16) {
+                break;
+            }
+            fseek(f, (long)(size - 16 + (size & 1)), SEEK_CUR);
+            channels = read_le16(fmt + 2);
+            wav->sample_rate = (int)read_le32(fmt + 4);
+            bits = read_le16(fmt + 14);
+        } else if (!memcmp(chunk, "data", 4)) {
+            if (bits != 16 || channels < 1) {
+                break;
+            }
+            size_t frames = size / (2 * (size_t)channels);
+            int16_t *raw = malloc(frames * channels * sizeof(int16_t));
+            wav->samples = malloc((frames ? frames : 1) * want * sizeof(int16_t));
+            frames = fread(raw, 2 * (size_t)channels, frames, f);
+            for (size_t i = 0; i < frames; i++) {
+                for (int c = 0; c < want; c++) {
+                    int from = c < channels ? c : channels - 1;
+                    wav->samples[i * want + c] = (int16_t)read_le16((const uint8_t *)&raw[i * channels + from]);
+                }
+            }
+            wav->count = frames;
+            wav->channels = want;
+            free(raw);
+            fclose(f);
+            return true;
+        } else {
+            fseek(f, (long)(size + (size & 1)), SEEK_CUR);
+        }
+    }
+    fclose(f);
+    return false;
+}
+
+void wav_free(wav_t *wav)
+{
+    free(wav->samples);
+    memset(wav, 0, sizeof(*wav));
+}
+
+static void write_header(wav_writer_t *writer)
+{
+    uint8_t h[44];
+    const int bytes = writer->bits / 8;
+    uint32_t data_bytes = (uint32_t)(writer->count * bytes);
+    memcpy(h, "RIFF", 4);
+    write_le32(h + 4, 36 + data_bytes);
+    memcpy(h + 8, "WAVEfmt ", 8);
+    write_le32(h + 16, 16);
+    write_le16(h + 20, 1); // PCM
+    write_le16(h + 22, (uint16_t)writer->channels);
+    write_le32(h + 24, (uint32_t)writer->sample_rate);
+    write_le32(h + 28, (uint32_t)(writer->sample_rate * bytes * writer->channels));
+    write_le16(h + 32, (uint16_t)(bytes * writer->channels));
+    write_le16(h + 34, (uint16_t)writer->bits);
+    memcpy(h + 36, "data", 4);
+    write_le32(h + 40, data_bytes);
+    fseek(writer->file, 0, SEEK_SET);
+    fwrite(h, 1, sizeof(h), writer->file);
+}
+
+bool wav_writer_open(wav_writer_t *writer, const char *path, int sample_rate, int channels, int bits)
+{
+    memset(writer, 0, sizeof(*writer));
+    writer->file = fopen(path, "wb");
+    if (!writer->file) {
+        return false;
+    }
+    writer->sample_rate = sample_rate;
+    writer->channels = channels;
+    writer->bits = bits;
+    write_header(writer);
+    return true;
+}
+
+void wav_writer_write(wav_writer_t *writer, const int16_t *samples, size_t n)
+{
+    if (!writer->file) {
+        return;
+    }
+    for (size_t i = 0; i < n; i++) {
+        uint8_t b[4];
+        if (writer->bits == 16) {
+            write_le16(b, (uint16_t)samples[i]);
+        } else {
+            write_le32(b, (uint32_t)samples[i] << 16);
+        }
+        fwrite(b, 1, writer->bits / 8, writer->file);
+    }
+    writer->count += n;
+}
+
+void wav_writer_write_s32(wav_writer_t *writer, const int32_t *samples, size_t n)
+{
+    if (!writer->file) {
+        return;
+    }
+    for (size_t i = 0; i < n; i++) {
+        uint8_t b[4];
+        if (writer->bits == 16) {
+            write_le16(b, (uint16_t)(samples[i] >> 16));
+        } else {
+            write_le32(b, (uint32_t)samples[i]);
+        }
+        fwrite(b, 1, writer->bits / 8, writer->file);
+    }
+    writer->count += n;
+}
+
+void wav_writer_close(wav_writer_t *writer)
+{
+    if (!writer->file) {
+        return;
+    }
+    write_header(writer);
+    fclose(writer->file);
+    writer->file = NULL;
+}
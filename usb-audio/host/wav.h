@@ -0,0 +1,46 @@
+// Minimal PCM16 WAV reading and writing for the host tools
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    int16_t *samples; // interleaved, `channels` per frame
+    size_t count;     // frames
+    int channels;
+    int sample_rate;
+} wav_t;
+
+// Loads a 16-bit PCM WAV file, keeping the first channel
+bool wav_read(const char *path, wav_t *wav);
+// Loads a 16-bit PCM WAV file as `channels` interleaved channels. Extra
+// channels in the file are dropped and missing ones repeat the last one
+// (so a mono file plays on both sides).
+bool wav_read_channels(const char *path, wav_t *wav, int channels);
+void wav_free(wav_t *wav);
+
+typedef struct {
+    FILE *file;
+    size_t count; // samples written
+    int channels;
+    int bits;     // 16 or 32
+    int sample_rate;
+} wav_writer_t;
+
+// 16 or 32 bit PCM writer - the header is filled in by wav_writer_close()
+bool wav_writer_open(wav_writer_t *writer, const char *path, int sample_rate, int channels, int bits);
+// Writes `n` samples (interleaved if there is more than one channel)
+void wav_writer_write(wav_writer_t *writer, const int16_t *samples, size_t n);
+// The same from left justified int32 samples, kept at the writer's width
+void wav_writer_write_s32(wav_writer_t *writer, const int32_t *samples, size_t n);
+void wav_writer_close(wav_writer_t *writer);
+
+#ifdef __cplusplus
+}
+#endif
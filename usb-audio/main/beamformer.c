@@ -0,0 +1,248 @@
+#include "beamformer.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// MVDR defaults: the covariance follows the room over about 200ms, and is
+// loaded with 1% of the mean mic power - enough to keep mic self-noise
+// from being amplified more than a dB or so (see host/beam_sim)
+#define MVDR_TIME_CONSTANT_S 0.2f
+#define MVDR_LOADING 0.01f
+
+// ====================== Delay and sum ======================
+// Windowed sinc taps for a delay of `frac` (0 to 1) samples on top of the
+// filter's own BEAM_FIR_TAPS / 2 - 1, scaled to a DC gain of 1/2 in Q15
+static void design_fractional(int16_t *taps, float frac)
+{
+    const float centre = BEAM_FIR_TAPS / 2 - 1 + frac;
+    float h[BEAM_FIR_TAPS];
+    float sum = 0;
+    for (int k = 0; k < BEAM_FIR_TAPS; k++) {
+        float t = k - centre;
+        float sinc = fabsf(t) < 1e-6f ? 1.0f : sinf((float)M_PI * t) / ((float)M_PI * t);
+        float window = 0.5f + 0.5f * cosf((float)M_PI * t / (BEAM_FIR_TAPS / 2));
+        h[k] = sinc * window;
+        sum += h[k];
+    }
+    int32_t total = 0;
+    int biggest = 0;
+    for (int k = 0; k < BEAM_FIR_TAPS; k++) {
+        taps[k] = (int16_t)lrintf(h[k] / sum * 16384.0f);
+        total += taps[k];
+        if (abs(taps[k]) > abs(taps[biggest])) {
+            biggest = k;
+        }
+    }
+    // rounding leftovers onto the biggest tap so the DC gain is exact
+    taps[biggest] += (int16_t)(16384 - total);
+}
+
+static void delay_sum_chunk(beamformer_t *bf, const int16_t *in, int16_t *out, size_t frames)
+{
+    for (int m = 0; m < BEAM_MICS; m++) {
+        int16_t *h = bf->history[m];
+        for (size_t i = 0; i < frames; i++) {
+            h[BEAM_HISTORY + i] = in[i * BEAM_MICS + m];
+        }
+    }
+    for (size_t i = 0; i < frames; i++) {
+        int32_t acc = 0;
+        for (int m = 0; m < BEAM_MICS; m++) {
+            // newest sample first: x[n - delay - k]
+            const int16_t *x = &bf->history[m][BEAM_HISTORY + i - bf->delay[m]];
+            const int16_t *taps = bf->fir[m];
+            for (int k = 0; k < BEAM_FIR_TAPS; k++) {
+                acc += (int32_t)taps[k] * x[-k];
+            }
+        }
+        acc = (acc + (1 << 14)) >> 15;
+        out[i] = (int16_t)(acc > 32767 ? 32767 : acc < -32768 ? -32768 : acc);
+    }
+    for (int m = 0; m < BEAM_MICS; m++) {
+        memmove(bf->history[m], bf->history[m] + frames, BEAM_HISTORY * sizeof(int16_t));
+    }
+}
+
+// ====================== MVDR ======================
+// In place radix 2 FFT on bf->re/im, forward or inverse (unscaled)
+static void fft(beamformer_t *bf, bool inverse)
+{
+    float *re = bf->re, *im = bf->im;
+    for (int i = 0; i < BEAM_FFT_SIZE; i++) {
+        int j = bf->bitrev[i];
+        if (i < j) {
+            float t = re[i];
+            re[i] = re[j];
+            re[j] = t;
+            t = im[i];
+            im[i] = im[j];
+            im[j] = t;
+        }
+    }
+    const float sign = inverse ? -1.0f : 1.0f;
+    for (int len = 2, step = BEAM_FFT_SIZE / 2; len <= BEAM_FFT_SIZE; len <<= 1, step >>= 1) {
+        for (int i = 0; i < BEAM_FFT_SIZE; i += len) {
+            for (int k = 0; k < len / 2; k++) {
+                float wr = bf->twiddle[k * step][0], wi = sign * bf->twiddle[k * step][1];
+                int a = i + k, b = i + k + len / 2;
+                float xr = re[b] * wr - im[b] * wi;
+                float xi = re[b] * wi + im[b] * wr;
+                re[b] = re[a] - xr;
+                im[b] = im[a] - xi;
+                re[a] += xr;
+                im[a] += xi;
+            }
+        }
+    }
+}
+
+// One STFT frame: both mics in one complex FFT (mic 0 real, mic 1
+// imaginary), the weights per bin, and the beam back out by overlap-add
+static void mvdr_frame(beamformer_t *bf)
+{
+    for (int n = 0; n < BEAM_FFT_SIZE; n++) {
+        bf->re[n] = bf->input[0][n] * bf->window[n];
+        bf->im[n] = bf->input[1][n] * bf->window[n];
+    }
+    fft(bf, false);
+
+    const float a = bf->smoothing;
+    for (int k = 0; k < BEAM_BINS; k++) {
+        // separate the two real spectra: X0 = (Z[k] + Z*[N-k]) / 2,
+        // X1 = (Z[k] - Z*[N-k]) / 2j
+        int nk = (BEAM_FFT_SIZE - k) & (BEAM_FFT_SIZE - 1);
+        float x0r = 0.5f * (bf->re[k] + bf->re[nk]), x0i = 0.5f * (bf->im[k] - bf->im[nk]);
+        float x1r = 0.5f * (bf->im[k] + bf->im[nk]), x1i = -0.5f * (bf->re[k] - bf->re[nk]);
+
+        if (bf->adapt) {
+            bf->r00[k] = a * bf->r00[k] + (1 - a) * (x0r * x0r + x0i * x0i);
+            bf->r11[k] = a * bf->r11[k] + (1 - a) * (x1r * x1r + x1i * x1i);
+            // X0 X1*
+            bf->r01_re[k] = a * bf->r01_re[k] + (1 - a) * (x0r * x1r + x0i * x1i);
+            bf->r01_im[k] = a * bf->r01_im[k] + (1 - a) * (x0i * x1r - x0r * x1i);
+        }
+        float load = bf->loading * 0.5f * (bf->r00[k] + bf->r11[k]) + 1e-12f;
+        float r00 = bf->r00[k] + load, r11 = bf->r11[k] + load;
+        float r01r = bf->r01_re[k], r01i = bf->r01_im[k];
+        const float *d0 = bf->steer[k][0], *d1 = bf->steer[k][1];
+
+        // u = adj(R) d (the 1/det cancels below), w = u / (d^H u)
+        float u0r = r11 * d0[0] - (r01r * d1[0] - r01i * d1[1]);
+        float u0i = r11 * d0[1] - (r01r * d1[1] + r01i * d1[0]);
+        float u1r = r00 * d1[0] - (r01r * d0[0] + r01i * d0[1]);
+        float u1i = r00 * d1[1] - (r01r * d0[1] - r01i * d0[0]);
+        float norm = d0[0] * u0r + d0[1] * u0i + d1[0] * u1r + d1[1] * u1i;
+        norm = norm > 1e-20f ? 1.0f / norm : 0;
+        // Y = w^H X. Bins k and N-k aren't needed again, so the beam's
+        // spectrum (conjugate symmetric, it is real) goes over them.
+        float y_re = ((u0r * x0r + u0i * x0i) + (u1r * x1r + u1i * x1i)) * norm;
+        float y_im = ((u0r * x0i - u0i * x0r) + (u1r * x1i - u1i * x1r)) * norm;
+        bf->re[k] = y_re;
+        bf->im[k] = y_im;
+        if (nk != k) {
+            bf->re[nk] = y_re;
+            bf->im[nk] = -y_im;
+        }
+    }
+    fft(bf, true);
+    for (int n = 0; n < BEAM_FFT_SIZE; n++) {
+        bf->overlap[n] += bf->re[n] * bf->window[n] * (1.0f / BEAM_FFT_SIZE);
+    }
+    memcpy(bf->out, bf->overlap, sizeof(bf->out));
+    memmove(bf->overlap, bf->overlap + BEAM_HOP, (BEAM_FFT_SIZE - BEAM_HOP) * sizeof(float));
+    memset(bf->overlap + BEAM_FFT_SIZE - BEAM_HOP, 0, BEAM_HOP * sizeof(float));
+    for (int m = 0; m < BEAM_MICS; m++) {
+        memmove(bf->input[m], bf->input[m] + BEAM_HOP, (BEAM_FFT_SIZE - BEAM_HOP) * sizeof(float));
+    }
+}
+
+static void mvdr_process(beamformer_t *bf, const int16_t *in, int16_t *out, size_t frames)
+{
+    const int start = BEAM_FFT_SIZE - BEAM_HOP;
+    for (size_t i = 0; i < frames; i++) {
+        bf->input[0][start + bf->fill] = in[i * BEAM_MICS] * (1.0f / 32768.0f);
+        bf->input[1][start + bf->fill] = in[i * BEAM_MICS + 1] * (1.0f / 32768.0f);
+        float v = bf->out[bf->fill] * 32768.0f;
+        out[i] = (int16_t)lrintf(v > 32767.0f ? 32767.0f : v < -32768.0f ? -32768.0f : v);
+        if (++bf->fill == BEAM_HOP) {
+            bf->fill = 0;
+            mvdr_frame(bf);
+        }
+    }
+}
+
+// ====================== Setup ======================
+void beamformer_steer(beamformer_t *bf, float steer_deg)
+{
+    steer_deg = steer_deg > 90 ? 90 : steer_deg < -90 ? -90 : steer_deg;
+    bf->steer_deg = steer_deg;
+    // mic 0 at -d/2, mic 1 at +d/2: a source towards mic 1 reaches it first
+    float half = 0.5f * bf->spacing_m * sinf(steer_deg * (float)M_PI / 180) / BEAM_SPEED_OF_SOUND * bf->sample_rate;
+    bf->arrival[0] = half;
+    bf->arrival[1] = -half;
+
+    // delay and sum: hold back whichever mic hears it first
+    float latest = fabsf(half);
+    for (int m = 0; m < BEAM_MICS; m++) {
+        float delay = latest - bf->arrival[m];
+        bf->delay[m] = (int)floorf(delay);
+        design_fractional(bf->fir[m], delay - bf->delay[m]);
+    }
+
+    // MVDR: the look direction's phase at each mic per bin
+    for (int k = 0; k < BEAM_BINS; k++) {
+        float w = 2 * (float)M_PI * k / BEAM_FFT_SIZE;
+        for (int m = 0; m < BEAM_MICS; m++) {
+            bf->steer[k][m][0] = cosf(w * bf->arrival[m]);
+            bf->steer[k][m][1] = -sinf(w * bf->arrival[m]);
+        }
+    }
+}
+
+bool beamformer_init(beamformer_t *bf, beam_mode_t mode, int sample_rate, float spacing_mm, float steer_deg)
+{
+    memset(bf, 0, sizeof(*bf));
+    bf->mode = mode;
+    bf->sample_rate = sample_rate;
+    bf->spacing_m = spacing_mm / 1000.0f;
+    if (bf->spacing_m / BEAM_SPEED_OF_SOUND * sample_rate > BEAM_MAX_DELAY - 1) {
+        return false;
+    }
+    bf->adapt = true;
+    bf->smoothing = expf(-BEAM_HOP / (MVDR_TIME_CONSTANT_S * sample_rate));
+    bf->loading = MVDR_LOADING;
+    for (int n = 0; n < BEAM_FFT_SIZE; n++) {
+        // sqrt periodic Hann both ways - the product overlap-adds to 1
+        bf->window[n] = sinf((float)M_PI * n / BEAM_FFT_SIZE);
+        int r = 0;
+        for (int bit = 1, rbit = BEAM_FFT_SIZE >> 1; bit < BEAM_FFT_SIZE; bit <<= 1, rbit >>= 1) {
+            if (n & bit) {
+                r |= rbit;
+            }
+        }
+        bf->bitrev[n] = (uint16_t)r;
+    }
+    for (int k = 0; k < BEAM_FFT_SIZE / 2; k++) {
+        bf->twiddle[k][0] = cosf(2 * (float)M_PI * k / BEAM_FFT_SIZE);
+        bf->twiddle[k][1] = -sinf(2 * (float)M_PI * k / BEAM_FFT_SIZE);
+    }
+    beamformer_steer(bf, steer_deg);
+    return true;
+}
+
+void beamformer_process(beamformer_t *bf, const int16_t *in, int16_t *out, size_t frames)
+{
+    if (bf->mode == BEAM_MVDR) {
+        mvdr_process(bf, in, out, frames);
+        return;
+    }
+    for (size_t done = 0; done < frames; done += BEAM_CHUNK) {
+        size_t n = frames - done < BEAM_CHUNK ? frames - done : BEAM_CHUNK;
+        delay_sum_chunk(bf, in + done * BEAM_MICS, out + done, n);
+    }
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Two mic beamformer for the UAC mic path.
+//
+// The two PDM mics share the data line and arrive as an interleaved stereo
+// block; the beamformer turns that into one mono channel that favours sound
+// from the look direction. Angles are from broadside (straight ahead of the
+// pair), positive towards mic 1 (the right slot), so +-90 is along the axis.
+//
+// Delay and sum: each mic goes through a 16 tap windowed sinc fractional
+// delay so sound from the look direction lines up, then the two are averaged.
+// Q15 fixed point, about 0.2ms of latency.
+//
+// MVDR: a 256 point STFT (50% overlap, sqrt Hann windows). Per bin it tracks
+// the 2x2 covariance of the mics and uses the weights with the least output
+// power that still pass the look direction unchanged, which puts a null on
+// the loudest interferer. Diagonal loading keeps it from amplifying mic
+// self-noise at low frequencies, where the pair is much smaller than a
+// wavelength. Float, BEAM_FFT_SIZE samples of latency.
+//
+// The state is self-contained (no pointers) so it can be copied.
+
+#define BEAM_MICS 2
+#define BEAM_FIR_TAPS 16
+// longest steering delay between the mics, in samples - 100mm at 48kHz
+#define BEAM_MAX_DELAY 16
+#define BEAM_HISTORY (BEAM_MAX_DELAY + BEAM_FIR_TAPS)
+// delay and sum works through blocks in chunks of this many frames
+#define BEAM_CHUNK 64
+#define BEAM_FFT_SIZE 256
+#define BEAM_HOP (BEAM_FFT_SIZE / 2)
+#define BEAM_BINS (BEAM_FFT_SIZE / 2 + 1)
+#define BEAM_SPEED_OF_SOUND 343.0f
+
+typedef enum {
+    BEAM_DELAY_SUM,
+    BEAM_MVDR,
+} beam_mode_t;
+
+typedef struct {
+    beam_mode_t mode;
+    int sample_rate;
+    float spacing_m;
+    float steer_deg;
+    // arrival time at each mic relative to the middle of the pair, samples
+    float arrival[BEAM_MICS];
+
+    // delay and sum - taps already halved, so the two sums add to the mean
+    int16_t fir[BEAM_MICS][BEAM_FIR_TAPS];
+    int delay[BEAM_MICS]; // whole samples ahead of the taps
+    int16_t history[BEAM_MICS][BEAM_HISTORY + BEAM_CHUNK];
+
+    // MVDR
+    bool adapt;          // false freezes the covariance (and the weights)
+    float smoothing;     // covariance forgetting factor per hop
+    float loading;       // diagonal loading relative to the mean mic power
+    float steer[BEAM_BINS][BEAM_MICS][2]; // look direction phase per bin, re/im
+    float r00[BEAM_BINS], r11[BEAM_BINS], r01_re[BEAM_BINS], r01_im[BEAM_BINS];
+    float input[BEAM_MICS][BEAM_FFT_SIZE]; // last frame, oldest first
+    float overlap[BEAM_FFT_SIZE];
+    float out[BEAM_HOP];                   // finished samples waiting to go
+    int fill;                              // new samples since the last frame
+    float window[BEAM_FFT_SIZE];
+    float twiddle[BEAM_FFT_SIZE / 2][2];
+    uint16_t bitrev[BEAM_FFT_SIZE];
+    float re[BEAM_FFT_SIZE], im[BEAM_FFT_SIZE];
+} beamformer_t;
+
+// Sets up a beamformer for two mics `spacing_mm` apart looking at
+// `steer_deg`. Returns false if the spacing needs more than BEAM_MAX_DELAY
+// samples of delay at this rate.
+bool beamformer_init(beamformer_t *bf, beam_mode_t mode, int sample_rate, float spacing_mm, float steer_deg);
+
+// Points the beam somewhere else (-90 to 90 degrees). Call from the task that
+// runs beamformer_process().
+void beamformer_steer(beamformer_t *bf, float steer_deg);
+
+// `frames` interleaved stereo frames (mic 0, mic 1) in, the beam out as mono.
+// `out` may be the same buffer as `in`.
+void beamformer_process(beamformer_t *bf, const int16_t *in, int16_t *out, size_t frames);
+
+#ifdef __cplusplus
+}
+#endif
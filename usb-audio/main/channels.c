@@ -0,0 +1,85 @@
+#include "channels.h"
+
+// The loops are kept simple and branch free with unit-stride stores: GCC
+// vectorises them on the host (the stride-2 loads become shuffles) and on
+// the S3 they compile to zero overhead loops with no per-sample branches.
+// Each kernel is instantiated for int16 (ACC is the wider type the sums are
+// done in) and int32 samples.
+#define CHANNELS_DEFINE(T, S, ACC)                                                                              \
+    void deinterleave2_##S(const T *__restrict in, T *__restrict left, T *__restrict right, size_t frames)      \
+    {                                                                                                           \
+        for (size_t i = 0; i < frames; i++) {                                                                   \
+            left[i] = in[2 * i];                                                                                \
+            right[i] = in[2 * i + 1];                                                                           \
+        }                                                                                                       \
+    }                                                                                                           \
+                                                                                                                \
+    void interleave2_##S(const T *__restrict left, const T *__restrict right, T *__restrict out, size_t frames) \
+    {                                                                                                           \
+        for (size_t i = 0; i < frames; i++) {                                                                   \
+            out[2 * i] = left[i];                                                                               \
+            out[2 * i + 1] = right[i];                                                                          \
+        }                                                                                                       \
+    }                                                                                                           \
+                                                                                                                \
+    void deinterleave_n_##S(const T *__restrict in, T *const *planes, size_t frames, int channels)              \
+    {                                                                                                           \
+        for (int c = 0; c < channels; c++) {                                                                    \
+            T *plane = planes[c];                                                                               \
+            for (size_t i = 0; i < frames; i++) {                                                               \
+                plane[i] = in[i * channels + c];                                                                \
+            }                                                                                                   \
+        }                                                                                                       \
+    }                                                                                                           \
+                                                                                                                \
+    void interleave_n_##S(const T *const *planes, T *__restrict out, size_t frames, int channels)               \
+    {                                                                                                           \
+        for (int c = 0; c < channels; c++) {                                                                    \
+            const T *plane = planes[c];                                                                         \
+            for (size_t i = 0; i < frames; i++) {                                                               \
+                out[i * channels + c] = plane[i];                                                               \
+            }                                                                                                   \
+        }                                                                                                       \
+    }                                                                                                           \
+                                                                                                                \
+    static void downmix2_restrict_##S(const T *__restrict in, T *__restrict out, size_t frames)                 \
+    {                                                                                                           \
+        for (size_t i = 0; i < frames; i++) {                                                                   \
+            out[i] = (T)(((ACC)in[2 * i] + in[2 * i + 1]) >> 1);                                                \
+        }                                                                                                       \
+    }                                                                                                           \
+                                                                                                                \
+    void downmix2_##S(const T *in, T *out, size_t frames)                                                       \
+    {                                                                                                           \
+        if (out + frames <= in || out >= in + 2 * frames) {                                                     \
+            downmix2_restrict_##S(in, out, frames);                                                             \
+            return;                                                                                             \
+        }                                                                                                       \
+        /* In place: go through a small buffer so the kernel still sees separate input and output. Output */  \
+        /* chunk k only overwrites input that earlier chunks have already read. */                             \
+        T tmp[64];                                                                                              \
+        for (size_t done = 0; done < frames; done += 64) {                                                      \
+            size_t n = frames - done < 64 ? frames - done : 64;                                                 \
+            downmix2_restrict_##S(in + 2 * done, tmp, n);                                                       \
+            memcpy(out + done, tmp, n * sizeof(T));                                                             \
+        }                                                                                                       \
+    }                                                                                                           \
+                                                                                                                \
+    void downmix_n_##S(const T *in, T *out, size_t frames, int channels)                                        \
+    {                                                                                                           \
+        for (size_t i = 0; i < frames; i++) {                                                                   \
+            ACC sum = 0;                                                                                        \
+            for (int c = 0; c < channels; c++) {                                                                \
+                sum += in[i * channels + c];                                                                    \
+            }                                                                                                   \
+            /* round down like the stereo kernel's shift */                                                     \
+            ACC mean = sum / channels;                                                                          \
+            if (sum < 0 && mean * channels != sum) {                                                            \
+                mean--;                                                                                         \
+            }                                                                                                   \
+            out[i] = (T)mean;                                                                                   \
+        }                                                                                                       \
+    }
+
+CHANNELS_DEFINE(int16_t, s16, int32_t)
+CHANNELS_DEFINE(int32_t, s32, int64_t)
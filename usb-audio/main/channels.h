@@ -0,0 +1,79 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Interleaving, deinterleaving and downmix kernels for int16 and int32 audio.
+//
+// UAC and the I2S DMA both carry interleaved frames (L R L R ...), while the
+// per-channel DSP (concealment, sidetone) works on one channel at a time. The
+// 1 and 2 channel cases have their own kernels and the inline wrappers below
+// pick one - the channel counts are compile time constants at every call
+// site in main.c, so the choice folds away. The DEINTERLEAVE(), INTERLEAVE()
+// and DOWNMIX() macros pick the sample type the same way.
+
+#define CHANNELS_DECLARE(T, S)                                                                                    \
+    /* Stereo: split L R pairs into two planes, and back */                                                      \
+    void deinterleave2_##S(const T *__restrict in, T *__restrict left, T *__restrict right, size_t frames);      \
+    void interleave2_##S(const T *__restrict left, const T *__restrict right, T *__restrict out, size_t frames); \
+    /* Any channel count */                                                                                      \
+    void deinterleave_n_##S(const T *__restrict in, T *const *planes, size_t frames, int channels);              \
+    void interleave_n_##S(const T *const *planes, T *__restrict out, size_t frames, int channels);               \
+    /* Stereo to mono, (L + R) / 2 rounded down - it can't clip. `out` may be `in` for an in place downmix. */   \
+    void downmix2_##S(const T *in, T *out, size_t frames);                                                       \
+    /* Any channel count, the average of all channels (in place is fine too) */                                  \
+    void downmix_n_##S(const T *in, T *out, size_t frames, int channels);                                        \
+                                                                                                                 \
+    static inline void deinterleave_##S(const T *in, T *const *planes, size_t frames, int channels)              \
+    {                                                                                                            \
+        if (channels == 1) {                                                                                     \
+            memcpy(planes[0], in, frames * sizeof(T));                                                           \
+        } else if (channels == 2) {                                                                              \
+            deinterleave2_##S(in, planes[0], planes[1], frames);                                                 \
+        } else {                                                                                                 \
+            deinterleave_n_##S(in, planes, frames, channels);                                                    \
+        }                                                                                                        \
+    }                                                                                                            \
+                                                                                                                 \
+    static inline void interleave_##S(const T *const *planes, T *out, size_t frames, int channels)               \
+    {                                                                                                            \
+        if (channels == 1) {                                                                                     \
+            memcpy(out, planes[0], frames * sizeof(T));                                                          \
+        } else if (channels == 2) {                                                                              \
+            interleave2_##S(planes[0], planes[1], out, frames);                                                  \
+        } else {                                                                                                 \
+            interleave_n_##S(planes, out, frames, channels);                                                     \
+        }                                                                                                        \
+    }                                                                                                            \
+                                                                                                                 \
+    static inline void downmix_##S(const T *in, T *out, size_t frames, int channels)                             \
+    {                                                                                                            \
+        if (channels == 1) {                                                                                     \
+            memmove(out, in, frames * sizeof(T));                                                                \
+        } else if (channels == 2) {                                                                              \
+            downmix2_##S(in, out, frames);                                                                       \
+        } else {                                                                                                 \
+            downmix_n_##S(in, out, frames, channels);                                                            \
+        }                                                                                                        \
+    }
+
+CHANNELS_DECLARE(int16_t, s16)
+CHANNELS_DECLARE(int32_t, s32)
+
+#ifndef __cplusplus
+#define DEINTERLEAVE(in, planes, frames, channels) \
+    _Generic((planes), int16_t **: deinterleave_s16, default: deinterleave_s32)(in, planes, frames, channels)
+#define INTERLEAVE(planes, out, frames, channels) \
+    _Generic((out), int16_t *: interleave_s16, default: interleave_s32)(planes, out, frames, channels)
+#define DOWNMIX(in, out, frames, channels) \
+    _Generic((out), int16_t *: downmix_s16, default: downmix_s32)(in, out, frames, channels)
+#endif
+
+#ifdef __cplusplus
+}
+#endif
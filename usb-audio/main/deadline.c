@@ -0,0 +1,113 @@
+#include "deadline.h"
+
+#include <stdio.h>
+#include <string.h>
+
+void deadline_init(deadline_monitor_t *m, uint32_t interval_us)
+{
+    memset(m, 0, sizeof(*m));
+    m->interval_us = interval_us;
+    m->min_slack_us = INT32_MAX;
+}
+
+int deadline_bucket(int32_t slack_us)
+{
+    if (slack_us < 0) {
+        return 0;
+    }
+    int bucket = 1;
+    while (bucket < DEADLINE_HIST_BUCKETS - 1 && slack_us >= ((int32_t)1 << (bucket + DEADLINE_HIST_SHIFT))) {
+        bucket++;
+    }
+    return bucket;
+}
+
+int32_t deadline_bucket_limit(int bucket)
+{
+    if (bucket <= 0) {
+        return 0;
+    }
+    if (bucket >= DEADLINE_HIST_BUCKETS - 1) {
+        return INT32_MAX;
+    }
+    return (int32_t)1 << (bucket + DEADLINE_HIST_SHIFT);
+}
+
+void deadline_begin(deadline_monitor_t *m, int64_t now_us, uint32_t run_us, uint32_t fill)
+{
+    // due one interval after the last call started. Measuring from the last
+    // entry rather than accumulating intervals keeps the USB and ESP clocks
+    // drifting apart from looking like ever growing lateness.
+    int64_t due = m->calls ? m->entered_us + m->interval_us : now_us;
+    m->entered_us = now_us;
+    m->due_us = due;
+    m->deadline_us = (now_us < due ? now_us : due) + m->interval_us;
+    m->entered_run_us = run_us;
+    m->entered_fill = fill;
+}
+
+int32_t deadline_end(deadline_monitor_t *m, int64_t now_us, uint32_t run_us, int core)
+{
+    int64_t slack = m->deadline_us - now_us;
+    int32_t slack_us = slack < INT32_MIN ? INT32_MIN : slack > INT32_MAX ? INT32_MAX : (int32_t)slack;
+
+    m->calls++;
+    m->misses += slack_us < 0;
+    m->histogram[deadline_bucket(slack_us)]++;
+    if (slack_us < m->min_slack_us) {
+        m->min_slack_us = slack_us;
+    }
+
+    uint32_t epoch = m->epoch;
+    if (m->seen_epoch != epoch) {
+        m->seen_epoch = epoch;
+        m->worst_count = 0;
+    }
+    // insertion into the short sorted list, dropping the one with the most
+    // slack when it is full
+    if (m->worst_count < DEADLINE_WORST || slack_us < m->worst[DEADLINE_WORST - 1].slack_us) {
+        uint32_t i = m->worst_count < DEADLINE_WORST ? m->worst_count++ : DEADLINE_WORST - 1;
+        for (; i > 0 && m->worst[i - 1].slack_us > slack_us; i--) {
+            m->worst[i] = m->worst[i - 1];
+        }
+        uint32_t duration = (uint32_t)(now_us - m->entered_us);
+        uint32_t ran = run_us - m->entered_run_us;
+        m->worst[i] = (deadline_event_t){
+            .at_us = (uint32_t)m->entered_us,
+            .slack_us = slack_us,
+            .duration_us = duration,
+            .late_us = m->entered_us > m->due_us ? (uint32_t)(m->entered_us - m->due_us) : 0,
+            // without run time stats both counters are zero
+            .preempted_us = run_us || m->entered_run_us ? (ran < duration ? duration - ran : 0) : 0,
+            .fill = m->entered_fill,
+            .core = (uint8_t)core,
+        };
+    }
+    return slack_us;
+}
+
+void deadline_print(const char *name, const deadline_monitor_t *m)
+{
+    printf("  %-12s %u calls, %u missed, min slack %d us of %u\n", name, (unsigned)m->calls,
+           (unsigned)m->misses, m->calls ? (int)m->min_slack_us : 0, (unsigned)m->interval_us);
+    printf("    slack     ");
+    for (int b = 0; b < DEADLINE_HIST_BUCKETS; b++) {
+        if (!m->histogram[b]) {
+            continue;
+        }
+        if (b == 0) {
+            printf(" missed:%u", (unsigned)m->histogram[b]);
+        } else if (b == DEADLINE_HIST_BUCKETS - 1) {
+            printf(" more:%u", (unsigned)m->histogram[b]);
+        } else {
+            printf(" <%d:%u", (int)deadline_bucket_limit(b), (unsigned)m->histogram[b]);
+        }
+    }
+    printf("\n");
+    for (uint32_t i = 0; i < m->worst_count && i < DEADLINE_WORST; i++) {
+        const deadline_event_t *e = &m->worst[i];
+        printf("    worst %u   at %u us: slack %d, took %u, late %u, preempted %u, fill %u, core %u\n", (unsigned)i,
+               (unsigned)e->at_us, (int)e->slack_us, (unsigned)e->duration_us, (unsigned)e->late_us,
+               (unsigned)e->preempted_us, (unsigned)e->fill, (unsigned)e->core);
+    }
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Deadline monitor for the audio callbacks and tasks.
+//
+// Each monitored piece of code is timestamped on entry and exit. Its deadline
+// is one service interval after it was due (or after it was entered, if that
+// was earlier), so a call that starts late has less slack even if it runs
+// quickly - which is what matters for the audio. The slack at exit goes into
+// a log2 histogram, and the calls with the least slack are kept with some
+// context (how late they started, how long they were preempted for, the
+// buffer fill and core) so priorities and affinity can be tuned from data.
+//
+// Like telemetry.h, the monitored task is the only writer. A reporter reads
+// a monitor and bumps `epoch` to start a new window for the worst list; the
+// histogram and counters run from boot.
+
+// histogram bucket 0 is missed deadlines, bucket k holds slack below
+// 2^(k + DEADLINE_HIST_SHIFT) us (the last one catches everything above)
+#define DEADLINE_HIST_BUCKETS 16
+#define DEADLINE_HIST_SHIFT 5
+// worst offenders kept per window
+#define DEADLINE_WORST 4
+
+typedef struct {
+    uint32_t at_us;        // entry time (low 32 bits of esp_timer)
+    int32_t slack_us;      // deadline - exit, negative if it was missed
+    uint32_t duration_us;  // entry to exit
+    uint32_t late_us;      // how long after it was due it was entered
+    uint32_t preempted_us; // time in between that the task wasn't running
+    uint32_t fill;         // caller's buffer level at entry, bytes
+    uint8_t core;
+} deadline_event_t;
+
+typedef struct {
+    uint32_t interval_us;
+    // counters since boot
+    uint32_t calls;
+    uint32_t misses;
+    int32_t min_slack_us;
+    uint32_t histogram[DEADLINE_HIST_BUCKETS];
+    // lowest slack first, `worst_count` valid
+    deadline_event_t worst[DEADLINE_WORST];
+    uint32_t worst_count;
+    volatile uint32_t epoch;
+    uint32_t seen_epoch;
+    // the call in progress
+    int64_t entered_us;
+    int64_t due_us;
+    int64_t deadline_us;
+    uint32_t entered_run_us;
+    uint32_t entered_fill;
+} deadline_monitor_t;
+
+void deadline_init(deadline_monitor_t *m, uint32_t interval_us);
+
+// Call on entry. `run_us` is the calling task's run time counter (0 if run
+// time stats are off) and `fill` whatever buffer level is worth recording.
+// Sets `deadline_us` from the interval; a caller with a better idea of its
+// deadline can overwrite it before deadline_end().
+void deadline_begin(deadline_monitor_t *m, int64_t now_us, uint32_t run_us, uint32_t fill);
+// Call on exit. Returns the slack.
+int32_t deadline_end(deadline_monitor_t *m, int64_t now_us, uint32_t run_us, int core);
+
+// Bucket index for a slack value
+int deadline_bucket(int32_t slack_us);
+// Upper edge of a histogram bucket in us (INT32_MAX for the last)
+int32_t deadline_bucket_limit(int bucket);
+
+// Prints a monitor's histogram and worst offenders
+void deadline_print(const char *name, const deadline_monitor_t *m);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,587 @@
+#include "dsp_chain.h"
+
+#include <math.h>
+#include <string.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// ====================== Descriptor reading ======================
+static inline uint16_t le_read16(const uint8_t *p)
+{
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static inline uint32_t le_read32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline float le_read_f32(const uint8_t *p)
+{
+    uint32_t bits = le_read32(p);
+    float f;
+    memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+uint16_t dsp_chain_crc16(const uint8_t *data, size_t len)
+{
+    uint16_t crc = 0xFFFF;
+    for (size_t i = 0; i < len; ++i) {
+        crc ^= (uint16_t)data[i] << 8;
+        for (int b = 0; b < 8; ++b) {
+            if (crc & 0x8000) {
+                crc = (crc << 1) ^ 0x1021;
+            } else {
+                crc <<= 1;
+            }
+        }
+    }
+    return crc;
+}
+
+// ====================== Arena ======================
+typedef struct {
+    uint8_t *base;
+    size_t len;
+    size_t used;
+} arena_t;
+
+static void *arena_alloc(arena_t *arena, size_t bytes)
+{
+    size_t start = (arena->used + 7) & ~(size_t)7;
+    if (start + bytes > arena->len) {
+        return NULL;
+    }
+    arena->used = start + bytes;
+    memset(arena->base + start, 0, bytes);
+    return arena->base + start;
+}
+
+static inline bool in_mask(uint8_t mask, int channel)
+{
+    return mask == 0 || (mask >> channel) & 1;
+}
+
+// ====================== Stages ======================
+// Every stage gets the whole block; the loops inside are the only per
+// sample work.
+
+typedef struct {
+    float gain;
+    uint8_t mask;
+    int channels;
+} gain_state_t;
+
+static void gain_process(void *state, float *const *planes, size_t frames)
+{
+    const gain_state_t *s = state;
+    for (int c = 0; c < s->channels; c++) {
+        if (!in_mask(s->mask, c)) {
+            continue;
+        }
+        float *x = planes[c];
+        for (size_t i = 0; i < frames; i++) {
+            x[i] *= s->gain;
+        }
+    }
+}
+
+typedef struct {
+    float b0, b1, b2, a1, a2;
+} biquad_t;
+
+// Transposed direct form II - two state values per channel
+static void biquad_run(const biquad_t *q, float *z, float *x, size_t frames)
+{
+    float z1 = z[0], z2 = z[1];
+    for (size_t i = 0; i < frames; i++) {
+        float in = x[i];
+        float out = q->b0 * in + z1;
+        z1 = q->b1 * in - q->a1 * out + z2;
+        z2 = q->b2 * in - q->a2 * out;
+        x[i] = out;
+    }
+    // a filter left ringing into silence decays into denormals, which are
+    // very slow on some FPUs - cut the tail off once it's far below audible
+    z[0] = fabsf(z1) < 1e-15f ? 0 : z1;
+    z[1] = fabsf(z2) < 1e-15f ? 0 : z2;
+}
+
+// RBJ audio EQ cookbook coefficients
+static biquad_t biquad_design(dsp_eq_shape_t shape, float freq, float q, float gain_db, int sample_rate)
+{
+    double a = pow(10, gain_db / 40.0);
+    double w0 = 2 * M_PI * freq / sample_rate;
+    double cs = cos(w0);
+    double alpha = sin(w0) / (2 * q);
+    double sa = 2 * sqrt(a) * alpha;
+    double b0, b1, b2, a0, a1, a2;
+    switch (shape) {
+    case DSP_EQ_LOW_SHELF:
+        b0 = a * ((a + 1) - (a - 1) * cs + sa);
+        b1 = 2 * a * ((a - 1) - (a + 1) * cs);
+        b2 = a * ((a + 1) - (a - 1) * cs - sa);
+        a0 = (a + 1) + (a - 1) * cs + sa;
+        a1 = -2 * ((a - 1) + (a + 1) * cs);
+        a2 = (a + 1) + (a - 1) * cs - sa;
+        break;
+    case DSP_EQ_HIGH_SHELF:
+        b0 = a * ((a + 1) + (a - 1) * cs + sa);
+        b1 = -2 * a * ((a - 1) + (a + 1) * cs);
+        b2 = a * ((a + 1) + (a - 1) * cs - sa);
+        a0 = (a + 1) - (a - 1) * cs + sa;
+        a1 = 2 * ((a - 1) - (a + 1) * cs);
+        a2 = (a + 1) - (a - 1) * cs - sa;
+        break;
+    case DSP_EQ_LOW_PASS:
+        b0 = (1 - cs) / 2;
+        b1 = 1 - cs;
+        b2 = (1 - cs) / 2;
+        a0 = 1 + alpha;
+        a1 = -2 * cs;
+        a2 = 1 - alpha;
+        break;
+    case DSP_EQ_HIGH_PASS:
+        b0 = (1 + cs) / 2;
+        b1 = -(1 + cs);
+        b2 = (1 + cs) / 2;
+        a0 = 1 + alpha;
+        a1 = -2 * cs;
+        a2 = 1 - alpha;
+        break;
+    case DSP_EQ_PEAK:
+    default:
+        b0 = 1 + alpha * a;
+        b1 = -2 * cs;
+        b2 = 1 - alpha * a;
+        a0 = 1 + alpha / a;
+        a1 = -2 * cs;
+        a2 = 1 - alpha / a;
+        break;
+    }
+    return (biquad_t){(float)(b0 / a0), (float)(b1 / a0), (float)(b2 / a0), (float)(a1 / a0), (float)(a2 / a0)};
+}
+
+typedef struct {
+    biquad_t q;
+    uint8_t mask;
+    int channels;
+    float z[DSP_CHAIN_MAX_CHANNELS][2];
+} eq_state_t;
+
+static void eq_process(void *state, float *const *planes, size_t frames)
+{
+    eq_state_t *s = state;
+    for (int c = 0; c < s->channels; c++) {
+        if (in_mask(s->mask, c)) {
+            biquad_run(&s->q, s->z[c], planes[c], frames);
+        }
+    }
+}
+
+// Feed forward peak limiter: the gain drops towards threshold / peak at the
+// attack rate and recovers at the release rate. No look ahead, so very fast
+// transients can overshoot by a little until the gain catches up.
+typedef struct {
+    float threshold;
+    float attack;
+    float release;
+    float gain;
+    uint8_t mask;
+    int channels;
+} limiter_state_t;
+
+static void limiter_process(void *state, float *const *planes, size_t frames)
+{
+    limiter_state_t *s = state;
+    float g = s->gain;
+    for (size_t i = 0; i < frames; i++) {
+        float peak = 0;
+        for (int c = 0; c < s->channels; c++) {
+            float v = fabsf(planes[c][i]);
+            if (in_mask(s->mask, c) && v > peak) {
+                peak = v;
+            }
+        }
+        float target = peak > s->threshold ? s->threshold / peak : 1.0f;
+        g += (target < g ? s->attack : s->release) * (target - g);
+        for (int c = 0; c < s->channels; c++) {
+            if (in_mask(s->mask, c)) {
+                planes[c][i] *= g;
+            }
+        }
+    }
+    s->gain = g;
+}
+
+// Linkwitz-Riley 4th order: two Butterworth sections each way. The two
+// outputs stay in phase and sum flat.
+#define BUTTERWORTH_Q 0.70710678f
+typedef struct {
+    biquad_t lp;
+    biquad_t hp;
+    float z_lp[2][2];
+    float z_hp[2][2];
+} crossover_state_t;
+
+static void crossover_process(void *state, float *const *planes, size_t frames)
+{
+    crossover_state_t *s = state;
+    float *low = planes[0];
+    float *high = planes[1];
+    for (size_t i = 0; i < frames; i++) {
+        float mono = 0.5f * (low[i] + high[i]);
+        low[i] = mono;
+        high[i] = mono;
+    }
+    biquad_run(&s->lp, s->z_lp[0], low, frames);
+    biquad_run(&s->lp, s->z_lp[1], low, frames);
+    biquad_run(&s->hp, s->z_hp[0], high, frames);
+    biquad_run(&s->hp, s->z_hp[1], high, frames);
+}
+
+typedef struct {
+    uint32_t delay;
+    uint32_t pos;
+    uint8_t mask;
+    int channels;
+    float *ring[DSP_CHAIN_MAX_CHANNELS];
+} delay_state_t;
+
+static void delay_process(void *state, float *const *planes, size_t frames)
+{
+    delay_state_t *s = state;
+    uint32_t pos = s->pos;
+    for (int c = 0; c < s->channels; c++) {
+        if (!s->ring[c]) {
+            continue;
+        }
+        float *ring = s->ring[c];
+        float *x = planes[c];
+        pos = s->pos;
+        for (size_t i = 0; i < frames; i++) {
+            float out = ring[pos];
+            ring[pos] = x[i];
+            x[i] = out;
+            if (++pos == s->delay) {
+                pos = 0;
+            }
+        }
+    }
+    s->pos = pos;
+}
+
+// ====================== Building ======================
+static float db_to_gain(float db)
+{
+    return powf(10.0f, db / 20.0f);
+}
+
+// Per sample smoothing coefficient for a time constant
+static float time_coefficient(float ms, int sample_rate)
+{
+    return 1.0f - expf(-1000.0f / (ms * sample_rate));
+}
+
+static bool in_range(float v, float lo, float hi)
+{
+    // also false for NaN
+    return v >= lo && v <= hi;
+}
+
+// Checks one stage's parameters and sets it up in the arena
+static dsp_chain_err_t build_stage(dsp_chain_t *chain, arena_t *arena, uint8_t type, uint8_t mask,
+                                   const uint8_t *p, uint16_t param_len)
+{
+    dsp_stage_t *stage = &chain->stages[chain->stage_count];
+    const float nyquist = chain->sample_rate / 2.0f;
+    size_t before = arena->used;
+    if (mask >> chain->channels) {
+        return DSP_CHAIN_ERR_PARAM;
+    }
+    switch (type) {
+    case DSP_STAGE_GAIN: {
+        if (param_len != 4 || !in_range(le_read_f32(p), -80, 24)) {
+            return param_len != 4 ? DSP_CHAIN_ERR_LENGTH : DSP_CHAIN_ERR_PARAM;
+        }
+        gain_state_t *s = arena_alloc(arena, sizeof(*s));
+        if (!s) {
+            return DSP_CHAIN_ERR_ARENA;
+        }
+        *s = (gain_state_t){db_to_gain(le_read_f32(p)), mask, chain->channels};
+        stage->process = gain_process;
+        stage->state = s;
+        break;
+    }
+    case DSP_STAGE_EQ: {
+        if (param_len != 13) {
+            return DSP_CHAIN_ERR_LENGTH;
+        }
+        uint8_t shape = p[0];
+        float freq = le_read_f32(p + 1), q = le_read_f32(p + 5), gain_db = le_read_f32(p + 9);
+        if (shape > DSP_EQ_HIGH_PASS || !in_range(freq, 10, nyquist * 0.95f) || !in_range(q, 0.1f, 20) ||
+            !in_range(gain_db, -40, 24)) {
+            return DSP_CHAIN_ERR_PARAM;
+        }
+        eq_state_t *s = arena_alloc(arena, sizeof(*s));
+        if (!s) {
+            return DSP_CHAIN_ERR_ARENA;
+        }
+        s->q = biquad_design((dsp_eq_shape_t)shape, freq, q, gain_db, chain->sample_rate);
+        s->mask = mask;
+        s->channels = chain->channels;
+        stage->process = eq_process;
+        stage->state = s;
+        break;
+    }
+    case DSP_STAGE_LIMITER: {
+        if (param_len != 12) {
+            return DSP_CHAIN_ERR_LENGTH;
+        }
+        float threshold_db = le_read_f32(p), attack_ms = le_read_f32(p + 4), release_ms = le_read_f32(p + 8);
+        if (!in_range(threshold_db, -60, 0) || !in_range(attack_ms, 0.01f, 1000) ||
+            !in_range(release_ms, 1, 5000)) {
+            return DSP_CHAIN_ERR_PARAM;
+        }
+        limiter_state_t *s = arena_alloc(arena, sizeof(*s));
+        if (!s) {
+            return DSP_CHAIN_ERR_ARENA;
+        }
+        *s = (limiter_state_t){db_to_gain(threshold_db), time_coefficient(attack_ms, chain->sample_rate),
+                               time_coefficient(release_ms, chain->sample_rate), 1.0f, mask, chain->channels};
+        stage->process = limiter_process;
+        stage->state = s;
+        break;
+    }
+    case DSP_STAGE_CROSSOVER: {
+        if (param_len != 4) {
+            return DSP_CHAIN_ERR_LENGTH;
+        }
+        float freq = le_read_f32(p);
+        if (chain->channels != 2 || !in_range(freq, 20, nyquist * 0.9f)) {
+            return DSP_CHAIN_ERR_PARAM;
+        }
+        crossover_state_t *s = arena_alloc(arena, sizeof(*s));
+        if (!s) {
+            return DSP_CHAIN_ERR_ARENA;
+        }
+        s->lp = biquad_design(DSP_EQ_LOW_PASS, freq, BUTTERWORTH_Q, 0, chain->sample_rate);
+        s->hp = biquad_design(DSP_EQ_HIGH_PASS, freq, BUTTERWORTH_Q, 0, chain->sample_rate);
+        stage->process = crossover_process;
+        stage->state = s;
+        break;
+    }
+    case DSP_STAGE_DELAY: {
+        if (param_len != 4) {
+            return DSP_CHAIN_ERR_LENGTH;
+        }
+        uint32_t delay = le_read32(p);
+        if (delay == 0 || delay > DSP_CHAIN_MAX_DELAY) {
+            return DSP_CHAIN_ERR_PARAM;
+        }
+        delay_state_t *s = arena_alloc(arena, sizeof(*s));
+        if (!s) {
+            return DSP_CHAIN_ERR_ARENA;
+        }
+        s->delay = delay;
+        s->mask = mask;
+        s->channels = chain->channels;
+        for (int c = 0; c < chain->channels; c++) {
+            if (in_mask(mask, c) && !(s->ring[c] = arena_alloc(arena, delay * sizeof(float)))) {
+                return DSP_CHAIN_ERR_ARENA;
+            }
+        }
+        stage->process = delay_process;
+        stage->state = s;
+        break;
+    }
+    default:
+        return DSP_CHAIN_ERR_TYPE;
+    }
+    stage->type = type;
+    stage->state_bytes = arena->used - before;
+    chain->stage_count++;
+    return DSP_CHAIN_OK;
+}
+
+static dsp_chain_err_t check_header(const uint8_t *desc, size_t len, size_t *offset)
+{
+    if (len < DSP_CHAIN_HEADER_LEN + 2) {
+        return DSP_CHAIN_ERR_LENGTH;
+    }
+    if (memcmp(desc, DSP_CHAIN_MAGIC, 4) != 0) {
+        return DSP_CHAIN_ERR_MAGIC;
+    }
+    *offset = 4;
+    if (desc[4] != DSP_CHAIN_VERSION) {
+        return DSP_CHAIN_ERR_VERSION;
+    }
+    *offset = 5;
+    if (desc[5] > DSP_CHAIN_MAX_STAGES) {
+        return DSP_CHAIN_ERR_STAGES;
+    }
+    *offset = 6;
+    if (le_read16(desc + 6) != len) {
+        return DSP_CHAIN_ERR_LENGTH;
+    }
+    *offset = len - 2;
+    if (dsp_chain_crc16(desc, len - 2) != le_read16(desc + len - 2)) {
+        return DSP_CHAIN_ERR_CRC;
+    }
+    return DSP_CHAIN_OK;
+}
+
+void dsp_chain_clear(dsp_chain_t *chain)
+{
+    chain->stage_count = 0;
+    chain->arena_used = 0;
+}
+
+dsp_chain_err_t dsp_chain_build(dsp_chain_t *chain, const uint8_t *desc, size_t len, int channels, int sample_rate,
+                                size_t max_frames, void *arena_mem, size_t arena_len, size_t *error_offset)
+{
+    memset(chain, 0, sizeof(*chain));
+    chain->channels = channels;
+    chain->sample_rate = sample_rate;
+    chain->max_frames = max_frames;
+
+    size_t offset = 0;
+    arena_t arena = {arena_mem, arena_len, 0};
+    dsp_chain_err_t err = channels < 1 || channels > DSP_CHAIN_MAX_CHANNELS ? DSP_CHAIN_ERR_PARAM
+                                                                              : check_header(desc, len, &offset);
+
+    // the planes the stages work on come first
+    for (int c = 0; err == DSP_CHAIN_OK && c < channels; c++) {
+        if (!(chain->planes[c] = arena_alloc(&arena, max_frames * sizeof(float)))) {
+            err = DSP_CHAIN_ERR_ARENA;
+        }
+    }
+
+    const size_t end = len - 2;
+    if (err == DSP_CHAIN_OK) {
+        offset = DSP_CHAIN_HEADER_LEN;
+    }
+    for (int i = 0; err == DSP_CHAIN_OK && i < desc[5]; i++) {
+        if (offset + DSP_CHAIN_STAGE_HEADER_LEN > end) {
+            err = DSP_CHAIN_ERR_LENGTH;
+            break;
+        }
+        uint16_t param_len = le_read16(desc + offset + 2);
+        if (offset + DSP_CHAIN_STAGE_HEADER_LEN + param_len > end) {
+            err = DSP_CHAIN_ERR_LENGTH;
+            break;
+        }
+        err = build_stage(chain, &arena, desc[offset], desc[offset + 1], desc + offset + DSP_CHAIN_STAGE_HEADER_LEN,
+                          param_len);
+        if (err == DSP_CHAIN_OK) {
+            offset += DSP_CHAIN_STAGE_HEADER_LEN + param_len;
+        }
+    }
+    if (err == DSP_CHAIN_OK && offset != end) {
+        // bytes after the last stage
+        err = DSP_CHAIN_ERR_LENGTH;
+    }
+
+    if (error_offset) {
+        *error_offset = offset;
+    }
+    if (err != DSP_CHAIN_OK) {
+        dsp_chain_clear(chain);
+        return err;
+    }
+    chain->arena_used = arena.used;
+    return DSP_CHAIN_OK;
+}
+
+// ====================== Processing ======================
+static void run_stages(const dsp_chain_t *chain, size_t frames)
+{
+    for (size_t i = 0; i < chain->stage_count; i++) {
+        chain->stages[i].process(chain->stages[i].state, chain->planes, frames);
+    }
+}
+
+void dsp_chain_process_s16(const dsp_chain_t *chain, int16_t *samples, size_t frames)
+{
+    if (chain->stage_count == 0) {
+        return;
+    }
+    const int channels = chain->channels;
+    for (int c = 0; c < channels; c++) {
+        float *x = chain->planes[c];
+        for (size_t i = 0; i < frames; i++) {
+            x[i] = samples[i * channels + c] * (1.0f / 32768.0f);
+        }
+    }
+    run_stages(chain, frames);
+    for (int c = 0; c < channels; c++) {
+        const float *x = chain->planes[c];
+        for (size_t i = 0; i < frames; i++) {
+            float v = x[i] * 32768.0f;
+            v = v > 32767.0f ? 32767.0f : v < -32768.0f ? -32768.0f : v;
+            samples[i * channels + c] = (int16_t)lrintf(v);
+        }
+    }
+}
+
+void dsp_chain_process_s32(const dsp_chain_t *chain, int32_t *samples, size_t frames)
+{
+    if (chain->stage_count == 0) {
+        return;
+    }
+    const int channels = chain->channels;
+    for (int c = 0; c < channels; c++) {
+        float *x = chain->planes[c];
+        for (size_t i = 0; i < frames; i++) {
+            x[i] = samples[i * channels + c] * (1.0f / 2147483648.0f);
+        }
+    }
+    run_stages(chain, frames);
+    for (int c = 0; c < channels; c++) {
+        const float *x = chain->planes[c];
+        for (size_t i = 0; i < frames; i++) {
+            // the largest float below 2^31
+            float v = x[i] * 2147483648.0f;
+            v = v > 2147483520.0f ? 2147483520.0f : v < -2147483648.0f ? -2147483648.0f : v;
+            samples[i * channels + c] = (int32_t)lrintf(v);
+        }
+    }
+}
+
+// ====================== Names ======================
+const char *dsp_chain_err_str(dsp_chain_err_t err)
+{
+    switch (err) {
+    case DSP_CHAIN_OK: return "ok";
+    case DSP_CHAIN_ERR_MAGIC: return "not a DSP chain descriptor";
+    case DSP_CHAIN_ERR_VERSION: return "unsupported descriptor version";
+    case DSP_CHAIN_ERR_LENGTH: return "truncated or inconsistent lengths";
+    case DSP_CHAIN_ERR_CRC: return "CRC mismatch";
+    case DSP_CHAIN_ERR_STAGES: return "too many stages";
+    case DSP_CHAIN_ERR_TYPE: return "unknown stage type";
+    case DSP_CHAIN_ERR_PARAM: return "parameter out of range";
+    case DSP_CHAIN_ERR_ARENA: return "state doesn't fit in the arena";
+    }
+    return "?";
+}
+
+const char *dsp_stage_name(uint8_t type)
+{
+    switch (type) {
+    case DSP_STAGE_GAIN: return "gain";
+    case DSP_STAGE_EQ: return "eq";
+    case DSP_STAGE_LIMITER: return "limiter";
+    case DSP_STAGE_CROSSOVER: return "crossover";
+    case DSP_STAGE_DELAY: return "delay";
+    }
+    return "?";
+}
+
+const char *dsp_eq_shape_name(uint8_t shape)
+{
+    static const char *const names[] = {"peak", "lowshelf", "highshelf", "lowpass", "highpass"};
+    return shape < sizeof(names) / sizeof(names[0]) ? names[shape] : "?";
+}
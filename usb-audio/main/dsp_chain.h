@@ -0,0 +1,125 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Speaker DSP chain built at runtime from a compact binary descriptor.
+//
+// The descriptor lists processing stages - gain, biquad EQ, limiter, two way
+// crossover, delay - with their parameters. Building a chain checks it,
+// works out filter coefficients and carves every stage's state out of an
+// arena the caller owns, so nothing is allocated while audio runs. Processing
+// converts a block to float planes once, calls each stage once for the whole
+// block and converts back with saturation.
+//
+// Descriptor layout, little-endian, floats are IEEE 754:
+//
+// [ "DSPC" ][u8 version][u8 stage count][u16 total length]
+// stage: [u8 type][u8 channel mask][u16 param length][params]
+// ...
+// [u16 crc16-ccitt over everything before it]
+//
+// A channel mask of 0 means every channel. Parameters per type:
+//   DSP_STAGE_GAIN       f32 gain dB
+//   DSP_STAGE_EQ         u8 shape (dsp_eq_shape_t), f32 Hz, f32 Q, f32 gain dB
+//   DSP_STAGE_LIMITER    f32 threshold dB, f32 attack ms, f32 release ms
+//                        (the masked channels share one gain so the image
+//                        doesn't move)
+//   DSP_STAGE_CROSSOVER  f32 Hz - needs two channels: their sum is split with
+//                        4th order Linkwitz-Riley filters, lows to channel 0
+//                        and highs to channel 1 (woofer and tweeter amps)
+//   DSP_STAGE_DELAY      u32 samples
+
+#define DSP_CHAIN_MAGIC "DSPC"
+#define DSP_CHAIN_VERSION 1
+#define DSP_CHAIN_HEADER_LEN 8
+#define DSP_CHAIN_STAGE_HEADER_LEN 4
+#define DSP_CHAIN_MAX_STAGES 16
+#define DSP_CHAIN_MAX_CHANNELS 2
+#define DSP_CHAIN_MAX_DESCRIPTOR 512
+#define DSP_CHAIN_MAX_DELAY 48000
+
+typedef enum {
+    DSP_STAGE_GAIN = 1,
+    DSP_STAGE_EQ = 2,
+    DSP_STAGE_LIMITER = 3,
+    DSP_STAGE_CROSSOVER = 4,
+    DSP_STAGE_DELAY = 5,
+} dsp_stage_type_t;
+
+typedef enum {
+    DSP_EQ_PEAK = 0,
+    DSP_EQ_LOW_SHELF = 1,
+    DSP_EQ_HIGH_SHELF = 2,
+    DSP_EQ_LOW_PASS = 3,
+    DSP_EQ_HIGH_PASS = 4,
+} dsp_eq_shape_t;
+
+typedef enum {
+    DSP_CHAIN_OK = 0,
+    DSP_CHAIN_ERR_MAGIC,      // not a descriptor
+    DSP_CHAIN_ERR_VERSION,    // a descriptor from a newer tool
+    DSP_CHAIN_ERR_LENGTH,     // truncated, or the lengths don't add up
+    DSP_CHAIN_ERR_CRC,        // corrupted
+    DSP_CHAIN_ERR_STAGES,     // more than DSP_CHAIN_MAX_STAGES
+    DSP_CHAIN_ERR_TYPE,       // unknown stage type
+    DSP_CHAIN_ERR_PARAM,      // parameter out of range for this rate/channel count
+    DSP_CHAIN_ERR_ARENA,      // the stages' state doesn't fit in the arena
+} dsp_chain_err_t;
+
+// One stage's work on a whole block of float planes
+typedef void (*dsp_stage_fn)(void *state, float *const *planes, size_t frames);
+
+typedef struct {
+    dsp_stage_fn process;
+    void *state;
+    uint8_t type;
+    size_t state_bytes;
+} dsp_stage_t;
+
+typedef struct {
+    int channels;
+    int sample_rate;
+    size_t max_frames;
+    size_t stage_count;
+    dsp_stage_t stages[DSP_CHAIN_MAX_STAGES];
+    float *planes[DSP_CHAIN_MAX_CHANNELS];
+    size_t arena_used;
+} dsp_chain_t;
+
+// Builds `chain` from a descriptor for blocks of up to `max_frames` frames.
+// All state, including the float planes, comes from `arena`. On failure the
+// chain is left empty (a passthrough) and `error_offset`, if given, is set to
+// the descriptor byte the problem was found at.
+dsp_chain_err_t dsp_chain_build(dsp_chain_t *chain, const uint8_t *desc, size_t len, int channels, int sample_rate,
+                                size_t max_frames, void *arena, size_t arena_len, size_t *error_offset);
+
+// An empty chain - processing leaves the audio alone
+void dsp_chain_clear(dsp_chain_t *chain);
+
+// Runs the chain in place over `frames` interleaved frames (at most
+// max_frames). An empty chain returns straight away.
+void dsp_chain_process_s16(const dsp_chain_t *chain, int16_t *samples, size_t frames);
+void dsp_chain_process_s32(const dsp_chain_t *chain, int32_t *samples, size_t frames);
+
+#ifndef __cplusplus
+#define DSP_CHAIN_PROCESS(chain, samples, frames) \
+    _Generic((samples), int16_t *: dsp_chain_process_s16, default: dsp_chain_process_s32)(chain, samples, frames)
+#endif
+
+const char *dsp_chain_err_str(dsp_chain_err_t err);
+const char *dsp_stage_name(uint8_t type);
+const char *dsp_eq_shape_name(uint8_t shape);
+
+// CRC used to seal descriptors (CRC-16/CCITT, the same as the telemetry
+// packets)
+uint16_t dsp_chain_crc16(const uint8_t *data, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,151 @@
+#include "format.h"
+
+#include <math.h>
+
+// Every kernel is the same loop: treat the input as Q31 (16 bit samples are
+// shifted up 16), multiply by the Q16 gain, then round and shift down to the
+// output resolution and saturate. The shifts are folded together per format
+// pair so each instantiation is a single multiply, add, shift and clamp.
+//
+// SHIFT is how far the 64 bit product is shifted down, BITS the resolution of
+// the output and POST how far it is shifted back up into its container (8 for
+// 24-in-32).
+#define DEFINE_FORMAT_GAIN(NAME, IN_T, OUT_T, SHIFT, BITS, POST)                                  \
+    uint32_t NAME(const IN_T *in, OUT_T *out, size_t n, uint32_t gain_q16)                       \
+    {                                                                                            \
+        const int64_t g = gain_q16;                                                              \
+        const int64_t lo = -((int64_t)1 << ((BITS) - 1));                                        \
+        const int64_t hi = ((int64_t)1 << ((BITS) - 1)) - 1;                                     \
+        uint32_t clipped = 0;                                                                    \
+        for (size_t i = 0; i < n; i++) {                                                         \
+            int64_t v = (int64_t)in[i] * g;                                                      \
+            if ((SHIFT) > 0) {                                                                   \
+                v = (v + ((int64_t)1 << ((SHIFT) > 0 ? (SHIFT) - 1 : 0))) >> (SHIFT);            \
+            }                                                                                    \
+            int64_t c = v < lo ? lo : v;                                                         \
+            c = c > hi ? hi : c;                                                                 \
+            clipped += c != v;                                                                   \
+            out[i] = (OUT_T)(c * ((int64_t)1 << (POST)));                                        \
+        }                                                                                        \
+        return clipped;                                                                          \
+    }
+
+DEFINE_FORMAT_GAIN(format_gain_s16_wide, int16_t, int16_t, 16, 16, 0)
+DEFINE_FORMAT_GAIN(format_gain_s16_s24, int16_t, int32_t, 8, 24, 8)
+DEFINE_FORMAT_GAIN(format_gain_s16_s32, int16_t, int32_t, 0, 32, 0)
+DEFINE_FORMAT_GAIN(format_gain_s32_s16, int32_t, int16_t, 32, 16, 0)
+DEFINE_FORMAT_GAIN(format_gain_s32_s24, int32_t, int32_t, 24, 24, 8)
+DEFINE_FORMAT_GAIN(format_gain_s32_s32, int32_t, int32_t, 16, 32, 0)
+
+uint32_t format_volume_gain_q16(int volume_db)
+{
+    return pow(10, volume_db / 20.0f) * FORMAT_GAIN_UNITY;
+}
+
+uint32_t format_gain_s16_s16(const int16_t *in, int16_t *out, size_t n, uint32_t gain_q16)
+{
+    if (gain_q16 > FORMAT_GAIN_UNITY) {
+        return format_gain_s16_wide(in, out, n, gain_q16);
+    }
+    // At or below unity the product fits in 32 bits and can't clip, which
+    // is a lot cheaper than 64 bit maths on the S3 - and the common case
+    const int32_t g = (int32_t)gain_q16;
+    for (size_t i = 0; i < n; i++) {
+        out[i] = (int16_t)(((int32_t)in[i] * g + (1 << 15)) >> 16);
+    }
+    return 0;
+}
+
+void format_dither_init(format_dither_t *dither, uint32_t seed, bool shape)
+{
+    dither->rng = seed ? seed : 0x9E3779B9u;
+    dither->shape = shape;
+    for (int c = 0; c < FORMAT_DITHER_MAX_CHANNELS; c++) {
+        dither->error[c] = 0;
+    }
+}
+
+static inline uint32_t xorshift32(uint32_t *state)
+{
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+// TPDF dither of +-1 output LSB, in product units (an LSB is 1 << SHIFT).
+// Up to 16 bits of resolution both uniform values come out of one xorshift.
+#define TPDF(rng, SHIFT)                                                                                 \
+    ((SHIFT) <= 16 ? tpdf_half(xorshift32(rng), (SHIFT) <= 16 ? 16 - (SHIFT) : 0)                      \
+                   : (int64_t)(xorshift32(rng) >> (32 - (SHIFT))) - (xorshift32(rng) >> (32 - (SHIFT))))
+
+static inline int64_t tpdf_half(uint32_t r, int drop)
+{
+    return (int64_t)((r & 0xFFFF) >> drop) - ((r >> 16) >> drop);
+}
+
+// As DEFINE_FORMAT_GAIN, with the dither (and shaped error) added before the
+// rounding shift. The error is what the requantisation actually did to the
+// sample, so feeding it back with the opposite sign high passes the noise.
+// A clipped sample's error is dropped rather than fed back.
+//
+// Nothing is requantised at a gain of 0, or at unity when the output holds
+// every input bit (EXACT_AT_UNITY), so those go to PLAIN undithered: mute is
+// silence and 0 dB is bit-transparent.
+#define DEFINE_FORMAT_GAIN_DITHER(NAME, PLAIN, EXACT_AT_UNITY, IN_T, OUT_T, SHIFT, BITS, POST)                \
+    uint32_t NAME(const IN_T *in, OUT_T *out, size_t frames, int channels, uint32_t gain_q16,                 \
+                  format_dither_t *dither)                                                                    \
+    {                                                                                                         \
+        if (gain_q16 == 0 || ((EXACT_AT_UNITY) && gain_q16 == FORMAT_GAIN_UNITY)) {                           \
+            for (int c = 0; c < channels; c++) {                                                              \
+                dither->error[c] = 0;                                                                         \
+            }                                                                                                 \
+            return PLAIN(in, out, frames * channels, gain_q16);                                               \
+        }                                                                                                     \
+        const int64_t g = gain_q16;                                                                           \
+        const int64_t lo = -((int64_t)1 << ((BITS) - 1));                                                     \
+        const int64_t hi = ((int64_t)1 << ((BITS) - 1)) - 1;                                                  \
+        const int64_t half = (int64_t)1 << ((SHIFT) - 1);                                                     \
+        uint32_t rng = dither->rng;                                                                           \
+        uint32_t clipped = 0;                                                                                 \
+        for (int c = 0; c < channels; c++) {                                                                  \
+            int64_t error = dither->shape ? dither->error[c] : 0;                                             \
+            for (size_t i = c; i < frames * channels; i += channels) {                                        \
+                int64_t wanted = (int64_t)in[i] * g - error;                                                  \
+                int64_t v = (wanted + TPDF(&rng, SHIFT) + half) >> (SHIFT);                                   \
+                int64_t q = v < lo ? lo : v;                                                                  \
+                q = q > hi ? hi : q;                                                                          \
+                clipped += q != v;                                                                            \
+                if (dither->shape) {                                                                          \
+                    error = q == v ? q * ((int64_t)1 << (SHIFT)) - wanted : 0;                                \
+                }                                                                                             \
+                out[i] = (OUT_T)(q * ((int64_t)1 << (POST)));                                                 \
+            }                                                                                                 \
+            dither->error[c] = error;                                                                         \
+        }                                                                                                     \
+        dither->rng = rng;                                                                                    \
+        return clipped;                                                                                       \
+    }
+
+DEFINE_FORMAT_GAIN_DITHER(format_gain_dither_s16_s16, format_gain_s16_s16, 1, int16_t, int16_t, 16, 16, 0)
+DEFINE_FORMAT_GAIN_DITHER(format_gain_dither_s16_s24, format_gain_s16_s24, 1, int16_t, int32_t, 8, 24, 8)
+DEFINE_FORMAT_GAIN_DITHER(format_gain_dither_s32_s16, format_gain_s32_s16, 0, int32_t, int16_t, 32, 16, 0)
+DEFINE_FORMAT_GAIN_DITHER(format_gain_dither_s32_s24, format_gain_s32_s24, 0, int32_t, int32_t, 24, 24, 8)
+DEFINE_FORMAT_GAIN_DITHER(format_gain_dither_s32_s32, format_gain_s32_s32, 1, int32_t, int32_t, 16, 32, 0)
+
+uint32_t format_gain_dither_s16_s32(const int16_t *in, int32_t *out, size_t frames, int channels, uint32_t gain_q16,
+                                    format_dither_t *dither)
+{
+    (void)dither;
+    return format_gain_s16_s32(in, out, frames * channels, gain_q16);
+}
+
+void format_widen_s16_s32_inplace(void *buf, size_t n)
+{
+    const int16_t *in = buf;
+    int32_t *out = buf;
+    for (size_t i = n; i-- > 0;) {
+        out[i] = (int32_t)in[i] * 65536;
+    }
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Sample formats on the USB and I2S sides.
+//
+// 24 bit samples travel left justified in a 32 bit container (the low byte is
+// zero), which is how UAC lays out a 24 bit sample in a 4 byte subslot and
+// what a 32 bit I2S slot expects. So 24-in-32 and 32 bit samples are the same
+// int32 numbers and move between USB and I2S without conversion - only the
+// requantisation at the end of the gain stage differs.
+#define AUDIO_FMT_S16 16
+#define AUDIO_FMT_S24_32 24
+#define AUDIO_FMT_S32 32
+
+#define AUDIO_FMT_BYTES(fmt) ((fmt) == AUDIO_FMT_S16 ? 2 : 4)
+
+// Unity for the Q16 gains below
+#define FORMAT_GAIN_UNITY 65536
+
+// The speaker gain for a UAC volume setting in dB (0 dB is unity)
+uint32_t format_volume_gain_q16(int volume_db);
+
+// Gain and format conversion in one pass: out = in * gain_q16, rounded and
+// saturated to the output format. One kernel per container pair, named
+// format_gain_<in>_<out>. `in` and `out` may be the same buffer when the
+// containers are the same size. Returns the number of samples that clipped.
+uint32_t format_gain_s16_s16(const int16_t *in, int16_t *out, size_t n, uint32_t gain_q16);
+uint32_t format_gain_s16_s24(const int16_t *in, int32_t *out, size_t n, uint32_t gain_q16);
+uint32_t format_gain_s16_s32(const int16_t *in, int32_t *out, size_t n, uint32_t gain_q16);
+uint32_t format_gain_s32_s16(const int32_t *in, int16_t *out, size_t n, uint32_t gain_q16);
+uint32_t format_gain_s32_s24(const int32_t *in, int32_t *out, size_t n, uint32_t gain_q16);
+uint32_t format_gain_s32_s32(const int32_t *in, int32_t *out, size_t n, uint32_t gain_q16);
+
+// Requantising with dither. Truncating an attenuated signal to the output
+// word length leaves an error that follows the signal - at low volumes it is
+// heard as distortion rather than noise. Adding TPDF dither (the sum of two
+// uniform randoms, +-1 LSB) before rounding turns it into a constant, signal
+// independent noise floor. Noise shaping feeds each sample's requantisation
+// error back into the next, which moves that noise up towards Nyquist where
+// it is much harder to hear, at the cost of more noise in total.
+#define FORMAT_DITHER_MAX_CHANNELS 2
+
+typedef struct {
+    uint32_t rng;                              // xorshift32 state, never zero
+    bool shape;                                // first order error feedback
+    int64_t error[FORMAT_DITHER_MAX_CHANNELS]; // last error per channel, in product units
+} format_dither_t;
+
+void format_dither_init(format_dither_t *dither, uint32_t seed, bool shape);
+
+// The same conversions with dithered requantisation. These work on whole
+// interleaved frames so the error feedback stays per channel. When there
+// is nothing to requantise the plain kernel is used: when the output has no
+// fewer bits than the product (16 bit to 32 bit), at a gain of 0 (mute is
+// digital silence) and at unity when the output is at least as wide as the
+// input (0 dB is bit-transparent).
+uint32_t format_gain_dither_s16_s16(const int16_t *in, int16_t *out, size_t frames, int channels, uint32_t gain_q16,
+                                    format_dither_t *dither);
+uint32_t format_gain_dither_s16_s24(const int16_t *in, int32_t *out, size_t frames, int channels, uint32_t gain_q16,
+                                    format_dither_t *dither);
+uint32_t format_gain_dither_s16_s32(const int16_t *in, int32_t *out, size_t frames, int channels, uint32_t gain_q16,
+                                    format_dither_t *dither);
+uint32_t format_gain_dither_s32_s16(const int32_t *in, int16_t *out, size_t frames, int channels, uint32_t gain_q16,
+                                    format_dither_t *dither);
+uint32_t format_gain_dither_s32_s24(const int32_t *in, int32_t *out, size_t frames, int channels, uint32_t gain_q16,
+                                    format_dither_t *dither);
+uint32_t format_gain_dither_s32_s32(const int32_t *in, int32_t *out, size_t frames, int channels, uint32_t gain_q16,
+                                    format_dither_t *dither);
+
+// Widen 16 bit samples to 32 bit in place: `buf` holds `n` int16 samples at
+// the start and ends up holding `n` int32 samples. Works from the end so
+// nothing is overwritten before it is read.
+void format_widen_s16_s32_inplace(void *buf, size_t n);
+
+#ifdef __cplusplus
+}
+#endif
@@ -7,12 +7,35 @@
 #include "sdkconfig.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/stream_buffer.h"
+#include "esp_timer.h"
 #include "driver/gpio.h"
 #include "usb_device_uac.h"
 #include "driver/i2s_pdm.h"
 #include "driver/i2s_std.h"
 #include <math.h>
+#include <stdio.h>
+#include <string.h>
 #include "driver/ledc.h"
+#include "sidetone.h"
+#include "plc.h"
+#include "channels.h"
+#include "format.h"
+#include "telemetry.h"
+#if CONFIG_APP_TELEMETRY_ENABLE
+#include "usb_composite.h"
+#endif
+#if CONFIG_APP_DSP_CHAIN
+#include "dsp_chain.h"
+#include "nvs.h"
+#include "nvs_flash.h"
+#endif
+#if CONFIG_APP_MIC_BEAMFORMER
+#include "beamformer.h"
+#endif
+#if CONFIG_APP_MIC_HUM_CANCEL
+#include "hum_notch.h"
+#endif
 
 
 #define SPEAKER_I2S_DOUT  13
@@ -24,6 +47,111 @@
 #define MIC_I2S_LR   10
 #define MIC_I2S_DATA 11
 
+// channels from the host, and to the amp(s)
+#define SPEAKER_CHANNELS CONFIG_UAC_SPEAKER_CHANNEL_NUM
+#if CONFIG_APP_SPEAKER_DOWNMIX
+#define SPEAKER_I2S_CHANNELS 1
+#else
+#define SPEAKER_I2S_CHANNELS SPEAKER_CHANNELS
+#endif
+#define MIC_CHANNELS CONFIG_UAC_MIC_CHANNEL_NUM
+#if CONFIG_APP_MIC_BEAMFORMER
+// two mics on the data line, beamformed into the host's one channel
+#define MIC_PDM_CHANNELS 2
+#else
+#define MIC_PDM_CHANNELS MIC_CHANNELS
+#endif
+
+#if SPEAKER_I2S_CHANNELS > 2
+#error "The I2S speaker output is mono or stereo - enable CONFIG_APP_SPEAKER_DOWNMIX for more host channels"
+#endif
+#if MIC_CHANNELS > 2
+#error "Two PDM mics share the data line at most (CONFIG_UAC_MIC_CHANNEL_NUM)"
+#endif
+#if CONFIG_APP_MIC_BEAMFORMER && MIC_CHANNELS != 1
+#error "The beamformer sends one channel to the host - set CONFIG_UAC_MIC_CHANNEL_NUM to 1"
+#endif
+
+// sample formats (format.h) on the USB side and at the amp
+#define USB_FORMAT CONFIG_APP_USB_SAMPLE_BITS
+#define SPEAKER_I2S_FORMAT CONFIG_APP_SPEAKER_SAMPLE_BITS
+
+#if USB_FORMAT == AUDIO_FMT_S16
+typedef int16_t usb_sample_t;
+#define USB_CONTAINER s16
+#else
+typedef int32_t usb_sample_t;
+#define USB_CONTAINER s32
+#endif
+
+// the speaker DSP runs on samples in the I2S container
+#if SPEAKER_I2S_FORMAT == AUDIO_FMT_S16
+typedef int16_t speaker_sample_t;
+#define SPEAKER_PRECISION s16
+#define SPEAKER_I2S_BIT_WIDTH I2S_DATA_BIT_WIDTH_16BIT
+#elif SPEAKER_I2S_FORMAT == AUDIO_FMT_S24_32
+typedef int32_t speaker_sample_t;
+#define SPEAKER_PRECISION s24
+#define SPEAKER_I2S_BIT_WIDTH I2S_DATA_BIT_WIDTH_32BIT
+#else
+typedef int32_t speaker_sample_t;
+#define SPEAKER_PRECISION s32
+#define SPEAKER_I2S_BIT_WIDTH I2S_DATA_BIT_WIDTH_32BIT
+#endif
+
+// the volume + format conversion kernel for this pair of formats
+#define FORMAT_GAIN_(in, out) format_gain_##in##_##out
+#define FORMAT_GAIN(in, out) FORMAT_GAIN_(in, out)
+#define FORMAT_GAIN_DITHER_(in, out) format_gain_dither_##in##_##out
+#define FORMAT_GAIN_DITHER(in, out) FORMAT_GAIN_DITHER_(in, out)
+#if CONFIG_APP_SPEAKER_DITHER
+#define speaker_convert(in, out, frames, gain) \
+    FORMAT_GAIN_DITHER(USB_CONTAINER, SPEAKER_PRECISION)(in, out, frames, SPEAKER_CHANNELS, gain, &speaker_dither)
+#else
+#define speaker_convert(in, out, frames, gain) \
+    FORMAT_GAIN(USB_CONTAINER, SPEAKER_PRECISION)(in, out, (frames) * SPEAKER_CHANNELS, gain)
+#endif
+#if CONFIG_APP_SPEAKER_DITHER && SPEAKER_CHANNELS > FORMAT_DITHER_MAX_CHANNELS
+#error "The speaker dither keeps state for two channels at most"
+#endif
+
+// frames in one UAC speaker interval - the unit the speaker task works in
+#define SPEAKER_BLOCK_FRAMES (CONFIG_UAC_SAMPLE_RATE * CONFIG_UAC_SPK_INTERVAL_MS / 1000)
+#define SPEAKER_BLOCK_SAMPLES (SPEAKER_BLOCK_FRAMES * SPEAKER_CHANNELS)
+#define SPEAKER_I2S_BLOCK_SAMPLES (SPEAKER_BLOCK_FRAMES * SPEAKER_I2S_CHANNELS)
+// the speaker jitter buffer - the I2S DMA, or speaker_pcm with the sidetone on
+#define SPEAKER_DMA_DESC_NUM  6
+#define SPEAKER_DMA_FRAME_NUM 240
+// silence queued ahead of the first block when playback starts
+#define SPEAKER_PREFILL_BLOCKS 1
+// how long before the DMA runs dry we give up waiting and conceal
+#define SPEAKER_DEADLINE_MARGIN_US 3000
+// host audio waiting for the speaker task
+#define SPEAKER_STREAM_BLOCKS 4
+
+#if CONFIG_APP_SIDETONE_ENABLE
+// The sidetone task owns both I2S channels and moves them SIDETONE_FRAMES at a
+// time (see sidetone.c), so their DMA is sized in those blocks. The speaker
+// task's blocks queue up in speaker_pcm for it instead, which takes over as
+// the jitter buffer, and the mic goes on to the UAC callback through
+// mic_stream.
+#define SIDETONE_FRAMES SIDETONE_BLOCK_FRAMES(CONFIG_UAC_SAMPLE_RATE)
+// how far the task can fall behind the mic before the PDM DMA overruns
+#define SIDETONE_RX_BLOCKS 16
+// UAC mic intervals waiting for the input callback
+#define MIC_STREAM_BLOCKS 3
+#define MIC_STREAM_BLOCK_BYTES \
+    (CONFIG_UAC_SAMPLE_RATE * CONFIG_UAC_MIC_INTERVAL_MS / 1000 * MIC_PDM_CHANNELS * sizeof(int16_t))
+#define SPEAKER_I2S_DMA_DESC_NUM  SIDETONE_TX_BLOCKS
+#define SPEAKER_I2S_DMA_FRAME_NUM SIDETONE_FRAMES
+#if SIDETONE_FRAMES < 1
+#error "The sidetone needs a sample rate of at least 6kHz"
+#endif
+#else
+#define SPEAKER_I2S_DMA_DESC_NUM  SPEAKER_DMA_DESC_NUM
+#define SPEAKER_I2S_DMA_FRAME_NUM SPEAKER_DMA_FRAME_NUM
+#endif
+
 static i2s_chan_handle_t rx;
 static i2s_chan_handle_t tx;
 
@@ -31,35 +159,379 @@ static bool is_muted = false;
 // volume is in dB
 static uint32_t volume = 0;
 static uint32_t volume_factor = 100;
+// the same as a Q16 gain for the speaker task
+static volatile uint32_t volume_gain_q16 = FORMAT_GAIN_UNITY;
+
+static StreamBufferHandle_t speaker_stream;
+#if CONFIG_APP_SIDETONE_ENABLE
+// speaker task -> sidetone task, SPEAKER_I2S_CHANNELS interleaved
+static StreamBufferHandle_t speaker_pcm;
+// sidetone task -> UAC input callback, as the PDM DMA delivers it
+static StreamBufferHandle_t mic_stream;
+#endif
+#if CONFIG_APP_SPEAKER_DITHER
+static format_dither_t speaker_dither;
+#endif
+// one per channel that reaches the amp
+static plc_t speaker_plc[SPEAKER_I2S_CHANNELS];
+static speaker_sample_t speaker_block[SPEAKER_BLOCK_SAMPLES];
+#if AUDIO_FMT_BYTES(USB_FORMAT) != AUDIO_FMT_BYTES(SPEAKER_I2S_FORMAT)
+// host audio arrives here when it has to change container size on the way
+// to speaker_block, otherwise it's received straight into speaker_block
+static usb_sample_t speaker_usb_block[SPEAKER_BLOCK_SAMPLES];
+#define SPEAKER_RX_BLOCK speaker_usb_block
+#else
+#define SPEAKER_RX_BLOCK speaker_block
+#endif
+#if SPEAKER_I2S_CHANNELS > 1
+static speaker_sample_t speaker_planes[SPEAKER_I2S_CHANNELS][SPEAKER_BLOCK_FRAMES];
+#endif
+
+#if CONFIG_APP_MIC_BEAMFORMER
+#define MIC_BLOCK_FRAMES (CONFIG_UAC_SAMPLE_RATE * CONFIG_UAC_MIC_INTERVAL_MS / 1000)
+// vendor control request with a new look direction, int16 degrees
+#define MIC_STEER_VENDOR_REQUEST 0x02
+static beamformer_t mic_beam;
+static int16_t mic_pdm_block[MIC_BLOCK_FRAMES * MIC_PDM_CHANNELS];
+// where the beam should point - the mic callback steers it between blocks
+static volatile int mic_steer_deg = CONFIG_APP_MIC_STEER_DEG;
+#endif
+#if CONFIG_APP_MIC_HUM_CANCEL
+static struct mic_hum mic_hum[MIC_CHANNELS];
+#endif
+#if CONFIG_APP_SIDETONE_ENABLE
+// vendor control request with a new sidetone gain, int16 dB
+#define SIDETONE_VENDOR_REQUEST 0x03
+#endif
+
+#if CONFIG_APP_DSP_CHAIN
+// vendor control request (bmRequestType 0x40) carrying a new descriptor
+#define DSP_VENDOR_REQUEST 0x01
+#define DSP_NVS_NAMESPACE "dsp"
+#define DSP_NVS_KEY "chain"
+// Two chains so a new one can be built while the other plays. The speaker
+// task owns dsp_current; a loader builds into the other one and hands it over
+// through dsp_next, which the task picks up at the start of a block.
+static dsp_chain_t dsp_chains[2];
+static uint8_t dsp_arenas[2][CONFIG_APP_DSP_ARENA_BYTES] __attribute__((aligned(8)));
+static dsp_chain_t *dsp_current = &dsp_chains[0];
+static dsp_chain_t *dsp_next;
+#endif
+
+#if CONFIG_APP_DEADLINE_MONITOR
+// the run time counter of the calling task, for the preemption times
+#if CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+#define task_run_us() ((uint32_t)ulTaskGetRunTimeCounter(NULL))
+#else
+#define task_run_us() 0
+#endif
+#define DEADLINE_BEGIN(id, fill) \
+    deadline_begin(&telemetry_deadlines[id], esp_timer_get_time(), task_run_us(), fill)
+#define DEADLINE_END(id) \
+    deadline_end(&telemetry_deadlines[id], esp_timer_get_time(), task_run_us(), xPortGetCoreID())
+#else
+#define DEADLINE_BEGIN(id, fill)
+#define DEADLINE_END(id)
+#endif
 
 static esp_err_t usb_uac_device_output_cb(uint8_t *buf, size_t len, void *arg)
 {
-    if (!tx) {
+    if (!tx || !speaker_stream) {
         return ESP_FAIL;
     }
-    int16_t *samples = (int16_t *)buf;
-    for (size_t i = 0; i < len / 2; i++) {
-        if (is_muted) {
-            samples[i] = 0;
-            continue;
+    DEADLINE_BEGIN(TELEMETRY_DEADLINE_SPK_CB, xStreamBufferBytesAvailable(speaker_stream));
+    int64_t start = esp_timer_get_time();
+    // hand over to the speaker task - it owns the I2S timing and does the
+    // volume as part of the format conversion
+    if (xStreamBufferSend(speaker_stream, buf, len, 0) != len) {
+        telemetry.spk_overruns++;
+    }
+    telemetry_record_time(&telemetry.spk_cb, (uint32_t)(esp_timer_get_time() - start));
+    DEADLINE_END(TELEMETRY_DEADLINE_SPK_CB);
+    return ESP_OK;
+}
+
+// Runs the concealment over an I2S block (SPEAKER_I2S_CHANNELS interleaved)
+// that holds `good` frames of real audio, concealing the rest of the block.
+// Each channel has its own concealment so the pitch search follows each one.
+static void speaker_conceal(speaker_sample_t *block, size_t good)
+{
+#if SPEAKER_I2S_CHANNELS == 1
+    if (good > 0) {
+        PLC_GOOD_FRAME(&speaker_plc[0], block, good);
+    }
+    if (good < SPEAKER_BLOCK_FRAMES) {
+        PLC_CONCEAL(&speaker_plc[0], block + good, SPEAKER_BLOCK_FRAMES - good);
+    }
+#else
+    speaker_sample_t *planes[SPEAKER_I2S_CHANNELS];
+    for (int c = 0; c < SPEAKER_I2S_CHANNELS; c++) {
+        planes[c] = speaker_planes[c];
+    }
+    DEINTERLEAVE(block, planes, good, SPEAKER_I2S_CHANNELS);
+    for (int c = 0; c < SPEAKER_I2S_CHANNELS; c++) {
+        if (good > 0) {
+            PLC_GOOD_FRAME(&speaker_plc[c], planes[c], good);
         }
-        int32_t sample = samples[i];
-        // volume is in dB
-        sample = (sample * volume_factor) / 100;
-        if (sample > 32767) {
-            sample = 32767;
-        } else if (sample < -32768) {
-            sample = -32768;
+        if (good < SPEAKER_BLOCK_FRAMES) {
+            PLC_CONCEAL(&speaker_plc[c], planes[c] + good, SPEAKER_BLOCK_FRAMES - good);
         }
-        samples[i] = (int16_t)sample;
     }
+    INTERLEAVE((const speaker_sample_t *const *)planes, block, SPEAKER_BLOCK_FRAMES, SPEAKER_I2S_CHANNELS);
+#endif
+}
+
+#if CONFIG_APP_DSP_CHAIN
+// Builds a chain from `desc` and queues it for the speaker task. Fails if the
+// last one hasn't been picked up yet or the descriptor doesn't check out, in
+// which case the current chain keeps playing.
+static esp_err_t dsp_load(const uint8_t *desc, size_t len)
+{
+    if (__atomic_load_n(&dsp_next, __ATOMIC_ACQUIRE)) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    const dsp_chain_t *current = __atomic_load_n(&dsp_current, __ATOMIC_ACQUIRE);
+    const int spare = current == &dsp_chains[0] ? 1 : 0;
+    size_t offset = 0;
+    dsp_chain_err_t err = dsp_chain_build(&dsp_chains[spare], desc, len, SPEAKER_I2S_CHANNELS, CONFIG_UAC_SAMPLE_RATE,
+                                          SPEAKER_BLOCK_FRAMES, dsp_arenas[spare], sizeof(dsp_arenas[spare]), &offset);
+    if (err != DSP_CHAIN_OK) {
+        printf("dsp chain rejected: %s at byte %u\n", dsp_chain_err_str(err), (unsigned)offset);
+        return ESP_ERR_INVALID_ARG;
+    }
+    printf("dsp chain: %u stages, %u of %u arena bytes\n", (unsigned)dsp_chains[spare].stage_count,
+           (unsigned)dsp_chains[spare].arena_used, (unsigned)sizeof(dsp_arenas[spare]));
+    __atomic_store_n(&dsp_next, &dsp_chains[spare], __ATOMIC_RELEASE);
+    return ESP_OK;
+}
+
+// The descriptor saved by the last successful update, if there is one
+static void dsp_load_from_nvs(void)
+{
+    esp_err_t ret = nvs_flash_init();
+    if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND) {
+        ESP_ERROR_CHECK(nvs_flash_erase());
+        ret = nvs_flash_init();
+    }
+    ESP_ERROR_CHECK(ret);
+    nvs_handle_t nvs;
+    if (nvs_open(DSP_NVS_NAMESPACE, NVS_READONLY, &nvs) != ESP_OK) {
+        return;
+    }
+    static uint8_t desc[DSP_CHAIN_MAX_DESCRIPTOR];
+    size_t len = sizeof(desc);
+    if (nvs_get_blob(nvs, DSP_NVS_KEY, desc, &len) == ESP_OK) {
+        dsp_load(desc, len);
+    }
+    nvs_close(nvs);
+}
+
+#if CONFIG_APP_TELEMETRY_ENABLE
+// A descriptor from the vendor request, waiting for the telemetry task. The
+// TinyUSB task only copies it; building and the NVS write happen at idle
+// priority.
+static uint8_t dsp_pending[DSP_CHAIN_MAX_DESCRIPTOR];
+static size_t dsp_pending_len;
+
+static void dsp_vendor_request(const uint8_t *data, size_t len)
+{
+    if (len > sizeof(dsp_pending) || __atomic_load_n(&dsp_pending_len, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+    memcpy(dsp_pending, data, len);
+    __atomic_store_n(&dsp_pending_len, len, __ATOMIC_RELEASE);
+}
+
+static void dsp_apply_pending(void)
+{
+    size_t len = __atomic_load_n(&dsp_pending_len, __ATOMIC_ACQUIRE);
+    if (!len) {
+        return;
+    }
+    esp_err_t ret = dsp_load(dsp_pending, len);
+    if (ret == ESP_ERR_INVALID_STATE) {
+        // the speaker task hasn't taken the last one yet, try next time
+        return;
+    }
+    nvs_handle_t nvs;
+    if (ret == ESP_OK && nvs_open(DSP_NVS_NAMESPACE, NVS_READWRITE, &nvs) == ESP_OK) {
+        if (nvs_set_blob(nvs, DSP_NVS_KEY, dsp_pending, len) == ESP_OK) {
+            nvs_commit(nvs);
+        }
+        nvs_close(nvs);
+    }
+    __atomic_store_n(&dsp_pending_len, 0, __ATOMIC_RELEASE);
+}
+#endif
+#endif
+
+static bool speaker_is_silent(void)
+{
+    for (int c = 0; c < SPEAKER_I2S_CHANNELS; c++) {
+        if (!plc_is_silent(&speaker_plc[c])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void speaker_i2s_write(const speaker_sample_t *samples, size_t n)
+{
+    size_t len = n * sizeof(speaker_sample_t);
     size_t total_bytes_written = 0;
     while (total_bytes_written < len) {
         size_t bytes_written = 0;
-        i2s_channel_write(tx, (uint8_t *)buf + total_bytes_written, len - total_bytes_written, &bytes_written, portMAX_DELAY);
+        i2s_channel_write(tx, (const uint8_t *)samples + total_bytes_written, len - total_bytes_written, &bytes_written, portMAX_DELAY);
         total_bytes_written += bytes_written;
     }
+}
+
+// Queues a block for the amp, waiting for room
+static void speaker_write(const speaker_sample_t *samples, size_t n)
+{
+#if CONFIG_APP_SIDETONE_ENABLE
+    // the sidetone task plays it out
+    xStreamBufferSend(speaker_pcm, samples, n * sizeof(speaker_sample_t), portMAX_DELAY);
+#else
+    speaker_i2s_write(samples, n);
+#endif
+}
+
+// Feeds the I2S speaker channel one UAC interval at a time. We keep track of
+// when the DMA will have played everything it has been given and wait for the
+// host's audio until just before then. If it hasn't turned up we write packet
+// loss concealment instead of letting the DMA underrun, and once that has
+// faded out we stop writing and let the DMA auto clear play silence.
+static void speaker_task(void *arg)
+{
+    const int64_t block_us = 1000000LL * SPEAKER_BLOCK_FRAMES / CONFIG_UAC_SAMPLE_RATE;
+    const int64_t dma_us = 1000000LL * SPEAKER_DMA_DESC_NUM * SPEAKER_DMA_FRAME_NUM / CONFIG_UAC_SAMPLE_RATE;
+    bool playing = false;
+    // when the DMA will have played everything we've written
+    int64_t dma_empty_at = 0;
+
+    while (1) {
+        TickType_t wait = portMAX_DELAY;
+        if (playing) {
+            int64_t slack_us = dma_empty_at - esp_timer_get_time() - SPEAKER_DEADLINE_MARGIN_US;
+            wait = slack_us > 0 ? pdMS_TO_TICKS(slack_us / 1000) : 0;
+        }
+        size_t got = xStreamBufferReceive(speaker_stream, SPEAKER_RX_BLOCK, sizeof(SPEAKER_RX_BLOCK), wait);
+        size_t frames = got / (sizeof(usb_sample_t) * SPEAKER_CHANNELS);
+        if (frames == 0 && !playing) {
+            continue;
+        }
+        // the block has to be written before the DMA runs out
+        DEADLINE_BEGIN(TELEMETRY_DEADLINE_SPK_TASK, xStreamBufferBytesAvailable(speaker_stream));
+#if CONFIG_APP_DSP_CHAIN
+        dsp_chain_t *next = __atomic_load_n(&dsp_next, __ATOMIC_ACQUIRE);
+        if (next) {
+            // current first, so a loader that sees dsp_next clear also sees
+            // which chain is free
+            __atomic_store_n(&dsp_current, next, __ATOMIC_RELEASE);
+            __atomic_store_n(&dsp_next, NULL, __ATOMIC_RELEASE);
+        }
+#endif
+#if CONFIG_APP_DEADLINE_MONITOR
+        if (playing) {
+            telemetry_deadlines[TELEMETRY_DEADLINE_SPK_TASK].deadline_us = dma_empty_at;
+        }
+#endif
+        // volume and format conversion in one pass (in place if the
+        // containers are the same size)
+        uint32_t gain = is_muted ? 0 : volume_gain_q16;
+        telemetry.spk_clipped += speaker_convert(SPEAKER_RX_BLOCK, speaker_block, frames, gain);
+#if SPEAKER_I2S_CHANNELS != SPEAKER_CHANNELS
+        // one amp - fold the host's channels down in place
+        DOWNMIX(speaker_block, speaker_block, frames, SPEAKER_CHANNELS);
+#endif
+        speaker_conceal(speaker_block, frames);
+        // the channels conceal in lockstep, so the first one speaks for all
+        telemetry.spk_loss_events = speaker_plc[0].loss_events;
+        telemetry.spk_concealed = speaker_plc[0].concealed_samples;
+        telemetry.spk_stream_fill = xStreamBufferBytesAvailable(speaker_stream);
+        if (frames == 0 && speaker_is_silent()) {
+            playing = false;
+            continue;
+        }
+#if CONFIG_APP_DSP_CHAIN
+        // the whole block, stage by stage - an empty chain returns at once
+        DSP_CHAIN_PROCESS(dsp_current, speaker_block, SPEAKER_BLOCK_FRAMES);
+#endif
+        int64_t now = esp_timer_get_time();
+        if (!playing) {
+            // starting from silence - give ourselves some headroom
+            static const speaker_sample_t silence[SPEAKER_I2S_BLOCK_SAMPLES];
+            playing = true;
+            dma_empty_at = now;
+            for (int i = 0; i < SPEAKER_PREFILL_BLOCKS; i++) {
+                speaker_write(silence, SPEAKER_I2S_BLOCK_SAMPLES);
+                dma_empty_at += block_us;
+            }
+        }
+        speaker_write(speaker_block, SPEAKER_I2S_BLOCK_SAMPLES);
+        DEADLINE_END(TELEMETRY_DEADLINE_SPK_TASK);
+        now = esp_timer_get_time();
+        dma_empty_at = (dma_empty_at > now ? dma_empty_at : now) + block_us;
+        if (dma_empty_at > now + dma_us) {
+            dma_empty_at = now + dma_us;
+        }
+    }
+}
+
+#if CONFIG_APP_SIDETONE_ENABLE
+// Moves both I2S channels SIDETONE_FRAMES at a time, paced by the mic DMA:
+// each mic block is passed on to the UAC callback and mixed into the next
+// block of host audio on its way to the amp. It writes as much as it reads and
+// both channels run off the same clock, so the speaker DMA stays
+// SIDETONE_TX_BLOCKS deep and the mic is never more than
+// SIDETONE_LATENCY_FRAMES from the amp. When the host isn't playing it's the
+// mic alone over silence.
+static void sidetone_task(void *arg)
+{
+    static int16_t mic[SIDETONE_FRAMES * MIC_PDM_CHANNELS];
+    static speaker_sample_t out[SIDETONE_FRAMES * SPEAKER_I2S_CHANNELS];
+    // start one block short of a full queue, so there's room to be late
+    memset(out, 0, sizeof(out));
+    for (int i = 0; i < SIDETONE_TX_BLOCKS - 1; i++) {
+        speaker_i2s_write(out, SIDETONE_FRAMES * SPEAKER_I2S_CHANNELS);
+    }
+
+    while (1) {
+        size_t bytes = 0;
+        if (i2s_channel_read(rx, mic, sizeof(mic), &bytes, portMAX_DELAY) != ESP_OK) {
+            telemetry.mic_errors++;
+        }
+        const size_t frames = bytes / (sizeof(int16_t) * MIC_PDM_CHANNELS);
+        // whole blocks only, so the frames stay in step - if the host isn't
+        // recording the stream fills up and the mic is dropped here
+        if (xStreamBufferSpacesAvailable(mic_stream) >= bytes) {
+            xStreamBufferSend(mic_stream, mic, bytes, 0);
+        }
+        // whatever host audio there is, silence after it
+        const size_t want = frames * SPEAKER_I2S_CHANNELS * sizeof(speaker_sample_t);
+        size_t got = xStreamBufferReceive(speaker_pcm, out, want, 0);
+        memset((uint8_t *)out + got, 0, want - got);
+        SIDETONE_APPLY(out, mic, frames, SPEAKER_I2S_CHANNELS, MIC_PDM_CHANNELS);
+        speaker_i2s_write(out, frames * SPEAKER_I2S_CHANNELS);
+    }
+}
+#endif
+
+// Reads `len` bytes from the PDM mic for the UAC input callback
+static esp_err_t mic_read(void *dst, size_t len, size_t *bytes_read)
+{
+#if CONFIG_APP_SIDETONE_ENABLE
+    // the sidetone task has the channel and passes the mic on
+    size_t got = 0;
+    while (got < len) {
+        got += xStreamBufferReceive(mic_stream, (uint8_t *)dst + got, len - got, portMAX_DELAY);
+    }
+    *bytes_read = got;
     return ESP_OK;
+#else
+    return i2s_channel_read(rx, dst, len, bytes_read, portMAX_DELAY);
+#endif
 }
 
 static esp_err_t usb_uac_device_input_cb(uint8_t *buf, size_t len, size_t *bytes_read, void *arg)
@@ -67,12 +539,62 @@ static esp_err_t usb_uac_device_input_cb(uint8_t *buf, size_t len, size_t *bytes
     if (!rx) {
         return ESP_FAIL;
     }
-    return i2s_channel_read(rx, buf, len, bytes_read, portMAX_DELAY);
+    // the wait for the PDM DMA counts against the deadline. There's no fill
+    // level to record - the I2S driver doesn't expose its DMA queue.
+    DEADLINE_BEGIN(TELEMETRY_DEADLINE_MIC_CB, 0);
+#if CONFIG_APP_MIC_BEAMFORMER
+    // both mics into our own block, the beam goes to the host
+    size_t frames = len / sizeof(usb_sample_t);
+    frames = frames < MIC_BLOCK_FRAMES ? frames : MIC_BLOCK_FRAMES;
+    size_t pdm_bytes = 0;
+    esp_err_t ret = mic_read(mic_pdm_block, frames * MIC_PDM_CHANNELS * sizeof(int16_t), &pdm_bytes);
+    const int16_t *samples = mic_pdm_block;
+#else
+    // the PDM decimator only produces 16 bit samples, so for the wider USB
+    // formats read half as many bytes and widen them in place below
+    const size_t pdm_len = len / (sizeof(usb_sample_t) / sizeof(int16_t));
+    esp_err_t ret = mic_read(buf, pdm_len, bytes_read);
+    const int16_t *samples = (const int16_t *)buf;
+    const size_t pdm_bytes = *bytes_read;
+#endif
+    // time our own work, not the wait for the DMA
+    int64_t start = esp_timer_get_time();
+    if (ret != ESP_OK) {
+        telemetry.mic_errors++;
+    }
+    uint32_t clipped = 0;
+    for (size_t i = 0; i < pdm_bytes / 2; i++) {
+        clipped += samples[i] == 32767 || samples[i] == -32768;
+    }
+    telemetry.mic_clipped += clipped;
+#if CONFIG_APP_MIC_BEAMFORMER
+    int steer = mic_steer_deg;
+    if (steer != (int)mic_beam.steer_deg) {
+        beamformer_steer(&mic_beam, steer);
+    }
+    beamformer_process(&mic_beam, mic_pdm_block, (int16_t *)buf, pdm_bytes / (sizeof(int16_t) * MIC_PDM_CHANNELS));
+    *bytes_read = pdm_bytes / MIC_PDM_CHANNELS;
+    samples = (const int16_t *)buf;
+#endif
+#if CONFIG_APP_MIC_HUM_CANCEL
+    for (int c = 0; c < MIC_CHANNELS; c++) {
+        hum_cancel(&mic_hum[c], (int16_t *)buf + c, *bytes_read / (2 * MIC_CHANNELS), MIC_CHANNELS);
+    }
+#endif
+#if USB_FORMAT != AUDIO_FMT_S16
+    // 16 bits shifted to the top of the word is valid 24-in-32 and 32 bit
+    format_widen_s16_s32_inplace(buf, *bytes_read / 2);
+    *bytes_read *= 2;
+#endif
+    telemetry_record_time(&telemetry.mic_cb, (uint32_t)(esp_timer_get_time() - start));
+    DEADLINE_END(TELEMETRY_DEADLINE_MIC_CB);
+    return ret;
 }
 
 static void usb_uac_device_set_mute_cb(uint32_t mute, void *arg)
 {
     is_muted = mute;
+    telemetry.muted = mute;
 }
 static void usb_uac_device_set_volume_cb(uint32_t _volume, void *arg)
 {
@@ -80,8 +602,117 @@ static void usb_uac_device_set_volume_cb(uint32_t _volume, void *arg)
     // _volume = (volume_db + 50) * 2
     int volume_db = _volume / 2 - 50;
     volume_factor = pow(10, volume_db / 20.0f) * 100.0f;
+    volume_gain_q16 = format_volume_gain_q16(volume_db);
+    telemetry.volume_db = volume_db;
+    telemetry.volume_factor = volume_factor;
 }
 
+#define USB_VENDOR_REQUESTS (CONFIG_APP_DSP_CHAIN || CONFIG_APP_MIC_BEAMFORMER || CONFIG_APP_SIDETONE_ENABLE)
+
+#if CONFIG_APP_TELEMETRY_ENABLE && USB_VENDOR_REQUESTS
+// Host to device vendor control requests, from the TinyUSB task
+static void usb_vendor_request(uint8_t request, const uint8_t *data, size_t len)
+{
+    switch (request) {
+#if CONFIG_APP_DSP_CHAIN
+    case DSP_VENDOR_REQUEST:
+        dsp_vendor_request(data, len);
+        break;
+#endif
+#if CONFIG_APP_MIC_BEAMFORMER
+    case MIC_STEER_VENDOR_REQUEST:
+        if (len == 2) {
+            int deg = (int16_t)(data[0] | data[1] << 8);
+            mic_steer_deg = deg > 90 ? 90 : deg < -90 ? -90 : deg;
+        }
+        break;
+#endif
+#if CONFIG_APP_SIDETONE_ENABLE
+    case SIDETONE_VENDOR_REQUEST:
+        // clamped to -60 (off) .. 0 by the setter
+        if (len == 2) {
+            sidetone_set_gain_db((int16_t)(data[0] | data[1] << 8));
+        }
+        break;
+#endif
+    default:
+        break;
+    }
+}
+#endif
+
+#if CONFIG_APP_TELEMETRY_ENABLE
+// Sends a telemetry packet down the CDC port every
+// CONFIG_APP_TELEMETRY_INTERVAL_MS. It runs at idle priority and only reads
+// the counters, so it can never hold up the audio.
+static void telemetry_task(void *arg)
+{
+    static uint8_t packet[TELEMETRY_MAX_PACKET_LEN];
+    static telemetry_t snapshot;
+    uint32_t seq = 0;
+    configRUN_TIME_COUNTER_TYPE last_idle[2] = {0};
+    configRUN_TIME_COUNTER_TYPE last_total = portGET_RUN_TIME_COUNTER_VALUE();
+    TickType_t wake = xTaskGetTickCount();
+
+    while (1) {
+        vTaskDelayUntil(&wake, pdMS_TO_TICKS(CONFIG_APP_TELEMETRY_INTERVAL_MS));
+
+#if CONFIG_APP_DSP_CHAIN
+        dsp_apply_pending();
+#endif
+        snapshot = telemetry;
+
+        // the run time counter ticks in us, so idle time over elapsed time
+        // gives the load of each core
+        configRUN_TIME_COUNTER_TYPE total = portGET_RUN_TIME_COUNTER_VALUE();
+        configRUN_TIME_COUNTER_TYPE elapsed = total - last_total;
+        last_total = total;
+        for (int core = 0; core < portNUM_PROCESSORS && core < 2; core++) {
+            configRUN_TIME_COUNTER_TYPE idle = ulTaskGetIdleRunTimeCounterForCore(core);
+            configRUN_TIME_COUNTER_TYPE idle_delta = idle - last_idle[core];
+            last_idle[core] = idle;
+            snapshot.cpu_load[core] = elapsed && idle_delta < elapsed ? 100 - (uint8_t)(idle_delta * 100 / elapsed) : 0;
+        }
+
+        size_t len = telemetry_encode(&snapshot, seq++, (uint32_t)esp_timer_get_time(), packet);
+        usb_composite_cdc_write(packet, len);
+        // start a new window for the callback maximums
+        telemetry_epoch++;
+
+#if CONFIG_APP_DEADLINE_MONITOR
+        // one deadline monitor per period, in turn - they're bigger than the
+        // status packet and the CDC writes are all or nothing
+        static deadline_monitor_t monitor;
+        uint8_t id = seq % TELEMETRY_DEADLINE_COUNT;
+        monitor = telemetry_deadlines[id];
+        len = telemetry_encode_deadline(&monitor, id, seq++, (uint32_t)esp_timer_get_time(), packet);
+        if (usb_composite_cdc_write(packet, len)) {
+            // sent, so start a new window for its worst offenders
+            telemetry_deadlines[id].epoch++;
+        }
+#endif
+    }
+}
+#elif CONFIG_APP_DEADLINE_MONITOR && CONFIG_APP_DEADLINE_LOG_INTERVAL_MS > 0
+// Without the telemetry port the deadline monitors are printed to the
+// console every CONFIG_APP_DEADLINE_LOG_INTERVAL_MS, from idle priority.
+static void deadline_task(void *arg)
+{
+    static deadline_monitor_t monitor;
+    TickType_t wake = xTaskGetTickCount();
+
+    while (1) {
+        vTaskDelayUntil(&wake, pdMS_TO_TICKS(CONFIG_APP_DEADLINE_LOG_INTERVAL_MS));
+        printf("deadlines:\n");
+        for (uint8_t id = 0; id < TELEMETRY_DEADLINE_COUNT; id++) {
+            monitor = telemetry_deadlines[id];
+            telemetry_deadlines[id].epoch++;
+            deadline_print(telemetry_deadline_name(id), &monitor);
+        }
+    }
+}
+#endif
+
 static void usb_uac_device_init(void)
 {
     uac_device_config_t config = {
@@ -97,11 +728,17 @@ static void usb_uac_device_init(void)
 
 void init_pdm_rx(void) {
     i2s_chan_config_t chan_cfg = I2S_CHANNEL_DEFAULT_CONFIG(I2S_NUM_0, I2S_ROLE_MASTER);
+#if CONFIG_APP_SIDETONE_ENABLE
+    // the sidetone task takes every block as it completes
+    chan_cfg.dma_desc_num = SIDETONE_RX_BLOCKS;
+    chan_cfg.dma_frame_num = SIDETONE_FRAMES;
+#endif
     i2s_new_channel(&chan_cfg, NULL, &rx);
 
     i2s_pdm_rx_config_t pdm_cfg = {
         .clk_cfg = I2S_PDM_RX_CLK_DEFAULT_CONFIG(CONFIG_UAC_SAMPLE_RATE),
-        .slot_cfg = I2S_PDM_RX_SLOT_DEFAULT_CONFIG(I2S_DATA_BIT_WIDTH_16BIT, I2S_SLOT_MODE_MONO),
+        .slot_cfg = I2S_PDM_RX_SLOT_DEFAULT_CONFIG(I2S_DATA_BIT_WIDTH_16BIT,
+                                                   MIC_PDM_CHANNELS == 2 ? I2S_SLOT_MODE_STEREO : I2S_SLOT_MODE_MONO),
         .gpio_cfg = {
             .clk = MIC_I2S_CLK,      // PDM clock
             // QUESTION - what about the LR clock pin? No longer relevant? Do we ties it high or low?
@@ -109,7 +746,8 @@ void init_pdm_rx(void) {
             .invert_flags = { .clk_inv = false },
         },
     };
-    pdm_cfg.slot_cfg.slot_mode = I2S_SLOT_MODE_MONO; // single mic
+    // one mic, or two sharing the data line (one per clock edge) which the
+    // DMA interleaves L R just like UAC wants them
 
     i2s_channel_init_pdm_rx_mode(rx, &pdm_cfg);
     i2s_channel_enable(rx);
@@ -117,12 +755,16 @@ void init_pdm_rx(void) {
 
 static void init_pcm_tx(void) {
     i2s_chan_config_t chan_cfg = I2S_CHANNEL_DEFAULT_CONFIG(I2S_NUM_1, I2S_ROLE_MASTER);
+    chan_cfg.dma_desc_num = SPEAKER_I2S_DMA_DESC_NUM;
+    chan_cfg.dma_frame_num = SPEAKER_I2S_DMA_FRAME_NUM;
+    // play silence rather than old buffers when we stop writing
+    chan_cfg.auto_clear = true;
     ESP_ERROR_CHECK(i2s_new_channel(&chan_cfg, &tx, NULL));
 
     i2s_std_config_t std_cfg = {
         .clk_cfg  = I2S_STD_CLK_DEFAULT_CONFIG(CONFIG_UAC_SAMPLE_RATE),
-        .slot_cfg = I2S_STD_MSB_SLOT_DEFAULT_CONFIG(I2S_DATA_BIT_WIDTH_16BIT,
-                                                    I2S_SLOT_MODE_MONO),
+        .slot_cfg = I2S_STD_MSB_SLOT_DEFAULT_CONFIG(SPEAKER_I2S_BIT_WIDTH,
+                                                    SPEAKER_I2S_CHANNELS == 2 ? I2S_SLOT_MODE_STEREO : I2S_SLOT_MODE_MONO),
         .gpio_cfg = {
             .mclk = I2S_GPIO_UNUSED,   // set this if your amp needs MCLK
             .bclk = SPEAKER_I2S_BCLK,
@@ -143,8 +785,71 @@ static void init_pcm_tx(void) {
 
 void app_main(void)
 {
+    telemetry.volume_factor = volume_factor;
+#if CONFIG_APP_SIDETONE_ENABLE
+    sidetone_init(CONFIG_APP_SIDETONE_GAIN_DB);
+#endif
     init_pdm_rx();
     init_pcm_tx();
+
+    for (int c = 0; c < SPEAKER_I2S_CHANNELS; c++) {
+        plc_init(&speaker_plc[c], CONFIG_UAC_SAMPLE_RATE);
+    }
+#if CONFIG_APP_MIC_BEAMFORMER
+#if CONFIG_APP_MIC_BEAM_MVDR
+    const beam_mode_t beam_mode = BEAM_MVDR;
+#else
+    const beam_mode_t beam_mode = BEAM_DELAY_SUM;
+#endif
+    if (!beamformer_init(&mic_beam, beam_mode, CONFIG_UAC_SAMPLE_RATE, CONFIG_APP_MIC_SPACING_MM,
+                         CONFIG_APP_MIC_STEER_DEG)) {
+        printf("mics %dmm apart are too far for the beamformer at %d Hz\n", CONFIG_APP_MIC_SPACING_MM,
+               CONFIG_UAC_SAMPLE_RATE);
+    }
+#endif
+#if CONFIG_APP_MIC_HUM_CANCEL
+    for (int c = 0; c < MIC_CHANNELS; c++) {
+        hum_init(&mic_hum[c], CONFIG_UAC_SAMPLE_RATE, CONFIG_APP_MIC_HUM_HZ, CONFIG_APP_MIC_HUM_HARMONICS);
+    }
+#endif
+#if CONFIG_APP_DEADLINE_MONITOR
+    deadline_init(&telemetry_deadlines[TELEMETRY_DEADLINE_SPK_CB], CONFIG_UAC_SPK_INTERVAL_MS * 1000);
+    deadline_init(&telemetry_deadlines[TELEMETRY_DEADLINE_MIC_CB], CONFIG_UAC_MIC_INTERVAL_MS * 1000);
+    deadline_init(&telemetry_deadlines[TELEMETRY_DEADLINE_SPK_TASK],
+                  1000000LL * SPEAKER_BLOCK_FRAMES / CONFIG_UAC_SAMPLE_RATE);
+#endif
+#if CONFIG_APP_SPEAKER_DITHER
+#if CONFIG_APP_SPEAKER_NOISE_SHAPING
+    format_dither_init(&speaker_dither, 1, true);
+#else
+    format_dither_init(&speaker_dither, 1, false);
+#endif
+#endif
+#if CONFIG_APP_DSP_CHAIN
+    dsp_chain_clear(&dsp_chains[0]);
+    dsp_load_from_nvs();
+#endif
+    speaker_stream = xStreamBufferCreate(SPEAKER_STREAM_BLOCKS * sizeof(SPEAKER_RX_BLOCK), sizeof(SPEAKER_RX_BLOCK));
+#if CONFIG_APP_SIDETONE_ENABLE
+    speaker_pcm = xStreamBufferCreate(SPEAKER_DMA_DESC_NUM * SPEAKER_DMA_FRAME_NUM * SPEAKER_I2S_CHANNELS *
+                                          sizeof(speaker_sample_t), 1);
+    mic_stream = xStreamBufferCreate(MIC_STREAM_BLOCKS * MIC_STREAM_BLOCK_BYTES, sizeof(int16_t) * MIC_PDM_CHANNELS);
+    // above everything else in the audio path - it has a block's time to
+    // get the next one out
+    xTaskCreatePinnedToCore(sidetone_task, "sidetone", 3072, NULL, CONFIG_UAC_SPK_TASK_PRIORITY + 2, NULL,
+                            tskNO_AFFINITY);
+#endif
+    xTaskCreatePinnedToCore(speaker_task, "spk_i2s", 4096, NULL, CONFIG_UAC_SPK_TASK_PRIORITY + 1, NULL, tskNO_AFFINITY);
+
+#if CONFIG_APP_TELEMETRY_ENABLE
+    ESP_ERROR_CHECK(usb_composite_init());
+#if USB_VENDOR_REQUESTS
+    usb_composite_set_vendor_cb(usb_vendor_request);
+#endif
+    xTaskCreatePinnedToCore(telemetry_task, "telemetry", 3072, NULL, tskIDLE_PRIORITY, NULL, tskNO_AFFINITY);
+#elif CONFIG_APP_DEADLINE_MONITOR && CONFIG_APP_DEADLINE_LOG_INTERVAL_MS > 0
+    xTaskCreatePinnedToCore(deadline_task, "deadlines", 3072, NULL, tskIDLE_PRIORITY, NULL, tskNO_AFFINITY);
+#endif
     usb_uac_device_init();
 
     // enable the amplifier
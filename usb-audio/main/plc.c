@@ -0,0 +1,214 @@
+#include "plc.h"
+
+#include <string.h>
+
+// Concealment shape (ms) - similar to G.711 appendix I: hold the repeated
+// period for a bit, then fade it out rather than buzzing forever
+#define PLC_HOLD_MS 10
+#define PLC_FADE_MS 50
+#define PLC_XFADE_MS 5
+// pitch search range (Hz)
+#define PLC_MAX_PITCH_HZ 500
+#define PLC_MIN_PITCH_HZ 50
+// coarse pitch search runs at roughly this rate
+#define PLC_COARSE_RATE 8000
+
+void plc_init(plc_t *plc, int sample_rate)
+{
+    memset(plc, 0, sizeof(*plc));
+    plc->sample_rate = sample_rate;
+    plc->min_period = sample_rate / PLC_MAX_PITCH_HZ;
+    plc->max_period = sample_rate / PLC_MIN_PITCH_HZ;
+    plc->window = plc->max_period / 2;
+    if (plc->max_period + plc->window > PLC_HISTORY_SAMPLES) {
+        plc->max_period = PLC_HISTORY_SAMPLES * 2 / 3;
+        plc->window = PLC_HISTORY_SAMPLES - plc->max_period;
+    }
+    plc->hold_samples = sample_rate * PLC_HOLD_MS / 1000;
+    plc->fade_samples = sample_rate * PLC_FADE_MS / 1000;
+    plc->xfade_samples = sample_rate * PLC_XFADE_MS / 1000;
+}
+
+static void push_history(plc_t *plc, const int16_t *samples, size_t n)
+{
+    if (n >= PLC_HISTORY_SAMPLES) {
+        memcpy(plc->history, samples + n - PLC_HISTORY_SAMPLES, sizeof(plc->history));
+        return;
+    }
+    memmove(plc->history, plc->history + n, (PLC_HISTORY_SAMPLES - n) * sizeof(int16_t));
+    memcpy(plc->history + PLC_HISTORY_SAMPLES - n, samples, n * sizeof(int16_t));
+}
+
+// Sign preserving normalised correlation (squared) of x against y. The energy
+// of x is the same for every lag so it is left out.
+static float correlation(const int16_t *x, const int16_t *y, int n, int step)
+{
+    int64_t xy = 0;
+    int64_t yy = 0;
+    for (int i = 0; i < n; i += step) {
+        xy += (int32_t)x[i] * y[i];
+        yy += (int32_t)y[i] * y[i];
+    }
+    if (yy == 0) {
+        return 0;
+    }
+    float c = (float)xy;
+    return (c < 0 ? -c * c : c * c) / (float)yy;
+}
+
+// Find the pitch period of the end of the history. A coarse search over every
+// `step`th sample and lag, then a full rate search around the best coarse lag.
+static int find_period(const plc_t *plc)
+{
+    const int16_t *x = plc->history + PLC_HISTORY_SAMPLES - plc->window;
+    int step = plc->sample_rate / PLC_COARSE_RATE;
+    if (step < 1) {
+        step = 1;
+    }
+    int best = plc->max_period;
+    float best_score = -1.0f;
+    for (int lag = plc->min_period; lag <= plc->max_period; lag += step) {
+        float score = correlation(x, x - lag, plc->window, step);
+        if (score > best_score) {
+            best_score = score;
+            best = lag;
+        }
+    }
+    if (step > 1) {
+        int lo = best - step + 1 < plc->min_period ? plc->min_period : best - step + 1;
+        int hi = best + step - 1 > plc->max_period ? plc->max_period : best + step - 1;
+        best_score = -1.0f;
+        for (int lag = lo; lag <= hi; lag++) {
+            float score = correlation(x, x - lag, plc->window, 1);
+            if (score > best_score) {
+                best_score = score;
+                best = lag;
+            }
+        }
+    }
+    return best;
+}
+
+static void start_concealment(plc_t *plc)
+{
+    const int16_t *h = plc->history;
+    plc->concealing = true;
+    plc->period = find_period(plc);
+    plc->pos = 0;
+    plc->conceal_count = 0;
+    plc->splice = (int32_t)h[PLC_HISTORY_SAMPLES - 1] - h[PLC_HISTORY_SAMPLES - 1 - plc->period];
+    plc->loss_events++;
+}
+
+// Next sample of the repeated period, with the join smoothed and the hold/fade
+// envelope applied
+static int16_t next_sample(plc_t *plc)
+{
+    const int16_t *segment = plc->history + PLC_HISTORY_SAMPLES - plc->period;
+    int32_t s = segment[plc->pos];
+    if (++plc->pos == plc->period) {
+        plc->pos = 0;
+    }
+    // walk the step at the join down to zero over the first quarter period
+    const int splice_len = plc->period / 4 + 1;
+    const int k = plc->conceal_count;
+    if (k < splice_len) {
+        s += plc->splice * (splice_len - 1 - k) / splice_len;
+    }
+    if (k >= plc->hold_samples) {
+        int faded = k - plc->hold_samples;
+        if (faded >= plc->fade_samples) {
+            s = 0;
+        } else {
+            s = s * (plc->fade_samples - faded) / plc->fade_samples;
+        }
+    }
+    plc->conceal_count++;
+    if (s > 32767) {
+        s = 32767;
+    } else if (s < -32768) {
+        s = -32768;
+    }
+    return (int16_t)s;
+}
+
+void plc_conceal(plc_t *plc, int16_t *out, size_t n)
+{
+    if (!plc->concealing) {
+        start_concealment(plc);
+    }
+    if (plc_is_silent(plc)) {
+        memset(out, 0, n * sizeof(int16_t));
+    } else {
+        for (size_t i = 0; i < n; i++) {
+            out[i] = next_sample(plc);
+        }
+    }
+    plc->concealed_samples += n;
+}
+
+void plc_good_frame(plc_t *plc, int16_t *samples, size_t n)
+{
+    if (plc->concealing) {
+        int len = plc->xfade_samples < (int)n ? plc->xfade_samples : (int)n;
+        bool silent = plc_is_silent(plc);
+        for (int i = 0; i < len; i++) {
+            int32_t synth = silent ? 0 : next_sample(plc);
+            samples[i] = (int16_t)(((int32_t)samples[i] * i + synth * (len - i)) / len);
+        }
+        plc->concealing = false;
+    }
+    push_history(plc, samples, n);
+}
+
+bool plc_is_silent(const plc_t *plc)
+{
+    return plc->concealing && plc->conceal_count >= plc->hold_samples + plc->fade_samples;
+}
+
+// 32 bit versions for the wider speaker formats. The pitch history only needs
+// 16 bits, so the concealment itself is 16 bit scaled up, but real audio and
+// the cross-fade into it keep their full resolution.
+
+void plc_conceal_s32(plc_t *plc, int32_t *out, size_t n)
+{
+    if (!plc->concealing) {
+        start_concealment(plc);
+    }
+    if (plc_is_silent(plc)) {
+        memset(out, 0, n * sizeof(int32_t));
+    } else {
+        for (size_t i = 0; i < n; i++) {
+            out[i] = (int32_t)next_sample(plc) * 65536;
+        }
+    }
+    plc->concealed_samples += n;
+}
+
+void plc_good_frame_s32(plc_t *plc, int32_t *samples, size_t n)
+{
+    if (plc->concealing) {
+        int len = plc->xfade_samples < (int)n ? plc->xfade_samples : (int)n;
+        bool silent = plc_is_silent(plc);
+        for (int i = 0; i < len; i++) {
+            int64_t synth = silent ? 0 : (int64_t)next_sample(plc) * 65536;
+            samples[i] = (int32_t)(((int64_t)samples[i] * i + synth * (len - i)) / len);
+        }
+        plc->concealing = false;
+    }
+    // only the newest PLC_HISTORY_SAMPLES matter
+    if (n > PLC_HISTORY_SAMPLES) {
+        samples += n - PLC_HISTORY_SAMPLES;
+        n = PLC_HISTORY_SAMPLES;
+    }
+    int16_t narrow[256];
+    while (n > 0) {
+        size_t chunk = n < 256 ? n : 256;
+        for (size_t i = 0; i < chunk; i++) {
+            narrow[i] = (int16_t)(samples[i] >> 16);
+        }
+        push_history(plc, narrow, chunk);
+        samples += chunk;
+        n -= chunk;
+    }
+}
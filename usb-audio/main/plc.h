@@ -0,0 +1,67 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Packet loss concealment for the speaker path.
+//
+// When the host misses a UAC interval we repeat the last pitch period of what
+// was played (found by autocorrelation), splice it in without a step, hold it
+// for a short while and then fade to silence. When real audio comes back it is
+// cross-faded in from the concealment so there is no click either way.
+
+// History has to hold the longest pitch period plus the correlation window
+#define PLC_HISTORY_SAMPLES 2048
+
+typedef struct {
+    int16_t history[PLC_HISTORY_SAMPLES]; // last samples played, oldest first
+    int sample_rate;
+    int min_period;    // shortest pitch period we search for (samples)
+    int max_period;    // longest pitch period we search for (samples)
+    int window;        // correlation window (samples)
+    int hold_samples;  // full level concealment before fading
+    int fade_samples;  // fade to silence after the hold
+    int xfade_samples; // cross-fade back to real audio
+
+    bool concealing;
+    int period;        // pitch period used for this loss event
+    int pos;           // position within the repeated period
+    int conceal_count; // samples concealed in this loss event
+    int32_t splice;    // step between the history and the repeated period
+
+    // statistics
+    uint32_t loss_events;
+    uint32_t concealed_samples;
+} plc_t;
+
+void plc_init(plc_t *plc, int sample_rate);
+
+// Real audio. If we were concealing, the start of the block is cross-faded
+// in place from the concealment.
+void plc_good_frame(plc_t *plc, int16_t *samples, size_t n);
+
+// No audio arrived in time - fill `out` with concealment
+void plc_conceal(plc_t *plc, int16_t *out, size_t n);
+
+// The same for 32 bit samples (24-in-32 or 32 bit speaker formats)
+void plc_good_frame_s32(plc_t *plc, int32_t *samples, size_t n);
+void plc_conceal_s32(plc_t *plc, int32_t *out, size_t n);
+
+#ifndef __cplusplus
+// Pick the version for the sample type at compile time
+#define PLC_GOOD_FRAME(plc, samples, n) \
+    _Generic((samples), int16_t *: plc_good_frame, int32_t *: plc_good_frame_s32)(plc, samples, n)
+#define PLC_CONCEAL(plc, out, n) _Generic((out), int16_t *: plc_conceal, int32_t *: plc_conceal_s32)(plc, out, n)
+#endif
+
+// True once the concealment has faded all the way out
+bool plc_is_silent(const plc_t *plc);
+
+#ifdef __cplusplus
+}
+#endif
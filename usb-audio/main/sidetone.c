@@ -0,0 +1,176 @@
+#include "sidetone.h"
+
+#include "channels.h"
+
+#include <math.h>
+
+// Mic -> speaker sidetone.
+//
+// The UAC tasks move audio 10ms at a time and the speaker DMA holds 30ms of
+// jitter buffer, so mixing there would put the mic tens of ms behind - more
+// than going through the host. Instead main.c's sidetone task owns both I2S
+// channels and moves SIDETONE_BLOCK_FRAMES at a time: each block read from the
+// PDM DMA is mixed here straight into the host audio going out with it, and
+// the speaker DMA only holds SIDETONE_TX_BLOCKS of those.
+//
+// The mic and speaker I2S channels are both clocked from the same source at
+// CONFIG_UAC_SAMPLE_RATE, so there is no long term drift between them. The
+// task is paced by the mic DMA and writes exactly what it reads, so the
+// speaker queue stays the same depth and every mic sample is played once.
+
+static volatile int16_t gain_q15 = 0;
+static volatile int gain_db_current = SIDETONE_MUTE_DB;
+
+static inline int16_t sat16(int32_t v)
+{
+    v = v < -32768 ? -32768 : v;
+    return (int16_t)(v > 32767 ? 32767 : v);
+}
+
+void sidetone_mix_s16(int16_t *__restrict out, const int16_t *__restrict mic, size_t n, int16_t gain)
+{
+    // Plain, branch free loop - GCC turns this into packed multiply/saturate
+    // on the host and the Xtensa zero overhead loop keeps it tight on the S3.
+    const int32_t g = gain;
+    for (size_t i = 0; i < n; i++) {
+        int32_t m = ((int32_t)mic[i] * g + (1 << 14)) >> 15;
+        out[i] = sat16((int32_t)out[i] + m);
+    }
+}
+
+void sidetone_mix2_s16(int16_t *__restrict out, const int16_t *__restrict mic, size_t frames, int16_t gain)
+{
+    const int32_t g = gain;
+    for (size_t i = 0; i < frames; i++) {
+        int32_t m = ((int32_t)mic[i] * g + (1 << 14)) >> 15;
+        out[2 * i] = sat16((int32_t)out[2 * i] + m);
+        out[2 * i + 1] = sat16((int32_t)out[2 * i + 1] + m);
+    }
+}
+
+static inline int32_t sat32(int64_t v)
+{
+    v = v < INT32_MIN ? INT32_MIN : v;
+    return (int32_t)(v > INT32_MAX ? INT32_MAX : v);
+}
+
+// For the 32 bit speaker formats the Q30 product only needs shifting up one
+// to be Q31, so the mic loses nothing
+void sidetone_mix_s32(int32_t *__restrict out, const int16_t *__restrict mic, size_t n, int16_t gain)
+{
+    const int32_t g = gain;
+    for (size_t i = 0; i < n; i++) {
+        int64_t m = (int64_t)((int32_t)mic[i] * g) * 2;
+        out[i] = sat32((int64_t)out[i] + m);
+    }
+}
+
+void sidetone_mix2_s32(int32_t *__restrict out, const int16_t *__restrict mic, size_t frames, int16_t gain)
+{
+    const int32_t g = gain;
+    for (size_t i = 0; i < frames; i++) {
+        int64_t m = (int64_t)((int32_t)mic[i] * g) * 2;
+        out[2 * i] = sat32((int64_t)out[2 * i] + m);
+        out[2 * i + 1] = sat32((int64_t)out[2 * i + 1] + m);
+    }
+}
+
+static void mix_s32(int32_t *out, const int16_t *mic, size_t frames, int channels, int16_t gain)
+{
+    if (channels == 1) {
+        sidetone_mix_s32(out, mic, frames, gain);
+    } else if (channels == 2) {
+        sidetone_mix2_s32(out, mic, frames, gain);
+    } else {
+        for (size_t i = 0; i < frames; i++) {
+            int64_t m = (int64_t)((int32_t)mic[i] * gain) * 2;
+            for (int c = 0; c < channels; c++) {
+                out[i * channels + c] = sat32((int64_t)out[i * channels + c] + m);
+            }
+        }
+    }
+}
+
+static void mix_s16(int16_t *out, const int16_t *mic, size_t frames, int channels, int16_t gain)
+{
+    if (channels == 1) {
+        sidetone_mix_s16(out, mic, frames, gain);
+    } else if (channels == 2) {
+        sidetone_mix2_s16(out, mic, frames, gain);
+    } else {
+        for (size_t i = 0; i < frames; i++) {
+            int32_t m = ((int32_t)mic[i] * gain + (1 << 14)) >> 15;
+            for (int c = 0; c < channels; c++) {
+                out[i * channels + c] = sat16((int32_t)out[i * channels + c] + m);
+            }
+        }
+    }
+}
+
+void sidetone_set_gain_db(int gain_db)
+{
+    if (gain_db <= SIDETONE_MUTE_DB) {
+        gain_q15 = 0;
+        gain_db_current = SIDETONE_MUTE_DB;
+        return;
+    }
+    if (gain_db > 0) {
+        gain_db = 0;
+    }
+    float g = powf(10.0f, gain_db / 20.0f) * 32768.0f;
+    gain_q15 = (int16_t)(g > 32767.0f ? 32767.0f : g);
+    gain_db_current = gain_db;
+}
+
+int sidetone_get_gain_db(void)
+{
+    return gain_db_current;
+}
+
+void sidetone_init(int gain_db)
+{
+    sidetone_set_gain_db(gain_db);
+}
+
+void sidetone_apply(int16_t *out, const int16_t *mic, size_t frames, int channels, int mic_channels)
+{
+    const int16_t gain = gain_q15;
+    if (gain == 0) {
+        return;
+    }
+    if (mic_channels == 1) {
+        mix_s16(out, mic, frames, channels, gain);
+        return;
+    }
+    // downmix in chunks so the stack use stays small
+    int16_t mono[256];
+    while (frames > 0) {
+        size_t n = frames < 256 ? frames : 256;
+        downmix_s16(mic, mono, n, mic_channels);
+        mix_s16(out, mono, n, channels, gain);
+        out += n * channels;
+        mic += n * mic_channels;
+        frames -= n;
+    }
+}
+
+void sidetone_apply_s32(int32_t *out, const int16_t *mic, size_t frames, int channels, int mic_channels)
+{
+    const int16_t gain = gain_q15;
+    if (gain == 0) {
+        return;
+    }
+    if (mic_channels == 1) {
+        mix_s32(out, mic, frames, channels, gain);
+        return;
+    }
+    int16_t mono[256];
+    while (frames > 0) {
+        size_t n = frames < 256 ? frames : 256;
+        downmix_s16(mic, mono, n, mic_channels);
+        mix_s32(out, mono, n, channels, gain);
+        out += n * channels;
+        mic += n * mic_channels;
+        frames -= n;
+    }
+}
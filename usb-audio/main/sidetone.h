@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Gains at or below this value switch the sidetone off completely
+#define SIDETONE_MUTE_DB -60
+
+// The sidetone path moves the mic to the amp this many frames at a time
+// (1/6ms), with this many of those blocks queued in the speaker DMA. A mic
+// sample waits at most one block to be read and the queue to be played, so
+// it reaches the amp within SIDETONE_LATENCY_FRAMES.
+#define SIDETONE_BLOCK_FRAMES(sample_rate) ((sample_rate) / 6000)
+#define SIDETONE_TX_BLOCKS 3
+#define SIDETONE_LATENCY_FRAMES(sample_rate) (SIDETONE_BLOCK_FRAMES(sample_rate) * (1 + SIDETONE_TX_BLOCKS))
+
+// Mix a Q15-scaled copy of `mic` into `out` in place, saturating to int16.
+// This is the per-sample kernel - it has no state and no IDF dependencies so
+// it can be benchmarked on the host.
+void sidetone_mix_s16(int16_t *__restrict out, const int16_t *__restrict mic, size_t n, int16_t gain_q15);
+// The same for an interleaved stereo `out` - each mic sample goes into both
+// channels of its frame
+void sidetone_mix2_s16(int16_t *__restrict out, const int16_t *__restrict mic, size_t frames, int16_t gain_q15);
+// ... and for 32 bit speaker samples
+void sidetone_mix_s32(int32_t *__restrict out, const int16_t *__restrict mic, size_t n, int16_t gain_q15);
+void sidetone_mix2_s32(int32_t *__restrict out, const int16_t *__restrict mic, size_t frames, int16_t gain_q15);
+
+// Set the gain in dB (<= SIDETONE_MUTE_DB is off)
+void sidetone_init(int gain_db);
+void sidetone_set_gain_db(int gain_db);
+int sidetone_get_gain_db(void);
+
+// Called from the sidetone task with each block read from the PDM mic
+// (`mic_channels` interleaved, downmixed to mono) and the speaker block it
+// goes out with. Mixes the mic into every channel of `out`.
+void sidetone_apply(int16_t *out, const int16_t *mic, size_t frames, int channels, int mic_channels);
+void sidetone_apply_s32(int32_t *out, const int16_t *mic, size_t frames, int channels, int mic_channels);
+#ifndef __cplusplus
+#define SIDETONE_APPLY(out, mic, frames, channels, mic_channels) \
+    _Generic((out), int16_t *: sidetone_apply, int32_t *: sidetone_apply_s32)(out, mic, frames, channels, mic_channels)
+#endif
+
+#ifdef __cplusplus
+}
+#endif
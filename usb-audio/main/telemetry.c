@@ -0,0 +1,202 @@
+#include "telemetry.h"
+
+#include <string.h>
+
+telemetry_t telemetry;
+volatile uint32_t telemetry_epoch;
+deadline_monitor_t telemetry_deadlines[TELEMETRY_DEADLINE_COUNT];
+
+const char *telemetry_deadline_name(uint8_t id)
+{
+    static const char *const names[TELEMETRY_DEADLINE_COUNT] = {"output_cb", "input_cb", "speaker task"};
+    return id < TELEMETRY_DEADLINE_COUNT ? names[id] : "?";
+}
+
+// ====================== CRC-16/CCITT (0x1021, init 0xFFFF, no XORout)
+// ====================== (same as serial-mic, so the frontend can check it)
+uint16_t telemetry_crc16(const uint8_t *data, size_t len)
+{
+    uint16_t crc = 0xFFFF;
+    for (size_t i = 0; i < len; ++i) {
+        crc ^= (uint16_t)data[i] << 8;
+        for (int b = 0; b < 8; ++b) {
+            if (crc & 0x8000) {
+                crc = (crc << 1) ^ 0x1021;
+            } else {
+                crc <<= 1;
+            }
+        }
+    }
+    return crc;
+}
+
+static inline uint8_t *le_write16(uint8_t *p, uint16_t v)
+{
+    p[0] = (uint8_t)(v & 0xFF);
+    p[1] = (uint8_t)((v >> 8) & 0xFF);
+    return p + 2;
+}
+
+static inline uint8_t *le_write32(uint8_t *p, uint32_t v)
+{
+    p[0] = (uint8_t)(v & 0xFF);
+    p[1] = (uint8_t)((v >> 8) & 0xFF);
+    p[2] = (uint8_t)((v >> 16) & 0xFF);
+    p[3] = (uint8_t)((v >> 24) & 0xFF);
+    return p + 4;
+}
+
+static inline uint16_t le_read16(const uint8_t *p)
+{
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static inline uint32_t le_read32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline uint16_t clamp16(uint32_t v)
+{
+    return v > 0xFFFF ? 0xFFFF : (uint16_t)v;
+}
+
+// Writes the header and zeroes the payload, returning where it starts
+static uint8_t *begin_packet(uint8_t *buf, uint16_t payload_len, uint32_t seq, uint32_t usec)
+{
+    uint8_t *p = buf;
+    *p++ = TELEMETRY_SYNC;
+    p = le_write16(p, payload_len);
+    p = le_write32(p, seq);
+    p = le_write32(p, usec);
+    memset(p, 0, payload_len);
+    return p;
+}
+
+// Appends the CRC over header and payload, returning the packet length
+static size_t end_packet(uint8_t *buf, uint16_t payload_len)
+{
+    uint8_t *p = buf + TELEMETRY_HEADER_LEN + payload_len;
+    p = le_write16(p, telemetry_crc16(buf, TELEMETRY_HEADER_LEN + payload_len));
+    return (size_t)(p - buf);
+}
+
+size_t telemetry_encode(const telemetry_t *t, uint32_t seq, uint32_t usec, uint8_t *buf)
+{
+    uint8_t *p = begin_packet(buf, TELEMETRY_PAYLOAD_LEN, seq, usec);
+    *p++ = TELEMETRY_TYPE_STATUS;
+    *p++ = TELEMETRY_VERSION;
+    // speaker
+    p = le_write32(p, t->spk_cb.calls);
+    p = le_write16(p, clamp16(t->spk_cb.last_us));
+    p = le_write16(p, clamp16(t->spk_cb.max_us));
+    p = le_write32(p, t->spk_overruns);
+    p = le_write32(p, t->spk_clipped);
+    p = le_write32(p, t->spk_loss_events);
+    p = le_write32(p, t->spk_concealed);
+    p = le_write16(p, clamp16(t->spk_stream_fill));
+    // mic
+    p = le_write32(p, t->mic_cb.calls);
+    p = le_write16(p, clamp16(t->mic_cb.last_us));
+    p = le_write16(p, clamp16(t->mic_cb.max_us));
+    p = le_write32(p, t->mic_errors);
+    p = le_write32(p, t->mic_clipped);
+    // controls
+    p = le_write16(p, (uint16_t)(int16_t)t->volume_db);
+    p = le_write16(p, clamp16(t->volume_factor));
+    *p++ = (uint8_t)(t->muted != 0);
+    // cpu
+    *p++ = t->cpu_load[0];
+    *p++ = t->cpu_load[1];
+    // the rest of the payload is reserved (zero)
+    return end_packet(buf, TELEMETRY_PAYLOAD_LEN);
+}
+
+bool telemetry_decode_payload(const uint8_t *payload, size_t len, telemetry_t *t)
+{
+    if (len < TELEMETRY_PAYLOAD_LEN || payload[0] != TELEMETRY_TYPE_STATUS || payload[1] != TELEMETRY_VERSION) {
+        return false;
+    }
+    const uint8_t *p = payload + 2;
+    memset(t, 0, sizeof(*t));
+    t->spk_cb.calls = le_read32(p); p += 4;
+    t->spk_cb.last_us = le_read16(p); p += 2;
+    t->spk_cb.max_us = le_read16(p); p += 2;
+    t->spk_overruns = le_read32(p); p += 4;
+    t->spk_clipped = le_read32(p); p += 4;
+    t->spk_loss_events = le_read32(p); p += 4;
+    t->spk_concealed = le_read32(p); p += 4;
+    t->spk_stream_fill = le_read16(p); p += 2;
+    t->mic_cb.calls = le_read32(p); p += 4;
+    t->mic_cb.last_us = le_read16(p); p += 2;
+    t->mic_cb.max_us = le_read16(p); p += 2;
+    t->mic_errors = le_read32(p); p += 4;
+    t->mic_clipped = le_read32(p); p += 4;
+    t->volume_db = (int16_t)le_read16(p); p += 2;
+    t->volume_factor = le_read16(p); p += 2;
+    t->muted = *p++;
+    t->cpu_load[0] = *p++;
+    t->cpu_load[1] = *p++;
+    return true;
+}
+
+size_t telemetry_encode_deadline(const deadline_monitor_t *m, uint8_t id, uint32_t seq, uint32_t usec, uint8_t *buf)
+{
+    uint8_t *p = begin_packet(buf, TELEMETRY_DEADLINE_PAYLOAD_LEN, seq, usec);
+    *p++ = TELEMETRY_TYPE_DEADLINE;
+    *p++ = TELEMETRY_VERSION;
+    *p++ = id;
+    p = le_write32(p, m->interval_us);
+    p = le_write32(p, m->calls);
+    p = le_write32(p, m->misses);
+    p = le_write32(p, (uint32_t)m->min_slack_us);
+    for (int b = 0; b < DEADLINE_HIST_BUCKETS; b++) {
+        p = le_write32(p, m->histogram[b]);
+    }
+    uint32_t count = m->worst_count < DEADLINE_WORST ? m->worst_count : DEADLINE_WORST;
+    *p++ = (uint8_t)count;
+    for (uint32_t i = 0; i < count; i++) {
+        const deadline_event_t *e = &m->worst[i];
+        p = le_write32(p, e->at_us);
+        p = le_write32(p, (uint32_t)e->slack_us);
+        p = le_write16(p, clamp16(e->duration_us));
+        p = le_write16(p, clamp16(e->late_us));
+        p = le_write16(p, clamp16(e->preempted_us));
+        p = le_write16(p, clamp16(e->fill));
+        *p++ = e->core;
+    }
+    return end_packet(buf, TELEMETRY_DEADLINE_PAYLOAD_LEN);
+}
+
+bool telemetry_decode_deadline(const uint8_t *payload, size_t len, uint8_t *id, deadline_monitor_t *m)
+{
+    if (len < TELEMETRY_DEADLINE_PAYLOAD_LEN || payload[0] != TELEMETRY_TYPE_DEADLINE ||
+        payload[1] != TELEMETRY_VERSION) {
+        return false;
+    }
+    const uint8_t *p = payload + 2;
+    memset(m, 0, sizeof(*m));
+    *id = *p++;
+    m->interval_us = le_read32(p); p += 4;
+    m->calls = le_read32(p); p += 4;
+    m->misses = le_read32(p); p += 4;
+    m->min_slack_us = (int32_t)le_read32(p); p += 4;
+    for (int b = 0; b < DEADLINE_HIST_BUCKETS; b++) {
+        m->histogram[b] = le_read32(p); p += 4;
+    }
+    m->worst_count = *p++;
+    if (m->worst_count > DEADLINE_WORST) {
+        return false;
+    }
+    for (uint32_t i = 0; i < m->worst_count; i++) {
+        deadline_event_t *e = &m->worst[i];
+        e->at_us = le_read32(p); p += 4;
+        e->slack_us = (int32_t)le_read32(p); p += 4;
+        e->duration_us = le_read16(p); p += 2;
+        e->late_us = le_read16(p); p += 2;
+        e->preempted_us = le_read16(p); p += 2;
+        e->fill = le_read16(p); p += 2;
+        e->core = *p++;
+    }
+    return true;
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "deadline.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Runtime counters for the audio paths, streamed to the host as telemetry
+// packets using the serial-mic framing:
+//
+// [0xA6][uint16 len][uint32 seq][uint32 usec][payload][uint16 crc]
+//
+// The payload starts with a type byte and a version byte so the host can tell
+// it apart from audio. Everything is little-endian. There are two types:
+// TELEMETRY_TYPE_STATUS with the counters below, and TELEMETRY_TYPE_DEADLINE
+// with one deadline monitor (deadline.h).
+//
+// Every counter has exactly one writer - the task that owns that part of the
+// audio path - and the telemetry task only ever reads them, so the audio
+// callbacks never wait on telemetry. Aligned 32 bit loads and stores are
+// atomic on the ESP32, which is all the consistency we need.
+
+#define TELEMETRY_SYNC 0xA6
+#define TELEMETRY_TYPE_STATUS 0x01
+#define TELEMETRY_TYPE_DEADLINE 0x02
+#define TELEMETRY_VERSION 1
+#define TELEMETRY_HEADER_LEN (1 + 2 + 4 + 4)
+#define TELEMETRY_TRAILER_LEN 2
+#define TELEMETRY_PAYLOAD_LEN 64
+#define TELEMETRY_DEADLINE_PAYLOAD_LEN 152
+#define TELEMETRY_MAX_PACKET_LEN (TELEMETRY_HEADER_LEN + TELEMETRY_DEADLINE_PAYLOAD_LEN + TELEMETRY_TRAILER_LEN)
+
+// which deadline monitor a TELEMETRY_TYPE_DEADLINE packet describes
+#define TELEMETRY_DEADLINE_SPK_CB 0   // usb_uac_device_output_cb
+#define TELEMETRY_DEADLINE_MIC_CB 1   // usb_uac_device_input_cb
+#define TELEMETRY_DEADLINE_SPK_TASK 2 // a block through the speaker task
+#define TELEMETRY_DEADLINE_COUNT 3
+
+// Execution time of one callback. The max is per telemetry period: the
+// telemetry task bumps `epoch` and the callback starts a new max when it
+// notices, so the two never write the same field.
+typedef struct {
+    uint32_t calls;
+    uint32_t last_us;
+    uint32_t max_us;
+    uint32_t seen_epoch;
+} telemetry_timing_t;
+
+typedef struct {
+    // speaker path
+    telemetry_timing_t spk_cb;
+    uint32_t spk_overruns;    // host audio that didn't fit in the speaker stream buffer
+    uint32_t spk_clipped;     // samples clipped by the volume stage
+    uint32_t spk_loss_events; // times the speaker task had to start concealment
+    uint32_t spk_concealed;   // samples of concealment played
+    uint32_t spk_stream_fill; // bytes waiting for the speaker task
+    // mic path
+    telemetry_timing_t mic_cb;
+    uint32_t mic_errors;  // I2S reads that failed
+    uint32_t mic_clipped; // samples at full scale
+    // controls
+    int32_t volume_db;
+    uint32_t volume_factor;
+    uint32_t muted;
+    // CPU load per core, percent (filled in by the telemetry task)
+    uint8_t cpu_load[2];
+} telemetry_t;
+
+extern telemetry_t telemetry;
+// bumped by the telemetry task after each packet
+extern volatile uint32_t telemetry_epoch;
+// indexed by TELEMETRY_DEADLINE_*, written by the monitored code
+extern deadline_monitor_t telemetry_deadlines[TELEMETRY_DEADLINE_COUNT];
+
+// Short name of a deadline monitor for printing
+const char *telemetry_deadline_name(uint8_t id);
+
+static inline void telemetry_record_time(telemetry_timing_t *t, uint32_t us)
+{
+    uint32_t epoch = telemetry_epoch;
+    if (t->seen_epoch != epoch) {
+        t->seen_epoch = epoch;
+        t->max_us = 0;
+    }
+    if (us > t->max_us) {
+        t->max_us = us;
+    }
+    t->last_us = us;
+    t->calls++;
+}
+
+// Frame the current counters into `buf` (at least TELEMETRY_MAX_PACKET_LEN
+// bytes). Returns the packet length.
+size_t telemetry_encode(const telemetry_t *t, uint32_t seq, uint32_t usec, uint8_t *buf);
+
+// Decode a status payload (the bytes between the header and the CRC). Returns
+// false if it isn't a telemetry status payload we understand.
+bool telemetry_decode_payload(const uint8_t *payload, size_t len, telemetry_t *t);
+
+// The same for a deadline monitor, and back. The decoded monitor only has
+// the reported fields filled in.
+size_t telemetry_encode_deadline(const deadline_monitor_t *m, uint8_t id, uint32_t seq, uint32_t usec, uint8_t *buf);
+bool telemetry_decode_deadline(const uint8_t *payload, size_t len, uint8_t *id, deadline_monitor_t *m);
+
+uint16_t telemetry_crc16(const uint8_t *data, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
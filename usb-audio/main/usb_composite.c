@@ -0,0 +1,195 @@
+// UAC + CDC composite device for the telemetry channel.
+//
+// With CONFIG_USB_DEVICE_UAC_AS_PART the usb_device_uac component only runs
+// the audio class - the application brings up TinyUSB, owns the device and
+// configuration descriptors and runs the device task. We put the component's
+// audio interfaces first and add a CDC ACM port after them. The audio
+// callbacks never touch the CDC side: the telemetry task writes whatever fits
+// in the CDC FIFO and drops the rest, so a closed or slow port on the host
+// costs the audio nothing.
+#include "sdkconfig.h"
+
+#if CONFIG_APP_TELEMETRY_ENABLE
+
+#include <string.h>
+
+#include "esp_log.h"
+#include "esp_private/usb_phy.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "tusb.h"
+#include "uac_descriptors.h"
+#include "usb_composite.h"
+
+#if !CFG_TUD_CDC
+#error "Telemetry needs CFG_TUD_CDC enabled in the TinyUSB config"
+#endif
+
+static const char *TAG = "usb_composite";
+
+// The component's audio interfaces come first (ITF_NUM_AUDIO_CONTROL ..
+// ITF_NUM_TOTAL - 1), then the CDC control and data interfaces.
+enum {
+    ITF_NUM_CDC = ITF_NUM_TOTAL,
+    ITF_NUM_CDC_DATA,
+    ITF_NUM_COMPOSITE_TOTAL,
+};
+
+// Audio uses EP1 (speaker out, mic in) and EP2 (feedback), so CDC gets 3 and 4.
+#define EPNUM_CDC_NOTIF 0x83
+#define EPNUM_CDC_OUT 0x04
+#define EPNUM_CDC_IN 0x84
+#define CDC_EP_SIZE 64
+
+enum {
+    STRID_LANGID = 0,
+    STRID_MANUFACTURER,
+    STRID_PRODUCT,
+    STRID_SERIAL,
+    STRID_AUDIO,
+    STRID_CDC,
+};
+
+#define CONFIG_TOTAL_LEN (TUD_CONFIG_DESC_LEN + TUD_AUDIO_DEVICE_DESC_LEN + TUD_CDC_DESC_LEN)
+
+static const tusb_desc_device_t device_descriptor = {
+    .bLength = sizeof(tusb_desc_device_t),
+    .bDescriptorType = TUSB_DESC_DEVICE,
+    .bcdUSB = 0x0200,
+    // interface association descriptors
+    .bDeviceClass = TUSB_CLASS_MISC,
+    .bDeviceSubClass = MISC_SUBCLASS_COMMON,
+    .bDeviceProtocol = MISC_PROTOCOL_IAD,
+    .bMaxPacketSize0 = CFG_TUD_ENDPOINT0_SIZE,
+    .idVendor = CONFIG_UAC_TUSB_VID,
+    // a different PID so hosts don't reuse the audio-only driver binding
+    .idProduct = CONFIG_UAC_TUSB_PID + 1,
+    .bcdDevice = 0x0100,
+    .iManufacturer = STRID_MANUFACTURER,
+    .iProduct = STRID_PRODUCT,
+    .iSerialNumber = STRID_SERIAL,
+    .bNumConfigurations = 1,
+};
+
+static const uint8_t configuration_descriptor[] = {
+    TUD_CONFIG_DESCRIPTOR(1, ITF_NUM_COMPOSITE_TOTAL, 0, CONFIG_TOTAL_LEN, 0x00, 100),
+    TUD_AUDIO_DEVICE_DESCRIPTOR(STRID_AUDIO, EPNUM_AUDIO_OUT, EPNUM_AUDIO_IN, EPNUM_AUDIO_FB),
+    TUD_CDC_DESCRIPTOR(ITF_NUM_CDC, STRID_CDC, EPNUM_CDC_NOTIF, 8, EPNUM_CDC_OUT, EPNUM_CDC_IN, CDC_EP_SIZE),
+};
+
+static const char *string_descriptors[] = {
+    NULL, // language, handled below
+    CONFIG_UAC_TUSB_MANUFACTURER,
+    CONFIG_UAC_TUSB_PRODUCT,
+    CONFIG_UAC_TUSB_SERIAL_NUM,
+    "USB Audio",
+    "Telemetry",
+};
+
+const uint8_t *tud_descriptor_device_cb(void)
+{
+    return (const uint8_t *)&device_descriptor;
+}
+
+const uint8_t *tud_descriptor_configuration_cb(uint8_t index)
+{
+    (void)index;
+    return configuration_descriptor;
+}
+
+const uint16_t *tud_descriptor_string_cb(uint8_t index, uint16_t langid)
+{
+    (void)langid;
+    static uint16_t desc[32];
+    size_t len;
+    if (index == STRID_LANGID) {
+        desc[1] = 0x0409; // English
+        len = 1;
+    } else if (index < sizeof(string_descriptors) / sizeof(string_descriptors[0])) {
+        const char *str = string_descriptors[index];
+        len = strlen(str);
+        if (len > 31) {
+            len = 31;
+        }
+        for (size_t i = 0; i < len; i++) {
+            desc[1 + i] = str[i];
+        }
+    } else {
+        return NULL;
+    }
+    desc[0] = (uint16_t)((TUSB_DESC_STRING << 8) | (2 * len + 2));
+    return desc;
+}
+
+static void tusb_device_task(void *arg)
+{
+    while (1) {
+        tud_task();
+    }
+}
+
+esp_err_t usb_composite_init(void)
+{
+    static usb_phy_handle_t phy;
+    usb_phy_config_t phy_config = {
+        .controller = USB_PHY_CTRL_OTG,
+        .target = USB_PHY_TARGET_INT,
+        .otg_mode = USB_OTG_MODE_DEVICE,
+    };
+    esp_err_t ret = usb_new_phy(&phy_config, &phy);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "USB PHY init failed: %s", esp_err_to_name(ret));
+        return ret;
+    }
+    if (!tusb_init()) {
+        ESP_LOGE(TAG, "TinyUSB init failed");
+        return ESP_FAIL;
+    }
+    BaseType_t ok = xTaskCreatePinnedToCore(tusb_device_task, "tusb", 4096, NULL, CONFIG_UAC_TINYUSB_TASK_PRIORITY,
+                                            NULL, CONFIG_UAC_TINYUSB_TASK_CORE < 0 ? tskNO_AFFINITY
+                                                                                   : CONFIG_UAC_TINYUSB_TASK_CORE);
+    return ok == pdPASS ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+// ====================== Vendor requests ======================
+static usb_composite_vendor_cb_t vendor_cb;
+static uint8_t vendor_data[USB_COMPOSITE_VENDOR_MAX_LEN];
+
+void usb_composite_set_vendor_cb(usb_composite_vendor_cb_t cb)
+{
+    vendor_cb = cb;
+}
+
+bool tud_vendor_control_xfer_cb(uint8_t rhport, uint8_t stage, tusb_control_request_t const *request)
+{
+    // host to device with a data stage only, anything else is stalled
+    if (!vendor_cb || request->bmRequestType_bit.direction != TUSB_DIR_OUT || request->wLength == 0 ||
+        request->wLength > sizeof(vendor_data)) {
+        return false;
+    }
+    if (stage == CONTROL_STAGE_SETUP) {
+        return tud_control_xfer(rhport, request, vendor_data, request->wLength);
+    }
+    if (stage == CONTROL_STAGE_ACK) {
+        vendor_cb(request->bRequest, vendor_data, request->wLength);
+    }
+    return true;
+}
+
+size_t usb_composite_cdc_write(const uint8_t *data, size_t len)
+{
+    // nobody listening - don't fill the FIFO with stale packets
+    if (!tud_cdc_connected()) {
+        return 0;
+    }
+    // whole packets only, the reader resyncs on 0xA6 but a torn packet is
+    // just wasted bandwidth
+    if (tud_cdc_write_available() < len) {
+        return 0;
+    }
+    size_t written = tud_cdc_write(data, len);
+    tud_cdc_write_flush();
+    return written;
+}
+
+#endif // CONFIG_APP_TELEMETRY_ENABLE
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Brings up TinyUSB as a UAC + CDC ACM composite device. Call before
+// uac_device_init() (needs CONFIG_USB_DEVICE_UAC_AS_PART).
+esp_err_t usb_composite_init(void);
+
+// Queue `data` on the CDC port without blocking. Writes all of it or nothing
+// and returns the number of bytes queued.
+size_t usb_composite_cdc_write(const uint8_t *data, size_t len);
+
+// Largest data stage accepted on a vendor control request
+#define USB_COMPOSITE_VENDOR_MAX_LEN 512
+
+// Called from the TinyUSB task once a host to device vendor request
+// (bmRequestType 0x40) and its data have arrived. Keep it short - copy the
+// data and hand it on.
+typedef void (*usb_composite_vendor_cb_t)(uint8_t request, const uint8_t *data, size_t len);
+
+// Accept vendor control requests and pass them to `cb`. Without a callback
+// they are stalled.
+void usb_composite_set_vendor_cb(usb_composite_vendor_cb_t cb);
+
+#ifdef __cplusplus
+}
+#endif